@@ -63,6 +63,7 @@ function build() {
         "dirio.c",
         "dynlib.c",
         "env.c",
+        "epoll.c",
         "err.c",
         "errno.c",
         "exec.c",
@@ -76,6 +77,7 @@ function build() {
         "if.c",
         "inet.c",
         "init.c",
+        "ioring.c",
         "kerror.c",
         "langinfo.c",
         "line.c",
@@ -0,0 +1,394 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    epoll.c
+
+Abstract:
+
+    This module implements the event polling interface on top of kernel event
+    queues.
+
+Author:
+
+    Minoca Corp. 16-Oct-2026
+
+Environment:
+
+    User Mode C Library
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include "libcp.h"
+#include <errno.h>
+#include <sys/epoll.h>
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+#define ASSERT_EPOLL_FLAGS_EQUIVALENT() \
+    ASSERT((EPOLLIN == POLL_EVENT_IN) && \
+           (EPOLLRDBAND == POLL_EVENT_IN_HIGH_PRIORITY) && \
+           (EPOLLOUT == POLL_EVENT_OUT) && \
+           (EPOLLWRBAND == POLL_EVENT_OUT_HIGH_PRIORITY) && \
+           (EPOLLERR == POLL_EVENT_ERROR) && \
+           (EPOLLHUP == POLL_EVENT_DISCONNECTED))
+
+#define ASSERT_EPOLL_STRUCTURE_EQUIVALENT() \
+    ASSERT((sizeof(struct epoll_event) == sizeof(EVENT_QUEUE_EVENT)) && \
+           (FIELD_OFFSET(struct epoll_event, data) == \
+            FIELD_OFFSET(EVENT_QUEUE_EVENT, Data)))
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the set of event bits that are passed through to the kernel.
+//
+
+#define EPOLL_EVENT_MASK \
+    (EPOLLIN | EPOLLRDBAND | EPOLLOUT | EPOLLWRBAND | EPOLLERR | EPOLLHUP)
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+LIBC_API
+int
+epoll_create (
+    int Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates an event polling descriptor.
+
+Arguments:
+
+    Size - Supplies a hint as to the number of descriptors that will be
+        registered. This is ignored, but must be greater than zero.
+
+Return Value:
+
+    Returns the new event polling descriptor on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    if (Size <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return epoll_create1(0);
+}
+
+LIBC_API
+int
+epoll_create1 (
+    int Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates an event polling descriptor.
+
+Arguments:
+
+    Flags - Supplies a bitfield of flags. Only EPOLL_CLOEXEC is accepted.
+
+Return Value:
+
+    Returns the new event polling descriptor on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    HANDLE Handle;
+    ULONG OpenFlags;
+    KSTATUS Status;
+
+    if ((Flags & ~EPOLL_CLOEXEC) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    OpenFlags = 0;
+    if ((Flags & EPOLL_CLOEXEC) != 0) {
+        OpenFlags |= SYS_OPEN_FLAG_CLOSE_ON_EXECUTE;
+    }
+
+    Status = OsCreateEventQueue(OpenFlags, &Handle);
+    if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    return (int)(UINTN)Handle;
+}
+
+LIBC_API
+int
+epoll_ctl (
+    int EventPoll,
+    int Operation,
+    int Descriptor,
+    struct epoll_event *Event
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds, modifies, or removes a descriptor's registration with
+    an event polling descriptor.
+
+Arguments:
+
+    EventPoll - Supplies the event polling descriptor.
+
+    Operation - Supplies the operation to perform. See EPOLL_CTL_*
+        definitions.
+
+    Descriptor - Supplies the descriptor whose registration is changing.
+
+    Event - Supplies a pointer to the events and data to register. This is
+        ignored for EPOLL_CTL_DEL.
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    ULONGLONG Data;
+    ULONG Events;
+    ULONG Flags;
+    EVENT_QUEUE_OPERATION QueueOperation;
+    KSTATUS Status;
+
+    ASSERT_EPOLL_FLAGS_EQUIVALENT();
+
+    switch (Operation) {
+    case EPOLL_CTL_ADD:
+        QueueOperation = EventQueueOperationAdd;
+        break;
+
+    case EPOLL_CTL_MOD:
+        QueueOperation = EventQueueOperationModify;
+        break;
+
+    case EPOLL_CTL_DEL:
+        QueueOperation = EventQueueOperationDelete;
+        break;
+
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+
+    Data = 0;
+    Events = 0;
+    Flags = 0;
+    if (QueueOperation != EventQueueOperationDelete) {
+        if (Event == NULL) {
+            errno = EFAULT;
+            return -1;
+        }
+
+        Data = Event->data.u64;
+        Events = Event->events & EPOLL_EVENT_MASK;
+        if ((Event->events & EPOLLET) != 0) {
+            Flags |= EVENT_QUEUE_FLAG_EDGE_TRIGGERED;
+        }
+
+        if ((Event->events & EPOLLONESHOT) != 0) {
+            Flags |= EVENT_QUEUE_FLAG_ONE_SHOT;
+        }
+    }
+
+    Status = OsEventQueueControl((HANDLE)(UINTN)EventPoll,
+                                 QueueOperation,
+                                 (HANDLE)(UINTN)Descriptor,
+                                 Events,
+                                 Flags,
+                                 Data);
+
+    if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    return 0;
+}
+
+LIBC_API
+int
+epoll_wait (
+    int EventPoll,
+    struct epoll_event *Events,
+    int EventCount,
+    int Timeout
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits for events on an event polling descriptor.
+
+Arguments:
+
+    EventPoll - Supplies the event polling descriptor.
+
+    Events - Supplies a pointer to an array where ready events are returned.
+
+    EventCount - Supplies the number of elements in the array. This must be
+        greater than zero.
+
+    Timeout - Supplies the amount of time in milliseconds to block before
+        giving up and returning anyway. Supply 0 to not block at all, and
+        supply -1 to wait for an indefinite amount of time.
+
+Return Value:
+
+    Returns the number of events returned on success.
+
+    Returns 0 to indicate a timeout.
+
+    Returns -1 to indicate an error, and errno will be set to contain more
+    information.
+
+--*/
+
+{
+
+    return epoll_pwait(EventPoll, Events, EventCount, Timeout, NULL);
+}
+
+LIBC_API
+int
+epoll_pwait (
+    int EventPoll,
+    struct epoll_event *Events,
+    int EventCount,
+    int Timeout,
+    const sigset_t *SignalMask
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits for events on an event polling descriptor, setting the
+    given signal mask for the duration of the wait.
+
+Arguments:
+
+    EventPoll - Supplies the event polling descriptor.
+
+    Events - Supplies a pointer to an array where ready events are returned.
+
+    EventCount - Supplies the number of elements in the array. This must be
+        greater than zero.
+
+    Timeout - Supplies the amount of time in milliseconds to block before
+        giving up and returning anyway. Supply 0 to not block at all, and
+        supply -1 to wait for an indefinite amount of time.
+
+    SignalMask - Supplies an optional pointer to a signal mask to set
+        atomically for the duration of the wait.
+
+Return Value:
+
+    Returns the number of events returned on success.
+
+    Returns 0 to indicate a timeout.
+
+    Returns -1 to indicate an error, and errno will be set to contain more
+    information.
+
+--*/
+
+{
+
+    ULONG EventsReturned;
+    KSTATUS Status;
+    ULONG TimeoutMilliseconds;
+
+    ASSERT_EPOLL_STRUCTURE_EQUIVALENT();
+
+    if (EventCount <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (Timeout < 0) {
+        TimeoutMilliseconds = SYS_WAIT_TIME_INDEFINITE;
+
+    } else {
+        TimeoutMilliseconds = Timeout;
+    }
+
+    Status = OsEventQueueWait((HANDLE)(UINTN)EventPoll,
+                              (PSIGNAL_SET)SignalMask,
+                              (PEVENT_QUEUE_EVENT)Events,
+                              EventCount,
+                              TimeoutMilliseconds,
+                              &EventsReturned);
+
+    if ((!KSUCCESS(Status)) && (Status != STATUS_TIMEOUT)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    if (!KSUCCESS(Status)) {
+        EventsReturned = 0;
+    }
+
+    return (int)EventsReturned;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
@@ -39,6 +39,7 @@ Module Name:
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
@@ -1128,6 +1129,83 @@ Return Value:
     return (ssize_t)BytesCompleted;
 }
 
+LIBC_API
+ssize_t
+sendfile (
+    int OutputDescriptor,
+    int InputDescriptor,
+    off_t *Offset,
+    size_t Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies data from one descriptor to another without passing it
+    through user mode. When the output is a socket, the file's cached pages
+    are handed directly to the network stack.
+
+Arguments:
+
+    OutputDescriptor - Supplies the descriptor to write to, usually a socket.
+
+    InputDescriptor - Supplies the descriptor of the file to read from.
+
+    Offset - Supplies an optional pointer to the file offset to start reading
+        from. On return, it is updated to the offset after the last byte
+        transferred. The input's file position is not changed. If this is NULL,
+        the input's file position is used and updated instead.
+
+    Size - Supplies the number of bytes to transfer.
+
+Return Value:
+
+    Returns the number of bytes transferred on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    UINTN BytesCompleted;
+    IO_OFFSET FileOffset;
+    KSTATUS Status;
+
+    if (Size > (size_t)SSIZE_MAX) {
+        Size = (size_t)SSIZE_MAX;
+    }
+
+    FileOffset = IO_OFFSET_NONE;
+    if (Offset != NULL) {
+        if (*Offset < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        FileOffset = *Offset;
+    }
+
+    Status = OsSendFile((HANDLE)(UINTN)OutputDescriptor,
+                        (HANDLE)(UINTN)InputDescriptor,
+                        FileOffset,
+                        Size,
+                        SYS_WAIT_TIME_INDEFINITE,
+                        &BytesCompleted);
+
+    if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    if (Offset != NULL) {
+        *Offset += BytesCompleted;
+    }
+
+    return (ssize_t)BytesCompleted;
+}
+
 LIBC_API
 int
 fsync (
@@ -3348,71 +3426,33 @@ Return Value:
     return 0;
 }
 
-//
-// --------------------------------------------------------- Internal Functions
-//
-
-int
-ClpOpen (
-    int Directory,
-    const char *Path,
-    int OpenFlags,
-    va_list ArgumentList
+ULONG
+ClpConvertOpenFlags (
+    INT OpenFlags
     )
 
 /*++
 
 Routine Description:
 
-    This routine opens a file and connects it to a file descriptor.
+    This routine converts a set of C library open flags into their system
+    equivalents.
 
 Arguments:
 
-    Directory - Supplies an optional file descriptor. If the given path
-        is a relative path, the directory referenced by this descriptor will
-        be used as a starting point for path resolution. Supply AT_FDCWD to
-        use the working directory for relative paths. This is normally the
-        expected behavior.
-
-    Path - Supplies a pointer to a null terminated string containing the path
-        of the file to open.
-
     OpenFlags - Supplies a set of flags ORed together. See O_* definitions.
 
-    ArgumentList - Supplies the variadic arguments to the open call.
-
 Return Value:
 
-    Returns a file descriptor on success.
-
-    -1 on failure. The errno variable will be set to indicate the error.
+    Returns the system open flags. See SYS_OPEN_FLAG_* definitions.
 
 --*/
 
 {
 
-    mode_t CreateMode;
-    FILE_PERMISSIONS CreatePermissions;
-    HANDLE FileHandle;
-    ULONG OsOpenFlags;
-    ULONG PathLength;
-    KSTATUS Status;
+    ULONG SystemFlags;
 
-    if (Path == NULL) {
-        errno = EINVAL;
-        return -1;
-    }
-
-    PathLength = RtlStringLength((PSTR)Path) + 1;
-    OsOpenFlags = 0;
-    CreatePermissions = 0;
-
-    //
-    // This assert stands for not just the openat call, but for all the *at
-    // calls out there that rely on this assumption.
-    //
-
-    assert(INVALID_HANDLE == (HANDLE)AT_FDCWD);
+    SystemFlags = 0;
 
     //
     // Set the access mask.
@@ -3420,15 +3460,15 @@ Return Value:
 
     switch (OpenFlags & O_ACCMODE) {
     case O_RDONLY:
-        OsOpenFlags |= SYS_OPEN_FLAG_READ;
+        SystemFlags |= SYS_OPEN_FLAG_READ;
         break;
 
     case O_WRONLY:
-        OsOpenFlags |= SYS_OPEN_FLAG_WRITE;
+        SystemFlags |= SYS_OPEN_FLAG_WRITE;
         break;
 
     case O_RDWR:
-        OsOpenFlags |= SYS_OPEN_FLAG_READ | SYS_OPEN_FLAG_WRITE;
+        SystemFlags |= SYS_OPEN_FLAG_READ | SYS_OPEN_FLAG_WRITE;
         break;
 
     default:
@@ -3438,45 +3478,45 @@ Return Value:
     assert(O_EXEC == O_SEARCH);
 
     if ((OpenFlags & O_EXEC) != 0) {
-        OsOpenFlags |= SYS_OPEN_FLAG_EXECUTE;
+        SystemFlags |= SYS_OPEN_FLAG_EXECUTE;
     }
 
     if ((OpenFlags & O_TRUNC) != 0) {
-        OsOpenFlags |= SYS_OPEN_FLAG_TRUNCATE;
+        SystemFlags |= SYS_OPEN_FLAG_TRUNCATE;
     }
 
     if ((OpenFlags & O_APPEND) != 0) {
-        OsOpenFlags |= SYS_OPEN_FLAG_APPEND;
+        SystemFlags |= SYS_OPEN_FLAG_APPEND;
     }
 
     if ((OpenFlags & O_NONBLOCK) != 0) {
-        OsOpenFlags |= SYS_OPEN_FLAG_NON_BLOCKING;
+        SystemFlags |= SYS_OPEN_FLAG_NON_BLOCKING;
     }
 
     if ((OpenFlags & O_DIRECTORY) != 0) {
-        OsOpenFlags |= SYS_OPEN_FLAG_DIRECTORY;
+        SystemFlags |= SYS_OPEN_FLAG_DIRECTORY;
     }
 
     if ((OpenFlags & O_NOFOLLOW) != 0) {
-        OsOpenFlags |= SYS_OPEN_FLAG_NO_SYMBOLIC_LINK;
+        SystemFlags |= SYS_OPEN_FLAG_NO_SYMBOLIC_LINK;
     }
 
     if ((OpenFlags & O_NOATIME) != 0) {
-        OsOpenFlags |= SYS_OPEN_FLAG_NO_ACCESS_TIME;
+        SystemFlags |= SYS_OPEN_FLAG_NO_ACCESS_TIME;
     }
 
     assert((O_SYNC == O_DSYNC) && (O_SYNC == O_RSYNC));
 
     if ((OpenFlags & O_SYNC) != 0) {
-        OsOpenFlags |= SYS_OPEN_FLAG_SYNCHRONIZED;
+        SystemFlags |= SYS_OPEN_FLAG_SYNCHRONIZED;
     }
 
     if ((OpenFlags & O_NOCTTY) != 0) {
-        OsOpenFlags |= SYS_OPEN_FLAG_NO_CONTROLLING_TERMINAL;
+        SystemFlags |= SYS_OPEN_FLAG_NO_CONTROLLING_TERMINAL;
     }
 
     if ((OpenFlags & O_CLOEXEC) != 0) {
-        OsOpenFlags |= SYS_OPEN_FLAG_CLOSE_ON_EXECUTE;
+        SystemFlags |= SYS_OPEN_FLAG_CLOSE_ON_EXECUTE;
     }
 
     //
@@ -3484,12 +3524,12 @@ Return Value:
     //
 
     if ((OpenFlags & O_PATH) != 0) {
-        OsOpenFlags &= ~(SYS_OPEN_FLAG_READ | SYS_OPEN_FLAG_WRITE |
+        SystemFlags &= ~(SYS_OPEN_FLAG_READ | SYS_OPEN_FLAG_WRITE |
                          SYS_OPEN_FLAG_EXECUTE);
     }
 
     if ((OpenFlags & O_ASYNC) != 0) {
-        OsOpenFlags |= SYS_OPEN_FLAG_ASYNCHRONOUS;
+        SystemFlags |= SYS_OPEN_FLAG_ASYNCHRONOUS;
     }
 
     //
@@ -3497,11 +3537,82 @@ Return Value:
     //
 
     if ((OpenFlags & O_CREAT) != 0) {
-        OsOpenFlags |= SYS_OPEN_FLAG_CREATE;
+        SystemFlags |= SYS_OPEN_FLAG_CREATE;
         if ((OpenFlags & O_EXCL) != 0) {
-            OsOpenFlags |= SYS_OPEN_FLAG_FAIL_IF_EXISTS;
+            SystemFlags |= SYS_OPEN_FLAG_FAIL_IF_EXISTS;
         }
+    }
+
+    return SystemFlags;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+int
+ClpOpen (
+    int Directory,
+    const char *Path,
+    int OpenFlags,
+    va_list ArgumentList
+    )
+
+/*++
+
+Routine Description:
+
+    This routine opens a file and connects it to a file descriptor.
+
+Arguments:
+
+    Directory - Supplies an optional file descriptor. If the given path
+        is a relative path, the directory referenced by this descriptor will
+        be used as a starting point for path resolution. Supply AT_FDCWD to
+        use the working directory for relative paths. This is normally the
+        expected behavior.
 
+    Path - Supplies a pointer to a null terminated string containing the path
+        of the file to open.
+
+    OpenFlags - Supplies a set of flags ORed together. See O_* definitions.
+
+    ArgumentList - Supplies the variadic arguments to the open call.
+
+Return Value:
+
+    Returns a file descriptor on success.
+
+    -1 on failure. The errno variable will be set to indicate the error.
+
+--*/
+
+{
+
+    mode_t CreateMode;
+    FILE_PERMISSIONS CreatePermissions;
+    HANDLE FileHandle;
+    ULONG OsOpenFlags;
+    ULONG PathLength;
+    KSTATUS Status;
+
+    if (Path == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    PathLength = RtlStringLength((PSTR)Path) + 1;
+    CreatePermissions = 0;
+
+    //
+    // This assert stands for not just the openat call, but for all the *at
+    // calls out there that rely on this assumption.
+    //
+
+    assert(INVALID_HANDLE == (HANDLE)AT_FDCWD);
+
+    OsOpenFlags = ClpConvertOpenFlags(OpenFlags);
+    if ((OpenFlags & O_CREAT) != 0) {
         CreateMode = va_arg(ArgumentList, mode_t);
 
         ASSERT_FILE_PERMISSIONS_EQUIVALENT();
@@ -0,0 +1,898 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ioring.c
+
+Abstract:
+
+    This module implements the I/O ring interface on top of kernel I/O rings.
+
+Author:
+
+    Minoca Corp. 16-Oct-2026
+
+Environment:
+
+    User Mode C Library
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include "libcp.h"
+#include <errno.h>
+#include <sys/ioring.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// These macros return pointers to the parts of the shared ring memory.
+//
+
+#define IO_RING_HEADER_OF(_Ring) ((PIO_RING_HEADER)((_Ring)->memory))
+
+#define IO_RING_SUBMISSIONS_OF(_Ring) \
+    ((PIO_RING_SUBMISSION)((_Ring)->memory + IO_RING_SUBMISSION_OFFSET))
+
+#define IO_RING_COMPLETIONS_OF(_Ring)                     \
+    ((PIO_RING_COMPLETION)((_Ring)->memory +              \
+                           IO_RING_COMPLETION_OFFSET((_Ring)->sq_entries)))
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the largest number of submission entries a ring can be created
+// with, leaving room for the completion array to be twice as big.
+//
+
+#define IO_RING_MAX_SUBMISSIONS (IO_RING_MAX_ENTRIES / 2)
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+int
+ClpIoRingPrepare (
+    struct io_ring *Ring,
+    IO_RING_OPERATION Operation,
+    ULONG Flags,
+    int FileDescriptor,
+    void *Buffer,
+    size_t Size,
+    off_t Offset,
+    uint64_t UserData
+    );
+
+int
+ClpIoRingEnter (
+    struct io_ring *Ring,
+    ULONG WaitCount,
+    ULONG TimeoutInMilliseconds
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+LIBC_API
+int
+io_ring_init (
+    unsigned int Entries,
+    struct io_ring *Ring,
+    int Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates an I/O ring.
+
+Arguments:
+
+    Entries - Supplies the number of submission entries. This is rounded up
+        to a power of two. The completion array gets twice as many entries.
+
+    Ring - Supplies a pointer to the ring structure to initialize.
+
+    Flags - Supplies a bitfield of flags. See IO_RING_* definitions.
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    ULONG CompletionCount;
+    HANDLE Handle;
+    PVOID Memory;
+    ULONG OpenFlags;
+    ULONG PageSize;
+    UINTN Size;
+    KSTATUS Status;
+    ULONG SubmissionCount;
+
+    if ((Entries == 0) ||
+        (Entries > IO_RING_MAX_SUBMISSIONS) ||
+        ((Flags & ~IO_RING_CLOEXEC) != 0)) {
+
+        errno = EINVAL;
+        return -1;
+    }
+
+    SubmissionCount = 1;
+    while (SubmissionCount < Entries) {
+        SubmissionCount <<= 1;
+    }
+
+    CompletionCount = SubmissionCount * 2;
+    OpenFlags = 0;
+    if ((Flags & IO_RING_CLOEXEC) != 0) {
+        OpenFlags |= SYS_OPEN_FLAG_CLOSE_ON_EXECUTE;
+    }
+
+    //
+    // The ring memory is shared so that a fork leaves the kernel and this
+    // process looking at the same pages rather than a copy-on-write copy.
+    //
+
+    PageSize = sysconf(_SC_PAGE_SIZE);
+    Size = IO_RING_SIZE(SubmissionCount, CompletionCount);
+    Size = ALIGN_RANGE_UP(Size, PageSize);
+    Status = OsMemoryMap(INVALID_HANDLE,
+                         0,
+                         Size,
+                         SYS_MAP_FLAG_READ | SYS_MAP_FLAG_WRITE |
+                         SYS_MAP_FLAG_SHARED | SYS_MAP_FLAG_ANONYMOUS,
+                         &Memory);
+
+    if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    Status = OsCreateIoRing(Memory,
+                            Size,
+                            SubmissionCount,
+                            CompletionCount,
+                            OpenFlags,
+                            &Handle);
+
+    if (!KSUCCESS(Status)) {
+        OsMemoryUnmap(Memory, Size);
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    Ring->fd = (int)(UINTN)Handle;
+    Ring->memory = Memory;
+    Ring->size = Size;
+    Ring->sq_entries = SubmissionCount;
+    Ring->cq_entries = CompletionCount;
+    Ring->sq_tail = 0;
+    return 0;
+}
+
+LIBC_API
+void
+io_ring_destroy (
+    struct io_ring *Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys an I/O ring. Requests still in flight finish in the
+    background, but their results are lost.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    //
+    // The kernel keeps its own lock on the ring pages until the last
+    // request drains, so the mapping can go right away.
+    //
+
+    OsClose((HANDLE)(UINTN)Ring->fd);
+    OsMemoryUnmap(Ring->memory, Ring->size);
+    Ring->fd = -1;
+    Ring->memory = NULL;
+    Ring->size = 0;
+    return;
+}
+
+LIBC_API
+int
+io_ring_prep_read (
+    struct io_ring *Ring,
+    int FileDescriptor,
+    void *Buffer,
+    size_t ByteCount,
+    off_t Offset,
+    uint64_t UserData
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prepares a read request on the ring. It is not started until
+    the next submit.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    FileDescriptor - Supplies the descriptor to read from.
+
+    Buffer - Supplies the buffer to read into. It must stay valid until the
+        request completes.
+
+    ByteCount - Supplies the number of bytes to read.
+
+    Offset - Supplies the offset to read from, or IO_RING_OFFSET_CURRENT to
+        use the current file position.
+
+    UserData - Supplies a value returned with the completion.
+
+Return Value:
+
+    0 on success.
+
+    -1 if the submission array is full, and errno will be set to EAGAIN.
+
+--*/
+
+{
+
+    return ClpIoRingPrepare(Ring,
+                            IoRingOperationRead,
+                            0,
+                            FileDescriptor,
+                            Buffer,
+                            ByteCount,
+                            Offset,
+                            UserData);
+}
+
+LIBC_API
+int
+io_ring_prep_write (
+    struct io_ring *Ring,
+    int FileDescriptor,
+    const void *Buffer,
+    size_t ByteCount,
+    off_t Offset,
+    uint64_t UserData
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prepares a write request on the ring. It is not started
+    until the next submit.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    FileDescriptor - Supplies the descriptor to write to.
+
+    Buffer - Supplies the data to write. It must stay valid until the request
+        completes.
+
+    ByteCount - Supplies the number of bytes to write.
+
+    Offset - Supplies the offset to write to, or IO_RING_OFFSET_CURRENT to use
+        the current file position.
+
+    UserData - Supplies a value returned with the completion.
+
+Return Value:
+
+    0 on success.
+
+    -1 if the submission array is full, and errno will be set to EAGAIN.
+
+--*/
+
+{
+
+    return ClpIoRingPrepare(Ring,
+                            IoRingOperationWrite,
+                            0,
+                            FileDescriptor,
+                            (void *)Buffer,
+                            ByteCount,
+                            Offset,
+                            UserData);
+}
+
+LIBC_API
+int
+io_ring_prep_accept (
+    struct io_ring *Ring,
+    int Socket,
+    int Flags,
+    uint64_t UserData
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prepares an accept request on the ring. It is not started
+    until the next submit.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Socket - Supplies the listening socket.
+
+    Flags - Supplies a bitfield of flags for the new descriptor. Only
+        SOCK_NONBLOCK and SOCK_CLOEXEC are accepted.
+
+    UserData - Supplies a value returned with the completion.
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    ULONG OpenFlags;
+
+    if ((Flags & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    OpenFlags = 0;
+    if ((Flags & SOCK_CLOEXEC) != 0) {
+        OpenFlags |= SYS_OPEN_FLAG_CLOSE_ON_EXECUTE;
+    }
+
+    if ((Flags & SOCK_NONBLOCK) != 0) {
+        OpenFlags |= SYS_OPEN_FLAG_NON_BLOCKING;
+    }
+
+    return ClpIoRingPrepare(Ring,
+                            IoRingOperationAccept,
+                            OpenFlags,
+                            Socket,
+                            NULL,
+                            0,
+                            0,
+                            UserData);
+}
+
+LIBC_API
+int
+io_ring_prep_send (
+    struct io_ring *Ring,
+    int Socket,
+    const void *Buffer,
+    size_t Length,
+    int Flags,
+    uint64_t UserData
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prepares a socket send request on the ring. It is not
+    started until the next submit.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Socket - Supplies the connected socket.
+
+    Buffer - Supplies the data to send. It must stay valid until the request
+        completes.
+
+    Length - Supplies the number of bytes to send.
+
+    Flags - Supplies a bitfield of MSG_* flags.
+
+    UserData - Supplies a value returned with the completion.
+
+Return Value:
+
+    0 on success.
+
+    -1 if the submission array is full, and errno will be set to EAGAIN.
+
+--*/
+
+{
+
+    //
+    // The MSG_* flags are the same as the kernel's socket I/O flags.
+    //
+
+    return ClpIoRingPrepare(Ring,
+                            IoRingOperationSend,
+                            Flags,
+                            Socket,
+                            (void *)Buffer,
+                            Length,
+                            0,
+                            UserData);
+}
+
+LIBC_API
+int
+io_ring_prep_recv (
+    struct io_ring *Ring,
+    int Socket,
+    void *Buffer,
+    size_t Length,
+    int Flags,
+    uint64_t UserData
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prepares a socket receive request on the ring. It is not
+    started until the next submit.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Socket - Supplies the connected socket.
+
+    Buffer - Supplies the buffer to receive into. It must stay valid until the
+        request completes.
+
+    Length - Supplies the size of the buffer in bytes.
+
+    Flags - Supplies a bitfield of MSG_* flags.
+
+    UserData - Supplies a value returned with the completion.
+
+Return Value:
+
+    0 on success.
+
+    -1 if the submission array is full, and errno will be set to EAGAIN.
+
+--*/
+
+{
+
+    return ClpIoRingPrepare(Ring,
+                            IoRingOperationReceive,
+                            Flags,
+                            Socket,
+                            Buffer,
+                            Length,
+                            0,
+                            UserData);
+}
+
+LIBC_API
+int
+io_ring_prep_fsync (
+    struct io_ring *Ring,
+    int FileDescriptor,
+    uint64_t UserData
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prepares a request to flush a descriptor's data to its
+    backing device. It is not started until the next submit.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    FileDescriptor - Supplies the descriptor to flush.
+
+    UserData - Supplies a value returned with the completion.
+
+Return Value:
+
+    0 on success.
+
+    -1 if the submission array is full, and errno will be set to EAGAIN.
+
+--*/
+
+{
+
+    return ClpIoRingPrepare(Ring,
+                            IoRingOperationFlush,
+                            0,
+                            FileDescriptor,
+                            NULL,
+                            0,
+                            0,
+                            UserData);
+}
+
+LIBC_API
+int
+io_ring_submit (
+    struct io_ring *Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts every prepared request on the ring.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+Return Value:
+
+    Returns the number of requests started. This may be fewer than were
+    prepared if the completion array is nearly full; the rest stay queued.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    return ClpIoRingEnter(Ring, 0, 0);
+}
+
+LIBC_API
+int
+io_ring_submit_and_wait (
+    struct io_ring *Ring,
+    unsigned int WaitCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts every prepared request on the ring and then waits
+    until the given number of completions are ready.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    WaitCount - Supplies the number of completions to wait for.
+
+Return Value:
+
+    Returns the number of requests started.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    return ClpIoRingEnter(Ring, WaitCount, SYS_WAIT_TIME_INDEFINITE);
+}
+
+LIBC_API
+int
+io_ring_peek_cqe (
+    struct io_ring *Ring,
+    struct io_ring_cqe *Completion
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes the oldest completion from the ring without
+    blocking.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Completion - Supplies a pointer where the completion will be returned.
+
+Return Value:
+
+    0 on success.
+
+    -1 if no completion is ready, and errno will be set to EAGAIN.
+
+--*/
+
+{
+
+    PIO_RING_COMPLETION Entry;
+    ULONG Head;
+    PIO_RING_HEADER Header;
+
+    Header = IO_RING_HEADER_OF(Ring);
+    Head = Header->CompletionHead;
+    if (Head == Header->CompletionTail) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    //
+    // Read the entry only after seeing the tail that published it, and hand
+    // the slot back only after the entry has been read.
+    //
+
+    RtlMemoryBarrier();
+    Entry = &(IO_RING_COMPLETIONS_OF(Ring)[Head & (Ring->cq_entries - 1)]);
+    Completion->user_data = Entry->UserData;
+    if (KSUCCESS(Entry->Status) || (Entry->Status == STATUS_END_OF_FILE)) {
+        if (Entry->NewHandle != INVALID_HANDLE) {
+            Completion->res = (ssize_t)(UINTN)(Entry->NewHandle);
+
+        } else {
+            Completion->res = (ssize_t)(Entry->BytesCompleted);
+        }
+
+    } else if ((Entry->Status == STATUS_TIMEOUT) ||
+               (Entry->Status == STATUS_OPERATION_WOULD_BLOCK)) {
+
+        Completion->res = -EAGAIN;
+
+    } else {
+        Completion->res = -ClConvertKstatusToErrorNumber(Entry->Status);
+    }
+
+    RtlMemoryBarrier();
+    Header->CompletionHead = Head + 1;
+    return 0;
+}
+
+LIBC_API
+int
+io_ring_wait_cqe (
+    struct io_ring *Ring,
+    struct io_ring_cqe *Completion,
+    int Timeout
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes the oldest completion from the ring. If none is
+    ready, prepared requests are submitted and the routine waits for one.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Completion - Supplies a pointer where the completion will be returned.
+
+    Timeout - Supplies the amount of time in milliseconds to block before
+        giving up. Supply 0 to not block at all, and supply -1 to wait for an
+        indefinite amount of time.
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure, and errno will be set to contain more information. errno
+    is set to EAGAIN if the timeout expired.
+
+--*/
+
+{
+
+    ULONG TimeoutMilliseconds;
+
+    if (io_ring_peek_cqe(Ring, Completion) == 0) {
+        return 0;
+    }
+
+    if (Timeout < 0) {
+        TimeoutMilliseconds = SYS_WAIT_TIME_INDEFINITE;
+
+    } else {
+        TimeoutMilliseconds = Timeout;
+    }
+
+    if (ClpIoRingEnter(Ring, 1, TimeoutMilliseconds) < 0) {
+        return -1;
+    }
+
+    return io_ring_peek_cqe(Ring, Completion);
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+int
+ClpIoRingPrepare (
+    struct io_ring *Ring,
+    IO_RING_OPERATION Operation,
+    ULONG Flags,
+    int FileDescriptor,
+    void *Buffer,
+    size_t Size,
+    off_t Offset,
+    uint64_t UserData
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fills in the next free submission entry on the ring. The
+    entry is not visible to the kernel until the next submit.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Operation - Supplies the operation to perform.
+
+    Flags - Supplies the operation-specific flags.
+
+    FileDescriptor - Supplies the descriptor to operate on.
+
+    Buffer - Supplies an optional pointer to the data buffer.
+
+    Size - Supplies the size of the data buffer in bytes.
+
+    Offset - Supplies the file offset for reads and writes.
+
+    UserData - Supplies the value to return with the completion.
+
+Return Value:
+
+    0 on success.
+
+    -1 if the submission array is full, and errno will be set to EAGAIN.
+
+--*/
+
+{
+
+    PIO_RING_SUBMISSION Entry;
+    PIO_RING_HEADER Header;
+
+    Header = IO_RING_HEADER_OF(Ring);
+    if ((Ring->sq_tail - Header->SubmissionHead) >= Ring->sq_entries) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    Entry = &(IO_RING_SUBMISSIONS_OF(Ring)[Ring->sq_tail &
+                                           (Ring->sq_entries - 1)]);
+
+    Entry->Operation = Operation;
+    Entry->Flags = Flags;
+    Entry->Handle = (HANDLE)(UINTN)FileDescriptor;
+    Entry->Buffer = Buffer;
+    Entry->Size = Size;
+    Entry->Offset = Offset;
+    if (Offset == IO_RING_OFFSET_CURRENT) {
+        Entry->Offset = IO_OFFSET_NONE;
+    }
+
+    Entry->UserData = UserData;
+    Ring->sq_tail += 1;
+    return 0;
+}
+
+int
+ClpIoRingEnter (
+    struct io_ring *Ring,
+    ULONG WaitCount,
+    ULONG TimeoutInMilliseconds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine publishes the prepared submissions to the kernel and
+    optionally waits for completions.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    WaitCount - Supplies the number of ready completions to wait for.
+
+    TimeoutInMilliseconds - Supplies the time to wait, in milliseconds.
+
+Return Value:
+
+    Returns the number of requests started.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    PIO_RING_HEADER Header;
+    KSTATUS Status;
+    ULONG Submitted;
+
+    //
+    // Make the entries visible before the tail that publishes them.
+    //
+
+    Header = IO_RING_HEADER_OF(Ring);
+    RtlMemoryBarrier();
+    Header->SubmissionTail = Ring->sq_tail;
+    Status = OsIoRingEnter((HANDLE)(UINTN)Ring->fd,
+                           Ring->sq_tail - Header->SubmissionHead,
+                           WaitCount,
+                           TimeoutInMilliseconds,
+                           &Submitted);
+
+    if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    if ((WaitCount != 0) &&
+        (Header->CompletionTail - Header->CompletionHead < WaitCount) &&
+        (TimeoutInMilliseconds != SYS_WAIT_TIME_INDEFINITE)) {
+
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return (int)Submitted;
+}
+
@@ -341,6 +341,129 @@ Return Value:
     return 0;
 }
 
+LIBC_API
+int
+posix_madvise (
+    void *Address,
+    size_t Length,
+    int Advice
+    )
+
+/*++
+
+Routine Description:
+
+    This routine advises the system about how the application expects to use
+    the given region of memory, so that the system can tune how the region is
+    paged in.
+
+Arguments:
+
+    Address - Supplies the page-aligned start of the region.
+
+    Length - Supplies the size, in bytes, of the region.
+
+    Advice - Supplies the advice. See POSIX_MADV_* for definitions.
+
+Return Value:
+
+    Returns 0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    ULONG OsAdvice;
+    KSTATUS Status;
+
+    switch (Advice) {
+    case POSIX_MADV_NORMAL:
+        OsAdvice = 0;
+        break;
+
+    case POSIX_MADV_SEQUENTIAL:
+        OsAdvice = SYS_MAP_FLAG_SEQUENTIAL;
+        break;
+
+    case POSIX_MADV_RANDOM:
+        OsAdvice = SYS_MAP_FLAG_RANDOM;
+        break;
+
+    case POSIX_MADV_WILLNEED:
+        OsAdvice = SYS_MAP_FLAG_WILL_NEED;
+        break;
+
+    case POSIX_MADV_DONTNEED:
+        return 0;
+
+    default:
+        return EINVAL;
+    }
+
+    Status = OsMemoryAdvise(Address, Length, OsAdvice);
+    if (!KSUCCESS(Status)) {
+        return ClConvertKstatusToErrorNumber(Status);
+    }
+
+    return 0;
+}
+
+LIBC_API
+int
+madvise (
+    void *Address,
+    size_t Length,
+    int Advice
+    )
+
+/*++
+
+Routine Description:
+
+    This routine advises the system about how the application expects to use
+    the given region of memory, so that the system can tune how the region is
+    paged in.
+
+Arguments:
+
+    Address - Supplies the page-aligned start of the region.
+
+    Length - Supplies the size, in bytes, of the region.
+
+    Advice - Supplies the advice. See MADV_* for definitions.
+
+Return Value:
+
+    Returns 0 on success.
+
+    -1 on failure. The errno variable will be set to indicate the error.
+
+--*/
+
+{
+
+    int Result;
+
+    //
+    // The discarding flavor of "don't need" is not supported.
+    //
+
+    if (Advice == POSIX_MADV_DONTNEED) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    Result = posix_madvise(Address, Length, Advice);
+    if (Result != 0) {
+        errno = Result;
+        return -1;
+    }
+
+    return 0;
+}
+
 LIBC_API
 int
 shm_open (
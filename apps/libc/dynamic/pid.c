@@ -34,6 +34,7 @@ Module Name:
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/resource.h>
 
 //
 // ---------------------------------------------------------------- Definitions
@@ -1226,11 +1227,24 @@ Return Value:
 
 {
 
-    //
-    // TODO: Implement nice.
-    //
+    int Value;
 
-    return 0;
+    errno = 0;
+    Value = getpriority(PRIO_PROCESS, 0);
+    if ((Value == -1) && (errno != 0)) {
+        return -1;
+    }
+
+    Value += Increment;
+    if (setpriority(PRIO_PROCESS, 0, Value) != 0) {
+        if (errno == EACCES) {
+            errno = EPERM;
+        }
+
+        return -1;
+    }
+
+    return getpriority(PRIO_PROCESS, 0);
 }
 
 //
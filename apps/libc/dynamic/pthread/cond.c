@@ -104,6 +104,8 @@ Return Value:
     PPTHREAD_CONDITION ConditionInternal;
 
     ConditionInternal = (PPTHREAD_CONDITION)Condition;
+    ConditionInternal->Waiters = 0;
+    ConditionInternal->Mutex = NULL;
     if (Attribute == NULL) {
         ConditionInternal->State = 0;
         return 0;
@@ -578,7 +580,12 @@ Return Value:
 
 {
 
+    pthread_mutex_t *Mutex;
+    ULONG NewState;
     ULONG Operation;
+    ULONG RequeueCount;
+    BOOL Shared;
+    KSTATUS Status;
     ULONG ThreadCount;
 
     //
@@ -586,14 +593,50 @@ Return Value:
     // get into the kernel.
     //
 
-    RtlAtomicAdd32(&(Condition->State), 1 << PTHREAD_CONDITION_COUNTER_SHIFT);
-    ThreadCount = Count;
-    Operation = UserLockWake;
-    if ((Condition->State & PTHREAD_CONDITION_SHARED) == 0) {
+    NewState = RtlAtomicAdd32(&(Condition->State),
+                              1 << PTHREAD_CONDITION_COUNTER_SHIFT);
+
+    NewState += 1 << PTHREAD_CONDITION_COUNTER_SHIFT;
+    Operation = 0;
+    Shared = TRUE;
+    if ((NewState & PTHREAD_CONDITION_SHARED) == 0) {
         Operation |= USER_LOCK_PRIVATE;
+        Shared = FALSE;
+    }
+
+    //
+    // When waking several threads, wake just one and move the rest directly
+    // onto the mutex they are all about to fight over. They then get woken
+    // one at a time as the mutex is released. The mutex is only touched if
+    // there are waiters, which guarantees it is still around. The recorded
+    // mutex is an address in the waiter's process, so shared conditions
+    // always just wake everyone.
+    //
+
+    if ((Shared == FALSE) && (Count > 1) && (Condition->Waiters > 1)) {
+        Mutex = Condition->Mutex;
+        if ((Mutex != NULL) && (ClpCanRequeueToMutex(Mutex, Shared) != FALSE)) {
+            ThreadCount = 1;
+            RequeueCount = Count - 1;
+            Status = OsUserLockPair(&(Condition->State),
+                                    Operation | UserLockRequeue,
+                                    &ThreadCount,
+                                    &(((PPTHREAD_MUTEX)Mutex)->State),
+                                    &RequeueCount,
+                                    NewState);
+
+            if (KSUCCESS(Status)) {
+                return 0;
+            }
+        }
     }
 
-    OsUserLock(&(Condition->State), Operation, &ThreadCount, 0);
+    ThreadCount = Count;
+    OsUserLock(&(Condition->State),
+               Operation | UserLockWake,
+               &ThreadCount,
+               0);
+
     return 0;
 }
 
@@ -650,6 +693,18 @@ Return Value:
 
     OldState = Condition->State;
 
+    //
+    // Record the mutex so that a broadcast can requeue waiters onto it. The
+    // address means nothing to other processes, so skip it for shared
+    // conditions.
+    //
+
+    if ((OldState & PTHREAD_CONDITION_SHARED) == 0) {
+        Condition->Mutex = Mutex;
+    }
+
+    RtlAtomicAdd32(&(Condition->Waiters), 1);
+
     //
     // Unlock the mutex and perform the wait.
     //
@@ -690,7 +745,8 @@ Return Value:
 
     } while (KernelStatus == STATUS_INTERRUPTED);
 
-    pthread_mutex_lock(Mutex);
+    RtlAtomicAdd32(&(Condition->Waiters), -1);
+    ClpAcquireMutexAfterConditionWait(Mutex);
     if (KernelStatus == STATUS_TIMEOUT) {
         return ETIMEDOUT;
     }
@@ -782,6 +782,128 @@ Return Value:
     return Result;
 }
 
+BOOL
+ClpCanRequeueToMutex (
+    pthread_mutex_t *Mutex,
+    BOOL Shared
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether condition variable waiters can be moved
+    directly onto the given mutex's wait queue by the kernel.
+
+Arguments:
+
+    Mutex - Supplies a pointer to the mutex.
+
+    Shared - Supplies a boolean indicating whether the condition variable is
+        shared between processes.
+
+Return Value:
+
+    TRUE if waiters can be requeued onto the mutex.
+
+    FALSE if the waiters need to be woken directly.
+
+--*/
+
+{
+
+    BOOL MutexShared;
+    ULONG State;
+
+    //
+    // Only normal mutexes can take requeued waiters, since the others track
+    // ownership that a requeued waiter would not set up. The kernel keys
+    // private and shared locks differently, so those must match too.
+    //
+
+    State = ((PPTHREAD_MUTEX)Mutex)->State;
+    if ((State & PTHREAD_MUTEX_STATE_TYPE_MASK) != 0) {
+        return FALSE;
+    }
+
+    MutexShared = FALSE;
+    if ((State & PTHREAD_MUTEX_STATE_SHARED) != 0) {
+        MutexShared = TRUE;
+    }
+
+    if (MutexShared != Shared) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+int
+ClpAcquireMutexAfterConditionWait (
+    pthread_mutex_t *Mutex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reacquires a mutex after waiting on a condition variable.
+    Other waiters may have been requeued onto the mutex behind its back, so
+    normal mutexes are always acquired in the contended state to make sure
+    the release wakes the next one.
+
+Arguments:
+
+    Mutex - Supplies a pointer to the mutex to acquire.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    ULONG LockedWithWaiters;
+    PPTHREAD_MUTEX MutexInternal;
+    ULONG OldState;
+    ULONG Operation;
+    ULONG Shared;
+    ULONG Unlocked;
+
+    MutexInternal = (PPTHREAD_MUTEX)Mutex;
+    if ((MutexInternal->State & PTHREAD_MUTEX_STATE_TYPE_MASK) != 0) {
+        return pthread_mutex_lock(Mutex);
+    }
+
+    Shared = MutexInternal->State & PTHREAD_MUTEX_STATE_SHARED;
+    LockedWithWaiters = Shared | PTHREAD_MUTEX_STATE_LOCKED_WITH_WAITERS;
+    Unlocked = Shared | PTHREAD_MUTEX_STATE_UNLOCKED;
+    Operation = UserLockWait;
+    if (Shared == 0) {
+        Operation |= USER_LOCK_PRIVATE;
+    }
+
+    while (TRUE) {
+        OldState = RtlAtomicExchange32(&(MutexInternal->State),
+                                       LockedWithWaiters);
+
+        if (OldState == Unlocked) {
+            break;
+        }
+
+        OldState = LockedWithWaiters;
+        OsUserLock(&(MutexInternal->State),
+                   Operation,
+                   &OldState,
+                   SYS_WAIT_TIME_INDEFINITE);
+    }
+
+    return 0;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
@@ -547,6 +547,13 @@ Return Value:
     //
 
     ClpDestroyThreadKeyData(Thread);
+
+    //
+    // Hand any memory this thread has cached back to the heap now that
+    // nothing else will run on it that might allocate.
+    //
+
+    OsHeapFlushThreadCache();
     DestroyRegion = NULL;
     DestroyRegionSize = 0;
 
@@ -141,10 +141,18 @@ Structure Description:
 
     State - Stores the state of the condition variable.
 
+    Waiters - Stores the number of threads currently waiting on the condition
+        variable.
+
+    Mutex - Stores a pointer to the mutex most recently used to wait on the
+        condition variable. Broadcasts requeue waiters directly onto it.
+
 --*/
 
 typedef struct _PTHREAD_CONDITION {
     ULONG State;
+    ULONG Waiters;
+    pthread_mutex_t *Mutex;
 } PTHREAD_CONDITION, *PPTHREAD_CONDITION;
 
 /*++
@@ -444,6 +452,60 @@ Return Value:
 
 --*/
 
+BOOL
+ClpCanRequeueToMutex (
+    pthread_mutex_t *Mutex,
+    BOOL Shared
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines whether condition variable waiters can be moved
+    directly onto the given mutex's wait queue by the kernel.
+
+Arguments:
+
+    Mutex - Supplies a pointer to the mutex.
+
+    Shared - Supplies a boolean indicating whether the condition variable is
+        shared between processes.
+
+Return Value:
+
+    TRUE if waiters can be requeued onto the mutex.
+
+    FALSE if the waiters need to be woken directly.
+
+--*/
+
+int
+ClpAcquireMutexAfterConditionWait (
+    pthread_mutex_t *Mutex
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reacquires a mutex after waiting on a condition variable.
+    Other waiters may have been requeued onto the mutex behind its back, so
+    normal mutexes are always acquired in the contended state to make sure
+    the release wakes the next one.
+
+Arguments:
+
+    Mutex - Supplies a pointer to the mutex to acquire.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
 ULONG
 ClpConvertAbsoluteTimespecToRelativeMilliseconds (
     const struct timespec *AbsoluteTime,
@@ -104,17 +104,42 @@ Return Value:
     nice value.
 
     -1 on failure, and the errno variable will be set to contain more
-    information.
+    information. Only PRIO_PROCESS is supported, so errno is set to EINVAL
+    for process groups and users.
 
 --*/
 
 {
 
+    SCHEDULER_CLASS Class;
+    LONG Priority;
+    KSTATUS Status;
+
     //
-    // TODO: Implement getpriority.
+    // Nice values are only tracked per process, so there is no single value
+    // to report for a process group or user.
     //
 
-    return 0;
+    if (Which != PRIO_PROCESS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    Status = OsSetScheduling(Who, NULL, 0, &Class, &Priority);
+    if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    //
+    // Real-time processes don't have a nice value.
+    //
+
+    if (Class != SchedulerClassFairShare) {
+        return 0;
+    }
+
+    return Priority;
 }
 
 LIBC_API
@@ -148,18 +173,54 @@ Return Value:
     0 on success.
 
     -1 on failure, and the errno variable will be set to contain more
-    information.
+    information. Only PRIO_PROCESS is supported, so errno is set to EINVAL
+    for process groups and users.
 
 --*/
 
 {
 
+    SCHEDULER_CLASS Class;
+    KSTATUS Status;
+
     //
-    // TODO: Implement setpriority.
+    // Setting the nice value of every process in a group or owned by a user
+    // is not supported.
     //
 
-    errno = ENOSYS;
-    return -1;
+    if (Which != PRIO_PROCESS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (Value < SCHEDULER_NICE_MIN) {
+        Value = SCHEDULER_NICE_MIN;
+
+    } else if (Value > SCHEDULER_NICE_MAX) {
+        Value = SCHEDULER_NICE_MAX;
+    }
+
+    Status = OsSetScheduling(Who, NULL, 0, &Class, NULL);
+    if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    //
+    // The nice value has no effect on real-time processes.
+    //
+
+    if (Class != SchedulerClassFairShare) {
+        return 0;
+    }
+
+    Status = OsSetScheduling(Who, &Class, Value, NULL, NULL);
+    if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    return 0;
 }
 
 LIBC_API
@@ -45,6 +45,17 @@ Module Name:
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+int
+ClpConvertSchedulingPolicyToClass (
+    int Policy,
+    PSCHEDULER_CLASS Class
+    );
+
+int
+ClpConvertSchedulerClassToPolicy (
+    SCHEDULER_CLASS Class
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -94,7 +105,409 @@ Return Value:
     return 0;
 }
 
+LIBC_API
+int
+sched_get_priority_max (
+    int Policy
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the maximum priority value for the given scheduling
+    policy.
+
+Arguments:
+
+    Policy - Supplies the scheduling policy. See SCHED_* definitions.
+
+Return Value:
+
+    Returns the maximum priority value on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+{
+
+    switch (Policy) {
+    case SCHED_OTHER:
+        return 0;
+
+    case SCHED_FIFO:
+    case SCHED_RR:
+        return SCHEDULER_REAL_TIME_PRIORITY_MAX;
+
+    default:
+        break;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+LIBC_API
+int
+sched_get_priority_min (
+    int Policy
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the minimum priority value for the given scheduling
+    policy.
+
+Arguments:
+
+    Policy - Supplies the scheduling policy. See SCHED_* definitions.
+
+Return Value:
+
+    Returns the minimum priority value on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+{
+
+    switch (Policy) {
+    case SCHED_OTHER:
+        return 0;
+
+    case SCHED_FIFO:
+    case SCHED_RR:
+        return SCHEDULER_REAL_TIME_PRIORITY_MIN;
+
+    default:
+        break;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+LIBC_API
+int
+sched_getscheduler (
+    pid_t ProcessId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the scheduling policy of the given process.
+
+Arguments:
+
+    ProcessId - Supplies the ID of the process to query. Supply zero to query
+        the current process.
+
+Return Value:
+
+    Returns the scheduling policy on success. See SCHED_* definitions.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+{
+
+    SCHEDULER_CLASS Class;
+    KSTATUS Status;
+
+    Status = OsSetScheduling(ProcessId, NULL, 0, &Class, NULL);
+    if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    return ClpConvertSchedulerClassToPolicy(Class);
+}
+
+LIBC_API
+int
+sched_setscheduler (
+    pid_t ProcessId,
+    int Policy,
+    const struct sched_param *Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the scheduling policy and priority of the given process.
+
+Arguments:
+
+    ProcessId - Supplies the ID of the process to modify. Supply zero to modify
+        the current process.
+
+    Policy - Supplies the new scheduling policy. See SCHED_* definitions.
+
+    Parameter - Supplies a pointer to the scheduling parameters. For SCHED_FIFO
+        and SCHED_RR this contains the fixed priority. For SCHED_OTHER the
+        priority must be zero.
+
+Return Value:
+
+    Returns the previous scheduling policy on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+{
+
+    SCHEDULER_CLASS Class;
+    SCHEDULER_CLASS OldClass;
+    LONG OldPriority;
+    LONG Priority;
+    int Result;
+    KSTATUS Status;
+
+    if (Parameter == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    Result = ClpConvertSchedulingPolicyToClass(Policy, &Class);
+    if (Result != 0) {
+        errno = Result;
+        return -1;
+    }
+
+    if ((Parameter->__sched_priority < sched_get_priority_min(Policy)) ||
+        (Parameter->__sched_priority > sched_get_priority_max(Policy))) {
+
+        errno = EINVAL;
+        return -1;
+    }
+
+    //
+    // The nice value is not part of the POSIX scheduling parameters, so keep
+    // the current nice value when moving to or staying in the time sharing
+    // policy.
+    //
+
+    Status = OsSetScheduling(ProcessId, NULL, 0, &OldClass, &OldPriority);
+    if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    Priority = Parameter->__sched_priority;
+    if (Class == SchedulerClassFairShare) {
+        Priority = SCHEDULER_NICE_DEFAULT;
+        if (OldClass == SchedulerClassFairShare) {
+            Priority = OldPriority;
+        }
+    }
+
+    Status = OsSetScheduling(ProcessId, &Class, Priority, &OldClass, NULL);
+    if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    return ClpConvertSchedulerClassToPolicy(OldClass);
+}
+
+LIBC_API
+int
+sched_getparam (
+    pid_t ProcessId,
+    struct sched_param *Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the scheduling parameters of the given process.
+
+Arguments:
+
+    ProcessId - Supplies the ID of the process to query. Supply zero to query
+        the current process.
+
+    Parameter - Supplies a pointer where the scheduling parameters will be
+        returned.
+
+Return Value:
+
+    0 on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+{
+
+    SCHEDULER_CLASS Class;
+    LONG Priority;
+    KSTATUS Status;
+
+    if (Parameter == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    Status = OsSetScheduling(ProcessId, NULL, 0, &Class, &Priority);
+    if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    if (Class == SchedulerClassFairShare) {
+        Priority = 0;
+    }
+
+    Parameter->__sched_priority = Priority;
+    return 0;
+}
+
+LIBC_API
+int
+sched_setparam (
+    pid_t ProcessId,
+    const struct sched_param *Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the scheduling parameters of the given process without
+    changing its policy.
+
+Arguments:
+
+    ProcessId - Supplies the ID of the process to modify. Supply zero to modify
+        the current process.
+
+    Parameter - Supplies a pointer to the new scheduling parameters.
+
+Return Value:
+
+    0 on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+{
+
+    int Policy;
+    int Result;
+
+    Policy = sched_getscheduler(ProcessId);
+    if (Policy < 0) {
+        return -1;
+    }
+
+    Result = sched_setscheduler(ProcessId, Policy, Parameter);
+    if (Result < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
 
+int
+ClpConvertSchedulingPolicyToClass (
+    int Policy,
+    PSCHEDULER_CLASS Class
+    )
+
+/*++
+
+Routine Description:
+
+    This routine converts a POSIX scheduling policy into a kernel scheduling
+    class.
+
+Arguments:
+
+    Policy - Supplies the scheduling policy. See SCHED_* definitions.
+
+    Class - Supplies a pointer where the scheduling class will be returned.
+
+Return Value:
+
+    0 on success.
+
+    EINVAL if the policy is not valid.
+
+--*/
+
+{
+
+    switch (Policy) {
+    case SCHED_OTHER:
+        *Class = SchedulerClassFairShare;
+        break;
+
+    case SCHED_FIFO:
+        *Class = SchedulerClassRealTimeFifo;
+        break;
+
+    case SCHED_RR:
+        *Class = SchedulerClassRealTimeRoundRobin;
+        break;
+
+    default:
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+int
+ClpConvertSchedulerClassToPolicy (
+    SCHEDULER_CLASS Class
+    )
+
+/*++
+
+Routine Description:
+
+    This routine converts a kernel scheduling class into a POSIX scheduling
+    policy.
+
+Arguments:
+
+    Class - Supplies the scheduling class.
+
+Return Value:
+
+    Returns the corresponding SCHED_* value.
+
+--*/
+
+{
+
+    switch (Class) {
+    case SchedulerClassRealTimeFifo:
+        return SCHED_FIFO;
+
+    case SchedulerClassRealTimeRoundRobin:
+        return SCHED_RR;
+
+    default:
+        break;
+    }
+
+    return SCHED_OTHER;
+}
+
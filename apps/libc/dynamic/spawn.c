@@ -209,6 +209,21 @@ ClpPosixSpawn (
     BOOL UsePath
     );
 
+KSTATUS
+ClpSpawnImage (
+    pid_t *ChildPid,
+    const char *Path,
+    PPOSIX_SPAWN_FILE_ACTION FileActions,
+    PPOSIX_SPAWN_ATTRIBUTES Attributes,
+    char *const Arguments[],
+    char *const Environment[]
+    );
+
+PSTR
+ClpSpawnSearchPath (
+    const char *File
+    );
+
 INT
 ClpProcessSpawnAttributes (
     PPOSIX_SPAWN_ATTRIBUTES Attributes
@@ -1184,12 +1199,56 @@ Return Value:
 {
 
     volatile int Error;
+    PPOSIX_SPAWN_ATTRIBUTES ImageAttributes;
+    PPOSIX_SPAWN_FILE_ACTION ImageFileActions;
+    PSTR ImagePath;
     pid_t Pid;
+    KSTATUS Status;
 
     //
-    // TODO: Use vfork when it is implemented.
+    // Have the kernel build the child straight from the image. This avoids
+    // duplicating this process' address space only to throw it away on exec.
+    // Scripts need an interpreter found by exec, so they take the fork path
+    // below.
     //
 
+    ImagePath = (PSTR)Path;
+    if ((UsePath != FALSE) && (strchr(Path, '/') == NULL)) {
+        ImagePath = ClpSpawnSearchPath(Path);
+        if (ImagePath == NULL) {
+            return errno;
+        }
+    }
+
+    ImageAttributes = NULL;
+    if (Attributes != NULL) {
+        ImageAttributes = *Attributes;
+    }
+
+    ImageFileActions = NULL;
+    if (FileActions != NULL) {
+        ImageFileActions = *FileActions;
+    }
+
+    Status = ClpSpawnImage(ChildPid,
+                           ImagePath,
+                           ImageFileActions,
+                           ImageAttributes,
+                           Arguments,
+                           Environment);
+
+    if (ImagePath != Path) {
+        free(ImagePath);
+    }
+
+    if (Status != STATUS_UNKNOWN_IMAGE_FORMAT) {
+        if (!KSUCCESS(Status)) {
+            return ClConvertKstatusToErrorNumber(Status);
+        }
+
+        return 0;
+    }
+
     Error = 0;
     Pid = fork();
     if (Pid == -1) {
@@ -1259,6 +1318,338 @@ Return Value:
     return Error;
 }
 
+KSTATUS
+ClpSpawnImage (
+    pid_t *ChildPid,
+    const char *Path,
+    PPOSIX_SPAWN_FILE_ACTION FileActions,
+    PPOSIX_SPAWN_ATTRIBUTES Attributes,
+    char *const Arguments[],
+    char *const Environment[]
+    )
+
+/*++
+
+Routine Description:
+
+    This routine asks the kernel to create a child process running the given
+    image, with the file actions and attributes applied in the child.
+
+Arguments:
+
+    ChildPid - Supplies an optional pointer where the child process ID will be
+        returned on success.
+
+    Path - Supplies a pointer to the path of the image to execute.
+
+    FileActions - Supplies an optional pointer to the file actions to execute
+        in the child.
+
+    Attributes - Supplies an optional pointer to the spawn attributes.
+
+    Arguments - Supplies the arguments to pass to the new child.
+
+    Environment - Supplies the environment to pass to the new child, or NULL
+        to use the current environment.
+
+Return Value:
+
+    STATUS_SUCCESS if the child is running.
+
+    STATUS_UNKNOWN_IMAGE_FORMAT if the path is not a binary image. No child is
+    created in this case.
+
+    Other error codes on failure.
+
+--*/
+
+{
+
+    PSPAWN_FILE_ACTION Action;
+    ULONG ActionCount;
+    PSPAWN_FILE_ACTION Actions;
+    UINTN ArgumentCount;
+    UINTN ArgumentValuesTotalLength;
+    PLIST_ENTRY CurrentEntry;
+    PSIGNAL_SET DefaultSignals;
+    PPOSIX_SPAWN_FILE_ENTRY Entry;
+    UINTN EnvironmentCount;
+    UINTN EnvironmentValuesTotalLength;
+    ULONG Flags;
+    PROCESS_ID ProcessId;
+    PPROCESS_ENVIRONMENT ProcessEnvironment;
+    PROCESS_GROUP_ID ProcessGroup;
+    PSIGNAL_SET SignalMask;
+    KSTATUS Status;
+
+    Actions = NULL;
+    ActionCount = 0;
+    ArgumentCount = 0;
+    ArgumentValuesTotalLength = 0;
+    DefaultSignals = NULL;
+    EnvironmentCount = 0;
+    EnvironmentValuesTotalLength = 0;
+    Flags = 0;
+    ProcessEnvironment = NULL;
+    ProcessGroup = 0;
+    ProcessId = 0;
+    SignalMask = NULL;
+    if (Environment == NULL) {
+        Environment = environ;
+    }
+
+    while (Arguments[ArgumentCount] != NULL) {
+        ArgumentValuesTotalLength += strlen(Arguments[ArgumentCount]) + 1;
+        ArgumentCount += 1;
+    }
+
+    if (Environment != NULL) {
+        while (Environment[EnvironmentCount] != NULL) {
+            EnvironmentValuesTotalLength +=
+                                     strlen(Environment[EnvironmentCount]) + 1;
+
+            EnvironmentCount += 1;
+        }
+    }
+
+    ProcessEnvironment = OsCreateEnvironment((PSTR)Path,
+                                             strlen(Path) + 1,
+                                             (PSTR *)Arguments,
+                                             ArgumentValuesTotalLength,
+                                             ArgumentCount,
+                                             (PSTR *)Environment,
+                                             EnvironmentValuesTotalLength,
+                                             EnvironmentCount);
+
+    if (ProcessEnvironment == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto SpawnImageEnd;
+    }
+
+    //
+    // Translate the attributes. The scheduling attributes are not supported
+    // on either path.
+    //
+
+    if (Attributes != NULL) {
+        if ((Attributes->Flags & POSIX_SPAWN_RESETIDS) != 0) {
+            Flags |= SPAWN_FLAG_RESET_IDS;
+        }
+
+        if ((Attributes->Flags & POSIX_SPAWN_SETPGROUP) != 0) {
+            Flags |= SPAWN_FLAG_PROCESS_GROUP;
+            ProcessGroup = Attributes->ProcessGroup;
+        }
+
+        if ((Attributes->Flags & POSIX_SPAWN_SETSIGMASK) != 0) {
+            Flags |= SPAWN_FLAG_SIGNAL_MASK;
+            SignalMask = (PSIGNAL_SET)&(Attributes->SignalMask);
+        }
+
+        if ((Attributes->Flags & POSIX_SPAWN_SETSIGDEF) != 0) {
+            Flags |= SPAWN_FLAG_SIGNAL_DEFAULTS;
+            DefaultSignals = (PSIGNAL_SET)&(Attributes->DefaultMask);
+        }
+    }
+
+    //
+    // Flatten the file action list into the array the kernel expects.
+    //
+
+    if (FileActions != NULL) {
+        CurrentEntry = FileActions->EntryList.Next;
+        while (CurrentEntry != &(FileActions->EntryList)) {
+            ActionCount += 1;
+            CurrentEntry = CurrentEntry->Next;
+        }
+    }
+
+    if (ActionCount != 0) {
+        Actions = malloc(ActionCount * sizeof(SPAWN_FILE_ACTION));
+        if (Actions == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto SpawnImageEnd;
+        }
+
+        memset(Actions, 0, ActionCount * sizeof(SPAWN_FILE_ACTION));
+        Action = Actions;
+        CurrentEntry = FileActions->EntryList.Next;
+        while (CurrentEntry != &(FileActions->EntryList)) {
+            Entry = LIST_VALUE(CurrentEntry, POSIX_SPAWN_FILE_ENTRY, ListEntry);
+            CurrentEntry = CurrentEntry->Next;
+            switch (Entry->Action) {
+            case SpawnActionOpen:
+                Action->Type = SpawnFileActionOpen;
+                Action->Handle = (HANDLE)(UINTN)(Entry->U.Open.Descriptor);
+                Action->Path = Entry->U.Open.Path;
+                Action->PathSize = strlen(Entry->U.Open.Path) + 1;
+                Action->Flags = ClpConvertOpenFlags(Entry->U.Open.OpenFlags);
+                if ((Entry->U.Open.OpenFlags & O_CREAT) != 0) {
+
+                    ASSERT_FILE_PERMISSIONS_EQUIVALENT();
+
+                    Action->CreatePermissions = Entry->U.Open.CreateMode;
+                }
+
+                break;
+
+            case SpawnActionDup2:
+                Action->Type = SpawnFileActionDuplicate;
+                Action->SourceHandle =
+                                  (HANDLE)(UINTN)(Entry->U.Dup2.Descriptor);
+
+                Action->Handle = (HANDLE)(UINTN)(Entry->U.Dup2.NewDescriptor);
+                break;
+
+            case SpawnActionClose:
+                Action->Type = SpawnFileActionClose;
+                Action->Handle = (HANDLE)(UINTN)(Entry->U.Close.Descriptor);
+                break;
+
+            default:
+
+                assert(FALSE);
+
+                Status = STATUS_INVALID_PARAMETER;
+                goto SpawnImageEnd;
+            }
+
+            Action += 1;
+        }
+    }
+
+    Status = OsSpawnProcess(ProcessEnvironment,
+                            Actions,
+                            ActionCount,
+                            Flags,
+                            ProcessGroup,
+                            SignalMask,
+                            DefaultSignals,
+                            &ProcessId);
+
+    //
+    // If the child was created but failed to start, it has already exited.
+    // Reap it so the caller never sees it.
+    //
+
+    if (!KSUCCESS(Status)) {
+        if (ProcessId != 0) {
+            waitpid(ProcessId, NULL, 0);
+        }
+
+        goto SpawnImageEnd;
+    }
+
+    if (ChildPid != NULL) {
+        *ChildPid = ProcessId;
+    }
+
+SpawnImageEnd:
+    if (Actions != NULL) {
+        free(Actions);
+    }
+
+    if (ProcessEnvironment != NULL) {
+        OsDestroyEnvironment(ProcessEnvironment);
+    }
+
+    return Status;
+}
+
+PSTR
+ClpSpawnSearchPath (
+    const char *File
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds an executable file on the PATH, in the same way that
+    execvp would.
+
+Arguments:
+
+    File - Supplies a pointer to the name of the executable, which does not
+        contain a slash.
+
+Return Value:
+
+    Returns a pointer to the full path of the executable on success. The
+    caller is responsible for freeing this memory.
+
+    NULL on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    PSTR CombinedPath;
+    size_t FileLength;
+    PCSTR PathEntry;
+    size_t PathEntryLength;
+    PCSTR PathEnd;
+    PSTR PathVariable;
+
+    PathVariable = getenv("PATH");
+    if ((PathVariable == NULL) || (*PathVariable == '\0')) {
+        return strdup(File);
+    }
+
+    CombinedPath = NULL;
+    errno = ENOENT;
+    FileLength = strlen(File);
+
+    //
+    // Split the path by hand rather than with strtok, since an empty entry
+    // (a leading or trailing colon, or two in a row) means the current
+    // directory and must not be skipped.
+    //
+
+    PathEntry = PathVariable;
+    while (TRUE) {
+        PathEnd = strchr(PathEntry, ':');
+        if (PathEnd == NULL) {
+            PathEntryLength = strlen(PathEntry);
+
+        } else {
+            PathEntryLength = PathEnd - PathEntry;
+        }
+
+        if (PathEntryLength == 0) {
+            PathEntry = ".";
+            PathEntryLength = 1;
+        }
+
+        if (PathEntry[PathEntryLength - 1] == '/') {
+            PathEntryLength -= 1;
+        }
+
+        CombinedPath = malloc(PathEntryLength + FileLength + 2);
+        if (CombinedPath == NULL) {
+            errno = ENOMEM;
+            break;
+        }
+
+        memcpy(CombinedPath, PathEntry, PathEntryLength);
+        CombinedPath[PathEntryLength] = '/';
+        strcpy(CombinedPath + PathEntryLength + 1, File);
+        if (access(CombinedPath, X_OK) == 0) {
+            break;
+        }
+
+        free(CombinedPath);
+        CombinedPath = NULL;
+        if (PathEnd == NULL) {
+            break;
+        }
+
+        PathEntry = PathEnd + 1;
+    }
+
+    return CombinedPath;
+}
+
 INT
 ClpProcessSpawnAttributes (
     PPOSIX_SPAWN_ATTRIBUTES Attributes
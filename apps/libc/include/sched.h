@@ -41,6 +41,30 @@ extern "C" {
 
 #endif
 
+//
+// Define the scheduling policies.
+//
+
+//
+// The default time sharing policy. Threads get a share of the processor
+// weighted by their nice value.
+//
+
+#define SCHED_OTHER 0
+
+//
+// A fixed priority policy where threads run until they block or yield.
+//
+
+#define SCHED_FIFO 1
+
+//
+// A fixed priority policy where threads at the same priority are rotated
+// when their time slice expires.
+//
+
+#define SCHED_RR 2
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -94,6 +118,172 @@ Return Value:
 
 --*/
 
+LIBC_API
+int
+sched_get_priority_max (
+    int Policy
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the maximum priority value for the given scheduling
+    policy.
+
+Arguments:
+
+    Policy - Supplies the scheduling policy. See SCHED_* definitions.
+
+Return Value:
+
+    Returns the maximum priority value on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+LIBC_API
+int
+sched_get_priority_min (
+    int Policy
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the minimum priority value for the given scheduling
+    policy.
+
+Arguments:
+
+    Policy - Supplies the scheduling policy. See SCHED_* definitions.
+
+Return Value:
+
+    Returns the minimum priority value on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+LIBC_API
+int
+sched_getscheduler (
+    pid_t ProcessId
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the scheduling policy of the given process.
+
+Arguments:
+
+    ProcessId - Supplies the ID of the process to query. Supply zero to query
+        the current process.
+
+Return Value:
+
+    Returns the scheduling policy on success. See SCHED_* definitions.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+LIBC_API
+int
+sched_setscheduler (
+    pid_t ProcessId,
+    int Policy,
+    const struct sched_param *Parameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets the scheduling policy and priority of the given process.
+
+Arguments:
+
+    ProcessId - Supplies the ID of the process to modify. Supply zero to modify
+        the current process.
+
+    Policy - Supplies the new scheduling policy. See SCHED_* definitions.
+
+    Parameter - Supplies a pointer to the scheduling parameters. For SCHED_FIFO
+        and SCHED_RR this contains the fixed priority. For SCHED_OTHER the
+        priority must be zero.
+
+Return Value:
+
+    Returns the previous scheduling policy on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+LIBC_API
+int
+sched_getparam (
+    pid_t ProcessId,
+    struct sched_param *Parameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the scheduling parameters of the given process.
+
+Arguments:
+
+    ProcessId - Supplies the ID of the process to query. Supply zero to query
+        the current process.
+
+    Parameter - Supplies a pointer where the scheduling parameters will be
+        returned.
+
+Return Value:
+
+    0 on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+LIBC_API
+int
+sched_setparam (
+    pid_t ProcessId,
+    const struct sched_param *Parameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets the scheduling parameters of the given process without
+    changing its policy.
+
+Arguments:
+
+    ProcessId - Supplies the ID of the process to modify. Supply zero to modify
+        the current process.
+
+    Parameter - Supplies a pointer to the new scheduling parameters.
+
+Return Value:
+
+    0 on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
 #ifdef __cplusplus
 
 }
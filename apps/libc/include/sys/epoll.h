@@ -0,0 +1,320 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    epoll.h
+
+Abstract:
+
+    This header contains definitions for event polling, which reports
+    readiness for a set of descriptors registered once up front.
+
+Author:
+
+    Minoca Corp. 16-Oct-2026
+
+--*/
+
+#ifndef _SYS_EPOLL_H
+#define _SYS_EPOLL_H
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <libcbase.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#ifdef __cplusplus
+
+extern "C" {
+
+#endif
+
+//
+// Define the event flags. The basic events match the poll flags.
+//
+
+#define EPOLLIN POLLIN
+#define EPOLLPRI POLLPRI
+#define EPOLLOUT POLLOUT
+#define EPOLLRDNORM POLLRDNORM
+#define EPOLLRDBAND POLLRDBAND
+#define EPOLLWRNORM POLLWRNORM
+#define EPOLLWRBAND POLLWRBAND
+#define EPOLLERR POLLERR
+#define EPOLLHUP POLLHUP
+
+//
+// This flag requests that the descriptor be reported only once per event
+// after which it is disabled until it is modified with EPOLL_CTL_MOD.
+//
+
+#define EPOLLONESHOT (1U << 30)
+
+//
+// This flag requests edge-triggered reporting: the descriptor is reported
+// when an event is signaled, not for as long as it remains set.
+//
+
+#define EPOLLET (1U << 31)
+
+//
+// Define the flags that can be passed to epoll_create1.
+//
+
+#define EPOLL_CLOEXEC 0x00004000
+
+//
+// Define the operations for epoll_ctl.
+//
+
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This union defines the caller-defined data associated with a registered
+    descriptor.
+
+Members:
+
+    ptr - Stores a pointer.
+
+    fd - Stores a file descriptor.
+
+    u32 - Stores a 32-bit value.
+
+    u64 - Stores a 64-bit value.
+
+--*/
+
+typedef union epoll_data {
+    void *ptr;
+    int fd;
+    uint32_t u32;
+    uint64_t u64;
+} epoll_data_t;
+
+/*++
+
+Structure Description:
+
+    This structure defines an event polling registration or result.
+
+Members:
+
+    events - Stores the mask of events. See EPOLL* definitions.
+
+    data - Stores the caller-defined data associated with the descriptor.
+
+--*/
+
+struct epoll_event {
+    uint32_t events;
+    epoll_data_t data;
+};
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+LIBC_API
+int
+epoll_create (
+    int Size
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates an event polling descriptor.
+
+Arguments:
+
+    Size - Supplies a hint as to the number of descriptors that will be
+        registered. This is ignored, but must be greater than zero.
+
+Return Value:
+
+    Returns the new event polling descriptor on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+epoll_create1 (
+    int Flags
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates an event polling descriptor.
+
+Arguments:
+
+    Flags - Supplies a bitfield of flags. Only EPOLL_CLOEXEC is accepted.
+
+Return Value:
+
+    Returns the new event polling descriptor on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+epoll_ctl (
+    int EventPoll,
+    int Operation,
+    int Descriptor,
+    struct epoll_event *Event
+    );
+
+/*++
+
+Routine Description:
+
+    This routine adds, modifies, or removes a descriptor's registration with
+    an event polling descriptor.
+
+Arguments:
+
+    EventPoll - Supplies the event polling descriptor.
+
+    Operation - Supplies the operation to perform. See EPOLL_CTL_*
+        definitions.
+
+    Descriptor - Supplies the descriptor whose registration is changing.
+
+    Event - Supplies a pointer to the events and data to register. This is
+        ignored for EPOLL_CTL_DEL.
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+epoll_wait (
+    int EventPoll,
+    struct epoll_event *Events,
+    int EventCount,
+    int Timeout
+    );
+
+/*++
+
+Routine Description:
+
+    This routine waits for events on an event polling descriptor.
+
+Arguments:
+
+    EventPoll - Supplies the event polling descriptor.
+
+    Events - Supplies a pointer to an array where ready events are returned.
+
+    EventCount - Supplies the number of elements in the array. This must be
+        greater than zero.
+
+    Timeout - Supplies the amount of time in milliseconds to block before
+        giving up and returning anyway. Supply 0 to not block at all, and
+        supply -1 to wait for an indefinite amount of time.
+
+Return Value:
+
+    Returns the number of events returned on success.
+
+    Returns 0 to indicate a timeout.
+
+    Returns -1 to indicate an error, and errno will be set to contain more
+    information.
+
+--*/
+
+LIBC_API
+int
+epoll_pwait (
+    int EventPoll,
+    struct epoll_event *Events,
+    int EventCount,
+    int Timeout,
+    const sigset_t *SignalMask
+    );
+
+/*++
+
+Routine Description:
+
+    This routine waits for events on an event polling descriptor, setting the
+    given signal mask for the duration of the wait.
+
+Arguments:
+
+    EventPoll - Supplies the event polling descriptor.
+
+    Events - Supplies a pointer to an array where ready events are returned.
+
+    EventCount - Supplies the number of elements in the array. This must be
+        greater than zero.
+
+    Timeout - Supplies the amount of time in milliseconds to block before
+        giving up and returning anyway. Supply 0 to not block at all, and
+        supply -1 to wait for an indefinite amount of time.
+
+    SignalMask - Supplies an optional pointer to a signal mask to set
+        atomically for the duration of the wait.
+
+Return Value:
+
+    Returns the number of events returned on success.
+
+    Returns 0 to indicate a timeout.
+
+    Returns -1 to indicate an error, and errno will be set to contain more
+    information.
+
+--*/
+
+#ifdef __cplusplus
+
+}
+
+#endif
+#endif
+
@@ -0,0 +1,539 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ioring.h
+
+Abstract:
+
+    This header contains definitions for I/O rings, which queue batches of
+    I/O requests to the kernel and collect their results through shared
+    memory.
+
+Author:
+
+    Minoca Corp. 16-Oct-2026
+
+--*/
+
+#ifndef _SYS_IORING_H
+#define _SYS_IORING_H
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <libcbase.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#ifdef __cplusplus
+
+extern "C" {
+
+#endif
+
+//
+// Define the flags that can be passed to io_ring_init.
+//
+
+//
+// This flag sets the close-on-execute flag on the ring descriptor.
+//
+
+#define IO_RING_CLOEXEC 0x00000001
+
+//
+// Supply this offset to read or write at the descriptor's current file
+// position, advancing it.
+//
+
+#define IO_RING_OFFSET_CURRENT ((off_t)-1)
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines an I/O ring. Its members are private to the C
+    library.
+
+Members:
+
+    fd - Stores the ring descriptor.
+
+    memory - Stores a pointer to the memory shared with the kernel.
+
+    size - Stores the size of the shared memory in bytes.
+
+    sq_entries - Stores the number of submission entries.
+
+    cq_entries - Stores the number of completion entries.
+
+    sq_tail - Stores the index one past the last prepared submission. This
+        runs ahead of the shared tail until the next submit.
+
+--*/
+
+struct io_ring {
+    int fd;
+    void *memory;
+    size_t size;
+    unsigned int sq_entries;
+    unsigned int cq_entries;
+    unsigned int sq_tail;
+};
+
+/*++
+
+Structure Description:
+
+    This structure defines the result of a completed I/O ring request.
+
+Members:
+
+    user_data - Stores the caller-defined value supplied when the request was
+        prepared.
+
+    res - Stores the result of the request. For reads, writes, sends, and
+        receives this is the number of bytes transferred. For accepts it is
+        the new descriptor. For fsync it is zero. On failure it is the
+        negative of the error number.
+
+--*/
+
+struct io_ring_cqe {
+    uint64_t user_data;
+    ssize_t res;
+};
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+LIBC_API
+int
+io_ring_init (
+    unsigned int Entries,
+    struct io_ring *Ring,
+    int Flags
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates an I/O ring.
+
+Arguments:
+
+    Entries - Supplies the number of submission entries. This is rounded up
+        to a power of two. The completion array gets twice as many entries.
+
+    Ring - Supplies a pointer to the ring structure to initialize.
+
+    Flags - Supplies a bitfield of flags. See IO_RING_* definitions.
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+void
+io_ring_destroy (
+    struct io_ring *Ring
+    );
+
+/*++
+
+Routine Description:
+
+    This routine destroys an I/O ring. Requests still in flight finish in the
+    background, but their results are lost.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+LIBC_API
+int
+io_ring_prep_read (
+    struct io_ring *Ring,
+    int FileDescriptor,
+    void *Buffer,
+    size_t ByteCount,
+    off_t Offset,
+    uint64_t UserData
+    );
+
+/*++
+
+Routine Description:
+
+    This routine prepares a read request on the ring. It is not started until
+    the next submit.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    FileDescriptor - Supplies the descriptor to read from.
+
+    Buffer - Supplies the buffer to read into. It must stay valid until the
+        request completes.
+
+    ByteCount - Supplies the number of bytes to read.
+
+    Offset - Supplies the offset to read from, or IO_RING_OFFSET_CURRENT to
+        use the current file position.
+
+    UserData - Supplies a value returned with the completion.
+
+Return Value:
+
+    0 on success.
+
+    -1 if the submission array is full, and errno will be set to EAGAIN.
+
+--*/
+
+LIBC_API
+int
+io_ring_prep_write (
+    struct io_ring *Ring,
+    int FileDescriptor,
+    const void *Buffer,
+    size_t ByteCount,
+    off_t Offset,
+    uint64_t UserData
+    );
+
+/*++
+
+Routine Description:
+
+    This routine prepares a write request on the ring. It is not started
+    until the next submit.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    FileDescriptor - Supplies the descriptor to write to.
+
+    Buffer - Supplies the data to write. It must stay valid until the request
+        completes.
+
+    ByteCount - Supplies the number of bytes to write.
+
+    Offset - Supplies the offset to write to, or IO_RING_OFFSET_CURRENT to use
+        the current file position.
+
+    UserData - Supplies a value returned with the completion.
+
+Return Value:
+
+    0 on success.
+
+    -1 if the submission array is full, and errno will be set to EAGAIN.
+
+--*/
+
+LIBC_API
+int
+io_ring_prep_accept (
+    struct io_ring *Ring,
+    int Socket,
+    int Flags,
+    uint64_t UserData
+    );
+
+/*++
+
+Routine Description:
+
+    This routine prepares an accept request on the ring. It is not started
+    until the next submit.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Socket - Supplies the listening socket.
+
+    Flags - Supplies a bitfield of flags for the new descriptor. Only
+        SOCK_NONBLOCK and SOCK_CLOEXEC are accepted.
+
+    UserData - Supplies a value returned with the completion.
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+io_ring_prep_send (
+    struct io_ring *Ring,
+    int Socket,
+    const void *Buffer,
+    size_t Length,
+    int Flags,
+    uint64_t UserData
+    );
+
+/*++
+
+Routine Description:
+
+    This routine prepares a socket send request on the ring. It is not
+    started until the next submit.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Socket - Supplies the connected socket.
+
+    Buffer - Supplies the data to send. It must stay valid until the request
+        completes.
+
+    Length - Supplies the number of bytes to send.
+
+    Flags - Supplies a bitfield of MSG_* flags.
+
+    UserData - Supplies a value returned with the completion.
+
+Return Value:
+
+    0 on success.
+
+    -1 if the submission array is full, and errno will be set to EAGAIN.
+
+--*/
+
+LIBC_API
+int
+io_ring_prep_recv (
+    struct io_ring *Ring,
+    int Socket,
+    void *Buffer,
+    size_t Length,
+    int Flags,
+    uint64_t UserData
+    );
+
+/*++
+
+Routine Description:
+
+    This routine prepares a socket receive request on the ring. It is not
+    started until the next submit.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Socket - Supplies the connected socket.
+
+    Buffer - Supplies the buffer to receive into. It must stay valid until the
+        request completes.
+
+    Length - Supplies the size of the buffer in bytes.
+
+    Flags - Supplies a bitfield of MSG_* flags.
+
+    UserData - Supplies a value returned with the completion.
+
+Return Value:
+
+    0 on success.
+
+    -1 if the submission array is full, and errno will be set to EAGAIN.
+
+--*/
+
+LIBC_API
+int
+io_ring_prep_fsync (
+    struct io_ring *Ring,
+    int FileDescriptor,
+    uint64_t UserData
+    );
+
+/*++
+
+Routine Description:
+
+    This routine prepares a request to flush a descriptor's data to its
+    backing device. It is not started until the next submit.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    FileDescriptor - Supplies the descriptor to flush.
+
+    UserData - Supplies a value returned with the completion.
+
+Return Value:
+
+    0 on success.
+
+    -1 if the submission array is full, and errno will be set to EAGAIN.
+
+--*/
+
+LIBC_API
+int
+io_ring_submit (
+    struct io_ring *Ring
+    );
+
+/*++
+
+Routine Description:
+
+    This routine starts every prepared request on the ring.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+Return Value:
+
+    Returns the number of requests started. This may be fewer than were
+    prepared if the completion array is nearly full; the rest stay queued.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+io_ring_submit_and_wait (
+    struct io_ring *Ring,
+    unsigned int WaitCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine starts every prepared request on the ring and then waits
+    until the given number of completions are ready.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    WaitCount - Supplies the number of completions to wait for.
+
+Return Value:
+
+    Returns the number of requests started.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+io_ring_peek_cqe (
+    struct io_ring *Ring,
+    struct io_ring_cqe *Completion
+    );
+
+/*++
+
+Routine Description:
+
+    This routine removes the oldest completion from the ring without
+    blocking.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Completion - Supplies a pointer where the completion will be returned.
+
+Return Value:
+
+    0 on success.
+
+    -1 if no completion is ready, and errno will be set to EAGAIN.
+
+--*/
+
+LIBC_API
+int
+io_ring_wait_cqe (
+    struct io_ring *Ring,
+    struct io_ring_cqe *Completion,
+    int Timeout
+    );
+
+/*++
+
+Routine Description:
+
+    This routine removes the oldest completion from the ring. If none is
+    ready, prepared requests are submitted and the routine waits for one.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Completion - Supplies a pointer where the completion will be returned.
+
+    Timeout - Supplies the amount of time in milliseconds to block before
+        giving up. Supply 0 to not block at all, and supply -1 to wait for an
+        indefinite amount of time.
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure, and errno will be set to contain more information. errno
+    is set to EAGAIN if the timeout expired.
+
+--*/
+
+#ifdef __cplusplus
+
+}
+
+#endif
+#endif
+
@@ -126,6 +126,49 @@ extern "C" {
 
 #define MS_INVALIDATE 0x0004
 
+//
+// Define the advice values for posix_madvise. The application has no
+// particular advice for the region.
+//
+
+#define POSIX_MADV_NORMAL 0
+
+//
+// The application expects to access the region sequentially from lower
+// addresses to higher addresses.
+//
+
+#define POSIX_MADV_SEQUENTIAL 1
+
+//
+// The application expects to access the region in a random order.
+//
+
+#define POSIX_MADV_RANDOM 2
+
+//
+// The application expects to access the region soon.
+//
+
+#define POSIX_MADV_WILLNEED 3
+
+//
+// The application does not expect to access the region soon. This is only a
+// hint and is currently ignored.
+//
+
+#define POSIX_MADV_DONTNEED 4
+
+//
+// Define the advice values for madvise. MADV_DONTNEED is deliberately not
+// provided, as applications expect it to discard the region's contents.
+//
+
+#define MADV_NORMAL POSIX_MADV_NORMAL
+#define MADV_SEQUENTIAL POSIX_MADV_SEQUENTIAL
+#define MADV_RANDOM POSIX_MADV_RANDOM
+#define MADV_WILLNEED POSIX_MADV_WILLNEED
+
 //
 // Define the value used to indicate a failed mapping.
 //
@@ -283,6 +326,70 @@ Return Value:
 
 --*/
 
+LIBC_API
+int
+posix_madvise (
+    void *Address,
+    size_t Length,
+    int Advice
+    );
+
+/*++
+
+Routine Description:
+
+    This routine advises the system about how the application expects to use
+    the given region of memory, so that the system can tune how the region is
+    paged in.
+
+Arguments:
+
+    Address - Supplies the page-aligned start of the region.
+
+    Length - Supplies the size, in bytes, of the region.
+
+    Advice - Supplies the advice. See POSIX_MADV_* for definitions.
+
+Return Value:
+
+    Returns 0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+LIBC_API
+int
+madvise (
+    void *Address,
+    size_t Length,
+    int Advice
+    );
+
+/*++
+
+Routine Description:
+
+    This routine advises the system about how the application expects to use
+    the given region of memory, so that the system can tune how the region is
+    paged in.
+
+Arguments:
+
+    Address - Supplies the page-aligned start of the region.
+
+    Length - Supplies the size, in bytes, of the region.
+
+    Advice - Supplies the advice. See MADV_* for definitions.
+
+Return Value:
+
+    Returns 0 on success.
+
+    -1 on failure. The errno variable will be set to indicate the error.
+
+--*/
+
 LIBC_API
 int
 shm_open (
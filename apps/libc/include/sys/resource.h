@@ -322,7 +322,8 @@ Return Value:
     nice value.
 
     -1 on failure, and the errno variable will be set to contain more
-    information.
+    information. Only PRIO_PROCESS is supported, so errno is set to EINVAL
+    for process groups and users.
 
 --*/
 
@@ -357,7 +358,8 @@ Return Value:
     0 on success.
 
     -1 on failure, and the errno variable will be set to contain more
-    information.
+    information. Only PRIO_PROCESS is supported, so errno is set to EINVAL
+    for process groups and users.
 
 --*/
 
@@ -0,0 +1,100 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    sendfile.h
+
+Abstract:
+
+    This header contains definitions for transferring data from a file to
+    another descriptor inside the kernel.
+
+Author:
+
+    Minoca Corp. 16-Oct-2026
+
+--*/
+
+#ifndef _SYS_SENDFILE_H
+#define _SYS_SENDFILE_H
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <sys/types.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#ifdef __cplusplus
+
+extern "C" {
+
+#endif
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+LIBC_API
+ssize_t
+sendfile (
+    int OutputDescriptor,
+    int InputDescriptor,
+    off_t *Offset,
+    size_t Size
+    );
+
+/*++
+
+Routine Description:
+
+    This routine copies data from one descriptor to another without passing it
+    through user mode. When the output is a socket, the file's cached pages
+    are handed directly to the network stack.
+
+Arguments:
+
+    OutputDescriptor - Supplies the descriptor to write to, usually a socket.
+
+    InputDescriptor - Supplies the descriptor of the file to read from.
+
+    Offset - Supplies an optional pointer to the file offset to start reading
+        from. On return, it is updated to the offset after the last byte
+        transferred. The input's file position is not changed. If this is NULL,
+        the input's file position is used and updated instead.
+
+    Size - Supplies the number of bytes to transfer.
+
+Return Value:
+
+    Returns the number of bytes transferred on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+#ifdef __cplusplus
+
+}
+
+#endif
+#endif
+
@@ -47,10 +47,84 @@ Module Name:
 #define SYSTEM_HEAP_MAGIC 0x6C6F6F50 // 'looP'
 #define SYSTEM_HEAP_DIRECT_ALLOCATION_THRESHOLD (256 * _1MB)
 
+//
+// Define the allocation tag used for thread heap caches: OsHc.
+//
+
+#define OS_HEAP_CACHE_ALLOCATION_TAG 0x6348734F
+
+//
+// Define the number of independently locked heaps threads are spread across.
+// The first arena is the one used before thread support is up.
+//
+
+#define OS_HEAP_ARENA_COUNT 8
+
+//
+// Define the number of size classes kept in each thread's cache, and the
+// largest allocation that can be cached.
+//
+
+#define OS_HEAP_CACHE_CLASS_COUNT 10
+#define OS_HEAP_CACHE_MAX_SIZE 512
+#define OS_HEAP_CACHE_NO_CLASS ((ULONG)-1)
+
+//
+// Define the number of objects a thread caches per size class. When the
+// limit is hit, half of them are handed back to the arenas.
+//
+
+#define OS_HEAP_CACHE_CLASS_LIMIT 32
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure defines a heap arena, one of several independent heaps
+    that threads are spread across to avoid all contending on one lock.
+
+Members:
+
+    Heap - Stores the heap itself.
+
+    Lock - Stores the lock serializing access to the heap.
+
+--*/
+
+typedef struct _OS_HEAP_ARENA {
+    MEMORY_HEAP Heap;
+    OS_LOCK Lock;
+} OS_HEAP_ARENA, *POS_HEAP_ARENA;
+
+/*++
+
+Structure Description:
+
+    This structure defines a per-thread cache of small free allocations. The
+    cached objects are still allocated as far as their arenas are concerned,
+    and are linked together through their first word.
+
+Members:
+
+    Arena - Stores a pointer to the arena this thread allocates from.
+
+    FreeList - Stores the head of the singly linked list of free objects for
+        each size class.
+
+    Count - Stores the number of objects on each size class list.
+
+--*/
+
+typedef struct _OS_HEAP_THREAD_CACHE {
+    POS_HEAP_ARENA Arena;
+    PVOID FreeList[OS_HEAP_CACHE_CLASS_COUNT];
+    ULONG Count[OS_HEAP_CACHE_CLASS_COUNT];
+} OS_HEAP_THREAD_CACHE, *POS_HEAP_THREAD_CACHE;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -76,16 +150,56 @@ OspHeapCorruption (
     PVOID Parameter
     );
 
+POS_HEAP_THREAD_CACHE
+OspHeapGetThreadCache (
+    VOID
+    );
+
+POS_HEAP_ARENA
+OspHeapAcquireArena (
+    POS_HEAP_THREAD_CACHE Cache
+    );
+
+POS_HEAP_ARENA
+OspHeapGetOwningArena (
+    PVOID Memory
+    );
+
+ULONG
+OspHeapGetCacheClass (
+    UINTN Size
+    );
+
+VOID
+OspHeapTrimThreadCache (
+    POS_HEAP_THREAD_CACHE Cache,
+    ULONG Class,
+    ULONG Count
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
 //
-// Store the primary heap.
+// Store the heap arenas. The first one is the primary heap.
+//
+
+OS_HEAP_ARENA OsHeapArenas[OS_HEAP_ARENA_COUNT];
+
+//
+// Store the counter used to hand out arenas to new threads round robin.
+//
+
+ULONG OsHeapNextArena;
+
+//
+// Store the object size for each thread cache size class.
 //
 
-MEMORY_HEAP OsHeap;
-OS_LOCK OsHeapLock;
+const UINTN OsHeapCacheSizes[OS_HEAP_CACHE_CLASS_COUNT] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512
+};
 
 //
 // Store the native page shift and mask.
@@ -128,10 +242,32 @@ Return Value:
 {
 
     PVOID Allocation;
+    POS_HEAP_ARENA Arena;
+    POS_HEAP_THREAD_CACHE Cache;
+    ULONG Class;
+
+    Cache = OspHeapGetThreadCache();
+
+    //
+    // Pop small allocations off the thread's cache if possible. Otherwise
+    // round them up to their size class so they can be cached when freed.
+    //
+
+    if ((Cache != NULL) && (Size != 0) && (Size <= OS_HEAP_CACHE_MAX_SIZE)) {
+        Class = OspHeapGetCacheClass(Size);
+        Allocation = Cache->FreeList[Class];
+        if (Allocation != NULL) {
+            Cache->FreeList[Class] = *((PVOID *)Allocation);
+            Cache->Count[Class] -= 1;
+            return Allocation;
+        }
+
+        Size = OsHeapCacheSizes[Class];
+    }
 
-    OsAcquireLock(&OsHeapLock);
-    Allocation = RtlHeapAllocate(&OsHeap, Size, Tag);
-    OsReleaseLock(&OsHeapLock);
+    Arena = OspHeapAcquireArena(Cache);
+    Allocation = RtlHeapAllocate(&(Arena->Heap), Size, Tag);
+    OsReleaseLock(&(Arena->Lock));
     return Allocation;
 }
 
@@ -159,9 +295,51 @@ Return Value:
 
 {
 
-    OsAcquireLock(&OsHeapLock);
-    RtlHeapFree(&OsHeap, Memory);
-    OsReleaseLock(&OsHeapLock);
+    POS_HEAP_ARENA Arena;
+    POS_HEAP_THREAD_CACHE Cache;
+    ULONG Class;
+    UINTN Size;
+
+    if (Memory == NULL) {
+        return;
+    }
+
+    Arena = OspHeapGetOwningArena(Memory);
+    Cache = OspHeapGetThreadCache();
+    if (Cache != NULL) {
+        Size = RtlHeapGetAllocationSize(&(Arena->Heap), Memory);
+
+        //
+        // Cache the allocation under the largest class it can satisfy, as
+        // long as that doesn't waste too much of it.
+        //
+
+        Class = OS_HEAP_CACHE_CLASS_COUNT;
+        while ((Class != 0) && (OsHeapCacheSizes[Class - 1] > Size)) {
+            Class -= 1;
+        }
+
+        if ((Class != 0) &&
+            (Size <= OsHeapCacheSizes[Class - 1] +
+                     (OsHeapCacheSizes[Class - 1] / 2))) {
+
+            Class -= 1;
+            *((PVOID *)Memory) = Cache->FreeList[Class];
+            Cache->FreeList[Class] = Memory;
+            Cache->Count[Class] += 1;
+            if (Cache->Count[Class] > OS_HEAP_CACHE_CLASS_LIMIT) {
+                OspHeapTrimThreadCache(Cache,
+                                       Class,
+                                       OS_HEAP_CACHE_CLASS_LIMIT / 2);
+            }
+
+            return;
+        }
+    }
+
+    OsAcquireLock(&(Arena->Lock));
+    RtlHeapFree(&(Arena->Heap), Memory);
+    OsReleaseLock(&(Arena->Lock));
     return;
 }
 
@@ -203,10 +381,25 @@ Return Value:
 {
 
     PVOID Allocation;
+    POS_HEAP_ARENA Arena;
+
+    if (Memory == NULL) {
+        return OsHeapAllocate(NewSize, Tag);
+    }
+
+    if (NewSize == 0) {
+        OsHeapFree(Memory);
+        return NULL;
+    }
+
+    //
+    // Resize the allocation within the arena it came from.
+    //
 
-    OsAcquireLock(&OsHeapLock);
-    Allocation = RtlHeapReallocate(&OsHeap, Memory, NewSize, Tag);
-    OsReleaseLock(&OsHeapLock);
+    Arena = OspHeapGetOwningArena(Memory);
+    OsAcquireLock(&(Arena->Lock));
+    Allocation = RtlHeapReallocate(&(Arena->Heap), Memory, NewSize, Tag);
+    OsReleaseLock(&(Arena->Lock));
     return Allocation;
 }
 
@@ -244,11 +437,17 @@ Return Value:
 
 {
 
+    POS_HEAP_ARENA Arena;
     KSTATUS Status;
 
-    OsAcquireLock(&OsHeapLock);
-    Status = RtlHeapAlignedAllocate(&OsHeap, Memory, Alignment, Size, Tag);
-    OsReleaseLock(&OsHeapLock);
+    Arena = OspHeapAcquireArena(OspHeapGetThreadCache());
+    Status = RtlHeapAlignedAllocate(&(Arena->Heap),
+                                    Memory,
+                                    Alignment,
+                                    Size,
+                                    Tag);
+
+    OsReleaseLock(&(Arena->Lock));
     return Status;
 }
 
@@ -277,9 +476,54 @@ Return Value:
 
 {
 
-    OsAcquireLock(&OsHeapLock);
-    RtlValidateHeap(&OsHeap, NULL);
-    OsReleaseLock(&OsHeapLock);
+    POS_HEAP_ARENA Arena;
+    ULONG Index;
+
+    for (Index = 0; Index < OS_HEAP_ARENA_COUNT; Index += 1) {
+        Arena = &(OsHeapArenas[Index]);
+        OsAcquireLock(&(Arena->Lock));
+        RtlValidateHeap(&(Arena->Heap), NULL);
+        OsReleaseLock(&(Arena->Lock));
+    }
+
+    return;
+}
+
+OS_API
+VOID
+OsHeapFlushThreadCache (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns all memory cached by the current thread back to the
+    shared heap and releases the thread's cache. The C library calls this when
+    a thread exits. If the thread allocates again, a new cache is created.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVOID *CacheLocation;
+
+    CacheLocation = OspGetThreadHeapCache();
+    if ((CacheLocation == NULL) || (*CacheLocation == NULL)) {
+        return;
+    }
+
+    OspHeapDestroyThreadCache(*CacheLocation);
+    *CacheLocation = NULL;
     return;
 }
 
@@ -306,22 +550,77 @@ Return Value:
 
 {
 
+    POS_HEAP_ARENA Arena;
     ULONG Flags;
+    ULONG Index;
 
-    OsInitializeLockDefault(&OsHeapLock);
     OsPageSize = OsEnvironment->StartData->PageSize;
     OsPageShift = RtlCountTrailingZeros(OsPageSize);
     Flags = MEMORY_HEAP_FLAG_NO_PARTIAL_FREES;
-    RtlHeapInitialize(&OsHeap,
-                      OspHeapExpand,
-                      OspHeapContract,
-                      OspHeapCorruption,
-                      SYSTEM_HEAP_MINIMUM_EXPANSION_PAGES << OsPageShift,
-                      OsPageSize,
-                      SYSTEM_HEAP_MAGIC,
-                      Flags);
-
-    OsHeap.DirectAllocationThreshold = SYSTEM_HEAP_DIRECT_ALLOCATION_THRESHOLD;
+
+    //
+    // All arenas share the same magic so that the owner of any allocation can
+    // be recovered from its footer. Arenas don't take any memory until they
+    // are first used.
+    //
+
+    for (Index = 0; Index < OS_HEAP_ARENA_COUNT; Index += 1) {
+        Arena = &(OsHeapArenas[Index]);
+        OsInitializeLockDefault(&(Arena->Lock));
+        RtlHeapInitialize(&(Arena->Heap),
+                          OspHeapExpand,
+                          OspHeapContract,
+                          OspHeapCorruption,
+                          SYSTEM_HEAP_MINIMUM_EXPANSION_PAGES << OsPageShift,
+                          OsPageSize,
+                          SYSTEM_HEAP_MAGIC,
+                          Flags);
+
+        Arena->Heap.DirectAllocationThreshold =
+                                       SYSTEM_HEAP_DIRECT_ALLOCATION_THRESHOLD;
+    }
+
+    return;
+}
+
+VOID
+OspHeapDestroyThreadCache (
+    PVOID Cache
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns everything held in a thread's heap cache to the heap
+    arenas and frees the cache itself. The thread owning the cache must either
+    be the caller or be gone.
+
+Arguments:
+
+    Cache - Supplies a pointer to the thread heap cache to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    POS_HEAP_ARENA Arena;
+    ULONG Class;
+    POS_HEAP_THREAD_CACHE ThreadCache;
+
+    ThreadCache = Cache;
+    for (Class = 0; Class < OS_HEAP_CACHE_CLASS_COUNT; Class += 1) {
+        OspHeapTrimThreadCache(ThreadCache, Class, ThreadCache->Count[Class]);
+    }
+
+    Arena = OspHeapGetOwningArena(ThreadCache);
+    OsAcquireLock(&(Arena->Lock));
+    RtlHeapFree(&(Arena->Heap), ThreadCache);
+    OsReleaseLock(&(Arena->Lock));
     return;
 }
 
@@ -473,3 +772,249 @@ Return Value:
     return;
 }
 
+POS_HEAP_THREAD_CACHE
+OspHeapGetThreadCache (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the current thread's heap cache, creating it if
+    needed. Creating the cache also assigns the thread to an arena.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns a pointer to the current thread's heap cache.
+
+    NULL if thread support is not yet up or the cache could not be created.
+
+--*/
+
+{
+
+    POS_HEAP_ARENA Arena;
+    POS_HEAP_THREAD_CACHE Cache;
+    PVOID *CacheLocation;
+    ULONG Index;
+
+    CacheLocation = OspGetThreadHeapCache();
+    if (CacheLocation == NULL) {
+        return NULL;
+    }
+
+    Cache = *CacheLocation;
+    if (Cache != NULL) {
+        return Cache;
+    }
+
+    Index = RtlAtomicAdd32(&OsHeapNextArena, 1) % OS_HEAP_ARENA_COUNT;
+    Arena = &(OsHeapArenas[Index]);
+    OsAcquireLock(&(Arena->Lock));
+    Cache = RtlHeapAllocate(&(Arena->Heap),
+                            sizeof(OS_HEAP_THREAD_CACHE),
+                            OS_HEAP_CACHE_ALLOCATION_TAG);
+
+    OsReleaseLock(&(Arena->Lock));
+    if (Cache == NULL) {
+        return NULL;
+    }
+
+    RtlZeroMemory(Cache, sizeof(OS_HEAP_THREAD_CACHE));
+    Cache->Arena = Arena;
+    *CacheLocation = Cache;
+    return Cache;
+}
+
+POS_HEAP_ARENA
+OspHeapAcquireArena (
+    POS_HEAP_THREAD_CACHE Cache
+    )
+
+/*++
+
+Routine Description:
+
+    This routine acquires the arena the current thread should allocate from.
+    If the thread's arena is busy, the thread moves on to the next arena for
+    this and future allocations.
+
+Arguments:
+
+    Cache - Supplies an optional pointer to the current thread's heap cache.
+        If this is NULL, the primary arena is used.
+
+Return Value:
+
+    Returns a pointer to the arena, with its lock held.
+
+--*/
+
+{
+
+    POS_HEAP_ARENA Arena;
+    UINTN Index;
+
+    if (Cache == NULL) {
+        Arena = &(OsHeapArenas[0]);
+        OsAcquireLock(&(Arena->Lock));
+        return Arena;
+    }
+
+    Arena = Cache->Arena;
+    if (OsTryToAcquireLock(&(Arena->Lock)) != FALSE) {
+        return Arena;
+    }
+
+    Index = (Arena - OsHeapArenas + 1) % OS_HEAP_ARENA_COUNT;
+    Arena = &(OsHeapArenas[Index]);
+    Cache->Arena = Arena;
+    OsAcquireLock(&(Arena->Lock));
+    return Arena;
+}
+
+POS_HEAP_ARENA
+OspHeapGetOwningArena (
+    PVOID Memory
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines which arena an allocation came from.
+
+Arguments:
+
+    Memory - Supplies the allocation.
+
+Return Value:
+
+    Returns a pointer to the owning arena. If the allocation doesn't point
+    back at a valid arena, the primary arena is returned so that the heap
+    reports the corruption when the allocation is used.
+
+--*/
+
+{
+
+    UINTN Offset;
+    PMEMORY_HEAP Owner;
+
+    Owner = RtlHeapGetAllocationOwner(&(OsHeapArenas[0].Heap), Memory);
+    Offset = (UINTN)Owner - (UINTN)OsHeapArenas;
+    if ((Offset >= sizeof(OsHeapArenas)) ||
+        ((Offset % sizeof(OS_HEAP_ARENA)) !=
+         FIELD_OFFSET(OS_HEAP_ARENA, Heap))) {
+
+        return &(OsHeapArenas[0]);
+    }
+
+    return PARENT_STRUCTURE(Owner, OS_HEAP_ARENA, Heap);
+}
+
+ULONG
+OspHeapGetCacheClass (
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the smallest thread cache size class that can hold an
+    allocation of the given size.
+
+Arguments:
+
+    Size - Supplies the size of the allocation, in bytes.
+
+Return Value:
+
+    Returns the size class index.
+
+    OS_HEAP_CACHE_NO_CLASS if the allocation is too big to be cached.
+
+--*/
+
+{
+
+    ULONG Class;
+
+    for (Class = 0; Class < OS_HEAP_CACHE_CLASS_COUNT; Class += 1) {
+        if (Size <= OsHeapCacheSizes[Class]) {
+            return Class;
+        }
+    }
+
+    return OS_HEAP_CACHE_NO_CLASS;
+}
+
+VOID
+OspHeapTrimThreadCache (
+    POS_HEAP_THREAD_CACHE Cache,
+    ULONG Class,
+    ULONG Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands objects from a thread cache size class back to the
+    arenas they came from. Runs of objects from the same arena are freed under
+    a single acquisition of its lock.
+
+Arguments:
+
+    Cache - Supplies a pointer to the thread heap cache.
+
+    Class - Supplies the size class to trim.
+
+    Count - Supplies the number of objects to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    POS_HEAP_ARENA Arena;
+    POS_HEAP_ARENA LockedArena;
+    PVOID Object;
+
+    ASSERT(Count <= Cache->Count[Class]);
+
+    LockedArena = NULL;
+    while (Count != 0) {
+        Object = Cache->FreeList[Class];
+        Cache->FreeList[Class] = *((PVOID *)Object);
+        Cache->Count[Class] -= 1;
+        Count -= 1;
+        Arena = OspHeapGetOwningArena(Object);
+        if (Arena != LockedArena) {
+            if (LockedArena != NULL) {
+                OsReleaseLock(&(LockedArena->Lock));
+            }
+
+            OsAcquireLock(&(Arena->Lock));
+            LockedArena = Arena;
+        }
+
+        RtlHeapFree(&(Arena->Heap), Object);
+    }
+
+    if (LockedArena != NULL) {
+        OsReleaseLock(&(LockedArena->Lock));
+    }
+
+    return;
+}
+
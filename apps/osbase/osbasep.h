@@ -250,6 +250,29 @@ Return Value:
 
 --*/
 
+VOID
+OspHeapDestroyThreadCache (
+    PVOID Cache
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns everything held in a thread's heap cache to the heap
+    arenas and frees the cache itself. The thread owning the cache must either
+    be the caller or be gone.
+
+Arguments:
+
+    Cache - Supplies a pointer to the thread heap cache to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
 VOID
 OspInitializeImageSupport (
     VOID
@@ -412,6 +435,31 @@ Return Value:
 
 --*/
 
+PVOID *
+OspGetThreadHeapCache (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the location where the current thread stores its
+    heap cache pointer.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns a pointer to the current thread's heap cache pointer.
+
+    NULL if thread support is not yet set up, in which case the caller should
+    go straight to the shared heap.
+
+--*/
+
 VOID
 OspTlsTearDownModule (
     PLOADED_IMAGE Image
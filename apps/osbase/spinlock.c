@@ -299,11 +299,95 @@ Return Value:
     Parameters.Value = *Value;
     Parameters.Operation = Operation;
     Parameters.TimeoutInMilliseconds = TimeoutInMilliseconds;
+    Parameters.SecondAddress = NULL;
+    Parameters.SecondValue = 0;
+    Parameters.Argument = 0;
     Status = OsSystemCall(SystemCallUserLock, &Parameters);
     *Value = Parameters.Value;
     return Status;
 }
 
+OS_API
+KSTATUS
+OsUserLockPair (
+    PVOID Address,
+    ULONG Operation,
+    PULONG Value,
+    PVOID SecondAddress,
+    PULONG SecondValue,
+    ULONG Argument
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs a cooperative locking operation with the kernel that
+    involves two user mode lock addresses.
+
+Arguments:
+
+    Address - Supplies a pointer to the first 32-bit lock value.
+
+    Operation - Supplies the operation of type USER_LOCK_OPERATION, as well as
+        any flags, see USER_LOCK_* definitions. The private flag applies to
+        both addresses. Valid operations are:
+
+        UserLockRequeue - Wakes the number of threads given in the value that
+        are blocked on the first address, and moves up to the second value
+        number of the remaining waiters over to wait on the second address.
+        This fails if the first address no longer contains the argument.
+
+        UserLockWakeOperation - Atomically modifies the second address as
+        described by the argument (see USER_LOCK_WAKE_OP), wakes the number of
+        threads given in the value that are blocked on the first address, and
+        wakes the second value number of threads blocked on the second address
+        if the comparison encoded in the argument held against the second
+        address' original value.
+
+    Value - Supplies a pointer that on input contains the number of threads to
+        wake on the first address. On output, contains the number woken.
+
+    SecondAddress - Supplies a pointer to the second 32-bit lock value.
+
+    SecondValue - Supplies a pointer that on input contains the number of
+        threads to requeue to or wake on the second address. On output,
+        contains the number of threads requeued or woken there.
+
+    Argument - Supplies the expected value of the first address for requeue
+        operations, or the packed wake operation.
+
+Return Value:
+
+    STATUS_SUCCESS if the operation succeeded.
+
+    STATUS_OPERATION_WOULD_BLOCK if for a requeue operation the value at the
+    first address was not equal to the argument.
+
+    STATUS_INVALID_PARAMETER if the operation or argument was not valid.
+
+    STATUS_ACCESS_VIOLATION if either address was not valid.
+
+--*/
+
+{
+
+    SYSTEM_CALL_USER_LOCK Parameters;
+    KSTATUS Status;
+
+    Parameters.Address = Address;
+    Parameters.Value = *Value;
+    Parameters.Operation = Operation;
+    Parameters.TimeoutInMilliseconds = 0;
+    Parameters.SecondAddress = SecondAddress;
+    Parameters.SecondValue = *SecondValue;
+    Parameters.Argument = Argument;
+    Status = OsSystemCall(SystemCallUserLock, &Parameters);
+    *Value = Parameters.Value;
+    *SecondValue = Parameters.SecondValue;
+    return Status;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
@@ -76,6 +76,9 @@ Structure Description:
     ListEntry - Stores pointers to the next and previous threads in the OS
         Library thread list.
 
+    HeapCache - Stores a pointer to the thread's heap cache, or NULL if the
+        thread has not yet allocated from the heap.
+
 --*/
 
 typedef struct _THREAD_CONTROL_BLOCK {
@@ -86,6 +89,7 @@ typedef struct _THREAD_CONTROL_BLOCK {
     UINTN StackGuard;
     UINTN BaseAllocationSize;
     LIST_ENTRY ListEntry;
+    PVOID HeapCache;
 } THREAD_CONTROL_BLOCK, *PTHREAD_CONTROL_BLOCK;
 
 //
@@ -108,6 +112,13 @@ OspGetThreadControlBlock (
 LIST_ENTRY OsThreadList;
 OS_LOCK OsThreadListLock;
 
+//
+// Remember whether the thread pointer has been set for the initial thread.
+// Until it is, the thread control block cannot be reached.
+//
+
+BOOL OsThreadPointerSet;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -355,7 +366,55 @@ Return Value:
 
 {
 
-    return OsSystemCall(SystemCallSetThreadPointer, Pointer);
+    KSTATUS Status;
+
+    Status = OsSystemCall(SystemCallSetThreadPointer, Pointer);
+    if ((KSUCCESS(Status)) && (Pointer != NULL)) {
+        OsThreadPointerSet = TRUE;
+    }
+
+    return Status;
+}
+
+PVOID *
+OspGetThreadHeapCache (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the location where the current thread stores its
+    heap cache pointer.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns a pointer to the current thread's heap cache pointer.
+
+    NULL if thread support is not yet set up, in which case the caller should
+    go straight to the shared heap.
+
+--*/
+
+{
+
+    PTHREAD_CONTROL_BLOCK ThreadControlBlock;
+
+    if (OsThreadPointerSet == FALSE) {
+        return NULL;
+    }
+
+    ThreadControlBlock = OspGetThreadControlBlock();
+    if (ThreadControlBlock == NULL) {
+        return NULL;
+    }
+
+    return &(ThreadControlBlock->HeapCache);
 }
 
 VOID
@@ -634,6 +693,16 @@ Return Value:
         OsHeapFree(ThreadControlBlock->TlsVector);
     }
 
+    //
+    // The thread normally flushes its own heap cache on the way out, but
+    // clean up after it if it didn't.
+    //
+
+    if (ThreadControlBlock->HeapCache != NULL) {
+        OspHeapDestroyThreadCache(ThreadControlBlock->HeapCache);
+        ThreadControlBlock->HeapCache = NULL;
+    }
+
     OsAcquireLock(&OsThreadListLock);
     LIST_REMOVE(&(ThreadControlBlock->ListEntry));
     OsReleaseLock(&OsThreadListLock);
@@ -119,11 +119,13 @@ var DriverFiles = [
 
 if (arch == "x86") {
     DriverFiles += [
+        "ahci.drv",
         "ata.drv",
         "atl1c.drv",
         "dwceth.drv",
         "e100.drv",
         "i8042.drv",
+        "nvme.drv",
         "rtl81xx.drv",
         "uhci.drv",
     ];
@@ -147,7 +149,9 @@ var BootDrivers = [
 
 if (arch == "x86") {
     BootDrivers += [
+        "ahci.drv",
         "ata.drv",
+        "nvme.drv",
         "pci.drv",
         "ehci.drv",
         "usbcomp.drv",
@@ -693,6 +697,7 @@ if (plat == "install-x86") {
 
     var Files = [
         "acpi.drv",
+        "ahci.drv",
         "ata.drv",
         "atl1c.drv",
         "bootman.bin",
@@ -720,6 +725,7 @@ if (plat == "install-x86") {
         "net80211.drv",
         "netcore.drv",
         "null.drv",
+        "nvme.drv",
         "onering.drv",
         "part.drv",
         "pci.drv",
@@ -404,6 +404,7 @@ Return Value:
 {
 
     pid_t Child;
+    INT Error;
     PSTR FullCommandPath;
     ULONG FullCommandPathSize;
     BOOL Result;
@@ -513,7 +514,25 @@ Return Value:
         goto RunCommandEnd;
     }
 
+    //
+    // Launch the command directly if possible rather than copying the whole
+    // shell just to replace it. A failure to launch looks the same as the
+    // forked child failing to exec.
+    //
+
     if (SwForkSupported != 0) {
+        Error = ShOsSpawnCommand(FullCommandPath, Arguments, &Child);
+        if (Error == 0) {
+            Status = 0;
+            goto RunCommandEnd;
+
+        } else if (Error != ENOSYS) {
+            Child = -1;
+            *ReturnValue = Error;
+            Status = 0;
+            goto RunCommandEnd;
+        }
+
         Child = SwFork();
         if (Child < 0) {
             PRINT_ERROR("sh: Failed to fork: %s\n", strerror(errno));
@@ -33,6 +33,7 @@ Module Name:
 #define _WIN32_WINNT 0x0501
 
 #include <windows.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -1044,6 +1045,47 @@ Return Value:
     return Result;
 }
 
+int
+ShOsSpawnCommand (
+    char *Command,
+    char **Arguments,
+    pid_t *Child
+    )
+
+/*++
+
+Routine Description:
+
+    This routine launches the given executable in a new child process without
+    first making a copy of the shell. Signals the shell traps are reset to
+    their original dispositions in the child.
+
+Arguments:
+
+    Command - Supplies a pointer to the full path of the executable to run.
+
+    Arguments - Supplies a pointer to the null terminated array of command
+        argument strings. This includes the first argument, the command name.
+
+    Child - Supplies a pointer where the child process ID will be returned on
+        success.
+
+Return Value:
+
+    0 on success.
+
+    ENOSYS if the command cannot be launched this way and the caller should
+    fork and exec instead.
+
+    Returns another error number if the executable could not be launched.
+
+--*/
+
+{
+
+    return ENOSYS;
+}
+
 void
 ShOsConvertExitStatus (
     int *Status
@@ -37,6 +37,7 @@ Module Name:
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <spawn.h>
 #include <pwd.h>
 #include <sys/times.h>
 #include <sys/wait.h>
@@ -87,6 +88,8 @@ int ShOriginalSignalDispositionValid[ShellSignalCount];
 
 int ShExecutableBitSupported = 1;
 
+extern char **environ;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -910,6 +913,101 @@ Return Value:
     return fcntl(FileDescriptor, F_DUPFD, SHELL_MINIMUM_FILE_DESCRIPTOR);
 }
 
+int
+ShOsSpawnCommand (
+    char *Command,
+    char **Arguments,
+    pid_t *Child
+    )
+
+/*++
+
+Routine Description:
+
+    This routine launches the given executable in a new child process without
+    first making a copy of the shell. Signals the shell traps are reset to
+    their original dispositions in the child.
+
+Arguments:
+
+    Command - Supplies a pointer to the full path of the executable to run.
+
+    Arguments - Supplies a pointer to the null terminated array of command
+        argument strings. This includes the first argument, the command name.
+
+    Child - Supplies a pointer where the child process ID will be returned on
+        success.
+
+Return Value:
+
+    0 on success.
+
+    ENOSYS if the command cannot be launched this way and the caller should
+    fork and exec instead.
+
+    Returns another error number if the executable could not be launched.
+
+--*/
+
+{
+
+    posix_spawnattr_t Attributes;
+    struct sigaction CurrentAction;
+    sigset_t DefaultSignals;
+    int OsSignalNumber;
+    int Result;
+    int SignalIndex;
+
+    //
+    // A spawned child inherits ignored signals and gets the default action for
+    // everything else. That matches restoring the original dispositions,
+    // except where a signal that was originally ignored is now trapped.
+    //
+
+    sigemptyset(&DefaultSignals);
+    for (SignalIndex = 0; SignalIndex < ShellSignalCount; SignalIndex += 1) {
+        OsSignalNumber = ShConvertToOsSignal(SignalIndex);
+        if ((OsSignalNumber == 0) ||
+            (ShOriginalSignalDispositionValid[SignalIndex] == 0)) {
+
+            continue;
+        }
+
+        if (ShOriginalSignalDispositions[SignalIndex].sa_handler != SIG_IGN) {
+            sigaddset(&DefaultSignals, OsSignalNumber);
+            continue;
+        }
+
+        Result = sigaction(OsSignalNumber, NULL, &CurrentAction);
+        if ((Result != 0) || (CurrentAction.sa_handler != SIG_IGN)) {
+            return ENOSYS;
+        }
+    }
+
+    Result = posix_spawnattr_init(&Attributes);
+    if (Result != 0) {
+        return Result;
+    }
+
+    Result = posix_spawnattr_setsigdefault(&Attributes, &DefaultSignals);
+    if (Result == 0) {
+        Result = posix_spawnattr_setflags(&Attributes, POSIX_SPAWN_SETSIGDEF);
+    }
+
+    if (Result == 0) {
+        fflush(NULL);
+        Result = posix_spawnp(Child,
+                              Command,
+                              NULL,
+                              &Attributes,
+                              Arguments,
+                              environ);
+    }
+
+    posix_spawnattr_destroy(&Attributes);
+    return Result;
+}
+
 void
 ShOsConvertExitStatus (
     int *Status
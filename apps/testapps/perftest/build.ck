@@ -31,9 +31,11 @@ function build() {
         "create.c",
         "dlopen.c",
         "dup.c",
+        "evpoll.c",
         "getppid.c",
         "exec.c",
         "fork.c",
+        "ioring.c",
         "malloc.c",
         "mmap.c",
         "mutex.c",
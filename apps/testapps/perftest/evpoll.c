@@ -0,0 +1,307 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    evpoll.c
+
+Abstract:
+
+    This module implements the performance benchmark tests for readiness
+    notification across a large set of descriptors, comparing poll() against
+    epoll_wait().
+
+Author:
+
+    Minoca Corp. 16-Oct-2026
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "perftest.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the number of pipes being watched. Only the read end of each pipe is
+// waited on.
+//
+
+#define PT_EVENT_POLL_DESCRIPTOR_COUNT 10000
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+void
+EventPollMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the poll and epoll readiness notification benchmark
+    tests. Each iteration makes one pipe out of many readable, waits for it to
+    be reported, and then drains it.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ssize_t BytesCompleted;
+    char Character;
+    int EventPoll;
+    struct epoll_event Event;
+    int Index;
+    unsigned long long Iterations;
+    int PipeCount;
+    int (*Pipes)[2];
+    struct pollfd *PollDescriptors;
+    int ReadyDescriptor;
+    int Status;
+    int UseEpoll;
+
+    EventPoll = -1;
+    Iterations = 0;
+    PipeCount = 0;
+    PollDescriptors = NULL;
+    Result->Type = PtResultIterations;
+    Result->Status = 0;
+    switch (Test->TestType) {
+    case PtTestPoll:
+        UseEpoll = 0;
+        break;
+
+    case PtTestEpoll:
+        UseEpoll = 1;
+        break;
+
+    default:
+
+        assert(0);
+
+        Result->Status = EINVAL;
+        return;
+    }
+
+    Pipes = malloc(sizeof(*Pipes) * PT_EVENT_POLL_DESCRIPTOR_COUNT);
+    if (Pipes == NULL) {
+        Result->Status = ENOMEM;
+        goto MainEnd;
+    }
+
+    if (UseEpoll != 0) {
+        EventPoll = epoll_create1(EPOLL_CLOEXEC);
+        if (EventPoll < 0) {
+            Result->Status = errno;
+            goto MainEnd;
+        }
+
+    } else {
+        PollDescriptors = malloc(sizeof(struct pollfd) *
+                                 PT_EVENT_POLL_DESCRIPTOR_COUNT);
+
+        if (PollDescriptors == NULL) {
+            Result->Status = ENOMEM;
+            goto MainEnd;
+        }
+    }
+
+    //
+    // Create the pipes and register interest in the read end of each.
+    //
+
+    for (Index = 0; Index < PT_EVENT_POLL_DESCRIPTOR_COUNT; Index += 1) {
+        Status = pipe(Pipes[Index]);
+        if (Status != 0) {
+            Result->Status = errno;
+            goto MainEnd;
+        }
+
+        PipeCount += 1;
+        if (UseEpoll != 0) {
+            memset(&Event, 0, sizeof(Event));
+            Event.events = EPOLLIN;
+            Event.data.u32 = Index;
+            Status = epoll_ctl(EventPoll,
+                               EPOLL_CTL_ADD,
+                               Pipes[Index][0],
+                               &Event);
+
+            if (Status != 0) {
+                Result->Status = errno;
+                goto MainEnd;
+            }
+
+        } else {
+            PollDescriptors[Index].fd = Pipes[Index][0];
+            PollDescriptors[Index].events = POLLIN;
+            PollDescriptors[Index].revents = 0;
+        }
+    }
+
+    //
+    // Start the test. This snaps resource usage and starts the clock ticking.
+    //
+
+    Status = PtStartTimedTest(Test->Duration);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    //
+    // Measure the cost of finding the one ready descriptor among many. The
+    // pipe signaled rotates so that neither interface benefits from always
+    // finding it at the front.
+    //
+
+    Character = 0;
+    while (PtIsTimedTestRunning() != 0) {
+        Index = Iterations % PT_EVENT_POLL_DESCRIPTOR_COUNT;
+        do {
+            BytesCompleted = write(Pipes[Index][1], &Character, 1);
+
+        } while ((BytesCompleted < 0) && (errno == EINTR));
+
+        if (BytesCompleted != 1) {
+            Result->Status = errno;
+            break;
+        }
+
+        ReadyDescriptor = -1;
+        if (UseEpoll != 0) {
+            do {
+                Status = epoll_wait(EventPoll, &Event, 1, -1);
+
+            } while ((Status < 0) && (errno == EINTR));
+
+            if (Status != 1) {
+                Result->Status = errno;
+                break;
+            }
+
+            ReadyDescriptor = Pipes[Event.data.u32][0];
+
+        } else {
+            do {
+                Status = poll(PollDescriptors,
+                              PT_EVENT_POLL_DESCRIPTOR_COUNT,
+                              -1);
+
+            } while ((Status < 0) && (errno == EINTR));
+
+            if (Status != 1) {
+                Result->Status = errno;
+                break;
+            }
+
+            for (Index = 0;
+                 Index < PT_EVENT_POLL_DESCRIPTOR_COUNT;
+                 Index += 1) {
+
+                if ((PollDescriptors[Index].revents & POLLIN) != 0) {
+                    ReadyDescriptor = PollDescriptors[Index].fd;
+                    break;
+                }
+            }
+        }
+
+        if (ReadyDescriptor < 0) {
+            Result->Status = EIO;
+            break;
+        }
+
+        do {
+            BytesCompleted = read(ReadyDescriptor, &Character, 1);
+
+        } while ((BytesCompleted < 0) && (errno == EINTR));
+
+        if (BytesCompleted != 1) {
+            Result->Status = errno;
+            break;
+        }
+
+        Iterations += 1;
+    }
+
+    Status = PtFinishTimedTest(Result);
+    if ((Status != 0) && (Result->Status == 0)) {
+        Result->Status = errno;
+    }
+
+MainEnd:
+    for (Index = 0; Index < PipeCount; Index += 1) {
+        close(Pipes[Index][0]);
+        close(Pipes[Index][1]);
+    }
+
+    if (EventPoll >= 0) {
+        close(EventPoll);
+    }
+
+    if (PollDescriptors != NULL) {
+        free(PollDescriptors);
+    }
+
+    if (Pipes != NULL) {
+        free(Pipes);
+    }
+
+    Result->Data.Iterations = Iterations;
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
@@ -0,0 +1,297 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ioring.c
+
+Abstract:
+
+    This module implements the I/O ring performance benchmark test.
+
+Author:
+
+    Minoca Corp. 16-Oct-2026
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioring.h>
+#include <unistd.h>
+
+#include "perftest.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define PT_IO_RING_TEST_FILE_NAME_LENGTH 48
+#define PT_IO_RING_TEST_FILE_SIZE (2 * 1024 * 1024)
+#define PT_IO_RING_TEST_BUFFER_SIZE 4096
+
+//
+// Define the number of reads submitted to the ring in each batch.
+//
+
+#define PT_IO_RING_TEST_BATCH_SIZE 16
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+void
+IoRingMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the I/O ring benchmark test. Each iteration submits
+    a batch of reads from the cached file with a single system call and then
+    reaps their completions.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    char *Buffer;
+    ssize_t BytesWritten;
+    struct io_ring_cqe Completion;
+    int FileCreated;
+    int FileDescriptor;
+    char FileName[PT_IO_RING_TEST_FILE_NAME_LENGTH];
+    int Index;
+    off_t Offset;
+    pid_t ProcessId;
+    struct io_ring Ring;
+    int RingCreated;
+    int Status;
+    unsigned long long TotalBytes;
+
+    FileCreated = 0;
+    FileDescriptor = -1;
+    Offset = 0;
+    RingCreated = 0;
+    Result->Type = PtResultBytes;
+    Result->Status = 0;
+    TotalBytes = 0;
+
+    //
+    // Allocate a buffer for each read in a batch.
+    //
+
+    Buffer = malloc(PT_IO_RING_TEST_BUFFER_SIZE * PT_IO_RING_TEST_BATCH_SIZE);
+    if (Buffer == NULL) {
+        Result->Status = ENOMEM;
+        goto MainEnd;
+    }
+
+    //
+    // Get the process ID and create a process safe file path.
+    //
+
+    ProcessId = getpid();
+    Status = snprintf(FileName,
+                      PT_IO_RING_TEST_FILE_NAME_LENGTH,
+                      "ioring_%d.txt",
+                      ProcessId);
+
+    if (Status < 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    FileDescriptor = open(FileName,
+                          O_RDWR | O_CREAT | O_TRUNC,
+                          S_IRUSR | S_IWUSR);
+
+    if (FileDescriptor < 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    FileCreated = 1;
+
+    //
+    // Like the read test, this measures reads from the system's cache, so
+    // prime the cache with junk data.
+    //
+
+    for (Index = 0;
+         Index < (PT_IO_RING_TEST_FILE_SIZE / PT_IO_RING_TEST_BUFFER_SIZE);
+         Index += 1) {
+
+        do {
+            BytesWritten = write(FileDescriptor,
+                                 Buffer,
+                                 PT_IO_RING_TEST_BUFFER_SIZE);
+
+        } while ((BytesWritten < 0) && (errno == EINTR));
+
+        if (BytesWritten < 0) {
+            Result->Status = errno;
+            goto MainEnd;
+        }
+
+        if (BytesWritten != PT_IO_RING_TEST_BUFFER_SIZE) {
+            Result->Status = EIO;
+            goto MainEnd;
+        }
+    }
+
+    Status = fsync(FileDescriptor);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    Status = io_ring_init(PT_IO_RING_TEST_BATCH_SIZE, &Ring, IO_RING_CLOEXEC);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    RingCreated = 1;
+
+    //
+    // Start the test. This snaps resource usage and starts the clock ticking.
+    //
+
+    Status = PtStartTimedTest(Test->Duration);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    //
+    // Measure ring throughput by counting the number of bytes that can be
+    // read in. Each batch walks forward through the file, wrapping at the end.
+    //
+
+    while (PtIsTimedTestRunning() != 0) {
+        for (Index = 0; Index < PT_IO_RING_TEST_BATCH_SIZE; Index += 1) {
+            Status = io_ring_prep_read(
+                                &Ring,
+                                FileDescriptor,
+                                Buffer + (Index * PT_IO_RING_TEST_BUFFER_SIZE),
+                                PT_IO_RING_TEST_BUFFER_SIZE,
+                                Offset,
+                                Index);
+
+            if (Status != 0) {
+                Result->Status = errno;
+                goto TestEnd;
+            }
+
+            Offset += PT_IO_RING_TEST_BUFFER_SIZE;
+            if (Offset >= PT_IO_RING_TEST_FILE_SIZE) {
+                Offset = 0;
+            }
+        }
+
+        do {
+            Status = io_ring_submit_and_wait(&Ring,
+                                             PT_IO_RING_TEST_BATCH_SIZE);
+
+        } while ((Status < 0) && (errno == EINTR));
+
+        if (Status != PT_IO_RING_TEST_BATCH_SIZE) {
+            Result->Status = errno;
+            if (Status >= 0) {
+                Result->Status = EIO;
+            }
+
+            break;
+        }
+
+        for (Index = 0; Index < PT_IO_RING_TEST_BATCH_SIZE; Index += 1) {
+            do {
+                Status = io_ring_wait_cqe(&Ring, &Completion, -1);
+
+            } while ((Status < 0) && (errno == EINTR));
+
+            if (Status != 0) {
+                Result->Status = errno;
+                goto TestEnd;
+            }
+
+            if (Completion.res < 0) {
+                Result->Status = -Completion.res;
+                goto TestEnd;
+            }
+
+            TotalBytes += (unsigned long long)Completion.res;
+        }
+    }
+
+TestEnd:
+    Status = PtFinishTimedTest(Result);
+    if ((Status != 0) && (Result->Status == 0)) {
+        Result->Status = errno;
+    }
+
+MainEnd:
+    if (RingCreated != 0) {
+        io_ring_destroy(&Ring);
+    }
+
+    if (FileCreated != 0) {
+        close(FileDescriptor);
+        remove(FileName);
+    }
+
+    if (Buffer != NULL) {
+        free(Buffer);
+    }
+
+    Result->Data.Bytes = TotalBytes;
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
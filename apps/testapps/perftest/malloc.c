@@ -33,6 +33,7 @@ Module Name:
 #include <assert.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <string.h>
@@ -48,6 +49,7 @@ Module Name:
 #define PT_MALLOC_TEST_ALLOCATION_LIMIT (256 * 1024)
 #define PT_MALLOC_TEST_ALLOCATION_COUNT 32
 #define PT_MALLOC_TEST_THREAD_COUNT 8
+#define PT_MALLOC_TEST_SMALL_LIMIT 512
 
 //
 // ------------------------------------------------------ Data Type Definitions
@@ -62,11 +64,23 @@ MallocStartRoutine (
     void *Parameter
     );
 
+void *
+MallocScalingStartRoutine (
+    void *Parameter
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
 volatile int MallocReadyThreadCount;
+pthread_mutex_t MallocReadyMutex = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// Store the iteration counts of each thread in the scaling test.
+//
+
+unsigned long long MallocThreadIterations[PT_MALLOC_TEST_THREAD_COUNT];
 
 //
 // ------------------------------------------------------------------ Functions
@@ -106,6 +120,7 @@ Return Value:
     pthread_mutex_t Mutex;
     int RandomSize;
     unsigned int Seed;
+    int SmallSize;
     int Status;
     int ThreadCount;
     int ThreadIndex;
@@ -113,6 +128,7 @@ Return Value:
 
     Iterations = 0;
     RandomSize = 0;
+    SmallSize = 0;
     Result->Type = PtResultIterations;
     Result->Status = 0;
     ThreadIndex = 0;
@@ -179,6 +195,43 @@ Return Value:
         RandomSize = 1;
         break;
 
+    //
+    // The scaling test runs the same small allocation loop on every thread,
+    // including this one, and counts the total work done. With a single
+    // shared heap lock this stays flat as threads are added.
+    //
+
+    case PtTestMallocScaling:
+        Threads = malloc(sizeof(pthread_t) * PT_MALLOC_TEST_THREAD_COUNT);
+        if (Threads == NULL) {
+            Result->Status = ENOMEM;
+            goto MainEnd;
+        }
+
+        MallocReadyThreadCount = 0;
+        for (ThreadIndex = 0;
+             ThreadIndex < PT_MALLOC_TEST_THREAD_COUNT;
+             ThreadIndex += 1) {
+
+            MallocThreadIterations[ThreadIndex] = 0;
+            Status = pthread_create(&(Threads[ThreadIndex]),
+                                    NULL,
+                                    MallocScalingStartRoutine,
+                                    &(MallocThreadIterations[ThreadIndex]));
+
+            if (Status != 0) {
+                Result->Status = Status;
+                goto MainEnd;
+            }
+        }
+
+        while (MallocReadyThreadCount != PT_MALLOC_TEST_THREAD_COUNT) {
+            sleep(1);
+        }
+
+        SmallSize = 1;
+        break;
+
     case PtTestMallocRandom:
         RandomSize = 1;
         break;
@@ -216,6 +269,9 @@ Return Value:
     while (PtIsTimedTestRunning() != 0) {
         if (RandomSize != 0) {
             AllocationSize = rand_r(&Seed) % PT_MALLOC_TEST_ALLOCATION_LIMIT;
+
+        } else if (SmallSize != 0) {
+            AllocationSize = (rand_r(&Seed) % PT_MALLOC_TEST_SMALL_LIMIT) + 1;
         }
 
         //
@@ -262,6 +318,24 @@ Return Value:
 
         break;
 
+    case PtTestMallocScaling:
+        if (Threads != NULL) {
+            ThreadCount = ThreadIndex;
+            for (ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex += 1) {
+                pthread_cancel(Threads[ThreadIndex]);
+                pthread_join(Threads[ThreadIndex], (void **)&Status);
+                if ((Status != 0) && (Result->Status == 0)) {
+                    Result->Status = Status;
+                }
+
+                Iterations += MallocThreadIterations[ThreadIndex];
+            }
+
+            free(Threads);
+        }
+
+        break;
+
     case PtTestMallocSmall:
     case PtTestMallocLarge:
     case PtTestMallocRandom:
@@ -380,3 +454,91 @@ Return Value:
     return (void *)0;
 }
 
+void *
+MallocScalingStartRoutine (
+    void *Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the start routine for a thread in the malloc
+    scaling test. It waits for the test to start and then allocates and frees
+    small blocks of memory, counting how many times it did so.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the iteration count to fill in.
+
+Return Value:
+
+    0 on success or an errno value otherwise.
+
+--*/
+
+{
+
+    void **Allocations;
+    int AllocationSize;
+    int Index;
+    unsigned long long Iterations;
+    void *Result;
+    unsigned int Seed;
+
+    AllocationSize = sizeof(void *) * PT_MALLOC_TEST_ALLOCATION_COUNT;
+    Allocations = malloc(AllocationSize);
+    if (Allocations == NULL) {
+        return (void *)ENOMEM;
+    }
+
+    memset(Allocations, 0, AllocationSize);
+    Iterations = 0;
+    Result = (void *)0;
+    Seed = time(NULL) ^ (unsigned int)(uintptr_t)Parameter;
+
+    //
+    // Announce that this thread is ready.
+    //
+
+    pthread_mutex_lock(&MallocReadyMutex);
+    MallocReadyThreadCount += 1;
+    pthread_mutex_unlock(&MallocReadyMutex);
+
+    //
+    // Busy spin waiting for the test to start.
+    //
+
+    while (PtIsTimedTestRunning() == 0) {
+        pthread_testcancel();
+    }
+
+    while (PtIsTimedTestRunning() != 0) {
+        AllocationSize = (rand_r(&Seed) % PT_MALLOC_TEST_SMALL_LIMIT) + 1;
+        Index = rand_r(&Seed) % PT_MALLOC_TEST_ALLOCATION_COUNT;
+        if (Allocations[Index] == NULL) {
+            Allocations[Index] = malloc(AllocationSize);
+            if (Allocations[Index] == NULL) {
+                Result = (void *)ENOMEM;
+                break;
+            }
+
+        } else {
+            free(Allocations[Index]);
+            Allocations[Index] = NULL;
+        }
+
+        Iterations += 1;
+    }
+
+    for (Index = 0; Index < PT_MALLOC_TEST_ALLOCATION_COUNT; Index += 1) {
+        if (Allocations[Index] != NULL) {
+            free(Allocations[Index]);
+        }
+    }
+
+    free(Allocations);
+    *((unsigned long long *)Parameter) = Iterations;
+    return Result;
+}
+
@@ -351,6 +351,13 @@ PT_TEST_INFORMATION PerformanceTests[PtTestTypeCount] = {
      PtResultIterations,
      MALLOC_CONTENDED_TEST_DEFAULT_DURATION},
 
+    {MALLOC_SCALING_TEST_NAME,
+     MALLOC_SCALING_TEST_DESCRIPTION,
+     MallocMain,
+     PtTestMallocScaling,
+     PtResultIterations,
+     MALLOC_SCALING_TEST_DEFAULT_DURATION},
+
     {PTHREAD_JOIN_TEST_NAME,
      PTHREAD_JOIN_TEST_DESCRIPTION,
      PthreadMain,
@@ -392,6 +399,27 @@ PT_TEST_INFORMATION PerformanceTests[PtTestTypeCount] = {
      PtTestFstat,
      PtResultIterations,
      FSTAT_TEST_DEFAULT_DURATION},
+
+    {POLL_TEST_NAME,
+     POLL_TEST_DESCRIPTION,
+     EventPollMain,
+     PtTestPoll,
+     PtResultIterations,
+     POLL_TEST_DEFAULT_DURATION},
+
+    {EPOLL_TEST_NAME,
+     EPOLL_TEST_DESCRIPTION,
+     EventPollMain,
+     PtTestEpoll,
+     PtResultIterations,
+     EPOLL_TEST_DEFAULT_DURATION},
+
+    {IO_RING_TEST_NAME,
+     IO_RING_TEST_DESCRIPTION,
+     IoRingMain,
+     PtTestIoRing,
+     PtResultBytes,
+     IO_RING_TEST_DEFAULT_DURATION},
 };
 
 //
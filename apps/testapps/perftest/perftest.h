@@ -109,6 +109,10 @@ Module Name:
 #define MALLOC_CONTENDED_TEST_DESCRIPTION \
     "Benchmarks malloc() and free() with multiple threads."
 
+#define MALLOC_SCALING_TEST_NAME "malloc_scaling"
+#define MALLOC_SCALING_TEST_DESCRIPTION \
+    "Benchmarks total small malloc() and free() throughput across threads."
+
 #define PTHREAD_JOIN_TEST_NAME "pthread_join"
 #define PTHREAD_JOIN_TEST_DESCRIPTION \
     "Benchmarks thread creation with pthread_join()."
@@ -133,6 +137,18 @@ Module Name:
 #define FSTAT_TEST_DESCRIPTION \
     "Benchmarks the fstat() C library routine."
 
+#define POLL_TEST_NAME "poll"
+#define POLL_TEST_DESCRIPTION \
+    "Benchmarks poll() readiness notification across 10000 descriptors."
+
+#define EPOLL_TEST_NAME "epoll"
+#define EPOLL_TEST_DESCRIPTION \
+    "Benchmarks epoll_wait() readiness notification across 10000 descriptors."
+
+#define IO_RING_TEST_NAME "ioring"
+#define IO_RING_TEST_DESCRIPTION \
+    "Benchmarks batched read throughput through an I/O ring."
+
 //
 // Default test durations, in seconds.
 //
@@ -159,12 +175,16 @@ Module Name:
 #define MALLOC_LARGE_TEST_DEFAULT_DURATION 30
 #define MALLOC_RANDOM_TEST_DEFAULT_DURATION 30
 #define MALLOC_CONTENDED_TEST_DEFAULT_DURATION 30
+#define MALLOC_SCALING_TEST_DEFAULT_DURATION 30
 #define PTHREAD_JOIN_TEST_DEFAULT_DURATION 30
 #define PTHREAD_DETACH_TEST_DEFAULT_DURATION 30
 #define MUTEX_TEST_DEFAULT_DURATION 30
 #define MUTEX_CONTENDED_TEST_DEFAULT_DURATION 30
 #define STAT_TEST_DEFAULT_DURATION 30
 #define FSTAT_TEST_DEFAULT_DURATION 30
+#define POLL_TEST_DEFAULT_DURATION 30
+#define EPOLL_TEST_DEFAULT_DURATION 30
+#define IO_RING_TEST_DEFAULT_DURATION 60
 
 //
 // Define the number of variables supplied to an iteration of the execute test
@@ -201,12 +221,16 @@ typedef enum _PT_TEST_TYPE {
     PtTestMallocLarge,
     PtTestMallocRandom,
     PtTestMallocContended,
+    PtTestMallocScaling,
     PtTestPthreadJoin,
     PtTestPthreadDetach,
     PtTestMutex,
     PtTestMutexContended,
     PtTestStat,
     PtTestFstat,
+    PtTestPoll,
+    PtTestEpoll,
+    PtTestIoRing,
     PtTestTypeCount
 } PT_TEST_TYPE, *PPT_TEST_TYPE;
 
@@ -978,3 +1002,54 @@ Return Value:
 
 --*/
 
+void
+EventPollMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs the poll and epoll readiness notification benchmark
+    tests.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+void
+IoRingMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs the I/O ring benchmark test.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
@@ -252,6 +252,16 @@ Return Value:
                  MmStatistics.PageSize) / _1MB;
 
     printf("Non-Paged Physical Memory: %I64dMB\n", Megabytes);
+    printf("Largest Free Physical Run: %ldKB\n",
+           (MmStatistics.LargestFreePhysicalRun * MmStatistics.PageSize) /
+           _1KB);
+
+    printf("Physical Fragmentation: %d%%\n",
+           MmStatistics.PhysicalFragmentation);
+
+    printf("Pre-Zeroed Pages: %ld\n", MmStatistics.ZeroedPhysicalPages);
+    printf("Zero Page Hits: %ld\n", MmStatistics.ZeroPageHits);
+    printf("Zero Page Misses: %ld\n", MmStatistics.ZeroPageMisses);
     printf("Non Paged Pool:\n");
     printf("    Size: %ld\n", MmStatistics.NonPagedPool.TotalHeapSize);
     printf("    Maximum Size: %ld\n", MmStatistics.NonPagedPool.MaxHeapSize);
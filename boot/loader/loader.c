@@ -2188,14 +2188,17 @@ Return Value:
     AllocationSize = DescriptorCount * sizeof(MEMORY_DESCRIPTOR);
 
     //
-    // It also needs a word for each physical page, plus an extra page for the
-    // physical memory segments.
+    // It also needs three words for each physical page (the page's state plus
+    // its free list links), plus a couple of pages for the physical memory
+    // segments and their free lists.
     // Note: if the loader continues to be 32-bit for a 64-bit kernel, then
     // this ULONG calculation is off.
     //
 
-    AllocationSize += sizeof(ULONG) * (BoMemoryMap.TotalSpace >> PageShift);
-    AllocationSize += PageSize;
+    AllocationSize += (sizeof(ULONG) * 3) *
+                      (BoMemoryMap.TotalSpace >> PageShift);
+
+    AllocationSize += PageSize * 2;
     AllocationSize = ALIGN_RANGE_UP(AllocationSize, PageSize);
     Status = BopAllocateKernelBuffer(AllocationSize,
                                      MAP_FLAG_GLOBAL,
@@ -0,0 +1,3955 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ahci.c
+
+Abstract:
+
+    This module implements the Advanced Host Controller Interface (AHCI) SATA
+    driver. Each port with a disk attached is exposed as a disk device. Reads
+    and writes are issued with native command queuing when both the
+    controller and disk support it, so up to 32 commands can be outstanding on
+    each port.
+
+Author:
+
+    Minoca Corp. 16-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include <minoca/intrface/disk.h>
+#include "ahci.h"
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// This macro returns the correct time counter function depending on whether
+// the operation is occurring in critical mode or not.
+//
+
+#define AHCI_GET_TIME_FUNCTION(_CriticalMode) \
+    ((_CriticalMode) ? HlQueryTimeCounter : KeGetRecentTimeCounter)
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef
+ULONGLONG
+(*PAHCI_QUERY_TIME_COUNTER) (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns snap of the time counter.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns a snap of the time counter.
+
+--*/
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+AhciAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    );
+
+VOID
+AhciDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+AhciDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+AhciDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+AhciDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+AhciDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+INTERRUPT_STATUS
+AhciInterruptService (
+    PVOID Context
+    );
+
+INTERRUPT_STATUS
+AhciInterruptServiceDpc (
+    PVOID Context
+    );
+
+VOID
+AhcipDispatchControllerStateChange (
+    PIRP Irp,
+    PAHCI_CONTROLLER Controller
+    );
+
+VOID
+AhcipDispatchPortStateChange (
+    PIRP Irp,
+    PAHCI_PORT Port
+    );
+
+VOID
+AhcipDispatchPortSystemControl (
+    PIRP Irp,
+    PAHCI_PORT Port
+    );
+
+KSTATUS
+AhcipProcessResourceRequirements (
+    PIRP Irp,
+    PAHCI_CONTROLLER Controller
+    );
+
+KSTATUS
+AhcipStartController (
+    PIRP Irp,
+    PAHCI_CONTROLLER Controller
+    );
+
+KSTATUS
+AhcipResetController (
+    PAHCI_CONTROLLER Controller
+    );
+
+KSTATUS
+AhcipInitializePort (
+    PAHCI_CONTROLLER Controller,
+    ULONG PortIndex
+    );
+
+VOID
+AhcipDestroyPort (
+    PAHCI_PORT Port
+    );
+
+VOID
+AhcipEnumeratePorts (
+    PIRP Irp,
+    PAHCI_CONTROLLER Controller
+    );
+
+KSTATUS
+AhcipIdentifyDevice (
+    PAHCI_PORT Port
+    );
+
+VOID
+AhcipStopPort (
+    PAHCI_PORT Port,
+    BOOL StopFisReceive,
+    BOOL CriticalMode
+    );
+
+KSTATUS
+AhcipStartPort (
+    PAHCI_PORT Port,
+    BOOL CriticalMode
+    );
+
+KSTATUS
+AhcipWaitForPortRegister (
+    PAHCI_PORT Port,
+    ULONG Register,
+    ULONG Mask,
+    ULONG Value,
+    ULONGLONG TimeoutInMicroseconds,
+    BOOL CriticalMode
+    );
+
+ULONG
+AhcipAcquireSlot (
+    PAHCI_PORT Port,
+    BOOL Exclusive
+    );
+
+VOID
+AhcipReleaseSlot (
+    PAHCI_PORT Port,
+    ULONG SlotIndex
+    );
+
+KSTATUS
+AhcipStartTransfer (
+    PAHCI_PORT Port,
+    ULONG SlotIndex
+    );
+
+ULONG
+AhcipFillPrdt (
+    PAHCI_COMMAND_TABLE Table,
+    PIO_BUFFER IoBuffer,
+    UINTN IoBufferOffset,
+    UINTN Size,
+    ULONG BlockSize,
+    PUINTN TransferSize
+    );
+
+VOID
+AhcipSetupCommand (
+    PAHCI_PORT Port,
+    ULONG SlotIndex,
+    AHCI_ATA_COMMAND Command,
+    ULONGLONG BlockAddress,
+    ULONG BlockCount,
+    ULONG PrdtLength,
+    BOOL ForceUnitAccess
+    );
+
+VOID
+AhcipIssueCommand (
+    PAHCI_PORT Port,
+    ULONG SlotIndex,
+    BOOL Queued
+    );
+
+VOID
+AhcipServicePort (
+    PAHCI_PORT Port,
+    ULONG PendingBits
+    );
+
+VOID
+AhcipCompleteSlot (
+    PAHCI_PORT Port,
+    ULONG SlotIndex,
+    KSTATUS Status
+    );
+
+VOID
+AhcipBeginRecovery (
+    PAHCI_PORT Port,
+    ULONG StoppedSlots,
+    BOOL DeviceError
+    );
+
+VOID
+AhcipRecoverPort (
+    PVOID Parameter
+    );
+
+KSTATUS
+AhcipReadNcqErrorLog (
+    PAHCI_PORT Port,
+    PUCHAR TagByte
+    );
+
+KSTATUS
+AhcipExecuteCommand (
+    PAHCI_PORT Port,
+    AHCI_ATA_COMMAND Command,
+    PHYSICAL_ADDRESS Buffer,
+    ULONG BufferSize
+    );
+
+KSTATUS
+AhcipSynchronizeDevice (
+    PAHCI_PORT Port
+    );
+
+KSTATUS
+AhcipBlockIoReset (
+    PVOID DiskToken
+    );
+
+KSTATUS
+AhcipBlockRead (
+    PVOID DiskToken,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    PUINTN BlocksCompleted
+    );
+
+KSTATUS
+AhcipBlockWrite (
+    PVOID DiskToken,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    PUINTN BlocksCompleted
+    );
+
+KSTATUS
+AhcipPerformPolledIo (
+    PIRP_READ_WRITE IrpReadWrite,
+    PAHCI_PORT Port,
+    BOOL Write
+    );
+
+VOID
+AhcipProcessPciMsiInterfaceChangeNotification (
+    PVOID Context,
+    PDEVICE Device,
+    PVOID InterfaceBuffer,
+    ULONG InterfaceBufferSize,
+    BOOL Arrival
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+PDRIVER AhciDriver = NULL;
+UUID AhciPciMsiInterfaceUuid = UUID_PCI_MESSAGE_SIGNALED_INTERRUPTS;
+UUID AhciDiskInterfaceUuid = UUID_DISK_INTERFACE;
+
+DISK_INTERFACE AhciDiskInterfaceTemplate = {
+    DISK_INTERFACE_VERSION,
+    NULL,
+    AHCI_DEFAULT_BLOCK_SIZE,
+    0,
+    NULL,
+    AhcipBlockIoReset,
+    AhcipBlockRead,
+    AhcipBlockWrite
+};
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+DriverEntry (
+    PDRIVER Driver
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is the entry point for the AHCI driver. It registers its
+    other dispatch functions, and performs driver-wide initialization.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver object.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code on error.
+
+--*/
+
+{
+
+    DRIVER_FUNCTION_TABLE FunctionTable;
+    KSTATUS Status;
+
+    AhciDriver = Driver;
+    RtlZeroMemory(&FunctionTable, sizeof(DRIVER_FUNCTION_TABLE));
+    FunctionTable.Version = DRIVER_FUNCTION_TABLE_VERSION;
+    FunctionTable.AddDevice = AhciAddDevice;
+    FunctionTable.DispatchStateChange = AhciDispatchStateChange;
+    FunctionTable.DispatchOpen = AhciDispatchOpen;
+    FunctionTable.DispatchClose = AhciDispatchClose;
+    FunctionTable.DispatchIo = AhciDispatchIo;
+    FunctionTable.DispatchSystemControl = AhciDispatchSystemControl;
+    Status = IoRegisterDriverFunctions(Driver, &FunctionTable);
+    return Status;
+}
+
+KSTATUS
+AhciAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when a device is detected for which the AHCI driver
+    acts as the function driver. The driver will attach itself to the stack.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver being called.
+
+    DeviceId - Supplies a pointer to a string with the device ID.
+
+    ClassId - Supplies a pointer to a string containing the device's class ID.
+
+    CompatibleIds - Supplies a pointer to a string containing device IDs
+        that would be compatible with this device.
+
+    DeviceToken - Supplies an opaque token that the driver can use to identify
+        the device in the system. This token should be used when attaching to
+        the stack.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code if the driver was unsuccessful in attaching itself.
+
+--*/
+
+{
+
+    PAHCI_CONTROLLER Controller;
+    KSTATUS Status;
+
+    Controller = MmAllocateNonPagedPool(sizeof(AHCI_CONTROLLER),
+                                        AHCI_ALLOCATION_TAG);
+
+    if (Controller == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto AddDeviceEnd;
+    }
+
+    RtlZeroMemory(Controller, sizeof(AHCI_CONTROLLER));
+    Controller->Type = AhciControllerContext;
+    Controller->InterruptLine = INVALID_INTERRUPT_LINE;
+    Controller->InterruptHandle = INVALID_HANDLE;
+    Status = IoAttachDriverToDevice(Driver, DeviceToken, Controller);
+    if (!KSUCCESS(Status)) {
+        goto AddDeviceEnd;
+    }
+
+    Status = STATUS_SUCCESS;
+
+AddDeviceEnd:
+    if (!KSUCCESS(Status)) {
+        if (Controller != NULL) {
+            MmFreeNonPagedPool(Controller);
+        }
+    }
+
+    return Status;
+}
+
+VOID
+AhciDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles State Change IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PAHCI_CONTROLLER Controller;
+
+    Controller = DeviceContext;
+    switch (Controller->Type) {
+    case AhciControllerContext:
+        AhcipDispatchControllerStateChange(Irp, Controller);
+        break;
+
+    case AhciPortContext:
+        AhcipDispatchPortStateChange(Irp, (PAHCI_PORT)Controller);
+        break;
+
+    default:
+
+        ASSERT(FALSE);
+
+        IoCompleteIrp(AhciDriver, Irp, STATUS_INVALID_CONFIGURATION);
+        break;
+    }
+
+    return;
+}
+
+VOID
+AhciDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Open IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PAHCI_PORT Port;
+
+    //
+    // Only the disk can be opened or closed.
+    //
+
+    Port = (PAHCI_PORT)DeviceContext;
+    if (Port->Type != AhciPortContext) {
+        return;
+    }
+
+    Irp->U.Open.DeviceContext = Port;
+    IoCompleteIrp(AhciDriver, Irp, STATUS_SUCCESS);
+    return;
+}
+
+VOID
+AhciDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Close IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PAHCI_PORT Port;
+
+    //
+    // Only the disk can be opened or closed.
+    //
+
+    Port = (PAHCI_PORT)DeviceContext;
+    if (Port->Type != AhciPortContext) {
+        return;
+    }
+
+    IoCompleteIrp(AhciDriver, Irp, STATUS_SUCCESS);
+    return;
+}
+
+VOID
+AhciDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles I/O IRPs. On the way down, the IRP is given a command
+    slot and started, and then pended. Many IRPs can be in flight on a port at
+    once. On the way up, the IRP's I/O buffer state is cleaned up.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG IrpReadWriteFlags;
+    RUNLEVEL OldRunLevel;
+    BOOL PmReferenceAdded;
+    PAHCI_PORT Port;
+    BOOL ReadWriteIrpPrepared;
+    ULONG SlotIndex;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    Port = (PAHCI_PORT)Irp->U.ReadWrite.DeviceContext;
+    if (Port->Type != AhciPortContext) {
+        return;
+    }
+
+    IrpReadWriteFlags = IRP_READ_WRITE_FLAG_DMA;
+    if (Irp->MinorCode == IrpMinorIoWrite) {
+        IrpReadWriteFlags |= IRP_READ_WRITE_FLAG_WRITE;
+    }
+
+    //
+    // An IRP on the way up has already been completed by the interrupt path,
+    // which released its slot. Finish up the I/O buffer state here at low
+    // level.
+    //
+
+    if (Irp->Direction == IrpUp) {
+        Status = IoCompleteReadWriteIrp(&(Irp->U.ReadWrite), IrpReadWriteFlags);
+        if (!KSUCCESS(Status)) {
+            IoUpdateIrpStatus(Irp, Status);
+        }
+
+        PmDeviceReleaseReference(Port->OsDevice);
+        return;
+    }
+
+    PmReferenceAdded = FALSE;
+    ReadWriteIrpPrepared = FALSE;
+    Status = PmDeviceAddReference(Port->OsDevice);
+    if (!KSUCCESS(Status)) {
+        goto DispatchIoEnd;
+    }
+
+    PmReferenceAdded = TRUE;
+
+    ASSERT(Irp->U.ReadWrite.IoBytesCompleted == 0);
+    ASSERT(IS_ALIGNED(Irp->U.ReadWrite.IoOffset, Port->BlockSize) != FALSE);
+    ASSERT(IS_ALIGNED(Irp->U.ReadWrite.IoSizeInBytes, Port->BlockSize) !=
+           FALSE);
+
+    Irp->U.ReadWrite.NewIoOffset = Irp->U.ReadWrite.IoOffset;
+    if (Irp->U.ReadWrite.IoSizeInBytes == 0) {
+        Status = STATUS_SUCCESS;
+        goto DispatchIoEnd;
+    }
+
+    //
+    // Prepare the I/O buffer for DMA. The controller can gather from any
+    // even address, so the scatter gather list is built straight from the
+    // buffer's fragments without copying.
+    //
+
+    Status = IoPrepareReadWriteIrp(&(Irp->U.ReadWrite),
+                                   AHCI_DATA_ALIGNMENT,
+                                   0,
+                                   Port->Controller->MaxPhysicalAddress,
+                                   IrpReadWriteFlags);
+
+    if (!KSUCCESS(Status)) {
+        goto DispatchIoEnd;
+    }
+
+    ReadWriteIrpPrepared = TRUE;
+
+    //
+    // Get a command slot, waiting if they are all in use. From here on the
+    // IRP is pended, and the up direction finishes it off even if starting
+    // the transfer fails.
+    //
+
+    SlotIndex = AhcipAcquireSlot(Port, FALSE);
+    Port->Slot[SlotIndex].Irp = Irp;
+    IoPendIrp(AhciDriver, Irp);
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Port->Lock));
+    Status = AhcipStartTransfer(Port, SlotIndex);
+    if (!KSUCCESS(Status)) {
+        Port->Slot[SlotIndex].Irp = NULL;
+        AhcipReleaseSlot(Port, SlotIndex);
+    }
+
+    KeReleaseSpinLock(&(Port->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    if (!KSUCCESS(Status)) {
+        IoCompleteIrp(AhciDriver, Irp, Status);
+    }
+
+    return;
+
+DispatchIoEnd:
+    if (ReadWriteIrpPrepared != FALSE) {
+        IoCompleteReadWriteIrp(&(Irp->U.ReadWrite), IrpReadWriteFlags);
+    }
+
+    if (PmReferenceAdded != FALSE) {
+        PmDeviceReleaseReference(Port->OsDevice);
+    }
+
+    IoCompleteIrp(AhciDriver, Irp, Status);
+    return;
+}
+
+VOID
+AhciDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles System Control IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PAHCI_PORT Port;
+
+    ASSERT(Irp->MajorCode == IrpMajorSystemControl);
+
+    Port = (PAHCI_PORT)DeviceContext;
+    if (Port->Type == AhciPortContext) {
+        AhcipDispatchPortSystemControl(Irp, Port);
+    }
+
+    return;
+}
+
+INTERRUPT_STATUS
+AhciInterruptService (
+    PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the AHCI interrupt service routine. It
+    acknowledges each interrupting port and saves its status for the DPC.
+
+Arguments:
+
+    Context - Supplies the context pointer given to the system when the
+        interrupt was connected. In this case, this points to the AHCI
+        controller.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+{
+
+    PAHCI_CONTROLLER Controller;
+    ULONG PendingPorts;
+    PAHCI_PORT Port;
+    ULONG PortIndex;
+    ULONG PortStatus;
+    ULONG Remaining;
+
+    Controller = (PAHCI_CONTROLLER)Context;
+    PendingPorts = AHCI_READ_REGISTER(Controller, AHCI_INTERRUPT_STATUS);
+    if (PendingPorts == 0) {
+        return InterruptStatusNotClaimed;
+    }
+
+    //
+    // The port status has to be cleared before the global status bit, or the
+    // global bit simply sets again.
+    //
+
+    Remaining = PendingPorts;
+    while (Remaining != 0) {
+        PortIndex = RtlCountTrailingZeros32(Remaining);
+        Remaining &= ~(1 << PortIndex);
+        Port = Controller->Ports[PortIndex];
+        if (Port == NULL) {
+            continue;
+        }
+
+        PortStatus = AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_INTERRUPT_STATUS);
+        AHCI_WRITE_PORT_REGISTER(Port, AHCI_PORT_INTERRUPT_STATUS, PortStatus);
+        RtlAtomicOr32(&(Port->PendingStatus), PortStatus);
+    }
+
+    AHCI_WRITE_REGISTER(Controller, AHCI_INTERRUPT_STATUS, PendingPorts);
+    return InterruptStatusClaimed;
+}
+
+INTERRUPT_STATUS
+AhciInterruptServiceDpc (
+    PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the AHCI dispatch-level interrupt service routine.
+
+Arguments:
+
+    Context - Supplies the context pointer given to the system when the
+        interrupt was connected. In this case, this points to the AHCI
+        controller.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+{
+
+    PAHCI_CONTROLLER Controller;
+    INTERRUPT_STATUS InterruptStatus;
+    ULONG PendingBits;
+    PAHCI_PORT Port;
+    ULONG PortIndex;
+
+    Controller = (PAHCI_CONTROLLER)Context;
+    InterruptStatus = InterruptStatusNotClaimed;
+    for (PortIndex = 0; PortIndex < AHCI_MAX_PORTS; PortIndex += 1) {
+        Port = Controller->Ports[PortIndex];
+        if (Port == NULL) {
+            continue;
+        }
+
+        PendingBits = RtlAtomicExchange32(&(Port->PendingStatus), 0);
+        if (PendingBits != 0) {
+            AhcipServicePort(Port, PendingBits);
+            InterruptStatus = InterruptStatusClaimed;
+        }
+    }
+
+    return InterruptStatus;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+AhcipDispatchControllerStateChange (
+    PIRP Irp,
+    PAHCI_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles state change IRPs for an AHCI controller.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Controller - Supplies a pointer to the controller context.
+
+Return Value:
+
+    None. The routine completes the IRP if appropriate.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    if (Irp->Direction == IrpUp) {
+        if (!KSUCCESS(IoGetIrpStatus(Irp))) {
+            return;
+        }
+
+        switch (Irp->MinorCode) {
+        case IrpMinorQueryResources:
+            Status = AhcipProcessResourceRequirements(Irp, Controller);
+            if (!KSUCCESS(Status)) {
+                IoCompleteIrp(AhciDriver, Irp, Status);
+            }
+
+            break;
+
+        case IrpMinorStartDevice:
+            Status = AhcipStartController(Irp, Controller);
+            if (!KSUCCESS(Status)) {
+                IoCompleteIrp(AhciDriver, Irp, Status);
+            }
+
+            break;
+
+        case IrpMinorQueryChildren:
+            AhcipEnumeratePorts(Irp, Controller);
+            break;
+
+        case IrpMinorIdle:
+        case IrpMinorSuspend:
+        case IrpMinorResume:
+        default:
+            break;
+        }
+    }
+
+    return;
+}
+
+VOID
+AhcipDispatchPortStateChange (
+    PIRP Irp,
+    PAHCI_PORT Port
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles state change IRPs for a disk attached to an AHCI
+    port.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Port - Supplies a pointer to the port.
+
+Return Value:
+
+    None. The routine completes the IRP if appropriate.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    if (Irp->Direction == IrpDown) {
+        switch (Irp->MinorCode) {
+        case IrpMinorStartDevice:
+            Port->OsDevice = Irp->Device;
+            Status = PmInitialize(Irp->Device);
+            if (!KSUCCESS(Status)) {
+                IoCompleteIrp(AhciDriver, Irp, Status);
+                break;
+            }
+
+            //
+            // Publish the disk interface.
+            //
+
+            Status = STATUS_SUCCESS;
+            if (Port->DiskInterface.DiskToken == NULL) {
+                RtlCopyMemory(&(Port->DiskInterface),
+                              &AhciDiskInterfaceTemplate,
+                              sizeof(DISK_INTERFACE));
+
+                Port->DiskInterface.DiskToken = Port;
+                Port->DiskInterface.BlockSize = Port->BlockSize;
+                Port->DiskInterface.BlockCount = Port->TotalBlocks;
+                Status = IoCreateInterface(&AhciDiskInterfaceUuid,
+                                           Irp->Device,
+                                           &(Port->DiskInterface),
+                                           sizeof(DISK_INTERFACE));
+
+                if (!KSUCCESS(Status)) {
+                    Port->DiskInterface.DiskToken = NULL;
+                }
+            }
+
+            IoCompleteIrp(AhciDriver, Irp, Status);
+            break;
+
+        case IrpMinorQueryResources:
+        case IrpMinorQueryChildren:
+        case IrpMinorIdle:
+        case IrpMinorSuspend:
+        case IrpMinorResume:
+            IoCompleteIrp(AhciDriver, Irp, STATUS_SUCCESS);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return;
+}
+
+VOID
+AhcipDispatchPortSystemControl (
+    PIRP Irp,
+    PAHCI_PORT Port
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles System Control IRPs for a disk attached to an AHCI
+    port.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Port - Supplies a pointer to the port.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVOID Context;
+    PSYSTEM_CONTROL_FILE_OPERATION FileOperation;
+    PSYSTEM_CONTROL_LOOKUP Lookup;
+    PFILE_PROPERTIES Properties;
+    ULONGLONG PropertiesFileSize;
+    KSTATUS Status;
+
+    Context = Irp->U.SystemControl.SystemContext;
+    switch (Irp->MinorCode) {
+    case IrpMinorSystemControlLookup:
+        Lookup = (PSYSTEM_CONTROL_LOOKUP)Context;
+        Status = STATUS_PATH_NOT_FOUND;
+        if (Lookup->Root != FALSE) {
+
+            //
+            // Enable opening of the root as a single file.
+            //
+
+            Properties = &(Lookup->Properties);
+            Properties->FileId = 0;
+            Properties->Type = IoObjectBlockDevice;
+            Properties->HardLinkCount = 1;
+            Properties->BlockSize = Port->BlockSize;
+            Properties->BlockCount = Port->TotalBlocks;
+            WRITE_INT64_SYNC(&(Properties->FileSize),
+                             Port->TotalBlocks << Port->BlockShift);
+
+            Status = STATUS_SUCCESS;
+        }
+
+        IoCompleteIrp(AhciDriver, Irp, Status);
+        break;
+
+    //
+    // Writes to the disk's properties are not allowed. Fail if the data
+    // has changed.
+    //
+
+    case IrpMinorSystemControlWriteFileProperties:
+        FileOperation = (PSYSTEM_CONTROL_FILE_OPERATION)Context;
+        Properties = FileOperation->FileProperties;
+        READ_INT64_SYNC(&(Properties->FileSize), &PropertiesFileSize);
+        if ((Properties->FileId != 0) ||
+            (Properties->Type != IoObjectBlockDevice) ||
+            (Properties->HardLinkCount != 1) ||
+            (Properties->BlockSize != Port->BlockSize) ||
+            (Properties->BlockCount != Port->TotalBlocks) ||
+            (PropertiesFileSize != (Port->TotalBlocks << Port->BlockShift))) {
+
+            Status = STATUS_NOT_SUPPORTED;
+
+        } else {
+            Status = STATUS_SUCCESS;
+        }
+
+        IoCompleteIrp(AhciDriver, Irp, Status);
+        break;
+
+    //
+    // Do not support hard disk device truncation.
+    //
+
+    case IrpMinorSystemControlTruncate:
+        IoCompleteIrp(AhciDriver, Irp, STATUS_NOT_SUPPORTED);
+        break;
+
+    //
+    // Gather and return device information.
+    //
+
+    case IrpMinorSystemControlDeviceInformation:
+        break;
+
+    //
+    // Send a cache flush command to the device upon getting a synchronize
+    // request.
+    //
+
+    case IrpMinorSystemControlSynchronize:
+        Status = PmDeviceAddReference(Port->OsDevice);
+        if (!KSUCCESS(Status)) {
+            IoCompleteIrp(AhciDriver, Irp, Status);
+            break;
+        }
+
+        Status = AhcipSynchronizeDevice(Port);
+        PmDeviceReleaseReference(Port->OsDevice);
+        IoCompleteIrp(AhciDriver, Irp, Status);
+        break;
+
+    //
+    // Ignore everything unrecognized.
+    //
+
+    default:
+
+        ASSERT(FALSE);
+
+        break;
+    }
+
+    return;
+}
+
+KSTATUS
+AhcipProcessResourceRequirements (
+    PIRP Irp,
+    PAHCI_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine filters through the resource requirements presented by the
+    bus for an AHCI controller. It prefers a message signaled interrupt, and
+    adds an interrupt vector requirement for any interrupt line requested as
+    a fallback.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Controller - Supplies a pointer to the AHCI controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PRESOURCE_CONFIGURATION_LIST ConfigurationList;
+    ULONGLONG LineCharacteristics;
+    PRESOURCE_REQUIREMENT NextRequirement;
+    PRESOURCE_REQUIREMENT Requirement;
+    PRESOURCE_REQUIREMENT_LIST RequirementList;
+    KSTATUS Status;
+    ULONGLONG VectorCharacteristics;
+    PRESOURCE_REQUIREMENT VectorRequirement;
+    RESOURCE_REQUIREMENT VectorTemplate;
+
+    ASSERT((Irp->MajorCode == IrpMajorStateChange) &&
+           (Irp->MinorCode == IrpMinorQueryResources));
+
+    //
+    // Initialize a nice interrupt vector requirement in preparation.
+    //
+
+    RtlZeroMemory(&VectorTemplate, sizeof(RESOURCE_REQUIREMENT));
+    VectorTemplate.Type = ResourceTypeInterruptVector;
+    VectorTemplate.Minimum = 0;
+    VectorTemplate.Maximum = -1;
+    VectorTemplate.Length = 1;
+
+    //
+    // Register for the PCI MSI interface, which arrives immediately if the
+    // device supports MSI or MSI-X.
+    //
+
+    if ((Controller->PciMsiFlags &
+         AHCI_PCI_MSI_FLAG_INTERFACE_REGISTERED) == 0) {
+
+        Status = IoRegisterForInterfaceNotifications(
+                                &AhciPciMsiInterfaceUuid,
+                                AhcipProcessPciMsiInterfaceChangeNotification,
+                                Irp->Device,
+                                Controller,
+                                TRUE);
+
+        if (!KSUCCESS(Status)) {
+            goto ProcessResourceRequirementsEnd;
+        }
+
+        Controller->PciMsiFlags |= AHCI_PCI_MSI_FLAG_INTERFACE_REGISTERED;
+    }
+
+    ConfigurationList = Irp->U.QueryResources.ResourceRequirements;
+    if ((Controller->PciMsiFlags &
+         AHCI_PCI_MSI_FLAG_INTERFACE_AVAILABLE) != 0) {
+
+        //
+        // A single vector serves every port. Ask for one in each
+        // configuration, with the legacy lines as alternatives in case the
+        // vector allocation fails.
+        //
+
+        RequirementList = IoGetNextResourceConfiguration(ConfigurationList,
+                                                         NULL);
+
+        while (RequirementList != NULL) {
+            VectorTemplate.Characteristics = INTERRUPT_VECTOR_EDGE_TRIGGERED;
+            VectorTemplate.OwningRequirement = NULL;
+            Status = IoCreateAndAddResourceRequirement(&VectorTemplate,
+                                                       RequirementList,
+                                                       &VectorRequirement);
+
+            if (!KSUCCESS(Status)) {
+                goto ProcessResourceRequirementsEnd;
+            }
+
+            Requirement = IoGetNextResourceRequirement(RequirementList, NULL);
+            while (Requirement != NULL) {
+                NextRequirement = IoGetNextResourceRequirement(RequirementList,
+                                                               Requirement);
+
+                if (Requirement->Type != ResourceTypeInterruptLine) {
+                    Requirement = NextRequirement;
+                    continue;
+                }
+
+                VectorCharacteristics = 0;
+                LineCharacteristics = Requirement->Characteristics;
+                if ((LineCharacteristics & INTERRUPT_LINE_ACTIVE_LOW) != 0) {
+                    VectorCharacteristics |= INTERRUPT_VECTOR_ACTIVE_LOW;
+                }
+
+                if ((LineCharacteristics & INTERRUPT_LINE_ACTIVE_HIGH) != 0) {
+                    VectorCharacteristics |= INTERRUPT_VECTOR_ACTIVE_HIGH;
+                }
+
+                if ((LineCharacteristics &
+                     INTERRUPT_LINE_EDGE_TRIGGERED) != 0) {
+
+                    VectorCharacteristics |= INTERRUPT_VECTOR_EDGE_TRIGGERED;
+                }
+
+                VectorTemplate.Characteristics = VectorCharacteristics;
+                VectorTemplate.OwningRequirement = Requirement;
+                Status = IoCreateAndAddResourceRequirementAlternative(
+                                                            &VectorTemplate,
+                                                            VectorRequirement);
+
+                if (!KSUCCESS(Status)) {
+                    goto ProcessResourceRequirementsEnd;
+                }
+
+                Requirement = NextRequirement;
+            }
+
+            RequirementList = IoGetNextResourceConfiguration(ConfigurationList,
+                                                             RequirementList);
+        }
+
+        Controller->PciMsiFlags |= AHCI_PCI_MSI_FLAG_RESOURCES_REQUESTED;
+
+    //
+    // Otherwise stick with the legacy interrupt line.
+    //
+
+    } else {
+        Status = IoCreateAndAddInterruptVectorsForLines(ConfigurationList,
+                                                        &VectorTemplate);
+
+        if (!KSUCCESS(Status)) {
+            goto ProcessResourceRequirementsEnd;
+        }
+    }
+
+    Status = STATUS_SUCCESS;
+
+ProcessResourceRequirementsEnd:
+    return Status;
+}
+
+KSTATUS
+AhcipStartController (
+    PIRP Irp,
+    PAHCI_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts an AHCI controller device.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Controller - Supplies a pointer to the AHCI controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG AlignmentOffset;
+    PRESOURCE_ALLOCATION Allocation;
+    PRESOURCE_ALLOCATION_LIST AllocationList;
+    IO_CONNECT_INTERRUPT_PARAMETERS Connect;
+    PRESOURCE_ALLOCATION ControllerBase;
+    ULONG Control;
+    PHYSICAL_ADDRESS EndAddress;
+    PRESOURCE_ALLOCATION LineAllocation;
+    PCI_MSI_INFORMATION MsiInformation;
+    PINTERFACE_PCI_MSI MsiInterface;
+    PCI_MSI_TYPE MsiType;
+    ULONG PageSize;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    ULONG PortIndex;
+    PROCESSOR_SET ProcessorSet;
+    ULONG Size;
+    KSTATUS Status;
+
+    ControllerBase = NULL;
+    Status = PmInitialize(Irp->Device);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Status = PmDeviceAddReference(Irp->Device);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    //
+    // Loop through the allocated resources to get the controller base and the
+    // interrupt.
+    //
+
+    AllocationList = Irp->U.StartDevice.ProcessorLocalResources;
+    Allocation = IoGetNextResourceAllocation(AllocationList, NULL);
+    while (Allocation != NULL) {
+
+        //
+        // If the resource is an interrupt vector the presense of an owning
+        // interrupt line allocation will dictate whether or not MSI/MSI-X
+        // is used versus legacy interrupts.
+        //
+
+        if (Allocation->Type == ResourceTypeInterruptVector) {
+            LineAllocation = Allocation->OwningAllocation;
+            if (LineAllocation == NULL) {
+
+                ASSERT((Controller->PciMsiFlags &
+                        AHCI_PCI_MSI_FLAG_RESOURCES_REQUESTED) != 0);
+
+                Controller->InterruptLine = INVALID_INTERRUPT_LINE;
+                Controller->PciMsiFlags |=
+                                         AHCI_PCI_MSI_FLAG_RESOURCES_ALLOCATED;
+
+            } else {
+
+                ASSERT(LineAllocation->Type == ResourceTypeInterruptLine);
+
+                Controller->InterruptLine = LineAllocation->Allocation;
+            }
+
+            Controller->InterruptVector = Allocation->Allocation;
+            Controller->InterruptResourcesFound = TRUE;
+
+        //
+        // The AHCI registers live in the last memory BAR (BAR 5). Any earlier
+        // BARs are for legacy IDE emulation or vendor use.
+        //
+
+        } else if (Allocation->Type == ResourceTypePhysicalAddressSpace) {
+            if (Allocation->Length != 0) {
+                ControllerBase = Allocation;
+            }
+        }
+
+        Allocation = IoGetNextResourceAllocation(AllocationList, Allocation);
+    }
+
+    if ((ControllerBase == NULL) ||
+        (Controller->InterruptResourcesFound == FALSE)) {
+
+        Status = STATUS_INVALID_CONFIGURATION;
+        goto StartControllerEnd;
+    }
+
+    //
+    // Map the controller.
+    //
+
+    if (Controller->ControllerBase == NULL) {
+        PageSize = MmPageSize();
+        PhysicalAddress = ControllerBase->Allocation;
+        EndAddress = PhysicalAddress + ControllerBase->Length;
+        PhysicalAddress = ALIGN_RANGE_DOWN(PhysicalAddress, PageSize);
+        AlignmentOffset = ControllerBase->Allocation - PhysicalAddress;
+        EndAddress = ALIGN_RANGE_UP(EndAddress, PageSize);
+        Size = (ULONG)(EndAddress - PhysicalAddress);
+        Controller->ControllerBase = MmMapPhysicalAddress(PhysicalAddress,
+                                                          Size,
+                                                          TRUE,
+                                                          FALSE,
+                                                          TRUE);
+
+        if (Controller->ControllerBase == NULL) {
+            Status = STATUS_NO_MEMORY;
+            goto StartControllerEnd;
+        }
+
+        Controller->ControllerBase += AlignmentOffset;
+    }
+
+    Status = AhcipResetController(Controller);
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    //
+    // Bring up each implemented port. A port that fails to come up is left
+    // without a context so that it never reports a disk, but does not fail
+    // the whole controller.
+    //
+
+    for (PortIndex = 0; PortIndex < AHCI_MAX_PORTS; PortIndex += 1) {
+        if ((Controller->PortsImplemented & (1 << PortIndex)) == 0) {
+            continue;
+        }
+
+        Status = AhcipInitializePort(Controller, PortIndex);
+        if (!KSUCCESS(Status)) {
+            RtlDebugPrint("AHCI: Port %d failed to initialize: %d\n",
+                          PortIndex,
+                          Status);
+        }
+    }
+
+    //
+    // Connect the interrupt.
+    //
+
+    if (Controller->InterruptHandle == INVALID_HANDLE) {
+        RtlZeroMemory(&Connect, sizeof(IO_CONNECT_INTERRUPT_PARAMETERS));
+        Connect.Version = IO_CONNECT_INTERRUPT_PARAMETERS_VERSION;
+        Connect.Device = Irp->Device;
+        Connect.LineNumber = Controller->InterruptLine;
+        Connect.Vector = Controller->InterruptVector;
+        Connect.InterruptServiceRoutine = AhciInterruptService;
+        Connect.DispatchServiceRoutine = AhciInterruptServiceDpc;
+        Connect.Context = Controller;
+        Connect.Interrupt = &(Controller->InterruptHandle);
+        Status = IoConnectInterrupt(&Connect);
+        if (!KSUCCESS(Status)) {
+            goto StartControllerEnd;
+        }
+    }
+
+    //
+    // If MSI/MSI-X resources were allocated, then those additionally need to
+    // be enabled through the PCI interface. Prefer MSI and fall back to MSI-X.
+    //
+
+    if (Controller->InterruptLine == INVALID_INTERRUPT_LINE) {
+
+        ASSERT((Controller->PciMsiFlags &
+                AHCI_PCI_MSI_FLAG_RESOURCES_ALLOCATED) != 0);
+
+        ProcessorSet.Target = ProcessorTargetAny;
+        MsiType = PciMsiTypeBasic;
+        MsiInterface = &(Controller->PciMsiInterface);
+        Status = MsiInterface->SetVectors(MsiInterface->DeviceToken,
+                                          MsiType,
+                                          Controller->InterruptVector,
+                                          0,
+                                          1,
+                                          &ProcessorSet);
+
+        if (!KSUCCESS(Status)) {
+            MsiType = PciMsiTypeExtended;
+            Status = MsiInterface->SetVectors(MsiInterface->DeviceToken,
+                                              MsiType,
+                                              Controller->InterruptVector,
+                                              0,
+                                              1,
+                                              &ProcessorSet);
+
+            if (!KSUCCESS(Status)) {
+                goto StartControllerEnd;
+            }
+        }
+
+        RtlZeroMemory(&MsiInformation, sizeof(PCI_MSI_INFORMATION));
+        MsiInformation.Version = PCI_MSI_INTERFACE_INFORMATION_VERSION;
+        MsiInformation.MsiType = MsiType;
+        MsiInformation.Flags = PCI_MSI_INTERFACE_FLAG_ENABLED;
+        MsiInformation.VectorCount = 1;
+        Status = MsiInterface->GetSetInformation(MsiInterface->DeviceToken,
+                                                 &MsiInformation,
+                                                 TRUE);
+
+        if (!KSUCCESS(Status)) {
+            goto StartControllerEnd;
+        }
+    }
+
+    //
+    // Clear anything left over and turn on interrupts.
+    //
+
+    AHCI_WRITE_REGISTER(Controller, AHCI_INTERRUPT_STATUS, MAX_ULONG);
+    Control = AHCI_READ_REGISTER(Controller, AHCI_GLOBAL_HOST_CONTROL);
+    Control |= AHCI_GLOBAL_CONTROL_INTERRUPT_ENABLE;
+    AHCI_WRITE_REGISTER(Controller, AHCI_GLOBAL_HOST_CONTROL, Control);
+    Status = STATUS_SUCCESS;
+
+StartControllerEnd:
+    PmDeviceReleaseReference(Irp->Device);
+    return Status;
+}
+
+KSTATUS
+AhcipResetController (
+    PAHCI_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine resets an AHCI controller and reads its capabilities.
+
+Arguments:
+
+    Controller - Supplies a pointer to the AHCI controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG Control;
+    ULONGLONG Timeout;
+
+    //
+    // Switch the controller into AHCI mode, then reset it. The reset puts
+    // the enable bit back to its default, so set it again afterwards.
+    //
+
+    AHCI_WRITE_REGISTER(Controller,
+                        AHCI_GLOBAL_HOST_CONTROL,
+                        AHCI_GLOBAL_CONTROL_AHCI_ENABLE);
+
+    AHCI_WRITE_REGISTER(Controller,
+                        AHCI_GLOBAL_HOST_CONTROL,
+                        AHCI_GLOBAL_CONTROL_AHCI_ENABLE |
+                        AHCI_GLOBAL_CONTROL_RESET);
+
+    Timeout = KeGetRecentTimeCounter() +
+              KeConvertMicrosecondsToTimeTicks(AHCI_RESET_TIMEOUT);
+
+    do {
+        Control = AHCI_READ_REGISTER(Controller, AHCI_GLOBAL_HOST_CONTROL);
+        if ((Control & AHCI_GLOBAL_CONTROL_RESET) == 0) {
+            break;
+        }
+
+        KeDelayExecution(FALSE, FALSE, AHCI_POLL_INTERVAL);
+
+    } while (KeGetRecentTimeCounter() <= Timeout);
+
+    if ((Control & AHCI_GLOBAL_CONTROL_RESET) != 0) {
+        RtlDebugPrint("AHCI: Controller reset timed out.\n");
+        return STATUS_TIMEOUT;
+    }
+
+    AHCI_WRITE_REGISTER(Controller,
+                        AHCI_GLOBAL_HOST_CONTROL,
+                        AHCI_GLOBAL_CONTROL_AHCI_ENABLE);
+
+    Controller->Capabilities = AHCI_READ_REGISTER(Controller,
+                                                  AHCI_HOST_CAPABILITIES);
+
+    Controller->PortsImplemented = AHCI_READ_REGISTER(Controller,
+                                                      AHCI_PORTS_IMPLEMENTED);
+
+    Controller->CommandSlotCount =
+              ((Controller->Capabilities & AHCI_CAPABILITY_COMMAND_SLOTS_MASK) >>
+               AHCI_CAPABILITY_COMMAND_SLOTS_SHIFT) + 1;
+
+    Controller->MaxPhysicalAddress = MAX_ULONG;
+    if ((Controller->Capabilities & AHCI_CAPABILITY_64_BIT) != 0) {
+        Controller->MaxPhysicalAddress = MAX_ULONGLONG;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+AhcipInitializePort (
+    PAHCI_CONTROLLER Controller,
+    ULONG PortIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the context for an AHCI port if needed, points the
+    port at its command list and received FIS area, and starts it.
+
+Arguments:
+
+    Controller - Supplies a pointer to the AHCI controller.
+
+    PortIndex - Supplies the port number.
+
+Return Value:
+
+    STATUS_SUCCESS if the port was set up, even if no device is attached.
+
+    Error code on failure.
+
+--*/
+
+{
+
+    ULONG AllocationSize;
+    ULONG Command;
+    PVOID Memory;
+    ULONG IoBufferFlags;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    PAHCI_PORT Port;
+    PAHCI_SLOT Slot;
+    ULONG SlotIndex;
+    KSTATUS Status;
+
+    Port = Controller->Ports[PortIndex];
+    if (Port == NULL) {
+        Port = MmAllocateNonPagedPool(sizeof(AHCI_PORT), AHCI_ALLOCATION_TAG);
+        if (Port == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto InitializePortEnd;
+        }
+
+        RtlZeroMemory(Port, sizeof(AHCI_PORT));
+        Port->Type = AhciPortContext;
+        Port->Controller = Controller;
+        Port->Index = PortIndex;
+        Port->Registers = Controller->ControllerBase +
+                          AHCI_PORT_REGISTER_OFFSET(PortIndex);
+
+        Port->SlotMask = 1;
+        Port->BlockSize = AHCI_DEFAULT_BLOCK_SIZE;
+        Port->BlockShift = RtlCountTrailingZeros32(AHCI_DEFAULT_BLOCK_SIZE);
+        KeInitializeSpinLock(&(Port->Lock));
+        Port->SlotEvent = KeCreateEvent(NULL);
+        Port->CommandEvent = KeCreateEvent(NULL);
+        Port->RecoveryWorkItem = KeCreateWorkItem(NULL,
+                                                  WorkPriorityNormal,
+                                                  AhcipRecoverPort,
+                                                  Port,
+                                                  AHCI_ALLOCATION_TAG);
+
+        if ((Port->SlotEvent == NULL) || (Port->CommandEvent == NULL) ||
+            (Port->RecoveryWorkItem == NULL)) {
+
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto InitializePortEnd;
+        }
+
+        //
+        // Allocate the memory shared with the controller: the command list,
+        // the received FIS area, the recovery command table, the identify and
+        // log buffers, and a command table for each slot.
+        //
+
+        AllocationSize = AHCI_COMMAND_TABLE_OFFSET +
+                         (Controller->CommandSlotCount *
+                          AHCI_COMMAND_TABLE_SIZE);
+
+        IoBufferFlags = IO_BUFFER_FLAG_PHYSICALLY_CONTIGUOUS |
+                        IO_BUFFER_FLAG_MAP_NON_CACHED;
+
+        Port->IoBuffer = MmAllocateNonPagedIoBuffer(
+                                                0,
+                                                Controller->MaxPhysicalAddress,
+                                                AHCI_COMMAND_LIST_ALIGNMENT,
+                                                AllocationSize,
+                                                IoBufferFlags);
+
+        if (Port->IoBuffer == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto InitializePortEnd;
+        }
+
+        ASSERT(Port->IoBuffer->FragmentCount == 1);
+
+        Memory = Port->IoBuffer->Fragment[0].VirtualAddress;
+        PhysicalAddress = Port->IoBuffer->Fragment[0].PhysicalAddress;
+        RtlZeroMemory(Memory, AllocationSize);
+        Port->CommandList = Memory + AHCI_COMMAND_LIST_OFFSET;
+        Port->Identify = Memory + AHCI_IDENTIFY_OFFSET;
+        Port->IdentifyPhysicalAddress = PhysicalAddress + AHCI_IDENTIFY_OFFSET;
+        Port->RecoveryTable = Memory + AHCI_RECOVERY_TABLE_OFFSET;
+        Port->RecoveryTablePhysicalAddress = PhysicalAddress +
+                                             AHCI_RECOVERY_TABLE_OFFSET;
+
+        Port->Log = Memory + AHCI_LOG_OFFSET;
+        Port->LogPhysicalAddress = PhysicalAddress + AHCI_LOG_OFFSET;
+        for (SlotIndex = 0;
+             SlotIndex < Controller->CommandSlotCount;
+             SlotIndex += 1) {
+
+            Slot = &(Port->Slot[SlotIndex]);
+            Slot->Table = Memory + AHCI_COMMAND_TABLE_OFFSET +
+                          (SlotIndex * AHCI_COMMAND_TABLE_SIZE);
+
+            Slot->TablePhysicalAddress = PhysicalAddress +
+                                         AHCI_COMMAND_TABLE_OFFSET +
+                                         (SlotIndex * AHCI_COMMAND_TABLE_SIZE);
+        }
+
+        Controller->Ports[PortIndex] = Port;
+    }
+
+    //
+    // The port has to be idle before its memory addresses can be changed.
+    //
+
+    AhcipStopPort(Port, TRUE, FALSE);
+    PhysicalAddress = Port->IoBuffer->Fragment[0].PhysicalAddress;
+    AHCI_WRITE_PORT_REGISTER(Port,
+                             AHCI_PORT_COMMAND_LIST_BASE,
+                             (ULONG)(PhysicalAddress +
+                                     AHCI_COMMAND_LIST_OFFSET));
+
+    AHCI_WRITE_PORT_REGISTER(Port,
+                             AHCI_PORT_COMMAND_LIST_BASE_HIGH,
+                             (ULONG)((PhysicalAddress +
+                                      AHCI_COMMAND_LIST_OFFSET) >> 32));
+
+    AHCI_WRITE_PORT_REGISTER(Port,
+                             AHCI_PORT_FIS_BASE,
+                             (ULONG)(PhysicalAddress +
+                                     AHCI_RECEIVED_FIS_OFFSET));
+
+    AHCI_WRITE_PORT_REGISTER(Port,
+                             AHCI_PORT_FIS_BASE_HIGH,
+                             (ULONG)((PhysicalAddress +
+                                      AHCI_RECEIVED_FIS_OFFSET) >> 32));
+
+    //
+    // Spin up the device if the controller staggers spin up.
+    //
+
+    if ((Controller->Capabilities & AHCI_CAPABILITY_STAGGERED_SPIN_UP) != 0) {
+        Command = AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_COMMAND);
+        Command |= AHCI_PORT_COMMAND_SPIN_UP | AHCI_PORT_COMMAND_POWER_ON;
+        AHCI_WRITE_PORT_REGISTER(Port, AHCI_PORT_COMMAND, Command);
+    }
+
+    AHCI_WRITE_PORT_REGISTER(Port,
+                             AHCI_PORT_INTERRUPT_ENABLE,
+                             AHCI_PORT_INTERRUPT_DEFAULT_MASK);
+
+    //
+    // An empty port is not an error. Enumeration checks for a device later.
+    //
+
+    Status = AhcipStartPort(Port, FALSE);
+    if (Status == STATUS_NO_SUCH_DEVICE) {
+        Status = STATUS_SUCCESS;
+    }
+
+InitializePortEnd:
+    if (!KSUCCESS(Status)) {
+        if ((Port != NULL) && (Controller->Ports[PortIndex] != Port)) {
+            AhcipDestroyPort(Port);
+        }
+    }
+
+    return Status;
+}
+
+VOID
+AhcipDestroyPort (
+    PAHCI_PORT Port
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys an AHCI port context that was never published to the
+    controller.
+
+Arguments:
+
+    Port - Supplies a pointer to the port to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Port->IoBuffer != NULL) {
+        MmFreeIoBuffer(Port->IoBuffer);
+    }
+
+    if (Port->SlotEvent != NULL) {
+        KeDestroyEvent(Port->SlotEvent);
+    }
+
+    if (Port->CommandEvent != NULL) {
+        KeDestroyEvent(Port->CommandEvent);
+    }
+
+    if (Port->RecoveryWorkItem != NULL) {
+        KeDestroyWorkItem(Port->RecoveryWorkItem);
+    }
+
+    MmFreeNonPagedPool(Port);
+    return;
+}
+
+VOID
+AhcipEnumeratePorts (
+    PIRP Irp,
+    PAHCI_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine enumerates the disks attached to an AHCI controller.
+
+Arguments:
+
+    Irp - Supplies a pointer to the query children IRP.
+
+    Controller - Supplies a pointer to the AHCI controller.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG ChildCount;
+    PDEVICE Children[AHCI_MAX_PORTS];
+    PAHCI_PORT Port;
+    ULONG PortIndex;
+    KSTATUS Status;
+
+    Status = PmDeviceAddReference(Irp->Device);
+    if (!KSUCCESS(Status)) {
+        IoCompleteIrp(AhciDriver, Irp, Status);
+        return;
+    }
+
+    ChildCount = 0;
+    for (PortIndex = 0; PortIndex < AHCI_MAX_PORTS; PortIndex += 1) {
+        Port = Controller->Ports[PortIndex];
+        if (Port == NULL) {
+            continue;
+        }
+
+        Status = AhcipIdentifyDevice(Port);
+        if (!KSUCCESS(Status)) {
+            Port->Device = NULL;
+
+        } else if (Port->Device == NULL) {
+            Status = IoCreateDevice(AhciDriver,
+                                    Port,
+                                    Irp->Device,
+                                    "Disk",
+                                    DISK_CLASS_ID,
+                                    NULL,
+                                    &(Port->Device));
+
+            if (!KSUCCESS(Status)) {
+                Port->Device = NULL;
+            }
+        }
+
+        if (Port->Device != NULL) {
+            Children[ChildCount] = Port->Device;
+            ChildCount += 1;
+        }
+    }
+
+    if (ChildCount != 0) {
+        Status = IoMergeChildArrays(Irp,
+                                    Children,
+                                    ChildCount,
+                                    AHCI_ALLOCATION_TAG);
+
+        if (!KSUCCESS(Status)) {
+            goto EnumeratePortsEnd;
+        }
+    }
+
+    Status = STATUS_SUCCESS;
+
+EnumeratePortsEnd:
+    PmDeviceReleaseReference(Irp->Device);
+    IoCompleteIrp(AhciDriver, Irp, Status);
+    return;
+}
+
+KSTATUS
+AhcipIdentifyDevice (
+    PAHCI_PORT Port
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a disk is attached to the given port, and
+    if so sends it an IDENTIFY DEVICE command and records its geometry and
+    queuing capabilities.
+
+Arguments:
+
+    Port - Supplies a pointer to the port to query.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG BlockSize;
+    PAHCI_CONTROLLER Controller;
+    PUSHORT Identify;
+    RUNLEVEL OldRunLevel;
+    ULONG QueueDepth;
+    ULONG SataStatus;
+    ULONG Signature;
+    ULONG SlotMask;
+    KSTATUS Status;
+
+    Controller = Port->Controller;
+    SataStatus = AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_SATA_STATUS);
+    if ((SataStatus & AHCI_PORT_SATA_STATUS_DETECTION_MASK) !=
+        AHCI_PORT_SATA_STATUS_DEVICE_PRESENT) {
+
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    //
+    // ATAPI devices and port multipliers are not supported.
+    //
+
+    Signature = AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_SIGNATURE);
+    if (Signature != AHCI_SIGNATURE_ATA) {
+        RtlDebugPrint("AHCI: Port %d has unsupported device signature 0x%x.\n",
+                      Port->Index,
+                      Signature);
+
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    Status = AhcipExecuteCommand(Port,
+                                 AhciCommandIdentify,
+                                 Port->IdentifyPhysicalAddress,
+                                 AHCI_IDENTIFY_WORD_COUNT * sizeof(USHORT));
+
+    if (!KSUCCESS(Status)) {
+        RtlDebugPrint("AHCI: Port %d identify failed: %d\n",
+                      Port->Index,
+                      Status);
+
+        return Status;
+    }
+
+    //
+    // Every SATA disk worth talking to supports the 48-bit command set, and
+    // requiring it means synchronized writes can always use force unit
+    // access.
+    //
+
+    Identify = Port->Identify;
+    if ((Identify[AHCI_IDENTIFY_COMMAND_SET_SUPPORTED] &
+         AHCI_IDENTIFY_COMMAND_SET_LBA48) == 0) {
+
+        RtlDebugPrint("AHCI: Port %d disk lacks 48-bit addressing.\n",
+                      Port->Index);
+
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    Port->TotalBlocks =
+        (ULONGLONG)Identify[AHCI_IDENTIFY_TOTAL_SECTORS_LBA48] |
+        ((ULONGLONG)Identify[AHCI_IDENTIFY_TOTAL_SECTORS_LBA48 + 1] << 16) |
+        ((ULONGLONG)Identify[AHCI_IDENTIFY_TOTAL_SECTORS_LBA48 + 2] << 32) |
+        ((ULONGLONG)Identify[AHCI_IDENTIFY_TOTAL_SECTORS_LBA48 + 3] << 48);
+
+    //
+    // Disks with logical sectors larger than 512 bytes report their size in
+    // words.
+    //
+
+    BlockSize = AHCI_DEFAULT_BLOCK_SIZE;
+    if (((Identify[AHCI_IDENTIFY_SECTOR_SIZE] &
+          AHCI_IDENTIFY_SECTOR_SIZE_VALID_MASK) ==
+         AHCI_IDENTIFY_SECTOR_SIZE_VALID) &&
+        ((Identify[AHCI_IDENTIFY_SECTOR_SIZE] &
+          AHCI_IDENTIFY_SECTOR_SIZE_LARGE_LOGICAL) != 0)) {
+
+        BlockSize = (Identify[AHCI_IDENTIFY_LOGICAL_SECTOR_SIZE] |
+                     (Identify[AHCI_IDENTIFY_LOGICAL_SECTOR_SIZE + 1] << 16)) *
+                    sizeof(USHORT);
+
+        if ((BlockSize < AHCI_DEFAULT_BLOCK_SIZE) ||
+            (POWER_OF_2(BlockSize) == FALSE)) {
+
+            RtlDebugPrint("AHCI: Port %d unsupported block size %d.\n",
+                          Port->Index,
+                          BlockSize);
+
+            return STATUS_NOT_SUPPORTED;
+        }
+    }
+
+    //
+    // Queue as many commands as both the controller and the disk allow.
+    //
+
+    SlotMask = 1;
+    if (((Controller->Capabilities &
+          AHCI_CAPABILITY_NATIVE_COMMAND_QUEUING) != 0) &&
+        ((Identify[AHCI_IDENTIFY_SATA_CAPABILITIES] &
+          AHCI_IDENTIFY_SATA_NCQ) != 0)) {
+
+        QueueDepth = (Identify[AHCI_IDENTIFY_QUEUE_DEPTH] &
+                      AHCI_IDENTIFY_QUEUE_DEPTH_MASK) + 1;
+
+        if (QueueDepth > Controller->CommandSlotCount) {
+            QueueDepth = Controller->CommandSlotCount;
+        }
+
+        if (QueueDepth == AHCI_MAX_COMMAND_SLOTS) {
+            SlotMask = MAX_ULONG;
+
+        } else {
+            SlotMask = (1 << QueueDepth) - 1;
+        }
+    }
+
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Port->Lock));
+    Port->BlockSize = BlockSize;
+    Port->BlockShift = RtlCountTrailingZeros32(BlockSize);
+    Port->Lba48Supported = TRUE;
+    Port->SlotMask = SlotMask;
+    Port->NcqEnabled = FALSE;
+    if (SlotMask != 1) {
+        Port->NcqEnabled = TRUE;
+    }
+
+    KeReleaseSpinLock(&(Port->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    return STATUS_SUCCESS;
+}
+
+VOID
+AhcipStopPort (
+    PAHCI_PORT Port,
+    BOOL StopFisReceive,
+    BOOL CriticalMode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine stops a port's command list engine, which discards every
+    command in flight.
+
+Arguments:
+
+    Port - Supplies a pointer to the port.
+
+    StopFisReceive - Supplies a boolean indicating whether FIS receive should
+        be stopped as well.
+
+    CriticalMode - Supplies a boolean indicating if this is occurring in a
+        critical code path (TRUE), such as crash dump, or in the default code
+        path.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Command;
+
+    Command = AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_COMMAND);
+    if ((Command & AHCI_PORT_COMMAND_START) != 0) {
+        Command &= ~AHCI_PORT_COMMAND_START;
+        AHCI_WRITE_PORT_REGISTER(Port, AHCI_PORT_COMMAND, Command);
+    }
+
+    AhcipWaitForPortRegister(Port,
+                             AHCI_PORT_COMMAND,
+                             AHCI_PORT_COMMAND_LIST_RUNNING,
+                             0,
+                             AHCI_PORT_STOP_TIMEOUT,
+                             CriticalMode);
+
+    if (StopFisReceive != FALSE) {
+        Command = AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_COMMAND);
+        if ((Command & AHCI_PORT_COMMAND_FIS_RECEIVE_ENABLE) != 0) {
+            Command &= ~AHCI_PORT_COMMAND_FIS_RECEIVE_ENABLE;
+            AHCI_WRITE_PORT_REGISTER(Port, AHCI_PORT_COMMAND, Command);
+        }
+
+        AhcipWaitForPortRegister(Port,
+                                 AHCI_PORT_COMMAND,
+                                 AHCI_PORT_COMMAND_FIS_RECEIVE_RUNNING,
+                                 0,
+                                 AHCI_PORT_STOP_TIMEOUT,
+                                 CriticalMode);
+    }
+
+    return;
+}
+
+KSTATUS
+AhcipStartPort (
+    PAHCI_PORT Port,
+    BOOL CriticalMode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts a stopped port's command list engine once the attached
+    device is ready, resetting the link if the device stays busy.
+
+Arguments:
+
+    Port - Supplies a pointer to the port.
+
+    CriticalMode - Supplies a boolean indicating if this is occurring in a
+        critical code path (TRUE), such as crash dump, or in the default code
+        path.
+
+Return Value:
+
+    STATUS_SUCCESS if the port is running.
+
+    STATUS_NO_SUCH_DEVICE if no device is attached.
+
+    STATUS_TIMEOUT if the device never became ready.
+
+--*/
+
+{
+
+    ULONG Command;
+    ULONG Control;
+    KSTATUS Status;
+
+    Command = AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_COMMAND);
+    Command |= AHCI_PORT_COMMAND_FIS_RECEIVE_ENABLE;
+    AHCI_WRITE_PORT_REGISTER(Port, AHCI_PORT_COMMAND, Command);
+    Status = AhcipWaitForPortRegister(Port,
+                                      AHCI_PORT_SATA_STATUS,
+                                      AHCI_PORT_SATA_STATUS_DETECTION_MASK,
+                                      AHCI_PORT_SATA_STATUS_DEVICE_PRESENT,
+                                      AHCI_LINK_TIMEOUT,
+                                      CriticalMode);
+
+    if (!KSUCCESS(Status)) {
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    AHCI_WRITE_PORT_REGISTER(Port, AHCI_PORT_SATA_ERROR, MAX_ULONG);
+    Status = AhcipWaitForPortRegister(Port,
+                                      AHCI_PORT_TASK_FILE_DATA,
+                                      AHCI_PORT_TASK_FILE_BUSY_MASK,
+                                      0,
+                                      AHCI_READY_TIMEOUT,
+                                      CriticalMode);
+
+    //
+    // If the device is wedged, either override the busy bits or reset the
+    // link to get it talking again.
+    //
+
+    if (!KSUCCESS(Status)) {
+        if ((Port->Controller->Capabilities &
+             AHCI_CAPABILITY_COMMAND_LIST_OVERRIDE) != 0) {
+
+            Command = AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_COMMAND);
+            Command |= AHCI_PORT_COMMAND_LIST_OVERRIDE;
+            AHCI_WRITE_PORT_REGISTER(Port, AHCI_PORT_COMMAND, Command);
+            Status = AhcipWaitForPortRegister(Port,
+                                              AHCI_PORT_COMMAND,
+                                              AHCI_PORT_COMMAND_LIST_OVERRIDE,
+                                              0,
+                                              AHCI_READY_TIMEOUT,
+                                              CriticalMode);
+
+        } else {
+            Control = AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_SATA_CONTROL);
+            Control &= ~AHCI_PORT_SATA_CONTROL_DETECTION_MASK;
+            AHCI_WRITE_PORT_REGISTER(Port,
+                                     AHCI_PORT_SATA_CONTROL,
+                                     Control | AHCI_PORT_SATA_CONTROL_COMRESET);
+
+            HlBusySpin(AHCI_COMRESET_DELAY);
+            AHCI_WRITE_PORT_REGISTER(Port, AHCI_PORT_SATA_CONTROL, Control);
+            Status = AhcipWaitForPortRegister(
+                                         Port,
+                                         AHCI_PORT_SATA_STATUS,
+                                         AHCI_PORT_SATA_STATUS_DETECTION_MASK,
+                                         AHCI_PORT_SATA_STATUS_DEVICE_PRESENT,
+                                         AHCI_LINK_TIMEOUT,
+                                         CriticalMode);
+
+            if (KSUCCESS(Status)) {
+                AHCI_WRITE_PORT_REGISTER(Port,
+                                         AHCI_PORT_SATA_ERROR,
+                                         MAX_ULONG);
+
+                Status = AhcipWaitForPortRegister(
+                                                Port,
+                                                AHCI_PORT_TASK_FILE_DATA,
+                                                AHCI_PORT_TASK_FILE_BUSY_MASK,
+                                                0,
+                                                AHCI_READY_TIMEOUT,
+                                                CriticalMode);
+            }
+        }
+
+        if (!KSUCCESS(Status)) {
+            RtlDebugPrint("AHCI: Port %d device not ready.\n", Port->Index);
+            return Status;
+        }
+    }
+
+    AHCI_WRITE_PORT_REGISTER(Port, AHCI_PORT_INTERRUPT_STATUS, MAX_ULONG);
+    Command = AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_COMMAND);
+    Command |= AHCI_PORT_COMMAND_START;
+    AHCI_WRITE_PORT_REGISTER(Port, AHCI_PORT_COMMAND, Command);
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+AhcipWaitForPortRegister (
+    PAHCI_PORT Port,
+    ULONG Register,
+    ULONG Mask,
+    ULONG Value,
+    ULONGLONG TimeoutInMicroseconds,
+    BOOL CriticalMode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine spins until the masked value of a port register matches the
+    given value.
+
+Arguments:
+
+    Port - Supplies a pointer to the port.
+
+    Register - Supplies the port register to read.
+
+    Mask - Supplies the bits of the register to compare.
+
+    Value - Supplies the value the masked register must equal.
+
+    TimeoutInMicroseconds - Supplies the maximum time to wait.
+
+    CriticalMode - Supplies a boolean indicating if this is occurring in a
+        critical code path (TRUE), such as crash dump, or in the default code
+        path.
+
+Return Value:
+
+    STATUS_SUCCESS if the register reached the value.
+
+    STATUS_TIMEOUT otherwise.
+
+--*/
+
+{
+
+    PAHCI_QUERY_TIME_COUNTER QueryTimeCounter;
+    ULONGLONG Timeout;
+
+    QueryTimeCounter = AHCI_GET_TIME_FUNCTION(CriticalMode);
+    Timeout = QueryTimeCounter() +
+              ((HlQueryTimeCounterFrequency() * TimeoutInMicroseconds) /
+               MICROSECONDS_PER_SECOND);
+
+    do {
+        if ((AHCI_READ_PORT_REGISTER(Port, Register) & Mask) == Value) {
+            return STATUS_SUCCESS;
+        }
+
+        HlBusySpin(AHCI_POLL_INTERVAL);
+
+    } while (QueryTimeCounter() <= Timeout);
+
+    if ((AHCI_READ_PORT_REGISTER(Port, Register) & Mask) == Value) {
+        return STATUS_SUCCESS;
+    }
+
+    return STATUS_TIMEOUT;
+}
+
+ULONG
+AhcipAcquireSlot (
+    PAHCI_PORT Port,
+    BOOL Exclusive
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates a command slot on the given port, blocking until
+    one is free. This routine must be called at low level.
+
+Arguments:
+
+    Port - Supplies a pointer to the port.
+
+    Exclusive - Supplies a boolean indicating whether the caller needs the
+        port to itself, which is required for commands that cannot be queued
+        alongside others. Exclusive callers wait for the port to drain, and
+        hold off new queued commands while they wait.
+
+Return Value:
+
+    Returns the allocated slot index.
+
+--*/
+
+{
+
+    ULONG FreeSlots;
+    RUNLEVEL OldRunLevel;
+    ULONG SlotIndex;
+    BOOL Waiting;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    Waiting = FALSE;
+    while (TRUE) {
+        SlotIndex = AHCI_INVALID_SLOT;
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(Port->Lock));
+        if (Exclusive != FALSE) {
+            if (Port->BusySlots == 0) {
+                Port->BusySlots = Port->SlotMask;
+                Port->Exclusive = TRUE;
+                SlotIndex = 0;
+                if (Waiting != FALSE) {
+                    Port->ExclusiveWaiters -= 1;
+                }
+
+            } else if (Waiting == FALSE) {
+                Port->ExclusiveWaiters += 1;
+                Waiting = TRUE;
+            }
+
+        } else if (Port->ExclusiveWaiters == 0) {
+            FreeSlots = Port->SlotMask & ~(Port->BusySlots);
+            if (FreeSlots != 0) {
+                SlotIndex = RtlCountTrailingZeros32(FreeSlots);
+                Port->BusySlots |= 1 << SlotIndex;
+            }
+        }
+
+        if (SlotIndex == AHCI_INVALID_SLOT) {
+            KeSignalEvent(Port->SlotEvent, SignalOptionUnsignal);
+        }
+
+        KeReleaseSpinLock(&(Port->Lock));
+        KeLowerRunLevel(OldRunLevel);
+        if (SlotIndex != AHCI_INVALID_SLOT) {
+            break;
+        }
+
+        KeWaitForEvent(Port->SlotEvent, FALSE, WAIT_TIME_INDEFINITE);
+    }
+
+    return SlotIndex;
+}
+
+VOID
+AhcipReleaseSlot (
+    PAHCI_PORT Port,
+    ULONG SlotIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a command slot and wakes anyone waiting for one. This
+    routine assumes the port lock is held.
+
+Arguments:
+
+    Port - Supplies a pointer to the port.
+
+    SlotIndex - Supplies the slot to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT((Port->BusySlots & (1 << SlotIndex)) != 0);
+    ASSERT((Port->IssuedSlots & (1 << SlotIndex)) == 0);
+
+    if (Port->Exclusive != FALSE) {
+        Port->Exclusive = FALSE;
+        Port->BusySlots = 0;
+
+    } else {
+        Port->BusySlots &= ~(1 << SlotIndex);
+    }
+
+    KeSignalEvent(Port->SlotEvent, SignalOptionSignalAll);
+    return;
+}
+
+KSTATUS
+AhcipStartTransfer (
+    PAHCI_PORT Port,
+    ULONG SlotIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine builds and issues the next piece of the read or write IRP
+    in the given slot. This routine assumes the port lock is held.
+
+Arguments:
+
+    Port - Supplies a pointer to the port.
+
+    SlotIndex - Supplies the slot holding the IRP.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONGLONG BlockAddress;
+    UINTN BytesPreviouslyCompleted;
+    AHCI_ATA_COMMAND Command;
+    BOOL ForceUnitAccess;
+    PIRP Irp;
+    UINTN MaxTransferSize;
+    ULONG PrdtLength;
+    PAHCI_SLOT Slot;
+    UINTN TransferSize;
+    BOOL Write;
+
+    Slot = &(Port->Slot[SlotIndex]);
+    Irp = Slot->Irp;
+
+    ASSERT(Irp != NULL);
+    ASSERT(Irp->U.ReadWrite.IoBuffer != NULL);
+
+    BytesPreviouslyCompleted = Irp->U.ReadWrite.IoBytesCompleted;
+
+    ASSERT(BytesPreviouslyCompleted < Irp->U.ReadWrite.IoSizeInBytes);
+    ASSERT(Irp->U.ReadWrite.NewIoOffset ==
+           (Irp->U.ReadWrite.IoOffset + BytesPreviouslyCompleted));
+
+    TransferSize = Irp->U.ReadWrite.IoSizeInBytes - BytesPreviouslyCompleted;
+    MaxTransferSize = (UINTN)AHCI_MAX_TRANSFER_BLOCKS << Port->BlockShift;
+    if (TransferSize > MaxTransferSize) {
+        TransferSize = MaxTransferSize;
+    }
+
+    PrdtLength = AhcipFillPrdt(
+                     Slot->Table,
+                     Irp->U.ReadWrite.IoBuffer,
+                     MmGetIoBufferCurrentOffset(Irp->U.ReadWrite.IoBuffer) +
+                     BytesPreviouslyCompleted,
+                     TransferSize,
+                     Port->BlockSize,
+                     &TransferSize);
+
+    if (PrdtLength == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Write = FALSE;
+    ForceUnitAccess = FALSE;
+    if (Irp->MinorCode == IrpMinorIoWrite) {
+        Write = TRUE;
+        if ((Irp->U.ReadWrite.IoFlags & IO_FLAG_DATA_SYNCHRONIZED) != 0) {
+            ForceUnitAccess = TRUE;
+        }
+    }
+
+    if (Port->NcqEnabled != FALSE) {
+        Command = AhciCommandReadFpdmaQueued;
+        if (Write != FALSE) {
+            Command = AhciCommandWriteFpdmaQueued;
+        }
+
+    } else {
+        Command = AhciCommandReadDma48;
+        if (Write != FALSE) {
+            Command = AhciCommandWriteDma48;
+            if (ForceUnitAccess != FALSE) {
+                Command = AhciCommandWriteDmaForceUnit48;
+            }
+        }
+    }
+
+    BlockAddress = Irp->U.ReadWrite.NewIoOffset >> Port->BlockShift;
+    AhcipSetupCommand(Port,
+                      SlotIndex,
+                      Command,
+                      BlockAddress,
+                      TransferSize >> Port->BlockShift,
+                      PrdtLength,
+                      ForceUnitAccess);
+
+    Slot->IoSize = TransferSize;
+    AhcipIssueCommand(Port, SlotIndex, Port->NcqEnabled);
+    return STATUS_SUCCESS;
+}
+
+ULONG
+AhcipFillPrdt (
+    PAHCI_COMMAND_TABLE Table,
+    PIO_BUFFER IoBuffer,
+    UINTN IoBufferOffset,
+    UINTN Size,
+    ULONG BlockSize,
+    PUINTN TransferSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fills out a command table's physical region descriptors
+    directly from an I/O buffer's fragments, merging physically contiguous
+    fragments. If the table fills up, the transfer is trimmed to a whole
+    number of blocks.
+
+Arguments:
+
+    Table - Supplies a pointer to the command table to fill out.
+
+    IoBuffer - Supplies a pointer to the I/O buffer.
+
+    IoBufferOffset - Supplies the offset into the I/O buffer where the
+        transfer begins.
+
+    Size - Supplies the number of bytes to transfer.
+
+    BlockSize - Supplies the disk's block size.
+
+    TransferSize - Supplies a pointer where the number of bytes the table
+        actually describes is returned.
+
+Return Value:
+
+    Returns the number of physical region descriptors filled out, which is
+    zero if not even one block could be described.
+
+--*/
+
+{
+
+    UINTN EntrySize;
+    PIO_BUFFER_FRAGMENT Fragment;
+    UINTN FragmentIndex;
+    UINTN FragmentOffset;
+    UINTN LastSize;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    PHYSICAL_ADDRESS PreviousEnd;
+    PAHCI_PRDT Prdt;
+    ULONG PrdtIndex;
+    UINTN Remaining;
+    UINTN Transfer;
+    UINTN Trim;
+
+    //
+    // Get to the current spot in the I/O buffer.
+    //
+
+    FragmentIndex = 0;
+    FragmentOffset = 0;
+    while (IoBufferOffset != 0) {
+
+        ASSERT(FragmentIndex < IoBuffer->FragmentCount);
+
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        if (IoBufferOffset < Fragment->Size) {
+            FragmentOffset = IoBufferOffset;
+            break;
+        }
+
+        IoBufferOffset -= Fragment->Size;
+        FragmentIndex += 1;
+    }
+
+    Prdt = Table->Prdt;
+    PrdtIndex = 0;
+    PreviousEnd = 0;
+    Remaining = Size;
+    while ((Remaining != 0) && (FragmentIndex < IoBuffer->FragmentCount)) {
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        PhysicalAddress = Fragment->PhysicalAddress + FragmentOffset;
+        EntrySize = Fragment->Size - FragmentOffset;
+        if (EntrySize > Remaining) {
+            EntrySize = Remaining;
+        }
+
+        ASSERT((IS_ALIGNED(PhysicalAddress, AHCI_DATA_ALIGNMENT) != FALSE) &&
+               (IS_ALIGNED(EntrySize, AHCI_DATA_ALIGNMENT) != FALSE));
+
+        //
+        // Extend the previous entry if this piece follows on from it in
+        // physical memory. Otherwise start a new entry.
+        //
+
+        LastSize = 0;
+        if (PrdtIndex != 0) {
+            LastSize = (Prdt[PrdtIndex - 1].ByteCount &
+                        AHCI_PRDT_BYTE_COUNT_MASK) + 1;
+        }
+
+        if ((PrdtIndex != 0) && (PhysicalAddress == PreviousEnd) &&
+            (LastSize < AHCI_PRDT_MAX_SIZE)) {
+
+            if (EntrySize > AHCI_PRDT_MAX_SIZE - LastSize) {
+                EntrySize = AHCI_PRDT_MAX_SIZE - LastSize;
+            }
+
+            Prdt[PrdtIndex - 1].ByteCount = LastSize + EntrySize - 1;
+
+        } else {
+            if (PrdtIndex == AHCI_PRDT_ENTRY_COUNT) {
+                break;
+            }
+
+            if (EntrySize > AHCI_PRDT_MAX_SIZE) {
+                EntrySize = AHCI_PRDT_MAX_SIZE;
+            }
+
+            Prdt[PrdtIndex].Address = (ULONG)PhysicalAddress;
+            Prdt[PrdtIndex].AddressHigh = (ULONG)(PhysicalAddress >> 32);
+            Prdt[PrdtIndex].Reserved = 0;
+            Prdt[PrdtIndex].ByteCount = EntrySize - 1;
+            PrdtIndex += 1;
+        }
+
+        PreviousEnd = PhysicalAddress + EntrySize;
+        Remaining -= EntrySize;
+        FragmentOffset += EntrySize;
+        if (FragmentOffset >= Fragment->Size) {
+            FragmentIndex += 1;
+            FragmentOffset = 0;
+        }
+    }
+
+    //
+    // If the table ran out before the whole request fit, back off to a block
+    // boundary. The rest goes in the next command.
+    //
+
+    Transfer = Size - Remaining;
+    Trim = Transfer & (BlockSize - 1);
+    while ((Trim != 0) && (PrdtIndex != 0)) {
+        LastSize = (Prdt[PrdtIndex - 1].ByteCount &
+                    AHCI_PRDT_BYTE_COUNT_MASK) + 1;
+
+        if (LastSize > Trim) {
+            Prdt[PrdtIndex - 1].ByteCount = LastSize - Trim - 1;
+            Transfer -= Trim;
+            Trim = 0;
+
+        } else {
+            PrdtIndex -= 1;
+            Transfer -= LastSize;
+            Trim -= LastSize;
+        }
+    }
+
+    *TransferSize = Transfer;
+    if (Transfer == 0) {
+        PrdtIndex = 0;
+    }
+
+    return PrdtIndex;
+}
+
+VOID
+AhcipSetupCommand (
+    PAHCI_PORT Port,
+    ULONG SlotIndex,
+    AHCI_ATA_COMMAND Command,
+    ULONGLONG BlockAddress,
+    ULONG BlockCount,
+    ULONG PrdtLength,
+    BOOL ForceUnitAccess
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fills out the command FIS and command header for a slot. The
+    slot's physical region descriptors must already be filled out.
+
+Arguments:
+
+    Port - Supplies a pointer to the port.
+
+    SlotIndex - Supplies the slot to set up.
+
+    Command - Supplies the ATA command to send.
+
+    BlockAddress - Supplies the starting block of a read or write.
+
+    BlockCount - Supplies the number of blocks to read or write.
+
+    PrdtLength - Supplies the number of physical region descriptors in use.
+
+    ForceUnitAccess - Supplies a boolean indicating whether a queued write
+        should bypass the disk's volatile cache.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PSATA_FIS_REGISTER_H2D Fis;
+    ULONG Flags;
+    PAHCI_COMMAND_HEADER Header;
+    PAHCI_SLOT Slot;
+
+    ASSERT(BlockCount <= AHCI_MAX_TRANSFER_BLOCKS);
+    ASSERT(PrdtLength <= AHCI_PRDT_ENTRY_COUNT);
+
+    Slot = &(Port->Slot[SlotIndex]);
+    Fis = (PSATA_FIS_REGISTER_H2D)(Slot->Table->CommandFis);
+    RtlZeroMemory(Fis, sizeof(SATA_FIS_REGISTER_H2D));
+    Fis->Type = SATA_FIS_TYPE_REGISTER_H2D;
+    Fis->Flags = SATA_FIS_REGISTER_H2D_COMMAND;
+    Fis->Command = Command;
+    Flags = (sizeof(SATA_FIS_REGISTER_H2D) / sizeof(ULONG)) |
+            (PrdtLength << AHCI_COMMAND_HEADER_PRDT_LENGTH_SHIFT);
+
+    switch (Command) {
+
+    //
+    // Queued commands carry the block count in the features register and the
+    // tag in the count register.
+    //
+
+    case AhciCommandReadFpdmaQueued:
+    case AhciCommandWriteFpdmaQueued:
+        Fis->FeaturesLow = (UCHAR)BlockCount;
+        Fis->FeaturesHigh = (UCHAR)(BlockCount >> 8);
+        Fis->CountLow = SlotIndex << AHCI_NCQ_TAG_SHIFT;
+        Fis->Device = AHCI_DEVICE_LBA;
+        if (ForceUnitAccess != FALSE) {
+            Fis->Device |= AHCI_DEVICE_FORCE_UNIT_ACCESS;
+        }
+
+        break;
+
+    case AhciCommandReadDma48:
+    case AhciCommandWriteDma48:
+    case AhciCommandWriteDmaForceUnit48:
+        Fis->CountLow = (UCHAR)BlockCount;
+        Fis->CountHigh = (UCHAR)(BlockCount >> 8);
+        Fis->Device = AHCI_DEVICE_LBA;
+        break;
+
+    default:
+        break;
+    }
+
+    Fis->Lba0 = (UCHAR)BlockAddress;
+    Fis->Lba1 = (UCHAR)(BlockAddress >> 8);
+    Fis->Lba2 = (UCHAR)(BlockAddress >> 16);
+    Fis->Lba3 = (UCHAR)(BlockAddress >> 24);
+    Fis->Lba4 = (UCHAR)(BlockAddress >> 32);
+    Fis->Lba5 = (UCHAR)(BlockAddress >> 40);
+    if ((Command == AhciCommandWriteFpdmaQueued) ||
+        (Command == AhciCommandWriteDma48) ||
+        (Command == AhciCommandWriteDmaForceUnit48)) {
+
+        Flags |= AHCI_COMMAND_HEADER_WRITE;
+    }
+
+    Header = &(Port->CommandList[SlotIndex]);
+    Header->Flags = Flags;
+    Header->ByteCount = 0;
+    Header->TableAddress = (ULONG)(Slot->TablePhysicalAddress);
+    Header->TableAddressHigh = (ULONG)(Slot->TablePhysicalAddress >> 32);
+    return;
+}
+
+VOID
+AhcipIssueCommand (
+    PAHCI_PORT Port,
+    ULONG SlotIndex,
+    BOOL Queued
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands a set up command slot to the controller, or holds it
+    back until error recovery is done. This routine assumes the port lock is
+    held.
+
+Arguments:
+
+    Port - Supplies a pointer to the port.
+
+    SlotIndex - Supplies the slot to issue.
+
+    Queued - Supplies a boolean indicating whether this is a native command
+        queuing command.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Mask;
+
+    Mask = 1 << SlotIndex;
+
+    ASSERT((Port->IssuedSlots & Mask) == 0);
+
+    Port->Slot[SlotIndex].Queued = Queued;
+    if (Port->Recovering != FALSE) {
+        Port->DeferredSlots |= Mask;
+        return;
+    }
+
+    //
+    // The command table and header live in uncached memory, but make sure
+    // the writes to them land before the controller is told to go.
+    //
+
+    RtlMemoryBarrier();
+    Port->IssuedSlots |= Mask;
+    if (Queued != FALSE) {
+        AHCI_WRITE_PORT_REGISTER(Port, AHCI_PORT_SATA_ACTIVE, Mask);
+    }
+
+    AHCI_WRITE_PORT_REGISTER(Port, AHCI_PORT_COMMAND_ISSUE, Mask);
+    return;
+}
+
+VOID
+AhcipServicePort (
+    PAHCI_PORT Port,
+    ULONG PendingBits
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles interrupt status for a port at dispatch level. It
+    completes every command the controller has finished, and on an error
+    hands the commands still outstanding to the recovery work item.
+
+Arguments:
+
+    Port - Supplies a pointer to the port.
+
+    PendingBits - Supplies the port interrupt status bits gathered by the
+        interrupt service routine.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Active;
+    ULONG Completed;
+    ULONG SlotIndex;
+
+    KeAcquireSpinLock(&(Port->Lock));
+    Active = AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_SATA_ACTIVE) |
+             AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_COMMAND_ISSUE);
+
+    Completed = Port->IssuedSlots & ~Active;
+
+    //
+    // An error stops the port. Anything finished before the error is still
+    // good. Restarting the port and finding out which command failed takes
+    // far too long for dispatch level, so leave the rest to the work item.
+    // Errors seen while recovery is already underway are its own business.
+    //
+
+    if (((PendingBits & AHCI_PORT_INTERRUPT_ERROR_MASK) != 0) &&
+        (Port->Recovering == FALSE)) {
+
+        RtlDebugPrint("AHCI: Port %d error: IS 0x%x, TFD 0x%x, SERR 0x%x.\n",
+                      Port->Index,
+                      PendingBits,
+                      AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_TASK_FILE_DATA),
+                      AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_SATA_ERROR));
+
+        AhcipBeginRecovery(Port, Port->IssuedSlots & Active, TRUE);
+    }
+
+    Port->IssuedSlots &= ~Completed;
+    while (Completed != 0) {
+        SlotIndex = RtlCountTrailingZeros32(Completed);
+        Completed &= ~(1 << SlotIndex);
+        AhcipCompleteSlot(Port, SlotIndex, STATUS_SUCCESS);
+    }
+
+    KeReleaseSpinLock(&(Port->Lock));
+    return;
+}
+
+VOID
+AhcipCompleteSlot (
+    PAHCI_PORT Port,
+    ULONG SlotIndex,
+    KSTATUS Status
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles a finished command. If the slot's IRP has more data
+    to move, the next piece is issued from the same slot. Otherwise the slot
+    is released and the IRP completed. This routine assumes the port lock is
+    held.
+
+Arguments:
+
+    Port - Supplies a pointer to the port.
+
+    SlotIndex - Supplies the slot whose command finished.
+
+    Status - Supplies the result of the command.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIRP Irp;
+    PAHCI_SLOT Slot;
+
+    Slot = &(Port->Slot[SlotIndex]);
+    Irp = Slot->Irp;
+
+    //
+    // Commands the driver issued itself have a thread waiting on them. That
+    // thread releases the slot.
+    //
+
+    if (Irp == NULL) {
+        Port->CommandStatus = Status;
+        KeSignalEvent(Port->CommandEvent, SignalOptionSignalAll);
+        return;
+    }
+
+    ASSERT(Irp->MajorCode == IrpMajorIo);
+
+    if (KSUCCESS(Status)) {
+        Irp->U.ReadWrite.IoBytesCompleted += Slot->IoSize;
+        Irp->U.ReadWrite.NewIoOffset += Slot->IoSize;
+
+        ASSERT(Irp->U.ReadWrite.IoBytesCompleted <=
+               Irp->U.ReadWrite.IoSizeInBytes);
+
+        if (Irp->U.ReadWrite.IoBytesCompleted !=
+            Irp->U.ReadWrite.IoSizeInBytes) {
+
+            Status = AhcipStartTransfer(Port, SlotIndex);
+            if (KSUCCESS(Status)) {
+                return;
+            }
+        }
+    }
+
+    Slot->Irp = NULL;
+    Slot->IoSize = 0;
+    AhcipReleaseSlot(Port, SlotIndex);
+
+    //
+    // Complete the IRP. The I/O buffer state is cleaned up by this driver
+    // after the IRP is reversed to the up direction, at low level.
+    //
+
+    IoCompleteIrp(AhciDriver, Irp, Status);
+    return;
+}
+
+VOID
+AhcipBeginRecovery (
+    PAHCI_PORT Port,
+    ULONG StoppedSlots,
+    BOOL DeviceError
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes the given in-flight commands away from the controller
+    and queues the work item that restarts the port. This routine assumes the
+    port lock is held.
+
+Arguments:
+
+    Port - Supplies a pointer to the port.
+
+    StoppedSlots - Supplies the mask of issued slots whose commands have not
+        finished.
+
+    DeviceError - Supplies a boolean indicating whether the device reported
+        an error (TRUE) or a command simply timed out (FALSE).
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    ASSERT(Port->Recovering == FALSE);
+    ASSERT((StoppedSlots & ~(Port->IssuedSlots)) == 0);
+
+    Port->Recovering = TRUE;
+    Port->RecoveryError = DeviceError;
+    Port->RecoverySlots = StoppedSlots;
+    Port->IssuedSlots &= ~StoppedSlots;
+    Status = KeQueueWorkItem(Port->RecoveryWorkItem);
+
+    ASSERT(KSUCCESS(Status));
+
+    return;
+}
+
+VOID
+AhcipRecoverPort (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine restarts a port after an error or a timeout, at low level. It
+    reads the NCQ error log to find the one queued command that failed, fails
+    only that command, and reissues every other command that was outstanding.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the port.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Failed;
+    KSTATUS FailedStatus;
+    ULONG NonQueued;
+    RUNLEVEL OldRunLevel;
+    PAHCI_PORT Port;
+    ULONG Queued;
+    ULONG Reissue;
+    ULONG Remaining;
+    ULONG SlotIndex;
+    ULONG Stopped;
+    KSTATUS Status;
+    UCHAR TagByte;
+    ULONG TimedOut;
+
+    Port = (PAHCI_PORT)Parameter;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+    ASSERT(Port->Recovering != FALSE);
+
+    //
+    // Nothing else touches the port's registers while it is recovering, so
+    // none of this needs the port lock. The recovery slots and error flag
+    // are also fixed until recovery is done.
+    //
+
+    Stopped = Port->RecoverySlots;
+    Queued = 0;
+    Remaining = Stopped;
+    while (Remaining != 0) {
+        SlotIndex = RtlCountTrailingZeros32(Remaining);
+        Remaining &= ~(1 << SlotIndex);
+        if (Port->Slot[SlotIndex].Queued != FALSE) {
+            Queued |= 1 << SlotIndex;
+        }
+    }
+
+    NonQueued = Stopped & ~Queued;
+    AhcipStopPort(Port, FALSE, FALSE);
+    Status = AhcipStartPort(Port, FALSE);
+    Failed = 0;
+    FailedStatus = STATUS_DEVICE_IO_ERROR;
+    if (!KSUCCESS(Status)) {
+        RtlDebugPrint("AHCI: Port %d failed to restart: %d.\n",
+                      Port->Index,
+                      Status);
+
+        Failed = MAX_ULONG;
+
+    //
+    // A device error with queued commands outstanding aborts all of them.
+    // The error log names the one that actually failed. Without queued
+    // commands, the one non-queued command in flight is the culprit.
+    //
+
+    } else if (Port->RecoveryError != FALSE) {
+        Failed = Stopped;
+        if (Queued != 0) {
+            Status = AhcipReadNcqErrorLog(Port, &TagByte);
+            if (!KSUCCESS(Status)) {
+                RtlDebugPrint("AHCI: Port %d failed to read error log: %d.\n",
+                              Port->Index,
+                              Status);
+
+                AhcipStopPort(Port, FALSE, FALSE);
+                AhcipStartPort(Port, FALSE);
+
+            } else if ((TagByte & AHCI_NCQ_ERROR_LOG_NON_QUEUED) != 0) {
+                if (NonQueued != 0) {
+                    Failed = NonQueued;
+                }
+
+            } else {
+                SlotIndex = TagByte & AHCI_NCQ_ERROR_LOG_TAG_MASK;
+                if ((Queued & (1 << SlotIndex)) != 0) {
+                    Failed = 1 << SlotIndex;
+                }
+            }
+        }
+    }
+
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Port->Lock));
+    Remaining = Port->RecoverySlots | Port->DeferredSlots;
+    Failed &= Remaining;
+    TimedOut = Port->TimedOutSlots & Remaining & ~Failed;
+    Port->TimedOutSlots &= ~TimedOut;
+    Reissue = Remaining & ~(Failed | TimedOut);
+    Port->Recovering = FALSE;
+    Port->RecoveryError = FALSE;
+    Port->RecoverySlots = 0;
+    Port->DeferredSlots = 0;
+    while (Reissue != 0) {
+        SlotIndex = RtlCountTrailingZeros32(Reissue);
+        Reissue &= ~(1 << SlotIndex);
+        Port->CommandList[SlotIndex].ByteCount = 0;
+        AhcipIssueCommand(Port, SlotIndex, Port->Slot[SlotIndex].Queued);
+    }
+
+    while (Failed != 0) {
+        SlotIndex = RtlCountTrailingZeros32(Failed);
+        Failed &= ~(1 << SlotIndex);
+        AhcipCompleteSlot(Port, SlotIndex, FailedStatus);
+    }
+
+    while (TimedOut != 0) {
+        SlotIndex = RtlCountTrailingZeros32(TimedOut);
+        TimedOut &= ~(1 << SlotIndex);
+        AhcipCompleteSlot(Port, SlotIndex, STATUS_TIMEOUT);
+    }
+
+    KeReleaseSpinLock(&(Port->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    return;
+}
+
+KSTATUS
+AhcipReadNcqErrorLog (
+    PAHCI_PORT Port,
+    PUCHAR TagByte
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads the NCQ command error log from a port that has just
+    been restarted after an error, spinning on the command's completion. Every
+    slot's command table may hold a command waiting to be reissued, so slot
+    zero's header is borrowed and pointed at the recovery command table. This
+    routine must be called from the recovery work item.
+
+Arguments:
+
+    Port - Supplies a pointer to the port.
+
+    TagByte - Supplies a pointer where the first byte of the log will be
+        returned. It holds the failed tag and the non-queued bit.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PSATA_FIS_REGISTER_H2D Fis;
+    PAHCI_COMMAND_HEADER Header;
+    PAHCI_PRDT Prdt;
+    AHCI_COMMAND_HEADER SavedHeader;
+    KSTATUS Status;
+    ULONG TaskFile;
+    ULONGLONG Timeout;
+
+    ASSERT(Port->Recovering != FALSE);
+
+    Fis = (PSATA_FIS_REGISTER_H2D)(Port->RecoveryTable->CommandFis);
+    RtlZeroMemory(Fis, sizeof(SATA_FIS_REGISTER_H2D));
+    Fis->Type = SATA_FIS_TYPE_REGISTER_H2D;
+    Fis->Flags = SATA_FIS_REGISTER_H2D_COMMAND;
+    Fis->Command = AhciCommandReadLogExt;
+    Fis->Lba0 = AHCI_LOG_NCQ_COMMAND_ERROR;
+    Fis->CountLow = 1;
+    Prdt = &(Port->RecoveryTable->Prdt[0]);
+    Prdt->Address = (ULONG)(Port->LogPhysicalAddress);
+    Prdt->AddressHigh = (ULONG)(Port->LogPhysicalAddress >> 32);
+    Prdt->Reserved = 0;
+    Prdt->ByteCount = AHCI_LOG_PAGE_SIZE - 1;
+    Header = &(Port->CommandList[0]);
+    RtlCopyMemory(&SavedHeader, Header, sizeof(AHCI_COMMAND_HEADER));
+    Header->Flags = (sizeof(SATA_FIS_REGISTER_H2D) / sizeof(ULONG)) |
+                    (1 << AHCI_COMMAND_HEADER_PRDT_LENGTH_SHIFT);
+
+    Header->ByteCount = 0;
+    Header->TableAddress = (ULONG)(Port->RecoveryTablePhysicalAddress);
+    Header->TableAddressHigh =
+                          (ULONG)(Port->RecoveryTablePhysicalAddress >> 32);
+
+    RtlMemoryBarrier();
+    AHCI_WRITE_PORT_REGISTER(Port, AHCI_PORT_COMMAND_ISSUE, 1);
+    Timeout = HlQueryTimeCounter() +
+              (HlQueryTimeCounterFrequency() * AHCI_COMMAND_TIMEOUT);
+
+    Status = STATUS_TIMEOUT;
+    do {
+        TaskFile = AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_TASK_FILE_DATA);
+        if ((TaskFile & AHCI_PORT_TASK_FILE_ERROR) != 0) {
+            Status = STATUS_DEVICE_IO_ERROR;
+            break;
+        }
+
+        if ((AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_COMMAND_ISSUE) & 1) == 0) {
+            Status = STATUS_SUCCESS;
+            break;
+        }
+
+        KeYield();
+
+    } while (HlQueryTimeCounter() <= Timeout);
+
+    RtlCopyMemory(Header, &SavedHeader, sizeof(AHCI_COMMAND_HEADER));
+    if (KSUCCESS(Status)) {
+        *TagByte = Port->Log[0];
+    }
+
+    return Status;
+}
+
+KSTATUS
+AhcipExecuteCommand (
+    PAHCI_PORT Port,
+    AHCI_ATA_COMMAND Command,
+    PHYSICAL_ADDRESS Buffer,
+    ULONG BufferSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends a command that cannot be queued, such as IDENTIFY or
+    FLUSH CACHE, and waits for it to finish. It waits for the port to drain
+    first. This routine must be called at low level.
+
+Arguments:
+
+    Port - Supplies a pointer to the port.
+
+    Command - Supplies the ATA command to send.
+
+    Buffer - Supplies the physical address of the data buffer for commands
+        that read data in.
+
+    BufferSize - Supplies the size of the data buffer, or zero if the command
+        has no data.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG Mask;
+    RUNLEVEL OldRunLevel;
+    ULONG Outstanding;
+    PAHCI_PRDT Prdt;
+    ULONG PrdtLength;
+    ULONG SlotIndex;
+    KSTATUS Status;
+
+    SlotIndex = AhcipAcquireSlot(Port, TRUE);
+    Mask = 1 << SlotIndex;
+
+    ASSERT(Port->Slot[SlotIndex].Irp == NULL);
+
+    PrdtLength = 0;
+    if (BufferSize != 0) {
+        Prdt = &(Port->Slot[SlotIndex].Table->Prdt[0]);
+        Prdt->Address = (ULONG)Buffer;
+        Prdt->AddressHigh = (ULONG)(Buffer >> 32);
+        Prdt->Reserved = 0;
+        Prdt->ByteCount = BufferSize - 1;
+        PrdtLength = 1;
+    }
+
+    AhcipSetupCommand(Port, SlotIndex, Command, 0, 0, PrdtLength, FALSE);
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Port->Lock));
+    KeSignalEvent(Port->CommandEvent, SignalOptionUnsignal);
+    AhcipIssueCommand(Port, SlotIndex, FALSE);
+    KeReleaseSpinLock(&(Port->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    while (TRUE) {
+        Status = KeWaitForEvent(Port->CommandEvent,
+                                FALSE,
+                                AHCI_COMMAND_TIMEOUT * MILLISECONDS_PER_SECOND);
+
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(Port->Lock));
+        Outstanding = Port->IssuedSlots | Port->RecoverySlots |
+                      Port->DeferredSlots;
+
+        if ((Outstanding & Mask) == 0) {
+            Port->TimedOutSlots &= ~Mask;
+            break;
+        }
+
+        //
+        // If the command is still outstanding after the wait, give up on it.
+        // Recovery restarts the port to get the slot back, then fails the
+        // command, which signals the event.
+        //
+
+        if (!KSUCCESS(Status) && ((Port->TimedOutSlots & Mask) == 0)) {
+            RtlDebugPrint("AHCI: Port %d command 0x%x timed out.\n",
+                          Port->Index,
+                          Command);
+
+            Port->TimedOutSlots |= Mask;
+            if (Port->Recovering == FALSE) {
+                AhcipBeginRecovery(Port, Port->IssuedSlots, FALSE);
+            }
+        }
+
+        KeReleaseSpinLock(&(Port->Lock));
+        KeLowerRunLevel(OldRunLevel);
+    }
+
+    Status = Port->CommandStatus;
+    AhcipReleaseSlot(Port, SlotIndex);
+    KeReleaseSpinLock(&(Port->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    return Status;
+}
+
+KSTATUS
+AhcipSynchronizeDevice (
+    PAHCI_PORT Port
+    )
+
+/*++
+
+Routine Description:
+
+    This routine synchronizes the device by sending a cache flush command.
+
+Arguments:
+
+    Port - Supplies a pointer to the port.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    return AhcipExecuteCommand(Port, AhciCommandCacheFlush48, 0, 0);
+}
+
+KSTATUS
+AhcipBlockIoReset (
+    PVOID DiskToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prepares a port for polled block I/O by masking its
+    interrupts and restarting it, which throws away any commands that were in
+    flight. This routine is called at high run level.
+
+Arguments:
+
+    DiskToken - Supplies an opaque token for the disk. The appropriate token is
+        retrieved by querying the disk device information.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PAHCI_PORT Port;
+
+    ASSERT(KeGetRunLevel() == RunLevelHigh);
+
+    Port = (PAHCI_PORT)DiskToken;
+    AHCI_WRITE_PORT_REGISTER(Port, AHCI_PORT_INTERRUPT_ENABLE, 0);
+    AhcipStopPort(Port, FALSE, TRUE);
+    return AhcipStartPort(Port, TRUE);
+}
+
+KSTATUS
+AhcipBlockRead (
+    PVOID DiskToken,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    PUINTN BlocksCompleted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads the block contents from the disk into the given I/O
+    buffer using polled I/O. It does so without acquiring any locks or
+    allocating any resources, as this routine is used for crash dump support
+    when the system is in a very fragile state. This routine must be called at
+    high level.
+
+Arguments:
+
+    DiskToken - Supplies an opaque token for the disk. The appropriate token is
+        retrieved by querying the disk device information.
+
+    IoBuffer - Supplies a pointer to the I/O buffer where the data will be read.
+
+    BlockAddress - Supplies the block index to read (for physical disk, this is
+        the LBA).
+
+    BlockCount - Supplies the number of blocks to read.
+
+    BlocksCompleted - Supplies a pointer that receives the total number of
+        blocks read.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    IRP_READ_WRITE IrpReadWrite;
+    PAHCI_PORT Port;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelHigh);
+
+    Port = (PAHCI_PORT)DiskToken;
+    IrpReadWrite.IoBuffer = IoBuffer;
+    IrpReadWrite.IoOffset = BlockAddress << Port->BlockShift;
+    IrpReadWrite.IoSizeInBytes = BlockCount << Port->BlockShift;
+    Status = AhcipPerformPolledIo(&IrpReadWrite, Port, FALSE);
+    *BlocksCompleted = IrpReadWrite.IoBytesCompleted >> Port->BlockShift;
+    return Status;
+}
+
+KSTATUS
+AhcipBlockWrite (
+    PVOID DiskToken,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    PUINTN BlocksCompleted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes the contents of the given I/O buffer to the disk using
+    polled I/O. It does so without acquiring any locks or allocating any
+    resources, as this routine is used for crash dump support when the system
+    is in a very fragile state. This routine must be called at high level.
+
+Arguments:
+
+    DiskToken - Supplies an opaque token for the disk. The appropriate token is
+        retrieved by querying the disk device information.
+
+    IoBuffer - Supplies a pointer to the I/O buffer containing the data to
+        write.
+
+    BlockAddress - Supplies the block index to write to (for physical disk,
+        this is the LBA).
+
+    BlockCount - Supplies the number of blocks to write.
+
+    BlocksCompleted - Supplies a pointer that receives the total number of
+        blocks written.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    IRP_READ_WRITE IrpReadWrite;
+    PAHCI_PORT Port;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelHigh);
+
+    Port = (PAHCI_PORT)DiskToken;
+    IrpReadWrite.IoBuffer = IoBuffer;
+    IrpReadWrite.IoOffset = BlockAddress << Port->BlockShift;
+    IrpReadWrite.IoSizeInBytes = BlockCount << Port->BlockShift;
+    Status = AhcipPerformPolledIo(&IrpReadWrite, Port, TRUE);
+    *BlocksCompleted = IrpReadWrite.IoBytesCompleted >> Port->BlockShift;
+    return Status;
+}
+
+KSTATUS
+AhcipPerformPolledIo (
+    PIRP_READ_WRITE IrpReadWrite,
+    PAHCI_PORT Port,
+    BOOL Write
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs a read or write one command at a time in slot zero,
+    spinning on each command's completion. It is only used in critical mode,
+    after the block I/O reset routine has quiesced the port.
+
+Arguments:
+
+    IrpReadWrite - Supplies a pointer to the I/O request read/write packet.
+
+    Port - Supplies a pointer to the port.
+
+    Write - Supplies a boolean indicating if this is a write operation (TRUE)
+        or a read operation (FALSE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONGLONG BlockAddress;
+    UINTN BytesRemaining;
+    AHCI_ATA_COMMAND Command;
+    KSTATUS CompletionStatus;
+    ULONG IrpReadWriteFlags;
+    UINTN MaxTransferSize;
+    ULONG PrdtLength;
+    BOOL ReadWriteIrpPrepared;
+    KSTATUS Status;
+    ULONGLONG Timeout;
+    ULONG TaskFile;
+    UINTN TransferSize;
+
+    IrpReadWrite->IoBytesCompleted = 0;
+    ReadWriteIrpPrepared = FALSE;
+
+    ASSERT(IrpReadWrite->IoBuffer != NULL);
+    ASSERT(IS_ALIGNED(IrpReadWrite->IoSizeInBytes, Port->BlockSize) != FALSE);
+    ASSERT(IS_ALIGNED(IrpReadWrite->IoOffset, Port->BlockSize) != FALSE);
+
+    IrpReadWriteFlags = IRP_READ_WRITE_FLAG_POLLED | IRP_READ_WRITE_FLAG_DMA;
+    if (Write != FALSE) {
+        IrpReadWriteFlags |= IRP_READ_WRITE_FLAG_WRITE;
+    }
+
+    Status = IoPrepareReadWriteIrp(IrpReadWrite,
+                                   AHCI_DATA_ALIGNMENT,
+                                   0,
+                                   Port->Controller->MaxPhysicalAddress,
+                                   IrpReadWriteFlags);
+
+    if (!KSUCCESS(Status)) {
+        goto PerformPolledIoEnd;
+    }
+
+    ReadWriteIrpPrepared = TRUE;
+
+    //
+    // Writes bypass the disk's cache, as nothing will come along afterwards
+    // to flush it.
+    //
+
+    Command = AhciCommandReadDma48;
+    if (Write != FALSE) {
+        Command = AhciCommandWriteDmaForceUnit48;
+    }
+
+    MaxTransferSize = (UINTN)AHCI_MAX_TRANSFER_BLOCKS << Port->BlockShift;
+    BytesRemaining = IrpReadWrite->IoSizeInBytes;
+    while (BytesRemaining != 0) {
+        TransferSize = BytesRemaining;
+        if (TransferSize > MaxTransferSize) {
+            TransferSize = MaxTransferSize;
+        }
+
+        PrdtLength = AhcipFillPrdt(
+                      Port->Slot[0].Table,
+                      IrpReadWrite->IoBuffer,
+                      MmGetIoBufferCurrentOffset(IrpReadWrite->IoBuffer) +
+                      IrpReadWrite->IoBytesCompleted,
+                      TransferSize,
+                      Port->BlockSize,
+                      &TransferSize);
+
+        if (PrdtLength == 0) {
+            Status = STATUS_INVALID_PARAMETER;
+            goto PerformPolledIoEnd;
+        }
+
+        BlockAddress = (IrpReadWrite->IoOffset +
+                        IrpReadWrite->IoBytesCompleted) >> Port->BlockShift;
+
+        AhcipSetupCommand(Port,
+                          0,
+                          Command,
+                          BlockAddress,
+                          TransferSize >> Port->BlockShift,
+                          PrdtLength,
+                          FALSE);
+
+        RtlMemoryBarrier();
+        AHCI_WRITE_PORT_REGISTER(Port, AHCI_PORT_COMMAND_ISSUE, 1);
+
+        //
+        // Spin until the command leaves the issue register, watching the task
+        // file for an error.
+        //
+
+        Timeout = HlQueryTimeCounter() +
+                  (HlQueryTimeCounterFrequency() * AHCI_COMMAND_TIMEOUT);
+
+        Status = STATUS_TIMEOUT;
+        do {
+            TaskFile = AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_TASK_FILE_DATA);
+            if ((TaskFile & AHCI_PORT_TASK_FILE_ERROR) != 0) {
+                Status = STATUS_DEVICE_IO_ERROR;
+                break;
+            }
+
+            if ((AHCI_READ_PORT_REGISTER(Port, AHCI_PORT_COMMAND_ISSUE) &
+                 1) == 0) {
+
+                Status = STATUS_SUCCESS;
+                break;
+            }
+
+        } while (HlQueryTimeCounter() <= Timeout);
+
+        if (!KSUCCESS(Status)) {
+            AhcipStopPort(Port, FALSE, TRUE);
+            AhcipStartPort(Port, TRUE);
+            goto PerformPolledIoEnd;
+        }
+
+        IrpReadWrite->IoBytesCompleted += TransferSize;
+        BytesRemaining -= TransferSize;
+    }
+
+    Status = STATUS_SUCCESS;
+
+PerformPolledIoEnd:
+    if (ReadWriteIrpPrepared != FALSE) {
+        CompletionStatus = IoCompleteReadWriteIrp(IrpReadWrite,
+                                                  IrpReadWriteFlags);
+
+        if (!KSUCCESS(CompletionStatus) && KSUCCESS(Status)) {
+            Status = CompletionStatus;
+        }
+    }
+
+    IrpReadWrite->NewIoOffset = IrpReadWrite->IoOffset +
+                                IrpReadWrite->IoBytesCompleted;
+
+    return Status;
+}
+
+VOID
+AhcipProcessPciMsiInterfaceChangeNotification (
+    PVOID Context,
+    PDEVICE Device,
+    PVOID InterfaceBuffer,
+    ULONG InterfaceBufferSize,
+    BOOL Arrival
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when a PCI MSI interface changes in availability.
+
+Arguments:
+
+    Context - Supplies the caller's context pointer, supplied when the caller
+        requested interface notifications.
+
+    Device - Supplies a pointer to the device exposing or deleting the
+        interface.
+
+    InterfaceBuffer - Supplies a pointer to the interface buffer of the
+        interface.
+
+    InterfaceBufferSize - Supplies the buffer size.
+
+    Arrival - Supplies TRUE if a new interface is arriving, or FALSE if an
+        interface is departing.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PAHCI_CONTROLLER Controller;
+
+    Controller = (PAHCI_CONTROLLER)Context;
+    if (Arrival != FALSE) {
+        if (InterfaceBufferSize >= sizeof(INTERFACE_PCI_MSI)) {
+
+            ASSERT((Controller->PciMsiFlags &
+                    AHCI_PCI_MSI_FLAG_INTERFACE_AVAILABLE) == 0);
+
+            RtlCopyMemory(&(Controller->PciMsiInterface),
+                          InterfaceBuffer,
+                          sizeof(INTERFACE_PCI_MSI));
+
+            Controller->PciMsiFlags |= AHCI_PCI_MSI_FLAG_INTERFACE_AVAILABLE;
+        }
+
+    } else {
+        Controller->PciMsiFlags &= ~AHCI_PCI_MSI_FLAG_INTERFACE_AVAILABLE;
+    }
+
+    return;
+}
+
@@ -0,0 +1,762 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ahci.h
+
+Abstract:
+
+    This header contains definitions for the Advanced Host Controller
+    Interface (AHCI) SATA driver.
+
+Author:
+
+    Minoca Corp. 16-Oct-2026
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/intrface/pci.h>
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// Define macros for accessing the generic host control registers.
+//
+
+#define AHCI_READ_REGISTER(_Controller, _Register) \
+    HlReadRegister32((PUCHAR)(_Controller)->ControllerBase + (_Register))
+
+#define AHCI_WRITE_REGISTER(_Controller, _Register, _Value)                \
+    HlWriteRegister32((PUCHAR)(_Controller)->ControllerBase + (_Register), \
+                      (_Value))
+
+//
+// Define macros for accessing a port's registers.
+//
+
+#define AHCI_READ_PORT_REGISTER(_Port, _Register) \
+    HlReadRegister32((PUCHAR)(_Port)->Registers + (_Register))
+
+#define AHCI_WRITE_PORT_REGISTER(_Port, _Register, _Value)       \
+    HlWriteRegister32((PUCHAR)(_Port)->Registers + (_Register), \
+                      (_Value))
+
+//
+// This macro returns the offset of a port's register set from the base of
+// the controller's registers.
+//
+
+#define AHCI_PORT_REGISTER_OFFSET(_PortIndex) \
+    (AHCI_PORT_REGISTER_BASE + ((_PortIndex) * AHCI_PORT_REGISTER_SIZE))
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define AHCI_ALLOCATION_TAG 0x69636841 // 'ichA'
+
+#define AHCI_MAX_PORTS 32
+#define AHCI_MAX_COMMAND_SLOTS 32
+#define AHCI_INVALID_SLOT ((ULONG)-1)
+
+#define AHCI_DEFAULT_BLOCK_SIZE 512
+
+//
+// Define the location and stride of the per-port register sets.
+//
+
+#define AHCI_PORT_REGISTER_BASE 0x100
+#define AHCI_PORT_REGISTER_SIZE 0x80
+
+//
+// Define the layout of the memory each port shares with the controller. The
+// command list must be 1KB aligned, the received FIS area must be 256 byte
+// aligned, and each command table must be 128 byte aligned. The error
+// recovery command table, the identify buffer, and the log buffer sit in the
+// gap between the received FIS area and the first command table.
+//
+
+#define AHCI_COMMAND_LIST_OFFSET 0x0
+#define AHCI_COMMAND_LIST_ALIGNMENT 0x400
+#define AHCI_RECEIVED_FIS_OFFSET 0x400
+#define AHCI_RECEIVED_FIS_SIZE 0x100
+#define AHCI_RECOVERY_TABLE_OFFSET 0x500
+#define AHCI_IDENTIFY_OFFSET 0x600
+#define AHCI_LOG_OFFSET 0x800
+#define AHCI_COMMAND_TABLE_OFFSET 0xA00
+
+//
+// Define the number of physical region descriptors in each command table.
+// This makes each command table 1KB. Larger transfers are split and the
+// remainder is issued from the same slot when each piece completes.
+//
+
+#define AHCI_PRDT_ENTRY_COUNT 56
+#define AHCI_COMMAND_TABLE_SIZE \
+    (FIELD_OFFSET(AHCI_COMMAND_TABLE, Prdt) + \
+     (AHCI_PRDT_ENTRY_COUNT * sizeof(AHCI_PRDT)))
+
+//
+// Define the largest byte count a single PRD entry can describe, and the
+// alignment the controller requires of data buffers.
+//
+
+#define AHCI_PRDT_MAX_SIZE 0x400000
+#define AHCI_DATA_ALIGNMENT 2
+
+//
+// Define the largest number of blocks a single read or write command can
+// transfer. The 16-bit count field encodes this value as zero.
+//
+
+#define AHCI_MAX_TRANSFER_BLOCKS 0x10000
+
+//
+// Define timeouts, in microseconds unless otherwise noted.
+//
+
+#define AHCI_RESET_TIMEOUT (1000 * MICROSECONDS_PER_MILLISECOND)
+#define AHCI_PORT_STOP_TIMEOUT (500 * MICROSECONDS_PER_MILLISECOND)
+#define AHCI_LINK_TIMEOUT (10 * MICROSECONDS_PER_MILLISECOND)
+#define AHCI_READY_TIMEOUT (1000 * MICROSECONDS_PER_MILLISECOND)
+#define AHCI_COMRESET_DELAY MICROSECONDS_PER_MILLISECOND
+#define AHCI_POLL_INTERVAL 10
+
+//
+// Define the timeout, in seconds, for commands issued by the driver itself
+// and for polled commands.
+//
+
+#define AHCI_COMMAND_TIMEOUT 30
+
+//
+// Define the generic host control registers.
+//
+
+#define AHCI_HOST_CAPABILITIES 0x00
+#define AHCI_GLOBAL_HOST_CONTROL 0x04
+#define AHCI_INTERRUPT_STATUS 0x08
+#define AHCI_PORTS_IMPLEMENTED 0x0C
+#define AHCI_VERSION 0x10
+
+//
+// Define host capabilities register bits.
+//
+
+#define AHCI_CAPABILITY_PORT_COUNT_MASK 0x0000001F
+#define AHCI_CAPABILITY_COMMAND_SLOTS_MASK 0x00001F00
+#define AHCI_CAPABILITY_COMMAND_SLOTS_SHIFT 8
+#define AHCI_CAPABILITY_STAGGERED_SPIN_UP 0x08000000
+#define AHCI_CAPABILITY_COMMAND_LIST_OVERRIDE 0x01000000
+#define AHCI_CAPABILITY_NATIVE_COMMAND_QUEUING 0x40000000
+#define AHCI_CAPABILITY_64_BIT 0x80000000
+
+//
+// Define global host control register bits.
+//
+
+#define AHCI_GLOBAL_CONTROL_RESET 0x00000001
+#define AHCI_GLOBAL_CONTROL_INTERRUPT_ENABLE 0x00000002
+#define AHCI_GLOBAL_CONTROL_AHCI_ENABLE 0x80000000
+
+//
+// Define the per-port registers.
+//
+
+#define AHCI_PORT_COMMAND_LIST_BASE 0x00
+#define AHCI_PORT_COMMAND_LIST_BASE_HIGH 0x04
+#define AHCI_PORT_FIS_BASE 0x08
+#define AHCI_PORT_FIS_BASE_HIGH 0x0C
+#define AHCI_PORT_INTERRUPT_STATUS 0x10
+#define AHCI_PORT_INTERRUPT_ENABLE 0x14
+#define AHCI_PORT_COMMAND 0x18
+#define AHCI_PORT_TASK_FILE_DATA 0x20
+#define AHCI_PORT_SIGNATURE 0x24
+#define AHCI_PORT_SATA_STATUS 0x28
+#define AHCI_PORT_SATA_CONTROL 0x2C
+#define AHCI_PORT_SATA_ERROR 0x30
+#define AHCI_PORT_SATA_ACTIVE 0x34
+#define AHCI_PORT_COMMAND_ISSUE 0x38
+
+//
+// Define port interrupt status and enable register bits.
+//
+
+#define AHCI_PORT_INTERRUPT_D2H_REGISTER_FIS 0x00000001
+#define AHCI_PORT_INTERRUPT_PIO_SETUP_FIS 0x00000002
+#define AHCI_PORT_INTERRUPT_DMA_SETUP_FIS 0x00000004
+#define AHCI_PORT_INTERRUPT_SET_DEVICE_BITS 0x00000008
+#define AHCI_PORT_INTERRUPT_DESCRIPTOR_PROCESSED 0x00000020
+#define AHCI_PORT_INTERRUPT_INTERFACE_FATAL 0x08000000
+#define AHCI_PORT_INTERRUPT_HOST_BUS_DATA_ERROR 0x10000000
+#define AHCI_PORT_INTERRUPT_HOST_BUS_FATAL 0x20000000
+#define AHCI_PORT_INTERRUPT_TASK_FILE_ERROR 0x40000000
+
+#define AHCI_PORT_INTERRUPT_COMPLETION_MASK      \
+    (AHCI_PORT_INTERRUPT_D2H_REGISTER_FIS |      \
+     AHCI_PORT_INTERRUPT_PIO_SETUP_FIS |         \
+     AHCI_PORT_INTERRUPT_DMA_SETUP_FIS |         \
+     AHCI_PORT_INTERRUPT_SET_DEVICE_BITS |       \
+     AHCI_PORT_INTERRUPT_DESCRIPTOR_PROCESSED)
+
+#define AHCI_PORT_INTERRUPT_ERROR_MASK           \
+    (AHCI_PORT_INTERRUPT_INTERFACE_FATAL |       \
+     AHCI_PORT_INTERRUPT_HOST_BUS_DATA_ERROR |   \
+     AHCI_PORT_INTERRUPT_HOST_BUS_FATAL |        \
+     AHCI_PORT_INTERRUPT_TASK_FILE_ERROR)
+
+#define AHCI_PORT_INTERRUPT_DEFAULT_MASK \
+    (AHCI_PORT_INTERRUPT_COMPLETION_MASK | AHCI_PORT_INTERRUPT_ERROR_MASK)
+
+//
+// Define port command and status register bits.
+//
+
+#define AHCI_PORT_COMMAND_START 0x00000001
+#define AHCI_PORT_COMMAND_SPIN_UP 0x00000002
+#define AHCI_PORT_COMMAND_POWER_ON 0x00000004
+#define AHCI_PORT_COMMAND_LIST_OVERRIDE 0x00000008
+#define AHCI_PORT_COMMAND_FIS_RECEIVE_ENABLE 0x00000010
+#define AHCI_PORT_COMMAND_FIS_RECEIVE_RUNNING 0x00004000
+#define AHCI_PORT_COMMAND_LIST_RUNNING 0x00008000
+#define AHCI_PORT_COMMAND_INTERFACE_ACTIVE 0x10000000
+
+//
+// Define port task file data register bits.
+//
+
+#define AHCI_PORT_TASK_FILE_ERROR 0x00000001
+#define AHCI_PORT_TASK_FILE_DATA_REQUEST 0x00000008
+#define AHCI_PORT_TASK_FILE_BUSY 0x00000080
+
+#define AHCI_PORT_TASK_FILE_BUSY_MASK \
+    (AHCI_PORT_TASK_FILE_BUSY | AHCI_PORT_TASK_FILE_DATA_REQUEST)
+
+//
+// Define port SATA status and control register values.
+//
+
+#define AHCI_PORT_SATA_STATUS_DETECTION_MASK 0x0000000F
+#define AHCI_PORT_SATA_STATUS_DEVICE_PRESENT 0x00000003
+#define AHCI_PORT_SATA_CONTROL_DETECTION_MASK 0x0000000F
+#define AHCI_PORT_SATA_CONTROL_COMRESET 0x00000001
+
+//
+// Define the port signature of an ATA disk. ATAPI devices, port multipliers,
+// and enclosure management bridges have other signatures.
+//
+
+#define AHCI_SIGNATURE_ATA 0x00000101
+
+//
+// Define command header flags.
+//
+
+#define AHCI_COMMAND_HEADER_FIS_LENGTH_MASK 0x0000001F
+#define AHCI_COMMAND_HEADER_WRITE 0x00000040
+#define AHCI_COMMAND_HEADER_PREFETCHABLE 0x00000080
+#define AHCI_COMMAND_HEADER_CLEAR_BUSY 0x00000400
+#define AHCI_COMMAND_HEADER_PRDT_LENGTH_SHIFT 16
+
+//
+// Define the physical region descriptor byte count mask and interrupt bit.
+//
+
+#define AHCI_PRDT_BYTE_COUNT_MASK 0x003FFFFF
+#define AHCI_PRDT_INTERRUPT 0x80000000
+
+//
+// Define FIS types and flags.
+//
+
+#define SATA_FIS_TYPE_REGISTER_H2D 0x27
+#define SATA_FIS_REGISTER_H2D_COMMAND 0x80
+
+//
+// Define ATA device register bits used in command FISes.
+//
+
+#define AHCI_DEVICE_LBA 0x40
+#define AHCI_DEVICE_FORCE_UNIT_ACCESS 0x80
+
+//
+// Define the shift of the queued command tag within the sector count field.
+//
+
+#define AHCI_NCQ_TAG_SHIFT 3
+
+//
+// Define the NCQ command error log, which reports the tag of the queued
+// command that failed. Reading it also takes the device out of its error
+// state so that queued commands can be issued again.
+//
+
+#define AHCI_LOG_NCQ_COMMAND_ERROR 0x10
+#define AHCI_LOG_PAGE_SIZE 512
+#define AHCI_NCQ_ERROR_LOG_TAG_MASK 0x1F
+#define AHCI_NCQ_ERROR_LOG_NON_QUEUED 0x80
+
+//
+// Define the word offsets of the IDENTIFY DEVICE data fields this driver uses.
+//
+
+#define AHCI_IDENTIFY_TOTAL_SECTORS 60
+#define AHCI_IDENTIFY_QUEUE_DEPTH 75
+#define AHCI_IDENTIFY_SATA_CAPABILITIES 76
+#define AHCI_IDENTIFY_COMMAND_SET_SUPPORTED 83
+#define AHCI_IDENTIFY_TOTAL_SECTORS_LBA48 100
+#define AHCI_IDENTIFY_SECTOR_SIZE 106
+#define AHCI_IDENTIFY_LOGICAL_SECTOR_SIZE 117
+#define AHCI_IDENTIFY_WORD_COUNT 256
+
+#define AHCI_IDENTIFY_QUEUE_DEPTH_MASK 0x001F
+#define AHCI_IDENTIFY_SATA_NCQ 0x0100
+#define AHCI_IDENTIFY_COMMAND_SET_LBA48 0x0400
+#define AHCI_IDENTIFY_SECTOR_SIZE_VALID_MASK 0xC000
+#define AHCI_IDENTIFY_SECTOR_SIZE_VALID 0x4000
+#define AHCI_IDENTIFY_SECTOR_SIZE_LARGE_LOGICAL 0x1000
+
+//
+// Define the maximum block address reachable with 28-bit commands.
+//
+
+#define AHCI_MAX_LBA28 0x0FFFFFFFULL
+
+//
+// Define a set of flags used to determine if MSI/MSI-X interrupts should be
+// used.
+//
+
+#define AHCI_PCI_MSI_FLAG_INTERFACE_REGISTERED 0x00000001
+#define AHCI_PCI_MSI_FLAG_INTERFACE_AVAILABLE  0x00000002
+#define AHCI_PCI_MSI_FLAG_RESOURCES_REQUESTED  0x00000004
+#define AHCI_PCI_MSI_FLAG_RESOURCES_ALLOCATED  0x00000008
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _AHCI_CONTEXT_TYPE {
+    AhciContextInvalid,
+    AhciControllerContext,
+    AhciPortContext
+} AHCI_CONTEXT_TYPE, *PAHCI_CONTEXT_TYPE;
+
+typedef struct _AHCI_CONTROLLER AHCI_CONTROLLER, *PAHCI_CONTROLLER;
+
+typedef enum _AHCI_ATA_COMMAND {
+    AhciCommandReadDma48            = 0x25,
+    AhciCommandReadLogExt           = 0x2F,
+    AhciCommandWriteDma48           = 0x35,
+    AhciCommandWriteDmaForceUnit48  = 0x3D,
+    AhciCommandReadFpdmaQueued      = 0x60,
+    AhciCommandWriteFpdmaQueued     = 0x61,
+    AhciCommandReadDma28            = 0xC8,
+    AhciCommandWriteDma28           = 0xCA,
+    AhciCommandCacheFlush28         = 0xE7,
+    AhciCommandCacheFlush48         = 0xEA,
+    AhciCommandIdentify             = 0xEC,
+} AHCI_ATA_COMMAND, *PAHCI_ATA_COMMAND;
+
+/*++
+
+Structure Description:
+
+    This structure defines an entry in a port's command list.
+
+Members:
+
+    Flags - Stores the FIS length in DWORDs along with the command flags and
+        the number of PRDT entries. See AHCI_COMMAND_HEADER_* definitions.
+
+    ByteCount - Stores the number of bytes the controller transferred.
+
+    TableAddress - Stores the low 32 bits of the command table's physical
+        address.
+
+    TableAddressHigh - Stores the high 32 bits of the command table's
+        physical address.
+
+    Reserved - Stores reserved space.
+
+--*/
+
+typedef struct _AHCI_COMMAND_HEADER {
+    ULONG Flags;
+    volatile ULONG ByteCount;
+    ULONG TableAddress;
+    ULONG TableAddressHigh;
+    ULONG Reserved[4];
+} PACKED AHCI_COMMAND_HEADER, *PAHCI_COMMAND_HEADER;
+
+/*++
+
+Structure Description:
+
+    This structure defines a physical region descriptor, which tells the
+    controller where a piece of a command's data lives.
+
+Members:
+
+    Address - Stores the low 32 bits of the physical address of the data.
+
+    AddressHigh - Stores the high 32 bits of the physical address.
+
+    Reserved - Stores a reserved value.
+
+    ByteCount - Stores the number of bytes in the region minus one, and the
+        interrupt on completion bit.
+
+--*/
+
+typedef struct _AHCI_PRDT {
+    ULONG Address;
+    ULONG AddressHigh;
+    ULONG Reserved;
+    ULONG ByteCount;
+} PACKED AHCI_PRDT, *PAHCI_PRDT;
+
+/*++
+
+Structure Description:
+
+    This structure defines a host to device register FIS, which carries an ATA
+    command to the device.
+
+Members:
+
+    Type - Stores the FIS type, SATA_FIS_TYPE_REGISTER_H2D.
+
+    Flags - Stores the port multiplier port and the command bit.
+
+    Command - Stores the ATA command.
+
+    FeaturesLow - Stores the low byte of the features register.
+
+    Lba0 - Stores bits 0-7 of the block address.
+
+    Lba1 - Stores bits 8-15 of the block address.
+
+    Lba2 - Stores bits 16-23 of the block address.
+
+    Device - Stores the device register.
+
+    Lba3 - Stores bits 24-31 of the block address.
+
+    Lba4 - Stores bits 32-39 of the block address.
+
+    Lba5 - Stores bits 40-47 of the block address.
+
+    FeaturesHigh - Stores the high byte of the features register.
+
+    CountLow - Stores the low byte of the sector count register.
+
+    CountHigh - Stores the high byte of the sector count register.
+
+    Icc - Stores the isochronous command completion value.
+
+    Control - Stores the device control register.
+
+    Reserved - Stores reserved bytes.
+
+--*/
+
+typedef struct _SATA_FIS_REGISTER_H2D {
+    UCHAR Type;
+    UCHAR Flags;
+    UCHAR Command;
+    UCHAR FeaturesLow;
+    UCHAR Lba0;
+    UCHAR Lba1;
+    UCHAR Lba2;
+    UCHAR Device;
+    UCHAR Lba3;
+    UCHAR Lba4;
+    UCHAR Lba5;
+    UCHAR FeaturesHigh;
+    UCHAR CountLow;
+    UCHAR CountHigh;
+    UCHAR Icc;
+    UCHAR Control;
+    UCHAR Reserved[4];
+} PACKED SATA_FIS_REGISTER_H2D, *PSATA_FIS_REGISTER_H2D;
+
+/*++
+
+Structure Description:
+
+    This structure defines a command table, which holds the command FIS and
+    the scatter gather list for one command slot.
+
+Members:
+
+    CommandFis - Stores the command FIS sent to the device.
+
+    AtapiCommand - Stores the ATAPI command, unused by this driver.
+
+    Reserved - Stores reserved space.
+
+    Prdt - Stores the physical region descriptor table.
+
+--*/
+
+typedef struct _AHCI_COMMAND_TABLE {
+    UCHAR CommandFis[64];
+    UCHAR AtapiCommand[16];
+    UCHAR Reserved[48];
+    AHCI_PRDT Prdt[ANYSIZE_ARRAY];
+} PACKED AHCI_COMMAND_TABLE, *PAHCI_COMMAND_TABLE;
+
+/*++
+
+Structure Description:
+
+    This structure defines the driver's state for one command slot.
+
+Members:
+
+    Irp - Stores a pointer to the IRP using the slot, or NULL if the driver
+        issued the command itself.
+
+    IoSize - Stores the size of the transfer currently in flight in this slot.
+
+    Table - Stores a pointer to the slot's command table.
+
+    TablePhysicalAddress - Stores the physical address of the command table.
+
+    Queued - Stores a boolean indicating whether the command last set up in
+        the slot is a native command queuing command.
+
+--*/
+
+typedef struct _AHCI_SLOT {
+    PIRP Irp;
+    UINTN IoSize;
+    PAHCI_COMMAND_TABLE Table;
+    PHYSICAL_ADDRESS TablePhysicalAddress;
+    BOOL Queued;
+} AHCI_SLOT, *PAHCI_SLOT;
+
+/*++
+
+Structure Description:
+
+    This structure defines state associated with an AHCI port and the disk
+    attached to it (the bus driver's context for the disk device).
+
+Members:
+
+    Type - Stores the context type.
+
+    Controller - Stores a pointer back up to the controller.
+
+    Index - Stores the port number.
+
+    Registers - Stores a pointer to the port's register set.
+
+    OsDevice - Stores a pointer to the OS device once the disk has started.
+
+    Device - Stores a pointer to the child device created for the disk.
+
+    IoBuffer - Stores a pointer to the I/O buffer holding the command list,
+        received FIS area, identify buffer, and command tables.
+
+    CommandList - Stores a pointer to the command list.
+
+    Identify - Stores a pointer to the buffer that receives IDENTIFY data.
+
+    IdentifyPhysicalAddress - Stores the physical address of the identify
+        buffer.
+
+    RecoveryTable - Stores a pointer to the command table used to read the
+        error log during recovery, when every slot's table may be in use.
+
+    RecoveryTablePhysicalAddress - Stores the physical address of the
+        recovery command table.
+
+    Log - Stores a pointer to the buffer that receives the error log.
+
+    LogPhysicalAddress - Stores the physical address of the log buffer.
+
+    RecoveryWorkItem - Stores a pointer to the work item that restarts the
+        port after an error or a timeout, at low level.
+
+    Lock - Stores the spin lock that serializes slot state and command
+        issue. It is acquired at dispatch level.
+
+    SlotEvent - Stores a pointer to an event signaled whenever a slot is
+        released.
+
+    CommandEvent - Stores a pointer to the event signaled when a command the
+        driver issued itself completes.
+
+    CommandStatus - Stores the completion status of the driver's own command.
+
+    PendingStatus - Stores the port interrupt status bits gathered by the
+        interrupt service routine but not yet handled.
+
+    SlotMask - Stores the mask of slots that may be used. Without native
+        command queuing this is a single slot.
+
+    BusySlots - Stores the mask of slots currently allocated.
+
+    IssuedSlots - Stores the mask of slots with commands in flight.
+
+    Recovering - Stores a boolean indicating that the recovery work item owns
+        the port. Commands are not handed to the controller while it is set.
+
+    RecoveryError - Stores a boolean indicating that recovery was started by
+        a device error, rather than only by a timeout.
+
+    RecoverySlots - Stores the mask of slots whose commands were in flight
+        when the port stopped. The failed command is among them.
+
+    DeferredSlots - Stores the mask of slots set up during recovery, waiting
+        to be issued once it is done.
+
+    TimedOutSlots - Stores the mask of slots whose commands have been given
+        up on. Recovery fails these rather than reissuing them.
+
+    Exclusive - Stores a boolean indicating that a caller owns every slot in
+        order to issue a command that cannot be queued.
+
+    ExclusiveWaiters - Stores the number of callers waiting for exclusive
+        access. New queued commands wait behind them.
+
+    NcqEnabled - Stores a boolean indicating whether reads and writes use
+        native command queuing.
+
+    Lba48Supported - Stores a boolean indicating whether the 48-bit command
+        set is supported.
+
+    BlockSize - Stores the logical block size of the disk, in bytes.
+
+    BlockShift - Stores the base two logarithm of the block size.
+
+    TotalBlocks - Stores the total number of blocks on the disk.
+
+    DiskInterface - Stores the disk interface.
+
+    Slot - Stores the per-slot state.
+
+--*/
+
+typedef struct _AHCI_PORT {
+    AHCI_CONTEXT_TYPE Type;
+    PAHCI_CONTROLLER Controller;
+    ULONG Index;
+    PVOID Registers;
+    PDEVICE OsDevice;
+    PDEVICE Device;
+    PIO_BUFFER IoBuffer;
+    PAHCI_COMMAND_HEADER CommandList;
+    PUSHORT Identify;
+    PHYSICAL_ADDRESS IdentifyPhysicalAddress;
+    PAHCI_COMMAND_TABLE RecoveryTable;
+    PHYSICAL_ADDRESS RecoveryTablePhysicalAddress;
+    PUCHAR Log;
+    PHYSICAL_ADDRESS LogPhysicalAddress;
+    PWORK_ITEM RecoveryWorkItem;
+    KSPIN_LOCK Lock;
+    PKEVENT SlotEvent;
+    PKEVENT CommandEvent;
+    KSTATUS CommandStatus;
+    volatile ULONG PendingStatus;
+    ULONG SlotMask;
+    ULONG BusySlots;
+    ULONG IssuedSlots;
+    BOOL Recovering;
+    BOOL RecoveryError;
+    ULONG RecoverySlots;
+    ULONG DeferredSlots;
+    ULONG TimedOutSlots;
+    BOOL Exclusive;
+    ULONG ExclusiveWaiters;
+    BOOL NcqEnabled;
+    BOOL Lba48Supported;
+    ULONG BlockSize;
+    ULONG BlockShift;
+    ULONGLONG TotalBlocks;
+    DISK_INTERFACE DiskInterface;
+    AHCI_SLOT Slot[AHCI_MAX_COMMAND_SLOTS];
+} AHCI_PORT, *PAHCI_PORT;
+
+/*++
+
+Structure Description:
+
+    This structure defines state associated with an AHCI controller.
+
+Members:
+
+    Type - Stores the context type.
+
+    ControllerBase - Stores the virtual address of the controller's
+        registers.
+
+    Capabilities - Stores the host capabilities register.
+
+    PortsImplemented - Stores the mask of ports the controller implements.
+
+    CommandSlotCount - Stores the number of command slots in each port.
+
+    MaxPhysicalAddress - Stores the highest physical address the controller
+        can reach with DMA.
+
+    InterruptLine - Stores the interrupt line the controller's interrupt comes
+        in on, or INVALID_INTERRUPT_LINE if message signaled interrupts are
+        in use.
+
+    InterruptVector - Stores the interrupt vector.
+
+    InterruptResourcesFound - Stores a boolean indicating whether or not the
+        interrupt line and vector fields are valid.
+
+    InterruptHandle - Stores the handle of the connected interrupt.
+
+    PciMsiFlags - Stores a bitmask of MSI state. See AHCI_PCI_MSI_FLAG_*.
+
+    PciMsiInterface - Stores the PCI MSI/MSI-X interface.
+
+    Ports - Stores pointers to the port contexts, indexed by port number.
+        Ports that are not implemented have no context.
+
+--*/
+
+struct _AHCI_CONTROLLER {
+    AHCI_CONTEXT_TYPE Type;
+    PVOID ControllerBase;
+    ULONG Capabilities;
+    ULONG PortsImplemented;
+    ULONG CommandSlotCount;
+    PHYSICAL_ADDRESS MaxPhysicalAddress;
+    ULONGLONG InterruptLine;
+    ULONGLONG InterruptVector;
+    BOOL InterruptResourcesFound;
+    HANDLE InterruptHandle;
+    ULONG PciMsiFlags;
+    INTERFACE_PCI_MSI PciMsiInterface;
+    PAHCI_PORT Ports[AHCI_MAX_PORTS];
+};
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
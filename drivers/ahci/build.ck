@@ -0,0 +1,44 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    AHCI
+
+Abstract:
+
+    This module implements the driver for the Advanced Host Controller
+    Interface (AHCI) SATA controller.
+
+Author:
+
+    Minoca Corp. 16-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+function build() {
+    name = "ahci";
+    sources = [
+        "ahci.c"
+    ];
+
+    drv = {
+        "label": name,
+        "inputs": sources,
+    };
+
+    entries = driver(drv);
+    return entries;
+}
+
+return build();
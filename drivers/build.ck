@@ -29,12 +29,14 @@ Module Name:
 function build() {
     drivers = [
         "//drivers/acpi:acpi",
+        "//drivers/ahci:ahci",
         "//drivers/ata:ata",
         "//drivers/devrem:devrem",
         "//drivers/fat:fat",
         "//drivers/i8042:i8042",
         "//drivers/net:net_drivers",
         "//drivers/null:null",
+        "//drivers/nvme:nvme",
         "//drivers/part:part",
         "//drivers/pci:pci",
         "//drivers/plat:platform_drivers",
@@ -63,8 +63,16 @@ Module Name:
 #define E100_READ_COMMAND_REGISTER(_Controller) \
     E100_READ_REGISTER16(_Controller, E100RegisterCommand)
 
+//
+// Commands are written a byte at a time so that they do not disturb the
+// interrupt mask bits in the upper byte of the command word.
+//
+
 #define E100_WRITE_COMMAND_REGISTER(_Controller, _Value) \
-    E100_WRITE_REGISTER16(_Controller, E100RegisterCommand, _Value)
+    E100_WRITE_REGISTER8(_Controller, E100RegisterCommand, _Value)
+
+#define E100_WRITE_INTERRUPT_CONTROL_REGISTER(_Controller, _Value) \
+    E100_WRITE_REGISTER8(_Controller, E100RegisterInterruptControl, _Value)
 
 #define E100_READ_STATUS_REGISTER(_Controller) \
     E100_READ_REGISTER16(_Controller, E100RegisterStatus)
@@ -107,6 +115,14 @@ Module Name:
 
 #define E100_RECEIVE_FRAME_COUNT 32
 
+//
+// Define the number of received frames handed to the networking core at once.
+// This is kept below the ring size so the receive unit always has frames to
+// fill while a batch is being processed.
+//
+
+#define E100_RECEIVE_BATCH_SIZE (E100_RECEIVE_FRAME_COUNT / 2)
+
 //
 // Define the amount of time to wait in microseconds for the status to move to
 // ready.
@@ -171,6 +187,9 @@ Module Name:
 #define E100_COMMAND_MASK_FLOW_CONTROL_PAUSE      (1 << 10)
 #define E100_COMMAND_GENERATE_SOFTWARE_INTERRUPT  (1 << 9)
 #define E100_COMMAND_GLOBAL_MASK                  (1 << 8)
+#define E100_COMMAND_MASK_RECEIVE                 \
+    (E100_COMMAND_MASK_FRAME_RECEIVED | E100_COMMAND_MASK_RECEIVE_NOT_READY)
+
 #define E100_COMMAND_NOP                          (0x0 << 4)
 #define E100_COMMAND_UNIT_START                   (0x1 << 4)
 #define E100_COMMAND_UNIT_RESUME                  (0x2 << 4)
@@ -314,6 +333,7 @@ typedef enum _E100_REGISTER {
     E100RegisterStatus              = 0x0,
     E100RegisterAcknowledge         = 0x1,
     E100RegisterCommand             = 0x2,
+    E100RegisterInterruptControl    = 0x3,
     E100RegisterPointer             = 0x4,
     E100RegisterPort                = 0x8,
     E100RegisterEepromControl       = 0xE,
@@ -485,6 +505,9 @@ Structure Description:
     ReceiveListLock - Stores a pointer to a queued lock that protects the
         received list.
 
+    ReceivePacket - Stores the array of net packet buffers used to hand a
+        batch of received frames to the networking core.
+
     CommandPhysicalAddress - Stores the physical address of the base of the
         command list (called a list but is really an array).
 
@@ -533,6 +556,7 @@ typedef struct _E100_DEVICE {
     PE100_RECEIVE_FRAME ReceiveFrame;
     ULONG ReceiveListBegin;
     PQUEUED_LOCK ReceiveListLock;
+    NET_PACKET_BUFFER ReceivePacket[E100_RECEIVE_BATCH_SIZE];
     PIO_BUFFER CommandIoBuffer;
     PE100_COMMAND Command;
     PNET_PACKET_BUFFER *CommandPacket;
@@ -628,6 +652,32 @@ Return Value:
 
 --*/
 
+ULONG
+E100Poll (
+    PVOID DeviceContext,
+    ULONG Budget
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reaps received frames from the device and hands them to the
+    networking core, unmasking receive interrupts once the device runs dry.
+
+Arguments:
+
+    DeviceContext - Supplies a pointer to the device context associated with
+        the link being polled.
+
+    Budget - Supplies the maximum number of frames to process.
+
+Return Value:
+
+    Returns the number of frames processed.
+
+--*/
+
 KSTATUS
 E100pInitializeDeviceStructures (
     PE100_DEVICE Device
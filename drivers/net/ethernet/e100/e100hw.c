@@ -76,9 +76,10 @@ E100pReapCompletedCommands (
     PE100_DEVICE Device
     );
 
-VOID
+ULONG
 E100pReapReceivedFrames (
-    PE100_DEVICE Device
+    PE100_DEVICE Device,
+    ULONG Budget
     );
 
 VOID
@@ -234,6 +235,53 @@ Return Value:
     return Status;
 }
 
+ULONG
+E100Poll (
+    PVOID DeviceContext,
+    ULONG Budget
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reaps received frames from the device and hands them to the
+    networking core, unmasking receive interrupts once the device runs dry.
+
+Arguments:
+
+    DeviceContext - Supplies a pointer to the device context associated with
+        the link being polled.
+
+    Budget - Supplies the maximum number of frames to process.
+
+Return Value:
+
+    Returns the number of frames processed.
+
+--*/
+
+{
+
+    PE100_DEVICE Device;
+    ULONG Processed;
+
+    Device = (PE100_DEVICE)DeviceContext;
+    Processed = E100pReapReceivedFrames(Device, Budget);
+
+    //
+    // If the budget was not used up then the ring is empty. Go back to taking
+    // receive interrupts. A frame that completed after the ring was checked
+    // leaves its status bit set, which interrupts as soon as it is unmasked.
+    //
+
+    if (Processed < Budget) {
+        E100_WRITE_INTERRUPT_CONTROL_REGISTER(Device, 0);
+    }
+
+    return Processed;
+}
+
 KSTATUS
 E100pInitializeDeviceStructures (
     PE100_DEVICE Device
@@ -756,6 +804,7 @@ Return Value:
     PE100_DEVICE Device;
     ULONG PendingBits;
     ULONG ProcessFramesMask;
+    KSTATUS Status;
 
     Device = (PE100_DEVICE)(Parameter);
 
@@ -772,14 +821,23 @@ Return Value:
 
     //
     // Handle the receive unit leaving the ready state and new frames
-    // coming in.
+    // coming in. Mask further receive interrupts and let the networking core
+    // poll the ring until it drains.
     //
 
     ProcessFramesMask = E100_STATUS_RECEIVE_NOT_READY |
                         E100_STATUS_FRAME_RECEIVED;
 
     if ((PendingBits & ProcessFramesMask) != 0) {
-        E100pReapReceivedFrames(Device);
+        E100_WRITE_INTERRUPT_CONTROL_REGISTER(
+                                    Device,
+                                    E100_COMMAND_MASK_RECEIVE >> BITS_PER_BYTE);
+
+        Status = NetSchedulePoll(Device->NetworkLink);
+        if (!KSUCCESS(Status)) {
+            E100_WRITE_INTERRUPT_CONTROL_REGISTER(Device, 0);
+            E100pReapReceivedFrames(Device, MAX_ULONG);
+        }
     }
 
     //
@@ -1252,124 +1310,160 @@ Return Value:
     return;
 }
 
-VOID
+ULONG
 E100pReapReceivedFrames (
-    PE100_DEVICE Device
+    PE100_DEVICE Device,
+    ULONG Budget
     )
 
 /*++
 
 Routine Description:
 
-    This routine processes any received frames from the network.
+    This routine processes received frames from the network. Completed frames
+    are handed to the networking core in batches, and each batch is returned
+    to the receive unit once the networking core is done with it.
 
 Arguments:
 
     Device - Supplies a pointer to the device.
 
+    Budget - Supplies the maximum number of frames to process.
+
 Return Value:
 
-    None.
+    Returns the number of frames processed.
 
 --*/
 
 {
 
+    ULONG BatchCount;
     PE100_RECEIVE_FRAME Frame;
+    ULONG FrameIndex;
+    ULONG Index;
     PE100_RECEIVE_FRAME LastFrame;
     ULONG ListBegin;
     ULONG ListEnd;
-    NET_PACKET_BUFFER Packet;
+    PNET_PACKET_BUFFER Packet;
+    NET_PACKET_LIST PacketList;
+    ULONG Processed;
     ULONG ReceivePhysicalAddress;
     USHORT ReceiveStatus;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
-    //
-    // Loop grabbing completed frames.
-    //
-
-    Packet.Flags = 0;
+    Processed = 0;
     KeAcquireQueuedLock(Device->ReceiveListLock);
     ReceivePhysicalAddress =
             (ULONG)(Device->ReceiveFrameIoBuffer->Fragment[0].PhysicalAddress);
 
     while (TRUE) {
-        ListBegin = Device->ReceiveListBegin;
-        Frame = &(Device->ReceiveFrame[ListBegin]);
 
         //
-        // If the frame is not complete, then this is the end of packets that
-        // need to be reaped.
+        // Gather a batch of completed frames. Frames that came through alright
+        // get sent up to the core networking library.
         //
 
-        if ((Frame->Status & E100_RECEIVE_COMPLETE) == 0) {
-            break;
+        NET_INITIALIZE_PACKET_LIST(&PacketList);
+        ListBegin = Device->ReceiveListBegin;
+        FrameIndex = ListBegin;
+        BatchCount = 0;
+        while ((BatchCount < E100_RECEIVE_BATCH_SIZE) &&
+               ((Processed + BatchCount) < Budget)) {
+
+            Frame = &(Device->ReceiveFrame[FrameIndex]);
+
+            //
+            // If the frame is not complete, then this is the end of packets
+            // that need to be reaped.
+            //
+
+            if ((Frame->Status & E100_RECEIVE_COMPLETE) == 0) {
+                break;
+            }
+
+            if ((Frame->Status & E100_RECEIVE_OK) != 0) {
+                Packet = &(Device->ReceivePacket[BatchCount]);
+                Packet->Flags = 0;
+                Packet->Buffer = (PVOID)(&(Frame->ReceiveFrame));
+                Packet->BufferPhysicalAddress = ReceivePhysicalAddress +
+                                      (FrameIndex * sizeof(E100_RECEIVE_FRAME));
+
+                Packet->BufferSize = Frame->Sizes &
+                                     E100_RECEIVE_SIZE_ACTUAL_COUNT_MASK;
+
+                Packet->DataSize = Packet->BufferSize;
+                Packet->DataOffset = 0;
+                Packet->FooterOffset = Packet->DataSize;
+                NET_ADD_PACKET_TO_LIST(Packet, &PacketList);
+            }
+
+            FrameIndex = E100_INCREMENT_RING_INDEX(FrameIndex,
+                                                   E100_RECEIVE_FRAME_COUNT);
+
+            BatchCount += 1;
+        }
+
+        if (NET_PACKET_LIST_EMPTY(&PacketList) == FALSE) {
+            NetProcessReceivedPacketList(Device->NetworkLink, &PacketList);
         }
 
         //
-        // If the frame came through alright, send it up to the core networking
-        // library to process.
+        // Set the batch of frames up to be reused, each becoming the new end
+        // of the list in turn.
         //
 
-        if ((Frame->Status & E100_RECEIVE_OK) != 0) {
-            Packet.Buffer = (PVOID)(&(Frame->ReceiveFrame));
-            Packet.BufferPhysicalAddress = ReceivePhysicalAddress +
-                                      (ListBegin * sizeof(E100_RECEIVE_FRAME));
+        for (Index = 0; Index < BatchCount; Index += 1) {
+            Frame = &(Device->ReceiveFrame[ListBegin]);
+            Frame->Status = E100_RECEIVE_COMMAND_SUSPEND;
+            Frame->Sizes = RECEIVE_FRAME_DATA_SIZE <<
+                           E100_RECEIVE_SIZE_BUFFER_SIZE_SHIFT;
 
-            Packet.BufferSize = Frame->Sizes &
-                                E100_RECEIVE_SIZE_ACTUAL_COUNT_MASK;
+            //
+            // Clear the end of list bit in the previous final frame. The
+            // atomic AND also acts as a full memory barrier.
+            //
 
-            Packet.DataSize = Packet.BufferSize;
-            Packet.DataOffset = 0;
-            Packet.FooterOffset = Packet.DataSize;
-            NetProcessReceivedPacket(Device->NetworkLink, &Packet);
-        }
+            ListEnd = E100_DECREMENT_RING_INDEX(ListBegin,
+                                                E100_RECEIVE_FRAME_COUNT);
 
-        //
-        // Set this frame up to be reused, it will be the new end of the list.
-        //
+            LastFrame = &(Device->ReceiveFrame[ListEnd]);
+            RtlAtomicAnd32(&(LastFrame->Status),
+                           ~E100_RECEIVE_COMMAND_SUSPEND);
 
-        Frame->Status = E100_RECEIVE_COMMAND_SUSPEND;
-        Frame->Sizes = RECEIVE_FRAME_DATA_SIZE <<
-                       E100_RECEIVE_SIZE_BUFFER_SIZE_SHIFT;
+            ListBegin = E100_INCREMENT_RING_INDEX(ListBegin,
+                                                  E100_RECEIVE_FRAME_COUNT);
+        }
 
         //
-        // Clear the end of list bit in the previous final frame. The atomic
-        // AND also acts as a full memory barrier.
+        // Move the beginning pointer up.
         //
 
-        ListEnd = E100_DECREMENT_RING_INDEX(ListBegin,
-                                            E100_RECEIVE_FRAME_COUNT);
-
-        LastFrame = &(Device->ReceiveFrame[ListEnd]);
-        RtlAtomicAnd32(&(LastFrame->Status), ~E100_RECEIVE_COMMAND_SUSPEND);
+        Device->ReceiveListBegin = ListBegin;
+        Processed += BatchCount;
 
         //
-        // Move the beginning pointer up.
+        // Resume the receive unit if it's not active.
         //
 
-        Device->ReceiveListBegin = E100_INCREMENT_RING_INDEX(
-                                                      ListBegin,
-                                                      E100_RECEIVE_FRAME_COUNT);
-    }
-
-    //
-    // Resume the receive unit if it's not active.
-    //
+        ReceiveStatus = E100_READ_STATUS_REGISTER(Device) &
+                        E100_STATUS_RECEIVE_UNIT_STATUS_MASK;
 
-    ReceiveStatus = E100_READ_STATUS_REGISTER(Device) &
-                    E100_STATUS_RECEIVE_UNIT_STATUS_MASK;
+        if (ReceiveStatus != E100_STATUS_RECEIVE_UNIT_READY) {
 
-    if (ReceiveStatus != E100_STATUS_RECEIVE_UNIT_READY) {
+            ASSERT(ReceiveStatus == E100_STATUS_RECEIVE_UNIT_SUSPENDED);
 
-        ASSERT(ReceiveStatus == E100_STATUS_RECEIVE_UNIT_SUSPENDED);
+            E100_WRITE_COMMAND_REGISTER(Device, E100_COMMAND_RECEIVE_RESUME);
+        }
 
-        E100_WRITE_COMMAND_REGISTER(Device, E100_COMMAND_RECEIVE_RESUME);
+        if ((BatchCount == 0) || (Processed >= Budget)) {
+            break;
+        }
     }
 
     KeReleaseQueuedLock(Device->ReceiveListLock);
-    return;
+    return Processed;
 }
 
 VOID
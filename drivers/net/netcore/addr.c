@@ -344,6 +344,24 @@ Return Value:
                               0,
                               NetpCompareAddressTranslationEntries);
 
+    //
+    // Devices that can be polled get a work item to do the polling.
+    //
+
+    if (Link->Properties.Interface.Poll != NULL) {
+        Link->PollBudget = NET_LINK_DEFAULT_POLL_BUDGET;
+        Link->PollWorkItem = KeCreateWorkItem(NULL,
+                                              WorkPriorityNormal,
+                                              NetpLinkPollWorker,
+                                              Link,
+                                              NET_CORE_ALLOCATION_TAG);
+
+        if (Link->PollWorkItem == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto AddLinkEnd;
+        }
+    }
+
     //
     // Find the appropriate data link layer and initialize it for this link.
     //
@@ -399,23 +417,27 @@ Return Value:
 
     //
     // All network devices respond to the network device information requests.
+    // Software links like loopback have no device.
     //
 
-    Status = IoRegisterDeviceInformation(Link->Properties.Device,
-                                         &NetNetworkDeviceInformationUuid,
-                                         TRUE);
+    if (Link->Properties.Device != NULL) {
+        Status = IoRegisterDeviceInformation(Link->Properties.Device,
+                                             &NetNetworkDeviceInformationUuid,
+                                             TRUE);
 
-    if (!KSUCCESS(Status)) {
-        goto AddLinkEnd;
-    }
+        if (!KSUCCESS(Status)) {
+            goto AddLinkEnd;
+        }
 
-    //
-    // With success a sure thing, take a reference on the OS device that
-    // registered the link with netcore. Its device context and driver need to
-    // remain available as long as netcore can access the device link interface.
-    //
+        //
+        // With success a sure thing, take a reference on the OS device that
+        // registered the link with netcore. Its device context and driver need
+        // to remain available as long as netcore can access the device link
+        // interface.
+        //
 
-    IoDeviceAddReference(Link->Properties.Device);
+        IoDeviceAddReference(Link->Properties.Device);
+    }
 
     //
     // Add the link to the global list. It is all ready to send and receive
@@ -433,9 +455,11 @@ Return Value:
 AddLinkEnd:
     if (!KSUCCESS(Status)) {
         if (Link != NULL) {
-            IoRegisterDeviceInformation(Link->Properties.Device,
-                                        &NetNetworkDeviceInformationUuid,
-                                        FALSE);
+            if (Link->Properties.Device != NULL) {
+                IoRegisterDeviceInformation(Link->Properties.Device,
+                                            &NetNetworkDeviceInformationUuid,
+                                            FALSE);
+            }
 
             //
             // If some network layer entries have initialized already, call
@@ -477,6 +501,10 @@ Return Value:
                 KeDestroyEvent(Link->AddressTranslationEvent);
             }
 
+            if (Link->PollWorkItem != NULL) {
+                KeDestroyWorkItem(Link->PollWorkItem);
+            }
+
             MmFreePagedPool(Link);
             Link = NULL;
         }
@@ -633,8 +661,9 @@ Return Value:
     }
 
     //
-    // If the link is now up, then use DHCP to get an address. It is assumed
-    // that the link will not go down before handing off to DHCP.
+    // If the link is now up, then use DHCP to get an address, unless the
+    // address was statically configured already. It is assumed that the link
+    // will not go down before handing off to DHCP.
     //
 
     if (LinkUp != FALSE) {
@@ -657,15 +686,17 @@ Return Value:
                                  NET_LINK_ADDRESS_ENTRY,
                                  ListEntry);
 
-        Status = NetpDhcpBeginAssignment(Link, LinkAddress);
-        if (!KSUCCESS(Status)) {
+        if (LinkAddress->Configured == FALSE) {
+            Status = NetpDhcpBeginAssignment(Link, LinkAddress);
+            if (!KSUCCESS(Status)) {
 
-            //
-            // TODO: Handle failed DHCP.
-            //
+                //
+                // TODO: Handle failed DHCP.
+                //
 
-            ASSERT(FALSE);
+                ASSERT(FALSE);
 
+            }
         }
 
     //
@@ -909,9 +940,11 @@ Return Value:
     // information requests.
     //
 
-    IoRegisterDeviceInformation(Link->Properties.Device,
-                                &NetNetworkDeviceInformationUuid,
-                                FALSE);
+    if (Link->Properties.Device != NULL) {
+        IoRegisterDeviceInformation(Link->Properties.Device,
+                                    &NetNetworkDeviceInformationUuid,
+                                    FALSE);
+    }
 
     //
     // If the link is still up, then send out the notice that is is actually
@@ -1100,10 +1133,13 @@ Return Value:
     PNET_LINK_ADDRESS_ENTRY CurrentLinkAddressEntry;
     PLIST_ENTRY CurrentLinkEntry;
     PNET_LINK_ADDRESS_ENTRY FoundAddress;
+    BOOL LoopbackDestination;
+    BOOL LoopbackLink;
     KSTATUS Status;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
+    LoopbackDestination = NetpIsLoopbackAddress(RemoteAddress);
     KeAcquireSharedExclusiveLockShared(NetLinkListLock);
     if (LIST_EMPTY(&NetLinkList)) {
         Status = STATUS_NO_NETWORK_CONNECTION;
@@ -1125,6 +1161,20 @@ Return Value:
             continue;
         }
 
+        //
+        // Loopback addresses are only reachable through the loopback link,
+        // and the loopback link reaches nothing else.
+        //
+
+        LoopbackLink = FALSE;
+        if (CurrentLink == NetLoopbackLink) {
+            LoopbackLink = TRUE;
+        }
+
+        if (LoopbackLink != LoopbackDestination) {
+            continue;
+        }
+
         //
         // TODO: Properly determine the route for this destination, rather
         // than just connecting through the first working network link and first
@@ -2607,6 +2657,93 @@ Return Value:
     return FoundSocket;
 }
 
+NET_API
+PNET_SOCKET
+NetFindReceiveSocket (
+    PNET_LINK Link,
+    PNET_PROTOCOL_ENTRY ProtocolEntry,
+    PNETWORK_ADDRESS LocalAddress,
+    PNETWORK_ADDRESS RemoteAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the socket that should receive a packet arriving on the
+    given link. If the link is in the middle of processing a batch of received
+    packets on this thread, the fully bound socket found for the previous
+    packet is reused without searching the socket trees. If the socket is
+    found and returned, the reference count will be increased on it. It is the
+    caller's responsiblity to release that reference.
+
+Arguments:
+
+    Link - Supplies a pointer to the link that received the packet.
+
+    ProtocolEntry - Supplies the protocol the socket must be on.
+
+    LocalAddress - Supplies a pointer to the local address of the socket.
+
+    RemoteAddress - Supplies a pointer to the remote address of the socket.
+
+Return Value:
+
+    Returns a pointer to a socket matching the given parameters, with an
+    increased reference count.
+
+    NULL if no socket matches.
+
+--*/
+
+{
+
+    PNET_RECEIVE_BATCH Batch;
+    PNET_SOCKET Socket;
+
+    //
+    // The batch lives on the stack of the thread processing it, so only look
+    // at it from that thread.
+    //
+
+    if (Link->ReceiveBatchThread != KeGetCurrentThread()) {
+        return NetFindSocket(ProtocolEntry, LocalAddress, RemoteAddress);
+    }
+
+    Batch = Link->ReceiveBatch;
+
+    ASSERT(Batch != NULL);
+
+    //
+    // The batch holds a reference on its socket, so it is safe to look at
+    // without the socket lock. A socket deactivated since the last packet is
+    // dropped from the batch and the trees are searched again.
+    //
+
+    Socket = Batch->Socket;
+    if (Socket != NULL) {
+        if ((Socket->Protocol == ProtocolEntry) &&
+            ((Socket->Flags & NET_SOCKET_FLAG_ACTIVE) != 0) &&
+            (NetpMatchFullyBoundSocket(Socket, LocalAddress, RemoteAddress) ==
+             ComparisonResultSame)) {
+
+            IoSocketAddReference(&(Socket->KernelSocket));
+            return Socket;
+        }
+
+        Batch->Socket = NULL;
+        IoSocketReleaseReference(&(Socket->KernelSocket));
+    }
+
+    Socket = NetFindSocket(ProtocolEntry, LocalAddress, RemoteAddress);
+    if ((Socket != NULL) && (Socket->BindingType == SocketFullyBound)) {
+        IoSocketAddReference(&(Socket->KernelSocket));
+        Batch->Socket = Socket;
+    }
+
+    return Socket;
+}
+
 NET_API
 KSTATUS
 NetGetSetNetworkDeviceInformation (
@@ -3495,8 +3632,23 @@ Return Value:
 
     KeReleaseSharedExclusiveLockShared(NetPluginListLock);
     Link->DataLinkEntry->Interface.DestroyLink(Link);
+
+    //
+    // Make sure no poll is running or pending before telling the device to
+    // tear down its context.
+    //
+
+    if (Link->PollWorkItem != NULL) {
+        KeCancelWorkItem(Link->PollWorkItem);
+        KeFlushWorkItem(Link->PollWorkItem);
+        KeDestroyWorkItem(Link->PollWorkItem);
+    }
+
     Link->Properties.Interface.DestroyLink(Link->Properties.DeviceContext);
-    IoDeviceReleaseReference(Link->Properties.Device);
+    if (Link->Properties.Device != NULL) {
+        IoDeviceReleaseReference(Link->Properties.Device);
+    }
+
     MmFreePagedPool(Link);
     return;
 }
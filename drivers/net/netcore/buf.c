@@ -37,25 +37,208 @@ Module Name:
 // ---------------------------------------------------------------- Definitions
 //
 
+//
+// Define the buffer size classes cached per processor. Class N holds buffers
+// of exactly 2^(N + minimum shift) bytes. Larger buffers go through the global
+// free list.
+//
+
+#define NET_BUFFER_MINIMUM_CLASS_SHIFT 8
+#define NET_BUFFER_SIZE_CLASS_COUNT 9
+#define NET_BUFFER_CLASS_SIZE(_Class) \
+    (1UL << ((_Class) + NET_BUFFER_MINIMUM_CLASS_SHIFT))
+
+//
+// Define the number of buffers each processor caches per class, and the
+// number moved between a processor and the depot at once.
+//
+
+#define NET_BUFFER_CACHE_DEPTH 32
+#define NET_BUFFER_CACHE_BATCH (NET_BUFFER_CACHE_DEPTH / 2)
+
+//
+// Define the maximum number of buffers held in each depot. Buffers freed
+// beyond this are returned to the system.
+//
+
+#define NET_BUFFER_DEPOT_LIMIT 256
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+typedef enum _NET_BUFFER_CONSTRAINT {
+    NetBufferConstraintPaged,
+    NetBufferConstraint32Bit,
+    NetBufferConstraintAny,
+    NetBufferConstraintCount
+} NET_BUFFER_CONSTRAINT, *PNET_BUFFER_CONSTRAINT;
+
+/*++
+
+Structure Description:
+
+    This structure defines a stack of free network buffers cached on a
+    processor. It only holds pointers, so it can be manipulated at dispatch
+    level even though the buffers themselves live in paged pool.
+
+Members:
+
+    Count - Stores the number of buffers in the stack.
+
+    Buffers - Stores the array of free buffers.
+
+--*/
+
+typedef struct _NET_BUFFER_STACK {
+    ULONG Count;
+    PNET_PACKET_BUFFER Buffers[NET_BUFFER_CACHE_DEPTH];
+} NET_BUFFER_STACK, *PNET_BUFFER_STACK;
+
+/*++
+
+Structure Description:
+
+    This structure defines the per-processor network buffer cache.
+
+Members:
+
+    Stacks - Stores the free buffer stacks for each DMA constraint and size
+        class.
+
+    Hits - Stores the number of allocations satisfied by this processor's
+        cache.
+
+    Misses - Stores the number of cacheable allocations this processor's
+        cache could not satisfy.
+
+    Trims - Stores the number of times a full stack on this processor was
+        trimmed back to the depot.
+
+--*/
+
+typedef struct _NET_BUFFER_CACHE {
+    NET_BUFFER_STACK
+        Stacks[NetBufferConstraintCount][NET_BUFFER_SIZE_CLASS_COUNT];
+    ULONG Hits;
+    ULONG Misses;
+    ULONG Trims;
+} NET_BUFFER_CACHE, *PNET_BUFFER_CACHE;
+
+/*++
+
+Structure Description:
+
+    This structure defines the global backing store of free buffers for one
+    DMA constraint and size class, shared by all processors.
+
+Members:
+
+    FreeList - Stores the list of free buffers.
+
+    Count - Stores the number of buffers on the free list.
+
+--*/
+
+typedef struct _NET_BUFFER_DEPOT {
+    LIST_ENTRY FreeList;
+    ULONG Count;
+} NET_BUFFER_DEPOT, *PNET_BUFFER_DEPOT;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+BOOL
+NetpGetBufferAllocationClass (
+    PNET_LINK Link,
+    ULONG Alignment,
+    PHYSICAL_ADDRESS MaximumPhysicalAddress,
+    ULONG Size,
+    PNET_BUFFER_CONSTRAINT Constraint,
+    PULONG Class
+    );
+
+BOOL
+NetpGetBufferFreeClass (
+    PNET_PACKET_BUFFER Buffer,
+    PNET_BUFFER_CONSTRAINT Constraint,
+    PULONG Class
+    );
+
+PNET_PACKET_BUFFER
+NetpBufferCacheAllocate (
+    NET_BUFFER_CONSTRAINT Constraint,
+    ULONG Class
+    );
+
+VOID
+NetpBufferCacheFree (
+    PNET_PACKET_BUFFER Buffer,
+    NET_BUFFER_CONSTRAINT Constraint,
+    ULONG Class
+    );
+
+ULONG
+NetpBufferCachePush (
+    NET_BUFFER_CONSTRAINT Constraint,
+    ULONG Class,
+    PNET_PACKET_BUFFER *Buffers,
+    ULONG Count
+    );
+
+VOID
+NetpBufferDepotRelease (
+    NET_BUFFER_CONSTRAINT Constraint,
+    ULONG Class,
+    PNET_PACKET_BUFFER *Buffers,
+    ULONG Count
+    );
+
+VOID
+NetpPrintBufferStatistics (
+    VOID
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
 //
-// Store a pointer to the global list of network buffers.
+// Store a pointer to the global list of network buffers that are too large
+// for the per-processor caches, and the lock that protects it and the depots.
 //
 
 LIST_ENTRY NetFreeBufferList;
 PQUEUED_LOCK NetBufferListLock;
 
+//
+// Store the array of per-processor buffer caches.
+//
+
+PNET_BUFFER_CACHE NetBufferCaches;
+ULONG NetBufferCacheCount;
+
+//
+// Store the depots backing the per-processor caches.
+//
+
+NET_BUFFER_DEPOT NetBufferDepots[NetBufferConstraintCount]
+                                [NET_BUFFER_SIZE_CLASS_COUNT];
+
+//
+// Store the number of buffers the depots have returned to the system.
+//
+
+ULONG NetBufferDepotReleases;
+
+//
+// Set this debug flag to print buffer cache statistics whenever buffers are
+// trimmed from a processor's cache.
+//
+
+BOOL NetBufferDebug = FALSE;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -110,9 +293,13 @@ Return Value:
 {
 
     ULONG Alignment;
+    ULONG AllocationSize;
     PNET_PACKET_BUFFER Buffer;
     PHYSICAL_ADDRESS BufferPhysical;
     ULONGLONG BufferSize;
+    BOOL Cacheable;
+    ULONG Class;
+    NET_BUFFER_CONSTRAINT Constraint;
     PLIST_ENTRY CurrentEntry;
     PNET_DATA_LINK_ENTRY DataLinkEntry;
     ULONG DataLinkMask;
@@ -198,10 +385,36 @@ Return Value:
     TotalSize = DataSize + Padding;
     TotalSize = ALIGN_RANGE_UP(TotalSize, Alignment);
 
+    //
+    // Most buffers fit in a size class whose DMA constraints satisfy the link.
+    // Try the processor's cache for those, and allocate a fresh buffer of the
+    // full class size on a miss so that it can be cached when freed.
+    //
+
+    Cacheable = NetpGetBufferAllocationClass(Link,
+                                             Alignment,
+                                             MaximumPhysicalAddress,
+                                             TotalSize,
+                                             &Constraint,
+                                             &Class);
+
+    LockHeld = FALSE;
+    if (Cacheable != FALSE) {
+        AllocationSize = NET_BUFFER_CLASS_SIZE(Class);
+        Buffer = NetpBufferCacheAllocate(Constraint, Class);
+        if (Buffer != NULL) {
+            Status = STATUS_SUCCESS;
+            goto AllocateBufferEnd;
+        }
+
+        goto AllocateBufferNew;
+    }
+
     //
     // Loop through the list looking for the first buffer that fits.
     //
 
+    AllocationSize = TotalSize;
     KeAcquireQueuedLock(NetBufferListLock);
     LockHeld = TRUE;
     CurrentEntry = NetFreeBufferList.Next;
@@ -237,6 +450,8 @@ Return Value:
     KeReleaseQueuedLock(NetBufferListLock);
     LockHeld = FALSE;
 
+AllocateBufferNew:
+
     //
     // Allocate a network packet buffer, but do not bother to zero it. This
     // routine takes care to initialize all the necessary fields before it is
@@ -260,11 +475,11 @@ Return Value:
         Buffer->IoBuffer = MmAllocateNonPagedIoBuffer(0,
                                                       MaximumPhysicalAddress,
                                                       Alignment,
-                                                      TotalSize,
+                                                      AllocationSize,
                                                       IoBufferFlags);
 
     } else {
-        Buffer->IoBuffer = MmAllocatePagedIoBuffer(TotalSize, 0);
+        Buffer->IoBuffer = MmAllocatePagedIoBuffer(AllocationSize, 0);
     }
 
     if (Buffer->IoBuffer == NULL) {
@@ -344,6 +559,14 @@ Return Value:
 
 {
 
+    ULONG Class;
+    NET_BUFFER_CONSTRAINT Constraint;
+
+    if (NetpGetBufferFreeClass(Buffer, &Constraint, &Class) != FALSE) {
+        NetpBufferCacheFree(Buffer, Constraint, Class);
+        return;
+    }
+
     KeAcquireQueuedLock(NetBufferListLock);
     INSERT_AFTER(&(Buffer->ListEntry), &NetFreeBufferList);
     KeReleaseQueuedLock(NetBufferListLock);
@@ -412,12 +635,44 @@ Return Value:
 
 {
 
+    ULONG AllocationSize;
+    ULONG Count;
+    PNET_BUFFER_DEPOT Depot;
+    ULONG Index;
+
+    if (NetBufferDebug == FALSE) {
+        NetBufferDebug = NetGlobalDebug;
+    }
+
     INITIALIZE_LIST_HEAD(&NetFreeBufferList);
+    Count = NetBufferConstraintCount * NET_BUFFER_SIZE_CLASS_COUNT;
+    Depot = &(NetBufferDepots[0][0]);
+    for (Index = 0; Index < Count; Index += 1) {
+        INITIALIZE_LIST_HEAD(&(Depot[Index].FreeList));
+        Depot[Index].Count = 0;
+    }
+
     NetBufferListLock = KeCreateQueuedLock();
     if (NetBufferListLock == NULL) {
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
+    //
+    // Create a buffer cache for each processor. Processors that come online
+    // later just go straight to the depots.
+    //
+
+    NetBufferCacheCount = KeGetActiveProcessorCount();
+    AllocationSize = NetBufferCacheCount * sizeof(NET_BUFFER_CACHE);
+    NetBufferCaches = MmAllocateNonPagedPool(AllocationSize,
+                                             NET_CORE_ALLOCATION_TAG);
+
+    if (NetBufferCaches == NULL) {
+        NetBufferCacheCount = 0;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(NetBufferCaches, AllocationSize);
     return STATUS_SUCCESS;
 }
 
@@ -449,6 +704,12 @@ Return Value:
         KeDestroyQueuedLock(NetBufferListLock);
     }
 
+    if (NetBufferCaches != NULL) {
+        MmFreeNonPagedPool(NetBufferCaches);
+        NetBufferCaches = NULL;
+        NetBufferCacheCount = 0;
+    }
+
     return;
 }
 
@@ -456,3 +717,512 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+
+BOOL
+NetpGetBufferAllocationClass (
+    PNET_LINK Link,
+    ULONG Alignment,
+    PHYSICAL_ADDRESS MaximumPhysicalAddress,
+    ULONG Size,
+    PNET_BUFFER_CONSTRAINT Constraint,
+    PULONG Class
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines the per-processor cache that can satisfy a buffer
+    allocation.
+
+Arguments:
+
+    Link - Supplies an optional pointer to the link the buffer will be sent
+        through.
+
+    Alignment - Supplies the required alignment of the buffer.
+
+    MaximumPhysicalAddress - Supplies the maximum physical address the link
+        can access.
+
+    Size - Supplies the total size of the buffer needed, in bytes.
+
+    Constraint - Supplies a pointer where the DMA constraint of the cache will
+        be returned.
+
+    Class - Supplies a pointer where the size class of the cache will be
+        returned.
+
+Return Value:
+
+    TRUE if the allocation can be satisfied from a per-processor cache.
+
+    FALSE if the allocation must go through the global free list.
+
+--*/
+
+{
+
+    ULONG ClassSize;
+    ULONG PageSize;
+
+    //
+    // Non-paged buffers are allocated with page granularity and alignment, so
+    // their classes start at a page. Links with stricter requirements than
+    // that, or whose physical address limit is neither exactly 32-bit nor
+    // unlimited, are rare enough to go through the global list.
+    //
+
+    if (Link == NULL) {
+        *Constraint = NetBufferConstraintPaged;
+
+    } else {
+        PageSize = MmPageSize();
+        if ((Alignment > PageSize) ||
+            (MaximumPhysicalAddress < MAX_ULONG)) {
+
+            return FALSE;
+        }
+
+        if (MaximumPhysicalAddress == MAX_ULONG) {
+            *Constraint = NetBufferConstraint32Bit;
+
+        } else if (MaximumPhysicalAddress == MAX_ULONGLONG) {
+            *Constraint = NetBufferConstraintAny;
+
+        } else {
+            return FALSE;
+        }
+
+        if (Size < PageSize) {
+            Size = PageSize;
+        }
+    }
+
+    for (*Class = 0; *Class < NET_BUFFER_SIZE_CLASS_COUNT; *Class += 1) {
+        ClassSize = NET_BUFFER_CLASS_SIZE(*Class);
+        if (ClassSize >= Size) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+BOOL
+NetpGetBufferFreeClass (
+    PNET_PACKET_BUFFER Buffer,
+    PNET_BUFFER_CONSTRAINT Constraint,
+    PULONG Class
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines the per-processor cache a freed buffer belongs in.
+
+Arguments:
+
+    Buffer - Supplies a pointer to the buffer being freed.
+
+    Constraint - Supplies a pointer where the DMA constraint of the cache will
+        be returned.
+
+    Class - Supplies a pointer where the size class of the cache will be
+        returned.
+
+Return Value:
+
+    TRUE if the buffer can be placed in a per-processor cache.
+
+    FALSE if the buffer must be placed on the global free list.
+
+--*/
+
+{
+
+    PHYSICAL_ADDRESS PhysicalAddress;
+    UINTN Size;
+
+    Size = Buffer->IoBuffer->Fragment[0].Size;
+    if ((Size < NET_BUFFER_CLASS_SIZE(0)) ||
+        (Size > NET_BUFFER_CLASS_SIZE(NET_BUFFER_SIZE_CLASS_COUNT - 1)) ||
+        (!POWER_OF_2(Size))) {
+
+        return FALSE;
+    }
+
+    PhysicalAddress = Buffer->IoBuffer->Fragment[0].PhysicalAddress;
+    if (PhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
+        *Constraint = NetBufferConstraintPaged;
+
+    } else if ((PhysicalAddress + Size) <= MAX_ULONG) {
+        *Constraint = NetBufferConstraint32Bit;
+
+    } else {
+        *Constraint = NetBufferConstraintAny;
+    }
+
+    *Class = RtlCountTrailingZeros32(Size) - NET_BUFFER_MINIMUM_CLASS_SHIFT;
+    return TRUE;
+}
+
+PNET_PACKET_BUFFER
+NetpBufferCacheAllocate (
+    NET_BUFFER_CONSTRAINT Constraint,
+    ULONG Class
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates a buffer from the current processor's cache,
+    refilling the cache from the depot if it is empty.
+
+Arguments:
+
+    Constraint - Supplies the DMA constraint of the buffer.
+
+    Class - Supplies the size class of the buffer.
+
+Return Value:
+
+    Returns a pointer to the buffer on success.
+
+    NULL if neither the cache nor the depot has a free buffer.
+
+--*/
+
+{
+
+    PNET_PACKET_BUFFER Buffer;
+    PNET_PACKET_BUFFER Buffers[NET_BUFFER_CACHE_BATCH];
+    PNET_BUFFER_CACHE Cache;
+    ULONG Count;
+    PNET_BUFFER_DEPOT Depot;
+    PLIST_ENTRY Entry;
+    RUNLEVEL OldRunLevel;
+    ULONG Processor;
+    PNET_BUFFER_STACK Stack;
+
+    Buffer = NULL;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    Processor = KeGetCurrentProcessorNumber();
+    if (Processor < NetBufferCacheCount) {
+        Cache = &(NetBufferCaches[Processor]);
+        Stack = &(Cache->Stacks[Constraint][Class]);
+        if (Stack->Count != 0) {
+            Stack->Count -= 1;
+            Buffer = Stack->Buffers[Stack->Count];
+            Cache->Hits += 1;
+
+        } else {
+            Cache->Misses += 1;
+        }
+    }
+
+    KeLowerRunLevel(OldRunLevel);
+    if (Buffer != NULL) {
+        return Buffer;
+    }
+
+    //
+    // Refill in bulk from the depot so that the lock is not taken again for
+    // the next several allocations.
+    //
+
+    Count = 0;
+    Depot = &(NetBufferDepots[Constraint][Class]);
+    KeAcquireQueuedLock(NetBufferListLock);
+    while ((Count < NET_BUFFER_CACHE_BATCH) && (Depot->Count != 0)) {
+        Entry = Depot->FreeList.Next;
+        LIST_REMOVE(Entry);
+        Depot->Count -= 1;
+        Buffers[Count] = LIST_VALUE(Entry, NET_PACKET_BUFFER, ListEntry);
+        Count += 1;
+    }
+
+    KeReleaseQueuedLock(NetBufferListLock);
+    if (Count == 0) {
+        return NULL;
+    }
+
+    Count -= 1;
+    Buffer = Buffers[Count];
+    if (Count != 0) {
+        Count = NetpBufferCachePush(Constraint, Class, Buffers, Count);
+        if (Count != 0) {
+            NetpBufferDepotRelease(Constraint, Class, Buffers, Count);
+        }
+    }
+
+    return Buffer;
+}
+
+VOID
+NetpBufferCacheFree (
+    PNET_PACKET_BUFFER Buffer,
+    NET_BUFFER_CONSTRAINT Constraint,
+    ULONG Class
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns a buffer to the current processor's cache, trimming
+    the cache back to the depot if it is full.
+
+Arguments:
+
+    Buffer - Supplies a pointer to the buffer to free.
+
+    Constraint - Supplies the DMA constraint of the buffer.
+
+    Class - Supplies the size class of the buffer.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNET_PACKET_BUFFER Buffers[NET_BUFFER_CACHE_BATCH + 1];
+    PNET_BUFFER_CACHE Cache;
+    ULONG Count;
+    ULONG Index;
+    RUNLEVEL OldRunLevel;
+    ULONG Processor;
+    PNET_BUFFER_STACK Stack;
+
+    Buffers[0] = Buffer;
+    Count = 1;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    Processor = KeGetCurrentProcessorNumber();
+    if (Processor < NetBufferCacheCount) {
+        Cache = &(NetBufferCaches[Processor]);
+        Stack = &(Cache->Stacks[Constraint][Class]);
+        if (Stack->Count < NET_BUFFER_CACHE_DEPTH) {
+            Stack->Buffers[Stack->Count] = Buffer;
+            Stack->Count += 1;
+            Count = 0;
+
+        } else {
+
+            //
+            // Move the oldest half of the stack out along with this buffer so
+            // the recently used buffers stay cache-warm on this processor.
+            //
+
+            RtlCopyMemory(&(Buffers[1]),
+                          Stack->Buffers,
+                          NET_BUFFER_CACHE_BATCH * sizeof(PNET_PACKET_BUFFER));
+
+            Stack->Count -= NET_BUFFER_CACHE_BATCH;
+            for (Index = 0; Index < Stack->Count; Index += 1) {
+                Stack->Buffers[Index] =
+                             Stack->Buffers[Index + NET_BUFFER_CACHE_BATCH];
+            }
+
+            Count += NET_BUFFER_CACHE_BATCH;
+            Cache->Trims += 1;
+        }
+    }
+
+    KeLowerRunLevel(OldRunLevel);
+    if (Count != 0) {
+        NetpBufferDepotRelease(Constraint, Class, Buffers, Count);
+    }
+
+    return;
+}
+
+ULONG
+NetpBufferCachePush (
+    NET_BUFFER_CONSTRAINT Constraint,
+    ULONG Class,
+    PNET_PACKET_BUFFER *Buffers,
+    ULONG Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine pushes buffers onto the current processor's cache.
+
+Arguments:
+
+    Constraint - Supplies the DMA constraint of the buffers.
+
+    Class - Supplies the size class of the buffers.
+
+    Buffers - Supplies an array of buffers to push. Any buffers that did not
+        fit are moved to the beginning of the array.
+
+    Count - Supplies the number of buffers in the array.
+
+Return Value:
+
+    Returns the number of buffers that did not fit in the cache.
+
+--*/
+
+{
+
+    ULONG Free;
+    ULONG Index;
+    RUNLEVEL OldRunLevel;
+    ULONG Processor;
+    ULONG PushCount;
+    PNET_BUFFER_STACK Stack;
+
+    PushCount = 0;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    Processor = KeGetCurrentProcessorNumber();
+    if (Processor < NetBufferCacheCount) {
+        Stack = &(NetBufferCaches[Processor].Stacks[Constraint][Class]);
+        Free = NET_BUFFER_CACHE_DEPTH - Stack->Count;
+        PushCount = Count;
+        if (PushCount > Free) {
+            PushCount = Free;
+        }
+
+        RtlCopyMemory(&(Stack->Buffers[Stack->Count]),
+                      Buffers,
+                      PushCount * sizeof(PNET_PACKET_BUFFER));
+
+        Stack->Count += PushCount;
+    }
+
+    KeLowerRunLevel(OldRunLevel);
+    Count -= PushCount;
+    if (PushCount != 0) {
+        for (Index = 0; Index < Count; Index += 1) {
+            Buffers[Index] = Buffers[Index + PushCount];
+        }
+    }
+
+    return Count;
+}
+
+VOID
+NetpBufferDepotRelease (
+    NET_BUFFER_CONSTRAINT Constraint,
+    ULONG Class,
+    PNET_PACKET_BUFFER *Buffers,
+    ULONG Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine places buffers in the depot, freeing any beyond the depot's
+    limit back to the system.
+
+Arguments:
+
+    Constraint - Supplies the DMA constraint of the buffers.
+
+    Class - Supplies the size class of the buffers.
+
+    Buffers - Supplies an array of buffers to release.
+
+    Count - Supplies the number of buffers in the array.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNET_PACKET_BUFFER Buffer;
+    PNET_BUFFER_DEPOT Depot;
+    ULONG Index;
+    ULONG Released;
+
+    Depot = &(NetBufferDepots[Constraint][Class]);
+    Index = 0;
+    KeAcquireQueuedLock(NetBufferListLock);
+    while ((Index < Count) && (Depot->Count < NET_BUFFER_DEPOT_LIMIT)) {
+        Buffer = Buffers[Index];
+        INSERT_AFTER(&(Buffer->ListEntry), &(Depot->FreeList));
+        Depot->Count += 1;
+        Index += 1;
+    }
+
+    Released = Count - Index;
+    NetBufferDepotReleases += Released;
+    KeReleaseQueuedLock(NetBufferListLock);
+    while (Index < Count) {
+        Buffer = Buffers[Index];
+        MmFreeIoBuffer(Buffer->IoBuffer);
+        MmFreePagedPool(Buffer);
+        Index += 1;
+    }
+
+    //
+    // Only report when the depot overflowed, rather than on every release.
+    //
+
+    if ((NetBufferDebug != FALSE) && (Released != 0)) {
+        NetpPrintBufferStatistics();
+    }
+
+    return;
+}
+
+VOID
+NetpPrintBufferStatistics (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints the per-processor buffer cache statistics to the
+    debugger.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Hits;
+    ULONG Misses;
+    ULONG Processor;
+    ULONG Trims;
+
+    Hits = 0;
+    Misses = 0;
+    Trims = 0;
+    for (Processor = 0; Processor < NetBufferCacheCount; Processor += 1) {
+        Hits += NetBufferCaches[Processor].Hits;
+        Misses += NetBufferCaches[Processor].Misses;
+        Trims += NetBufferCaches[Processor].Trims;
+    }
+
+    RtlDebugPrint("NET: Buffer caches: %d hits, %d misses, %d trims, "
+                  "%d released.\n",
+                  Hits,
+                  Misses,
+                  Trims,
+                  NetBufferDepotReleases);
+
+    return;
+}
@@ -36,6 +36,7 @@ function build() {
         "dhcp.c",
         "ethernet.c",
         "ip4.c",
+        "loopback.c",
         "netcore.c",
         "netlink/netlink.c",
         "netlink/genctrl.c",
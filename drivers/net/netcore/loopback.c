@@ -0,0 +1,533 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    loopback.c
+
+Abstract:
+
+    This module implements the software loopback link, which carries traffic
+    between sockets on this machine without involving a network device.
+
+Author:
+
+    Minoca Corp. 16-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include "netcore.h"
+#include <minoca/net/ip4.h>
+#include "ethernet.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the IPv4 address and subnet mask of the loopback link, in host order.
+//
+
+#define NET_LOOPBACK_IP4_ADDRESS 0x7F000001
+#define NET_LOOPBACK_IP4_SUBNET 0xFF000000
+
+//
+// Define the reported speed of the loopback link.
+//
+
+#define NET_LOOPBACK_LINK_SPEED (10 * NET_SPEED_1000_MBPS)
+
+//
+// Define the number of packets that can be waiting to loop back before new
+// sends are dropped.
+//
+
+#define NET_LOOPBACK_MAX_QUEUED_PACKETS 1024
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines the device context of the loopback link.
+
+Members:
+
+    Lock - Stores the spin lock protecting the packet list.
+
+    PacketList - Stores the list of packets sent but not yet received.
+
+    WorkItem - Stores a pointer to the work item that delivers queued packets
+        back up the stack.
+
+--*/
+
+typedef struct _NET_LOOPBACK_CONTEXT {
+    KSPIN_LOCK Lock;
+    NET_PACKET_LIST PacketList;
+    PWORK_ITEM WorkItem;
+} NET_LOOPBACK_CONTEXT, *PNET_LOOPBACK_CONTEXT;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+NetpLoopbackSend (
+    PVOID DeviceContext,
+    PNET_PACKET_LIST PacketList
+    );
+
+KSTATUS
+NetpLoopbackGetSetInformation (
+    PVOID DeviceContext,
+    NET_LINK_INFORMATION_TYPE InformationType,
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
+VOID
+NetpLoopbackDestroyLink (
+    PVOID DeviceContext
+    );
+
+VOID
+NetpLoopbackReceiveWorker (
+    PVOID Parameter
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store a pointer to the loopback link.
+//
+
+PNET_LINK NetLoopbackLink;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+VOID
+NetpLoopbackInitialize (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the loopback link and assigns it its address.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNET_LOOPBACK_CONTEXT Context;
+    PNET_LINK Link;
+    PNET_LINK_ADDRESS_ENTRY LinkAddress;
+    IP4_ADDRESS LoopbackAddress;
+    NET_LINK_PROPERTIES Properties;
+    KSTATUS Status;
+
+    Link = NULL;
+    Context = MmAllocateNonPagedPool(sizeof(NET_LOOPBACK_CONTEXT),
+                                     NET_CORE_ALLOCATION_TAG);
+
+    if (Context == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto LoopbackInitializeEnd;
+    }
+
+    RtlZeroMemory(Context, sizeof(NET_LOOPBACK_CONTEXT));
+    KeInitializeSpinLock(&(Context->Lock));
+    NET_INITIALIZE_PACKET_LIST(&(Context->PacketList));
+    Context->WorkItem = KeCreateWorkItem(NULL,
+                                         WorkPriorityNormal,
+                                         NetpLoopbackReceiveWorker,
+                                         Context,
+                                         NET_CORE_ALLOCATION_TAG);
+
+    if (Context->WorkItem == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto LoopbackInitializeEnd;
+    }
+
+    //
+    // The loopback link looks like an ethernet link with an all zeros address
+    // and no device behind it. Claiming checksum offload means that neither
+    // side of a local connection spends any time on checksums.
+    //
+
+    RtlZeroMemory(&Properties, sizeof(NET_LINK_PROPERTIES));
+    Properties.Version = NET_LINK_PROPERTIES_VERSION;
+    Properties.TransmitAlignment = 1;
+    Properties.Device = NULL;
+    Properties.DeviceContext = Context;
+    Properties.PacketSizeInformation.MaxPacketSize =
+                          ETHERNET_HEADER_SIZE + ETHERNET_MAXIMUM_PAYLOAD_SIZE;
+
+    Properties.ChecksumFlags = NET_LINK_CHECKSUM_FLAG_TRANSMIT_MASK |
+                               NET_LINK_CHECKSUM_FLAG_RECEIVE_MASK;
+
+    Properties.DataLinkType = NetDomainEthernet;
+    Properties.MaxPhysicalAddress = MAX_ULONGLONG;
+    Properties.PhysicalAddress.Domain = NetDomainEthernet;
+    Properties.Interface.Send = NetpLoopbackSend;
+    Properties.Interface.GetSetInformation = NetpLoopbackGetSetInformation;
+    Properties.Interface.DestroyLink = NetpLoopbackDestroyLink;
+    Status = NetAddLink(&Properties, &Link);
+    if (!KSUCCESS(Status)) {
+        goto LoopbackInitializeEnd;
+    }
+
+    //
+    // Statically configure the address the IPv4 layer created for the link.
+    //
+
+    RtlZeroMemory(&LoopbackAddress, sizeof(IP4_ADDRESS));
+    LoopbackAddress.Domain = NetDomainIp4;
+    KeAcquireQueuedLock(Link->QueuedLock);
+
+    ASSERT(!LIST_EMPTY(&(Link->LinkAddressList)));
+
+    LinkAddress = LIST_VALUE(Link->LinkAddressList.Next,
+                             NET_LINK_ADDRESS_ENTRY,
+                             ListEntry);
+
+    LoopbackAddress.Address = CPU_TO_NETWORK32(NET_LOOPBACK_IP4_SUBNET);
+    RtlCopyMemory(&(LinkAddress->Subnet),
+                  &LoopbackAddress,
+                  sizeof(NETWORK_ADDRESS));
+
+    LoopbackAddress.Address = 0;
+    RtlCopyMemory(&(LinkAddress->DefaultGateway),
+                  &LoopbackAddress,
+                  sizeof(NETWORK_ADDRESS));
+
+    LoopbackAddress.Address = CPU_TO_NETWORK32(NET_LOOPBACK_IP4_ADDRESS);
+    RtlCopyMemory(&(LinkAddress->Address),
+                  &LoopbackAddress,
+                  sizeof(NETWORK_ADDRESS));
+
+    RtlCopyMemory(&(LinkAddress->PhysicalAddress),
+                  &(Link->Properties.PhysicalAddress),
+                  sizeof(NETWORK_ADDRESS));
+
+    LinkAddress->StaticAddress = TRUE;
+    LinkAddress->Configured = TRUE;
+    KeReleaseQueuedLock(Link->QueuedLock);
+
+    //
+    // Seed the translation for the loopback address so that sends never wait
+    // on ARP.
+    //
+
+    Status = NetAddNetworkAddressTranslation(
+                                       Link,
+                                       (PNETWORK_ADDRESS)&LoopbackAddress,
+                                       &(Link->Properties.PhysicalAddress));
+
+    if (!KSUCCESS(Status)) {
+        goto LoopbackInitializeEnd;
+    }
+
+    NetLoopbackLink = Link;
+    NetSetLinkState(Link, TRUE, NET_LOOPBACK_LINK_SPEED);
+    Status = STATUS_SUCCESS;
+
+LoopbackInitializeEnd:
+    if (!KSUCCESS(Status)) {
+        RtlDebugPrint("NET: Failed to create loopback link: %d\n", Status);
+        if (Link != NULL) {
+            NetRemoveLink(Link);
+
+        } else if (Context != NULL) {
+            NetpLoopbackDestroyLink(Context);
+        }
+    }
+
+    return;
+}
+
+BOOL
+NetpIsLoopbackAddress (
+    PNETWORK_ADDRESS Address
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the given address can only be reached
+    through the loopback link.
+
+Arguments:
+
+    Address - Supplies a pointer to the network address to check.
+
+Return Value:
+
+    TRUE if the address belongs to the loopback link.
+
+    FALSE otherwise.
+
+--*/
+
+{
+
+    PIP4_ADDRESS Ip4Address;
+    ULONG Subnet;
+
+    if (Address->Domain != NetDomainIp4) {
+        return FALSE;
+    }
+
+    Ip4Address = (PIP4_ADDRESS)Address;
+    Subnet = NETWORK_TO_CPU32(Ip4Address->Address) & NET_LOOPBACK_IP4_SUBNET;
+    if (Subnet != (NET_LOOPBACK_IP4_ADDRESS & NET_LOOPBACK_IP4_SUBNET)) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+NetpLoopbackSend (
+    PVOID DeviceContext,
+    PNET_PACKET_LIST PacketList
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends data through the loopback link. The packets are queued
+    and handed back up the stack by a worker, since the sender may be holding
+    locks that processing the receive on the other end would need.
+
+Arguments:
+
+    DeviceContext - Supplies a pointer to the loopback context.
+
+    PacketList - Supplies a pointer to a list of network packets to send.
+
+Return Value:
+
+    STATUS_SUCCESS if all packets were queued.
+
+    STATUS_RESOURCE_IN_USE if the packets were dropped because too many are
+    already waiting.
+
+--*/
+
+{
+
+    PNET_LOOPBACK_CONTEXT Context;
+    RUNLEVEL OldRunLevel;
+    KSTATUS Status;
+
+    Context = (PNET_LOOPBACK_CONTEXT)DeviceContext;
+    Status = STATUS_SUCCESS;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Context->Lock));
+    if (Context->PacketList.Count >= NET_LOOPBACK_MAX_QUEUED_PACKETS) {
+        Status = STATUS_RESOURCE_IN_USE;
+
+    } else {
+        NET_APPEND_PACKET_LIST(PacketList, &(Context->PacketList));
+    }
+
+    KeReleaseSpinLock(&(Context->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    if (KSUCCESS(Status)) {
+        KeQueueWorkItem(Context->WorkItem);
+    }
+
+    return Status;
+}
+
+KSTATUS
+NetpLoopbackGetSetInformation (
+    PVOID DeviceContext,
+    NET_LINK_INFORMATION_TYPE InformationType,
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets the loopback link information.
+
+Arguments:
+
+    DeviceContext - Supplies a pointer to the loopback context.
+
+    InformationType - Supplies the type of information being queried or set.
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the data
+        buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or a
+        set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PULONG Flags;
+    KSTATUS Status;
+
+    switch (InformationType) {
+    case NetLinkInformationChecksumOffload:
+        if (*DataSize != sizeof(ULONG)) {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        if (Set != FALSE) {
+            return STATUS_NOT_SUPPORTED;
+        }
+
+        Flags = (PULONG)Data;
+        *Flags = NET_LINK_CHECKSUM_FLAG_TRANSMIT_MASK |
+                 NET_LINK_CHECKSUM_FLAG_RECEIVE_MASK;
+
+        Status = STATUS_SUCCESS;
+        break;
+
+    default:
+        Status = STATUS_NOT_SUPPORTED;
+        break;
+    }
+
+    return Status;
+}
+
+VOID
+NetpLoopbackDestroyLink (
+    PVOID DeviceContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tears down the loopback context once the link is gone.
+
+Arguments:
+
+    DeviceContext - Supplies a pointer to the loopback context.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNET_LOOPBACK_CONTEXT Context;
+
+    Context = (PNET_LOOPBACK_CONTEXT)DeviceContext;
+    if (Context->WorkItem != NULL) {
+        KeCancelWorkItem(Context->WorkItem);
+        KeFlushWorkItem(Context->WorkItem);
+        KeDestroyWorkItem(Context->WorkItem);
+    }
+
+    NetDestroyBufferList(&(Context->PacketList));
+    MmFreeNonPagedPool(Context);
+    return;
+}
+
+VOID
+NetpLoopbackReceiveWorker (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands packets sent on the loopback link back up the stack as
+    received packets. The same buffers are used on both sides, so nothing is
+    copied or reallocated, and everything queued is delivered as one batch.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the loopback context.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNET_LOOPBACK_CONTEXT Context;
+    RUNLEVEL OldRunLevel;
+    NET_PACKET_LIST PacketList;
+
+    Context = (PNET_LOOPBACK_CONTEXT)Parameter;
+    NET_INITIALIZE_PACKET_LIST(&PacketList);
+    while (TRUE) {
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(Context->Lock));
+        NET_APPEND_PACKET_LIST(&(Context->PacketList), &PacketList);
+        KeReleaseSpinLock(&(Context->Lock));
+        KeLowerRunLevel(OldRunLevel);
+        if (NET_PACKET_LIST_EMPTY(&PacketList)) {
+            break;
+        }
+
+        NetProcessReceivedPacketList(NetLoopbackLink, &PacketList);
+        NetDestroyBufferList(&PacketList);
+    }
+
+    return;
+}
+
@@ -374,6 +374,12 @@ Return Value:
     NetInitialized = TRUE;
     Status = STATUS_SUCCESS;
 
+    //
+    // Bring up the loopback link now that links can be added.
+    //
+
+    NetpLoopbackInitialize();
+
     //
     // Handle any post-registration work for the built in protocols, networks,
     // data links and miscellaneous components.
@@ -1206,6 +1212,135 @@ Return Value:
     return;
 }
 
+NET_API
+VOID
+NetProcessReceivedPacketList (
+    PNET_LINK Link,
+    PNET_PACKET_LIST PacketList
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called by the low level NIC driver to pass a batch of
+    received packets onto the core networking library for dispatching. Socket
+    lookups are cached across the batch, so consecutive packets for the same
+    connection do not each search the socket trees.
+
+Arguments:
+
+    Link - Supplies a pointer to the link that received the packets.
+
+    PacketList - Supplies a pointer to the list of received packets. The
+        packets may be used as scratch space while this routine executes, but
+        will not be accessed after it returns. The list itself is left intact
+        and remains owned by the caller.
+
+Return Value:
+
+    None. When the function returns, the memory associated with the packets
+    may be reclaimed and reused.
+
+--*/
+
+{
+
+    NET_RECEIVE_BATCH Batch;
+    PLIST_ENTRY CurrentEntry;
+    PKTHREAD OldThread;
+    PNET_PACKET_BUFFER Packet;
+    PKTHREAD Thread;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    //
+    // Claim the link's batch for this thread, then install the batch so that
+    // the transport layers can find it. Other threads check the owner before
+    // touching the batch, since it lives on this thread's stack. If some other
+    // thread is already processing a batch on this link, just run without
+    // one; the lookups will simply not be cached.
+    //
+
+    Batch.Socket = NULL;
+    Thread = KeGetCurrentThread();
+    OldThread = (PKTHREAD)RtlAtomicCompareExchange(
+                                          (PUINTN)&(Link->ReceiveBatchThread),
+                                          (UINTN)Thread,
+                                          (UINTN)NULL);
+
+    if (OldThread == NULL) {
+        Link->ReceiveBatch = &Batch;
+    }
+
+    CurrentEntry = PacketList->Head.Next;
+    while (CurrentEntry != &(PacketList->Head)) {
+        Packet = LIST_VALUE(CurrentEntry, NET_PACKET_BUFFER, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        Link->DataLinkEntry->Interface.ProcessReceivedPacket(
+                                                        Link->DataLinkContext,
+                                                        Packet);
+    }
+
+    if (OldThread == NULL) {
+        Link->ReceiveBatch = NULL;
+        RtlMemoryBarrier();
+        Link->ReceiveBatchThread = NULL;
+        if (Batch.Socket != NULL) {
+            IoSocketReleaseReference(&(Batch.Socket->KernelSocket));
+        }
+    }
+
+    return;
+}
+
+NET_API
+KSTATUS
+NetSchedulePoll (
+    PNET_LINK Link
+    )
+
+/*++
+
+Routine Description:
+
+    This routine requests that the networking core poll the given link for
+    received frames. It is typically called from the device's interrupt path
+    after masking receive interrupts. This routine can be called at or below
+    dispatch level.
+
+Arguments:
+
+    Link - Supplies a pointer to the link to poll.
+
+Return Value:
+
+    STATUS_SUCCESS if the poll was scheduled or is already pending.
+
+    STATUS_NOT_SUPPORTED if the link's device did not supply a poll routine.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    if (Link->PollWorkItem == NULL) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    //
+    // A poll that is already queued will pick up the new frames.
+    //
+
+    Status = KeQueueWorkItem(Link->PollWorkItem);
+    if (Status == STATUS_RESOURCE_IN_USE) {
+        Status = STATUS_SUCCESS;
+    }
+
+    return Status;
+}
+
 NET_API
 BOOL
 NetGetGlobalDebugFlag (
@@ -2426,6 +2561,56 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+VOID
+NetpLinkPollWorker (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine polls a link's device for received frames until the device
+    runs out of work. The device keeps its receive interrupts masked for as
+    long as it keeps filling the budget, so a link under heavy load is served
+    entirely from here rather than taking an interrupt per frame.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the link to poll.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNET_LINK Link;
+    ULONG Processed;
+
+    Link = (PNET_LINK)Parameter;
+    while (TRUE) {
+        Processed = Link->Properties.Interface.Poll(
+                                                Link->Properties.DeviceContext,
+                                                Link->PollBudget);
+
+        if (Processed < Link->PollBudget) {
+            break;
+        }
+
+        //
+        // The budget was exhausted, so more frames are likely waiting. Let
+        // other threads at this priority run before going around again.
+        //
+
+        KeYield();
+    }
+
+    return;
+}
+
 VOID
 NetpDestroyProtocol (
     PNET_PROTOCOL_ENTRY Protocol
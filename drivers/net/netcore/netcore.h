@@ -56,6 +56,24 @@ Module Name:
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure defines the state kept while a batch of received packets is
+    processed on a link.
+
+Members:
+
+    Socket - Stores a pointer to the fully bound socket that received the
+        previous packet in the batch, holding a reference.
+
+--*/
+
+typedef struct _NET_RECEIVE_BATCH {
+    PNET_SOCKET Socket;
+} NET_RECEIVE_BATCH, *PNET_RECEIVE_BATCH;
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -83,6 +101,12 @@ extern PSHARED_EXCLUSIVE_LOCK NetPluginListLock;
 extern LIST_ENTRY NetRawSocketsList;
 extern PSHARED_EXCLUSIVE_LOCK NetRawSocketsLock;
 
+//
+// Store a pointer to the software loopback link.
+//
+
+extern PNET_LINK NetLoopbackLink;
+
 //
 // -------------------------------------------------------- Function Prototypes
 //
@@ -433,6 +457,28 @@ Return Value:
 
 --*/
 
+VOID
+NetpLinkPollWorker (
+    PVOID Parameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine polls a link's device for received frames until the device
+    runs out of work.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the link to poll.
+
+Return Value:
+
+    None.
+
+--*/
+
 //
 // Prototypes to entry points for built in data link layers.
 //
@@ -458,6 +504,55 @@ Return Value:
 
 --*/
 
+//
+// Prototypes to entry points for built in links.
+//
+
+VOID
+NetpLoopbackInitialize (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates the loopback link and assigns it its address.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+BOOL
+NetpIsLoopbackAddress (
+    PNETWORK_ADDRESS Address
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the given address can only be reached
+    through the loopback link.
+
+Arguments:
+
+    Address - Supplies a pointer to the network address to check.
+
+Return Value:
+
+    TRUE if the address belongs to the loopback link.
+
+    FALSE otherwise.
+
+--*/
+
 //
 // Prototypes to entry points for built in components.
 //
@@ -49,6 +49,20 @@ Module Name:
 
 #define TCP_TIMER_MAX_REFERENCE 0x10000000
 
+//
+// Define the geometry of the TCP timer wheel. Each level has the same number
+// of slots, and each slot in a level spans all the slots of the level below
+// it. With a 250ms tick, three levels of 64 slots cover about 18 hours, which
+// is beyond the default keep alive timeout.
+//
+
+#define TCP_TIMER_WHEEL_LEVELS 3
+#define TCP_TIMER_WHEEL_SLOT_SHIFT 6
+#define TCP_TIMER_WHEEL_SLOTS (1 << TCP_TIMER_WHEEL_SLOT_SHIFT)
+#define TCP_TIMER_WHEEL_SLOT_MASK (TCP_TIMER_WHEEL_SLOTS - 1)
+#define TCP_TIMER_WHEEL_SPAN \
+    (1ULL << (TCP_TIMER_WHEEL_SLOT_SHIFT * TCP_TIMER_WHEEL_LEVELS))
+
 #define TCP_POLL_EVENT_IO               \
     (POLL_EVENT_IN | POLL_EVENT_OUT |   \
      POLL_EVENT_IN_HIGH_PRIORITY | POLL_EVENT_OUT_HIGH_PRIORITY)
@@ -83,6 +97,41 @@ typedef struct _TCP_SOCKET_OPTION {
     BOOL SetAllowed;
 } TCP_SOCKET_OPTION, *PTCP_SOCKET_OPTION;
 
+/*++
+
+Structure Description:
+
+    This structure defines the hierarchical timer wheel that tracks when each
+    TCP socket next needs attention from the worker thread. Only sockets with
+    a pending deadline are on the wheel, so idle connections cost nothing per
+    tick.
+
+Members:
+
+    Slots - Stores the list heads for each slot of each level of the wheel.
+        Slots in level zero hold sockets due on a single tick. Slots in higher
+        levels hold sockets that get cascaded down a level when the wheel
+        reaches the start of that slot's span.
+
+    BaseTime - Stores the time counter value corresponding to tick zero.
+
+    CurrentTick - Stores the last tick the wheel has processed.
+
+    DueTick - Stores the tick the global TCP timer is queued for, or zero if
+        it is not queued.
+
+    SocketCount - Stores the number of sockets on the wheel.
+
+--*/
+
+typedef struct _TCP_TIMER_WHEEL {
+    LIST_ENTRY Slots[TCP_TIMER_WHEEL_LEVELS][TCP_TIMER_WHEEL_SLOTS];
+    ULONGLONG BaseTime;
+    ULONGLONG CurrentTick;
+    ULONGLONG DueTick;
+    ULONG SocketCount;
+} TCP_TIMER_WHEEL, *PTCP_TIMER_WHEEL;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -194,6 +243,11 @@ NetpTcpWorkerThread (
     PVOID Parameter
     );
 
+VOID
+NetpTcpProcessSocketTimer (
+    PTCP_SOCKET Socket
+    );
+
 VOID
 NetpTcpProcessPacket (
     PTCP_SOCKET Socket,
@@ -361,21 +415,44 @@ NetpTcpTimerAddReference (
     PTCP_SOCKET Socket
     );
 
-ULONG
+VOID
 NetpTcpTimerReleaseReference (
     PTCP_SOCKET Socket
     );
 
-VOID
-NetpTcpQueueTcpTimer (
-    VOID
+ULONGLONG
+NetpTcpGetTimerDeadline (
+    PTCP_SOCKET Socket
     );
 
 VOID
-NetpTcpArmKeepAliveTimer (
+NetpTcpScheduleTimer (
+    PTCP_SOCKET Socket,
     ULONGLONG DueTime
     );
 
+VOID
+NetpTcpCancelTimer (
+    PTCP_SOCKET Socket
+    );
+
+VOID
+NetpTcpTimerWheelInsert (
+    PTCP_SOCKET Socket,
+    ULONGLONG Tick
+    );
+
+VOID
+NetpTcpTimerWheelAdvance (
+    ULONGLONG Tick,
+    PLIST_ENTRY ExpiredList
+    );
+
+VOID
+NetpTcpTimerWheelArm (
+    VOID
+    );
+
 KSTATUS
 NetpTcpReceiveOutOfBandData (
     BOOL FromKernelMode,
@@ -396,24 +473,31 @@ NetpTcpFreeSegment (
     PTCP_SEGMENT_HEADER Segment
     );
 
+VOID
+NetpTcpFreeSendSegment (
+    PTCP_SOCKET Socket,
+    PTCP_SEND_SEGMENT Segment
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
 //
-// Store a pointer to the global TCP timer.
+// Store a pointer to the global TCP timer, which wakes the worker thread when
+// the next socket on the timer wheel is due.
 //
 
 PKTIMER NetTcpTimer;
 ULONGLONG NetTcpTimerPeriod;
-volatile ULONG NetTcpTimerReferenceCount;
 
 //
-// Store a pointer to the global TCP keep alive timer.
+// Store the timer wheel of sockets waiting on a deadline, and the lock that
+// protects it.
 //
 
-PQUEUED_LOCK NetTcpKeepAliveTimerLock;
-PKTIMER NetTcpKeepAliveTimer;
+TCP_TIMER_WHEEL NetTcpTimerWheel;
+PQUEUED_LOCK NetTcpTimerWheelLock;
 
 //
 // Store the global list of sockets.
@@ -589,6 +673,8 @@ Return Value:
 
 {
 
+    ULONG Level;
+    ULONG Slot;
     KSTATUS Status;
 
     //
@@ -626,24 +712,23 @@ Return Value:
         goto TcpInitializeEnd;
     }
 
-    ASSERT(NetTcpKeepAliveTimerLock == NULL);
+    ASSERT(NetTcpTimerWheelLock == NULL);
 
-    NetTcpKeepAliveTimerLock = KeCreateQueuedLock();
-    if (NetTcpKeepAliveTimerLock == NULL) {
+    NetTcpTimerWheelLock = KeCreateQueuedLock();
+    if (NetTcpTimerWheelLock == NULL) {
         Status = STATUS_INSUFFICIENT_RESOURCES;
         goto TcpInitializeEnd;
     }
 
     NetTcpTimerPeriod = KeConvertMicrosecondsToTimeTicks(TCP_TIMER_PERIOD);
-
-    ASSERT(NetTcpKeepAliveTimer == NULL);
-
-    NetTcpKeepAliveTimer = KeCreateTimer(TCP_ALLOCATION_TAG);
-    if (NetTcpKeepAliveTimer == NULL) {
-        Status = STATUS_INSUFFICIENT_RESOURCES;
-        goto TcpInitializeEnd;
+    for (Level = 0; Level < TCP_TIMER_WHEEL_LEVELS; Level += 1) {
+        for (Slot = 0; Slot < TCP_TIMER_WHEEL_SLOTS; Slot += 1) {
+            INITIALIZE_LIST_HEAD(&(NetTcpTimerWheel.Slots[Level][Slot]));
+        }
     }
 
+    NetTcpTimerWheel.BaseTime = KeGetRecentTimeCounter();
+
     //
     // Create the worker thread.
     //
@@ -677,14 +762,9 @@ Return Value:
             NetTcpTimer = NULL;
         }
 
-        if (NetTcpKeepAliveTimerLock != NULL) {
-            KeDestroyQueuedLock(NetTcpKeepAliveTimerLock);
-            NetTcpKeepAliveTimerLock = NULL;
-        }
-
-        if (NetTcpKeepAliveTimer != NULL) {
-            KeDestroyTimer(NetTcpKeepAliveTimer);
-            NetTcpKeepAliveTimer = NULL;
+        if (NetTcpTimerWheelLock != NULL) {
+            KeDestroyQueuedLock(NetTcpTimerWheelLock);
+            NetTcpTimerWheelLock = NULL;
         }
     }
 
@@ -895,6 +975,7 @@ Return Value:
 
     ASSERT(TcpSocket->State == TcpStateClosed);
     ASSERT(TcpSocket->ListEntry.Next == NULL);
+    ASSERT(TcpSocket->TimerWheelEntry.Next == NULL);
     ASSERT(LIST_EMPTY(&(TcpSocket->ReceivedSegmentList)) != FALSE);
     ASSERT(LIST_EMPTY(&(TcpSocket->OutgoingSegmentList)) != FALSE);
 
@@ -1647,6 +1728,7 @@ Return Value:
     PTCP_SEND_SEGMENT NewSegment;
     BOOL OutgoingSegmentListWasEmpty;
     BOOL PushNeeded;
+    BOOL ReferenceBuffer;
     ULONG RequiredOpening;
     ULONG ReturnedEvents;
     ULONG SegmentSize;
@@ -1665,6 +1747,11 @@ Return Value:
     NewSegment = NULL;
     OutgoingSegmentListWasEmpty = FALSE;
     PushNeeded = TRUE;
+    ReferenceBuffer = FALSE;
+    if ((Flags & SOCKET_IO_REFERENCE_BUFFER) != 0) {
+        ReferenceBuffer = TRUE;
+    }
+
     TcpSocket = (PTCP_SOCKET)Socket;
     TimeCounterFrequency = 0;
     IoState = TcpSocket->NetSocket.KernelSocket.IoState;
@@ -1812,7 +1899,8 @@ Return Value:
 
         //
         // If the last packet has already been sent off or is jam packed, then
-        // forget it, make a new packet.
+        // forget it, make a new packet. Segments referencing page cache data
+        // are never merged, as that would mean copying the data.
         //
 
         LastSegment = LIST_VALUE(TcpSocket->OutgoingSegmentList.Previous,
@@ -1821,7 +1909,9 @@ Return Value:
 
         LastSegmentLength = LastSegment->Length - LastSegment->Offset;
         if ((LastSegment->SendAttemptCount != 0) ||
-            (LastSegmentLength == TcpSocket->SendMaxSegmentSize)) {
+            (LastSegmentLength == TcpSocket->SendMaxSegmentSize) ||
+            (LastSegment->IoBuffer != NULL) ||
+            (ReferenceBuffer != FALSE)) {
 
             break;
         }
@@ -1874,6 +1964,7 @@ Return Value:
         NewSegment->SequenceNumber = LastSegment->SequenceNumber +
                                      LastSegment->Offset;
 
+        NewSegment->IoBuffer = NULL;
         NewSegment->LastSendTime = 0;
         NewSegment->Length = SegmentSize;
         NewSegment->Offset = 0;
@@ -2027,19 +2118,36 @@ Return Value:
             goto TcpSendEnd;
         }
 
+        //
+        // If the caller allows it, hold references on the page cache pages
+        // backing this range rather than copying the data. Fall back to a
+        // copy if the range is not entirely backed by the page cache.
+        //
+
+        NewSegment->IoBuffer = NULL;
+        if (ReferenceBuffer != FALSE) {
+            NewSegment->IoBuffer = MmReferenceIoBufferRange(IoBuffer,
+                                                            BytesComplete,
+                                                            SegmentSize);
+        }
+
         //
         // Copy the new data in.
         //
 
-        Status = MmCopyIoBufferData(IoBuffer,
-                                    NewSegment + 1,
-                                    BytesComplete,
-                                    SegmentSize,
-                                    FALSE);
+        if (NewSegment->IoBuffer == NULL) {
+            Status = MmCopyIoBufferData(IoBuffer,
+                                        NewSegment + 1,
+                                        BytesComplete,
+                                        SegmentSize,
+                                        FALSE);
 
-        if (!KSUCCESS(Status)) {
-            NetpTcpFreeSegment(TcpSocket, (PTCP_SEGMENT_HEADER)NewSegment);
-            goto TcpSendEnd;
+            if (!KSUCCESS(Status)) {
+                NetpTcpFreeSegment(TcpSocket,
+                                   (PTCP_SEGMENT_HEADER)NewSegment);
+
+                goto TcpSendEnd;
+            }
         }
 
         NewSegment->SequenceNumber = TcpSocket->SendNextBufferSequence;
@@ -2224,7 +2332,11 @@ Return Value:
 
     SourceAddress->Port = NETWORK_TO_CPU16(Header->SourcePort);
     DestinationAddress->Port = NETWORK_TO_CPU16(Header->DestinationPort);
-    Socket = NetFindSocket(ProtocolEntry, DestinationAddress, SourceAddress);
+    Socket = NetFindReceiveSocket(Link,
+                                  ProtocolEntry,
+                                  DestinationAddress,
+                                  SourceAddress);
+
     if (Socket == NULL) {
         NetpTcpHandleUnconnectedPacket(Link,
                                        Header,
@@ -3300,7 +3412,7 @@ Return Value:
 
                             TcpSocket->KeepAliveTime = DueTime;
                             TcpSocket->KeepAliveProbeCount = 0;
-                            NetpTcpArmKeepAliveTimer(DueTime);
+                            NetpTcpScheduleTimer(TcpSocket, DueTime);
                         }
 
                         TcpSocket->Flags |= TCP_SOCKET_FLAG_KEEP_ALIVE;
@@ -3679,7 +3791,9 @@ NetpTcpWorkerThread (
 
 Routine Description:
 
-    This routine implements periodic maintenance work required by TCP.
+    This routine implements periodic maintenance work required by TCP. It
+    advances the timer wheel and services only the sockets whose deadlines
+    have come due.
 
 Arguments:
 
@@ -3693,293 +3807,275 @@ Return Value:
 
 {
 
-    PLIST_ENTRY CurrentEntry;
-    PTCP_SOCKET CurrentSocket;
-    ULONGLONG CurrentTime;
-    PULONG Flags;
-    PIO_OBJECT_STATE IoState;
-    ULONGLONG KeepAliveTime;
-    BOOL KeepAliveTimeout;
-    PSOCKET KernelSocket;
-    BOOL LinkUp;
-    ULONG OldReferenceCount;
-    ULONGLONG RecentTime;
-    PVOID SignalingObject;
-    PVOID WaitObjectArray[2];
-    BOOL WithAcknowledge;
-
-    ASSERT(2 < BUILTIN_WAIT_BLOCK_ENTRY_COUNT);
+    ULONGLONG CurrentTick;
+    LIST_ENTRY ExpiredList;
+    PTCP_SOCKET Socket;
 
-    KeepAliveTime = MAX_ULONGLONG;
-    WaitObjectArray[0] = NetTcpTimer;
-    WaitObjectArray[1] = NetTcpKeepAliveTimer;
-    while ((NetTcpTimer != NULL) && (NetTcpKeepAliveTimer != NULL)) {
+    while (NetTcpTimer != NULL) {
 
         //
-        // Sleep until the periodic or keep alive timer fires again.
+        // Sleep until the next socket on the timer wheel is due.
         //
 
-        ObWaitOnObjects(WaitObjectArray,
-                        2,
-                        0,
-                        WAIT_TIME_INDEFINITE,
-                        NULL,
-                        &SignalingObject);
+        ObWaitOnObject(NetTcpTimer, 0, WAIT_TIME_INDEFINITE);
+        KeSignalTimer(NetTcpTimer, SignalOptionUnsignal);
 
         //
-        // If the keep alive timer signaled, then check the keep alive states.
+        // Move the wheel up to the current time, collecting every socket
+        // whose tick has passed. Each expired socket comes back with a
+        // reference. Then queue the timer for whatever is due next.
         //
 
-        KeepAliveTimeout = FALSE;
-        if (SignalingObject == NetTcpKeepAliveTimer) {
-            KeepAliveTimeout = TRUE;
-            KeepAliveTime = MAX_ULONGLONG;
-            KeSignalTimer(NetTcpKeepAliveTimer, SignalOptionUnsignal);
+        INITIALIZE_LIST_HEAD(&ExpiredList);
+        CurrentTick = HlQueryTimeCounter() - NetTcpTimerWheel.BaseTime;
+        CurrentTick /= NetTcpTimerPeriod;
+        KeAcquireQueuedLock(NetTcpTimerWheelLock);
+        NetTcpTimerWheel.DueTick = 0;
+        NetpTcpTimerWheelAdvance(CurrentTick, &ExpiredList);
+        NetpTcpTimerWheelArm();
+        KeReleaseQueuedLock(NetTcpTimerWheelLock);
 
         //
-        // If the TCP time signaled, determine whether or not work needs to be
-        // done. Start by decrementing a reference for the now expired timer.
-        // If the old reference count is 1 then none of the sockets need
-        // processing. If there is still more than 1 reference, however, at
-        // least one socket is hanging around. Queue the timer and process the
-        // sockets.
+        // Service each expired socket. The list is manipulated under the
+        // wheel lock, since a closing socket looks at its wheel entry to
+        // decide whether or not it is still on the wheel.
         //
 
-        } else {
-
-            ASSERT(SignalingObject == NetTcpTimer);
-
-            KeSignalTimer(NetTcpTimer, SignalOptionUnsignal);
-            OldReferenceCount = NetpTcpTimerReleaseReference(NULL);
-            if (OldReferenceCount == 1) {
-                continue;
+        while (TRUE) {
+            KeAcquireQueuedLock(NetTcpTimerWheelLock);
+            if (LIST_EMPTY(&ExpiredList) != FALSE) {
+                KeReleaseQueuedLock(NetTcpTimerWheelLock);
+                break;
             }
 
-            NetpTcpQueueTcpTimer();
+            Socket = LIST_VALUE(ExpiredList.Next, TCP_SOCKET, TimerWheelEntry);
+            LIST_REMOVE(&(Socket->TimerWheelEntry));
+            Socket->TimerWheelEntry.Next = NULL;
+            KeReleaseQueuedLock(NetTcpTimerWheelLock);
+            NetpTcpProcessSocketTimer(Socket);
+            IoSocketReleaseReference(&(Socket->NetSocket.KernelSocket));
         }
+    }
 
-        //
-        // Loop through every socket.
-        //
+    return;
+}
 
-        CurrentTime = 0;
-        KeAcquireQueuedLock(NetTcpSocketListLock);
-        CurrentEntry = NetTcpSocketList.Next;
-        while (CurrentEntry != &NetTcpSocketList) {
-            CurrentSocket = LIST_VALUE(CurrentEntry, TCP_SOCKET, ListEntry);
-            CurrentEntry = CurrentEntry->Next;
-            KernelSocket = &(CurrentSocket->NetSocket.KernelSocket);
+VOID
+NetpTcpProcessSocketTimer (
+    PTCP_SOCKET Socket
+    )
 
-            ASSERT(KernelSocket->ReferenceCount >= 1);
+/*++
 
-            //
-            // Check the link state for all bound sockets. If the link is down,
-            // then close the socket.
-            //
+Routine Description:
 
-            if (CurrentSocket->NetSocket.Link != NULL) {
-                NetGetLinkState(CurrentSocket->NetSocket.Link, &LinkUp, NULL);
-                if (LinkUp == FALSE) {
-                    IoSocketAddReference(KernelSocket);
-                    KeAcquireQueuedLock(CurrentSocket->Lock);
-                    NetpTcpCloseOutSocket(CurrentSocket, TRUE);
-                    KeReleaseQueuedLock(CurrentSocket->Lock);
-                    IoSocketReleaseReference(KernelSocket);
-                    continue;
-                }
-            }
+    This routine handles a socket whose deadline on the timer wheel has
+    expired. It retransmits, sends delayed acknowledgements, handles SYN and
+    FIN retries and timeouts, expires the time-wait state, and sends keep
+    alive probes as needed. It then puts the socket back on the wheel if it
+    still has a deadline pending.
 
-            //
-            // If the socket is not waiting on anything, move on. Manipulation
-            // of any of these criteria require manipulating the TCP timer
-            // reference count.
-            //
+Arguments:
 
-            Flags = &(CurrentSocket->Flags);
-            if ((LIST_EMPTY(&(CurrentSocket->OutgoingSegmentList))) &&
-                ((*Flags & TCP_SOCKET_FLAG_SEND_ACKNOWLEDGE) == 0) &&
-                (((*Flags & TCP_SOCKET_FLAG_SEND_FINAL_SEQUENCE_VALID) == 0) ||
-                 ((*Flags & TCP_SOCKET_FLAG_SEND_FIN_WITH_DATA) != 0)) &&
-                (CurrentSocket->State != TcpStateTimeWait) &&
-                (TCP_IS_SYN_RETRY_STATE(CurrentSocket->State) == FALSE) &&
-                (((*Flags & TCP_SOCKET_FLAG_SEND_FIN_WITH_DATA) != 0) ||
-                 (TCP_IS_FIN_RETRY_STATE(CurrentSocket->State) == FALSE)) &&
-                ((KeepAliveTimeout == FALSE) ||
-                 ((*Flags & TCP_SOCKET_FLAG_KEEP_ALIVE) == 0) ||
-                 (TCP_IS_KEEP_ALIVE_STATE(CurrentSocket->State) == FALSE))) {
-
-                continue;
-            }
+    Socket - Supplies a pointer to the expired socket. The caller must hold a
+        reference on the socket.
 
-            IoSocketAddReference(KernelSocket);
-            KeAcquireQueuedLock(CurrentSocket->Lock);
-            NetpTcpSendPendingSegments(CurrentSocket, &CurrentTime);
+Return Value:
 
-            //
-            // If the media was disconnected, close out the socket and move on.
-            //
+    None.
 
-            IoState = CurrentSocket->NetSocket.KernelSocket.IoState;
-            if ((IoState->Events & POLL_EVENT_DISCONNECTED) != 0) {
-                NetpTcpCloseOutSocket(CurrentSocket, TRUE);
-                KeReleaseQueuedLock(CurrentSocket->Lock);
-                IoSocketReleaseReference(KernelSocket);
-                continue;
-            }
+--*/
 
-            //
-            // If the socket is in the time wait state and the timer has
-            // expired then close out the socket.
-            //
+{
 
-            if (CurrentSocket->State == TcpStateTimeWait) {
-                if (KeGetRecentTimeCounter() > CurrentSocket->TimeoutEnd) {
+    ULONGLONG CurrentTime;
+    ULONGLONG Deadline;
+    PULONG Flags;
+    PIO_OBJECT_STATE IoState;
+    BOOL KeepAliveTimeout;
+    BOOL LinkUp;
+    ULONGLONG RecentTime;
+    BOOL WithAcknowledge;
 
-                    ASSERT(CurrentSocket->TimeoutEnd != 0);
+    KeAcquireQueuedLock(Socket->Lock);
+    if (Socket->State == TcpStateClosed) {
+        goto ProcessSocketTimerEnd;
+    }
 
-                    if (NetTcpDebugPrintSequenceNumbers != FALSE) {
-                        RtlDebugPrint("TCP: Time-wait finished.\n");
-                    }
+    //
+    // Check the link state for bound sockets. If the link is down, then close
+    // the socket.
+    //
 
-                    NetpTcpCloseOutSocket(CurrentSocket, TRUE);
-                }
+    if (Socket->NetSocket.Link != NULL) {
+        NetGetLinkState(Socket->NetSocket.Link, &LinkUp, NULL);
+        if (LinkUp == FALSE) {
+            NetpTcpCloseOutSocket(Socket, FALSE);
+            goto ProcessSocketTimerEnd;
+        }
+    }
 
-            //
-            // If the socket is waiting for a SYN to be ACK'd, then resend the
-            // SYN if the retry has been reached. If the timeout has been
-            // reached then send a reset and signal the error event to wake up
-            // connect or accept.
-            //
+    RecentTime = KeGetRecentTimeCounter();
+    Flags = &(Socket->Flags);
+    KeepAliveTimeout = FALSE;
+    if (((*Flags & TCP_SOCKET_FLAG_KEEP_ALIVE) != 0) &&
+        (TCP_IS_KEEP_ALIVE_STATE(Socket->State) != FALSE) &&
+        (RecentTime >= Socket->KeepAliveTime)) {
 
-            } else if (TCP_IS_SYN_RETRY_STATE(CurrentSocket->State)) {
-                RecentTime = KeGetRecentTimeCounter();
-                if (RecentTime > CurrentSocket->TimeoutEnd) {
-                    NetpTcpSendControlPacket(CurrentSocket,
-                                             TCP_HEADER_FLAG_RESET);
+        KeepAliveTimeout = TRUE;
+    }
 
-                    NET_SOCKET_SET_LAST_ERROR(&(CurrentSocket->NetSocket),
-                                              STATUS_TIMEOUT);
+    //
+    // Sockets may come off the wheel early if their deadline moved out after
+    // they were scheduled. If the socket is not waiting on anything, just put
+    // it back on the wheel.
+    //
 
-                    IoSetIoObjectState(IoState, POLL_EVENT_ERROR, TRUE);
-                    NetpTcpSetState(CurrentSocket, TcpStateInitialized);
+    if ((LIST_EMPTY(&(Socket->OutgoingSegmentList))) &&
+        ((*Flags & TCP_SOCKET_FLAG_SEND_ACKNOWLEDGE) == 0) &&
+        (((*Flags & TCP_SOCKET_FLAG_SEND_FINAL_SEQUENCE_VALID) == 0) ||
+         ((*Flags & TCP_SOCKET_FLAG_SEND_FIN_WITH_DATA) != 0)) &&
+        (Socket->State != TcpStateTimeWait) &&
+        (TCP_IS_SYN_RETRY_STATE(Socket->State) == FALSE) &&
+        (((*Flags & TCP_SOCKET_FLAG_SEND_FIN_WITH_DATA) != 0) ||
+         (TCP_IS_FIN_RETRY_STATE(Socket->State) == FALSE)) &&
+        (KeepAliveTimeout == FALSE)) {
 
-                } else if (RecentTime >= CurrentSocket->RetryTime) {
-                    WithAcknowledge = FALSE;
-                    if (CurrentSocket->State == TcpStateSynReceived) {
-                        WithAcknowledge = TRUE;
-                    }
+        goto ProcessSocketTimerReschedule;
+    }
 
-                    NetpTcpSendSyn(CurrentSocket, WithAcknowledge);
-                    TCP_UPDATE_RETRY_TIME(CurrentSocket);
-                }
+    CurrentTime = 0;
+    NetpTcpSendPendingSegments(Socket, &CurrentTime);
 
-            //
-            // If the socket is waiting for a FIN to be ACK'd, then resend the
-            // FIN if the retry time has been reached. If the timeout has
-            // expired, send a reset and close the socket.
-            //
+    //
+    // If the media was disconnected, close out the socket and move on.
+    //
 
-            } else if (((*Flags & TCP_SOCKET_FLAG_SEND_FIN_WITH_DATA) == 0) &&
-                       TCP_IS_FIN_RETRY_STATE(CurrentSocket->State)) {
+    IoState = Socket->NetSocket.KernelSocket.IoState;
+    if ((IoState->Events & POLL_EVENT_DISCONNECTED) != 0) {
+        NetpTcpCloseOutSocket(Socket, FALSE);
+        goto ProcessSocketTimerEnd;
+    }
 
-                RecentTime = KeGetRecentTimeCounter();
-                if (RecentTime > CurrentSocket->TimeoutEnd) {
-                    NetpTcpSendControlPacket(CurrentSocket,
-                                             TCP_HEADER_FLAG_RESET);
+    //
+    // If the socket is in the time wait state and the timer has expired then
+    // close out the socket.
+    //
 
-                    *Flags |= TCP_SOCKET_FLAG_CONNECTION_RESET;
-                    NET_SOCKET_SET_LAST_ERROR(&(CurrentSocket->NetSocket),
-                                              STATUS_DESTINATION_UNREACHABLE);
+    if (Socket->State == TcpStateTimeWait) {
+        if (KeGetRecentTimeCounter() > Socket->TimeoutEnd) {
 
-                    IoSetIoObjectState(IoState, POLL_EVENT_ERROR, TRUE);
-                    NetpTcpCloseOutSocket(CurrentSocket, TRUE);
+            ASSERT(Socket->TimeoutEnd != 0);
 
-                } else if (RecentTime >= CurrentSocket->RetryTime) {
-                    NetpTcpSendControlPacket(CurrentSocket,
-                                             TCP_HEADER_FLAG_FIN);
+            if (NetTcpDebugPrintSequenceNumbers != FALSE) {
+                RtlDebugPrint("TCP: Time-wait finished.\n");
+            }
 
-                    TCP_UPDATE_RETRY_TIME(CurrentSocket);
-                }
+            NetpTcpCloseOutSocket(Socket, FALSE);
+        }
 
-            //
-            // If the socket is in the keep alive state and the keep alive
-            // timer woke up the thread, then check on that timeout.
-            //
+    //
+    // If the socket is waiting for a SYN to be ACK'd, then resend the SYN if
+    // the retry has been reached. If the timeout has been reached then send a
+    // reset and signal the error event to wake up connect or accept.
+    //
 
-            } else if ((KeepAliveTimeout != FALSE) &&
-                       ((*Flags & TCP_SOCKET_FLAG_KEEP_ALIVE) != 0) &&
-                       TCP_IS_KEEP_ALIVE_STATE(CurrentSocket->State)) {
+    } else if (TCP_IS_SYN_RETRY_STATE(Socket->State)) {
+        RecentTime = KeGetRecentTimeCounter();
+        if (RecentTime > Socket->TimeoutEnd) {
+            NetpTcpSendControlPacket(Socket, TCP_HEADER_FLAG_RESET);
+            NET_SOCKET_SET_LAST_ERROR(&(Socket->NetSocket), STATUS_TIMEOUT);
+            IoSetIoObjectState(IoState, POLL_EVENT_ERROR, TRUE);
+            NetpTcpSetState(Socket, TcpStateInitialized);
 
-                //
-                // If too many probes have been sent without a response then
-                // this socket is dead. Be nice, send a reset and then close it
-                // out.
-                //
+        } else if (RecentTime >= Socket->RetryTime) {
+            WithAcknowledge = FALSE;
+            if (Socket->State == TcpStateSynReceived) {
+                WithAcknowledge = TRUE;
+            }
 
-                if (CurrentSocket->KeepAliveProbeCount >
-                    CurrentSocket->KeepAliveProbeLimit) {
+            NetpTcpSendSyn(Socket, WithAcknowledge);
+            TCP_UPDATE_RETRY_TIME(Socket);
+        }
 
-                    NetpTcpSendControlPacket(CurrentSocket,
-                                             TCP_HEADER_FLAG_RESET);
+    //
+    // If the socket is waiting for a FIN to be ACK'd, then resend the FIN if
+    // the retry time has been reached. If the timeout has expired, send a
+    // reset and close the socket.
+    //
 
-                    *Flags |= TCP_SOCKET_FLAG_CONNECTION_RESET;
-                    NET_SOCKET_SET_LAST_ERROR(&(CurrentSocket->NetSocket),
-                                              STATUS_DESTINATION_UNREACHABLE);
+    } else if (((*Flags & TCP_SOCKET_FLAG_SEND_FIN_WITH_DATA) == 0) &&
+               TCP_IS_FIN_RETRY_STATE(Socket->State)) {
 
-                    IoSetIoObjectState(IoState, POLL_EVENT_ERROR, TRUE);
-                    NetpTcpCloseOutSocket(CurrentSocket, TRUE);
+        RecentTime = KeGetRecentTimeCounter();
+        if (RecentTime > Socket->TimeoutEnd) {
+            NetpTcpSendControlPacket(Socket, TCP_HEADER_FLAG_RESET);
+            *Flags |= TCP_SOCKET_FLAG_CONNECTION_RESET;
+            NET_SOCKET_SET_LAST_ERROR(&(Socket->NetSocket),
+                                      STATUS_DESTINATION_UNREACHABLE);
 
-                //
-                // Otherwise, if the keep alive time has been reached, then
-                // send another ping and then re-arm the keep alive time.
-                //
+            IoSetIoObjectState(IoState, POLL_EVENT_ERROR, TRUE);
+            NetpTcpCloseOutSocket(Socket, FALSE);
 
-                } else {
-                    RecentTime = KeGetRecentTimeCounter();
-                    if (RecentTime >= CurrentSocket->KeepAliveTime) {
-                        NetpTcpSendControlPacket(CurrentSocket,
-                                                 TCP_HEADER_FLAG_KEEP_ALIVE);
-
-                        CurrentSocket->KeepAliveProbeCount += 1;
-                        CurrentSocket->KeepAliveTime = RecentTime;
-                        CurrentSocket->KeepAliveTime +=
-                                               CurrentSocket->KeepAlivePeriod *
-                                               HlQueryTimeCounterFrequency();
-                    }
+        } else if (RecentTime >= Socket->RetryTime) {
+            NetpTcpSendControlPacket(Socket, TCP_HEADER_FLAG_FIN);
+            TCP_UPDATE_RETRY_TIME(Socket);
+        }
 
-                    if (CurrentSocket->KeepAliveTime < KeepAliveTime) {
-                        KeepAliveTime = CurrentSocket->KeepAliveTime;
-                    }
-                }
-            }
+    //
+    // If the socket is in the keep alive state and its keep alive time has
+    // arrived, then check on the remote side.
+    //
 
-            //
-            // If an acknowledge needs to be sent and it wasn't already sent
-            // above, then send just an acknowledge along.
-            //
+    } else if (KeepAliveTimeout != FALSE) {
 
-            if ((*Flags & TCP_SOCKET_FLAG_SEND_ACKNOWLEDGE) != 0) {
-                *Flags &= ~TCP_SOCKET_FLAG_SEND_ACKNOWLEDGE;
-                NetpTcpTimerReleaseReference(CurrentSocket);
-                NetpTcpSendControlPacket(CurrentSocket, 0);
-            }
+        //
+        // If too many probes have been sent without a response then this
+        // socket is dead. Be nice, send a reset and then close it out.
+        //
 
-            KeReleaseQueuedLock(CurrentSocket->Lock);
-            IoSocketReleaseReference(KernelSocket);
-        }
+        if (Socket->KeepAliveProbeCount > Socket->KeepAliveProbeLimit) {
+            NetpTcpSendControlPacket(Socket, TCP_HEADER_FLAG_RESET);
+            *Flags |= TCP_SOCKET_FLAG_CONNECTION_RESET;
+            NET_SOCKET_SET_LAST_ERROR(&(Socket->NetSocket),
+                                      STATUS_DESTINATION_UNREACHABLE);
 
-        KeReleaseQueuedLock(NetTcpSocketListLock);
+            IoSetIoObjectState(IoState, POLL_EVENT_ERROR, TRUE);
+            NetpTcpCloseOutSocket(Socket, FALSE);
 
         //
-        // If the keep alive timer needs to be re-armed, then do so with the
-        // next lowest time.
+        // Otherwise send another ping and then push out the keep alive time.
         //
 
-        if ((KeepAliveTimeout != FALSE) && (KeepAliveTime != MAX_ULONGLONG)) {
-            NetpTcpArmKeepAliveTimer(KeepAliveTime);
+        } else {
+            RecentTime = KeGetRecentTimeCounter();
+            NetpTcpSendControlPacket(Socket, TCP_HEADER_FLAG_KEEP_ALIVE);
+            Socket->KeepAliveProbeCount += 1;
+            Socket->KeepAliveTime = RecentTime;
+            Socket->KeepAliveTime += Socket->KeepAlivePeriod *
+                                     HlQueryTimeCounterFrequency();
         }
     }
 
+    //
+    // If an acknowledge needs to be sent and it wasn't already sent above,
+    // then send just an acknowledge along.
+    //
+
+    if ((*Flags & TCP_SOCKET_FLAG_SEND_ACKNOWLEDGE) != 0) {
+        *Flags &= ~TCP_SOCKET_FLAG_SEND_ACKNOWLEDGE;
+        NetpTcpTimerReleaseReference(Socket);
+        NetpTcpSendControlPacket(Socket, 0);
+    }
+
+ProcessSocketTimerReschedule:
+    Deadline = NetpTcpGetTimerDeadline(Socket);
+    if (Deadline != MAX_ULONGLONG) {
+        NetpTcpScheduleTimer(Socket, Deadline);
+    }
+
+ProcessSocketTimerEnd:
+    KeReleaseQueuedLock(Socket->Lock);
     return;
 }
 
@@ -4553,8 +4649,11 @@ Return Value:
     }
 
     //
-    // If the socket is in a keep alive state then update the keep alive time
-    // and arm the keep alive timer. The remote side is still alive!
+    // If the socket is in a keep alive state then update the keep alive time.
+    // The remote side is still alive! The keep alive time only ever moves
+    // out, so if the socket is already on the timer wheel it is left where it
+    // is; the worker reschedules it when it finds the deadline has moved.
+    // This keeps the wheel lock off the receive path.
     //
 
     if (((Socket->Flags & TCP_SOCKET_FLAG_KEEP_ALIVE) != 0) &&
@@ -4566,7 +4665,9 @@ Return Value:
 
         Socket->KeepAliveTime = DueTime;
         Socket->KeepAliveProbeCount = 0;
-        NetpTcpArmKeepAliveTimer(DueTime);
+        if (Socket->TimerWheelEntry.Next == NULL) {
+            NetpTcpScheduleTimer(Socket, DueTime);
+        }
     }
 
     return;
@@ -6975,12 +7076,28 @@ Return Value:
     HeaderFlags = Segment->Flags & TCP_SEND_SEGMENT_HEADER_FLAG_MASK;
 
     //
-    // Copy the segment data over and fill out the TCP header.
+    // Copy the segment data over and fill out the TCP header. Segments that
+    // reference page cache data are copied straight out of the cache pages.
     //
 
-    RtlCopyMemory(Packet->Buffer + Packet->DataOffset,
-                  (PUCHAR)(Segment + 1) + Segment->Offset,
-                  SegmentLength);
+    if (Segment->IoBuffer != NULL) {
+        Status = MmCopyIoBufferData(Segment->IoBuffer,
+                                    Packet->Buffer + Packet->DataOffset,
+                                    Segment->Offset,
+                                    SegmentLength,
+                                    FALSE);
+
+        if (!KSUCCESS(Status)) {
+            NetFreeBuffer(Packet);
+            Packet = NULL;
+            goto TcpCreatePacketEnd;
+        }
+
+    } else {
+        RtlCopyMemory(Packet->Buffer + Packet->DataOffset,
+                      (PUCHAR)(Segment + 1) + Segment->Offset,
+                      SegmentLength);
+    }
 
     ASSERT(Packet->DataOffset >= sizeof(TCP_HEADER));
 
@@ -7098,7 +7215,7 @@ Return Value:
             }
 
             SignalTransmitReadyEvent = TRUE;
-            NetpTcpFreeSegment(Socket, &(Segment->Header));
+            NetpTcpFreeSendSegment(Socket, Segment);
 
         //
         // If the current acknowledge number is in the middle of the segment,
@@ -7198,6 +7315,10 @@ Return Value:
             NetpTcpTimerReleaseReference(Socket);
         }
 
+        if (OutgoingSegment->IoBuffer != NULL) {
+            MmFreeIoBuffer(OutgoingSegment->IoBuffer);
+        }
+
         MmFreePagedPool(OutgoingSegment);
     }
 
@@ -8158,6 +8279,8 @@ Return Value:
             NetpTcpTimerReleaseReference(Socket);
         }
 
+        NetpTcpCancelTimer(Socket);
+
         NetpTcpFreeSocketDataBuffers(Socket);
         IoSetIoObjectState(Socket->NetSocket.KernelSocket.IoState,
                            TCP_POLL_EVENT_IO,
@@ -8332,8 +8455,8 @@ NetpTcpTimerAddReference (
 
 Routine Description:
 
-    This routine increments the reference count on the TCP timer, ensuring that
-    it runs.
+    This routine increments the socket's reference count on the TCP timer,
+    and makes sure the socket is on the timer wheel for the next tick.
 
 Arguments:
 
@@ -8348,103 +8471,268 @@ Return Value:
 
 {
 
-    ULONG OldReferenceCount;
+    ULONGLONG DueTime;
+
+    Socket->TimerReferenceCount += 1;
+
+    ASSERT((Socket->TimerReferenceCount > 0) &&
+           (Socket->TimerReferenceCount < TCP_TIMER_MAX_REFERENCE));
 
     //
-    // Increment the reference count in the socket. If it's already got
-    // references, no action is needed on the global count.
+    // Whatever the socket needs the timer for should be looked at on the
+    // next tick. The worker thread pushes the deadline back out if nothing
+    // was actually due.
     //
 
-    Socket->TimerReferenceCount += 1;
+    DueTime = KeGetRecentTimeCounter() + NetTcpTimerPeriod;
+    NetpTcpScheduleTimer(Socket, DueTime);
+    return;
+}
+
+VOID
+NetpTcpTimerReleaseReference (
+    PTCP_SOCKET Socket
+    )
+
+/*++
+
+Routine Description:
+
+    This routine decrements the socket's reference count on the TCP timer.
+    The socket is not pulled off the timer wheel; if it comes due with
+    nothing to do, the worker thread simply drops it or reschedules it for
+    its next real deadline.
+
+Arguments:
+
+    Socket - Supplies a pointer to the socket that is releasing the timer
+        reference. This routine assumes the socket lock is held.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
 
     ASSERT((Socket->TimerReferenceCount > 0) &&
            (Socket->TimerReferenceCount < TCP_TIMER_MAX_REFERENCE));
 
-    if (Socket->TimerReferenceCount > 1) {
-        return;
+    Socket->TimerReferenceCount -= 1;
+    return;
+}
+
+ULONGLONG
+NetpTcpGetTimerDeadline (
+    PTCP_SOCKET Socket
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines when the given socket next needs attention from
+    the TCP worker thread. This routine assumes the socket lock is held.
+
+Arguments:
+
+    Socket - Supplies a pointer to the socket.
+
+Return Value:
+
+    Returns the time counter value when the socket is next due.
+
+    MAX_ULONGLONG if the socket has no pending deadlines.
+
+--*/
+
+{
+
+    ULONGLONG Deadline;
+    ULONG Flags;
+    ULONGLONG Timeout;
+
+    Deadline = MAX_ULONGLONG;
+    Flags = Socket->Flags;
+    if (Socket->State == TcpStateClosed) {
+        return Deadline;
     }
 
     //
-    // This is the first reference the socket is taking on the global timer.
-    // Incremement the reference count of the global timer, and maybe queue it.
+    // Outstanding data and delayed acknowledges are serviced every tick, as
+    // is a FIN waiting to go out. The per-segment retransmit times are
+    // tracked by the send path.
     //
 
-    OldReferenceCount = RtlAtomicAdd32(&NetTcpTimerReferenceCount, 1);
+    if ((LIST_EMPTY(&(Socket->OutgoingSegmentList)) == FALSE) ||
+        ((Flags & TCP_SOCKET_FLAG_SEND_ACKNOWLEDGE) != 0) ||
+        (((Flags & TCP_SOCKET_FLAG_SEND_FINAL_SEQUENCE_VALID) != 0) &&
+         ((Flags & TCP_SOCKET_FLAG_SEND_FIN_WITH_DATA) == 0) &&
+         ((Socket->State == TcpStateEstablished) ||
+          (Socket->State == TcpStateCloseWait)))) {
 
-    ASSERT(OldReferenceCount < TCP_TIMER_MAX_REFERENCE);
+        Deadline = KeGetRecentTimeCounter() + NetTcpTimerPeriod;
 
-    if (OldReferenceCount == 0) {
-        if (NetTcpDebugPrintSequenceNumbers != FALSE) {
-            RtlDebugPrint("TCP: Enabled periodic timer.\n");
+    //
+    // The time-wait state just needs to wake up when it's over.
+    //
+
+    } else if (Socket->State == TcpStateTimeWait) {
+        Deadline = Socket->TimeoutEnd + 1;
+
+    //
+    // SYN and FIN retries wake up for the next retry or the overall timeout,
+    // whichever comes first.
+    //
+
+    } else if ((TCP_IS_SYN_RETRY_STATE(Socket->State)) ||
+               (((Flags & TCP_SOCKET_FLAG_SEND_FIN_WITH_DATA) == 0) &&
+                (TCP_IS_FIN_RETRY_STATE(Socket->State)))) {
+
+        Deadline = Socket->RetryTime;
+        Timeout = Socket->TimeoutEnd + 1;
+        if (Timeout < Deadline) {
+            Deadline = Timeout;
         }
+    }
+
+    if (((Flags & TCP_SOCKET_FLAG_KEEP_ALIVE) != 0) &&
+        (TCP_IS_KEEP_ALIVE_STATE(Socket->State) != FALSE) &&
+        (Socket->KeepAliveTime < Deadline)) {
 
-        NetpTcpQueueTcpTimer();
+        Deadline = Socket->KeepAliveTime;
     }
 
-    return;
+    return Deadline;
 }
 
-ULONG
-NetpTcpTimerReleaseReference (
-    PTCP_SOCKET Socket
+VOID
+NetpTcpScheduleTimer (
+    PTCP_SOCKET Socket,
+    ULONGLONG DueTime
     )
 
 /*++
 
 Routine Description:
 
-    This routine decrements the reference count on the TCP timer, canceling it
-    if no one else is using it.
+    This routine puts the given socket on the timer wheel so that the worker
+    thread services it at or shortly after the given time. If the socket is
+    already due sooner, it is left alone.
 
 Arguments:
 
-    Socket - Supplies an optional pointer to the socket that is releasing the
-        timer reference.
+    Socket - Supplies a pointer to the socket. This routine assumes the
+        socket lock is held.
+
+    DueTime - Supplies the time counter value when the socket should be
+        serviced.
 
 Return Value:
 
-    Returns the old reference count on the TCP timer. The return value should
-    only be observed if the socket parameter is NULL.
+    None.
 
 --*/
 
 {
 
-    ULONG OldReferenceCount;
+    ULONGLONG BoundaryTick;
+    ULONGLONG CurrentTick;
+    ULONGLONG Tick;
+    PTCP_TIMER_WHEEL Wheel;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    if (Socket->State == TcpStateClosed) {
+        return;
+    }
 
-    if (Socket != NULL) {
+    //
+    // Round the due time up to a tick so the socket never comes due early.
+    //
 
-        ASSERT((Socket->TimerReferenceCount > 0) &&
-               (Socket->TimerReferenceCount < TCP_TIMER_MAX_REFERENCE));
+    Wheel = &NetTcpTimerWheel;
+    Tick = 0;
+    if (DueTime > Wheel->BaseTime) {
+        Tick = DueTime - Wheel->BaseTime + NetTcpTimerPeriod - 1;
+        Tick /= NetTcpTimerPeriod;
+    }
 
-        Socket->TimerReferenceCount -= 1;
-        if (Socket->TimerReferenceCount != 0) {
-            return Socket->TimerReferenceCount;
+    KeAcquireQueuedLock(NetTcpTimerWheelLock);
+
+    //
+    // The wheel stops advancing while it is empty. Catch it up to the present
+    // before inserting, otherwise the first socket after a long idle period
+    // would leave the worker walking every tick that elapsed in between.
+    //
+
+    if (Wheel->SocketCount == 0) {
+        CurrentTick = HlQueryTimeCounter() - Wheel->BaseTime;
+        CurrentTick /= NetTcpTimerPeriod;
+        if (CurrentTick > Wheel->CurrentTick) {
+            Wheel->CurrentTick = CurrentTick;
         }
     }
 
-    OldReferenceCount = RtlAtomicAdd32(&NetTcpTimerReferenceCount, (ULONG)-1);
+    if (Tick <= Wheel->CurrentTick) {
+        Tick = Wheel->CurrentTick + 1;
+    }
+
+    //
+    // A socket with a linked wheel entry but a tick of zero has already
+    // expired and is waiting on the worker thread, which reschedules it
+    // after servicing it.
+    //
 
-    ASSERT((OldReferenceCount != 0) &&
-           (OldReferenceCount < TCP_TIMER_MAX_REFERENCE));
+    if (Socket->TimerWheelEntry.Next != NULL) {
+        if ((Socket->TimerWheelTick == 0) ||
+            (Socket->TimerWheelTick <= Tick)) {
 
-    return OldReferenceCount;
+            goto ScheduleTimerEnd;
+        }
+
+        LIST_REMOVE(&(Socket->TimerWheelEntry));
+        Wheel->SocketCount -= 1;
+    }
+
+    NetpTcpTimerWheelInsert(Socket, Tick);
+
+    //
+    // The worker wakes up at every level zero wrap to cascade the upper
+    // levels, so there's no need to wake sooner than that for a socket that
+    // went into an upper level.
+    //
+
+    BoundaryTick = (Wheel->CurrentTick | TCP_TIMER_WHEEL_SLOT_MASK) + 1;
+    if (Tick > BoundaryTick) {
+        Tick = BoundaryTick;
+    }
+
+    if ((Wheel->DueTick == 0) || (Tick < Wheel->DueTick)) {
+        NetpTcpTimerWheelArm();
+    }
+
+ScheduleTimerEnd:
+    KeReleaseQueuedLock(NetTcpTimerWheelLock);
+    return;
 }
 
 VOID
-NetpTcpQueueTcpTimer (
-    VOID
+NetpTcpCancelTimer (
+    PTCP_SOCKET Socket
     )
 
 /*++
 
 Routine Description:
 
-    This routine queues the TCP timer.
+    This routine removes the given socket from the timer wheel. This routine
+    assumes the socket lock is held.
 
 Arguments:
 
-    None.
+    Socket - Supplies a pointer to the socket.
 
 Return Value:
 
@@ -8454,48 +8742,49 @@ Return Value:
 
 {
 
-    ULONGLONG DueTime;
-    KSTATUS Status;
+    if (Socket->TimerWheelEntry.Next == NULL) {
+        return;
+    }
 
-    ASSERT(KeGetRunLevel() == RunLevelLow);
+    KeAcquireQueuedLock(NetTcpTimerWheelLock);
 
     //
-    // Add a reference for the TCP worker and queue the timer.
+    // Leave the socket alone if it has already expired. The worker holds a
+    // reference on it and will notice it has been closed.
     //
 
-    RtlAtomicAdd32(&NetTcpTimerReferenceCount, 1);
-    DueTime = KeGetRecentTimeCounter();
-    DueTime += NetTcpTimerPeriod;
-    Status = KeQueueTimer(NetTcpTimer,
-                          TimerQueueSoftWake,
-                          DueTime,
-                          0,
-                          0,
-                          NULL);
+    if ((Socket->TimerWheelEntry.Next != NULL) &&
+        (Socket->TimerWheelTick != 0)) {
 
-    if (!KSUCCESS(Status)) {
-        RtlDebugPrint("Error: Failed to queue TCP timer: %d\n", Status);
+        LIST_REMOVE(&(Socket->TimerWheelEntry));
+        Socket->TimerWheelEntry.Next = NULL;
+        Socket->TimerWheelTick = 0;
+        NetTcpTimerWheel.SocketCount -= 1;
     }
 
+    KeReleaseQueuedLock(NetTcpTimerWheelLock);
     return;
 }
 
 VOID
-NetpTcpArmKeepAliveTimer (
-    ULONGLONG DueTime
+NetpTcpTimerWheelInsert (
+    PTCP_SOCKET Socket,
+    ULONGLONG Tick
     )
 
 /*++
 
 Routine Description:
 
-    This routine arms or re-arms the keep alive timer to the given due time if
-    it is less than the current due time.
+    This routine inserts a socket into the timer wheel slot for the given
+    tick. This routine assumes the timer wheel lock is held.
 
 Arguments:
 
-    DueTime - Supplies the value of the time tick counter when the keep alive
-        timer should expire.
+    Socket - Supplies a pointer to the socket, which must not be on the wheel.
+
+    Tick - Supplies the tick when the socket is due. This must not be before
+        the current tick of the wheel.
 
 Return Value:
 
@@ -8505,38 +8794,212 @@ Return Value:
 
 {
 
-    ULONGLONG CurrentDueTime;
-    KSTATUS Status;
+    ULONGLONG Delta;
+    ULONG Level;
+    ULONG Shift;
+    ULONG Slot;
+    PTCP_TIMER_WHEEL Wheel;
 
-    ASSERT(KeGetRunLevel() == RunLevelLow);
+    Wheel = &NetTcpTimerWheel;
+
+    ASSERT(Tick >= Wheel->CurrentTick);
 
     //
-    // If the timer's current due time is 0 (not queued) or greater than the
-    // requested due time, cancel the timer and re-queue it.
+    // Deadlines beyond the reach of the wheel are parked in the last slot it
+    // can reach. The socket will come due early and get rescheduled.
     //
 
-    KeAcquireQueuedLock(NetTcpKeepAliveTimerLock);
-    CurrentDueTime = KeGetTimerDueTime(NetTcpKeepAliveTimer);
-    if ((CurrentDueTime == 0) || (CurrentDueTime > DueTime)) {
-        if (NetTcpDebugPrintSequenceNumbers != FALSE) {
-            RtlDebugPrint("TCP: Arming keep alive timer.\n");
+    Delta = Tick - Wheel->CurrentTick;
+    if (Delta >= TCP_TIMER_WHEEL_SPAN) {
+        Delta = TCP_TIMER_WHEEL_SPAN - 1;
+        Tick = Wheel->CurrentTick + Delta;
+    }
+
+    Level = 0;
+    Shift = 0;
+    while ((Level < TCP_TIMER_WHEEL_LEVELS - 1) &&
+           (Delta >= (1ULL << (Shift + TCP_TIMER_WHEEL_SLOT_SHIFT)))) {
+
+        Level += 1;
+        Shift += TCP_TIMER_WHEEL_SLOT_SHIFT;
+    }
+
+    Slot = (Tick >> Shift) & TCP_TIMER_WHEEL_SLOT_MASK;
+    Socket->TimerWheelTick = Tick;
+    INSERT_BEFORE(&(Socket->TimerWheelEntry), &(Wheel->Slots[Level][Slot]));
+    Wheel->SocketCount += 1;
+    return;
+}
+
+VOID
+NetpTcpTimerWheelAdvance (
+    ULONGLONG Tick,
+    PLIST_ENTRY ExpiredList
+    )
+
+/*++
+
+Routine Description:
+
+    This routine moves the timer wheel forward to the given tick, cascading
+    upper level slots down as their spans begin and collecting every socket
+    that has come due. This routine assumes the timer wheel lock is held.
+
+Arguments:
+
+    Tick - Supplies the tick to advance the wheel to.
+
+    ExpiredList - Supplies a pointer to the head of a list that receives the
+        expired sockets. A reference is taken on each socket, and its wheel
+        tick is set to zero to indicate that it is awaiting service.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY Head;
+    ULONG Index;
+    ULONG Level;
+    LIST_ENTRY ProcessList;
+    PTCP_SOCKET Socket;
+    PTCP_TIMER_WHEEL Wheel;
+
+    Wheel = &NetTcpTimerWheel;
+    while (Wheel->CurrentTick < Tick) {
+
+        //
+        // There's nothing to walk through if the wheel is empty.
+        //
+
+        if (Wheel->SocketCount == 0) {
+            Wheel->CurrentTick = Tick;
+            break;
         }
 
-        KeCancelTimer(NetTcpKeepAliveTimer);
-        Status = KeQueueTimer(NetTcpKeepAliveTimer,
-                              TimerQueueSoftWake,
-                              DueTime,
-                              0,
-                              0,
-                              NULL);
+        Wheel->CurrentTick += 1;
 
-        if (!KSUCCESS(Status)) {
-            RtlDebugPrint("Error: Failed to queue TCP keep alive timer: %d\n",
-                          Status);
+        //
+        // When level zero wraps, pull the next slot of each upper level down
+        // to the levels below it.
+        //
+
+        Index = Wheel->CurrentTick & TCP_TIMER_WHEEL_SLOT_MASK;
+        Level = 1;
+        while ((Index == 0) && (Level < TCP_TIMER_WHEEL_LEVELS)) {
+            Index = (Wheel->CurrentTick >>
+                     (Level * TCP_TIMER_WHEEL_SLOT_SHIFT)) &
+                    TCP_TIMER_WHEEL_SLOT_MASK;
+
+            Head = &(Wheel->Slots[Level][Index]);
+            if (LIST_EMPTY(Head) == FALSE) {
+                MOVE_LIST(Head, &ProcessList);
+                INITIALIZE_LIST_HEAD(Head);
+                while (LIST_EMPTY(&ProcessList) == FALSE) {
+                    Socket = LIST_VALUE(ProcessList.Next,
+                                        TCP_SOCKET,
+                                        TimerWheelEntry);
+
+                    LIST_REMOVE(&(Socket->TimerWheelEntry));
+                    Wheel->SocketCount -= 1;
+                    NetpTcpTimerWheelInsert(Socket, Socket->TimerWheelTick);
+                }
+            }
+
+            Level += 1;
+        }
+
+        //
+        // Everything in the current level zero slot has expired.
+        //
+
+        Head = &(Wheel->Slots[0][Wheel->CurrentTick &
+                                 TCP_TIMER_WHEEL_SLOT_MASK]);
+
+        while (LIST_EMPTY(Head) == FALSE) {
+            Socket = LIST_VALUE(Head->Next, TCP_SOCKET, TimerWheelEntry);
+            LIST_REMOVE(&(Socket->TimerWheelEntry));
+            Wheel->SocketCount -= 1;
+            Socket->TimerWheelTick = 0;
+            IoSocketAddReference(&(Socket->NetSocket.KernelSocket));
+            INSERT_BEFORE(&(Socket->TimerWheelEntry), ExpiredList);
         }
     }
 
-    KeReleaseQueuedLock(NetTcpKeepAliveTimerLock);
+    return;
+}
+
+VOID
+NetpTcpTimerWheelArm (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues the global TCP timer for the next tick that has work
+    on the timer wheel: either the next non-empty level zero slot, or the
+    next wrap of level zero, when upper levels need to be cascaded. If the
+    wheel is empty, the timer is left alone. This routine assumes the timer
+    wheel lock is held.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONGLONG DueTime;
+    KSTATUS Status;
+    ULONGLONG Tick;
+    PTCP_TIMER_WHEEL Wheel;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    Wheel = &NetTcpTimerWheel;
+    if (Wheel->SocketCount == 0) {
+        return;
+    }
+
+    Tick = Wheel->CurrentTick + 1;
+    while ((Tick & TCP_TIMER_WHEEL_SLOT_MASK) != 0) {
+        if (LIST_EMPTY(&(Wheel->Slots[0][Tick & TCP_TIMER_WHEEL_SLOT_MASK])) ==
+            FALSE) {
+
+            break;
+        }
+
+        Tick += 1;
+    }
+
+    if (Tick == Wheel->DueTick) {
+        return;
+    }
+
+    Wheel->DueTick = Tick;
+    DueTime = Wheel->BaseTime + (Tick * NetTcpTimerPeriod);
+    KeCancelTimer(NetTcpTimer);
+    Status = KeQueueTimer(NetTcpTimer,
+                          TimerQueueSoftWake,
+                          DueTime,
+                          0,
+                          0,
+                          NULL);
+
+    if (!KSUCCESS(Status)) {
+        RtlDebugPrint("Error: Failed to queue TCP timer: %d\n", Status);
+    }
+
     return;
 }
 
@@ -8862,3 +9325,39 @@ Return Value:
     return;
 }
 
+VOID
+NetpTcpFreeSendSegment (
+    PTCP_SOCKET Socket,
+    PTCP_SEND_SEGMENT Segment
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases an outgoing TCP segment, dropping any page cache
+    references it holds, and makes it available for reuse.
+
+Arguments:
+
+    Socket - Supplies a pointer to the TCP socket that owns the segment.
+
+    Segment - Supplies a pointer to the send segment to be released.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Segment->IoBuffer != NULL) {
+        MmFreeIoBuffer(Segment->IoBuffer);
+        Segment->IoBuffer = NULL;
+    }
+
+    NetpTcpFreeSegment(Socket, &(Segment->Header));
+    return;
+}
+
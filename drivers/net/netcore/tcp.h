@@ -433,9 +433,16 @@ Structure Description:
     Flags - Stores a bitmask of TCP flags. See TCP_SOCKET_FLAG_* for
         definitions.
 
-    TimerReferenceCount - Supplies the reference count on the global TCP timer.
-        If this value is non-zero, there is a single reference on the global
-        TCP timer.
+    TimerReferenceCount - Supplies the number of reasons the socket has for
+        needing the TCP worker thread, such as unacknowledged data or a
+        pending delayed acknowledge.
+
+    TimerWheelEntry - Stores pointers to the next and previous sockets in the
+        same TCP timer wheel slot. The next pointer is NULL if the socket is
+        not on the wheel.
+
+    TimerWheelTick - Stores the timer wheel tick when the socket is due, or
+        zero if the socket has expired and is waiting to be serviced.
 
     SendInitialSequence - Stores the random offset that the sequence numbers
         started at for this socket.
@@ -603,6 +610,8 @@ typedef struct _TCP_SOCKET {
     TCP_STATE State;
     ULONG Flags;
     LONG TimerReferenceCount;
+    LIST_ENTRY TimerWheelEntry;
+    ULONGLONG TimerWheelTick;
     ULONG SendInitialSequence;
     ULONG SendUnacknowledgedSequence;
     ULONG SendNextBufferSequence;
@@ -727,7 +736,8 @@ typedef struct _TCP_RECEIVED_SEGMENT {
 Structure Description:
 
     This structure stores information about an outgoing TCP segment. The data
-    comes immediately after this structure.
+    comes immediately after this structure, unless the segment references an
+    I/O buffer.
 
 Members:
 
@@ -754,6 +764,11 @@ Structure Description:
     Flags - Stores a bitmask of flags for the outgoing TCP segment. See
         TCP_SEND_SEGMENT_FLAG_* for definitions.
 
+    IoBuffer - Stores an optional pointer to an I/O buffer holding the
+        segment's data. If set, the buffer holds references on the page cache
+        pages containing the data until the segment is freed, and no data
+        follows this structure.
+
 --*/
 
 typedef struct _TCP_SEND_SEGMENT {
@@ -765,6 +780,7 @@ typedef struct _TCP_SEND_SEGMENT {
     ULONG Length;
     ULONG Offset;
     ULONG Flags;
+    PIO_BUFFER IoBuffer;
 } TCP_SEND_SEGMENT, *PTCP_SEND_SEGMENT;
 
 /*++
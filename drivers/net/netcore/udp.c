@@ -1268,7 +1268,11 @@ Return Value:
     // Find a socket willing to take this packet.
     //
 
-    Socket = NetFindSocket(ProtocolEntry, DestinationAddress, SourceAddress);
+    Socket = NetFindReceiveSocket(Link,
+                                  ProtocolEntry,
+                                  DestinationAddress,
+                                  SourceAddress);
+
     if (Socket == NULL) {
         return;
     }
@@ -0,0 +1,44 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    NVMe
+
+Abstract:
+
+    This module implements the driver for NVM Express (NVMe) solid state
+    disk controllers.
+
+Author:
+
+    Minoca Corp. 16-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+function build() {
+    name = "nvme";
+    sources = [
+        "nvme.c"
+    ];
+
+    drv = {
+        "label": name,
+        "inputs": sources,
+    };
+
+    entries = driver(drv);
+    return entries;
+}
+
+return build();
@@ -0,0 +1,3807 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    nvme.c
+
+Abstract:
+
+    This module implements the NVM Express (NVMe) driver. Each namespace is
+    exposed as a disk device. One submission and completion queue pair is
+    created per processor, each signaled by its own MSI-X vector aimed at that
+    processor, so I/O is submitted and completed on the same processor without
+    contending with other processors.
+
+Author:
+
+    Minoca Corp. 16-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include <minoca/intrface/disk.h>
+#include "nvme.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+NvmeAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    );
+
+VOID
+NvmeDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+NvmeDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+NvmeDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+NvmeDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+NvmeDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+INTERRUPT_STATUS
+NvmeInterruptService (
+    PVOID Context
+    );
+
+INTERRUPT_STATUS
+NvmeInterruptServiceDpc (
+    PVOID Context
+    );
+
+VOID
+NvmepDispatchControllerStateChange (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    );
+
+VOID
+NvmepDispatchNamespaceStateChange (
+    PIRP Irp,
+    PNVME_NAMESPACE Namespace
+    );
+
+VOID
+NvmepDispatchNamespaceSystemControl (
+    PIRP Irp,
+    PNVME_NAMESPACE Namespace
+    );
+
+KSTATUS
+NvmepProcessResourceRequirements (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    );
+
+KSTATUS
+NvmepStartController (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    );
+
+KSTATUS
+NvmepConnectInterrupts (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    );
+
+KSTATUS
+NvmepWaitForReady (
+    PNVME_CONTROLLER Controller,
+    BOOL Ready
+    );
+
+KSTATUS
+NvmepIdentifyController (
+    PNVME_CONTROLLER Controller
+    );
+
+KSTATUS
+NvmepCreateIoQueues (
+    PNVME_CONTROLLER Controller
+    );
+
+PNVME_QUEUE
+NvmepCreateQueue (
+    PNVME_CONTROLLER Controller,
+    ULONG QueueId,
+    ULONG Depth
+    );
+
+VOID
+NvmepResetQueue (
+    PNVME_QUEUE Queue
+    );
+
+VOID
+NvmepEnumerateNamespaces (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    );
+
+KSTATUS
+NvmepIdentifyNamespace (
+    PNVME_CONTROLLER Controller,
+    ULONG NamespaceId
+    );
+
+PNVME_QUEUE
+NvmepGetIoQueue (
+    PNVME_CONTROLLER Controller
+    );
+
+ULONG
+NvmepAcquireCommand (
+    PNVME_QUEUE Queue
+    );
+
+VOID
+NvmepReleaseCommand (
+    PNVME_QUEUE Queue,
+    ULONG CommandId
+    );
+
+VOID
+NvmepSubmitCommand (
+    PNVME_QUEUE Queue,
+    PNVME_SUBMISSION_ENTRY Entry
+    );
+
+KSTATUS
+NvmepExecuteCommand (
+    PNVME_QUEUE Queue,
+    PNVME_SUBMISSION_ENTRY Entry,
+    PULONG Result
+    );
+
+KSTATUS
+NvmepStartTransfer (
+    PNVME_QUEUE Queue,
+    ULONG CommandId
+    );
+
+KSTATUS
+NvmepBuildPrpList (
+    PNVME_COMMAND Command,
+    PIO_BUFFER IoBuffer,
+    UINTN IoBufferOffset,
+    UINTN Size,
+    ULONG BlockSize,
+    PNVME_SUBMISSION_ENTRY Entry,
+    PUINTN TransferSize
+    );
+
+BOOL
+NvmepQueueHasCompletion (
+    PNVME_QUEUE Queue
+    );
+
+VOID
+NvmepProcessCompletions (
+    PNVME_QUEUE Queue
+    );
+
+VOID
+NvmepCompleteCommand (
+    PNVME_QUEUE Queue,
+    ULONG CommandId,
+    KSTATUS Status,
+    ULONG Result
+    );
+
+KSTATUS
+NvmepGetCompletionStatus (
+    PNVME_QUEUE Queue,
+    PNVME_COMPLETION_ENTRY Entry
+    );
+
+KSTATUS
+NvmepSynchronizeNamespace (
+    PNVME_NAMESPACE Namespace
+    );
+
+KSTATUS
+NvmepBlockIoReset (
+    PVOID DiskToken
+    );
+
+KSTATUS
+NvmepBlockRead (
+    PVOID DiskToken,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    PUINTN BlocksCompleted
+    );
+
+KSTATUS
+NvmepBlockWrite (
+    PVOID DiskToken,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    PUINTN BlocksCompleted
+    );
+
+KSTATUS
+NvmepPerformPolledIo (
+    PIRP_READ_WRITE IrpReadWrite,
+    PNVME_NAMESPACE Namespace,
+    BOOL Write
+    );
+
+VOID
+NvmepProcessPciMsiInterfaceChangeNotification (
+    PVOID Context,
+    PDEVICE Device,
+    PVOID InterfaceBuffer,
+    ULONG InterfaceBufferSize,
+    BOOL Arrival
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+PDRIVER NvmeDriver = NULL;
+UUID NvmePciMsiInterfaceUuid = UUID_PCI_MESSAGE_SIGNALED_INTERRUPTS;
+UUID NvmeDiskInterfaceUuid = UUID_DISK_INTERFACE;
+
+DISK_INTERFACE NvmeDiskInterfaceTemplate = {
+    DISK_INTERFACE_VERSION,
+    NULL,
+    0,
+    0,
+    NULL,
+    NvmepBlockIoReset,
+    NvmepBlockRead,
+    NvmepBlockWrite
+};
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+DriverEntry (
+    PDRIVER Driver
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is the entry point for the NVMe driver. It registers its
+    other dispatch functions, and performs driver-wide initialization.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver object.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code on error.
+
+--*/
+
+{
+
+    DRIVER_FUNCTION_TABLE FunctionTable;
+    KSTATUS Status;
+
+    NvmeDriver = Driver;
+    RtlZeroMemory(&FunctionTable, sizeof(DRIVER_FUNCTION_TABLE));
+    FunctionTable.Version = DRIVER_FUNCTION_TABLE_VERSION;
+    FunctionTable.AddDevice = NvmeAddDevice;
+    FunctionTable.DispatchStateChange = NvmeDispatchStateChange;
+    FunctionTable.DispatchOpen = NvmeDispatchOpen;
+    FunctionTable.DispatchClose = NvmeDispatchClose;
+    FunctionTable.DispatchIo = NvmeDispatchIo;
+    FunctionTable.DispatchSystemControl = NvmeDispatchSystemControl;
+    Status = IoRegisterDriverFunctions(Driver, &FunctionTable);
+    return Status;
+}
+
+KSTATUS
+NvmeAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when a device is detected for which the NVMe driver
+    acts as the function driver. The driver will attach itself to the stack.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver being called.
+
+    DeviceId - Supplies a pointer to a string with the device ID.
+
+    ClassId - Supplies a pointer to a string containing the device's class ID.
+
+    CompatibleIds - Supplies a pointer to a string containing device IDs
+        that would be compatible with this device.
+
+    DeviceToken - Supplies an opaque token that the driver can use to identify
+        the device in the system. This token should be used when attaching to
+        the stack.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code if the driver was unsuccessful in attaching itself.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+    ULONG Index;
+    KSTATUS Status;
+
+    Controller = MmAllocateNonPagedPool(sizeof(NVME_CONTROLLER),
+                                        NVME_ALLOCATION_TAG);
+
+    if (Controller == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto AddDeviceEnd;
+    }
+
+    RtlZeroMemory(Controller, sizeof(NVME_CONTROLLER));
+    Controller->Type = NvmeControllerContext;
+    Controller->InterruptLine = INVALID_INTERRUPT_LINE;
+    for (Index = 0; Index < NVME_MAX_VECTORS; Index += 1) {
+        Controller->Vectors[Index].Controller = Controller;
+        Controller->Vectors[Index].Index = Index;
+        Controller->Vectors[Index].InterruptHandle = INVALID_HANDLE;
+    }
+
+    Controller->AdminLock = KeCreateQueuedLock();
+    if (Controller->AdminLock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto AddDeviceEnd;
+    }
+
+    Status = IoAttachDriverToDevice(Driver, DeviceToken, Controller);
+    if (!KSUCCESS(Status)) {
+        goto AddDeviceEnd;
+    }
+
+    Status = STATUS_SUCCESS;
+
+AddDeviceEnd:
+    if (!KSUCCESS(Status)) {
+        if (Controller != NULL) {
+            if (Controller->AdminLock != NULL) {
+                KeDestroyQueuedLock(Controller->AdminLock);
+            }
+
+            MmFreeNonPagedPool(Controller);
+        }
+    }
+
+    return Status;
+}
+
+VOID
+NvmeDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles State Change IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+
+    Controller = DeviceContext;
+    switch (Controller->Type) {
+    case NvmeControllerContext:
+        NvmepDispatchControllerStateChange(Irp, Controller);
+        break;
+
+    case NvmeNamespaceContext:
+        NvmepDispatchNamespaceStateChange(Irp, (PNVME_NAMESPACE)Controller);
+        break;
+
+    default:
+
+        ASSERT(FALSE);
+
+        IoCompleteIrp(NvmeDriver, Irp, STATUS_INVALID_CONFIGURATION);
+        break;
+    }
+
+    return;
+}
+
+VOID
+NvmeDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Open IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNVME_NAMESPACE Namespace;
+
+    //
+    // Only the disk can be opened or closed.
+    //
+
+    Namespace = (PNVME_NAMESPACE)DeviceContext;
+    if (Namespace->Type != NvmeNamespaceContext) {
+        return;
+    }
+
+    Irp->U.Open.DeviceContext = Namespace;
+    IoCompleteIrp(NvmeDriver, Irp, STATUS_SUCCESS);
+    return;
+}
+
+VOID
+NvmeDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Close IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNVME_NAMESPACE Namespace;
+
+    //
+    // Only the disk can be opened or closed.
+    //
+
+    Namespace = (PNVME_NAMESPACE)DeviceContext;
+    if (Namespace->Type != NvmeNamespaceContext) {
+        return;
+    }
+
+    IoCompleteIrp(NvmeDriver, Irp, STATUS_SUCCESS);
+    return;
+}
+
+VOID
+NvmeDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles I/O IRPs. On the way down, the IRP is given a command
+    on the current processor's queue, started, and pended. On the way up, the
+    IRP's I/O buffer state is cleaned up.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG CommandId;
+    PNVME_CONTROLLER Controller;
+    ULONG IrpReadWriteFlags;
+    PNVME_NAMESPACE Namespace;
+    RUNLEVEL OldRunLevel;
+    BOOL PmReferenceAdded;
+    PNVME_QUEUE Queue;
+    BOOL ReadWriteIrpPrepared;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    Namespace = (PNVME_NAMESPACE)Irp->U.ReadWrite.DeviceContext;
+    if (Namespace->Type != NvmeNamespaceContext) {
+        return;
+    }
+
+    Controller = Namespace->Controller;
+    IrpReadWriteFlags = IRP_READ_WRITE_FLAG_DMA;
+    if (Irp->MinorCode == IrpMinorIoWrite) {
+        IrpReadWriteFlags |= IRP_READ_WRITE_FLAG_WRITE;
+    }
+
+    //
+    // An IRP on the way up has already been completed by the interrupt path,
+    // which freed its command. Finish up the I/O buffer state here at low
+    // level.
+    //
+
+    if (Irp->Direction == IrpUp) {
+        Status = IoCompleteReadWriteIrp(&(Irp->U.ReadWrite), IrpReadWriteFlags);
+        if (!KSUCCESS(Status)) {
+            IoUpdateIrpStatus(Irp, Status);
+        }
+
+        PmDeviceReleaseReference(Namespace->OsDevice);
+        return;
+    }
+
+    PmReferenceAdded = FALSE;
+    ReadWriteIrpPrepared = FALSE;
+    Status = PmDeviceAddReference(Namespace->OsDevice);
+    if (!KSUCCESS(Status)) {
+        goto DispatchIoEnd;
+    }
+
+    PmReferenceAdded = TRUE;
+
+    ASSERT(Irp->U.ReadWrite.IoBytesCompleted == 0);
+    ASSERT(IS_ALIGNED(Irp->U.ReadWrite.IoOffset, Namespace->BlockSize) !=
+           FALSE);
+
+    ASSERT(IS_ALIGNED(Irp->U.ReadWrite.IoSizeInBytes, Namespace->BlockSize) !=
+           FALSE);
+
+    Irp->U.ReadWrite.NewIoOffset = Irp->U.ReadWrite.IoOffset;
+    if (Irp->U.ReadWrite.IoSizeInBytes == 0) {
+        Status = STATUS_SUCCESS;
+        goto DispatchIoEnd;
+    }
+
+    //
+    // Prepare the I/O buffer for DMA. The PRP list is built straight from the
+    // buffer's fragments without copying.
+    //
+
+    Status = IoPrepareReadWriteIrp(&(Irp->U.ReadWrite),
+                                   NVME_DATA_ALIGNMENT,
+                                   0,
+                                   MAX_ULONGLONG,
+                                   IrpReadWriteFlags);
+
+    if (!KSUCCESS(Status)) {
+        goto DispatchIoEnd;
+    }
+
+    ReadWriteIrpPrepared = TRUE;
+    Queue = NvmepGetIoQueue(Controller);
+    if (Queue == NULL) {
+        Status = STATUS_NOT_READY;
+        goto DispatchIoEnd;
+    }
+
+    //
+    // Get a command, waiting if they are all in use. From here on the IRP is
+    // pended, and the up direction finishes it off even if starting the
+    // transfer fails.
+    //
+
+    CommandId = NvmepAcquireCommand(Queue);
+    Queue->Commands[CommandId].Irp = Irp;
+    IoPendIrp(NvmeDriver, Irp);
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Queue->Lock));
+    Status = NvmepStartTransfer(Queue, CommandId);
+    if (!KSUCCESS(Status)) {
+        Queue->Commands[CommandId].Irp = NULL;
+        NvmepReleaseCommand(Queue, CommandId);
+    }
+
+    KeReleaseSpinLock(&(Queue->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    if (!KSUCCESS(Status)) {
+        IoCompleteIrp(NvmeDriver, Irp, Status);
+    }
+
+    return;
+
+DispatchIoEnd:
+    if (ReadWriteIrpPrepared != FALSE) {
+        IoCompleteReadWriteIrp(&(Irp->U.ReadWrite), IrpReadWriteFlags);
+    }
+
+    if (PmReferenceAdded != FALSE) {
+        PmDeviceReleaseReference(Namespace->OsDevice);
+    }
+
+    IoCompleteIrp(NvmeDriver, Irp, Status);
+    return;
+}
+
+VOID
+NvmeDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles System Control IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNVME_NAMESPACE Namespace;
+
+    ASSERT(Irp->MajorCode == IrpMajorSystemControl);
+
+    Namespace = (PNVME_NAMESPACE)DeviceContext;
+    if (Namespace->Type == NvmeNamespaceContext) {
+        NvmepDispatchNamespaceSystemControl(Irp, Namespace);
+    }
+
+    return;
+}
+
+INTERRUPT_STATUS
+NvmeInterruptService (
+    PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the NVMe interrupt service routine. It claims the
+    interrupt if any completion queue on the vector has a new entry.
+
+Arguments:
+
+    Context - Supplies the context pointer given to the system when the
+        interrupt was connected. In this case, this points to the NVMe vector.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+    BOOL Pending;
+    ULONG QueueCount;
+    ULONG QueueId;
+    PNVME_VECTOR Vector;
+
+    Vector = (PNVME_VECTOR)Context;
+    Controller = Vector->Controller;
+    Pending = FALSE;
+
+    //
+    // The admin queue always signals the first vector. I/O queues are spread
+    // across the vectors in order.
+    //
+
+    if ((Vector->Index == 0) && (Controller->Queues[0] != NULL)) {
+        Pending = NvmepQueueHasCompletion(Controller->Queues[0]);
+    }
+
+    QueueCount = Controller->IoQueueCount;
+    QueueId = Vector->Index + 1;
+    while ((Pending == FALSE) && (QueueId <= QueueCount)) {
+        Pending = NvmepQueueHasCompletion(Controller->Queues[QueueId]);
+        QueueId += Controller->VectorCount;
+    }
+
+    if (Pending == FALSE) {
+        return InterruptStatusNotClaimed;
+    }
+
+    //
+    // Without MSI-X the interrupt stays asserted until the completions are
+    // consumed, so mask it until the DPC has run.
+    //
+
+    if (Controller->MaskInterrupts != FALSE) {
+        NVME_WRITE_REGISTER(Controller,
+                            NVME_INTERRUPT_MASK_SET,
+                            1 << Vector->Index);
+    }
+
+    return InterruptStatusClaimed;
+}
+
+INTERRUPT_STATUS
+NvmeInterruptServiceDpc (
+    PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the NVMe dispatch-level interrupt service routine.
+    It processes the completion queues signaled by the vector.
+
+Arguments:
+
+    Context - Supplies the context pointer given to the system when the
+        interrupt was connected. In this case, this points to the NVMe vector.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+    PNVME_QUEUE Queue;
+    ULONG QueueCount;
+    ULONG QueueId;
+    PNVME_VECTOR Vector;
+
+    Vector = (PNVME_VECTOR)Context;
+    Controller = Vector->Controller;
+    if ((Vector->Index == 0) && (Controller->Queues[0] != NULL)) {
+        Queue = Controller->Queues[0];
+        KeAcquireSpinLock(&(Queue->Lock));
+        NvmepProcessCompletions(Queue);
+        KeReleaseSpinLock(&(Queue->Lock));
+    }
+
+    QueueCount = Controller->IoQueueCount;
+    for (QueueId = Vector->Index + 1;
+         QueueId <= QueueCount;
+         QueueId += Controller->VectorCount) {
+
+        Queue = Controller->Queues[QueueId];
+        KeAcquireSpinLock(&(Queue->Lock));
+        NvmepProcessCompletions(Queue);
+        KeReleaseSpinLock(&(Queue->Lock));
+    }
+
+    if (Controller->MaskInterrupts != FALSE) {
+        NVME_WRITE_REGISTER(Controller,
+                            NVME_INTERRUPT_MASK_CLEAR,
+                            1 << Vector->Index);
+    }
+
+    return InterruptStatusClaimed;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+NvmepDispatchControllerStateChange (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles state change IRPs for an NVMe controller.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Controller - Supplies a pointer to the controller context.
+
+Return Value:
+
+    None. The routine completes the IRP if appropriate.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    if (Irp->Direction == IrpUp) {
+        if (!KSUCCESS(IoGetIrpStatus(Irp))) {
+            return;
+        }
+
+        switch (Irp->MinorCode) {
+        case IrpMinorQueryResources:
+            Status = NvmepProcessResourceRequirements(Irp, Controller);
+            if (!KSUCCESS(Status)) {
+                IoCompleteIrp(NvmeDriver, Irp, Status);
+            }
+
+            break;
+
+        case IrpMinorStartDevice:
+            Status = NvmepStartController(Irp, Controller);
+            if (!KSUCCESS(Status)) {
+                IoCompleteIrp(NvmeDriver, Irp, Status);
+            }
+
+            break;
+
+        case IrpMinorQueryChildren:
+            NvmepEnumerateNamespaces(Irp, Controller);
+            break;
+
+        case IrpMinorIdle:
+        case IrpMinorSuspend:
+        case IrpMinorResume:
+        default:
+            break;
+        }
+    }
+
+    return;
+}
+
+VOID
+NvmepDispatchNamespaceStateChange (
+    PIRP Irp,
+    PNVME_NAMESPACE Namespace
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles state change IRPs for an NVMe namespace.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Namespace - Supplies a pointer to the namespace.
+
+Return Value:
+
+    None. The routine completes the IRP if appropriate.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    if (Irp->Direction == IrpDown) {
+        switch (Irp->MinorCode) {
+        case IrpMinorStartDevice:
+            Namespace->OsDevice = Irp->Device;
+            Status = PmInitialize(Irp->Device);
+            if (!KSUCCESS(Status)) {
+                IoCompleteIrp(NvmeDriver, Irp, Status);
+                break;
+            }
+
+            //
+            // Publish the disk interface.
+            //
+
+            Status = STATUS_SUCCESS;
+            if (Namespace->DiskInterface.DiskToken == NULL) {
+                RtlCopyMemory(&(Namespace->DiskInterface),
+                              &NvmeDiskInterfaceTemplate,
+                              sizeof(DISK_INTERFACE));
+
+                Namespace->DiskInterface.DiskToken = Namespace;
+                Namespace->DiskInterface.BlockSize = Namespace->BlockSize;
+                Namespace->DiskInterface.BlockCount = Namespace->TotalBlocks;
+                Status = IoCreateInterface(&NvmeDiskInterfaceUuid,
+                                           Irp->Device,
+                                           &(Namespace->DiskInterface),
+                                           sizeof(DISK_INTERFACE));
+
+                if (!KSUCCESS(Status)) {
+                    Namespace->DiskInterface.DiskToken = NULL;
+                }
+            }
+
+            IoCompleteIrp(NvmeDriver, Irp, Status);
+            break;
+
+        case IrpMinorQueryResources:
+        case IrpMinorQueryChildren:
+        case IrpMinorIdle:
+        case IrpMinorSuspend:
+        case IrpMinorResume:
+            IoCompleteIrp(NvmeDriver, Irp, STATUS_SUCCESS);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return;
+}
+
+VOID
+NvmepDispatchNamespaceSystemControl (
+    PIRP Irp,
+    PNVME_NAMESPACE Namespace
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles System Control IRPs for an NVMe namespace.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Namespace - Supplies a pointer to the namespace.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVOID Context;
+    PSYSTEM_CONTROL_FILE_OPERATION FileOperation;
+    PSYSTEM_CONTROL_LOOKUP Lookup;
+    PFILE_PROPERTIES Properties;
+    ULONGLONG PropertiesFileSize;
+    KSTATUS Status;
+
+    Context = Irp->U.SystemControl.SystemContext;
+    switch (Irp->MinorCode) {
+    case IrpMinorSystemControlLookup:
+        Lookup = (PSYSTEM_CONTROL_LOOKUP)Context;
+        Status = STATUS_PATH_NOT_FOUND;
+        if (Lookup->Root != FALSE) {
+
+            //
+            // Enable opening of the root as a single file.
+            //
+
+            Properties = &(Lookup->Properties);
+            Properties->FileId = 0;
+            Properties->Type = IoObjectBlockDevice;
+            Properties->HardLinkCount = 1;
+            Properties->BlockSize = Namespace->BlockSize;
+            Properties->BlockCount = Namespace->TotalBlocks;
+            WRITE_INT64_SYNC(&(Properties->FileSize),
+                             Namespace->TotalBlocks << Namespace->BlockShift);
+
+            Status = STATUS_SUCCESS;
+        }
+
+        IoCompleteIrp(NvmeDriver, Irp, Status);
+        break;
+
+    //
+    // Writes to the disk's properties are not allowed. Fail if the data
+    // has changed.
+    //
+
+    case IrpMinorSystemControlWriteFileProperties:
+        FileOperation = (PSYSTEM_CONTROL_FILE_OPERATION)Context;
+        Properties = FileOperation->FileProperties;
+        READ_INT64_SYNC(&(Properties->FileSize), &PropertiesFileSize);
+        if ((Properties->FileId != 0) ||
+            (Properties->Type != IoObjectBlockDevice) ||
+            (Properties->HardLinkCount != 1) ||
+            (Properties->BlockSize != Namespace->BlockSize) ||
+            (Properties->BlockCount != Namespace->TotalBlocks) ||
+            (PropertiesFileSize !=
+             (Namespace->TotalBlocks << Namespace->BlockShift))) {
+
+            Status = STATUS_NOT_SUPPORTED;
+
+        } else {
+            Status = STATUS_SUCCESS;
+        }
+
+        IoCompleteIrp(NvmeDriver, Irp, Status);
+        break;
+
+    //
+    // Do not support hard disk device truncation.
+    //
+
+    case IrpMinorSystemControlTruncate:
+        IoCompleteIrp(NvmeDriver, Irp, STATUS_NOT_SUPPORTED);
+        break;
+
+    //
+    // Gather and return device information.
+    //
+
+    case IrpMinorSystemControlDeviceInformation:
+        break;
+
+    //
+    // Send a flush command to the device upon getting a synchronize request.
+    //
+
+    case IrpMinorSystemControlSynchronize:
+        Status = PmDeviceAddReference(Namespace->OsDevice);
+        if (!KSUCCESS(Status)) {
+            IoCompleteIrp(NvmeDriver, Irp, Status);
+            break;
+        }
+
+        Status = NvmepSynchronizeNamespace(Namespace);
+        PmDeviceReleaseReference(Namespace->OsDevice);
+        IoCompleteIrp(NvmeDriver, Irp, Status);
+        break;
+
+    //
+    // Ignore everything unrecognized.
+    //
+
+    default:
+
+        ASSERT(FALSE);
+
+        break;
+    }
+
+    return;
+}
+
+KSTATUS
+NvmepProcessResourceRequirements (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine filters through the resource requirements presented by the
+    bus for an NVMe controller. With MSI-X it asks for a vector per processor.
+    Otherwise it asks for a single message signaled vector, with the legacy
+    interrupt line as a fallback.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Controller - Supplies a pointer to the NVMe controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PRESOURCE_CONFIGURATION_LIST ConfigurationList;
+    ULONG Index;
+    ULONGLONG LineCharacteristics;
+    PCI_MSI_INFORMATION MsiInformation;
+    PINTERFACE_PCI_MSI MsiInterface;
+    PRESOURCE_REQUIREMENT NextRequirement;
+    PRESOURCE_REQUIREMENT Requirement;
+    PRESOURCE_REQUIREMENT_LIST RequirementList;
+    KSTATUS Status;
+    ULONG VectorCount;
+    ULONGLONG VectorCharacteristics;
+    PRESOURCE_REQUIREMENT VectorRequirement;
+    RESOURCE_REQUIREMENT VectorTemplate;
+
+    ASSERT((Irp->MajorCode == IrpMajorStateChange) &&
+           (Irp->MinorCode == IrpMinorQueryResources));
+
+    //
+    // Initialize a nice interrupt vector requirement in preparation.
+    //
+
+    RtlZeroMemory(&VectorTemplate, sizeof(RESOURCE_REQUIREMENT));
+    VectorTemplate.Type = ResourceTypeInterruptVector;
+    VectorTemplate.Minimum = 0;
+    VectorTemplate.Maximum = -1;
+    VectorTemplate.Length = 1;
+
+    //
+    // Register for the PCI MSI interface, which arrives immediately if the
+    // device supports MSI or MSI-X.
+    //
+
+    if ((Controller->PciMsiFlags &
+         NVME_PCI_MSI_FLAG_INTERFACE_REGISTERED) == 0) {
+
+        Status = IoRegisterForInterfaceNotifications(
+                                &NvmePciMsiInterfaceUuid,
+                                NvmepProcessPciMsiInterfaceChangeNotification,
+                                Irp->Device,
+                                Controller,
+                                TRUE);
+
+        if (!KSUCCESS(Status)) {
+            goto ProcessResourceRequirementsEnd;
+        }
+
+        Controller->PciMsiFlags |= NVME_PCI_MSI_FLAG_INTERFACE_REGISTERED;
+    }
+
+    ConfigurationList = Irp->U.QueryResources.ResourceRequirements;
+    if ((Controller->PciMsiFlags &
+         NVME_PCI_MSI_FLAG_INTERFACE_AVAILABLE) != 0) {
+
+        //
+        // Figure out how many vectors to ask for. MSI-X can aim each vector
+        // at a different processor, so ask for one per processor. Plain MSI
+        // gets a single vector shared by every queue.
+        //
+
+        VectorCount = 1;
+        Controller->PciMsiFlags &= ~NVME_PCI_MSI_FLAG_EXTENDED;
+        MsiInterface = &(Controller->PciMsiInterface);
+        RtlZeroMemory(&MsiInformation, sizeof(PCI_MSI_INFORMATION));
+        MsiInformation.Version = PCI_MSI_INTERFACE_INFORMATION_VERSION;
+        MsiInformation.MsiType = PciMsiTypeExtended;
+        Status = MsiInterface->GetSetInformation(MsiInterface->DeviceToken,
+                                                 &MsiInformation,
+                                                 FALSE);
+
+        if ((KSUCCESS(Status)) && (MsiInformation.MaxVectorCount != 0)) {
+            Controller->PciMsiFlags |= NVME_PCI_MSI_FLAG_EXTENDED;
+            VectorCount = KeGetActiveProcessorCount();
+            if (VectorCount > MsiInformation.MaxVectorCount) {
+                VectorCount = MsiInformation.MaxVectorCount;
+            }
+
+            if (VectorCount > NVME_MAX_VECTORS) {
+                VectorCount = NVME_MAX_VECTORS;
+            }
+        }
+
+        Controller->RequestedVectorCount = VectorCount;
+
+        //
+        // Add the vectors to each configuration. The first one takes the
+        // legacy lines as alternatives in case message signaled vectors
+        // cannot be had.
+        //
+
+        RequirementList = IoGetNextResourceConfiguration(ConfigurationList,
+                                                         NULL);
+
+        while (RequirementList != NULL) {
+            VectorTemplate.Characteristics = INTERRUPT_VECTOR_EDGE_TRIGGERED;
+            VectorTemplate.OwningRequirement = NULL;
+            Status = IoCreateAndAddResourceRequirement(&VectorTemplate,
+                                                       RequirementList,
+                                                       &VectorRequirement);
+
+            if (!KSUCCESS(Status)) {
+                goto ProcessResourceRequirementsEnd;
+            }
+
+            Requirement = IoGetNextResourceRequirement(RequirementList, NULL);
+            while (Requirement != NULL) {
+                NextRequirement = IoGetNextResourceRequirement(RequirementList,
+                                                               Requirement);
+
+                if (Requirement->Type != ResourceTypeInterruptLine) {
+                    Requirement = NextRequirement;
+                    continue;
+                }
+
+                VectorCharacteristics = 0;
+                LineCharacteristics = Requirement->Characteristics;
+                if ((LineCharacteristics & INTERRUPT_LINE_ACTIVE_LOW) != 0) {
+                    VectorCharacteristics |= INTERRUPT_VECTOR_ACTIVE_LOW;
+                }
+
+                if ((LineCharacteristics & INTERRUPT_LINE_ACTIVE_HIGH) != 0) {
+                    VectorCharacteristics |= INTERRUPT_VECTOR_ACTIVE_HIGH;
+                }
+
+                if ((LineCharacteristics &
+                     INTERRUPT_LINE_EDGE_TRIGGERED) != 0) {
+
+                    VectorCharacteristics |= INTERRUPT_VECTOR_EDGE_TRIGGERED;
+                }
+
+                VectorTemplate.Characteristics = VectorCharacteristics;
+                VectorTemplate.OwningRequirement = Requirement;
+                Status = IoCreateAndAddResourceRequirementAlternative(
+                                                            &VectorTemplate,
+                                                            VectorRequirement);
+
+                if (!KSUCCESS(Status)) {
+                    goto ProcessResourceRequirementsEnd;
+                }
+
+                Requirement = NextRequirement;
+            }
+
+            VectorTemplate.Characteristics = INTERRUPT_VECTOR_EDGE_TRIGGERED;
+            VectorTemplate.OwningRequirement = NULL;
+            for (Index = 1; Index < VectorCount; Index += 1) {
+                Status = IoCreateAndAddResourceRequirement(&VectorTemplate,
+                                                           RequirementList,
+                                                           NULL);
+
+                if (!KSUCCESS(Status)) {
+                    goto ProcessResourceRequirementsEnd;
+                }
+            }
+
+            RequirementList = IoGetNextResourceConfiguration(ConfigurationList,
+                                                             RequirementList);
+        }
+
+        Controller->PciMsiFlags |= NVME_PCI_MSI_FLAG_RESOURCES_REQUESTED;
+
+    //
+    // Otherwise stick with the legacy interrupt line.
+    //
+
+    } else {
+        Status = IoCreateAndAddInterruptVectorsForLines(ConfigurationList,
+                                                        &VectorTemplate);
+
+        if (!KSUCCESS(Status)) {
+            goto ProcessResourceRequirementsEnd;
+        }
+    }
+
+    Status = STATUS_SUCCESS;
+
+ProcessResourceRequirementsEnd:
+    return Status;
+}
+
+KSTATUS
+NvmepStartController (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts an NVMe controller device. It resets the controller,
+    sets up the admin queue, and creates the I/O queues.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Controller - Supplies a pointer to the NVMe controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    BOOL AdminLockHeld;
+    ULONG AdminQueueAttributes;
+    ULONG AlignmentOffset;
+    PRESOURCE_ALLOCATION Allocation;
+    PRESOURCE_ALLOCATION_LIST AllocationList;
+    ULONG CapabilitiesHigh;
+    ULONG CapabilitiesLow;
+    ULONG Configuration;
+    PRESOURCE_ALLOCATION ControllerBase;
+    PHYSICAL_ADDRESS EndAddress;
+    PIO_BUFFER_FRAGMENT Fragment;
+    ULONG IoBufferFlags;
+    PRESOURCE_ALLOCATION LineAllocation;
+    ULONGLONG LineVector;
+    ULONG MessageVectorCount;
+    ULONG PageSize;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    PNVME_QUEUE Queue;
+    ULONG Size;
+    KSTATUS Status;
+    ULONG Timeout;
+
+    AdminLockHeld = FALSE;
+    ControllerBase = NULL;
+    LineVector = 0;
+    MessageVectorCount = 0;
+    Status = PmInitialize(Irp->Device);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Status = PmDeviceAddReference(Irp->Device);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    //
+    // Loop through the allocated resources to get the controller base and the
+    // interrupts.
+    //
+
+    Controller->InterruptLine = INVALID_INTERRUPT_LINE;
+    Controller->InterruptResourcesFound = FALSE;
+    AllocationList = Irp->U.StartDevice.ProcessorLocalResources;
+    Allocation = IoGetNextResourceAllocation(AllocationList, NULL);
+    while (Allocation != NULL) {
+
+        //
+        // If the resource is an interrupt vector the presense of an owning
+        // interrupt line allocation will dictate whether or not MSI/MSI-X
+        // is used versus legacy interrupts.
+        //
+
+        if (Allocation->Type == ResourceTypeInterruptVector) {
+            LineAllocation = Allocation->OwningAllocation;
+            if (LineAllocation == NULL) {
+
+                ASSERT((Controller->PciMsiFlags &
+                        NVME_PCI_MSI_FLAG_RESOURCES_REQUESTED) != 0);
+
+                if (MessageVectorCount < NVME_MAX_VECTORS) {
+                    Controller->Vectors[MessageVectorCount].Vector =
+                                                        Allocation->Allocation;
+
+                    MessageVectorCount += 1;
+                }
+
+            } else {
+
+                ASSERT(LineAllocation->Type == ResourceTypeInterruptLine);
+
+                Controller->InterruptLine = LineAllocation->Allocation;
+                LineVector = Allocation->Allocation;
+            }
+
+            Controller->InterruptResourcesFound = TRUE;
+
+        //
+        // The registers live in the first memory BAR.
+        //
+
+        } else if (Allocation->Type == ResourceTypePhysicalAddressSpace) {
+            if ((ControllerBase == NULL) && (Allocation->Length != 0)) {
+                ControllerBase = Allocation;
+            }
+        }
+
+        Allocation = IoGetNextResourceAllocation(AllocationList, Allocation);
+    }
+
+    if ((ControllerBase == NULL) ||
+        (Controller->InterruptResourcesFound == FALSE)) {
+
+        Status = STATUS_INVALID_CONFIGURATION;
+        goto StartControllerEnd;
+    }
+
+    //
+    // If the first vector fell back to the legacy line, the other message
+    // signaled vectors are of no use.
+    //
+
+    if (Controller->InterruptLine != INVALID_INTERRUPT_LINE) {
+        Controller->VectorCount = 1;
+        Controller->Vectors[0].Vector = LineVector;
+        Controller->MaskInterrupts = TRUE;
+
+    } else {
+        Controller->PciMsiFlags |= NVME_PCI_MSI_FLAG_RESOURCES_ALLOCATED;
+        Controller->VectorCount = MessageVectorCount;
+        Controller->MaskInterrupts = TRUE;
+        if ((Controller->PciMsiFlags & NVME_PCI_MSI_FLAG_EXTENDED) != 0) {
+            Controller->MaskInterrupts = FALSE;
+
+        } else {
+            Controller->VectorCount = 1;
+        }
+    }
+
+    //
+    // Map the controller.
+    //
+
+    if (Controller->ControllerBase == NULL) {
+        PageSize = MmPageSize();
+        PhysicalAddress = ControllerBase->Allocation;
+        EndAddress = PhysicalAddress + ControllerBase->Length;
+        PhysicalAddress = ALIGN_RANGE_DOWN(PhysicalAddress, PageSize);
+        AlignmentOffset = ControllerBase->Allocation - PhysicalAddress;
+        EndAddress = ALIGN_RANGE_UP(EndAddress, PageSize);
+        Size = (ULONG)(EndAddress - PhysicalAddress);
+        Controller->ControllerBase = MmMapPhysicalAddress(PhysicalAddress,
+                                                          Size,
+                                                          TRUE,
+                                                          FALSE,
+                                                          TRUE);
+
+        if (Controller->ControllerBase == NULL) {
+            Status = STATUS_NO_MEMORY;
+            goto StartControllerEnd;
+        }
+
+        Controller->ControllerBase += AlignmentOffset;
+    }
+
+    //
+    // Read the capabilities. Only the NVM command set and 4KB memory pages
+    // are supported.
+    //
+
+    CapabilitiesLow = NVME_READ_REGISTER(Controller, NVME_CAPABILITIES);
+    CapabilitiesHigh = NVME_READ_REGISTER(Controller, NVME_CAPABILITIES_HIGH);
+    if (((CapabilitiesHigh & NVME_CAPABILITY_HIGH_NVM_COMMAND_SET) == 0) ||
+        (((CapabilitiesHigh & NVME_CAPABILITY_HIGH_MIN_PAGE_SIZE_MASK) >>
+          NVME_CAPABILITY_HIGH_MIN_PAGE_SIZE_SHIFT) != 0)) {
+
+        RtlDebugPrint("NVMe: Unsupported controller capabilities 0x%x%08x.\n",
+                      CapabilitiesHigh,
+                      CapabilitiesLow);
+
+        Status = STATUS_NOT_SUPPORTED;
+        goto StartControllerEnd;
+    }
+
+    Controller->MaxQueueDepth =
+                    (CapabilitiesLow & NVME_CAPABILITY_MAX_QUEUE_ENTRIES_MASK) +
+                    1;
+
+    Controller->DoorbellStride =
+         sizeof(ULONG) <<
+         (CapabilitiesHigh & NVME_CAPABILITY_HIGH_DOORBELL_STRIDE_MASK);
+
+    Timeout = (CapabilitiesLow & NVME_CAPABILITY_TIMEOUT_MASK) >>
+              NVME_CAPABILITY_TIMEOUT_SHIFT;
+
+    if (Timeout == 0) {
+        Timeout = 1;
+    }
+
+    Controller->ReadyTimeout = Timeout * NVME_READY_TIMEOUT_UNIT;
+
+    //
+    // Disable the controller, which also throws away any I/O queues left
+    // from a previous start.
+    //
+
+    Controller->IoQueueCount = 0;
+    Configuration = NVME_READ_REGISTER(Controller,
+                                       NVME_CONTROLLER_CONFIGURATION);
+
+    if ((Configuration & NVME_CONFIGURATION_ENABLE) != 0) {
+        Configuration &= ~NVME_CONFIGURATION_ENABLE;
+        NVME_WRITE_REGISTER(Controller,
+                            NVME_CONTROLLER_CONFIGURATION,
+                            Configuration);
+    }
+
+    Status = NvmepWaitForReady(Controller, FALSE);
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    //
+    // Set up the admin queue and the identify buffer.
+    //
+
+    if (Controller->Queues[0] == NULL) {
+        Controller->Queues[0] = NvmepCreateQueue(Controller,
+                                                 0,
+                                                 NVME_ADMIN_QUEUE_DEPTH);
+
+        if (Controller->Queues[0] == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto StartControllerEnd;
+        }
+    }
+
+    if (Controller->IdentifyBuffer == NULL) {
+        IoBufferFlags = IO_BUFFER_FLAG_PHYSICALLY_CONTIGUOUS |
+                        IO_BUFFER_FLAG_MAP_NON_CACHED;
+
+        Controller->IdentifyBuffer = MmAllocateNonPagedIoBuffer(
+                                                            0,
+                                                            MAX_ULONGLONG,
+                                                            NVME_PAGE_SIZE,
+                                                            NVME_IDENTIFY_SIZE,
+                                                            IoBufferFlags);
+
+        if (Controller->IdentifyBuffer == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto StartControllerEnd;
+        }
+
+        Fragment = &(Controller->IdentifyBuffer->Fragment[0]);
+        Controller->Identify = Fragment->VirtualAddress;
+        Controller->IdentifyPhysicalAddress = Fragment->PhysicalAddress;
+    }
+
+    Queue = Controller->Queues[0];
+    NvmepResetQueue(Queue);
+    AdminQueueAttributes = (Queue->Depth - 1) |
+                           ((Queue->Depth - 1) <<
+                            NVME_ADMIN_QUEUE_COMPLETION_SIZE_SHIFT);
+
+    NVME_WRITE_REGISTER(Controller,
+                        NVME_ADMIN_QUEUE_ATTRIBUTES,
+                        AdminQueueAttributes);
+
+    NVME_WRITE_REGISTER(Controller,
+                        NVME_ADMIN_SUBMISSION_QUEUE,
+                        (ULONG)(Queue->SubmissionQueuePhysicalAddress));
+
+    NVME_WRITE_REGISTER(Controller,
+                        NVME_ADMIN_SUBMISSION_QUEUE_HIGH,
+                        (ULONG)(Queue->SubmissionQueuePhysicalAddress >> 32));
+
+    NVME_WRITE_REGISTER(Controller,
+                        NVME_ADMIN_COMPLETION_QUEUE,
+                        (ULONG)(Queue->CompletionQueuePhysicalAddress));
+
+    NVME_WRITE_REGISTER(Controller,
+                        NVME_ADMIN_COMPLETION_QUEUE_HIGH,
+                        (ULONG)(Queue->CompletionQueuePhysicalAddress >> 32));
+
+    //
+    // Admin commands complete through interrupts, so hook those up before
+    // turning the controller on.
+    //
+
+    Status = NvmepConnectInterrupts(Irp, Controller);
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    Configuration =
+        (NVME_SUBMISSION_ENTRY_SHIFT <<
+         NVME_CONFIGURATION_SUBMISSION_ENTRY_SIZE_SHIFT) |
+        (NVME_COMPLETION_ENTRY_SHIFT <<
+         NVME_CONFIGURATION_COMPLETION_ENTRY_SIZE_SHIFT) |
+        ((NVME_PAGE_SHIFT - 12) << NVME_CONFIGURATION_PAGE_SIZE_SHIFT) |
+        NVME_CONFIGURATION_ENABLE;
+
+    NVME_WRITE_REGISTER(Controller,
+                        NVME_CONTROLLER_CONFIGURATION,
+                        Configuration);
+
+    Status = NvmepWaitForReady(Controller, TRUE);
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    KeAcquireQueuedLock(Controller->AdminLock);
+    AdminLockHeld = TRUE;
+    Status = NvmepIdentifyController(Controller);
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    Status = NvmepCreateIoQueues(Controller);
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    Status = STATUS_SUCCESS;
+
+StartControllerEnd:
+    if (AdminLockHeld != FALSE) {
+        KeReleaseQueuedLock(Controller->AdminLock);
+    }
+
+    PmDeviceReleaseReference(Irp->Device);
+    return Status;
+}
+
+KSTATUS
+NvmepConnectInterrupts (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine connects the controller's interrupt vectors and, for message
+    signaled interrupts, programs and enables them. With MSI-X each vector is
+    aimed at the processor whose queue it serves.
+
+Arguments:
+
+    Irp - Supplies a pointer to the start device IRP.
+
+    Controller - Supplies a pointer to the NVMe controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    IO_CONNECT_INTERRUPT_PARAMETERS Connect;
+    ULONG Index;
+    PCI_MSI_INFORMATION MsiInformation;
+    PINTERFACE_PCI_MSI MsiInterface;
+    PCI_MSI_TYPE MsiType;
+    ULONG ProcessorCount;
+    PROCESSOR_SET ProcessorSet;
+    KSTATUS Status;
+    PNVME_VECTOR Vector;
+
+    for (Index = 0; Index < Controller->VectorCount; Index += 1) {
+        Vector = &(Controller->Vectors[Index]);
+        if (Vector->InterruptHandle != INVALID_HANDLE) {
+            continue;
+        }
+
+        RtlZeroMemory(&Connect, sizeof(IO_CONNECT_INTERRUPT_PARAMETERS));
+        Connect.Version = IO_CONNECT_INTERRUPT_PARAMETERS_VERSION;
+        Connect.Device = Irp->Device;
+        Connect.LineNumber = Controller->InterruptLine;
+        Connect.Vector = Vector->Vector;
+        Connect.InterruptServiceRoutine = NvmeInterruptService;
+        Connect.DispatchServiceRoutine = NvmeInterruptServiceDpc;
+        Connect.Context = Vector;
+        Connect.Interrupt = &(Vector->InterruptHandle);
+        Status = IoConnectInterrupt(&Connect);
+        if (!KSUCCESS(Status)) {
+            goto ConnectInterruptsEnd;
+        }
+    }
+
+    if (Controller->InterruptLine != INVALID_INTERRUPT_LINE) {
+        Status = STATUS_SUCCESS;
+        goto ConnectInterruptsEnd;
+    }
+
+    ASSERT((Controller->PciMsiFlags &
+            NVME_PCI_MSI_FLAG_RESOURCES_ALLOCATED) != 0);
+
+    MsiInterface = &(Controller->PciMsiInterface);
+    if ((Controller->PciMsiFlags & NVME_PCI_MSI_FLAG_EXTENDED) != 0) {
+        MsiType = PciMsiTypeExtended;
+        ProcessorCount = KeGetActiveProcessorCount();
+        ProcessorSet.Target = ProcessorTargetSingleProcessor;
+        for (Index = 0; Index < Controller->VectorCount; Index += 1) {
+            ProcessorSet.U.Number = Index % ProcessorCount;
+            Status = MsiInterface->SetVectors(MsiInterface->DeviceToken,
+                                              MsiType,
+                                              Controller->Vectors[Index].Vector,
+                                              Index,
+                                              1,
+                                              &ProcessorSet);
+
+            if (!KSUCCESS(Status)) {
+                goto ConnectInterruptsEnd;
+            }
+        }
+
+    } else {
+        MsiType = PciMsiTypeBasic;
+        ProcessorSet.Target = ProcessorTargetAny;
+        Status = MsiInterface->SetVectors(MsiInterface->DeviceToken,
+                                          MsiType,
+                                          Controller->Vectors[0].Vector,
+                                          0,
+                                          1,
+                                          &ProcessorSet);
+
+        if (!KSUCCESS(Status)) {
+            goto ConnectInterruptsEnd;
+        }
+    }
+
+    RtlZeroMemory(&MsiInformation, sizeof(PCI_MSI_INFORMATION));
+    MsiInformation.Version = PCI_MSI_INTERFACE_INFORMATION_VERSION;
+    MsiInformation.MsiType = MsiType;
+    MsiInformation.Flags = PCI_MSI_INTERFACE_FLAG_ENABLED;
+    MsiInformation.VectorCount = Controller->VectorCount;
+    Status = MsiInterface->GetSetInformation(MsiInterface->DeviceToken,
+                                             &MsiInformation,
+                                             TRUE);
+
+ConnectInterruptsEnd:
+    return Status;
+}
+
+KSTATUS
+NvmepWaitForReady (
+    PNVME_CONTROLLER Controller,
+    BOOL Ready
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits for the controller to report that it is ready or that
+    it has finished disabling.
+
+Arguments:
+
+    Controller - Supplies a pointer to the NVMe controller.
+
+    Ready - Supplies a boolean indicating whether to wait for the ready bit
+        to set (TRUE) or clear (FALSE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG ControllerStatus;
+    ULONG Expected;
+    ULONGLONG Timeout;
+
+    Expected = 0;
+    if (Ready != FALSE) {
+        Expected = NVME_STATUS_READY;
+    }
+
+    Timeout = KeGetRecentTimeCounter() +
+              KeConvertMicrosecondsToTimeTicks(Controller->ReadyTimeout);
+
+    do {
+        ControllerStatus = NVME_READ_REGISTER(Controller,
+                                              NVME_CONTROLLER_STATUS);
+
+        if ((Ready != FALSE) &&
+            ((ControllerStatus & NVME_STATUS_FATAL) != 0)) {
+
+            RtlDebugPrint("NVMe: Controller fatal status.\n");
+            return STATUS_DEVICE_IO_ERROR;
+        }
+
+        if ((ControllerStatus & NVME_STATUS_READY) == Expected) {
+            return STATUS_SUCCESS;
+        }
+
+        KeDelayExecution(FALSE, FALSE, NVME_POLL_INTERVAL);
+
+    } while (KeGetRecentTimeCounter() <= Timeout);
+
+    RtlDebugPrint("NVMe: Timed out waiting for ready %d.\n", Ready);
+    return STATUS_TIMEOUT;
+}
+
+KSTATUS
+NvmepIdentifyController (
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends an identify controller command and records the
+    controller's transfer limit, namespace count, and cache. This routine
+    assumes the admin lock is held.
+
+Arguments:
+
+    Controller - Supplies a pointer to the NVMe controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    NVME_SUBMISSION_ENTRY Entry;
+    PUCHAR Identify;
+    ULONG MaxTransferShift;
+    KSTATUS Status;
+
+    RtlZeroMemory(&Entry, sizeof(NVME_SUBMISSION_ENTRY));
+    Entry.CommandDword0 = NvmeAdminIdentify;
+    Entry.Prp1 = Controller->IdentifyPhysicalAddress;
+    Entry.CommandDword10 = NVME_IDENTIFY_CONTROLLER;
+    Status = NvmepExecuteCommand(Controller->Queues[0], &Entry, NULL);
+    if (!KSUCCESS(Status)) {
+        RtlDebugPrint("NVMe: Identify controller failed: %d\n", Status);
+        return Status;
+    }
+
+    Identify = Controller->Identify;
+    Controller->NamespaceCount =
+           *((PULONG)(Identify + NVME_IDENTIFY_CONTROLLER_NAMESPACE_COUNT));
+
+    Controller->VolatileWriteCache = FALSE;
+    if ((Identify[NVME_IDENTIFY_CONTROLLER_VOLATILE_WRITE_CACHE] &
+         NVME_VOLATILE_WRITE_CACHE_PRESENT) != 0) {
+
+        Controller->VolatileWriteCache = TRUE;
+    }
+
+    //
+    // The maximum transfer is a power of two multiple of the minimum page
+    // size, which is the 4KB page size in use. Zero means no limit.
+    //
+
+    Controller->MaxTransferSize = NVME_MAX_TRANSFER_SIZE;
+    MaxTransferShift = Identify[NVME_IDENTIFY_CONTROLLER_MAX_TRANSFER];
+    if ((MaxTransferShift != 0) &&
+        ((NVME_PAGE_SHIFT + MaxTransferShift) <
+         (sizeof(ULONG) * BITS_PER_BYTE)) &&
+        ((NVME_PAGE_SIZE << MaxTransferShift) < NVME_MAX_TRANSFER_SIZE)) {
+
+        Controller->MaxTransferSize = NVME_PAGE_SIZE << MaxTransferShift;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+NvmepCreateIoQueues (
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates one I/O queue pair per processor, or as many as the
+    controller will allow. This routine assumes the admin lock is held.
+
+Arguments:
+
+    Controller - Supplies a pointer to the NVMe controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG Allocated;
+    ULONG Depth;
+    NVME_SUBMISSION_ENTRY Entry;
+    PNVME_QUEUE Queue;
+    ULONG QueueCount;
+    ULONG QueueId;
+    ULONG Result;
+    KSTATUS Status;
+
+    //
+    // Ask for a queue pair per processor. The controller may grant fewer.
+    //
+
+    QueueCount = KeGetActiveProcessorCount();
+    if (QueueCount > NVME_MAX_IO_QUEUES) {
+        QueueCount = NVME_MAX_IO_QUEUES;
+    }
+
+    RtlZeroMemory(&Entry, sizeof(NVME_SUBMISSION_ENTRY));
+    Entry.CommandDword0 = NvmeAdminSetFeatures;
+    Entry.CommandDword10 = NVME_FEATURE_NUMBER_OF_QUEUES;
+    Entry.CommandDword11 = ((QueueCount - 1) <<
+                            NVME_QUEUE_COUNT_COMPLETION_SHIFT) |
+                           (QueueCount - 1);
+
+    Status = NvmepExecuteCommand(Controller->Queues[0], &Entry, &Result);
+    if (!KSUCCESS(Status)) {
+        RtlDebugPrint("NVMe: Set queue count failed: %d\n", Status);
+        return Status;
+    }
+
+    Allocated = (Result & NVME_QUEUE_COUNT_MASK) + 1;
+    if (QueueCount > Allocated) {
+        QueueCount = Allocated;
+    }
+
+    Allocated = ((Result >> NVME_QUEUE_COUNT_COMPLETION_SHIFT) &
+                 NVME_QUEUE_COUNT_MASK) + 1;
+
+    if (QueueCount > Allocated) {
+        QueueCount = Allocated;
+    }
+
+    Depth = NVME_IO_QUEUE_DEPTH;
+    if (Depth > Controller->MaxQueueDepth) {
+        Depth = Controller->MaxQueueDepth;
+    }
+
+    for (QueueId = 1; QueueId <= QueueCount; QueueId += 1) {
+        Queue = Controller->Queues[QueueId];
+        if (Queue == NULL) {
+            Queue = NvmepCreateQueue(Controller, QueueId, Depth);
+            if (Queue == NULL) {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+
+            Controller->Queues[QueueId] = Queue;
+        }
+
+        NvmepResetQueue(Queue);
+        Queue->VectorIndex = (QueueId - 1) % Controller->VectorCount;
+
+        //
+        // The completion queue has to exist before the submission queue that
+        // feeds it.
+        //
+
+        RtlZeroMemory(&Entry, sizeof(NVME_SUBMISSION_ENTRY));
+        Entry.CommandDword0 = NvmeAdminCreateCompletionQueue;
+        Entry.Prp1 = Queue->CompletionQueuePhysicalAddress;
+        Entry.CommandDword10 = ((Queue->Depth - 1) <<
+                                NVME_CREATE_QUEUE_SIZE_SHIFT) |
+                               QueueId;
+
+        Entry.CommandDword11 =
+                  (Queue->VectorIndex <<
+                   NVME_CREATE_COMPLETION_QUEUE_VECTOR_SHIFT) |
+                  NVME_CREATE_COMPLETION_QUEUE_INTERRUPTS_ENABLED |
+                  NVME_CREATE_QUEUE_PHYSICALLY_CONTIGUOUS;
+
+        Status = NvmepExecuteCommand(Controller->Queues[0], &Entry, NULL);
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        RtlZeroMemory(&Entry, sizeof(NVME_SUBMISSION_ENTRY));
+        Entry.CommandDword0 = NvmeAdminCreateSubmissionQueue;
+        Entry.Prp1 = Queue->SubmissionQueuePhysicalAddress;
+        Entry.CommandDword10 = ((Queue->Depth - 1) <<
+                                NVME_CREATE_QUEUE_SIZE_SHIFT) |
+                               QueueId;
+
+        Entry.CommandDword11 =
+                       (QueueId <<
+                        NVME_CREATE_SUBMISSION_QUEUE_COMPLETION_QUEUE_SHIFT) |
+                       NVME_CREATE_QUEUE_PHYSICALLY_CONTIGUOUS;
+
+        Status = NvmepExecuteCommand(Controller->Queues[0], &Entry, NULL);
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        //
+        // Publish the queue. The interrupt service routines only look at
+        // queues below the count.
+        //
+
+        RtlMemoryBarrier();
+        Controller->IoQueueCount = QueueId;
+    }
+
+    //
+    // Make do with however many queues were created.
+    //
+
+    if (Controller->IoQueueCount == 0) {
+        RtlDebugPrint("NVMe: Failed to create I/O queues: %d\n", Status);
+        return Status;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+PNVME_QUEUE
+NvmepCreateQueue (
+    PNVME_CONTROLLER Controller,
+    ULONG QueueId,
+    ULONG Depth
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates a submission and completion queue pair along with
+    the PRP lists for its commands.
+
+Arguments:
+
+    Controller - Supplies a pointer to the NVMe controller.
+
+    QueueId - Supplies the queue ID.
+
+    Depth - Supplies the number of entries in each queue.
+
+Return Value:
+
+    Returns a pointer to the new queue on success.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    ULONG AllocationSize;
+    PNVME_COMMAND Command;
+    ULONG CommandCount;
+    ULONG CompletionOffset;
+    ULONG Index;
+    ULONG IoBufferFlags;
+    PUCHAR Memory;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    ULONG PrpListOffset;
+    PNVME_QUEUE Queue;
+    KSTATUS Status;
+
+    Queue = MmAllocateNonPagedPool(sizeof(NVME_QUEUE), NVME_ALLOCATION_TAG);
+    if (Queue == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateQueueEnd;
+    }
+
+    RtlZeroMemory(Queue, sizeof(NVME_QUEUE));
+    Queue->Controller = Controller;
+    Queue->QueueId = QueueId;
+    Queue->Depth = Depth;
+    KeInitializeSpinLock(&(Queue->Lock));
+    Queue->CommandEvent = KeCreateEvent(NULL);
+    if (Queue->CommandEvent == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateQueueEnd;
+    }
+
+    //
+    // Keeping fewer commands outstanding than there are queue entries means
+    // the submission queue can never fill up.
+    //
+
+    CommandCount = Depth - 1;
+    if (CommandCount > NVME_MAX_QUEUE_COMMANDS) {
+        CommandCount = NVME_MAX_QUEUE_COMMANDS;
+    }
+
+    Queue->CommandCount = CommandCount;
+
+    //
+    // Lay out the submission queue, the completion queue, and a PRP list for
+    // each command plus one for polled I/O. Each queue starts on a page.
+    //
+
+    CompletionOffset = ALIGN_RANGE_UP(Depth << NVME_SUBMISSION_ENTRY_SHIFT,
+                                      NVME_PAGE_SIZE);
+
+    PrpListOffset = ALIGN_RANGE_UP(CompletionOffset +
+                                   (Depth << NVME_COMPLETION_ENTRY_SHIFT),
+                                   NVME_PAGE_SIZE);
+
+    AllocationSize = PrpListOffset +
+                     ((CommandCount + 1) * NVME_PRP_LIST_SIZE);
+
+    IoBufferFlags = IO_BUFFER_FLAG_PHYSICALLY_CONTIGUOUS |
+                    IO_BUFFER_FLAG_MAP_NON_CACHED;
+
+    Queue->IoBuffer = MmAllocateNonPagedIoBuffer(0,
+                                                 MAX_ULONGLONG,
+                                                 NVME_PAGE_SIZE,
+                                                 AllocationSize,
+                                                 IoBufferFlags);
+
+    if (Queue->IoBuffer == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateQueueEnd;
+    }
+
+    ASSERT(Queue->IoBuffer->FragmentCount == 1);
+
+    Memory = Queue->IoBuffer->Fragment[0].VirtualAddress;
+    PhysicalAddress = Queue->IoBuffer->Fragment[0].PhysicalAddress;
+    RtlZeroMemory(Memory, AllocationSize);
+    Queue->SubmissionQueue = (PNVME_SUBMISSION_ENTRY)Memory;
+    Queue->SubmissionQueuePhysicalAddress = PhysicalAddress;
+    Queue->CompletionQueue =
+                        (PNVME_COMPLETION_ENTRY)(Memory + CompletionOffset);
+
+    Queue->CompletionQueuePhysicalAddress = PhysicalAddress + CompletionOffset;
+    for (Index = 0; Index <= CommandCount; Index += 1) {
+        if (Index == CommandCount) {
+            Command = &(Queue->PolledCommand);
+
+        } else {
+            Command = &(Queue->Commands[Index]);
+        }
+
+        Command->PrpList = (PULONGLONG)(Memory + PrpListOffset +
+                                        (Index * NVME_PRP_LIST_SIZE));
+
+        Command->PrpListPhysicalAddress = PhysicalAddress + PrpListOffset +
+                                          (Index * NVME_PRP_LIST_SIZE);
+    }
+
+    Status = STATUS_SUCCESS;
+
+CreateQueueEnd:
+    if (!KSUCCESS(Status)) {
+        if (Queue != NULL) {
+            if (Queue->IoBuffer != NULL) {
+                MmFreeIoBuffer(Queue->IoBuffer);
+            }
+
+            if (Queue->CommandEvent != NULL) {
+                KeDestroyEvent(Queue->CommandEvent);
+            }
+
+            MmFreeNonPagedPool(Queue);
+            Queue = NULL;
+        }
+    }
+
+    return Queue;
+}
+
+VOID
+NvmepResetQueue (
+    PNVME_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns a queue pair to its initial empty state before it is
+    handed to the controller.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNVME_COMMAND Command;
+    ULONG Index;
+
+    RtlZeroMemory(Queue->SubmissionQueue,
+                  Queue->Depth << NVME_SUBMISSION_ENTRY_SHIFT);
+
+    RtlZeroMemory(Queue->CompletionQueue,
+                  Queue->Depth << NVME_COMPLETION_ENTRY_SHIFT);
+
+    Queue->SubmissionTail = 0;
+    Queue->CompletionHead = 0;
+    Queue->Phase = NVME_COMPLETION_STATUS_PHASE;
+    Queue->BusyCommands = 0;
+    for (Index = 0; Index < Queue->CommandCount; Index += 1) {
+        Command = &(Queue->Commands[Index]);
+        Command->Irp = NULL;
+        Command->IoSize = 0;
+        Command->Done = FALSE;
+        Command->Abandoned = FALSE;
+    }
+
+    return;
+}
+
+VOID
+NvmepEnumerateNamespaces (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine enumerates the active namespaces of an NVMe controller.
+
+Arguments:
+
+    Irp - Supplies a pointer to the query children IRP.
+
+    Controller - Supplies a pointer to the NVMe controller.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG ChildCount;
+    PDEVICE Children[NVME_MAX_NAMESPACES];
+    ULONG Index;
+    PNVME_NAMESPACE Namespace;
+    ULONG NamespaceCount;
+    KSTATUS Status;
+
+    Status = PmDeviceAddReference(Irp->Device);
+    if (!KSUCCESS(Status)) {
+        IoCompleteIrp(NvmeDriver, Irp, Status);
+        return;
+    }
+
+    ChildCount = 0;
+    NamespaceCount = Controller->NamespaceCount;
+    if (NamespaceCount > NVME_MAX_NAMESPACES) {
+        NamespaceCount = NVME_MAX_NAMESPACES;
+    }
+
+    for (Index = 0; Index < NamespaceCount; Index += 1) {
+        Status = NvmepIdentifyNamespace(Controller, Index + 1);
+        Namespace = Controller->Namespaces[Index];
+        if (Namespace == NULL) {
+            continue;
+        }
+
+        if (!KSUCCESS(Status)) {
+            Namespace->Device = NULL;
+
+        } else if (Namespace->Device == NULL) {
+            Status = IoCreateDevice(NvmeDriver,
+                                    Namespace,
+                                    Irp->Device,
+                                    "Disk",
+                                    DISK_CLASS_ID,
+                                    NULL,
+                                    &(Namespace->Device));
+
+            if (!KSUCCESS(Status)) {
+                Namespace->Device = NULL;
+            }
+        }
+
+        if (Namespace->Device != NULL) {
+            Children[ChildCount] = Namespace->Device;
+            ChildCount += 1;
+        }
+    }
+
+    if (ChildCount != 0) {
+        Status = IoMergeChildArrays(Irp,
+                                    Children,
+                                    ChildCount,
+                                    NVME_ALLOCATION_TAG);
+
+        if (!KSUCCESS(Status)) {
+            goto EnumerateNamespacesEnd;
+        }
+    }
+
+    Status = STATUS_SUCCESS;
+
+EnumerateNamespacesEnd:
+    PmDeviceReleaseReference(Irp->Device);
+    IoCompleteIrp(NvmeDriver, Irp, Status);
+    return;
+}
+
+KSTATUS
+NvmepIdentifyNamespace (
+    PNVME_CONTROLLER Controller,
+    ULONG NamespaceId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends an identify namespace command and records the
+    namespace's size and block size, creating its context if needed.
+
+Arguments:
+
+    Controller - Supplies a pointer to the NVMe controller.
+
+    NamespaceId - Supplies the namespace to identify.
+
+Return Value:
+
+    STATUS_SUCCESS if the namespace is active and usable.
+
+    STATUS_NO_SUCH_DEVICE if the namespace is inactive.
+
+    Other error codes on failure.
+
+--*/
+
+{
+
+    ULONG BlockShift;
+    NVME_SUBMISSION_ENTRY Entry;
+    ULONG FormatIndex;
+    PUCHAR Identify;
+    ULONG LbaFormat;
+    PNVME_NAMESPACE Namespace;
+    KSTATUS Status;
+    ULONGLONG TotalBlocks;
+
+    ASSERT((NamespaceId != 0) && (NamespaceId <= NVME_MAX_NAMESPACES));
+
+    KeAcquireQueuedLock(Controller->AdminLock);
+    RtlZeroMemory(&Entry, sizeof(NVME_SUBMISSION_ENTRY));
+    Entry.CommandDword0 = NvmeAdminIdentify;
+    Entry.NamespaceId = NamespaceId;
+    Entry.Prp1 = Controller->IdentifyPhysicalAddress;
+    Entry.CommandDword10 = NVME_IDENTIFY_NAMESPACE;
+    Status = NvmepExecuteCommand(Controller->Queues[0], &Entry, NULL);
+    if (!KSUCCESS(Status)) {
+        KeReleaseQueuedLock(Controller->AdminLock);
+        RtlDebugPrint("NVMe: Identify namespace %d failed: %d\n",
+                      NamespaceId,
+                      Status);
+
+        return Status;
+    }
+
+    Identify = Controller->Identify;
+    TotalBlocks = *((PULONGLONG)(Identify + NVME_IDENTIFY_NAMESPACE_SIZE));
+    FormatIndex = Identify[NVME_IDENTIFY_NAMESPACE_FORMATTED_LBA_SIZE] &
+                  NVME_FORMATTED_LBA_SIZE_INDEX_MASK;
+
+    LbaFormat = *((PULONG)(Identify + NVME_IDENTIFY_NAMESPACE_LBA_FORMAT +
+                           (FormatIndex * sizeof(ULONG))));
+
+    KeReleaseQueuedLock(Controller->AdminLock);
+    if (TotalBlocks == 0) {
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    //
+    // Namespaces formatted with metadata are not supported, and every block
+    // has to fit within a page so a single PRP entry never splits one.
+    //
+
+    BlockShift = (LbaFormat & NVME_LBA_FORMAT_DATA_SIZE_MASK) >>
+                 NVME_LBA_FORMAT_DATA_SIZE_SHIFT;
+
+    if (((LbaFormat & NVME_LBA_FORMAT_METADATA_SIZE_MASK) != 0) ||
+        (BlockShift < 9) || (BlockShift > NVME_PAGE_SHIFT)) {
+
+        RtlDebugPrint("NVMe: Namespace %d has unsupported format 0x%x.\n",
+                      NamespaceId,
+                      LbaFormat);
+
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    Namespace = Controller->Namespaces[NamespaceId - 1];
+    if (Namespace == NULL) {
+        Namespace = MmAllocateNonPagedPool(sizeof(NVME_NAMESPACE),
+                                           NVME_ALLOCATION_TAG);
+
+        if (Namespace == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlZeroMemory(Namespace, sizeof(NVME_NAMESPACE));
+        Namespace->Type = NvmeNamespaceContext;
+        Namespace->Controller = Controller;
+        Namespace->NamespaceId = NamespaceId;
+        Controller->Namespaces[NamespaceId - 1] = Namespace;
+    }
+
+    Namespace->BlockShift = BlockShift;
+    Namespace->BlockSize = 1 << BlockShift;
+    Namespace->TotalBlocks = TotalBlocks;
+    return STATUS_SUCCESS;
+}
+
+PNVME_QUEUE
+NvmepGetIoQueue (
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the I/O queue belonging to the current processor.
+
+Arguments:
+
+    Controller - Supplies a pointer to the NVMe controller.
+
+Return Value:
+
+    Returns a pointer to the queue, or NULL if no I/O queues exist.
+
+--*/
+
+{
+
+    RUNLEVEL OldRunLevel;
+    ULONG Processor;
+    ULONG QueueCount;
+
+    QueueCount = Controller->IoQueueCount;
+    if (QueueCount == 0) {
+        return NULL;
+    }
+
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    Processor = KeGetCurrentProcessorNumber();
+    KeLowerRunLevel(OldRunLevel);
+    return Controller->Queues[(Processor % QueueCount) + 1];
+}
+
+ULONG
+NvmepAcquireCommand (
+    PNVME_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates a command ID on the given queue, blocking until one
+    is free. This routine must be called at low level.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    Returns the allocated command ID.
+
+--*/
+
+{
+
+    ULONG CommandId;
+    ULONG CommandMask;
+    ULONG FreeCommands;
+    RUNLEVEL OldRunLevel;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    CommandMask = MAX_ULONG;
+    if (Queue->CommandCount < NVME_MAX_QUEUE_COMMANDS) {
+        CommandMask = (1 << Queue->CommandCount) - 1;
+    }
+
+    while (TRUE) {
+        CommandId = NVME_INVALID_COMMAND;
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(Queue->Lock));
+        FreeCommands = CommandMask & ~(Queue->BusyCommands);
+        if (FreeCommands != 0) {
+            CommandId = RtlCountTrailingZeros32(FreeCommands);
+            Queue->BusyCommands |= 1 << CommandId;
+
+        } else {
+            KeSignalEvent(Queue->CommandEvent, SignalOptionUnsignal);
+        }
+
+        KeReleaseSpinLock(&(Queue->Lock));
+        KeLowerRunLevel(OldRunLevel);
+        if (CommandId != NVME_INVALID_COMMAND) {
+            break;
+        }
+
+        KeWaitForEvent(Queue->CommandEvent, FALSE, WAIT_TIME_INDEFINITE);
+    }
+
+    return CommandId;
+}
+
+VOID
+NvmepReleaseCommand (
+    PNVME_QUEUE Queue,
+    ULONG CommandId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a command ID and wakes anyone waiting for one. This
+    routine assumes the queue lock is held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    CommandId - Supplies the command ID to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT((Queue->BusyCommands & (1 << CommandId)) != 0);
+
+    Queue->BusyCommands &= ~(1 << CommandId);
+    KeSignalEvent(Queue->CommandEvent, SignalOptionSignalAll);
+    return;
+}
+
+VOID
+NvmepSubmitCommand (
+    PNVME_QUEUE Queue,
+    PNVME_SUBMISSION_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies a command into the submission queue and rings the
+    doorbell. This routine assumes the queue lock is held, or that the system
+    is in critical mode.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Entry - Supplies a pointer to the command to submit.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    RtlCopyMemory(&(Queue->SubmissionQueue[Queue->SubmissionTail]),
+                  Entry,
+                  sizeof(NVME_SUBMISSION_ENTRY));
+
+    Queue->SubmissionTail += 1;
+    if (Queue->SubmissionTail == Queue->Depth) {
+        Queue->SubmissionTail = 0;
+    }
+
+    RtlMemoryBarrier();
+    NVME_WRITE_REGISTER(Queue->Controller,
+                        NVME_SUBMISSION_DOORBELL(Queue->Controller,
+                                                 Queue->QueueId),
+                        Queue->SubmissionTail);
+
+    return;
+}
+
+KSTATUS
+NvmepExecuteCommand (
+    PNVME_QUEUE Queue,
+    PNVME_SUBMISSION_ENTRY Entry,
+    PULONG Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends a command the driver issues itself and waits for it to
+    complete. This routine must be called at low level.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue to send the command on.
+
+    Entry - Supplies a pointer to the command. The command ID is filled in by
+        this routine.
+
+    Result - Supplies an optional pointer where the command specific result
+        is returned.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PNVME_COMMAND Command;
+    ULONG CommandId;
+    RUNLEVEL OldRunLevel;
+    KSTATUS Status;
+    ULONGLONG Timeout;
+
+    CommandId = NvmepAcquireCommand(Queue);
+    Command = &(Queue->Commands[CommandId]);
+
+    ASSERT(Command->Irp == NULL);
+
+    Command->Done = FALSE;
+    Command->Abandoned = FALSE;
+    Entry->CommandDword0 |= CommandId << NVME_COMMAND_ID_SHIFT;
+    Timeout = KeGetRecentTimeCounter() +
+              KeConvertMicrosecondsToTimeTicks(NVME_COMMAND_TIMEOUT *
+                                               MICROSECONDS_PER_SECOND);
+
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Queue->Lock));
+    NvmepSubmitCommand(Queue, Entry);
+    KeReleaseSpinLock(&(Queue->Lock));
+    KeLowerRunLevel(OldRunLevel);
+
+    //
+    // The event is shared by every waiter on the queue, so check that this
+    // particular command is done after each wake.
+    //
+
+    while (TRUE) {
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(Queue->Lock));
+        if (Command->Done != FALSE) {
+            Status = Command->Status;
+            if (Result != NULL) {
+                *Result = Command->Result;
+            }
+
+            NvmepReleaseCommand(Queue, CommandId);
+            KeReleaseSpinLock(&(Queue->Lock));
+            KeLowerRunLevel(OldRunLevel);
+            break;
+        }
+
+        //
+        // If the controller never answers, leave the command ID allocated so
+        // it cannot be reused while the controller might still complete it.
+        //
+
+        if (KeGetRecentTimeCounter() > Timeout) {
+            Command->Abandoned = TRUE;
+            KeReleaseSpinLock(&(Queue->Lock));
+            KeLowerRunLevel(OldRunLevel);
+            RtlDebugPrint("NVMe: Queue %d command 0x%x timed out.\n",
+                          Queue->QueueId,
+                          Entry->CommandDword0);
+
+            Status = STATUS_TIMEOUT;
+            break;
+        }
+
+        KeSignalEvent(Queue->CommandEvent, SignalOptionUnsignal);
+        KeReleaseSpinLock(&(Queue->Lock));
+        KeLowerRunLevel(OldRunLevel);
+        KeWaitForEvent(Queue->CommandEvent,
+                       FALSE,
+                       NVME_COMMAND_TIMEOUT * MILLISECONDS_PER_SECOND);
+    }
+
+    return Status;
+}
+
+KSTATUS
+NvmepStartTransfer (
+    PNVME_QUEUE Queue,
+    ULONG CommandId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine builds and submits the next piece of the read or write IRP
+    owned by the given command. This routine assumes the queue lock is held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    CommandId - Supplies the command holding the IRP.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONGLONG BlockAddress;
+    ULONG BlockCount;
+    UINTN BytesPreviouslyCompleted;
+    PNVME_COMMAND Command;
+    NVME_SUBMISSION_ENTRY Entry;
+    PIRP Irp;
+    PNVME_NAMESPACE Namespace;
+    NVME_IO_OPCODE Opcode;
+    KSTATUS Status;
+    UINTN TransferSize;
+
+    Command = &(Queue->Commands[CommandId]);
+    Irp = Command->Irp;
+
+    ASSERT(Irp != NULL);
+    ASSERT(Irp->U.ReadWrite.IoBuffer != NULL);
+
+    Namespace = Irp->U.ReadWrite.DeviceContext;
+    BytesPreviouslyCompleted = Irp->U.ReadWrite.IoBytesCompleted;
+
+    ASSERT(BytesPreviouslyCompleted < Irp->U.ReadWrite.IoSizeInBytes);
+    ASSERT(Irp->U.ReadWrite.NewIoOffset ==
+           (Irp->U.ReadWrite.IoOffset + BytesPreviouslyCompleted));
+
+    TransferSize = Irp->U.ReadWrite.IoSizeInBytes - BytesPreviouslyCompleted;
+    if (TransferSize > Queue->Controller->MaxTransferSize) {
+        TransferSize = Queue->Controller->MaxTransferSize;
+    }
+
+    RtlZeroMemory(&Entry, sizeof(NVME_SUBMISSION_ENTRY));
+    Status = NvmepBuildPrpList(
+                     Command,
+                     Irp->U.ReadWrite.IoBuffer,
+                     MmGetIoBufferCurrentOffset(Irp->U.ReadWrite.IoBuffer) +
+                     BytesPreviouslyCompleted,
+                     TransferSize,
+                     Namespace->BlockSize,
+                     &Entry,
+                     &TransferSize);
+
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Opcode = NvmeIoRead;
+    if (Irp->MinorCode == IrpMinorIoWrite) {
+        Opcode = NvmeIoWrite;
+        if ((Irp->U.ReadWrite.IoFlags & IO_FLAG_DATA_SYNCHRONIZED) != 0) {
+            Entry.CommandDword12 |= NVME_READ_WRITE_FORCE_UNIT_ACCESS;
+        }
+    }
+
+    BlockAddress = Irp->U.ReadWrite.NewIoOffset >> Namespace->BlockShift;
+    BlockCount = TransferSize >> Namespace->BlockShift;
+
+    ASSERT((BlockCount != 0) && (BlockCount <= NVME_MAX_BLOCK_COUNT));
+
+    Entry.CommandDword0 = NVME_COMMAND_DWORD0(Opcode, CommandId);
+    Entry.NamespaceId = Namespace->NamespaceId;
+    Entry.CommandDword10 = (ULONG)BlockAddress;
+    Entry.CommandDword11 = (ULONG)(BlockAddress >> 32);
+    Entry.CommandDword12 |= BlockCount - 1;
+    Command->IoSize = TransferSize;
+    NvmepSubmitCommand(Queue, &Entry);
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+NvmepBuildPrpList (
+    PNVME_COMMAND Command,
+    PIO_BUFFER IoBuffer,
+    UINTN IoBufferOffset,
+    UINTN Size,
+    ULONG BlockSize,
+    PNVME_SUBMISSION_ENTRY Entry,
+    PUINTN TransferSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine describes a range of an I/O buffer with physical region page
+    entries, directly from the buffer's fragments. Every entry but the first
+    must start on a page boundary and every entry but the last must end on
+    one. If the fragments break that rule, or the PRP list fills up, the
+    transfer is trimmed to a whole number of blocks and the rest is left for
+    another command.
+
+Arguments:
+
+    Command - Supplies a pointer to the command, whose PRP list is filled in.
+
+    IoBuffer - Supplies a pointer to the I/O buffer.
+
+    IoBufferOffset - Supplies the offset into the I/O buffer where the
+        transfer begins.
+
+    Size - Supplies the number of bytes to transfer.
+
+    BlockSize - Supplies the namespace's block size.
+
+    Entry - Supplies a pointer to the submission entry whose PRP fields are
+        filled in.
+
+    TransferSize - Supplies a pointer where the number of bytes described is
+        returned.
+
+Return Value:
+
+    STATUS_SUCCESS if at least one block was described.
+
+    STATUS_INVALID_PARAMETER if the buffer cannot be described.
+
+--*/
+
+{
+
+    UINTN ChunkSize;
+    ULONG EntryCount;
+    UINTN FirstSize;
+    PIO_BUFFER_FRAGMENT Fragment;
+    UINTN FragmentIndex;
+    UINTN FragmentOffset;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    UINTN PieceSize;
+    UINTN Remaining;
+    BOOL Stop;
+    UINTN Transfer;
+
+    //
+    // Get to the current spot in the I/O buffer.
+    //
+
+    FragmentIndex = 0;
+    FragmentOffset = 0;
+    while (IoBufferOffset != 0) {
+
+        ASSERT(FragmentIndex < IoBuffer->FragmentCount);
+
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        if (IoBufferOffset < Fragment->Size) {
+            FragmentOffset = IoBufferOffset;
+            break;
+        }
+
+        IoBufferOffset -= Fragment->Size;
+        FragmentIndex += 1;
+    }
+
+    EntryCount = 0;
+    FirstSize = 0;
+    Remaining = Size;
+    Stop = FALSE;
+    Transfer = 0;
+    while ((Remaining != 0) && (Stop == FALSE) &&
+           (FragmentIndex < IoBuffer->FragmentCount)) {
+
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        PhysicalAddress = Fragment->PhysicalAddress + FragmentOffset;
+        PieceSize = Fragment->Size - FragmentOffset;
+        if (PieceSize > Remaining) {
+            PieceSize = Remaining;
+        }
+
+        ASSERT(IS_ALIGNED(PhysicalAddress, NVME_DATA_ALIGNMENT) != FALSE);
+
+        if ((EntryCount != 0) &&
+            (IS_ALIGNED(PhysicalAddress, NVME_PAGE_SIZE) == FALSE)) {
+
+            break;
+        }
+
+        //
+        // Carve the fragment into page sized entries.
+        //
+
+        while (PieceSize != 0) {
+            if (EntryCount == (NVME_PRP_LIST_ENTRY_COUNT + 1)) {
+                Stop = TRUE;
+                break;
+            }
+
+            ChunkSize = NVME_PAGE_SIZE -
+                        REMAINDER(PhysicalAddress, NVME_PAGE_SIZE);
+
+            if (ChunkSize > PieceSize) {
+                ChunkSize = PieceSize;
+            }
+
+            if (EntryCount == 0) {
+                Entry->Prp1 = PhysicalAddress;
+                FirstSize = ChunkSize;
+
+            } else {
+                Command->PrpList[EntryCount - 1] = PhysicalAddress;
+            }
+
+            EntryCount += 1;
+            PhysicalAddress += ChunkSize;
+            PieceSize -= ChunkSize;
+            Remaining -= ChunkSize;
+            Transfer += ChunkSize;
+            FragmentOffset += ChunkSize;
+
+            //
+            // An entry that ends short of a page has to be the last one.
+            //
+
+            if ((Remaining != 0) &&
+                (IS_ALIGNED(PhysicalAddress, NVME_PAGE_SIZE) == FALSE)) {
+
+                Stop = TRUE;
+                break;
+            }
+        }
+
+        if (FragmentOffset >= Fragment->Size) {
+            FragmentIndex += 1;
+            FragmentOffset = 0;
+        }
+    }
+
+    //
+    // Back off to a block boundary and count the entries still needed.
+    //
+
+    Transfer = ALIGN_RANGE_DOWN(Transfer, BlockSize);
+    *TransferSize = Transfer;
+    if (Transfer == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    EntryCount = 1;
+    if (Transfer > FirstSize) {
+        EntryCount += ALIGN_RANGE_UP(Transfer - FirstSize, NVME_PAGE_SIZE) /
+                      NVME_PAGE_SIZE;
+    }
+
+    Entry->Prp2 = 0;
+    if (EntryCount == 2) {
+        Entry->Prp2 = Command->PrpList[0];
+
+    } else if (EntryCount > 2) {
+        Entry->Prp2 = Command->PrpListPhysicalAddress;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+BOOL
+NvmepQueueHasCompletion (
+    PNVME_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a completion queue has an entry waiting.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    TRUE if the next completion entry has been written by the controller.
+
+    FALSE otherwise.
+
+--*/
+
+{
+
+    PNVME_COMPLETION_ENTRY Entry;
+
+    Entry = &(Queue->CompletionQueue[Queue->CompletionHead]);
+    if ((Entry->Status & NVME_COMPLETION_STATUS_PHASE) == Queue->Phase) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+VOID
+NvmepProcessCompletions (
+    PNVME_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles every new entry in a completion queue and then tells
+    the controller how far it got. This routine assumes the queue lock is
+    held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG CommandId;
+    PNVME_COMPLETION_ENTRY Entry;
+    BOOL Processed;
+    ULONG Result;
+    KSTATUS Status;
+
+    Processed = FALSE;
+    while (NvmepQueueHasCompletion(Queue) != FALSE) {
+
+        //
+        // Read the rest of the entry only after seeing the phase flip.
+        //
+
+        RtlMemoryBarrier();
+        Entry = &(Queue->CompletionQueue[Queue->CompletionHead]);
+        CommandId = Entry->CommandId;
+        Result = Entry->Result;
+        Status = NvmepGetCompletionStatus(Queue, Entry);
+        Queue->CompletionHead += 1;
+        if (Queue->CompletionHead == Queue->Depth) {
+            Queue->CompletionHead = 0;
+            Queue->Phase ^= NVME_COMPLETION_STATUS_PHASE;
+        }
+
+        Processed = TRUE;
+        if ((CommandId < Queue->CommandCount) &&
+            ((Queue->BusyCommands & (1 << CommandId)) != 0)) {
+
+            NvmepCompleteCommand(Queue, CommandId, Status, Result);
+        }
+    }
+
+    if (Processed != FALSE) {
+        NVME_WRITE_REGISTER(Queue->Controller,
+                            NVME_COMPLETION_DOORBELL(Queue->Controller,
+                                                     Queue->QueueId),
+                            Queue->CompletionHead);
+    }
+
+    return;
+}
+
+VOID
+NvmepCompleteCommand (
+    PNVME_QUEUE Queue,
+    ULONG CommandId,
+    KSTATUS Status,
+    ULONG Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles a finished command. If the command's IRP has more
+    data to move, the next piece is submitted with the same command ID.
+    Otherwise the command is freed and the IRP completed. This routine assumes
+    the queue lock is held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    CommandId - Supplies the command that finished.
+
+    Status - Supplies the result of the command.
+
+    Result - Supplies the command specific result.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNVME_COMMAND Command;
+    PIRP Irp;
+
+    Command = &(Queue->Commands[CommandId]);
+    Irp = Command->Irp;
+
+    //
+    // Commands the driver issued itself have a thread waiting on them. That
+    // thread frees the command, unless it already gave up.
+    //
+
+    if (Irp == NULL) {
+        if (Command->Abandoned != FALSE) {
+            Command->Abandoned = FALSE;
+            NvmepReleaseCommand(Queue, CommandId);
+            return;
+        }
+
+        Command->Status = Status;
+        Command->Result = Result;
+        Command->Done = TRUE;
+        KeSignalEvent(Queue->CommandEvent, SignalOptionSignalAll);
+        return;
+    }
+
+    ASSERT(Irp->MajorCode == IrpMajorIo);
+
+    if (KSUCCESS(Status)) {
+        Irp->U.ReadWrite.IoBytesCompleted += Command->IoSize;
+        Irp->U.ReadWrite.NewIoOffset += Command->IoSize;
+
+        ASSERT(Irp->U.ReadWrite.IoBytesCompleted <=
+               Irp->U.ReadWrite.IoSizeInBytes);
+
+        if (Irp->U.ReadWrite.IoBytesCompleted !=
+            Irp->U.ReadWrite.IoSizeInBytes) {
+
+            Status = NvmepStartTransfer(Queue, CommandId);
+            if (KSUCCESS(Status)) {
+                return;
+            }
+        }
+    }
+
+    Command->Irp = NULL;
+    Command->IoSize = 0;
+    NvmepReleaseCommand(Queue, CommandId);
+
+    //
+    // Complete the IRP. The I/O buffer state is cleaned up by this driver
+    // after the IRP is reversed to the up direction, at low level.
+    //
+
+    IoCompleteIrp(NvmeDriver, Irp, Status);
+    return;
+}
+
+KSTATUS
+NvmepGetCompletionStatus (
+    PNVME_QUEUE Queue,
+    PNVME_COMPLETION_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine converts a completion entry's status field into a status
+    code.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue the entry came from.
+
+    Entry - Supplies a pointer to the completion entry.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG CompletionStatus;
+
+    CompletionStatus = (Entry->Status & NVME_COMPLETION_STATUS_MASK) >>
+                       NVME_COMPLETION_STATUS_SHIFT;
+
+    if (CompletionStatus == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    RtlDebugPrint("NVMe: Queue %d command %d failed with status 0x%x.\n",
+                  Queue->QueueId,
+                  Entry->CommandId,
+                  CompletionStatus);
+
+    return STATUS_DEVICE_IO_ERROR;
+}
+
+KSTATUS
+NvmepSynchronizeNamespace (
+    PNVME_NAMESPACE Namespace
+    )
+
+/*++
+
+Routine Description:
+
+    This routine flushes the controller's volatile write cache for the given
+    namespace, if it has one.
+
+Arguments:
+
+    Namespace - Supplies a pointer to the namespace.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+    NVME_SUBMISSION_ENTRY Entry;
+    PNVME_QUEUE Queue;
+
+    Controller = Namespace->Controller;
+    if (Controller->VolatileWriteCache == FALSE) {
+        return STATUS_SUCCESS;
+    }
+
+    Queue = NvmepGetIoQueue(Controller);
+    if (Queue == NULL) {
+        return STATUS_NOT_READY;
+    }
+
+    RtlZeroMemory(&Entry, sizeof(NVME_SUBMISSION_ENTRY));
+    Entry.CommandDword0 = NvmeIoFlush;
+    Entry.NamespaceId = Namespace->NamespaceId;
+    return NvmepExecuteCommand(Queue, &Entry, NULL);
+}
+
+KSTATUS
+NvmepBlockIoReset (
+    PVOID DiskToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prepares the controller for polled block I/O. Polled I/O
+    runs on the first I/O queue and throws away any other completions it
+    finds there. This routine is called at high run level.
+
+Arguments:
+
+    DiskToken - Supplies an opaque token for the disk. The appropriate token is
+        retrieved by querying the disk device information.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+    PNVME_NAMESPACE Namespace;
+
+    ASSERT(KeGetRunLevel() == RunLevelHigh);
+
+    Namespace = (PNVME_NAMESPACE)DiskToken;
+    Controller = Namespace->Controller;
+    if (Controller->IoQueueCount == 0) {
+        return STATUS_NOT_READY;
+    }
+
+    if (Controller->MaskInterrupts != FALSE) {
+        NVME_WRITE_REGISTER(Controller, NVME_INTERRUPT_MASK_SET, MAX_ULONG);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+NvmepBlockRead (
+    PVOID DiskToken,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    PUINTN BlocksCompleted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads the block contents from the disk into the given I/O
+    buffer using polled I/O. It does so without acquiring any locks or
+    allocating any resources, as this routine is used for crash dump support
+    when the system is in a very fragile state. This routine must be called at
+    high level.
+
+Arguments:
+
+    DiskToken - Supplies an opaque token for the disk. The appropriate token is
+        retrieved by querying the disk device information.
+
+    IoBuffer - Supplies a pointer to the I/O buffer where the data will be read.
+
+    BlockAddress - Supplies the block index to read (for physical disk, this is
+        the LBA).
+
+    BlockCount - Supplies the number of blocks to read.
+
+    BlocksCompleted - Supplies a pointer that receives the total number of
+        blocks read.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    IRP_READ_WRITE IrpReadWrite;
+    PNVME_NAMESPACE Namespace;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelHigh);
+
+    Namespace = (PNVME_NAMESPACE)DiskToken;
+    IrpReadWrite.IoBuffer = IoBuffer;
+    IrpReadWrite.IoOffset = BlockAddress << Namespace->BlockShift;
+    IrpReadWrite.IoSizeInBytes = BlockCount << Namespace->BlockShift;
+    Status = NvmepPerformPolledIo(&IrpReadWrite, Namespace, FALSE);
+    *BlocksCompleted = IrpReadWrite.IoBytesCompleted >> Namespace->BlockShift;
+    return Status;
+}
+
+KSTATUS
+NvmepBlockWrite (
+    PVOID DiskToken,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    PUINTN BlocksCompleted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes the contents of the given I/O buffer to the disk using
+    polled I/O. It does so without acquiring any locks or allocating any
+    resources, as this routine is used for crash dump support when the system
+    is in a very fragile state. This routine must be called at high level.
+
+Arguments:
+
+    DiskToken - Supplies an opaque token for the disk. The appropriate token is
+        retrieved by querying the disk device information.
+
+    IoBuffer - Supplies a pointer to the I/O buffer containing the data to
+        write.
+
+    BlockAddress - Supplies the block index to write to (for physical disk,
+        this is the LBA).
+
+    BlockCount - Supplies the number of blocks to write.
+
+    BlocksCompleted - Supplies a pointer that receives the total number of
+        blocks written.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    IRP_READ_WRITE IrpReadWrite;
+    PNVME_NAMESPACE Namespace;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelHigh);
+
+    Namespace = (PNVME_NAMESPACE)DiskToken;
+    IrpReadWrite.IoBuffer = IoBuffer;
+    IrpReadWrite.IoOffset = BlockAddress << Namespace->BlockShift;
+    IrpReadWrite.IoSizeInBytes = BlockCount << Namespace->BlockShift;
+    Status = NvmepPerformPolledIo(&IrpReadWrite, Namespace, TRUE);
+    *BlocksCompleted = IrpReadWrite.IoBytesCompleted >> Namespace->BlockShift;
+    return Status;
+}
+
+KSTATUS
+NvmepPerformPolledIo (
+    PIRP_READ_WRITE IrpReadWrite,
+    PNVME_NAMESPACE Namespace,
+    BOOL Write
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs a read or write one command at a time on the first
+    I/O queue, spinning on each command's completion. It is only used in
+    critical mode.
+
+Arguments:
+
+    IrpReadWrite - Supplies a pointer to the I/O request read/write packet.
+
+    Namespace - Supplies a pointer to the namespace.
+
+    Write - Supplies a boolean indicating if this is a write operation (TRUE)
+        or a read operation (FALSE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONGLONG BlockAddress;
+    UINTN BytesRemaining;
+    PNVME_COMPLETION_ENTRY Completion;
+    KSTATUS CompletionStatus;
+    PNVME_CONTROLLER Controller;
+    BOOL Done;
+    NVME_SUBMISSION_ENTRY Entry;
+    ULONG IrpReadWriteFlags;
+    NVME_IO_OPCODE Opcode;
+    PNVME_QUEUE Queue;
+    BOOL ReadWriteIrpPrepared;
+    KSTATUS Status;
+    ULONGLONG Timeout;
+    UINTN TransferSize;
+
+    IrpReadWrite->IoBytesCompleted = 0;
+    ReadWriteIrpPrepared = FALSE;
+    Controller = Namespace->Controller;
+
+    ASSERT(IrpReadWrite->IoBuffer != NULL);
+    ASSERT(IS_ALIGNED(IrpReadWrite->IoSizeInBytes, Namespace->BlockSize) !=
+           FALSE);
+
+    ASSERT(IS_ALIGNED(IrpReadWrite->IoOffset, Namespace->BlockSize) != FALSE);
+
+    if (Controller->IoQueueCount == 0) {
+        Status = STATUS_NOT_READY;
+        goto PerformPolledIoEnd;
+    }
+
+    Queue = Controller->Queues[1];
+    IrpReadWriteFlags = IRP_READ_WRITE_FLAG_POLLED | IRP_READ_WRITE_FLAG_DMA;
+    if (Write != FALSE) {
+        IrpReadWriteFlags |= IRP_READ_WRITE_FLAG_WRITE;
+    }
+
+    Status = IoPrepareReadWriteIrp(IrpReadWrite,
+                                   NVME_DATA_ALIGNMENT,
+                                   0,
+                                   MAX_ULONGLONG,
+                                   IrpReadWriteFlags);
+
+    if (!KSUCCESS(Status)) {
+        goto PerformPolledIoEnd;
+    }
+
+    ReadWriteIrpPrepared = TRUE;
+
+    //
+    // Writes bypass the controller's cache, as nothing will come along
+    // afterwards to flush it.
+    //
+
+    Opcode = NvmeIoRead;
+    if (Write != FALSE) {
+        Opcode = NvmeIoWrite;
+    }
+
+    BytesRemaining = IrpReadWrite->IoSizeInBytes;
+    while (BytesRemaining != 0) {
+        TransferSize = BytesRemaining;
+        if (TransferSize > Controller->MaxTransferSize) {
+            TransferSize = Controller->MaxTransferSize;
+        }
+
+        RtlZeroMemory(&Entry, sizeof(NVME_SUBMISSION_ENTRY));
+        Status = NvmepBuildPrpList(
+                      &(Queue->PolledCommand),
+                      IrpReadWrite->IoBuffer,
+                      MmGetIoBufferCurrentOffset(IrpReadWrite->IoBuffer) +
+                      IrpReadWrite->IoBytesCompleted,
+                      TransferSize,
+                      Namespace->BlockSize,
+                      &Entry,
+                      &TransferSize);
+
+        if (!KSUCCESS(Status)) {
+            goto PerformPolledIoEnd;
+        }
+
+        BlockAddress = (IrpReadWrite->IoOffset +
+                        IrpReadWrite->IoBytesCompleted) >>
+                       Namespace->BlockShift;
+
+        Entry.CommandDword0 = NVME_COMMAND_DWORD0(Opcode,
+                                                  NVME_POLLED_COMMAND_ID);
+
+        Entry.NamespaceId = Namespace->NamespaceId;
+        Entry.CommandDword10 = (ULONG)BlockAddress;
+        Entry.CommandDword11 = (ULONG)(BlockAddress >> 32);
+        Entry.CommandDword12 = (TransferSize >> Namespace->BlockShift) - 1;
+        if (Write != FALSE) {
+            Entry.CommandDword12 |= NVME_READ_WRITE_FORCE_UNIT_ACCESS;
+        }
+
+        NvmepSubmitCommand(Queue, &Entry);
+
+        //
+        // Spin on the completion queue. Completions for commands that were in
+        // flight before the crash are consumed and dropped.
+        //
+
+        Timeout = HlQueryTimeCounter() +
+                  (HlQueryTimeCounterFrequency() * NVME_COMMAND_TIMEOUT);
+
+        Done = FALSE;
+        Status = STATUS_TIMEOUT;
+        do {
+            if (NvmepQueueHasCompletion(Queue) == FALSE) {
+                continue;
+            }
+
+            RtlMemoryBarrier();
+            Completion = &(Queue->CompletionQueue[Queue->CompletionHead]);
+            if (Completion->CommandId == NVME_POLLED_COMMAND_ID) {
+                Status = NvmepGetCompletionStatus(Queue, Completion);
+                Done = TRUE;
+            }
+
+            Queue->CompletionHead += 1;
+            if (Queue->CompletionHead == Queue->Depth) {
+                Queue->CompletionHead = 0;
+                Queue->Phase ^= NVME_COMPLETION_STATUS_PHASE;
+            }
+
+            NVME_WRITE_REGISTER(Controller,
+                                NVME_COMPLETION_DOORBELL(Controller,
+                                                         Queue->QueueId),
+                                Queue->CompletionHead);
+
+            if (Done != FALSE) {
+                break;
+            }
+
+        } while (HlQueryTimeCounter() <= Timeout);
+
+        if (!KSUCCESS(Status)) {
+            goto PerformPolledIoEnd;
+        }
+
+        IrpReadWrite->IoBytesCompleted += TransferSize;
+        BytesRemaining -= TransferSize;
+    }
+
+    Status = STATUS_SUCCESS;
+
+PerformPolledIoEnd:
+    if (ReadWriteIrpPrepared != FALSE) {
+        CompletionStatus = IoCompleteReadWriteIrp(IrpReadWrite,
+                                                  IrpReadWriteFlags);
+
+        if (!KSUCCESS(CompletionStatus) && KSUCCESS(Status)) {
+            Status = CompletionStatus;
+        }
+    }
+
+    IrpReadWrite->NewIoOffset = IrpReadWrite->IoOffset +
+                                IrpReadWrite->IoBytesCompleted;
+
+    return Status;
+}
+
+VOID
+NvmepProcessPciMsiInterfaceChangeNotification (
+    PVOID Context,
+    PDEVICE Device,
+    PVOID InterfaceBuffer,
+    ULONG InterfaceBufferSize,
+    BOOL Arrival
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when a PCI MSI interface changes in availability.
+
+Arguments:
+
+    Context - Supplies the caller's context pointer, supplied when the caller
+        requested interface notifications.
+
+    Device - Supplies a pointer to the device exposing or deleting the
+        interface.
+
+    InterfaceBuffer - Supplies a pointer to the interface buffer of the
+        interface.
+
+    InterfaceBufferSize - Supplies the buffer size.
+
+    Arrival - Supplies TRUE if a new interface is arriving, or FALSE if an
+        interface is departing.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+
+    Controller = (PNVME_CONTROLLER)Context;
+    if (Arrival != FALSE) {
+        if (InterfaceBufferSize >= sizeof(INTERFACE_PCI_MSI)) {
+
+            ASSERT((Controller->PciMsiFlags &
+                    NVME_PCI_MSI_FLAG_INTERFACE_AVAILABLE) == 0);
+
+            RtlCopyMemory(&(Controller->PciMsiInterface),
+                          InterfaceBuffer,
+                          sizeof(INTERFACE_PCI_MSI));
+
+            Controller->PciMsiFlags |= NVME_PCI_MSI_FLAG_INTERFACE_AVAILABLE;
+        }
+
+    } else {
+        Controller->PciMsiFlags &= ~NVME_PCI_MSI_FLAG_INTERFACE_AVAILABLE;
+    }
+
+    return;
+}
+
@@ -0,0 +1,682 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    nvme.h
+
+Abstract:
+
+    This header contains definitions for the NVM Express (NVMe) driver.
+
+Author:
+
+    Minoca Corp. 16-Oct-2026
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/intrface/pci.h>
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// Define macros for accessing the controller registers.
+//
+
+#define NVME_READ_REGISTER(_Controller, _Register) \
+    HlReadRegister32((PUCHAR)(_Controller)->ControllerBase + (_Register))
+
+#define NVME_WRITE_REGISTER(_Controller, _Register, _Value)                \
+    HlWriteRegister32((PUCHAR)(_Controller)->ControllerBase + (_Register), \
+                      (_Value))
+
+//
+// These macros return the offset of a queue's submission tail and completion
+// head doorbells.
+//
+
+#define NVME_SUBMISSION_DOORBELL(_Controller, _QueueId) \
+    (NVME_DOORBELL_BASE + ((2 * (_QueueId)) * (_Controller)->DoorbellStride))
+
+#define NVME_COMPLETION_DOORBELL(_Controller, _QueueId) \
+    (NVME_DOORBELL_BASE +                               \
+     (((2 * (_QueueId)) + 1) * (_Controller)->DoorbellStride))
+
+//
+// This macro returns the command dword 0 for the given opcode and command ID.
+//
+
+#define NVME_COMMAND_DWORD0(_Opcode, _CommandId) \
+    ((_Opcode) | ((_CommandId) << NVME_COMMAND_ID_SHIFT))
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define NVME_ALLOCATION_TAG 0x656D764E // 'emvN'
+
+//
+// Define the maximum number of I/O queue pairs and interrupt vectors. One pair
+// is created per processor, up to this limit.
+//
+
+#define NVME_MAX_IO_QUEUES 32
+#define NVME_MAX_VECTORS NVME_MAX_IO_QUEUES
+
+//
+// Define the maximum number of namespaces exposed as disks.
+//
+
+#define NVME_MAX_NAMESPACES 16
+
+//
+// Define the queue sizes, in entries. At most 32 commands are outstanding on
+// a queue at once, which keeps the command bitmaps to a single ULONG and means
+// a submission queue can never fill.
+//
+
+#define NVME_ADMIN_QUEUE_DEPTH 8
+#define NVME_IO_QUEUE_DEPTH 64
+#define NVME_MAX_QUEUE_COMMANDS 32
+#define NVME_INVALID_COMMAND ((ULONG)-1)
+
+//
+// Define the command ID used by polled crash dump I/O, which never collides
+// with a real command slot.
+//
+
+#define NVME_POLLED_COMMAND_ID 0xFFFF
+
+//
+// Define the memory page size the controller is programmed with. Every PRP
+// entry after the first must be aligned to this.
+//
+
+#define NVME_PAGE_SHIFT 12
+#define NVME_PAGE_SIZE (1 << NVME_PAGE_SHIFT)
+
+//
+// Define the number of entries in each command's PRP list. A list this size
+// never crosses a page, so lists never need to be chained. This bounds a
+// single command's transfer.
+//
+
+#define NVME_PRP_LIST_ENTRY_COUNT 64
+#define NVME_PRP_LIST_SIZE (NVME_PRP_LIST_ENTRY_COUNT * sizeof(ULONGLONG))
+#define NVME_MAX_TRANSFER_SIZE (NVME_PRP_LIST_ENTRY_COUNT * NVME_PAGE_SIZE)
+
+//
+// Define the required alignment of data buffers.
+//
+
+#define NVME_DATA_ALIGNMENT 4
+
+//
+// Define timeouts. The ready timeout comes from the capabilities register in
+// units of 500 milliseconds.
+//
+
+#define NVME_READY_TIMEOUT_UNIT (500 * MICROSECONDS_PER_MILLISECOND)
+#define NVME_POLL_INTERVAL 10
+
+//
+// Define the command timeout, in seconds.
+//
+
+#define NVME_COMMAND_TIMEOUT 30
+
+//
+// Define controller register offsets.
+//
+
+#define NVME_CAPABILITIES 0x00
+#define NVME_CAPABILITIES_HIGH 0x04
+#define NVME_VERSION 0x08
+#define NVME_INTERRUPT_MASK_SET 0x0C
+#define NVME_INTERRUPT_MASK_CLEAR 0x10
+#define NVME_CONTROLLER_CONFIGURATION 0x14
+#define NVME_CONTROLLER_STATUS 0x1C
+#define NVME_ADMIN_QUEUE_ATTRIBUTES 0x24
+#define NVME_ADMIN_SUBMISSION_QUEUE 0x28
+#define NVME_ADMIN_SUBMISSION_QUEUE_HIGH 0x2C
+#define NVME_ADMIN_COMPLETION_QUEUE 0x30
+#define NVME_ADMIN_COMPLETION_QUEUE_HIGH 0x34
+#define NVME_DOORBELL_BASE 0x1000
+
+//
+// Define capabilities register bits, low half.
+//
+
+#define NVME_CAPABILITY_MAX_QUEUE_ENTRIES_MASK 0x0000FFFF
+#define NVME_CAPABILITY_TIMEOUT_MASK 0xFF000000
+#define NVME_CAPABILITY_TIMEOUT_SHIFT 24
+
+//
+// Define capabilities register bits, high half.
+//
+
+#define NVME_CAPABILITY_HIGH_DOORBELL_STRIDE_MASK 0x0000000F
+#define NVME_CAPABILITY_HIGH_NVM_COMMAND_SET 0x00000020
+#define NVME_CAPABILITY_HIGH_MIN_PAGE_SIZE_MASK 0x000F0000
+#define NVME_CAPABILITY_HIGH_MIN_PAGE_SIZE_SHIFT 16
+
+//
+// Define controller configuration register bits.
+//
+
+#define NVME_CONFIGURATION_ENABLE 0x00000001
+#define NVME_CONFIGURATION_PAGE_SIZE_SHIFT 7
+#define NVME_CONFIGURATION_SUBMISSION_ENTRY_SIZE_SHIFT 16
+#define NVME_CONFIGURATION_COMPLETION_ENTRY_SIZE_SHIFT 20
+
+//
+// Define controller status register bits.
+//
+
+#define NVME_STATUS_READY 0x00000001
+#define NVME_STATUS_FATAL 0x00000002
+
+//
+// Define the admin queue attributes register fields.
+//
+
+#define NVME_ADMIN_QUEUE_COMPLETION_SIZE_SHIFT 16
+
+//
+// Define the base two logarithms of the queue entry sizes.
+//
+
+#define NVME_SUBMISSION_ENTRY_SHIFT 6
+#define NVME_COMPLETION_ENTRY_SHIFT 4
+
+//
+// Define submission entry fields.
+//
+
+#define NVME_COMMAND_ID_SHIFT 16
+
+//
+// Define completion entry status fields. The phase tag flips each time the
+// controller wraps around the queue.
+//
+
+#define NVME_COMPLETION_STATUS_PHASE 0x0001
+#define NVME_COMPLETION_STATUS_MASK 0xFFFE
+#define NVME_COMPLETION_STATUS_SHIFT 1
+
+//
+// Define create I/O queue command fields.
+//
+
+#define NVME_CREATE_QUEUE_SIZE_SHIFT 16
+#define NVME_CREATE_QUEUE_PHYSICALLY_CONTIGUOUS 0x00000001
+#define NVME_CREATE_COMPLETION_QUEUE_INTERRUPTS_ENABLED 0x00000002
+#define NVME_CREATE_COMPLETION_QUEUE_VECTOR_SHIFT 16
+#define NVME_CREATE_SUBMISSION_QUEUE_COMPLETION_QUEUE_SHIFT 16
+
+//
+// Define identify command values.
+//
+
+#define NVME_IDENTIFY_NAMESPACE 0x00
+#define NVME_IDENTIFY_CONTROLLER 0x01
+#define NVME_IDENTIFY_SIZE 0x1000
+
+//
+// Define identify controller data byte offsets.
+//
+
+#define NVME_IDENTIFY_CONTROLLER_MAX_TRANSFER 77
+#define NVME_IDENTIFY_CONTROLLER_NAMESPACE_COUNT 516
+#define NVME_IDENTIFY_CONTROLLER_VOLATILE_WRITE_CACHE 525
+
+#define NVME_VOLATILE_WRITE_CACHE_PRESENT 0x01
+
+//
+// Define identify namespace data byte offsets.
+//
+
+#define NVME_IDENTIFY_NAMESPACE_SIZE 0
+#define NVME_IDENTIFY_NAMESPACE_FORMATTED_LBA_SIZE 26
+#define NVME_IDENTIFY_NAMESPACE_LBA_FORMAT 128
+
+#define NVME_FORMATTED_LBA_SIZE_INDEX_MASK 0x0F
+#define NVME_LBA_FORMAT_METADATA_SIZE_MASK 0x0000FFFF
+#define NVME_LBA_FORMAT_DATA_SIZE_MASK 0x00FF0000
+#define NVME_LBA_FORMAT_DATA_SIZE_SHIFT 16
+
+//
+// Define set features values.
+//
+
+#define NVME_FEATURE_NUMBER_OF_QUEUES 0x07
+#define NVME_QUEUE_COUNT_COMPLETION_SHIFT 16
+#define NVME_QUEUE_COUNT_MASK 0x0000FFFF
+
+//
+// Define read and write command fields.
+//
+
+#define NVME_READ_WRITE_FORCE_UNIT_ACCESS 0x40000000
+#define NVME_MAX_BLOCK_COUNT 0x10000
+
+//
+// Define the set of flags used for MSI/MSI-X interrupts.
+//
+
+#define NVME_PCI_MSI_FLAG_INTERFACE_REGISTERED 0x00000001
+#define NVME_PCI_MSI_FLAG_INTERFACE_AVAILABLE  0x00000002
+#define NVME_PCI_MSI_FLAG_RESOURCES_REQUESTED  0x00000004
+#define NVME_PCI_MSI_FLAG_RESOURCES_ALLOCATED  0x00000008
+#define NVME_PCI_MSI_FLAG_EXTENDED             0x00000010
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _NVME_CONTEXT_TYPE {
+    NvmeContextInvalid,
+    NvmeControllerContext,
+    NvmeNamespaceContext
+} NVME_CONTEXT_TYPE, *PNVME_CONTEXT_TYPE;
+
+typedef struct _NVME_CONTROLLER NVME_CONTROLLER, *PNVME_CONTROLLER;
+
+typedef enum _NVME_ADMIN_OPCODE {
+    NvmeAdminDeleteSubmissionQueue = 0x00,
+    NvmeAdminCreateSubmissionQueue = 0x01,
+    NvmeAdminDeleteCompletionQueue = 0x04,
+    NvmeAdminCreateCompletionQueue = 0x05,
+    NvmeAdminIdentify              = 0x06,
+    NvmeAdminSetFeatures           = 0x09,
+} NVME_ADMIN_OPCODE, *PNVME_ADMIN_OPCODE;
+
+typedef enum _NVME_IO_OPCODE {
+    NvmeIoFlush = 0x00,
+    NvmeIoWrite = 0x01,
+    NvmeIoRead  = 0x02,
+} NVME_IO_OPCODE, *PNVME_IO_OPCODE;
+
+/*++
+
+Structure Description:
+
+    This structure defines an NVMe submission queue entry.
+
+Members:
+
+    CommandDword0 - Stores the opcode and the command ID.
+
+    NamespaceId - Stores the namespace the command applies to.
+
+    Reserved - Stores reserved space.
+
+    MetadataPointer - Stores the physical address of the command's metadata.
+
+    Prp1 - Stores the first physical region page entry.
+
+    Prp2 - Stores the second physical region page entry, or the physical
+        address of a PRP list.
+
+    CommandDword10 - Stores command specific data.
+
+    CommandDword11 - Stores command specific data.
+
+    CommandDword12 - Stores command specific data.
+
+    CommandDword13 - Stores command specific data.
+
+    CommandDword14 - Stores command specific data.
+
+    CommandDword15 - Stores command specific data.
+
+--*/
+
+typedef struct _NVME_SUBMISSION_ENTRY {
+    ULONG CommandDword0;
+    ULONG NamespaceId;
+    ULONG Reserved[2];
+    ULONGLONG MetadataPointer;
+    ULONGLONG Prp1;
+    ULONGLONG Prp2;
+    ULONG CommandDword10;
+    ULONG CommandDword11;
+    ULONG CommandDword12;
+    ULONG CommandDword13;
+    ULONG CommandDword14;
+    ULONG CommandDword15;
+} PACKED NVME_SUBMISSION_ENTRY, *PNVME_SUBMISSION_ENTRY;
+
+/*++
+
+Structure Description:
+
+    This structure defines an NVMe completion queue entry.
+
+Members:
+
+    Result - Stores the command specific result.
+
+    Reserved - Stores reserved space.
+
+    SubmissionHead - Stores the controller's current submission queue head.
+
+    SubmissionQueueId - Stores the submission queue the command came from.
+
+    CommandId - Stores the ID of the completed command.
+
+    Status - Stores the phase tag and the command status. See
+        NVME_COMPLETION_STATUS_* definitions.
+
+--*/
+
+typedef struct _NVME_COMPLETION_ENTRY {
+    ULONG Result;
+    ULONG Reserved;
+    USHORT SubmissionHead;
+    USHORT SubmissionQueueId;
+    USHORT CommandId;
+    volatile USHORT Status;
+} PACKED NVME_COMPLETION_ENTRY, *PNVME_COMPLETION_ENTRY;
+
+/*++
+
+Structure Description:
+
+    This structure defines the driver's state for one command ID on a queue.
+
+Members:
+
+    Irp - Stores a pointer to the IRP using the command, or NULL if the driver
+        issued the command itself.
+
+    IoSize - Stores the size of the transfer currently in flight.
+
+    PrpList - Stores a pointer to the command's PRP list.
+
+    PrpListPhysicalAddress - Stores the physical address of the PRP list.
+
+    Done - Stores a boolean indicating that a command the driver issued
+        itself has completed.
+
+    Abandoned - Stores a boolean indicating that the issuer of the driver's
+        own command gave up waiting, so the completion must free the command.
+
+    Status - Stores the completion status of the driver's own command.
+
+    Result - Stores the command specific result of the driver's own command.
+
+--*/
+
+typedef struct _NVME_COMMAND {
+    PIRP Irp;
+    UINTN IoSize;
+    PULONGLONG PrpList;
+    PHYSICAL_ADDRESS PrpListPhysicalAddress;
+    BOOL Done;
+    BOOL Abandoned;
+    KSTATUS Status;
+    ULONG Result;
+} NVME_COMMAND, *PNVME_COMMAND;
+
+/*++
+
+Structure Description:
+
+    This structure defines a submission and completion queue pair. Queue zero
+    is the admin queue.
+
+Members:
+
+    Controller - Stores a pointer back to the controller.
+
+    QueueId - Stores the queue ID.
+
+    VectorIndex - Stores the index of the interrupt vector that signals the
+        completion queue.
+
+    IoBuffer - Stores a pointer to the I/O buffer holding the queues and PRP
+        lists.
+
+    SubmissionQueue - Stores a pointer to the submission queue.
+
+    CompletionQueue - Stores a pointer to the completion queue.
+
+    SubmissionQueuePhysicalAddress - Stores the physical address of the
+        submission queue.
+
+    CompletionQueuePhysicalAddress - Stores the physical address of the
+        completion queue.
+
+    Depth - Stores the number of entries in each queue.
+
+    SubmissionTail - Stores the index where the next command is written.
+
+    CompletionHead - Stores the index of the next completion to look at.
+
+    Phase - Stores the phase tag that marks a new completion entry.
+
+    Lock - Stores the spin lock that serializes command state, submission,
+        and completion processing. It is acquired at dispatch level.
+
+    CommandEvent - Stores a pointer to an event signaled whenever a command is
+        freed or one of the driver's own commands completes.
+
+    CommandCount - Stores the number of commands that may be outstanding.
+
+    BusyCommands - Stores the bitmask of allocated command IDs.
+
+    Commands - Stores the per-command state.
+
+    PolledCommand - Stores the command state used by polled crash dump I/O,
+        which has its own PRP list.
+
+--*/
+
+typedef struct _NVME_QUEUE {
+    PNVME_CONTROLLER Controller;
+    ULONG QueueId;
+    ULONG VectorIndex;
+    PIO_BUFFER IoBuffer;
+    PNVME_SUBMISSION_ENTRY SubmissionQueue;
+    PNVME_COMPLETION_ENTRY CompletionQueue;
+    PHYSICAL_ADDRESS SubmissionQueuePhysicalAddress;
+    PHYSICAL_ADDRESS CompletionQueuePhysicalAddress;
+    ULONG Depth;
+    ULONG SubmissionTail;
+    ULONG CompletionHead;
+    USHORT Phase;
+    KSPIN_LOCK Lock;
+    PKEVENT CommandEvent;
+    ULONG CommandCount;
+    ULONG BusyCommands;
+    NVME_COMMAND Commands[NVME_MAX_QUEUE_COMMANDS];
+    NVME_COMMAND PolledCommand;
+} NVME_QUEUE, *PNVME_QUEUE;
+
+/*++
+
+Structure Description:
+
+    This structure defines an interrupt vector connected for the controller.
+
+Members:
+
+    Controller - Stores a pointer back to the controller.
+
+    Index - Stores the controller's index for this vector.
+
+    Vector - Stores the system interrupt vector.
+
+    InterruptHandle - Stores the handle of the connected interrupt.
+
+--*/
+
+typedef struct _NVME_VECTOR {
+    PNVME_CONTROLLER Controller;
+    ULONG Index;
+    ULONGLONG Vector;
+    HANDLE InterruptHandle;
+} NVME_VECTOR, *PNVME_VECTOR;
+
+/*++
+
+Structure Description:
+
+    This structure defines state associated with an NVMe namespace (the bus
+    driver's context for the disk device).
+
+Members:
+
+    Type - Stores the context type.
+
+    Controller - Stores a pointer back up to the controller.
+
+    NamespaceId - Stores the namespace ID.
+
+    OsDevice - Stores a pointer to the OS device once the disk has started.
+
+    Device - Stores a pointer to the child device created for the namespace.
+
+    BlockSize - Stores the logical block size, in bytes.
+
+    BlockShift - Stores the base two logarithm of the block size.
+
+    TotalBlocks - Stores the total number of blocks in the namespace.
+
+    DiskInterface - Stores the disk interface.
+
+--*/
+
+typedef struct _NVME_NAMESPACE {
+    NVME_CONTEXT_TYPE Type;
+    PNVME_CONTROLLER Controller;
+    ULONG NamespaceId;
+    PDEVICE OsDevice;
+    PDEVICE Device;
+    ULONG BlockSize;
+    ULONG BlockShift;
+    ULONGLONG TotalBlocks;
+    DISK_INTERFACE DiskInterface;
+} NVME_NAMESPACE, *PNVME_NAMESPACE;
+
+/*++
+
+Structure Description:
+
+    This structure defines state associated with an NVMe controller.
+
+Members:
+
+    Type - Stores the context type.
+
+    ControllerBase - Stores the virtual address of the controller's
+        registers.
+
+    DoorbellStride - Stores the distance between doorbell registers, in
+        bytes.
+
+    ReadyTimeout - Stores the time to wait for the controller to become ready
+        or disabled, in microseconds.
+
+    MaxQueueDepth - Stores the largest queue the controller supports, in
+        entries.
+
+    MaxTransferSize - Stores the largest transfer a single command may make,
+        in bytes.
+
+    NamespaceCount - Stores the number of namespaces the controller reports.
+
+    VolatileWriteCache - Stores a boolean indicating whether the controller
+        has a write cache that needs flushing.
+
+    AdminLock - Stores a pointer to the lock serializing admin commands and
+        use of the identify buffer.
+
+    IdentifyBuffer - Stores a pointer to the I/O buffer receiving identify
+        data.
+
+    Identify - Stores a pointer to the identify data.
+
+    IdentifyPhysicalAddress - Stores the physical address of the identify
+        data.
+
+    Queues - Stores pointers to the queue pairs, indexed by queue ID. Queue
+        zero is the admin queue.
+
+    IoQueueCount - Stores the number of I/O queue pairs created. Processors
+        share queues round robin if there are fewer queues than processors.
+
+    InterruptLine - Stores the interrupt line for legacy interrupts, or
+        INVALID_INTERRUPT_LINE if message signaled interrupts are in use.
+
+    InterruptResourcesFound - Stores a boolean indicating whether or not the
+        interrupt fields are valid.
+
+    MaskInterrupts - Stores a boolean indicating whether the interrupt service
+        routine must mask the controller's interrupt until the DPC runs, which
+        is the case for anything but MSI-X.
+
+    VectorCount - Stores the number of interrupt vectors in use.
+
+    Vectors - Stores the interrupt vectors. I/O queues are spread across
+        these; the admin queue always uses the first.
+
+    RequestedVectorCount - Stores the number of message signaled vectors
+        requested when querying resources.
+
+    PciMsiFlags - Stores a bitmask of MSI state. See NVME_PCI_MSI_FLAG_*.
+
+    PciMsiInterface - Stores the PCI MSI/MSI-X interface.
+
+    Namespaces - Stores pointers to the namespace contexts, indexed by
+        namespace ID minus one.
+
+--*/
+
+struct _NVME_CONTROLLER {
+    NVME_CONTEXT_TYPE Type;
+    PVOID ControllerBase;
+    ULONG DoorbellStride;
+    ULONGLONG ReadyTimeout;
+    ULONG MaxQueueDepth;
+    ULONG MaxTransferSize;
+    ULONG NamespaceCount;
+    BOOL VolatileWriteCache;
+    PQUEUED_LOCK AdminLock;
+    PIO_BUFFER IdentifyBuffer;
+    PUCHAR Identify;
+    PHYSICAL_ADDRESS IdentifyPhysicalAddress;
+    PNVME_QUEUE Queues[NVME_MAX_IO_QUEUES + 1];
+    volatile ULONG IoQueueCount;
+    ULONGLONG InterruptLine;
+    BOOL InterruptResourcesFound;
+    BOOL MaskInterrupts;
+    ULONG VectorCount;
+    NVME_VECTOR Vectors[NVME_MAX_VECTORS];
+    ULONG RequestedVectorCount;
+    ULONG PciMsiFlags;
+    INTERFACE_PCI_MSI PciMsiInterface;
+    PNVME_NAMESPACE Namespaces[NVME_MAX_NAMESPACES];
+};
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
@@ -3742,6 +3742,14 @@ Return Value:
             return "IDE";
         }
 
+        if (Subclass == PCI_CLASS_MASS_STORAGE_SATA_AHCI) {
+            return "AHCI";
+        }
+
+        if (Subclass == PCI_CLASS_MASS_STORAGE_NVME) {
+            return "NVMe";
+        }
+
         break;
 
     case PCI_CLASS_BRIDGE:
@@ -1485,6 +1485,8 @@ typedef enum _IO_OBJECT_TYPE {
     IoObjectTerminalSlave,
     IoObjectSharedMemoryObject,
     IoObjectSymbolicLink,
+    IoObjectEventQueue,
+    IoObjectIoRing,
     IoObjectTypeCount
 } IO_OBJECT_TYPE, *PIO_OBJECT_TYPE;
 
@@ -1693,6 +1695,16 @@ Structure Description:
 
     Async - Stores an optional pointer to the asynchronous object state.
 
+    EventQueueLock - Stores a pointer to the lock protecting the event queue
+        list. This is created the first time the object is registered with an
+        event queue.
+
+    EventQueueList - Stores the list of event queue registrations interested
+        in this object's events.
+
+    WaitList - Stores the list of one-shot kernel waits armed for this
+        object's events. This is protected by the event queue lock.
+
 --*/
 
 typedef struct _IO_OBJECT_STATE {
@@ -1703,6 +1715,9 @@ typedef struct _IO_OBJECT_STATE {
     PKEVENT ErrorEvent;
     volatile ULONG Events;
     PIO_ASYNC_STATE Async;
+    PQUEUED_LOCK EventQueueLock;
+    LIST_ENTRY EventQueueList;
+    LIST_ENTRY WaitList;
 } IO_OBJECT_STATE, *PIO_OBJECT_STATE;
 
 typedef enum _IRP_MAJOR_CODE {
@@ -5517,6 +5532,34 @@ Return Value:
 
 --*/
 
+INTN
+IoSysSendFile (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine transfers data from a file to another handle without passing
+    it through user mode. When the destination is a socket, the page cache
+    pages holding the file data are handed to the protocol directly.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or the number of bytes completed (a positive integer) on
+    success.
+
+    Error status code (a negative integer) on failure.
+
+--*/
+
 INTN
 IoSysFlush (
     PVOID SystemCallParameter
@@ -5646,6 +5689,134 @@ Return Value:
 
 --*/
 
+INTN
+IoSysCreateEventQueue (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates an event queue on behalf of a user mode application.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+INTN
+IoSysEventQueueControl (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine adds, modifies, or removes an I/O handle's registration with
+    an event queue.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+INTN
+IoSysEventQueueWait (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine waits for events on an event queue and returns a batch of
+    them.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    The number of events returned (a non-negative integer) on success.
+
+    Error status code (a negative integer) on failure.
+
+--*/
+
+INTN
+IoSysCreateIoRing (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates an I/O ring on behalf of a user mode application.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+INTN
+IoSysIoRingEnter (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine consumes new submissions from an I/O ring and optionally
+    waits for completions to arrive.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    The number of submissions consumed (a non-negative integer) on success.
+
+    Error status code (a negative integer) on failure.
+
+--*/
+
 INTN
 IoSysDuplicateHandle (
     PVOID SystemCallParameter
@@ -6441,6 +6612,37 @@ Return Value:
 
 --*/
 
+KERNEL_API
+KSTATUS
+IoPrefetchCachedData (
+    PIO_HANDLE Handle,
+    IO_OFFSET Offset,
+    UINTN Size
+    );
+
+/*++
+
+Routine Description:
+
+    This routine starts reading the given range of a cached file into the page
+    cache in the background. This is only a hint: the read-ahead is skipped if
+    the object is not cached, another read-ahead is already in flight, or
+    physical memory is tight.
+
+Arguments:
+
+    Handle - Supplies a pointer to the I/O handle of the object to prefetch.
+
+    Offset - Supplies the file offset to start prefetching at.
+
+    Size - Supplies the number of bytes to prefetch.
+
+Return Value:
+
+    Status code.
+
+--*/
+
 KSTATUS
 IoCloseProcessHandles (
     PKPROCESS Process,
@@ -6514,6 +6716,32 @@ Return Value:
 
 --*/
 
+KSTATUS
+IoPerformSpawnFileActions (
+    PVOID Actions,
+    ULONG ActionCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs the file actions requested for a spawned process.
+    It runs in the context of the new process before its image is loaded.
+
+Arguments:
+
+    Actions - Supplies a pointer to the array of SPAWN_FILE_ACTION structures
+        to perform, in order. Paths in this array must be kernel mode copies.
+
+    ActionCount - Supplies the number of elements in the array.
+
+Return Value:
+
+    Status code. Processing stops at the first action that fails.
+
+--*/
+
 KSTATUS
 IoOpenPageFile (
     PSTR Path,
@@ -7358,6 +7586,35 @@ Return Value:
 
 --*/
 
+PPAGE_CACHE_ENTRY
+IoLookupPageCacheEntry (
+    PIO_HANDLE Handle,
+    IO_OFFSET Offset
+    );
+
+/*++
+
+Routine Description:
+
+    This routine looks for a page cache entry that already holds the data at
+    the given offset of the object behind the handle. It never performs I/O.
+
+Arguments:
+
+    Handle - Supplies a pointer to the I/O handle of a cacheable object.
+
+    Offset - Supplies the page-aligned offset into the object.
+
+Return Value:
+
+    Returns a pointer to the page cache entry with a reference taken on
+    behalf of the caller, who must release it with
+    IoPageCacheEntryReleaseReference.
+
+    NULL if the object is not cacheable or the page is not in the cache.
+
+--*/
+
 VOID
 IoPageCacheEntryAddReference (
     PPAGE_CACHE_ENTRY Entry
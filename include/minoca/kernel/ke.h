@@ -94,6 +94,12 @@ Module Name:
 #define KERNEL_MAX_ARGUMENT_VALUES 10
 #define KERNEL_MAX_COMMAND_LINE 4096
 
+//
+// Define the number of fractional bits in a scheduler load average.
+//
+
+#define SCHEDULER_LOAD_SHIFT 8
+
 //
 // Work queue flags.
 //
@@ -246,6 +252,8 @@ typedef enum _KE_INFORMATION_TYPE {
     KeInformationProcessorUsage,
     KeInformationProcessorCount,
     KeInformationKernelCommandLine,
+    KeInformationSchedulerStatistics,
+    KeInformationWorkQueueStatistics,
 } KE_INFORMATION_TYPE, *PKE_INFORMATION_TYPE;
 
 typedef enum _SYSTEM_RESET_TYPE {
@@ -295,6 +303,9 @@ typedef struct _SCHEDULER_GROUP_ENTRY
 
 typedef struct _SCHEDULER_GROUP SCHEDULER_GROUP, *PSCHEDULER_GROUP;
 typedef struct _DPC DPC, *PDPC;
+typedef struct _KQUEUED_SPIN_LOCK_HANDLE
+    KQUEUED_SPIN_LOCK_HANDLE, *PKQUEUED_SPIN_LOCK_HANDLE;
+
 typedef struct _PROCESSOR_START_BLOCK
     PROCESSOR_START_BLOCK, *PPROCESSOR_START_BLOCK;
 
@@ -375,6 +386,64 @@ typedef struct _PROCESSOR_CYCLE_ACCOUNTING {
 
 /*++
 
+Structure Description:
+
+    This structure defines a waiter's place in line for a queued spin lock.
+    Each acquirer supplies its own handle, usually on its stack, and spins
+    only on that handle. This keeps waiters from fighting over the lock's
+    cache line and grants the lock in the order it was requested.
+
+Members:
+
+    Next - Stores a pointer to the handle of the next waiter in line.
+
+    Waiting - Stores a non-zero value while the owner of this handle is
+        waiting for the lock. The previous owner clears it to pass the lock
+        on.
+
+--*/
+
+struct _KQUEUED_SPIN_LOCK_HANDLE {
+    volatile PKQUEUED_SPIN_LOCK_HANDLE Next;
+    volatile ULONG Waiting;
+};
+
+/*++
+
+Structure Description:
+
+    This structure defines a fair queued (MCS) spin lock.
+
+Members:
+
+    Tail - Stores a pointer to the handle of the last waiter in line, or NULL
+        if the lock is free.
+
+    Owner - Stores a pointer to the handle of the current lock holder.
+
+    OwningThread - Stores a pointer to the thread that holds the lock.
+
+    AcquireCount - Stores the number of times the lock has been acquired.
+
+    ContentionCount - Stores the number of acquisitions that had to wait for
+        another holder.
+
+    SpinCount - Stores the total number of spin iterations waiters have
+        performed on this lock.
+
+--*/
+
+typedef struct _KQUEUED_SPIN_LOCK {
+    volatile PKQUEUED_SPIN_LOCK_HANDLE Tail;
+    PKQUEUED_SPIN_LOCK_HANDLE Owner;
+    volatile PVOID OwningThread;
+    UINTN AcquireCount;
+    UINTN ContentionCount;
+    UINTN SpinCount;
+} KQUEUED_SPIN_LOCK, *PKQUEUED_SPIN_LOCK;
+
+/*++
+
 Structure Description:
 
     This structure contains the context for a scheduling group.
@@ -396,6 +465,10 @@ Structure Description:
     ThreadCount - Stores the number of threads, ready or not, that live in the
         group.
 
+    Weight - Stores the relative share of the processor this group gets among
+        its sibling groups and threads. A weight of SCHEDULER_DEFAULT_WEIGHT
+        is equivalent to a thread with a nice value of zero.
+
 --*/
 
 struct _SCHEDULER_GROUP {
@@ -405,6 +478,7 @@ struct _SCHEDULER_GROUP {
     PSCHEDULER_GROUP_ENTRY Entries;
     UINTN EntryCount;
     UINTN ThreadCount;
+    ULONG Weight;
 };
 
 /*++
@@ -423,7 +497,8 @@ Structure Description:
 
     ReadyThreadCount - Stores the number of threads inside this group and all
         its children (meaning this includes all ready threads inside child and
-        grandchild groups).
+        grandchild groups). For the root group entry of a processor, this also
+        includes the ready real-time threads.
 
     Scheduler - Stores a pointer to the root CPU this group belongs to.
 
@@ -441,21 +516,85 @@ struct _SCHEDULER_GROUP_ENTRY {
 
 /*++
 
+Structure Description:
+
+    This structure contains the load balancing statistics for a processor's
+    scheduler.
+
+Members:
+
+    ReadyThreadCount - Stores the number of threads ready or running on the
+        processor at the time the statistics were collected.
+
+    LoadAverage - Stores the decaying average number of ready threads on the
+        processor, as a fixed point value with SCHEDULER_LOAD_SHIFT fractional
+        bits.
+
+    BalanceCount - Stores the number of periodic balancing passes the
+        processor has performed.
+
+    PushCount - Stores the number of threads this processor pushed to less
+        loaded processors.
+
+    PullCount - Stores the number of threads this processor pulled from
+        busier processors while idle.
+
+    CacheHotCount - Stores the number of times a thread on this processor was
+        passed over for migration because it ran too recently.
+
+--*/
+
+typedef struct _SCHEDULER_BALANCE_STATISTICS {
+    UINTN ReadyThreadCount;
+    UINTN LoadAverage;
+    UINTN BalanceCount;
+    UINTN PushCount;
+    UINTN PullCount;
+    UINTN CacheHotCount;
+} SCHEDULER_BALANCE_STATISTICS, *PSCHEDULER_BALANCE_STATISTICS;
+
+/*++
+
 Structure Description:
 
     This structure contains the scheduler context for a specific processor.
 
 Members:
 
-    Lock - Stores the spin lock serializing access to the scheduling data.
+    Lock - Stores the queued spin lock serializing access to the scheduling
+        data.
 
     Group - Stores the fixed head scheduling group for this processor.
 
+    LastTick - Stores the clock interrupt count at the time the running thread
+        was last charged for a tick.
+
+    RealTimeReadyMask - Stores a bitmask of which real-time priority queues
+        are non-empty. Bit N corresponds to priority N.
+
+    RealTimeQueues - Stores the lists of ready real-time threads, one for
+        each real-time priority level.
+
+    NextBalanceTick - Stores the clock interrupt count at which the next
+        periodic load balancing pass should occur.
+
+    BalancePending - Stores a boolean indicating that the clock interrupt has
+        requested a load balancing pass at the next scheduler entry.
+
+    Statistics - Stores the load balancing statistics for this processor,
+        including the current load average.
+
 --*/
 
 struct _SCHEDULER_DATA {
-    KSPIN_LOCK Lock;
+    KQUEUED_SPIN_LOCK Lock;
     SCHEDULER_GROUP_ENTRY Group;
+    UINTN LastTick;
+    ULONG RealTimeReadyMask;
+    LIST_ENTRY RealTimeQueues[SCHEDULER_REAL_TIME_PRIORITY_COUNT];
+    UINTN NextBalanceTick;
+    BOOL BalancePending;
+    SCHEDULER_BALANCE_STATISTICS Statistics;
 };
 
 /*++
@@ -651,6 +790,12 @@ Structure Description:
 
     CpuVersion - Stores the processor identification information for this CPU.
 
+    PoolCache - Stores a pointer to the memory manager's per-processor cache
+        of small pool allocations.
+
+    PhysicalPageCache - Stores a pointer to the memory manager's
+        per-processor list of free physical pages.
+
 --*/
 
 typedef struct _PROCESSOR_BLOCK PROCESSOR_BLOCK, *PPROCESSOR_BLOCK;
@@ -686,6 +831,8 @@ struct _PROCESSOR_BLOCK {
     PVOID SwapPage;
     UINTN NmiCount;
     PROCESSOR_IDENTIFICATION CpuVersion;
+    PVOID PoolCache;
+    PVOID PhysicalPageCache;
 };
 
 /*++
@@ -715,6 +862,80 @@ typedef struct _PROCESSOR_USAGE_INFORMATION {
 
 /*++
 
+Structure Description:
+
+    This structure defines scheduler load balancing information for a
+    processor.
+
+Members:
+
+    ProcessorNumber - Stores the processor number to query.
+
+    Statistics - Stores the load balancing statistics for the processor.
+
+--*/
+
+typedef struct _SCHEDULER_STATISTICS_INFORMATION {
+    UINTN ProcessorNumber;
+    SCHEDULER_BALANCE_STATISTICS Statistics;
+} SCHEDULER_STATISTICS_INFORMATION, *PSCHEDULER_STATISTICS_INFORMATION;
+
+/*++
+
+Structure Description:
+
+    This structure contains the statistics for a work queue.
+
+Members:
+
+    ThreadCount - Stores the number of worker threads currently servicing the
+        queue.
+
+    IdleThreadCount - Stores the number of worker threads currently waiting
+        for work.
+
+    PeakThreadCount - Stores the largest number of worker threads the queue
+        has had at once.
+
+    StallThreadCount - Stores the number of worker threads created because
+        the existing workers made no progress while work was pending.
+
+    PendingCount - Stores the number of work items currently waiting to run.
+
+    QueuedCount - Stores the total number of work items queued.
+
+    HighPriorityCount - Stores the total number of high priority work items
+        queued.
+
+    CompletedCount - Stores the total number of work items that have run.
+
+    StolenCount - Stores the number of work items run by a worker on a
+        different processor than the one that queued them.
+
+    AverageLatency - Stores the average time, in microseconds, between a work
+        item being queued and a worker picking it up.
+
+    MaximumLatency - Stores the longest time, in microseconds, a work item has
+        waited to be picked up.
+
+--*/
+
+typedef struct _WORK_QUEUE_STATISTICS {
+    UINTN ThreadCount;
+    UINTN IdleThreadCount;
+    UINTN PeakThreadCount;
+    UINTN StallThreadCount;
+    UINTN PendingCount;
+    UINTN QueuedCount;
+    UINTN HighPriorityCount;
+    UINTN CompletedCount;
+    UINTN StolenCount;
+    ULONGLONG AverageLatency;
+    ULONGLONG MaximumLatency;
+} WORK_QUEUE_STATISTICS, *PWORK_QUEUE_STATISTICS;
+
+/*++
+
 Structure Description:
 
     This structure provides information about the number of processors in the
@@ -747,11 +968,26 @@ Structure Description:
 
     OwningThread - Stores a pointer to the thread that is holding the lock.
 
+    AcquireCount - Stores the number of times the lock has been acquired.
+
+    ContentionCount - Stores the number of acquisitions that found the lock
+        already held.
+
+    SpinCount - Stores the number of contended acquisitions that got the lock
+        by spinning while the owner ran on another processor.
+
+    SleepCount - Stores the number of contended acquisitions that had to
+        block.
+
 --*/
 
 typedef struct _QUEUED_LOCK {
     OBJECT_HEADER Header;
     PKTHREAD OwningThread;
+    UINTN AcquireCount;
+    UINTN ContentionCount;
+    UINTN SpinCount;
+    UINTN SleepCount;
 } QUEUED_LOCK, *PQUEUED_LOCK;
 
 /*++
@@ -1327,6 +1563,135 @@ Return Value:
 
 --*/
 
+KERNEL_API
+VOID
+KeInitializeQueuedSpinLock (
+    PKQUEUED_SPIN_LOCK Lock
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes a queued spin lock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to initialize.
+
+Return Value:
+
+    None.
+
+--*/
+
+KERNEL_API
+VOID
+KeAcquireQueuedSpinLock (
+    PKQUEUED_SPIN_LOCK Lock,
+    PKQUEUED_SPIN_LOCK_HANDLE Handle
+    );
+
+/*++
+
+Routine Description:
+
+    This routine acquires a queued spin lock. Waiters are granted the lock in
+    the order they arrived, and each spins only on its own handle. The lock
+    must be acquired at dispatch level or above, or with interrupts disabled,
+    so that a waiter is never preempted while holding a place in line.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to acquire.
+
+    Handle - Supplies a pointer to the caller's handle for this acquisition.
+        The handle must remain valid until the lock is released, and is
+        usually a local variable of the caller.
+
+Return Value:
+
+    None.
+
+--*/
+
+KERNEL_API
+VOID
+KeReleaseQueuedSpinLock (
+    PKQUEUED_SPIN_LOCK Lock
+    );
+
+/*++
+
+Routine Description:
+
+    This routine releases a queued spin lock, handing it directly to the next
+    waiter in line if there is one.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+KERNEL_API
+BOOL
+KeTryToAcquireQueuedSpinLock (
+    PKQUEUED_SPIN_LOCK Lock,
+    PKQUEUED_SPIN_LOCK_HANDLE Handle
+    );
+
+/*++
+
+Routine Description:
+
+    This routine makes one attempt to acquire a queued spin lock. It does not
+    get in line if the lock is held.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to attempt to acquire.
+
+    Handle - Supplies a pointer to the caller's handle for this acquisition,
+        which must remain valid until the lock is released if the acquire
+        succeeds.
+
+Return Value:
+
+    TRUE if the lock was acquired.
+
+    FALSE if the lock was not acquired.
+
+--*/
+
+KERNEL_API
+BOOL
+KeIsQueuedSpinLockHeld (
+    PKQUEUED_SPIN_LOCK Lock
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a queued spin lock is held or free.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to check.
+
+Return Value:
+
+    TRUE if the lock has been acquired.
+
+    FALSE if the lock is free.
+
+--*/
+
 KERNEL_API
 PSHARED_EXCLUSIVE_LOCK
 KeCreateSharedExclusiveLock (
@@ -2355,6 +2720,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 ULONG
 KeGetCurrentProcessorNumber (
     VOID
@@ -2377,6 +2743,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 ULONG
 KeGetActiveProcessorCount (
     VOID
@@ -2875,6 +3242,34 @@ Return Value:
 
 --*/
 
+KERNEL_API
+VOID
+KeGetWorkQueueStatistics (
+    PWORK_QUEUE WorkQueue,
+    PWORK_QUEUE_STATISTICS Statistics
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns a snapshot of the statistics for a work queue. The
+    counters are gathered without synchronization, so they may be slightly
+    inconsistent with each other.
+
+Arguments:
+
+    WorkQueue - Supplies a pointer to the work queue to query. Supply NULL to
+        query the system work queue.
+
+    Statistics - Supplies a pointer where the statistics will be returned.
+
+Return Value:
+
+    None.
+
+--*/
+
 KERNEL_API
 KSTATUS
 KeGetRandomBytes (
@@ -3372,6 +3767,69 @@ Return Value:
 
 --*/
 
+VOID
+KeInitializeSchedulerEntry (
+    PSCHEDULER_ENTRY Entry,
+    PSCHEDULER_ENTRY Parent,
+    PSCHEDULER_ENTRY Template
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes a thread's scheduler entry.
+
+Arguments:
+
+    Entry - Supplies a pointer to the thread scheduler entry to initialize.
+
+    Parent - Supplies a pointer to the group entry the thread belongs to.
+
+    Template - Supplies an optional pointer to a scheduler entry whose
+        scheduling class and priority should be inherited. If NULL, the entry
+        is placed in the fair share class with the default nice value.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+KeSetThreadSchedulingParameters (
+    PKTHREAD Thread,
+    SCHEDULER_CLASS Class,
+    LONG Priority
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets the scheduling class and priority of a thread. If the
+    thread is currently ready, it is moved to the appropriate queue. Callers
+    are responsible for checking permissions.
+
+Arguments:
+
+    Thread - Supplies a pointer to the thread to modify.
+
+    Class - Supplies the new scheduling class.
+
+    Priority - Supplies the new priority. For real-time classes this is a
+        fixed priority between SCHEDULER_REAL_TIME_PRIORITY_MIN and
+        SCHEDULER_REAL_TIME_PRIORITY_MAX. For the fair share class this is a
+        nice value between SCHEDULER_NICE_MIN and SCHEDULER_NICE_MAX.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if the class or priority is out of range.
+
+--*/
+
 VOID
 KeIdleLoop (
     VOID
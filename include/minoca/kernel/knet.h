@@ -208,6 +208,15 @@ Module Name:
 
 #define SOCKET_IO_DONT_ROUTE 0x00000100
 
+//
+// This flag is set only by the kernel. It indicates that the I/O buffer being
+// sent may be backed by the page cache, and that the protocol may hold
+// references on those pages until the data is acknowledged rather than copying
+// it. It is stripped from flags supplied by user mode.
+//
+
+#define SOCKET_IO_REFERENCE_BUFFER 0x80000000
+
 //
 // Define common internet protocol numbers, as defined by the IANA.
 //
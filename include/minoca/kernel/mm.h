@@ -72,7 +72,7 @@ Module Name:
 
 #define USER_STACK_HEADROOM (128 * _1MB)
 #define USER_STACK_MAX (((UINTN)MAX_USER_ADDRESS + 1) * 3 / 4)
-#define MM_STATISTICS_VERSION 1
+#define MM_STATISTICS_VERSION 3
 #define MM_STATISTICS_MAX_VERSION 0x10000000
 
 //
@@ -126,6 +126,8 @@ Module Name:
 #define IMAGE_SECTION_DESTROYING        0x00000100
 #define IMAGE_SECTION_DESTROYED         0x00000200
 #define IMAGE_SECTION_WAS_WRITABLE      0x00000400
+#define IMAGE_SECTION_SEQUENTIAL        0x00000800
+#define IMAGE_SECTION_RANDOM            0x00001000
 
 //
 // Define a mask of image section flags that should be transfered when an image
@@ -135,7 +137,7 @@ Module Name:
 #define IMAGE_SECTION_COPY_MASK                             \
     (IMAGE_SECTION_ACCESS_MASK | IMAGE_SECTION_NON_PAGED |  \
      IMAGE_SECTION_SHARED | IMAGE_SECTION_MAP_SYSTEM_CALL | \
-     IMAGE_SECTION_WAS_WRITABLE)
+     IMAGE_SECTION_WAS_WRITABLE | IMAGE_SECTION_ADVICE_MASK)
 
 //
 // Define a mask of image section access flags.
@@ -144,6 +146,14 @@ Module Name:
 #define IMAGE_SECTION_ACCESS_MASK \
     (IMAGE_SECTION_READABLE | IMAGE_SECTION_WRITABLE | IMAGE_SECTION_EXECUTABLE)
 
+//
+// Define the mask of image section flags that carry the caller's access
+// pattern advice.
+//
+
+#define IMAGE_SECTION_ADVICE_MASK \
+    (IMAGE_SECTION_SEQUENTIAL | IMAGE_SECTION_RANDOM)
+
 //
 // Define the mask of flags that is internal and should not be specified by
 // outside callers.
@@ -220,6 +230,16 @@ Module Name:
 
 #define MAX_IO_VECTOR_COUNT 1024
 
+//
+// Define the number of processors whose use of an address space is tracked so
+// that TLB invalidations can be sent only where they are needed. Processors
+// numbered beyond this are assumed to be using every address space.
+//
+
+#define ADDRESS_SPACE_TRACKED_PROCESSORS 64
+#define ADDRESS_SPACE_PROCESSOR_WORDS \
+    (ADDRESS_SPACE_TRACKED_PROCESSORS / (sizeof(ULONG) * BITS_PER_BYTE))
+
 //
 // Define the native sized user write function.
 // TODO: 64-bit.
@@ -340,6 +360,7 @@ typedef enum _MEMORY_WARNING_LEVEL {
 typedef enum _MM_INFORMATION_TYPE {
     MmInformationInvalid,
     MmInformationSystemMemory,
+    MmInformationFaultAround,
 } MM_INFORMATION_TYPE, *PMM_INFORMATION_TYPE;
 
 /*++
@@ -637,6 +658,22 @@ Structure Description:
     NonPagedPhysicalPages - Stores the number of physical pages that are
         pinned in memory and cannot be paged out to disk.
 
+    LargestFreePhysicalRun - Stores the size, in pages, of the largest free
+        block in the physical page allocator.
+
+    PhysicalFragmentation - Stores the percentage of free physical pages that
+        are not part of a maximum sized free block. Zero means free memory is
+        entirely unfragmented.
+
+    ZeroedPhysicalPages - Stores the number of pre-zeroed pages currently
+        waiting to back anonymous page faults.
+
+    ZeroPageHits - Stores the number of anonymous page faults satisfied from
+        the pool of pre-zeroed pages.
+
+    ZeroPageMisses - Stores the number of anonymous page faults that found the
+        pre-zeroed pool empty and had to zero a page themselves.
+
 --*/
 
 typedef struct _MM_STATISTICS {
@@ -647,6 +684,11 @@ typedef struct _MM_STATISTICS {
     UINTN PhysicalPages;
     UINTN AllocatedPhysicalPages;
     UINTN NonPagedPhysicalPages;
+    UINTN LargestFreePhysicalRun;
+    ULONG PhysicalFragmentation;
+    UINTN ZeroedPhysicalPages;
+    UINTN ZeroPageHits;
+    UINTN ZeroPageMisses;
 } MM_STATISTICS, *PMM_STATISTICS;
 
 /*++
@@ -698,6 +740,9 @@ Structure Description:
 
     BreakEnd - Stores the end address of the program break.
 
+    ActiveProcessors - Stores a bitmap of the processors that currently have
+        this address space loaded.
+
 --*/
 
 typedef struct _ADDRESS_SPACE {
@@ -709,6 +754,7 @@ typedef struct _ADDRESS_SPACE {
     PVOID MaxMemoryMap;
     PVOID BreakStart;
     PVOID BreakEnd;
+    volatile ULONG ActiveProcessors[ADDRESS_SPACE_PROCESSOR_WORDS];
 } ADDRESS_SPACE, *PADDRESS_SPACE;
 
 /*++
@@ -1006,6 +1052,42 @@ Return Value:
 
 --*/
 
+KERNEL_API
+PIO_BUFFER
+MmReferenceIoBufferRange (
+    PIO_BUFFER IoBuffer,
+    UINTN Offset,
+    UINTN Size
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a new I/O buffer that describes a range of a page
+    cache backed I/O buffer without copying it. The new buffer takes its own
+    references on the page cache entries, so the data stays valid after the
+    original buffer is freed.
+
+Arguments:
+
+    IoBuffer - Supplies a pointer to the page cache backed I/O buffer.
+
+    Offset - Supplies the offset into the I/O buffer where the range begins.
+
+    Size - Supplies the size of the range, in bytes.
+
+Return Value:
+
+    Returns a pointer to the new I/O buffer on success. Offset zero of the new
+    buffer corresponds to the start of the range. The caller must free it with
+    MmFreeIoBuffer.
+
+    NULL if any page in the range is not backed by the page cache or on
+    allocation failure.
+
+--*/
+
 KERNEL_API
 KSTATUS
 MmCreateIoBuffer (
@@ -2874,6 +2956,40 @@ Return Value:
 
 --*/
 
+BOOL
+MmUserCompareExchange32 (
+    PVOID Buffer,
+    PULONG Value,
+    ULONG ExchangeValue
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs an atomic 32-bit compare exchange on user mode
+    memory. This is assumed to be naturally aligned.
+
+Arguments:
+
+    Buffer - Supplies a pointer to the user mode value to compare and
+        potentially exchange.
+
+    Value - Supplies a pointer that on input contains the value to compare
+        against. On output, returns the original value at the buffer.
+
+    ExchangeValue - Supplies the value to write if the comparison returns
+        equality.
+
+Return Value:
+
+    TRUE if the memory was accessed successfully. The caller must compare the
+    returned original value to determine whether the exchange happened.
+
+    FALSE if the access failed.
+
+--*/
+
 PMEMORY_RESERVATION
 MmCreateMemoryReservation (
     PVOID PreferredVirtualAddress,
@@ -105,7 +105,7 @@ Module Name:
 // be possible to raise this so long as it doesn't collide with INVALID_HANDLE.
 //
 
-#define OB_MAX_HANDLES 0x1000
+#define OB_MAX_HANDLES 0x8000
 
 typedef enum _OBJECT_TYPE {
     ObjectInvalid,
@@ -127,6 +127,8 @@ typedef enum _OBJECT_TYPE {
     ObjectTerminalMaster,
     ObjectTerminalSlave,
     ObjectSharedMemoryObject,
+    ObjectEventQueue,
+    ObjectIoRing,
     ObjectMaxTypes
 } OBJECT_TYPE, *POBJECT_TYPE;
 
@@ -122,6 +122,20 @@ Module Name:
 #define PsIsSessionLeader(_Process) \
     ((_Process)->Identifiers.SessionId == (_Process)->Identifiers.ProcessId)
 
+//
+// This macro packs the argument for a user lock wake operation. The operation
+// and operand are applied to the second address, and the original value there
+// is compared with the comparison value to decide whether to also wake waiters
+// on the second address. Operands and comparison values are 12 bits wide.
+//
+
+#define USER_LOCK_WAKE_OP(_Operation, _Operand, _Comparison, _CompareValue) \
+    (((_Operation) << USER_LOCK_WAKE_OP_OPERATION_SHIFT) |                  \
+     ((_Comparison) << USER_LOCK_WAKE_OP_COMPARISON_SHIFT) |                \
+     (((_Operand) & USER_LOCK_WAKE_OP_VALUE_MASK) <<                        \
+      USER_LOCK_WAKE_OP_OPERAND_SHIFT) |                                    \
+     ((_CompareValue) & USER_LOCK_WAKE_OP_VALUE_MASK))
+
 //
 // ---------------------------------------------------------------- Definitions
 //
@@ -148,6 +162,31 @@ Module Name:
 #define SUPPLEMENTARY_GROUP_MAX 128
 #define SUPPLEMENTARY_GROUP_MIN 8
 
+//
+// Define the number of fixed priority levels in the real-time scheduling
+// classes. Larger values are higher priority.
+//
+
+#define SCHEDULER_REAL_TIME_PRIORITY_COUNT 32
+#define SCHEDULER_REAL_TIME_PRIORITY_MIN 0
+#define SCHEDULER_REAL_TIME_PRIORITY_MAX 31
+
+//
+// Define the range of nice values used by the fair share scheduling class.
+// Smaller values get a larger share of the processor.
+//
+
+#define SCHEDULER_NICE_MIN (-20)
+#define SCHEDULER_NICE_MAX 19
+#define SCHEDULER_NICE_DEFAULT 0
+
+//
+// Define the weight of a nice value of zero. Group weights are expressed in
+// these same units.
+//
+
+#define SCHEDULER_DEFAULT_WEIGHT 1024
+
 //
 // Define privileged permission bit indices.
 //
@@ -483,6 +522,16 @@ Module Name:
 
 #define USER_LOCK_PRIVATE 0x00000080
 
+//
+// Define the fields of the packed wake operation argument.
+//
+
+#define USER_LOCK_WAKE_OP_OPERATION_SHIFT 28
+#define USER_LOCK_WAKE_OP_COMPARISON_SHIFT 24
+#define USER_LOCK_WAKE_OP_OPERAND_SHIFT 12
+#define USER_LOCK_WAKE_OP_FIELD_MASK 0x0000000F
+#define USER_LOCK_WAKE_OP_VALUE_MASK 0x00000FFF
+
 //
 // Define the current version of the process start data structure.
 //
@@ -581,12 +630,56 @@ typedef enum _SCHEDULER_ENTRY_TYPE {
     SchedulerEntryGroup,
 } SCHEDULER_ENTRY_TYPE, *PSCHEDULER_ENTRY_TYPE;
 
+//
+// Define the scheduling classes. Real-time threads always run ahead of fair
+// share threads. FIFO real-time threads run until they block or yield, round
+// robin real-time threads are rotated among their priority level when their
+// time slice expires.
+//
+
+typedef enum _SCHEDULER_CLASS {
+    SchedulerClassInvalid,
+    SchedulerClassFairShare,
+    SchedulerClassRealTimeFifo,
+    SchedulerClassRealTimeRoundRobin,
+    SchedulerClassCount
+} SCHEDULER_CLASS, *PSCHEDULER_CLASS;
+
 typedef enum _USER_LOCK_OPERATION {
     UserLockInvalid,
     UserLockWait,
     UserLockWake,
+    UserLockRequeue,
+    UserLockWakeOperation,
 } USER_LOCK_OPERATION, *PUSER_LOCK_OPERATION;
 
+//
+// Define the operations a user lock wake operation can perform on the second
+// address.
+//
+
+typedef enum _USER_LOCK_WAKE_OP_OPERATION {
+    UserLockWakeOpSet,
+    UserLockWakeOpAdd,
+    UserLockWakeOpOr,
+    UserLockWakeOpAndNot,
+    UserLockWakeOpXor,
+} USER_LOCK_WAKE_OP_OPERATION, *PUSER_LOCK_WAKE_OP_OPERATION;
+
+//
+// Define the unsigned comparisons a user lock wake operation can make between
+// the original value at the second address and the comparison value.
+//
+
+typedef enum _USER_LOCK_WAKE_OP_COMPARISON {
+    UserLockWakeOpEqual,
+    UserLockWakeOpNotEqual,
+    UserLockWakeOpLessThan,
+    UserLockWakeOpLessOrEqual,
+    UserLockWakeOpGreaterThan,
+    UserLockWakeOpGreaterOrEqual,
+} USER_LOCK_WAKE_OP_COMPARISON, *PUSER_LOCK_WAKE_OP_COMPARISON;
+
 //
 // Define the different types of resource limits. These line up with the
 // RLIMIT_* definitions.
@@ -1506,6 +1599,24 @@ Structure Description:
     ListEntry - Stores pointers to the next and previous threads in the
         ready list.
 
+    Class - Stores the scheduling class of the entry. Groups are always in the
+        fair share class.
+
+    Priority - Stores the fixed priority for real-time entries, or the nice
+        value for fair share entries.
+
+    Weight - Stores the relative share of the processor this entry gets among
+        its fair share siblings.
+
+    Credit - Stores the credit remaining in the entry's current time slice,
+        in units where a clock tick of run time costs SCHEDULER_DEFAULT_WEIGHT.
+        This goes negative when an entry overruns its slice, and the debt is
+        carried into the next one.
+
+    LastRunTime - Stores the time counter value when the thread was last
+        switched out. This is used to avoid migrating threads whose working
+        set is likely still in the processor's cache.
+
 --*/
 
 typedef struct _SCHEDULER_ENTRY SCHEDULER_ENTRY, *PSCHEDULER_ENTRY;
@@ -1513,6 +1624,11 @@ struct _SCHEDULER_ENTRY {
     SCHEDULER_ENTRY_TYPE Type;
     PSCHEDULER_ENTRY Parent;
     LIST_ENTRY ListEntry;
+    SCHEDULER_CLASS Class;
+    LONG Priority;
+    ULONG Weight;
+    LONG Credit;
+    ULONGLONG LastRunTime;
 };
 
 /*++
@@ -2551,6 +2667,32 @@ Return Value:
 
 --*/
 
+INTN
+PsSysSetScheduling (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call that gets or sets the scheduling
+    class and priority of a process.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
 INTN
 PsSysUserLock (
     PVOID SystemCallParameter
@@ -3178,6 +3320,34 @@ Return Value:
 
 --*/
 
+INTN
+PsSysSpawnProcess (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a new child process running the given image. Unlike
+    fork followed by exec, the caller's address space is never duplicated:
+    the child starts with a fresh address space, a copy of the caller's
+    handles, and the requested file actions and attributes applied.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Error status code on failure.
+
+--*/
+
 INTN
 PsSysGetSetProcessId (
     PVOID SystemCallParameter
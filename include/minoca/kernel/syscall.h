@@ -166,12 +166,26 @@ Module Name:
 // Define memory mapping flags.
 //
 
-#define SYS_MAP_FLAG_READ      0x00000001
-#define SYS_MAP_FLAG_WRITE     0x00000002
-#define SYS_MAP_FLAG_EXECUTE   0x00000004
-#define SYS_MAP_FLAG_SHARED    0x00000008
-#define SYS_MAP_FLAG_FIXED     0x00000010
-#define SYS_MAP_FLAG_ANONYMOUS 0x00000020
+#define SYS_MAP_FLAG_READ       0x00000001
+#define SYS_MAP_FLAG_WRITE      0x00000002
+#define SYS_MAP_FLAG_EXECUTE    0x00000004
+#define SYS_MAP_FLAG_SHARED     0x00000008
+#define SYS_MAP_FLAG_FIXED      0x00000010
+#define SYS_MAP_FLAG_ANONYMOUS  0x00000020
+#define SYS_MAP_FLAG_ADVISE     0x00000040
+#define SYS_MAP_FLAG_SEQUENTIAL 0x00000080
+#define SYS_MAP_FLAG_RANDOM     0x00000100
+#define SYS_MAP_FLAG_WILL_NEED  0x00000200
+
+//
+// Define the mask of memory mapping flags that carry access pattern advice.
+// These may accompany a map request, or an unmap request with the advise flag
+// set, in which case the advice is applied to the region instead of unmapping
+// it.
+//
+
+#define SYS_MAP_ADVICE_MASK \
+    (SYS_MAP_FLAG_SEQUENTIAL | SYS_MAP_FLAG_RANDOM | SYS_MAP_FLAG_WILL_NEED)
 
 //
 // Define memory mapping flush flags.
@@ -259,6 +273,33 @@ Module Name:
     (POLL_EVENT_IN | POLL_EVENT_IN_HIGH_PRIORITY | POLL_EVENT_OUT | \
      POLL_EVENT_OUT_HIGH_PRIORITY)
 
+//
+// Define event queue registration flags.
+//
+
+//
+// Set this flag to report an event only when the I/O object signals it,
+// rather than for as long as the event remains set.
+//
+
+#define EVENT_QUEUE_FLAG_EDGE_TRIGGERED 0x00000001
+
+//
+// Set this flag to disable the registration after one event is reported. It
+// is rearmed by modifying the registration.
+//
+
+#define EVENT_QUEUE_FLAG_ONE_SHOT       0x00000002
+
+#define EVENT_QUEUE_FLAG_MASK \
+    (EVENT_QUEUE_FLAG_EDGE_TRIGGERED | EVENT_QUEUE_FLAG_ONE_SHOT)
+
+//
+// Define the maximum number of events returned by a single event queue wait.
+//
+
+#define EVENT_QUEUE_MAX_WAIT_EVENTS 1024
+
 //
 // Define the effective access permission flags.
 //
@@ -274,6 +315,62 @@ Module Name:
 #define TIMER_CONTROL_FLAG_USE_TIMER_NUMBER 0x00000001
 #define TIMER_CONTROL_FLAG_SIGNAL_THREAD    0x00000002
 
+//
+// Define the spawn process flags, which select the attributes applied to the
+// child before its image is loaded.
+//
+
+#define SPAWN_FLAG_RESET_IDS       0x00000001
+#define SPAWN_FLAG_PROCESS_GROUP   0x00000002
+#define SPAWN_FLAG_SIGNAL_DEFAULTS 0x00000004
+#define SPAWN_FLAG_SIGNAL_MASK     0x00000008
+
+#define SPAWN_FLAG_MASK            \
+    (SPAWN_FLAG_RESET_IDS |        \
+     SPAWN_FLAG_PROCESS_GROUP |    \
+     SPAWN_FLAG_SIGNAL_DEFAULTS |  \
+     SPAWN_FLAG_SIGNAL_MASK)
+
+//
+// Define the maximum number of file actions a single spawn call can perform.
+//
+
+#define SPAWN_MAX_FILE_ACTIONS 1024
+
+//
+// Define the maximum number of entries in an I/O ring's submission or
+// completion array. Both counts must be powers of two.
+//
+
+#define IO_RING_MAX_ENTRIES 4096
+
+//
+// Define the offset of the submission array from the start of the ring
+// memory.
+//
+
+#define IO_RING_SUBMISSION_OFFSET \
+    ALIGN_RANGE_UP(sizeof(IO_RING_HEADER), sizeof(ULONGLONG))
+
+//
+// Define the offset of the completion array from the start of the ring
+// memory, given the number of submission entries.
+//
+
+#define IO_RING_COMPLETION_OFFSET(_SubmissionCount) \
+    ALIGN_RANGE_UP(IO_RING_SUBMISSION_OFFSET + \
+                   ((_SubmissionCount) * sizeof(IO_RING_SUBMISSION)), \
+                   sizeof(ULONGLONG))
+
+//
+// Define the total size of the ring memory, given the number of submission
+// and completion entries.
+//
+
+#define IO_RING_SIZE(_SubmissionCount, _CompletionCount) \
+    (IO_RING_COMPLETION_OFFSET(_SubmissionCount) + \
+     ((_CompletionCount) * sizeof(IO_RING_COMPLETION)))
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -351,6 +448,14 @@ typedef enum _SYSTEM_CALL_NUMBER {
     SystemCallSetITimer,
     SystemCallSetResourceLimit,
     SystemCallSetBreak,
+    SystemCallSetScheduling,
+    SystemCallCreateEventQueue,
+    SystemCallEventQueueControl,
+    SystemCallEventQueueWait,
+    SystemCallSendFile,
+    SystemCallSpawnProcess,
+    SystemCallCreateIoRing,
+    SystemCallIoRingEnter,
     SystemCallCount
 } SYSTEM_CALL_NUMBER, *PSYSTEM_CALL_NUMBER;
 
@@ -437,6 +542,168 @@ typedef enum _RESOURCE_USAGE_REQUEST {
     ResourceUsageRequestThread,
 } RESOURCE_USAGE_REQUEST, *PRESOURCE_USAGE_REQUEST;
 
+typedef enum _EVENT_QUEUE_OPERATION {
+    EventQueueOperationInvalid,
+    EventQueueOperationAdd,
+    EventQueueOperationModify,
+    EventQueueOperationDelete
+} EVENT_QUEUE_OPERATION, *PEVENT_QUEUE_OPERATION;
+
+typedef enum _SPAWN_FILE_ACTION_TYPE {
+    SpawnFileActionInvalid,
+    SpawnFileActionOpen,
+    SpawnFileActionDuplicate,
+    SpawnFileActionClose
+} SPAWN_FILE_ACTION_TYPE, *PSPAWN_FILE_ACTION_TYPE;
+
+/*++
+
+Structure Description:
+
+    This structure defines a file action performed in a spawned child before
+    its image is loaded.
+
+Members:
+
+    Type - Stores the type of action to perform.
+
+    Handle - Stores the handle in the child that the action targets. Opens
+        and duplicates replace this handle if it is already in use.
+
+    SourceHandle - Stores the handle to duplicate for duplicate actions.
+
+    Path - Stores a pointer to the path to open for open actions.
+
+    PathSize - Stores the size of the path buffer in bytes, including the
+        null terminator.
+
+    Flags - Stores the open flags for open actions. See SYS_OPEN_FLAG_*.
+
+    CreatePermissions - Stores the permissions to apply to a newly created
+        file.
+
+--*/
+
+typedef struct _SPAWN_FILE_ACTION {
+    SPAWN_FILE_ACTION_TYPE Type;
+    HANDLE Handle;
+    HANDLE SourceHandle;
+    PSTR Path;
+    ULONG PathSize;
+    ULONG Flags;
+    FILE_PERMISSIONS CreatePermissions;
+} SPAWN_FILE_ACTION, *PSPAWN_FILE_ACTION;
+
+typedef enum _IO_RING_OPERATION {
+    IoRingOperationInvalid,
+    IoRingOperationRead,
+    IoRingOperationWrite,
+    IoRingOperationAccept,
+    IoRingOperationSend,
+    IoRingOperationReceive,
+    IoRingOperationFlush,
+    IoRingOperationCount
+} IO_RING_OPERATION, *PIO_RING_OPERATION;
+
+/*++
+
+Structure Description:
+
+    This structure defines the header at the start of an I/O ring's shared
+    memory. The submission and completion arrays follow it. Each side only
+    writes the index it owns; the other index is read-only to it.
+
+Members:
+
+    SubmissionHead - Stores the index of the next submission the kernel will
+        consume. Only the kernel writes this.
+
+    SubmissionTail - Stores the index one past the last submission user mode
+        has filled in. Only user mode writes this.
+
+    CompletionHead - Stores the index of the next completion user mode will
+        consume. Only user mode writes this.
+
+    CompletionTail - Stores the index one past the last completion the kernel
+        has filled in. Only the kernel writes this.
+
+    SubmissionCount - Stores the number of entries in the submission array.
+
+    CompletionCount - Stores the number of entries in the completion array.
+
+--*/
+
+typedef struct _IO_RING_HEADER {
+    volatile ULONG SubmissionHead;
+    volatile ULONG SubmissionTail;
+    volatile ULONG CompletionHead;
+    volatile ULONG CompletionTail;
+    ULONG SubmissionCount;
+    ULONG CompletionCount;
+} IO_RING_HEADER, *PIO_RING_HEADER;
+
+/*++
+
+Structure Description:
+
+    This structure defines an entry in an I/O ring's submission array.
+
+Members:
+
+    Operation - Stores the operation to perform.
+
+    Flags - Stores operation-specific flags. Send and receive operations take
+        SOCKET_IO_* flags, accept operations take SYS_OPEN_FLAG_* flags for
+        the new handle, and the rest take none.
+
+    Handle - Stores the I/O handle to operate on.
+
+    Buffer - Stores the user mode buffer to read into or write from.
+
+    Size - Stores the size of the buffer in bytes.
+
+    Offset - Stores the offset for reads and writes. Supply -1 to use and
+        advance the handle's current file position.
+
+    UserData - Stores caller-defined data returned in the completion.
+
+--*/
+
+typedef struct _IO_RING_SUBMISSION {
+    IO_RING_OPERATION Operation;
+    ULONG Flags;
+    HANDLE Handle;
+    PVOID Buffer;
+    UINTN Size;
+    IO_OFFSET Offset;
+    ULONGLONG UserData;
+} IO_RING_SUBMISSION, *PIO_RING_SUBMISSION;
+
+/*++
+
+Structure Description:
+
+    This structure defines an entry in an I/O ring's completion array.
+
+Members:
+
+    UserData - Stores the caller-defined data from the submission.
+
+    Status - Stores the status of the operation.
+
+    NewHandle - Stores the new handle for completed accept operations.
+
+    BytesCompleted - Stores the number of bytes transferred.
+
+--*/
+
+typedef struct _IO_RING_COMPLETION {
+    ULONGLONG UserData;
+    KSTATUS Status;
+    HANDLE NewHandle;
+    UINTN BytesCompleted;
+} IO_RING_COMPLETION, *PIO_RING_COMPLETION;
+
 //
 // System call parameter structures
 //
@@ -578,6 +845,83 @@ typedef struct _SYSTEM_CALL_PERFORM_VECTORED_IO {
 
 /*++
 
+Structure Description:
+
+    This structure defines the system call parameters for the call to transfer
+    data from a file directly to another handle, usually a socket.
+
+Members:
+
+    Destination - Stores the handle to write the data to.
+
+    Source - Stores the handle of the file to read the data from.
+
+    TimeoutInMilliseconds - Stores the number of milliseconds that the write
+        should be waited on before timing out. Use SYS_WAIT_TIME_INDEFINITE to
+        wait forever.
+
+    Offset - Stores the offset in the source file to start reading from.
+        Supply -1ULL to use and update the source's current file pointer.
+
+    Size - Stores the number of bytes to transfer.
+
+--*/
+
+typedef struct _SYSTEM_CALL_SEND_FILE {
+    HANDLE Destination;
+    HANDLE Source;
+    ULONG TimeoutInMilliseconds;
+    IO_OFFSET Offset;
+    INTN Size;
+} SYSCALL_STRUCT SYSTEM_CALL_SEND_FILE, *PSYSTEM_CALL_SEND_FILE;
+
+/*++
+
+Structure Description:
+
+    This structure defines the system call parameters for the spawn process
+    system call, which creates a child process running a new image without
+    first duplicating the caller's address space.
+
+Members:
+
+    Environment - Supplies the image name, arguments, and environment.
+
+    FileActions - Supplies an optional pointer to an array of file actions to
+        perform in the child, in order.
+
+    FileActionCount - Supplies the number of elements in the file action array.
+
+    Flags - Supplies a bitfield of attributes to apply. See SPAWN_FLAG_*.
+
+    ProcessGroup - Supplies the process group for the child to join if the
+        process group flag is set. Zero creates a new group led by the child.
+
+    SignalMask - Supplies the signal mask of the child's main thread if the
+        signal mask flag is set. Otherwise the caller's mask is inherited.
+
+    DefaultSignals - Supplies the set of signals to return to their default
+        dispositions if the signal defaults flag is set.
+
+    ProcessId - Stores the ID of the child process. This is set whenever a
+        child was created, even if it then failed to start and needs to be
+        reaped.
+
+--*/
+
+typedef struct _SYSTEM_CALL_SPAWN_PROCESS {
+    PROCESS_ENVIRONMENT Environment;
+    PSPAWN_FILE_ACTION FileActions;
+    ULONG FileActionCount;
+    ULONG Flags;
+    PROCESS_GROUP_ID ProcessGroup;
+    SIGNAL_SET SignalMask;
+    SIGNAL_SET DefaultSignals;
+    PROCESS_ID ProcessId;
+} SYSCALL_STRUCT SYSTEM_CALL_SPAWN_PROCESS, *PSYSTEM_CALL_SPAWN_PROCESS;
+
+/*++
+
 Structure Description:
 
     This structure defines the system call parameters for the create pipe call.
@@ -954,6 +1298,182 @@ typedef struct _SYSTEM_CALL_POLL {
 
 /*++
 
+Structure Description:
+
+    This structure defines an event returned from an event queue.
+
+Members:
+
+    Events - Stores the bitmask of poll events that are set on the I/O handle.
+        See POLL_EVENT_* definitions.
+
+    Data - Stores the caller-defined data supplied when the I/O handle was
+        registered with the event queue.
+
+--*/
+
+typedef struct _EVENT_QUEUE_EVENT {
+    ULONG Events;
+    ULONGLONG Data;
+} EVENT_QUEUE_EVENT, *PEVENT_QUEUE_EVENT;
+
+/*++
+
+Structure Description:
+
+    This structure defines the system call parameters for creating an event
+    queue.
+
+Members:
+
+    OpenFlags - Stores the set of open flags associated with the handle. Only
+        SYS_OPEN_FLAG_CLOSE_ON_EXECUTE is accepted.
+
+    Handle - Stores the returned handle to the new event queue.
+
+--*/
+
+typedef struct _SYSTEM_CALL_CREATE_EVENT_QUEUE {
+    ULONG OpenFlags;
+    HANDLE Handle;
+} SYSCALL_STRUCT SYSTEM_CALL_CREATE_EVENT_QUEUE,
+    *PSYSTEM_CALL_CREATE_EVENT_QUEUE;
+
+/*++
+
+Structure Description:
+
+    This structure defines the system call parameters for adding, modifying,
+    or removing an I/O handle's registration with an event queue.
+
+Members:
+
+    EventQueue - Stores the handle to the event queue.
+
+    Operation - Stores the operation to perform.
+
+    Handle - Stores the I/O handle whose registration is being changed.
+
+    Events - Stores the bitmask of poll events the registration is interested
+        in. Error events are always reported. This is ignored for delete
+        operations.
+
+    Flags - Stores a bitmask of registration flags. See EVENT_QUEUE_FLAG_*
+        definitions. This is ignored for delete operations.
+
+    Data - Stores the caller-defined data to return with each event. This is
+        ignored for delete operations.
+
+--*/
+
+typedef struct _SYSTEM_CALL_EVENT_QUEUE_CONTROL {
+    HANDLE EventQueue;
+    EVENT_QUEUE_OPERATION Operation;
+    HANDLE Handle;
+    ULONG Events;
+    ULONG Flags;
+    ULONGLONG Data;
+} SYSCALL_STRUCT SYSTEM_CALL_EVENT_QUEUE_CONTROL,
+    *PSYSTEM_CALL_EVENT_QUEUE_CONTROL;
+
+/*++
+
+Structure Description:
+
+    This structure defines the system call parameters for waiting on an event
+    queue.
+
+Members:
+
+    EventQueue - Stores the handle to the event queue.
+
+    SignalMask - Stores an optional pointer to a signal mask to set for the
+        duration of the wait.
+
+    Events - Stores a pointer to the array where ready events are returned.
+
+    EventCount - Stores the number of elements in the events array. At most
+        EVENT_QUEUE_MAX_WAIT_EVENTS are returned per call.
+
+    TimeoutInMilliseconds - Stores the number of milliseconds to wait for an
+        event before giving up.
+
+--*/
+
+typedef struct _SYSTEM_CALL_EVENT_QUEUE_WAIT {
+    HANDLE EventQueue;
+    PSIGNAL_SET SignalMask;
+    PEVENT_QUEUE_EVENT Events;
+    LONG EventCount;
+    ULONG TimeoutInMilliseconds;
+} SYSCALL_STRUCT SYSTEM_CALL_EVENT_QUEUE_WAIT, *PSYSTEM_CALL_EVENT_QUEUE_WAIT;
+
+/*++
+
+Structure Description:
+
+    This structure defines the system call parameters for creating an I/O
+    ring.
+
+Members:
+
+    Ring - Stores a pointer to the page aligned user mode memory backing the
+        ring. It must be IO_RING_SIZE bytes long, and stays locked in memory
+        until the ring is destroyed. It should be shared memory so that a fork
+        does not make it copy-on-write.
+
+    RingSize - Stores the size of the ring memory in bytes.
+
+    SubmissionCount - Stores the number of submission entries.
+
+    CompletionCount - Stores the number of completion entries.
+
+    OpenFlags - Stores the set of open flags associated with the handle. Only
+        SYS_OPEN_FLAG_CLOSE_ON_EXECUTE is accepted.
+
+    Handle - Stores the returned handle to the new I/O ring.
+
+--*/
+
+typedef struct _SYSTEM_CALL_CREATE_IO_RING {
+    PVOID Ring;
+    UINTN RingSize;
+    ULONG SubmissionCount;
+    ULONG CompletionCount;
+    ULONG OpenFlags;
+    HANDLE Handle;
+} SYSCALL_STRUCT SYSTEM_CALL_CREATE_IO_RING, *PSYSTEM_CALL_CREATE_IO_RING;
+
+/*++
+
+Structure Description:
+
+    This structure defines the system call parameters for submitting work to
+    and waiting on an I/O ring.
+
+Members:
+
+    Ring - Stores the handle to the I/O ring.
+
+    SubmitCount - Stores the maximum number of new submissions to consume.
+
+    WaitCount - Stores the number of unconsumed completions to wait for before
+        returning.
+
+    TimeoutInMilliseconds - Stores the number of milliseconds to wait for the
+        completions before giving up.
+
+--*/
+
+typedef struct _SYSTEM_CALL_IO_RING_ENTER {
+    HANDLE Ring;
+    ULONG SubmitCount;
+    ULONG WaitCount;
+    ULONG TimeoutInMilliseconds;
+} SYSCALL_STRUCT SYSTEM_CALL_IO_RING_ENTER, *PSYSTEM_CALL_IO_RING_ENTER;
+
+/*++
+
 Structure Description:
 
     This structure defines the system call parameters for creating a new
@@ -1976,6 +2496,9 @@ Structure Description:
         (FALSE) operation is being requested.
 
     Flags - Stores a bitmask of flags. See SYS_MAP_FLAG_* for definitions.
+        If the map boolean is FALSE and SYS_MAP_FLAG_ADVISE is set, then the
+        given region is not unmapped. Instead, the advice flags replace the
+        access pattern advice for the image sections covering the region.
 
     Handle - Stores a handle to the file object to be mapped.
 
@@ -2389,6 +2912,17 @@ Structure Description:
     TimeoutInMilliseconds - Stores the timeout in milliseconds the caller
         should wait. Set to SYS_WAIT_TIME_INDEFINITE to wait forever.
 
+    SecondAddress - Stores a pointer to the address of the second lock for
+        requeue and wake operations.
+
+    SecondValue - Stores the maximum number of threads to requeue to or wake
+        on the second address. On output, returns the number of threads
+        requeued or woken there.
+
+    Argument - Stores the value the first address must still contain for a
+        requeue operation, or the packed USER_LOCK_WAKE_OP argument for a wake
+        operation.
+
 --*/
 
 typedef struct _SYSTEM_CALL_USER_LOCK {
@@ -2396,6 +2930,9 @@ typedef struct _SYSTEM_CALL_USER_LOCK {
     ULONG Value;
     ULONG Operation;
     ULONG TimeoutInMilliseconds;
+    PULONG SecondAddress;
+    ULONG SecondValue;
+    ULONG Argument;
 } SYSCALL_STRUCT SYSTEM_CALL_USER_LOCK, *PSYSTEM_CALL_USER_LOCK;
 
 /*++
@@ -2531,6 +3068,37 @@ typedef struct _SYSTEM_CALL_SET_RESOURCE_LIMIT {
 
 /*++
 
+Structure Description:
+
+    This structure defines the system call parameters for getting or setting
+    the scheduling class and priority of a process.
+
+Members:
+
+    ProcessId - Stores the ID of the process to operate on. Supply zero to
+        operate on the current process.
+
+    Set - Stores a boolean indicating whether to get the scheduling parameters
+        (FALSE) or set them (TRUE).
+
+    Class - Stores the new scheduling class to set for set operations on
+        input. Returns the previous scheduling class.
+
+    Priority - Stores the new priority to set for set operations on input.
+        For real-time classes this is the fixed priority, for the fair share
+        class this is the nice value. Returns the previous priority.
+
+--*/
+
+typedef struct _SYSTEM_CALL_SET_SCHEDULING {
+    PROCESS_ID ProcessId;
+    BOOL Set;
+    SCHEDULER_CLASS Class;
+    LONG Priority;
+} SYSCALL_STRUCT SYSTEM_CALL_SET_SCHEDULING, *PSYSTEM_CALL_SET_SCHEDULING;
+
+/*++
+
 Structure Description:
 
     This structure defines a union of all possible system call parameter
@@ -2608,6 +3176,14 @@ typedef union _SYSTEM_CALL_PARAMETER_UNION {
     SYSTEM_CALL_SET_ITIMER SetITimer;
     SYSTEM_CALL_SET_RESOURCE_LIMIT SetResourceLimit;
     SYSTEM_CALL_SET_BREAK SetBreak;
+    SYSTEM_CALL_SET_SCHEDULING SetScheduling;
+    SYSTEM_CALL_CREATE_EVENT_QUEUE CreateEventQueue;
+    SYSTEM_CALL_EVENT_QUEUE_CONTROL EventQueueControl;
+    SYSTEM_CALL_EVENT_QUEUE_WAIT EventQueueWait;
+    SYSTEM_CALL_SEND_FILE SendFile;
+    SYSTEM_CALL_SPAWN_PROCESS SpawnProcess;
+    SYSTEM_CALL_CREATE_IO_RING CreateIoRing;
+    SYSTEM_CALL_IO_RING_ENTER IoRingEnter;
 } SYSCALL_STRUCT SYSTEM_CALL_PARAMETER_UNION, *PSYSTEM_CALL_PARAMETER_UNION;
 
 typedef
@@ -124,6 +124,7 @@ Module Name:
 #define CR4_OS_XMM_EXCEPTIONS 0x00000400
 #define CR4_OS_FX_SAVE_RESTORE 0x00000200
 #define CR4_PAGE_GLOBAL_ENABLE 0x00000080
+#define CR4_PAGE_SIZE_EXTENSIONS 0x00000010
 
 #define PAGE_SIZE 4096
 #define PAGE_MASK 0x00000FFF
@@ -170,6 +171,7 @@ Module Name:
 #define X86_CPUID_BASIC_EAX_EXTENDED_FAMILY_SHIFT 20
 
 #define X86_CPUID_BASIC_ECX_MONITOR (1 << 3)
+#define X86_CPUID_BASIC_EDX_PAGE_SIZE_EXTENSIONS (1 << 3)
 #define X86_CPUID_BASIC_EDX_SYSENTER (1 << 11)
 #define X86_CPUID_BASIC_EDX_CMOV (1 << 15)
 #define X86_CPUID_BASIC_EDX_FX_SAVE_RESTORE (1 << 24)
@@ -800,6 +802,10 @@ Structure Description:
     PageTableCount - Stores the number of page tables that were allocated on
         behalf of this process (user mode only).
 
+    LargePageTables - Stores an optional array, indexed by user mode page
+        directory entry, of the physical addresses of page tables set aside to
+        split each large page mapping back into small pages.
+
 --*/
 
 typedef struct _ADDRESS_SPACE_X86 {
@@ -807,6 +813,7 @@ typedef struct _ADDRESS_SPACE_X86 {
     PPTE PageDirectory;
     ULONG PageDirectoryPhysical;
     ULONG PageTableCount;
+    PULONG LargePageTables;
 } ADDRESS_SPACE_X86, *PADDRESS_SPACE_X86;
 
 //
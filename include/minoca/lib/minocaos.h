@@ -505,6 +505,49 @@ Return Value:
 
 --*/
 
+OS_API
+KSTATUS
+OsSendFile (
+    HANDLE Destination,
+    HANDLE Source,
+    IO_OFFSET Offset,
+    UINTN Size,
+    ULONG TimeoutInMilliseconds,
+    PUINTN BytesCompleted
+    );
+
+/*++
+
+Routine Description:
+
+    This routine transfers data from a file to another handle, usually a
+    socket, without copying it through the caller's address space.
+
+Arguments:
+
+    Destination - Supplies the handle to write the data to.
+
+    Source - Supplies the handle of the file to read the data from.
+
+    Offset - Supplies the offset into the source file to start reading from.
+        Set this to IO_OFFSET_NONE to use and advance the source's current file
+        position.
+
+    Size - Supplies the number of bytes to transfer.
+
+    TimeoutInMilliseconds - Supplies the number of milliseconds that the
+        write should be waited on before timing out. Use
+        SYS_WAIT_TIME_INDEFINITE to wait forever.
+
+    BytesCompleted - Supplies a pointer where the number of bytes transferred
+        will be returned.
+
+Return Value:
+
+    Status code.
+
+--*/
+
 OS_API
 KSTATUS
 OsFlush (
@@ -717,6 +760,65 @@ Return Value:
 
 --*/
 
+OS_API
+KSTATUS
+OsSpawnProcess (
+    PPROCESS_ENVIRONMENT Environment,
+    PSPAWN_FILE_ACTION FileActions,
+    ULONG FileActionCount,
+    ULONG Flags,
+    PROCESS_GROUP_ID ProcessGroup,
+    PSIGNAL_SET SignalMask,
+    PSIGNAL_SET DefaultSignals,
+    PPROCESS_ID ProcessId
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a new child process running the given binary image,
+    without duplicating the current process' address space first.
+
+Arguments:
+
+    Environment - Supplies a pointer to the environment to execute, which
+        includes the image name, parameters, and environment variables.
+
+    FileActions - Supplies an optional pointer to an array of file actions to
+        perform in the child before the image runs.
+
+    FileActionCount - Supplies the number of elements in the file action array.
+
+    Flags - Supplies a bitfield of attributes to apply to the child. See
+        SPAWN_FLAG_* definitions.
+
+    ProcessGroup - Supplies the process group for the child to join if the
+        process group flag is set. Supply 0 to create a new group.
+
+    SignalMask - Supplies an optional pointer to the initial signal mask of the
+        child. This is used if the signal mask flag is set.
+
+    DefaultSignals - Supplies an optional pointer to the set of signals to
+        return to their default dispositions. This is used if the signal
+        defaults flag is set.
+
+    ProcessId - Supplies a pointer where the ID of the child is returned. This
+        is set to a valid ID even on some failures, where the child was
+        created but failed to start and must still be waited on. It is 0 if no
+        child was created.
+
+Return Value:
+
+    STATUS_SUCCESS if the child is running the new image.
+
+    STATUS_UNKNOWN_IMAGE_FORMAT if the file is not an executable image (for
+    instance, it is a script).
+
+    Other error codes on failure.
+
+--*/
+
 OS_API
 KSTATUS
 OsGetSystemVersion (
@@ -894,6 +996,213 @@ Return Value:
 
 --*/
 
+OS_API
+KSTATUS
+OsCreateEventQueue (
+    ULONG Flags,
+    PHANDLE Handle
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates an event queue, which reports readiness for a set of
+    registered I/O handles.
+
+Arguments:
+
+    Flags - Supplies a bitfield of flags governing the behavior of the new
+        handle. Only SYS_OPEN_FLAG_CLOSE_ON_EXECUTE is permitted.
+
+    Handle - Supplies a pointer where the handle to the new event queue will
+        be returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+OS_API
+KSTATUS
+OsEventQueueControl (
+    HANDLE EventQueue,
+    EVENT_QUEUE_OPERATION Operation,
+    HANDLE Handle,
+    ULONG Events,
+    ULONG Flags,
+    ULONGLONG Data
+    );
+
+/*++
+
+Routine Description:
+
+    This routine adds, modifies, or removes an I/O handle's registration with
+    an event queue.
+
+Arguments:
+
+    EventQueue - Supplies the handle to the event queue.
+
+    Operation - Supplies the operation to perform.
+
+    Handle - Supplies the I/O handle whose registration is being changed.
+
+    Events - Supplies the mask of poll events the registration is interested
+        in. See POLL_EVENT_* definitions. Error events are always reported.
+
+    Flags - Supplies a bitfield of registration flags. See EVENT_QUEUE_FLAG_*
+        definitions.
+
+    Data - Supplies caller-defined data to return with each event.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_FILE_EXISTS if the handle is already registered and an add was
+    requested.
+
+    STATUS_NOT_FOUND if the handle is not registered and a modify or delete
+    was requested.
+
+    STATUS_NOT_SUPPORTED if the handle cannot be registered.
+
+--*/
+
+OS_API
+KSTATUS
+OsEventQueueWait (
+    HANDLE EventQueue,
+    PSIGNAL_SET SignalMask,
+    PEVENT_QUEUE_EVENT Events,
+    ULONG EventCount,
+    ULONG TimeoutInMilliseconds,
+    PULONG EventsReturned
+    );
+
+/*++
+
+Routine Description:
+
+    This routine waits for events on an event queue and returns a batch of
+    them.
+
+Arguments:
+
+    EventQueue - Supplies the handle to the event queue.
+
+    SignalMask - Supplies an optional pointer to a mask to set for the
+        duration of the wait.
+
+    Events - Supplies a pointer to an array where ready events are returned.
+
+    EventCount - Supplies the number of elements in the events array.
+
+    TimeoutInMilliseconds - Supplies the number of milliseconds to wait before
+        giving up.
+
+    EventsReturned - Supplies a pointer where the number of events returned
+        will be stored on success. This is zero if the wait timed out.
+
+Return Value:
+
+    STATUS_SUCCESS if events were returned or the wait timed out.
+
+    STATUS_INTERRUPTED if a signal was caught during the wait.
+
+    STATUS_INVALID_PARAMETER if more than MAX_LONG events are requested.
+
+--*/
+
+OS_API
+KSTATUS
+OsCreateIoRing (
+    PVOID Ring,
+    UINTN RingSize,
+    ULONG SubmissionCount,
+    ULONG CompletionCount,
+    ULONG Flags,
+    PHANDLE Handle
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates an I/O ring, which carries batches of I/O requests
+    and their results through memory shared with the kernel.
+
+Arguments:
+
+    Ring - Supplies a pointer to the page aligned memory backing the ring. It
+        must be at least IO_RING_SIZE bytes, and should be shared memory so
+        that a fork does not make it copy-on-write.
+
+    RingSize - Supplies the size of the ring memory in bytes.
+
+    SubmissionCount - Supplies the number of submission entries. This must be
+        a power of two no greater than IO_RING_MAX_ENTRIES.
+
+    CompletionCount - Supplies the number of completion entries. This must be
+        a power of two no greater than IO_RING_MAX_ENTRIES.
+
+    Flags - Supplies a bitfield of flags governing the behavior of the new
+        handle. Only SYS_OPEN_FLAG_CLOSE_ON_EXECUTE is permitted.
+
+    Handle - Supplies a pointer where the handle to the new I/O ring will be
+        returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+OS_API
+KSTATUS
+OsIoRingEnter (
+    HANDLE Ring,
+    ULONG SubmitCount,
+    ULONG WaitCount,
+    ULONG TimeoutInMilliseconds,
+    PULONG Submitted
+    );
+
+/*++
+
+Routine Description:
+
+    This routine hands new submissions on an I/O ring to the kernel and
+    optionally waits for completions.
+
+Arguments:
+
+    Ring - Supplies the handle to the I/O ring.
+
+    SubmitCount - Supplies the maximum number of new submissions to consume.
+
+    WaitCount - Supplies the number of unconsumed completions to wait for.
+        Supply zero to return without waiting.
+
+    TimeoutInMilliseconds - Supplies the number of milliseconds to wait for
+        the completions before giving up.
+
+    Submitted - Supplies a pointer where the number of submissions consumed
+        will be returned on success.
+
+Return Value:
+
+    STATUS_SUCCESS if the submissions were consumed and the wait finished or
+    timed out. Fewer submissions than requested are consumed if the
+    completion array does not have room for their results.
+
+    STATUS_INTERRUPTED if a signal was caught during the wait.
+
+--*/
+
 OS_API
 PSIGNAL_HANDLER_ROUTINE
 OsSetSignalHandler (
@@ -2095,6 +2404,37 @@ Return Value:
 
 --*/
 
+OS_API
+KSTATUS
+OsMemoryAdvise (
+    PVOID Address,
+    UINTN Size,
+    ULONG Advice
+    );
+
+/*++
+
+Routine Description:
+
+    This routine gives the kernel a hint about how the given region of the
+    current process' address space will be accessed. The region stays mapped.
+
+Arguments:
+
+    Address - Supplies the page-aligned starting address of the region.
+
+    Size - Supplies the size of the region, in bytes.
+
+    Advice - Supplies a bitmask of SYS_MAP_FLAG_SEQUENTIAL,
+        SYS_MAP_FLAG_RANDOM, and SYS_MAP_FLAG_WILL_NEED. Supply zero to return
+        the region to the default access pattern.
+
+Return Value:
+
+    Status code.
+
+--*/
+
 OS_API
 KSTATUS
 OsSetMemoryProtection (
@@ -2297,6 +2637,55 @@ Return Value:
 
 --*/
 
+OS_API
+KSTATUS
+OsSetScheduling (
+    PROCESS_ID ProcessId,
+    PSCHEDULER_CLASS NewClass,
+    LONG NewPriority,
+    PSCHEDULER_CLASS OldClass,
+    PLONG OldPriority
+    );
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets the scheduling class and priority of a process.
+    Setting applies the new parameters to every thread in the process.
+
+Arguments:
+
+    ProcessId - Supplies the ID of the process to operate on. Supply zero to
+        operate on the current process.
+
+    NewClass - Supplies an optional pointer to the new scheduling class to
+        set. If this is NULL, then new values are not set.
+
+    NewPriority - Supplies the new priority to set. For real-time classes this
+        is the fixed priority, for the fair share class this is the nice value.
+        This is ignored if no new class is supplied.
+
+    OldClass - Supplies an optional pointer where the previous scheduling class
+        will be returned.
+
+    OldPriority - Supplies an optional pointer where the previous priority will
+        be returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if the class or priority is not valid.
+
+    STATUS_NO_SUCH_PROCESS if the given process does not exist.
+
+    STATUS_PERMISSION_DENIED if the caller is trying to enter a real-time
+    class, lower its nice value, or change another user's process without the
+    scheduling permission.
+
+--*/
+
 OS_API
 KSTATUS
 OsCreateTerminal (
@@ -2623,6 +3012,30 @@ Return Value:
 
 --*/
 
+OS_API
+VOID
+OsHeapFlushThreadCache (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns all memory cached by the current thread back to the
+    shared heap and releases the thread's cache. The C library calls this when
+    a thread exits. If the thread allocates again, a new cache is created.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
 OS_API
 PPROCESS_ENVIRONMENT
 OsCreateEnvironment (
@@ -4205,6 +4618,69 @@ Return Value:
 
 --*/
 
+OS_API
+KSTATUS
+OsUserLockPair (
+    PVOID Address,
+    ULONG Operation,
+    PULONG Value,
+    PVOID SecondAddress,
+    PULONG SecondValue,
+    ULONG Argument
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs a cooperative locking operation with the kernel that
+    involves two user mode lock addresses.
+
+Arguments:
+
+    Address - Supplies a pointer to the first 32-bit lock value.
+
+    Operation - Supplies the operation of type USER_LOCK_OPERATION, as well as
+        any flags, see USER_LOCK_* definitions. The private flag applies to
+        both addresses. Valid operations are:
+
+        UserLockRequeue - Wakes the number of threads given in the value that
+        are blocked on the first address, and moves up to the second value
+        number of the remaining waiters over to wait on the second address.
+        This fails if the first address no longer contains the argument.
+
+        UserLockWakeOperation - Atomically modifies the second address as
+        described by the argument (see USER_LOCK_WAKE_OP), wakes the number of
+        threads given in the value that are blocked on the first address, and
+        wakes the second value number of threads blocked on the second address
+        if the comparison encoded in the argument held against the second
+        address' original value.
+
+    Value - Supplies a pointer that on input contains the number of threads to
+        wake on the first address. On output, contains the number woken.
+
+    SecondAddress - Supplies a pointer to the second 32-bit lock value.
+
+    SecondValue - Supplies a pointer that on input contains the number of
+        threads to requeue to or wake on the second address. On output,
+        contains the number of threads requeued or woken there.
+
+    Argument - Supplies the expected value of the first address for requeue
+        operations, or the packed wake operation.
+
+Return Value:
+
+    STATUS_SUCCESS if the operation succeeded.
+
+    STATUS_OPERATION_WOULD_BLOCK if for a requeue operation the value at the
+    first address was not equal to the argument.
+
+    STATUS_INVALID_PARAMETER if the operation or argument was not valid.
+
+    STATUS_ACCESS_VIOLATION if either address was not valid.
+
+--*/
+
 OS_API
 PVOID
 OsGetTlsAddress (
@@ -5734,6 +5734,65 @@ Return Value:
 
 --*/
 
+RTL_API
+UINTN
+RtlHeapGetAllocationSize (
+    PMEMORY_HEAP Heap,
+    PVOID Memory
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the number of usable bytes in a heap allocation,
+    which may be larger than the size originally requested. The heap lock
+    does not need to be held, as the caller owns the allocation.
+
+Arguments:
+
+    Heap - Supplies the heap the memory was allocated from.
+
+    Memory - Supplies the allocation created by the heap allocation routine.
+
+Return Value:
+
+    Returns the usable size of the allocation in bytes.
+
+    0 if the allocation appears to be corrupt.
+
+--*/
+
+RTL_API
+PMEMORY_HEAP
+RtlHeapGetAllocationOwner (
+    PMEMORY_HEAP Heap,
+    PVOID Memory
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the heap an allocation was made from. Several heaps
+    initialized with the same allocation tag can use this to route a free to
+    the right heap. The heap lock does not need to be held, as the caller owns
+    the allocation.
+
+Arguments:
+
+    Heap - Supplies any heap sharing the allocation tag of the heap the memory
+        was allocated from.
+
+    Memory - Supplies the allocation created by the heap allocation routine.
+
+Return Value:
+
+    Returns the heap recorded in the allocation. The caller must check that
+    this is a heap it knows about, as a corrupt allocation produces garbage.
+
+--*/
+
 RTL_API
 VOID
 RtlHeapProfilerGetStatistics (
@@ -136,6 +136,13 @@ Module Name:
 
 #define NET_LINK_PROPERTIES_VERSION 1
 
+//
+// Define the default number of frames a polling link may hand to the
+// networking core in one pass before the poll worker yields.
+//
+
+#define NET_LINK_DEFAULT_POLL_BUDGET 64
+
 //
 // Define some common network link speeds.
 //
@@ -505,6 +512,37 @@ Return Value:
 
 --*/
 
+typedef
+ULONG
+(*PNET_DEVICE_LINK_POLL) (
+    PVOID DeviceContext,
+    ULONG Budget
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reaps received frames from the device and hands them to the
+    networking core. It is called at low level from the link's poll worker
+    after the device requested a poll with NetSchedulePoll. The device should
+    leave its receive interrupts masked while it is being polled and unmask
+    them only when it finds less work than the budget allows.
+
+Arguments:
+
+    DeviceContext - Supplies a pointer to the device context associated with
+        the link being polled.
+
+    Budget - Supplies the maximum number of frames to process.
+
+Return Value:
+
+    Returns the number of frames processed. Returning the full budget indicates
+    that more frames may be pending and that the link should be polled again.
+
+--*/
+
 /*++
 
 Structure Description:
@@ -523,12 +561,17 @@ Structure Description:
         that the network link is no longer in use by the networking core and
         any link interface context can be destroyed.
 
+    Poll - Supplies an optional pointer to a function used to reap received
+        frames in polled mode. Devices that do not supply this routine must
+        process received frames themselves.
+
 --*/
 
 typedef struct _NET_DEVICE_LINK_INTERFACE {
     PNET_DEVICE_LINK_SEND Send;
     PNET_DEVICE_LINK_GET_SET_INFORMATION GetSetInformation;
     PNET_DEVICE_LINK_DESTROY_LINK DestroyLink;
+    PNET_DEVICE_LINK_POLL Poll;
 } NET_DEVICE_LINK_INTERFACE, *PNET_DEVICE_LINK_INTERFACE;
 
 /*++
@@ -626,6 +669,22 @@ Structure Description:
     AddressTranslationTree - Stores the tree containing translations between
         network addresses and physical addresses, keyed by network address.
 
+    PollWorkItem - Stores a pointer to the work item that polls the device for
+        received frames. This is only allocated if the device supplied a poll
+        routine.
+
+    PollBudget - Stores the maximum number of frames the device is asked to
+        process in a single poll.
+
+    ReceiveBatchThread - Stores a pointer to the thread currently processing
+        a batch of received packets on this link, if any. This is private to
+        the networking core.
+
+    ReceiveBatch - Stores a pointer to the receive batch currently being
+        processed on this link, if any. It lives on the stack of the receive
+        batch thread, and is only valid for that thread to touch. This is
+        private to the networking core.
+
 --*/
 
 typedef struct _NET_LINK {
@@ -640,6 +699,10 @@ typedef struct _NET_LINK {
     NET_LINK_PROPERTIES Properties;
     PKEVENT AddressTranslationEvent;
     RED_BLACK_TREE AddressTranslationTree;
+    PWORK_ITEM PollWorkItem;
+    ULONG PollBudget;
+    PKTHREAD ReceiveBatchThread;
+    PVOID ReceiveBatch;
 } NET_LINK, *PNET_LINK;
 
 typedef
@@ -2331,6 +2394,65 @@ Return Value:
 
 --*/
 
+NET_API
+VOID
+NetProcessReceivedPacketList (
+    PNET_LINK Link,
+    PNET_PACKET_LIST PacketList
+    );
+
+/*++
+
+Routine Description:
+
+    This routine is called by the low level NIC driver to pass a batch of
+    received packets onto the core networking library for dispatching. Socket
+    lookups are cached across the batch, so consecutive packets for the same
+    connection do not each search the socket trees.
+
+Arguments:
+
+    Link - Supplies a pointer to the link that received the packets.
+
+    PacketList - Supplies a pointer to the list of received packets. The
+        packets may be used as scratch space while this routine executes, but
+        will not be accessed after it returns. The list itself is left intact
+        and remains owned by the caller.
+
+Return Value:
+
+    None. When the function returns, the memory associated with the packets
+    may be reclaimed and reused.
+
+--*/
+
+NET_API
+KSTATUS
+NetSchedulePoll (
+    PNET_LINK Link
+    );
+
+/*++
+
+Routine Description:
+
+    This routine requests that the networking core poll the given link for
+    received frames. It is typically called from the device's interrupt path
+    after masking receive interrupts. This routine can be called at or below
+    dispatch level.
+
+Arguments:
+
+    Link - Supplies a pointer to the link to poll.
+
+Return Value:
+
+    STATUS_SUCCESS if the poll was scheduled or is already pending.
+
+    STATUS_NOT_SUPPORTED if the link's device did not supply a poll routine.
+
+--*/
+
 NET_API
 BOOL
 NetGetGlobalDebugFlag (
@@ -3038,6 +3160,45 @@ Return Value:
 
 --*/
 
+NET_API
+PNET_SOCKET
+NetFindReceiveSocket (
+    PNET_LINK Link,
+    PNET_PROTOCOL_ENTRY ProtocolEntry,
+    PNETWORK_ADDRESS LocalAddress,
+    PNETWORK_ADDRESS RemoteAddress
+    );
+
+/*++
+
+Routine Description:
+
+    This routine finds the socket that should receive a packet arriving on the
+    given link. If the link is in the middle of processing a batch of received
+    packets on this thread, the fully bound socket found for the previous
+    packet is reused without searching the socket trees. If the socket is
+    found and returned, the reference count will be increased on it. It is the
+    caller's responsiblity to release that reference.
+
+Arguments:
+
+    Link - Supplies a pointer to the link that received the packet.
+
+    ProtocolEntry - Supplies the protocol the socket must be on.
+
+    LocalAddress - Supplies a pointer to the local address of the socket.
+
+    RemoteAddress - Supplies a pointer to the remote address of the socket.
+
+Return Value:
+
+    Returns a pointer to a socket matching the given parameters, with an
+    increased reference count.
+
+    NULL if no socket matches.
+
+--*/
+
 NET_API
 KSTATUS
 NetGetSetNetworkDeviceInformation (
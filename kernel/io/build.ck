@@ -38,6 +38,7 @@ function build() {
         "devrem.c",
         "devres.c",
         "driver.c",
+        "evqueue.c",
         "fileobj.c",
         "filesys.c",
         "flock.c",
@@ -47,6 +48,7 @@ function build() {
         "intrupt.c",
         "iobase.c",
         "iohandle.c",
+        "ioring.c",
         "irp.c",
         "mount.c",
         "obfs.c",
@@ -43,6 +43,29 @@ Module Name:
 
 /*++
 
+Structure Description:
+
+    This structure defines an asynchronous read-ahead request.
+
+Members:
+
+    FileObject - Stores a pointer to the file object to read ahead in. The
+        request holds a reference on it.
+
+    Offset - Stores the page-aligned file offset to start reading at.
+
+    Size - Stores the number of bytes to read ahead.
+
+--*/
+
+typedef struct _IO_READ_AHEAD_REQUEST {
+    PFILE_OBJECT FileObject;
+    IO_OFFSET Offset;
+    UINTN Size;
+} IO_READ_AHEAD_REQUEST, *PIO_READ_AHEAD_REQUEST;
+
+/*++
+
 Structure Description:
 
     This structure defines the context needed to iterate over write operations
@@ -161,6 +184,25 @@ IopPerformDefaultPartialWrite (
     UINTN IoBufferOffset
     );
 
+VOID
+IopUpdateReadAhead (
+    PFILE_OBJECT FileObject,
+    IO_OFFSET Offset,
+    UINTN Size
+    );
+
+KSTATUS
+IopQueueReadAhead (
+    PFILE_OBJECT FileObject,
+    IO_OFFSET Offset,
+    UINTN Size
+    );
+
+VOID
+IopReadAheadWorker (
+    PVOID Parameter
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -169,6 +211,78 @@ IopPerformDefaultPartialWrite (
 // ------------------------------------------------------------------ Functions
 //
 
+KERNEL_API
+KSTATUS
+IoPrefetchCachedData (
+    PIO_HANDLE Handle,
+    IO_OFFSET Offset,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts reading the given range of a cached file into the page
+    cache in the background. This is only a hint: the read-ahead is skipped if
+    the object is not cached, another read-ahead is already in flight, or
+    physical memory is tight.
+
+Arguments:
+
+    Handle - Supplies a pointer to the I/O handle of the object to prefetch.
+
+    Offset - Supplies the file offset to start prefetching at.
+
+    Size - Supplies the number of bytes to prefetch.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    IO_OFFSET End;
+    PFILE_OBJECT FileObject;
+    ULONGLONG FileSize;
+    ULONG OldFlags;
+    ULONG PageSize;
+
+    FileObject = Handle->FileObject;
+    if ((IO_IS_FILE_OBJECT_CACHEABLE(FileObject) == FALSE) ||
+        (MmGetPhysicalMemoryWarningLevel() != MemoryWarningLevelNone)) {
+
+        return STATUS_SUCCESS;
+    }
+
+    PageSize = MmPageSize();
+    End = ALIGN_RANGE_UP(Offset + Size, PageSize);
+    Offset = ALIGN_RANGE_DOWN(Offset, PageSize);
+    READ_INT64_SYNC(&(FileObject->Properties.FileSize), &FileSize);
+    if (End > FileSize) {
+        End = ALIGN_RANGE_UP(FileSize, PageSize);
+    }
+
+    if (End - Offset > IO_PREFETCH_MAXIMUM_SIZE) {
+        End = Offset + IO_PREFETCH_MAXIMUM_SIZE;
+    }
+
+    if (Offset >= End) {
+        return STATUS_SUCCESS;
+    }
+
+    OldFlags = RtlAtomicOr32(&(FileObject->Flags),
+                             FILE_OBJECT_FLAG_READ_AHEAD_PENDING);
+
+    if ((OldFlags & FILE_OBJECT_FLAG_READ_AHEAD_PENDING) != 0) {
+        return STATUS_SUCCESS;
+    }
+
+    return IopQueueReadAhead(FileObject, Offset, End - Offset);
+}
+
 KSTATUS
 IopPerformCacheableIoOperation (
     PIO_HANDLE Handle,
@@ -203,6 +317,7 @@ Return Value:
     BOOL LockHeldExclusive;
     IO_OFFSET OriginalOffset;
     ULONG PageShift;
+    BOOL ReadAhead;
     IO_OFFSET StartOffset;
     KSTATUS Status;
     FILE_OBJECT_TIME_TYPE TimeType;
@@ -215,6 +330,7 @@ Return Value:
     ASSERT(IO_IS_CACHEABLE_TYPE(FileObject->Properties.Type) != FALSE);
 
     OriginalOffset = IoContext->Offset;
+    ReadAhead = FALSE;
     StartOffset = OriginalOffset;
 
     //
@@ -317,6 +433,10 @@ Return Value:
                                           IoContext,
                                           &LockHeldExclusive);
 
+            if (FileObject->Properties.Type == IoObjectRegularFile) {
+                ReadAhead = TRUE;
+            }
+
         } else {
             Status = IopPerformNonCachedRead(FileObject,
                                              IoContext,
@@ -359,6 +479,17 @@ Return Value:
         KeReleaseSharedExclusiveLockShared(FileObject->Lock);
     }
 
+    //
+    // Let the read-ahead logic see this read so it can get the next part of
+    // the file into the cache before it is asked for.
+    //
+
+    if ((ReadAhead != FALSE) && (IoContext->BytesCompleted != 0)) {
+        IopUpdateReadAhead(FileObject,
+                           StartOffset,
+                           IoContext->BytesCompleted);
+    }
+
     return Status;
 }
 
@@ -2424,3 +2555,297 @@ Return Value:
     return Status;
 }
 
+VOID
+IopUpdateReadAhead (
+    PFILE_OBJECT FileObject,
+    IO_OFFSET Offset,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine updates a file object's read-ahead state after a cached read,
+    and kicks off an asynchronous read-ahead if the reader is getting close to
+    the end of what has already been read ahead. Sequential reads grow the
+    read-ahead window, while random reads shrink it.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object that was read.
+
+    Offset - Supplies the file offset the read started at.
+
+    Size - Supplies the number of bytes read.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    IO_OFFSET End;
+    ULONGLONG FileSize;
+    ULONG OldFlags;
+    ULONG PageSize;
+    IO_OFFSET ReadAheadOffset;
+    UINTN ReadAheadSize;
+    ULONG Window;
+
+    //
+    // Only one reader updates the state at a time. If someone else is in
+    // here, let them have it; this is only a heuristic.
+    //
+
+    OldFlags = RtlAtomicOr32(&(FileObject->Flags),
+                             FILE_OBJECT_FLAG_READ_AHEAD_LOCKED);
+
+    if ((OldFlags & FILE_OBJECT_FLAG_READ_AHEAD_LOCKED) != 0) {
+        return;
+    }
+
+    End = Offset + Size;
+    PageSize = MmPageSize();
+    ReadAheadSize = 0;
+    Window = FileObject->ReadAheadWindow;
+
+    //
+    // A read that starts where the last one left off (or overlaps its end) is
+    // sequential. Anything else cuts the window down.
+    //
+
+    if ((Offset <= FileObject->ReadAheadNextOffset) &&
+        (End > FileObject->ReadAheadNextOffset) &&
+        (Offset + Window >= FileObject->ReadAheadNextOffset)) {
+
+        if (Window == 0) {
+            Window = IO_READ_AHEAD_MINIMUM_WINDOW;
+            FileObject->ReadAheadEnd = End;
+        }
+
+        //
+        // Start the next read-ahead once the reader is within half a window
+        // of the end of the data already read ahead, doubling the window each
+        // time.
+        //
+
+        if ((FileObject->ReadAheadEnd < End) ||
+            ((FileObject->ReadAheadEnd - End) < (Window / 2))) {
+
+            if (FileObject->ReadAheadEnd > End) {
+                Window *= 2;
+                if (Window > IO_READ_AHEAD_MAXIMUM_WINDOW) {
+                    Window = IO_READ_AHEAD_MAXIMUM_WINDOW;
+                }
+            }
+
+            ReadAheadOffset = ALIGN_RANGE_UP(End, PageSize);
+            if (FileObject->ReadAheadEnd > ReadAheadOffset) {
+                ReadAheadOffset = FileObject->ReadAheadEnd;
+            }
+
+            ReadAheadSize = Window;
+        }
+
+    } else {
+        Window /= 4;
+        if (Window < IO_READ_AHEAD_MINIMUM_WINDOW) {
+            Window = 0;
+        }
+
+        FileObject->ReadAheadEnd = End;
+    }
+
+    FileObject->ReadAheadNextOffset = End;
+
+    //
+    // Don't read ahead past the end of the file, when memory is tight, or if
+    // the last read-ahead is still going.
+    //
+
+    if (ReadAheadSize != 0) {
+        READ_INT64_SYNC(&(FileObject->Properties.FileSize), &FileSize);
+        if (ReadAheadOffset >= FileSize) {
+            ReadAheadSize = 0;
+
+        } else if ((FileSize - ReadAheadOffset) < ReadAheadSize) {
+            ReadAheadSize = ALIGN_RANGE_UP(FileSize - ReadAheadOffset,
+                                           PageSize);
+        }
+
+        if (MmGetPhysicalMemoryWarningLevel() != MemoryWarningLevelNone) {
+            Window = 0;
+            ReadAheadSize = 0;
+        }
+    }
+
+    if (ReadAheadSize != 0) {
+        OldFlags = RtlAtomicOr32(&(FileObject->Flags),
+                                 FILE_OBJECT_FLAG_READ_AHEAD_PENDING);
+
+        if ((OldFlags & FILE_OBJECT_FLAG_READ_AHEAD_PENDING) != 0) {
+            ReadAheadSize = 0;
+        }
+    }
+
+    if (ReadAheadSize != 0) {
+        FileObject->ReadAheadEnd = ReadAheadOffset + ReadAheadSize;
+    }
+
+    FileObject->ReadAheadWindow = Window;
+    RtlAtomicAnd32(&(FileObject->Flags), ~FILE_OBJECT_FLAG_READ_AHEAD_LOCKED);
+    if (ReadAheadSize != 0) {
+        IopQueueReadAhead(FileObject, ReadAheadOffset, ReadAheadSize);
+    }
+
+    return;
+}
+
+KSTATUS
+IopQueueReadAhead (
+    PFILE_OBJECT FileObject,
+    IO_OFFSET Offset,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fires off a read-ahead in the background. The caller must have
+    set the read-ahead pending flag on the file object, which is cleared here
+    if the read-ahead could not be queued.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object to read ahead in.
+
+    Offset - Supplies the page-aligned file offset to start reading at.
+
+    Size - Supplies the number of bytes to read ahead.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PIO_READ_AHEAD_REQUEST Request;
+    KSTATUS Status;
+
+    ASSERT((FileObject->Flags & FILE_OBJECT_FLAG_READ_AHEAD_PENDING) != 0);
+
+    Request = MmAllocatePagedPool(sizeof(IO_READ_AHEAD_REQUEST),
+                                  IO_ALLOCATION_TAG);
+
+    if (Request == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto QueueReadAheadEnd;
+    }
+
+    IopFileObjectAddReference(FileObject);
+    Request->FileObject = FileObject;
+    Request->Offset = Offset;
+    Request->Size = Size;
+    Status = KeCreateAndQueueWorkItem(NULL,
+                                      WorkPriorityNormal,
+                                      IopReadAheadWorker,
+                                      Request);
+
+    if (!KSUCCESS(Status)) {
+        IopFileObjectReleaseReference(FileObject);
+        MmFreePagedPool(Request);
+        goto QueueReadAheadEnd;
+    }
+
+QueueReadAheadEnd:
+    if (!KSUCCESS(Status)) {
+        RtlAtomicAnd32(&(FileObject->Flags),
+                       ~FILE_OBJECT_FLAG_READ_AHEAD_PENDING);
+    }
+
+    return Status;
+}
+
+VOID
+IopReadAheadWorker (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs an asynchronous read-ahead, pulling a range of a
+    file into the page cache.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the read-ahead request, which this
+        routine frees.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PFILE_OBJECT FileObject;
+    IO_CONTEXT IoContext;
+    BOOL LockHeldExclusive;
+    PIO_READ_AHEAD_REQUEST Request;
+    KSTATUS Status;
+
+    Request = Parameter;
+    FileObject = Request->FileObject;
+    IoContext.IoBuffer = NULL;
+    Status = MmValidateIoBufferForCachedIo(&(IoContext.IoBuffer),
+                                           Request->Size,
+                                           MmPageSize());
+
+    if (!KSUCCESS(Status)) {
+        goto ReadAheadWorkerEnd;
+    }
+
+    //
+    // Perform a normal cached read into a throwaway buffer. Pages that are
+    // already cached are skipped over, and missed pages land in the cache.
+    //
+
+    IoContext.Offset = Request->Offset;
+    IoContext.SizeInBytes = Request->Size;
+    IoContext.BytesCompleted = 0;
+    IoContext.Flags = 0;
+    IoContext.TimeoutInMilliseconds = WAIT_TIME_INDEFINITE;
+    IoContext.Write = FALSE;
+    KeAcquireSharedExclusiveLockShared(FileObject->Lock);
+    LockHeldExclusive = FALSE;
+    if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
+        IopPerformCachedRead(FileObject, &IoContext, &LockHeldExclusive);
+    }
+
+    if (LockHeldExclusive != FALSE) {
+        KeReleaseSharedExclusiveLockExclusive(FileObject->Lock);
+
+    } else {
+        KeReleaseSharedExclusiveLockShared(FileObject->Lock);
+    }
+
+ReadAheadWorkerEnd:
+    if (IoContext.IoBuffer != NULL) {
+        MmFreeIoBuffer(IoContext.IoBuffer);
+    }
+
+    RtlAtomicAnd32(&(FileObject->Flags), ~FILE_OBJECT_FLAG_READ_AHEAD_PENDING);
+    IopFileObjectReleaseReference(FileObject);
+    MmFreePagedPool(Request);
+    return;
+}
+
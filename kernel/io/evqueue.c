@@ -0,0 +1,1582 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    evqueue.c
+
+Abstract:
+
+    This module implements event queues, which let a caller register interest
+    in a set of I/O handles once and then harvest ready events in batches.
+
+Author:
+
+    Minoca Corp. 16-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define EVENT_QUEUE_ALLOCATION_TAG 0x51657645 // 'QevE'
+
+//
+// This internal flag is set on a one-shot registration once it has reported
+// an event. It is cleared when the registration is modified.
+//
+
+#define EVENT_QUEUE_ENTRY_FLAG_DISABLED 0x80000000
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines an event queue.
+
+Members:
+
+    Header - Stores the standard object header.
+
+    Lock - Stores a pointer to the lock protecting the entry tree and the
+        ready list.
+
+    EntryTree - Stores the tree of registrations, keyed by I/O handle.
+
+    ReadyList - Stores the list of registrations that have events to report.
+
+    IoState - Stores a pointer to the event queue's own I/O object state. The
+        in event is set while the ready list is not empty.
+
+--*/
+
+typedef struct _EVENT_QUEUE {
+    OBJECT_HEADER Header;
+    PQUEUED_LOCK Lock;
+    RED_BLACK_TREE EntryTree;
+    LIST_ENTRY ReadyList;
+    PIO_OBJECT_STATE IoState;
+} EVENT_QUEUE, *PEVENT_QUEUE;
+
+/*++
+
+Structure Description:
+
+    This structure defines the registration of one I/O handle with an event
+    queue.
+
+Members:
+
+    TreeNode - Stores the node in the event queue's entry tree.
+
+    StateListEntry - Stores pointers to the next and previous registrations
+        on the I/O object state's event queue list.
+
+    ReadyListEntry - Stores pointers to the next and previous registrations on
+        the event queue's ready list. The next pointer is NULL if the
+        registration is not on the ready list.
+
+    Queue - Stores a pointer to the event queue that owns the registration.
+
+    IoHandle - Stores a pointer to the registered I/O handle. No reference is
+        held; the registration is removed when the handle is destroyed.
+
+    IoState - Stores a pointer to the I/O object state of the handle.
+
+    Events - Stores the mask of poll events the registration is interested in.
+
+    Flags - Stores a bitmask of flags. See EVENT_QUEUE_FLAG_* definitions.
+
+    Data - Stores the caller-defined data returned with each event.
+
+--*/
+
+typedef struct _EVENT_QUEUE_ENTRY {
+    RED_BLACK_TREE_NODE TreeNode;
+    LIST_ENTRY StateListEntry;
+    LIST_ENTRY ReadyListEntry;
+    PEVENT_QUEUE Queue;
+    PIO_HANDLE IoHandle;
+    PIO_OBJECT_STATE IoState;
+    ULONG Events;
+    ULONG Flags;
+    ULONGLONG Data;
+} EVENT_QUEUE_ENTRY, *PEVENT_QUEUE_ENTRY;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+VOID
+IopDestroyEventQueue (
+    PVOID EventQueueObject
+    );
+
+KSTATUS
+IopGetEventQueueFromHandle (
+    PIO_HANDLE IoHandle,
+    PEVENT_QUEUE *Queue
+    );
+
+KSTATUS
+IopControlEventQueue (
+    PEVENT_QUEUE Queue,
+    EVENT_QUEUE_OPERATION Operation,
+    PIO_HANDLE IoHandle,
+    ULONG Events,
+    ULONG Flags,
+    ULONGLONG Data
+    );
+
+KSTATUS
+IopWaitForEventQueue (
+    PEVENT_QUEUE Queue,
+    PEVENT_QUEUE_EVENT Events,
+    ULONG EventCount,
+    ULONG TimeoutInMilliseconds,
+    PULONG EventsReturned
+    );
+
+ULONG
+IopHarvestEventQueue (
+    PEVENT_QUEUE Queue,
+    PEVENT_QUEUE_EVENT Events,
+    ULONG EventCount
+    );
+
+VOID
+IopQueueEventQueueEntry (
+    PEVENT_QUEUE_ENTRY Entry
+    );
+
+VOID
+IopRemoveEventQueueEntry (
+    PEVENT_QUEUE_ENTRY Entry
+    );
+
+COMPARISON_RESULT
+IopCompareEventQueueEntries (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store a pointer to the lock serializing changes to event queue
+// registrations. Adding, removing, and tearing down registrations all hold
+// this lock, so a registration can never be freed out from under another
+// path that needs to acquire the I/O object state lock before the event
+// queue lock. Reporting and harvesting events do not take it.
+//
+
+PQUEUED_LOCK IoEventQueueLock;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INTN
+IoSysCreateEventQueue (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates an event queue on behalf of a user mode application.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+{
+
+    PKPROCESS CurrentProcess;
+    ULONG HandleFlags;
+    PIO_HANDLE IoHandle;
+    PSYSTEM_CALL_CREATE_EVENT_QUEUE Parameters;
+    KSTATUS Status;
+
+    CurrentProcess = PsGetCurrentProcess();
+
+    ASSERT(CurrentProcess != PsGetKernelProcess());
+
+    IoHandle = NULL;
+    Parameters = (PSYSTEM_CALL_CREATE_EVENT_QUEUE)SystemCallParameter;
+    Parameters->Handle = INVALID_HANDLE;
+    if ((Parameters->OpenFlags & ~SYS_OPEN_FLAG_CLOSE_ON_EXECUTE) != 0) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto SysCreateEventQueueEnd;
+    }
+
+    Status = IopOpen(FALSE,
+                     NULL,
+                     NULL,
+                     0,
+                     IO_ACCESS_READ,
+                     OPEN_FLAG_CREATE,
+                     IoObjectEventQueue,
+                     NULL,
+                     FILE_PERMISSION_USER_READ | FILE_PERMISSION_USER_WRITE,
+                     &IoHandle);
+
+    if (!KSUCCESS(Status)) {
+        goto SysCreateEventQueueEnd;
+    }
+
+    HandleFlags = 0;
+    if ((Parameters->OpenFlags & SYS_OPEN_FLAG_CLOSE_ON_EXECUTE) != 0) {
+        HandleFlags |= FILE_DESCRIPTOR_CLOSE_ON_EXECUTE;
+    }
+
+    Status = ObCreateHandle(CurrentProcess->HandleTable,
+                            IoHandle,
+                            HandleFlags,
+                            &(Parameters->Handle));
+
+    if (!KSUCCESS(Status)) {
+        goto SysCreateEventQueueEnd;
+    }
+
+SysCreateEventQueueEnd:
+    if (!KSUCCESS(Status)) {
+        if (IoHandle != NULL) {
+            IoClose(IoHandle);
+        }
+    }
+
+    return Status;
+}
+
+INTN
+IoSysEventQueueControl (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds, modifies, or removes an I/O handle's registration with
+    an event queue.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+{
+
+    PKPROCESS CurrentProcess;
+    PIO_HANDLE IoHandle;
+    PSYSTEM_CALL_EVENT_QUEUE_CONTROL Parameters;
+    PEVENT_QUEUE Queue;
+    PIO_HANDLE QueueHandle;
+    KSTATUS Status;
+
+    CurrentProcess = PsGetCurrentProcess();
+    IoHandle = NULL;
+    Parameters = (PSYSTEM_CALL_EVENT_QUEUE_CONTROL)SystemCallParameter;
+    QueueHandle = ObGetHandleValue(CurrentProcess->HandleTable,
+                                   Parameters->EventQueue,
+                                   NULL);
+
+    if (QueueHandle == NULL) {
+        Status = STATUS_INVALID_HANDLE;
+        goto SysEventQueueControlEnd;
+    }
+
+    Status = IopGetEventQueueFromHandle(QueueHandle, &Queue);
+    if (!KSUCCESS(Status)) {
+        goto SysEventQueueControlEnd;
+    }
+
+    IoHandle = ObGetHandleValue(CurrentProcess->HandleTable,
+                                Parameters->Handle,
+                                NULL);
+
+    if (IoHandle == NULL) {
+        Status = STATUS_INVALID_HANDLE;
+        goto SysEventQueueControlEnd;
+    }
+
+    Status = IopControlEventQueue(Queue,
+                                  Parameters->Operation,
+                                  IoHandle,
+                                  Parameters->Events,
+                                  Parameters->Flags,
+                                  Parameters->Data);
+
+SysEventQueueControlEnd:
+    if (IoHandle != NULL) {
+        IoIoHandleReleaseReference(IoHandle);
+    }
+
+    if (QueueHandle != NULL) {
+        IoIoHandleReleaseReference(QueueHandle);
+    }
+
+    return Status;
+}
+
+INTN
+IoSysEventQueueWait (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits for events on an event queue and returns a batch of
+    them.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    The number of events returned (a non-negative integer) on success.
+
+    Error status code (a negative integer) on failure.
+
+--*/
+
+{
+
+    ULONG EventCount;
+    PEVENT_QUEUE_EVENT Events;
+    ULONG EventsReturned;
+    SIGNAL_SET OldSignalSet;
+    PSYSTEM_CALL_EVENT_QUEUE_WAIT Parameters;
+    PKPROCESS Process;
+    PEVENT_QUEUE Queue;
+    PIO_HANDLE QueueHandle;
+    BOOL RestoreSignalMask;
+    INTN Result;
+    SIGNAL_SET SignalMask;
+    KSTATUS Status;
+    PKTHREAD Thread;
+
+    Events = NULL;
+    EventsReturned = 0;
+    Parameters = (PSYSTEM_CALL_EVENT_QUEUE_WAIT)SystemCallParameter;
+    Thread = KeGetCurrentThread();
+    Process = Thread->OwningProcess;
+    QueueHandle = NULL;
+    RestoreSignalMask = FALSE;
+    if ((Parameters->Events == NULL) || (Parameters->EventCount <= 0)) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto SysEventQueueWaitEnd;
+    }
+
+    EventCount = Parameters->EventCount;
+    if (EventCount > EVENT_QUEUE_MAX_WAIT_EVENTS) {
+        EventCount = EVENT_QUEUE_MAX_WAIT_EVENTS;
+    }
+
+    //
+    // Set the signal mask if supplied.
+    //
+
+    if (Parameters->SignalMask != NULL) {
+        Status = MmCopyFromUserMode(&SignalMask,
+                                    Parameters->SignalMask,
+                                    sizeof(SIGNAL_SET));
+
+        if (!KSUCCESS(Status)) {
+            goto SysEventQueueWaitEnd;
+        }
+
+        PsSetSignalMask(&SignalMask, &OldSignalSet);
+        RestoreSignalMask = TRUE;
+    }
+
+    QueueHandle = ObGetHandleValue(Process->HandleTable,
+                                   Parameters->EventQueue,
+                                   NULL);
+
+    if (QueueHandle == NULL) {
+        Status = STATUS_INVALID_HANDLE;
+        goto SysEventQueueWaitEnd;
+    }
+
+    Status = IopGetEventQueueFromHandle(QueueHandle, &Queue);
+    if (!KSUCCESS(Status)) {
+        goto SysEventQueueWaitEnd;
+    }
+
+    Events = MmAllocatePagedPool(EventCount * sizeof(EVENT_QUEUE_EVENT),
+                                 EVENT_QUEUE_ALLOCATION_TAG);
+
+    if (Events == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto SysEventQueueWaitEnd;
+    }
+
+    Status = IopWaitForEventQueue(Queue,
+                                  Events,
+                                  EventCount,
+                                  Parameters->TimeoutInMilliseconds,
+                                  &EventsReturned);
+
+    if (!KSUCCESS(Status)) {
+        goto SysEventQueueWaitEnd;
+    }
+
+    if (EventsReturned != 0) {
+        Status = MmCopyToUserMode(Parameters->Events,
+                                  Events,
+                                  EventsReturned * sizeof(EVENT_QUEUE_EVENT));
+
+        if (!KSUCCESS(Status)) {
+            goto SysEventQueueWaitEnd;
+        }
+    }
+
+SysEventQueueWaitEnd:
+    if (RestoreSignalMask != FALSE) {
+
+        //
+        // If a signal arrived during the wait, then do not restore the blocked
+        // mask until it gets a chance to be dispatched. Save the old signal
+        // set to be restored during signal dispatch.
+        //
+
+        PsCheckRuntimeTimers(Thread);
+        if (Thread->SignalPending == ThreadSignalPending) {
+            Thread->RestoreSignals = OldSignalSet;
+            Thread->Flags |= THREAD_FLAG_RESTORE_SIGNALS;
+
+        } else {
+            PsSetSignalMask(&OldSignalSet, NULL);
+        }
+    }
+
+    if (Events != NULL) {
+        MmFreePagedPool(Events);
+    }
+
+    if (QueueHandle != NULL) {
+        IoIoHandleReleaseReference(QueueHandle);
+    }
+
+    Result = Status;
+    if (KSUCCESS(Status)) {
+        Result = EventsReturned;
+    }
+
+    return Result;
+}
+
+KSTATUS
+IopCreateEventQueue (
+    FILE_PERMISSIONS Permissions,
+    PFILE_OBJECT *FileObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new event queue.
+
+Arguments:
+
+    Permissions - Supplies the permissions to give to the file object.
+
+    FileObject - Supplies a pointer where a pointer to a newly created event
+        queue file object will be returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    BOOL Created;
+    FILE_PROPERTIES FileProperties;
+    PFILE_OBJECT NewFileObject;
+    PEVENT_QUEUE NewQueue;
+    KSTATUS Status;
+    PKTHREAD Thread;
+
+    ASSERT(*FileObject == NULL);
+
+    NewFileObject = NULL;
+
+    //
+    // Create the actual object. This reference is transferred to the file
+    // object's special I/O member on success.
+    //
+
+    NewQueue = ObCreateObject(ObjectEventQueue,
+                              NULL,
+                              NULL,
+                              0,
+                              sizeof(EVENT_QUEUE),
+                              IopDestroyEventQueue,
+                              0,
+                              EVENT_QUEUE_ALLOCATION_TAG);
+
+    if (NewQueue == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateEventQueueEnd;
+    }
+
+    RtlRedBlackTreeInitialize(&(NewQueue->EntryTree),
+                              0,
+                              IopCompareEventQueueEntries);
+
+    INITIALIZE_LIST_HEAD(&(NewQueue->ReadyList));
+    NewQueue->Lock = KeCreateQueuedLock();
+    if (NewQueue->Lock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateEventQueueEnd;
+    }
+
+    Thread = KeGetCurrentThread();
+    IopFillOutFilePropertiesForObject(&FileProperties, &(NewQueue->Header));
+    FileProperties.Permissions = Permissions;
+    FileProperties.Type = IoObjectEventQueue;
+    FileProperties.UserId = Thread->Identity.EffectiveUserId;
+    FileProperties.GroupId = Thread->Identity.EffectiveGroupId;
+    Status = IopCreateOrLookupFileObject(&FileProperties,
+                                         ObGetRootObject(),
+                                         0,
+                                         &NewFileObject,
+                                         &Created);
+
+    if (!KSUCCESS(Status)) {
+
+        //
+        // Release the references added by filling out the file properties.
+        //
+
+        ObReleaseReference(NewQueue);
+        goto CreateEventQueueEnd;
+    }
+
+    ASSERT(Created != FALSE);
+    ASSERT(NewFileObject->IoState != NULL);
+
+    *FileObject = NewFileObject;
+    NewQueue->IoState = NewFileObject->IoState;
+
+    ASSERT(((*FileObject)->SpecialIo == NULL) &&
+           ((KeGetEventState((*FileObject)->ReadyEvent) == NotSignaled) ||
+            (KeGetEventState((*FileObject)->ReadyEvent) ==
+             NotSignaledWithWaiters)));
+
+    (*FileObject)->SpecialIo = NewQueue;
+    NewQueue = NULL;
+    Status = STATUS_SUCCESS;
+
+CreateEventQueueEnd:
+
+    //
+    // On both success and failure, the file object's ready event needs to be
+    // signaled. Other threads may be waiting on the event.
+    //
+
+    if (*FileObject != NULL) {
+        KeSignalEvent((*FileObject)->ReadyEvent, SignalOptionSignalAll);
+    }
+
+    if (!KSUCCESS(Status)) {
+        if (NewFileObject != NULL) {
+            *FileObject = NULL;
+            IopFileObjectReleaseReference(NewFileObject);
+        }
+
+        if (NewQueue != NULL) {
+            ObReleaseReference(NewQueue);
+            NewQueue = NULL;
+        }
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopCloseEventQueue (
+    PIO_HANDLE IoHandle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when an event queue handle is closed. It removes
+    every registration from the queue.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the I/O handle being closed.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PEVENT_QUEUE_ENTRY Entry;
+    PIO_OBJECT_STATE IoState;
+    PRED_BLACK_TREE_NODE Node;
+    PEVENT_QUEUE Queue;
+
+    ASSERT(IoHandle->FileObject->Properties.Type == IoObjectEventQueue);
+
+    Queue = IoHandle->FileObject->SpecialIo;
+    if (Queue == NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // The registration lock keeps every entry alive between dropping the
+    // queue lock and reacquiring it in the proper order behind the I/O
+    // object state lock.
+    //
+
+    KeAcquireQueuedLock(IoEventQueueLock);
+    while (TRUE) {
+        KeAcquireQueuedLock(Queue->Lock);
+        Node = RtlRedBlackTreeGetLowestNode(&(Queue->EntryTree));
+        KeReleaseQueuedLock(Queue->Lock);
+        if (Node == NULL) {
+            break;
+        }
+
+        Entry = RED_BLACK_TREE_VALUE(Node, EVENT_QUEUE_ENTRY, TreeNode);
+        IoState = Entry->IoState;
+        KeAcquireQueuedLock(IoState->EventQueueLock);
+        KeAcquireQueuedLock(Queue->Lock);
+        IopRemoveEventQueueEntry(Entry);
+        KeReleaseQueuedLock(Queue->Lock);
+        KeReleaseQueuedLock(IoState->EventQueueLock);
+        MmFreePagedPool(Entry);
+    }
+
+    KeReleaseQueuedLock(IoEventQueueLock);
+    return STATUS_SUCCESS;
+}
+
+VOID
+IopUnregisterEventQueueHandle (
+    PIO_HANDLE IoHandle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes all event queue registrations for the given I/O
+    handle. It is called when the handle is being destroyed.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the I/O handle being destroyed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PEVENT_QUEUE_ENTRY Entry;
+    LIST_ENTRY FreeList;
+    PIO_OBJECT_STATE IoState;
+    PEVENT_QUEUE Queue;
+
+    //
+    // Objects that have never been registered with an event queue have no
+    // lock, and can skip all of this.
+    //
+
+    IoState = IoHandle->FileObject->IoState;
+    if ((IoState == NULL) || (IoState->EventQueueLock == NULL)) {
+        return;
+    }
+
+    INITIALIZE_LIST_HEAD(&FreeList);
+    KeAcquireQueuedLock(IoEventQueueLock);
+    KeAcquireQueuedLock(IoState->EventQueueLock);
+    CurrentEntry = IoState->EventQueueList.Next;
+    while (CurrentEntry != &(IoState->EventQueueList)) {
+        Entry = LIST_VALUE(CurrentEntry, EVENT_QUEUE_ENTRY, StateListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if (Entry->IoHandle != IoHandle) {
+            continue;
+        }
+
+        Queue = Entry->Queue;
+        KeAcquireQueuedLock(Queue->Lock);
+        IopRemoveEventQueueEntry(Entry);
+        KeReleaseQueuedLock(Queue->Lock);
+        INSERT_BEFORE(&(Entry->StateListEntry), &FreeList);
+    }
+
+    KeReleaseQueuedLock(IoState->EventQueueLock);
+    KeReleaseQueuedLock(IoEventQueueLock);
+    while (LIST_EMPTY(&FreeList) == FALSE) {
+        Entry = LIST_VALUE(FreeList.Next, EVENT_QUEUE_ENTRY, StateListEntry);
+        LIST_REMOVE(&(Entry->StateListEntry));
+        MmFreePagedPool(Entry);
+    }
+
+    return;
+}
+
+VOID
+IopNotifyEventQueues (
+    PIO_OBJECT_STATE IoState,
+    ULONG Events
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues the registrations interested in the given events onto
+    their event queues, and fires any armed waits interested in them.
+
+Arguments:
+
+    IoState - Supplies a pointer to the I/O object state whose events were
+        just set.
+
+    Events - Supplies the mask of poll events that were set.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PEVENT_QUEUE_ENTRY Entry;
+    PEVENT_QUEUE Queue;
+    PIO_STATE_WAIT Wait;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    KeAcquireQueuedLock(IoState->EventQueueLock);
+    CurrentEntry = IoState->EventQueueList.Next;
+    while (CurrentEntry != &(IoState->EventQueueList)) {
+        Entry = LIST_VALUE(CurrentEntry, EVENT_QUEUE_ENTRY, StateListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if ((Events & (Entry->Events | POLL_NONMASKABLE_EVENTS)) == 0) {
+            continue;
+        }
+
+        Queue = Entry->Queue;
+        KeAcquireQueuedLock(Queue->Lock);
+        IopQueueEventQueueEntry(Entry);
+        KeReleaseQueuedLock(Queue->Lock);
+    }
+
+    //
+    // Waits are one-shot, so pull each one off before calling it. Clearing
+    // the next pointer tells a racing disarm that the wait has fired.
+    //
+
+    CurrentEntry = IoState->WaitList.Next;
+    while (CurrentEntry != &(IoState->WaitList)) {
+        Wait = LIST_VALUE(CurrentEntry, IO_STATE_WAIT, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if ((Events & (Wait->Events | POLL_NONMASKABLE_EVENTS)) == 0) {
+            continue;
+        }
+
+        LIST_REMOVE(&(Wait->ListEntry));
+        Wait->ListEntry.Next = NULL;
+        Wait->Routine(Wait, Events);
+    }
+
+    KeReleaseQueuedLock(IoState->EventQueueLock);
+    return;
+}
+
+KSTATUS
+IopArmIoStateWait (
+    PIO_STATE_WAIT Wait
+    )
+
+/*++
+
+Routine Description:
+
+    This routine arms a one-shot wait on an I/O object state. The wait's
+    routine is called once, from the thread that sets one of the events.
+
+Arguments:
+
+    Wait - Supplies a pointer to the initialized wait. It must not already be
+        armed.
+
+Return Value:
+
+    STATUS_SUCCESS if the wait was armed.
+
+    STATUS_TOO_LATE if one of the events is already set. The wait is not
+    armed and the caller should retry its operation.
+
+    STATUS_INSUFFICIENT_RESOURCES if the I/O object state's lock could not be
+    created.
+
+--*/
+
+{
+
+    PIO_OBJECT_STATE IoState;
+    PQUEUED_LOCK Lock;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+    ASSERT(Wait->ListEntry.Next == NULL);
+
+    IoState = Wait->IoState;
+    if (IoState->EventQueueLock == NULL) {
+        Status = STATUS_SUCCESS;
+        KeAcquireQueuedLock(IoEventQueueLock);
+        if (IoState->EventQueueLock == NULL) {
+            Lock = KeCreateQueuedLock();
+            if (Lock == NULL) {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+
+            } else {
+                RtlMemoryBarrier();
+                IoState->EventQueueLock = Lock;
+            }
+        }
+
+        KeReleaseQueuedLock(IoEventQueueLock);
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+    }
+
+    //
+    // Setting the events updates the mask before looking for waits, so
+    // checking the mask after getting on the list cannot miss an event.
+    //
+
+    KeAcquireQueuedLock(IoState->EventQueueLock);
+    if ((IoState->Events & (Wait->Events | POLL_NONMASKABLE_EVENTS)) != 0) {
+        Status = STATUS_TOO_LATE;
+
+    } else {
+        INSERT_BEFORE(&(Wait->ListEntry), &(IoState->WaitList));
+        Status = STATUS_SUCCESS;
+    }
+
+    KeReleaseQueuedLock(IoState->EventQueueLock);
+    return Status;
+}
+
+BOOL
+IopDisarmIoStateWait (
+    PIO_STATE_WAIT Wait
+    )
+
+/*++
+
+Routine Description:
+
+    This routine disarms a wait on an I/O object state.
+
+Arguments:
+
+    Wait - Supplies a pointer to the wait.
+
+Return Value:
+
+    TRUE if the wait was disarmed before it fired. Its routine will not be
+    called.
+
+    FALSE if the wait was not armed or has already fired. In that case its
+    routine has finished running by the time this returns.
+
+--*/
+
+{
+
+    BOOL Disarmed;
+    PIO_OBJECT_STATE IoState;
+
+    IoState = Wait->IoState;
+    if (IoState->EventQueueLock == NULL) {
+        return FALSE;
+    }
+
+    Disarmed = FALSE;
+    KeAcquireQueuedLock(IoState->EventQueueLock);
+    if (Wait->ListEntry.Next != NULL) {
+        LIST_REMOVE(&(Wait->ListEntry));
+        Wait->ListEntry.Next = NULL;
+        Disarmed = TRUE;
+    }
+
+    KeReleaseQueuedLock(IoState->EventQueueLock);
+    return Disarmed;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+IopDestroyEventQueue (
+    PVOID EventQueueObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys all resources associated with an event queue.
+
+Arguments:
+
+    EventQueueObject - Supplies a pointer to the event queue being destroyed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PEVENT_QUEUE Queue;
+
+    Queue = (PEVENT_QUEUE)EventQueueObject;
+
+    ASSERT(RED_BLACK_TREE_EMPTY(&(Queue->EntryTree)));
+    ASSERT(LIST_EMPTY(&(Queue->ReadyList)));
+
+    if (Queue->Lock != NULL) {
+        KeDestroyQueuedLock(Queue->Lock);
+    }
+
+    return;
+}
+
+KSTATUS
+IopGetEventQueueFromHandle (
+    PIO_HANDLE IoHandle,
+    PEVENT_QUEUE *Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the event queue behind the given I/O handle.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the I/O handle.
+
+    Queue - Supplies a pointer where a pointer to the event queue will be
+        returned on success.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if the handle is not an event queue.
+
+--*/
+
+{
+
+    PFILE_OBJECT FileObject;
+
+    FileObject = IoHandle->FileObject;
+    if (FileObject->Properties.Type != IoObjectEventQueue) {
+        *Queue = NULL;
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    *Queue = FileObject->SpecialIo;
+
+    ASSERT(*Queue != NULL);
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+IopControlEventQueue (
+    PEVENT_QUEUE Queue,
+    EVENT_QUEUE_OPERATION Operation,
+    PIO_HANDLE IoHandle,
+    ULONG Events,
+    ULONG Flags,
+    ULONGLONG Data
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds, modifies, or removes an I/O handle's registration with
+    an event queue.
+
+Arguments:
+
+    Queue - Supplies a pointer to the event queue.
+
+    Operation - Supplies the operation to perform.
+
+    IoHandle - Supplies a pointer to the I/O handle whose registration is
+        being changed.
+
+    Events - Supplies the mask of poll events the registration is interested
+        in.
+
+    Flags - Supplies a bitmask of registration flags. See EVENT_QUEUE_FLAG_*
+        definitions.
+
+    Data - Supplies the caller-defined data to return with each event.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_SUPPORTED if the handle cannot be registered with an event
+    queue.
+
+    STATUS_FILE_EXISTS if the handle is already registered and an add was
+    requested.
+
+    STATUS_NOT_FOUND if the handle is not registered and a modify or delete
+    was requested.
+
+--*/
+
+{
+
+    PEVENT_QUEUE_ENTRY Entry;
+    PFILE_OBJECT FileObject;
+    PRED_BLACK_TREE_NODE FoundNode;
+    PIO_OBJECT_STATE IoState;
+    PQUEUED_LOCK Lock;
+    EVENT_QUEUE_ENTRY SearchEntry;
+    KSTATUS Status;
+
+    Entry = NULL;
+    if ((Flags & ~EVENT_QUEUE_FLAG_MASK) != 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    // Event queues cannot watch other event queues, and objects without I/O
+    // state (like regular files) are always ready.
+    //
+
+    FileObject = IoHandle->FileObject;
+    IoState = FileObject->IoState;
+    if ((FileObject->Properties.Type == IoObjectEventQueue) ||
+        (IoState == NULL)) {
+
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    if (Operation == EventQueueOperationAdd) {
+        Entry = MmAllocatePagedPool(sizeof(EVENT_QUEUE_ENTRY),
+                                    EVENT_QUEUE_ALLOCATION_TAG);
+
+        if (Entry == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlZeroMemory(Entry, sizeof(EVENT_QUEUE_ENTRY));
+        Entry->Queue = Queue;
+        Entry->IoHandle = IoHandle;
+        Entry->IoState = IoState;
+        Entry->Events = Events;
+        Entry->Flags = Flags;
+        Entry->Data = Data;
+    }
+
+    KeAcquireQueuedLock(IoEventQueueLock);
+
+    //
+    // Create the I/O object state's lock on the first registration. The
+    // barrier makes sure the lock is fully initialized before anyone setting
+    // the I/O state sees it.
+    //
+
+    if (IoState->EventQueueLock == NULL) {
+        Lock = KeCreateQueuedLock();
+        if (Lock == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto ControlEventQueueEnd;
+        }
+
+        RtlMemoryBarrier();
+        IoState->EventQueueLock = Lock;
+    }
+
+    KeAcquireQueuedLock(IoState->EventQueueLock);
+    KeAcquireQueuedLock(Queue->Lock);
+    SearchEntry.IoHandle = IoHandle;
+    FoundNode = RtlRedBlackTreeSearch(&(Queue->EntryTree),
+                                      &(SearchEntry.TreeNode));
+
+    switch (Operation) {
+    case EventQueueOperationAdd:
+        if (FoundNode != NULL) {
+            Status = STATUS_FILE_EXISTS;
+            break;
+        }
+
+        RtlRedBlackTreeInsert(&(Queue->EntryTree), &(Entry->TreeNode));
+        INSERT_BEFORE(&(Entry->StateListEntry), &(IoState->EventQueueList));
+
+        //
+        // Report anything that is already pending. Events set from here on
+        // will find the registration on the I/O object state's list.
+        //
+
+        if ((IoState->Events & (Events | POLL_NONMASKABLE_EVENTS)) != 0) {
+            IopQueueEventQueueEntry(Entry);
+        }
+
+        Entry = NULL;
+        Status = STATUS_SUCCESS;
+        break;
+
+    case EventQueueOperationModify:
+        if (FoundNode == NULL) {
+            Status = STATUS_NOT_FOUND;
+            break;
+        }
+
+        Entry = RED_BLACK_TREE_VALUE(FoundNode, EVENT_QUEUE_ENTRY, TreeNode);
+        Entry->Events = Events;
+        Entry->Flags = Flags;
+        Entry->Data = Data;
+        if ((IoState->Events & (Events | POLL_NONMASKABLE_EVENTS)) != 0) {
+            IopQueueEventQueueEntry(Entry);
+        }
+
+        Entry = NULL;
+        Status = STATUS_SUCCESS;
+        break;
+
+    case EventQueueOperationDelete:
+        if (FoundNode == NULL) {
+            Status = STATUS_NOT_FOUND;
+            break;
+        }
+
+        Entry = RED_BLACK_TREE_VALUE(FoundNode, EVENT_QUEUE_ENTRY, TreeNode);
+        IopRemoveEventQueueEntry(Entry);
+        Status = STATUS_SUCCESS;
+        break;
+
+    default:
+        Status = STATUS_INVALID_PARAMETER;
+        break;
+    }
+
+    KeReleaseQueuedLock(Queue->Lock);
+    KeReleaseQueuedLock(IoState->EventQueueLock);
+
+ControlEventQueueEnd:
+    KeReleaseQueuedLock(IoEventQueueLock);
+
+    //
+    // Free a registration that was either removed or never inserted.
+    //
+
+    if (Entry != NULL) {
+        MmFreePagedPool(Entry);
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopWaitForEventQueue (
+    PEVENT_QUEUE Queue,
+    PEVENT_QUEUE_EVENT Events,
+    ULONG EventCount,
+    ULONG TimeoutInMilliseconds,
+    PULONG EventsReturned
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits for at least one event on the given event queue and
+    harvests as many ready events as fit in the supplied array.
+
+Arguments:
+
+    Queue - Supplies a pointer to the event queue.
+
+    Events - Supplies a pointer to the array where events are returned.
+
+    EventCount - Supplies the number of elements in the array.
+
+    TimeoutInMilliseconds - Supplies the number of milliseconds to wait for an
+        event. Supply WAIT_TIME_INDEFINITE to wait forever.
+
+    EventsReturned - Supplies a pointer where the number of events returned
+        will be stored. This is zero if the wait timed out.
+
+Return Value:
+
+    STATUS_SUCCESS if events were returned or the wait timed out.
+
+    STATUS_INTERRUPTED if a signal arrived during the wait.
+
+--*/
+
+{
+
+    ULONGLONG CurrentTime;
+    ULONGLONG EndTime;
+    ULONGLONG Frequency;
+    ULONG Harvested;
+    KSTATUS Status;
+    ULONG WaitTime;
+
+    EndTime = 0;
+    Frequency = 0;
+    if ((TimeoutInMilliseconds != 0) &&
+        (TimeoutInMilliseconds != WAIT_TIME_INDEFINITE)) {
+
+        Frequency = HlQueryTimeCounterFrequency();
+        EndTime = HlQueryTimeCounter() +
+                  KeConvertMicrosecondsToTimeTicks(
+                      TimeoutInMilliseconds * MICROSECONDS_PER_MILLISECOND);
+    }
+
+    WaitTime = TimeoutInMilliseconds;
+    while (TRUE) {
+        KeAcquireQueuedLock(Queue->Lock);
+        Harvested = IopHarvestEventQueue(Queue, Events, EventCount);
+        KeReleaseQueuedLock(Queue->Lock);
+        if ((Harvested != 0) || (WaitTime == 0)) {
+            Status = STATUS_SUCCESS;
+            break;
+        }
+
+        //
+        // The queue's in event may fire for registrations whose events have
+        // since gone away, so go around until something is really harvested
+        // or time runs out.
+        //
+
+        Status = IoWaitForIoObjectState(Queue->IoState,
+                                        POLL_EVENT_IN,
+                                        TRUE,
+                                        WaitTime,
+                                        NULL);
+
+        if (Status == STATUS_TIMEOUT) {
+            Status = STATUS_SUCCESS;
+            break;
+        }
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        if (EndTime != 0) {
+            CurrentTime = HlQueryTimeCounter();
+            if (CurrentTime >= EndTime) {
+                WaitTime = 0;
+
+            } else {
+                WaitTime = ((EndTime - CurrentTime) *
+                            MILLISECONDS_PER_SECOND) / Frequency;
+
+                if (WaitTime == 0) {
+                    WaitTime = 1;
+                }
+            }
+        }
+    }
+
+    *EventsReturned = Harvested;
+    return Status;
+}
+
+ULONG
+IopHarvestEventQueue (
+    PEVENT_QUEUE Queue,
+    PEVENT_QUEUE_EVENT Events,
+    ULONG EventCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine pulls ready events off of an event queue. Level-triggered
+    registrations that are still ready go back on the end of the ready list
+    so they are reported again on the next harvest. The caller must hold the
+    event queue lock.
+
+Arguments:
+
+    Queue - Supplies a pointer to the event queue.
+
+    Events - Supplies a pointer to the array where events are returned.
+
+    EventCount - Supplies the number of elements in the array.
+
+Return Value:
+
+    Returns the number of events harvested.
+
+--*/
+
+{
+
+    PEVENT_QUEUE_ENTRY Entry;
+    ULONG Harvested;
+    LIST_ENTRY RequeueList;
+    ULONG ReturnedEvents;
+
+    Harvested = 0;
+    INITIALIZE_LIST_HEAD(&RequeueList);
+    while ((Harvested < EventCount) &&
+           (LIST_EMPTY(&(Queue->ReadyList)) == FALSE)) {
+
+        Entry = LIST_VALUE(Queue->ReadyList.Next,
+                           EVENT_QUEUE_ENTRY,
+                           ReadyListEntry);
+
+        LIST_REMOVE(&(Entry->ReadyListEntry));
+        Entry->ReadyListEntry.Next = NULL;
+
+        //
+        // Report the current state of the object, not whatever it was when
+        // the registration was queued. If the events have since cleared,
+        // drop the registration until it is signaled again.
+        //
+
+        ReturnedEvents = Entry->IoState->Events &
+                         (Entry->Events | POLL_NONMASKABLE_EVENTS);
+
+        if (ReturnedEvents == 0) {
+            continue;
+        }
+
+        Events[Harvested].Events = ReturnedEvents;
+        Events[Harvested].Data = Entry->Data;
+        Harvested += 1;
+        if ((Entry->Flags & EVENT_QUEUE_FLAG_ONE_SHOT) != 0) {
+            Entry->Flags |= EVENT_QUEUE_ENTRY_FLAG_DISABLED;
+
+        } else if ((Entry->Flags & EVENT_QUEUE_FLAG_EDGE_TRIGGERED) == 0) {
+            INSERT_BEFORE(&(Entry->ReadyListEntry), &RequeueList);
+        }
+    }
+
+    if (LIST_EMPTY(&RequeueList) == FALSE) {
+        APPEND_LIST(&RequeueList, &(Queue->ReadyList));
+    }
+
+    if (LIST_EMPTY(&(Queue->ReadyList)) != FALSE) {
+        IoSetIoObjectState(Queue->IoState, POLL_EVENT_IN, FALSE);
+    }
+
+    return Harvested;
+}
+
+VOID
+IopQueueEventQueueEntry (
+    PEVENT_QUEUE_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine puts a registration on its event queue's ready list if it is
+    not already there. The caller must hold the event queue lock.
+
+Arguments:
+
+    Entry - Supplies a pointer to the registration.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PEVENT_QUEUE Queue;
+
+    if ((Entry->ReadyListEntry.Next != NULL) ||
+        ((Entry->Flags & EVENT_QUEUE_ENTRY_FLAG_DISABLED) != 0)) {
+
+        return;
+    }
+
+    Queue = Entry->Queue;
+    if (LIST_EMPTY(&(Queue->ReadyList)) != FALSE) {
+        IoSetIoObjectState(Queue->IoState, POLL_EVENT_IN, TRUE);
+    }
+
+    INSERT_BEFORE(&(Entry->ReadyListEntry), &(Queue->ReadyList));
+    return;
+}
+
+VOID
+IopRemoveEventQueueEntry (
+    PEVENT_QUEUE_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a registration from its event queue and its I/O
+    object state. The caller must hold the registration lock, the I/O object
+    state's event queue lock, and the event queue lock.
+
+Arguments:
+
+    Entry - Supplies a pointer to the registration.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PEVENT_QUEUE Queue;
+
+    Queue = Entry->Queue;
+    RtlRedBlackTreeRemove(&(Queue->EntryTree), &(Entry->TreeNode));
+    LIST_REMOVE(&(Entry->StateListEntry));
+    if (Entry->ReadyListEntry.Next != NULL) {
+        LIST_REMOVE(&(Entry->ReadyListEntry));
+        Entry->ReadyListEntry.Next = NULL;
+        if (LIST_EMPTY(&(Queue->ReadyList)) != FALSE) {
+            IoSetIoObjectState(Queue->IoState, POLL_EVENT_IN, FALSE);
+        }
+    }
+
+    return;
+}
+
+COMPARISON_RESULT
+IopCompareEventQueueEntries (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two event queue registrations by I/O handle.
+
+Arguments:
+
+    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+
+    FirstNode - Supplies a pointer to the left side of the comparison.
+
+    SecondNode - Supplies a pointer to the second side of the comparison.
+
+Return Value:
+
+    Same if the two nodes have the same value.
+
+    Ascending if the first node is less than the second node.
+
+    Descending if the second node is less than the first node.
+
+--*/
+
+{
+
+    PEVENT_QUEUE_ENTRY FirstEntry;
+    PEVENT_QUEUE_ENTRY SecondEntry;
+
+    FirstEntry = RED_BLACK_TREE_VALUE(FirstNode, EVENT_QUEUE_ENTRY, TreeNode);
+    SecondEntry = RED_BLACK_TREE_VALUE(SecondNode, EVENT_QUEUE_ENTRY, TreeNode);
+    if ((UINTN)(FirstEntry->IoHandle) < (UINTN)(SecondEntry->IoHandle)) {
+        return ComparisonResultAscending;
+    }
+
+    if ((UINTN)(FirstEntry->IoHandle) > (UINTN)(SecondEntry->IoHandle)) {
+        return ComparisonResultDescending;
+    }
+
+    return ComparisonResultSame;
+}
@@ -214,6 +214,16 @@ Return Value:
         }
     }
 
+    //
+    // Queue the object on any event queues it is registered with and fire any
+    // armed waits. The lock is only created on the first registration, so
+    // most objects skip this.
+    //
+
+    if ((Set != FALSE) && (IoState->EventQueueLock != NULL)) {
+        IopNotifyEventQueues(IoState, Events);
+    }
+
     return;
 }
 
@@ -403,6 +413,8 @@ Return Value:
     }
 
     RtlZeroMemory(NewState, sizeof(IO_OBJECT_STATE));
+    INITIALIZE_LIST_HEAD(&(NewState->EventQueueList));
+    INITIALIZE_LIST_HEAD(&(NewState->WaitList));
 
     //
     // Create the events and lock.
@@ -496,6 +508,13 @@ Return Value:
         KeDestroyEvent(State->ErrorEvent);
     }
 
+    ASSERT(LIST_EMPTY(&(State->EventQueueList)));
+    ASSERT(LIST_EMPTY(&(State->WaitList)));
+
+    if (State->EventQueueLock != NULL) {
+        KeDestroyQueuedLock(State->EventQueueLock);
+    }
+
     MmFreePagedPool(State);
     return;
 }
@@ -831,6 +850,8 @@ Return Value:
                 case IoObjectTerminalMaster:
                 case IoObjectTerminalSlave:
                 case IoObjectSharedMemoryObject:
+                case IoObjectEventQueue:
+                case IoObjectIoRing:
                     break;
 
                 default:
@@ -1198,6 +1219,8 @@ Return Value:
             case IoObjectTerminalMaster:
             case IoObjectTerminalSlave:
             case IoObjectSharedMemoryObject:
+            case IoObjectEventQueue:
+            case IoObjectIoRing:
                 ObReleaseReference(Object->SpecialIo);
                 break;
 
@@ -249,6 +249,27 @@ Return Value:
         goto InitializeEnd;
     }
 
+    //
+    // Create the lock serializing event queue registration changes.
+    //
+
+    IoEventQueueLock = KeCreateQueuedLock();
+    if (IoEventQueueLock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto InitializeEnd;
+    }
+
+    //
+    // Create the work queue that runs I/O ring operations. Its workers block
+    // in ordinary I/O, so lean on the work queue's ability to grow.
+    //
+
+    IoRingWorkQueue = KeCreateWorkQueue(0, "IoRingWorker");
+    if (IoRingWorkQueue == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto InitializeEnd;
+    }
+
     //
     // Initialize the file system list head and create the lock protecting
     // access to it.
@@ -2299,9 +2299,8 @@ Return Value:
                                        SourceFileObject);
 
             if (NewPathEntry != NULL) {
-                INSERT_BEFORE(
-                        &(NewPathEntry->SiblingListEntry),
-                        &(DestinationDirectoryPathPoint.PathEntry->ChildList));
+                IopPathLink(DestinationDirectoryPathPoint.PathEntry,
+                            NewPathEntry);
 
                 IopFileObjectAddReference(SourceFileObject);
             }
@@ -3453,6 +3452,23 @@ Return Value:
         Status = STATUS_SUCCESS;
         break;
 
+    //
+    // Event queues are anonymous and set up entirely at creation.
+    //
+
+    case IoObjectEventQueue:
+        Status = STATUS_SUCCESS;
+        break;
+
+    //
+    // I/O rings are anonymous, and their memory is attached right after
+    // creation.
+    //
+
+    case IoObjectIoRing:
+        Status = STATUS_SUCCESS;
+        break;
+
     case IoObjectSocket:
         Status = IopOpenSocket(NewHandle);
         break;
@@ -3672,6 +3688,14 @@ Return Value:
 
         break;
 
+    case IoObjectEventQueue:
+        Status = IopCreateEventQueue(CreatePermissions, FileObject);
+        break;
+
+    case IoObjectIoRing:
+        Status = IopCreateIoRing(CreatePermissions, FileObject);
+        break;
+
     default:
 
         ASSERT(FALSE);
@@ -3714,6 +3738,7 @@ Return Value:
     FileObject = NULL;
     if (IoHandle->PathPoint.PathEntry != NULL) {
         FileObject = IoHandle->FileObject;
+        IopUnregisterEventQueueHandle(IoHandle);
         switch (FileObject->Properties.Type) {
         case IoObjectRegularFile:
         case IoObjectRegularDirectory:
@@ -3762,6 +3787,14 @@ Return Value:
             Status = IopTerminalCloseSlave(IoHandle);
             break;
 
+        case IoObjectEventQueue:
+            Status = IopCloseEventQueue(IoHandle);
+            break;
+
+        case IoObjectIoRing:
+            Status = IopCloseIoRing(IoHandle);
+            break;
+
         default:
             Status = STATUS_SUCCESS;
             break;
@@ -5355,6 +5388,11 @@ Return Value:
         Status = IopPerformObjectIoOperation(Handle, Context);
         break;
 
+    case IoObjectEventQueue:
+    case IoObjectIoRing:
+        Status = STATUS_NOT_SUPPORTED;
+        break;
+
     default:
 
         ASSERT(FALSE);
@@ -213,6 +213,20 @@ Module Name:
 
 #define FILE_OBJECT_FLAG_DIRTY_DATA 0x00000040
 
+//
+// This flag is set while a reader is updating the file object's read-ahead
+// state.
+//
+
+#define FILE_OBJECT_FLAG_READ_AHEAD_LOCKED 0x00000080
+
+//
+// This flag is set while an asynchronous read-ahead is outstanding on the
+// file object.
+//
+
+#define FILE_OBJECT_FLAG_READ_AHEAD_PENDING 0x00000100
+
 //
 // The resource allocation work is currently assigned to the system work queue.
 //
@@ -225,6 +239,21 @@ Module Name:
 
 #define IO_READ_AHEAD_SIZE _128KB
 
+//
+// Define the bounds of the adaptive read-ahead window used for files. The
+// window doubles on each sequential read-ahead and is quartered on random
+// access.
+//
+
+#define IO_READ_AHEAD_MINIMUM_WINDOW (4 * _4KB)
+#define IO_READ_AHEAD_MAXIMUM_WINDOW _1MB
+
+//
+// Define the largest range a single prefetch hint will read into the cache.
+//
+
+#define IO_PREFETCH_MAXIMUM_SIZE (16 * _1MB)
+
 //
 // This flag is set to indicate that the eviction operation is executing as a
 // result of a truncate. All image sections should be unmapped and all page
@@ -391,6 +420,15 @@ Structure Description:
     FileLockEvent - Stores a pointer to the event that's signalled when a file
         object lock is released.
 
+    ReadAheadNextOffset - Stores the file offset just past the previous
+        cached read, used to detect sequential access.
+
+    ReadAheadEnd - Stores the file offset just past the last region read
+        ahead into the page cache.
+
+    ReadAheadWindow - Stores the current read-ahead window size, in bytes.
+        This is zero if the file is not being read sequentially.
+
 --*/
 
 typedef struct _FILE_OBJECT FILE_OBJECT, *PFILE_OBJECT;
@@ -412,10 +450,52 @@ struct _FILE_OBJECT {
     FILE_PROPERTIES Properties;
     LIST_ENTRY FileLockList;
     PKEVENT FileLockEvent;
+    IO_OFFSET ReadAheadNextOffset;
+    IO_OFFSET ReadAheadEnd;
+    ULONG ReadAheadWindow;
 };
 
 /*++
 
+Structure Description:
+
+    This structure defines a hash table used to look up the children of a
+    directory path entry by name. It is protected by the directory's file
+    object lock, and is resized incrementally: when it grows, a new bucket
+    array is allocated and the old buckets are migrated a few at a time as
+    new children are linked in. Lookups consult both arrays until the
+    migration completes.
+
+Members:
+
+    Buckets - Stores a pointer to the current array of bucket list heads.
+
+    BucketCount - Stores the number of buckets in the current array. This is
+        always a power of two.
+
+    OldBuckets - Stores an optional pointer to the previous array of bucket
+        list heads that is still being migrated.
+
+    OldBucketCount - Stores the number of buckets in the old array.
+
+    MigrateIndex - Stores the index of the next old bucket to migrate. All old
+        buckets below this index are empty.
+
+    EntryCount - Stores the number of path entries in the table.
+
+--*/
+
+typedef struct _PATH_ENTRY_TABLE {
+    PLIST_ENTRY Buckets;
+    ULONG BucketCount;
+    PLIST_ENTRY OldBuckets;
+    ULONG OldBucketCount;
+    ULONG MigrateIndex;
+    ULONG EntryCount;
+} PATH_ENTRY_TABLE, *PPATH_ENTRY_TABLE;
+
+/*++
+
 Structure Description:
 
     This structure defines a path entry.
@@ -458,6 +538,16 @@ Structure Description:
 
     FileObject - Stores a pointer to the file object backing this path entry.
 
+    HashListEntry - Stores pointers to the next and previous entries in the
+        parent's child hash table bucket. The next pointer is NULL if the
+        entry is not in a hash table.
+
+    ChildCount - Stores the number of children on the child list.
+
+    ChildTable - Stores an optional pointer to the hash table used to look up
+        children by name. This is only created once a directory has enough
+        children to make a linear search expensive.
+
 --*/
 
 struct _PATH_ENTRY {
@@ -473,6 +563,9 @@ struct _PATH_ENTRY {
     PPATH_ENTRY Parent;
     LIST_ENTRY ChildList;
     PFILE_OBJECT FileObject;
+    LIST_ENTRY HashListEntry;
+    ULONG ChildCount;
+    PPATH_ENTRY_TABLE ChildTable;
 };
 
 /*++
@@ -1079,6 +1172,67 @@ Return Value:
 
 --*/
 
+typedef struct _IO_STATE_WAIT IO_STATE_WAIT, *PIO_STATE_WAIT;
+
+typedef
+VOID
+(*PIO_STATE_WAIT_ROUTINE) (
+    PIO_STATE_WAIT Wait,
+    ULONG Events
+    );
+
+/*++
+
+Routine Description:
+
+    This routine is called when an armed I/O object state wait fires. It is
+    called at low level with the I/O object state's event queue lock held, so
+    it must not block or touch the object's registrations.
+
+Arguments:
+
+    Wait - Supplies a pointer to the wait that fired. It has already been
+        removed from the I/O object state.
+
+    Events - Supplies the mask of poll events that were just set.
+
+Return Value:
+
+    None.
+
+--*/
+
+/*++
+
+Structure Description:
+
+    This structure defines a one-shot wait on an I/O object state's events
+    that calls back instead of blocking a thread.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous waits on the I/O
+        object state. The next pointer is NULL while the wait is not armed.
+
+    IoState - Stores a pointer to the I/O object state being waited on.
+
+    Events - Stores the mask of poll events to wait for. Errors are
+        non-maskable and always fire the wait.
+
+    Routine - Stores a pointer to the routine to call when the wait fires.
+
+    Context - Stores a pointer's worth of context for the routine.
+
+--*/
+
+struct _IO_STATE_WAIT {
+    LIST_ENTRY ListEntry;
+    PIO_OBJECT_STATE IoState;
+    ULONG Events;
+    PIO_STATE_WAIT_ROUTINE Routine;
+    PVOID Context;
+};
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -1159,6 +1313,19 @@ extern POBJECT_HEADER IoIrpDirectory;
 
 extern POBJECT_HEADER IoPipeDirectory;
 
+//
+// Store a pointer to the lock serializing changes to event queue
+// registrations.
+//
+
+extern PQUEUED_LOCK IoEventQueueLock;
+
+//
+// Store a pointer to the work queue that runs I/O ring operations.
+//
+
+extern PWORK_QUEUE IoRingWorkQueue;
+
 //
 // Store the saved boot information.
 //
@@ -3194,6 +3361,204 @@ Return Value:
 
 --*/
 
+KSTATUS
+IopCreateEventQueue (
+    FILE_PERMISSIONS Permissions,
+    PFILE_OBJECT *FileObject
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a new event queue.
+
+Arguments:
+
+    Permissions - Supplies the permissions to give to the file object.
+
+    FileObject - Supplies a pointer where a pointer to a newly created event
+        queue file object will be returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+IopCloseEventQueue (
+    PIO_HANDLE IoHandle
+    );
+
+/*++
+
+Routine Description:
+
+    This routine is called when an event queue handle is closed. It removes
+    every registration from the queue.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the I/O handle being closed.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VOID
+IopUnregisterEventQueueHandle (
+    PIO_HANDLE IoHandle
+    );
+
+/*++
+
+Routine Description:
+
+    This routine removes all event queue registrations for the given I/O
+    handle. It is called when the handle is being destroyed.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the I/O handle being destroyed.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+IopNotifyEventQueues (
+    PIO_OBJECT_STATE IoState,
+    ULONG Events
+    );
+
+/*++
+
+Routine Description:
+
+    This routine queues the registrations interested in the given events onto
+    their event queues, and fires any armed waits interested in them.
+
+Arguments:
+
+    IoState - Supplies a pointer to the I/O object state whose events were
+        just set.
+
+    Events - Supplies the mask of poll events that were set.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+IopArmIoStateWait (
+    PIO_STATE_WAIT Wait
+    );
+
+/*++
+
+Routine Description:
+
+    This routine arms a one-shot wait on an I/O object state. The wait's
+    routine is called once, from the thread that sets one of the events.
+
+Arguments:
+
+    Wait - Supplies a pointer to the initialized wait. It must not already be
+        armed.
+
+Return Value:
+
+    STATUS_SUCCESS if the wait was armed.
+
+    STATUS_TOO_LATE if one of the events is already set. The wait is not
+    armed and the caller should retry its operation.
+
+    STATUS_INSUFFICIENT_RESOURCES if the I/O object state's lock could not be
+    created.
+
+--*/
+
+BOOL
+IopDisarmIoStateWait (
+    PIO_STATE_WAIT Wait
+    );
+
+/*++
+
+Routine Description:
+
+    This routine disarms a wait on an I/O object state.
+
+Arguments:
+
+    Wait - Supplies a pointer to the wait.
+
+Return Value:
+
+    TRUE if the wait was disarmed before it fired. Its routine will not be
+    called.
+
+    FALSE if the wait was not armed or has already fired. In that case its
+    routine has finished running by the time this returns.
+
+--*/
+
+KSTATUS
+IopCreateIoRing (
+    FILE_PERMISSIONS Permissions,
+    PFILE_OBJECT *FileObject
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a new I/O ring. The ring has no memory attached until
+    the creating system call supplies it.
+
+Arguments:
+
+    Permissions - Supplies the permissions to give to the file object.
+
+    FileObject - Supplies a pointer where a pointer to a newly created I/O
+        ring file object will be returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+IopCloseIoRing (
+    PIO_HANDLE IoHandle
+    );
+
+/*++
+
+Routine Description:
+
+    This routine is called when an I/O ring handle is closed. Operations that
+    are blocked waiting for data give up, and no new handles are created for
+    accept operations still in flight.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the I/O handle being closed.
+
+Return Value:
+
+    Status code.
+
+--*/
+
 KSTATUS
 IopInitializeTerminalSupport (
     VOID
@@ -4071,6 +4436,32 @@ Return Value:
 
 --*/
 
+VOID
+IopPathLink (
+    PPATH_ENTRY Parent,
+    PPATH_ENTRY Entry
+    );
+
+/*++
+
+Routine Description:
+
+    This routine links the given path entry into its parent directory's list
+    of children, and into the parent's child hash table if there is one. The
+    caller must hold the parent path entry's file object lock exclusively.
+
+Arguments:
+
+    Parent - Supplies a pointer to the parent path entry.
+
+    Entry - Supplies a pointer to the path entry to link in.
+
+Return Value:
+
+    None.
+
+--*/
+
 VOID
 IopPathUnlink (
     PPATH_ENTRY Entry
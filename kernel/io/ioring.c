@@ -0,0 +1,1856 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ioring.c
+
+Abstract:
+
+    This module implements I/O rings, which let a caller queue batches of I/O
+    requests in memory shared with the kernel and collect their results from
+    the same memory, without a system call per request.
+
+Author:
+
+    Minoca Corp. 16-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define IO_RING_ALLOCATION_TAG 0x52726F49 // 'RorI'
+
+//
+// Define how long a ring operation on a handle that cannot be polled blocks in
+// one go before checking whether the ring has been closed out from under it.
+//
+
+#define IO_RING_WAIT_INTERVAL 1000
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines an I/O ring.
+
+Members:
+
+    Header - Stores the standard object header.
+
+    SubmitLock - Stores a pointer to the lock serializing consumers of the
+        submission array.
+
+    Lock - Stores a pointer to the lock protecting the completion array, the
+        in-flight count, and the closing flag.
+
+    IoState - Stores a pointer to the ring's own I/O object state. The in
+        event is set when a new completion is posted.
+
+    UserBuffer - Stores a pointer to the I/O buffer describing the caller's
+        ring memory.
+
+    LockedBuffer - Stores a pointer to the locked down copy of the user buffer
+        through which the kernel accesses the ring.
+
+    Shared - Stores the kernel mapping of the shared ring header. This is NULL
+        until ring memory has been attached.
+
+    Submissions - Stores the kernel mapping of the submission array.
+
+    Completions - Stores the kernel mapping of the completion array.
+
+    SubmissionCount - Stores the number of entries in the submission array.
+
+    CompletionCount - Stores the number of entries in the completion array.
+
+    SubmissionHead - Stores the kernel's private copy of the submission head.
+        The shared copy is only ever written from this value.
+
+    CompletionTail - Stores the kernel's private copy of the completion tail.
+
+    InFlight - Stores the number of submissions consumed that have not yet
+        posted a completion. Each one owns a completion slot.
+
+    ParkedList - Stores the list of requests waiting for their handles to
+        become ready, without a worker thread.
+
+    Closing - Stores a boolean indicating that the ring's handle has been
+        closed and outstanding operations should stop waiting.
+
+--*/
+
+typedef struct _IO_RING {
+    OBJECT_HEADER Header;
+    PQUEUED_LOCK SubmitLock;
+    PQUEUED_LOCK Lock;
+    PIO_OBJECT_STATE IoState;
+    PIO_BUFFER UserBuffer;
+    PIO_BUFFER LockedBuffer;
+    PIO_RING_HEADER Shared;
+    PIO_RING_SUBMISSION Submissions;
+    PIO_RING_COMPLETION Completions;
+    ULONG SubmissionCount;
+    ULONG CompletionCount;
+    ULONG SubmissionHead;
+    ULONG CompletionTail;
+    ULONG InFlight;
+    LIST_ENTRY ParkedList;
+    BOOL Closing;
+} IO_RING, *PIO_RING;
+
+/*++
+
+Structure Description:
+
+    This structure defines one operation consumed from an I/O ring and handed
+    to a worker thread.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous requests on the
+        ring's parked list. The next pointer is NULL while the request is not
+        parked. This is protected by the ring lock.
+
+    WorkItem - Stores a pointer to the work item that runs the request. It is
+        queued again each time a parked request's handle becomes ready.
+
+    Wait - Stores the wait armed on the handle's I/O object state while the
+        request is parked.
+
+    FileObject - Stores a pointer to the ring's file object. A reference is
+        held, which keeps the ring and its I/O object state alive.
+
+    Ring - Stores a pointer to the ring.
+
+    Process - Stores a pointer to the process that submitted the operation.
+        A reference is held.
+
+    IoHandle - Stores a pointer to the I/O handle to operate on. A reference
+        is held.
+
+    UserBuffer - Stores an optional pointer to the I/O buffer describing the
+        caller's data buffer.
+
+    IoBuffer - Stores an optional pointer to the locked down copy of the data
+        buffer, usable from any thread.
+
+    Submission - Stores a private copy of the submission entry.
+
+--*/
+
+typedef struct _IO_RING_REQUEST {
+    LIST_ENTRY ListEntry;
+    PWORK_ITEM WorkItem;
+    IO_STATE_WAIT Wait;
+    PFILE_OBJECT FileObject;
+    PIO_RING Ring;
+    PKPROCESS Process;
+    PIO_HANDLE IoHandle;
+    PIO_BUFFER UserBuffer;
+    PIO_BUFFER IoBuffer;
+    IO_RING_SUBMISSION Submission;
+} IO_RING_REQUEST, *PIO_RING_REQUEST;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+VOID
+IopDestroyIoRing (
+    PVOID IoRingObject
+    );
+
+KSTATUS
+IopGetIoRingFromHandle (
+    PIO_HANDLE IoHandle,
+    PIO_RING *Ring
+    );
+
+KSTATUS
+IopAttachIoRingMemory (
+    PIO_RING Ring,
+    PVOID Buffer,
+    UINTN BufferSize,
+    ULONG SubmissionCount,
+    ULONG CompletionCount
+    );
+
+KSTATUS
+IopSubmitIoRing (
+    PIO_HANDLE RingHandle,
+    PIO_RING Ring,
+    ULONG SubmitCount,
+    PULONG Submitted
+    );
+
+KSTATUS
+IopWaitForIoRing (
+    PIO_RING Ring,
+    ULONG WaitCount,
+    ULONG TimeoutInMilliseconds
+    );
+
+KSTATUS
+IopCreateIoRingRequest (
+    PIO_HANDLE RingHandle,
+    PIO_RING_SUBMISSION Submission,
+    PIO_RING_REQUEST *NewRequest
+    );
+
+VOID
+IopDestroyIoRingRequest (
+    PIO_RING_REQUEST Request
+    );
+
+VOID
+IopIoRingWorker (
+    PVOID Parameter
+    );
+
+KSTATUS
+IopPerformIoRingRequest (
+    PIO_RING_REQUEST Request,
+    PHANDLE NewHandle,
+    PUINTN BytesCompleted
+    );
+
+KSTATUS
+IopParkIoRingRequest (
+    PIO_RING_REQUEST Request
+    );
+
+VOID
+IopWakeIoRingRequest (
+    PIO_STATE_WAIT Wait,
+    ULONG Events
+    );
+
+KSTATUS
+IopPinIoRingBuffer (
+    PVOID Buffer,
+    UINTN Size,
+    PIO_BUFFER *UserBuffer,
+    PIO_BUFFER *LockedBuffer
+    );
+
+VOID
+IopPostIoRingCompletion (
+    PIO_RING Ring,
+    ULONGLONG UserData,
+    KSTATUS Status,
+    HANDLE NewHandle,
+    UINTN BytesCompleted
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+PWORK_QUEUE IoRingWorkQueue;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INTN
+IoSysCreateIoRing (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates an I/O ring on behalf of a user mode application.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+{
+
+    PKPROCESS CurrentProcess;
+    ULONG HandleFlags;
+    PIO_HANDLE IoHandle;
+    PSYSTEM_CALL_CREATE_IO_RING Parameters;
+    PIO_RING Ring;
+    KSTATUS Status;
+
+    CurrentProcess = PsGetCurrentProcess();
+
+    ASSERT(CurrentProcess != PsGetKernelProcess());
+
+    IoHandle = NULL;
+    Parameters = (PSYSTEM_CALL_CREATE_IO_RING)SystemCallParameter;
+    Parameters->Handle = INVALID_HANDLE;
+    if ((Parameters->OpenFlags & ~SYS_OPEN_FLAG_CLOSE_ON_EXECUTE) != 0) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto SysCreateIoRingEnd;
+    }
+
+    Status = IopOpen(FALSE,
+                     NULL,
+                     NULL,
+                     0,
+                     IO_ACCESS_READ | IO_ACCESS_WRITE,
+                     OPEN_FLAG_CREATE,
+                     IoObjectIoRing,
+                     NULL,
+                     FILE_PERMISSION_USER_READ | FILE_PERMISSION_USER_WRITE,
+                     &IoHandle);
+
+    if (!KSUCCESS(Status)) {
+        goto SysCreateIoRingEnd;
+    }
+
+    Ring = IoHandle->FileObject->SpecialIo;
+    Status = IopAttachIoRingMemory(Ring,
+                                   Parameters->Ring,
+                                   Parameters->RingSize,
+                                   Parameters->SubmissionCount,
+                                   Parameters->CompletionCount);
+
+    if (!KSUCCESS(Status)) {
+        goto SysCreateIoRingEnd;
+    }
+
+    HandleFlags = 0;
+    if ((Parameters->OpenFlags & SYS_OPEN_FLAG_CLOSE_ON_EXECUTE) != 0) {
+        HandleFlags |= FILE_DESCRIPTOR_CLOSE_ON_EXECUTE;
+    }
+
+    Status = ObCreateHandle(CurrentProcess->HandleTable,
+                            IoHandle,
+                            HandleFlags,
+                            &(Parameters->Handle));
+
+    if (!KSUCCESS(Status)) {
+        goto SysCreateIoRingEnd;
+    }
+
+SysCreateIoRingEnd:
+    if (!KSUCCESS(Status)) {
+        if (IoHandle != NULL) {
+            IoClose(IoHandle);
+        }
+    }
+
+    return Status;
+}
+
+INTN
+IoSysIoRingEnter (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine consumes new submissions from an I/O ring and optionally
+    waits for completions to arrive.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    The number of submissions consumed (a non-negative integer) on success.
+
+    Error status code (a negative integer) on failure.
+
+--*/
+
+{
+
+    PSYSTEM_CALL_IO_RING_ENTER Parameters;
+    PKPROCESS Process;
+    INTN Result;
+    PIO_RING Ring;
+    PIO_HANDLE RingHandle;
+    KSTATUS Status;
+    ULONG Submitted;
+
+    Parameters = (PSYSTEM_CALL_IO_RING_ENTER)SystemCallParameter;
+    Process = PsGetCurrentProcess();
+    Submitted = 0;
+    RingHandle = ObGetHandleValue(Process->HandleTable, Parameters->Ring, NULL);
+    if (RingHandle == NULL) {
+        Status = STATUS_INVALID_HANDLE;
+        goto SysIoRingEnterEnd;
+    }
+
+    Status = IopGetIoRingFromHandle(RingHandle, &Ring);
+    if (!KSUCCESS(Status)) {
+        goto SysIoRingEnterEnd;
+    }
+
+    if (Parameters->SubmitCount != 0) {
+        Status = IopSubmitIoRing(RingHandle,
+                                 Ring,
+                                 Parameters->SubmitCount,
+                                 &Submitted);
+
+        if (!KSUCCESS(Status)) {
+            goto SysIoRingEnterEnd;
+        }
+    }
+
+    if (Parameters->WaitCount != 0) {
+        Status = IopWaitForIoRing(Ring,
+                                  Parameters->WaitCount,
+                                  Parameters->TimeoutInMilliseconds);
+
+        //
+        // Once submissions have been consumed the caller has to hear about
+        // them, so an interrupted wait is not reported.
+        //
+
+        if (!KSUCCESS(Status) && (Submitted != 0)) {
+            Status = STATUS_SUCCESS;
+        }
+
+        if (!KSUCCESS(Status)) {
+            goto SysIoRingEnterEnd;
+        }
+    }
+
+SysIoRingEnterEnd:
+    if (RingHandle != NULL) {
+        IoIoHandleReleaseReference(RingHandle);
+    }
+
+    Result = Status;
+    if (KSUCCESS(Status)) {
+        Result = Submitted;
+    }
+
+    return Result;
+}
+
+KSTATUS
+IopCreateIoRing (
+    FILE_PERMISSIONS Permissions,
+    PFILE_OBJECT *FileObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new I/O ring. The ring has no memory attached until
+    the creating system call supplies it.
+
+Arguments:
+
+    Permissions - Supplies the permissions to give to the file object.
+
+    FileObject - Supplies a pointer where a pointer to a newly created I/O
+        ring file object will be returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    BOOL Created;
+    FILE_PROPERTIES FileProperties;
+    PFILE_OBJECT NewFileObject;
+    PIO_RING NewRing;
+    KSTATUS Status;
+    PKTHREAD Thread;
+
+    ASSERT(*FileObject == NULL);
+
+    NewFileObject = NULL;
+
+    //
+    // Create the actual object. This reference is transferred to the file
+    // object's special I/O member on success.
+    //
+
+    NewRing = ObCreateObject(ObjectIoRing,
+                             NULL,
+                             NULL,
+                             0,
+                             sizeof(IO_RING),
+                             IopDestroyIoRing,
+                             0,
+                             IO_RING_ALLOCATION_TAG);
+
+    if (NewRing == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateIoRingEnd;
+    }
+
+    INITIALIZE_LIST_HEAD(&(NewRing->ParkedList));
+    NewRing->SubmitLock = KeCreateQueuedLock();
+    NewRing->Lock = KeCreateQueuedLock();
+    if ((NewRing->SubmitLock == NULL) || (NewRing->Lock == NULL)) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateIoRingEnd;
+    }
+
+    Thread = KeGetCurrentThread();
+    IopFillOutFilePropertiesForObject(&FileProperties, &(NewRing->Header));
+    FileProperties.Permissions = Permissions;
+    FileProperties.Type = IoObjectIoRing;
+    FileProperties.UserId = Thread->Identity.EffectiveUserId;
+    FileProperties.GroupId = Thread->Identity.EffectiveGroupId;
+    Status = IopCreateOrLookupFileObject(&FileProperties,
+                                         ObGetRootObject(),
+                                         0,
+                                         &NewFileObject,
+                                         &Created);
+
+    if (!KSUCCESS(Status)) {
+
+        //
+        // Release the references added by filling out the file properties.
+        //
+
+        ObReleaseReference(NewRing);
+        goto CreateIoRingEnd;
+    }
+
+    ASSERT(Created != FALSE);
+    ASSERT(NewFileObject->IoState != NULL);
+
+    *FileObject = NewFileObject;
+    NewRing->IoState = NewFileObject->IoState;
+
+    ASSERT(((*FileObject)->SpecialIo == NULL) &&
+           ((KeGetEventState((*FileObject)->ReadyEvent) == NotSignaled) ||
+            (KeGetEventState((*FileObject)->ReadyEvent) ==
+             NotSignaledWithWaiters)));
+
+    (*FileObject)->SpecialIo = NewRing;
+    NewRing = NULL;
+    Status = STATUS_SUCCESS;
+
+CreateIoRingEnd:
+
+    //
+    // On both success and failure, the file object's ready event needs to be
+    // signaled. Other threads may be waiting on the event.
+    //
+
+    if (*FileObject != NULL) {
+        KeSignalEvent((*FileObject)->ReadyEvent, SignalOptionSignalAll);
+    }
+
+    if (!KSUCCESS(Status)) {
+        if (NewFileObject != NULL) {
+            *FileObject = NULL;
+            IopFileObjectReleaseReference(NewFileObject);
+        }
+
+        if (NewRing != NULL) {
+            ObReleaseReference(NewRing);
+            NewRing = NULL;
+        }
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopCloseIoRing (
+    PIO_HANDLE IoHandle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when an I/O ring handle is closed. Parked operations
+    are cancelled, operations that are blocked waiting for data give up, and no
+    new handles are created for accept operations still in flight.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the I/O handle being closed.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    LIST_ENTRY CancelList;
+    PLIST_ENTRY CurrentEntry;
+    PIO_RING_REQUEST Request;
+    PIO_RING Ring;
+
+    ASSERT(IoHandle->FileObject->Properties.Type == IoObjectIoRing);
+
+    Ring = IoHandle->FileObject->SpecialIo;
+    if (Ring == NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // Pull every parked request whose wait can still be called off. A wait
+    // that already fired has queued its request, which takes itself off the
+    // list and sees the ring closing.
+    //
+
+    INITIALIZE_LIST_HEAD(&CancelList);
+    KeAcquireQueuedLock(Ring->Lock);
+    Ring->Closing = TRUE;
+    CurrentEntry = Ring->ParkedList.Next;
+    while (CurrentEntry != &(Ring->ParkedList)) {
+        Request = LIST_VALUE(CurrentEntry, IO_RING_REQUEST, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if (IopDisarmIoStateWait(&(Request->Wait)) != FALSE) {
+            LIST_REMOVE(&(Request->ListEntry));
+            INSERT_BEFORE(&(Request->ListEntry), &CancelList);
+        }
+    }
+
+    KeReleaseQueuedLock(Ring->Lock);
+    while (LIST_EMPTY(&CancelList) == FALSE) {
+        Request = LIST_VALUE(CancelList.Next, IO_RING_REQUEST, ListEntry);
+        LIST_REMOVE(&(Request->ListEntry));
+        Request->ListEntry.Next = NULL;
+        IopPostIoRingCompletion(Ring,
+                                Request->Submission.UserData,
+                                STATUS_OPERATION_CANCELLED,
+                                INVALID_HANDLE,
+                                0);
+
+        IopDestroyIoRingRequest(Request);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+IopDestroyIoRing (
+    PVOID IoRingObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys all resources associated with an I/O ring.
+
+Arguments:
+
+    IoRingObject - Supplies a pointer to the I/O ring being destroyed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING Ring;
+
+    Ring = (PIO_RING)IoRingObject;
+
+    ASSERT(Ring->InFlight == 0);
+
+    if ((Ring->LockedBuffer != NULL) &&
+        (Ring->LockedBuffer != Ring->UserBuffer)) {
+
+        MmFreeIoBuffer(Ring->LockedBuffer);
+    }
+
+    if (Ring->UserBuffer != NULL) {
+        MmFreeIoBuffer(Ring->UserBuffer);
+    }
+
+    if (Ring->SubmitLock != NULL) {
+        KeDestroyQueuedLock(Ring->SubmitLock);
+    }
+
+    if (Ring->Lock != NULL) {
+        KeDestroyQueuedLock(Ring->Lock);
+    }
+
+    return;
+}
+
+KSTATUS
+IopGetIoRingFromHandle (
+    PIO_HANDLE IoHandle,
+    PIO_RING *Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the I/O ring behind the given I/O handle.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the I/O handle.
+
+    Ring - Supplies a pointer where a pointer to the I/O ring will be returned
+        on success.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if the handle is not an I/O ring.
+
+--*/
+
+{
+
+    PFILE_OBJECT FileObject;
+
+    FileObject = IoHandle->FileObject;
+    if (FileObject->Properties.Type != IoObjectIoRing) {
+        *Ring = NULL;
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    *Ring = FileObject->SpecialIo;
+
+    ASSERT((*Ring != NULL) && ((*Ring)->Shared != NULL));
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+IopAttachIoRingMemory (
+    PIO_RING Ring,
+    PVOID Buffer,
+    UINTN BufferSize,
+    ULONG SubmissionCount,
+    ULONG CompletionCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine locks down the caller's ring memory, maps it into the kernel,
+    and initializes the shared header.
+
+Arguments:
+
+    Ring - Supplies a pointer to the newly created ring.
+
+    Buffer - Supplies the user mode address of the ring memory.
+
+    BufferSize - Supplies the size of the ring memory in bytes.
+
+    SubmissionCount - Supplies the number of submission entries.
+
+    CompletionCount - Supplies the number of completion entries.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PVOID Mapping;
+    UINTN RingSize;
+    KSTATUS Status;
+
+    ASSERT(Ring->Shared == NULL);
+
+    if ((SubmissionCount == 0) ||
+        (SubmissionCount > IO_RING_MAX_ENTRIES) ||
+        (!POWER_OF_2(SubmissionCount)) ||
+        (CompletionCount == 0) ||
+        (CompletionCount > IO_RING_MAX_ENTRIES) ||
+        (!POWER_OF_2(CompletionCount))) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    RingSize = IO_RING_SIZE(SubmissionCount, CompletionCount);
+    if ((BufferSize < RingSize) ||
+        (IS_POINTER_ALIGNED(Buffer, MmPageSize()) == FALSE)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Status = IopPinIoRingBuffer(Buffer,
+                                RingSize,
+                                &(Ring->UserBuffer),
+                                &(Ring->LockedBuffer));
+
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Status = MmMapIoBuffer(Ring->LockedBuffer, FALSE, FALSE, TRUE);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Mapping = Ring->LockedBuffer->Fragment[0].VirtualAddress;
+    Ring->Shared = Mapping;
+    Ring->Submissions = Mapping + IO_RING_SUBMISSION_OFFSET;
+    Ring->Completions = Mapping + IO_RING_COMPLETION_OFFSET(SubmissionCount);
+    Ring->SubmissionCount = SubmissionCount;
+    Ring->CompletionCount = CompletionCount;
+    Ring->Shared->SubmissionHead = 0;
+    Ring->Shared->SubmissionTail = 0;
+    Ring->Shared->CompletionHead = 0;
+    Ring->Shared->CompletionTail = 0;
+    Ring->Shared->SubmissionCount = SubmissionCount;
+    Ring->Shared->CompletionCount = CompletionCount;
+    RtlMemoryBarrier();
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+IopSubmitIoRing (
+    PIO_HANDLE RingHandle,
+    PIO_RING Ring,
+    ULONG SubmitCount,
+    PULONG Submitted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine consumes new entries from the ring's submission array and
+    hands them to the ring work queue. An entry is only consumed if a
+    completion slot can be reserved for it, so completions never overflow.
+
+Arguments:
+
+    RingHandle - Supplies a pointer to the I/O handle of the ring.
+
+    Ring - Supplies a pointer to the ring.
+
+    SubmitCount - Supplies the maximum number of entries to consume.
+
+    Submitted - Supplies a pointer where the number of entries consumed will
+        be returned. Entries that fail to start are consumed too; they post an
+        error completion.
+
+Return Value:
+
+    STATUS_SUCCESS if entries were consumed, or if there was nothing to consume
+    or no room for more completions.
+
+    STATUS_INVALID_PARAMETER if the shared submission tail is corrupt.
+
+--*/
+
+{
+
+    ULONG Available;
+    ULONG Count;
+    ULONG Index;
+    ULONG Pending;
+    PIO_RING_REQUEST Request;
+    KSTATUS Status;
+    IO_RING_SUBMISSION Submission;
+    ULONG Tail;
+
+    *Submitted = 0;
+    KeAcquireQueuedLock(Ring->SubmitLock);
+    Tail = Ring->Shared->SubmissionTail;
+    RtlMemoryBarrier();
+    Available = Tail - Ring->SubmissionHead;
+    if (Available > Ring->SubmissionCount) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto SubmitIoRingEnd;
+    }
+
+    Count = SubmitCount;
+    if (Count > Available) {
+        Count = Available;
+    }
+
+    Status = STATUS_SUCCESS;
+    while (*Submitted < Count) {
+
+        //
+        // Reserve a completion slot. The user owned completion head is only
+        // trusted as far as this comparison; a bogus value just makes the
+        // ring look full.
+        //
+
+        KeAcquireQueuedLock(Ring->Lock);
+        Pending = Ring->CompletionTail - Ring->Shared->CompletionHead;
+        if ((Pending > Ring->CompletionCount) ||
+            (Pending + Ring->InFlight >= Ring->CompletionCount)) {
+
+            KeReleaseQueuedLock(Ring->Lock);
+            break;
+        }
+
+        Ring->InFlight += 1;
+        KeReleaseQueuedLock(Ring->Lock);
+
+        //
+        // Copy the entry out before handing the slot back, as user mode is
+        // free to reuse it immediately afterwards.
+        //
+
+        Index = Ring->SubmissionHead & (Ring->SubmissionCount - 1);
+        RtlCopyMemory(&Submission,
+                      &(Ring->Submissions[Index]),
+                      sizeof(IO_RING_SUBMISSION));
+
+        RtlMemoryBarrier();
+        Ring->SubmissionHead += 1;
+        Ring->Shared->SubmissionHead = Ring->SubmissionHead;
+        *Submitted += 1;
+        Status = IopCreateIoRingRequest(RingHandle, &Submission, &Request);
+        if (KSUCCESS(Status)) {
+            Status = KeQueueWorkItem(Request->WorkItem);
+            if (!KSUCCESS(Status)) {
+                IopDestroyIoRingRequest(Request);
+            }
+        }
+
+        if (!KSUCCESS(Status)) {
+            IopPostIoRingCompletion(Ring,
+                                    Submission.UserData,
+                                    Status,
+                                    INVALID_HANDLE,
+                                    0);
+
+            Status = STATUS_SUCCESS;
+        }
+    }
+
+SubmitIoRingEnd:
+    KeReleaseQueuedLock(Ring->SubmitLock);
+    return Status;
+}
+
+KSTATUS
+IopWaitForIoRing (
+    PIO_RING Ring,
+    ULONG WaitCount,
+    ULONG TimeoutInMilliseconds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits until the given number of completions are waiting to
+    be consumed on the ring.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    WaitCount - Supplies the number of unconsumed completions to wait for.
+        This is capped at the size of the completion array.
+
+    TimeoutInMilliseconds - Supplies the number of milliseconds to wait.
+        Supply WAIT_TIME_INDEFINITE to wait forever.
+
+Return Value:
+
+    STATUS_SUCCESS if the completions arrived or the wait timed out.
+
+    STATUS_INTERRUPTED if a signal arrived during the wait.
+
+--*/
+
+{
+
+    ULONGLONG CurrentTime;
+    ULONGLONG EndTime;
+    ULONGLONG Frequency;
+    ULONG Ready;
+    KSTATUS Status;
+    ULONG WaitTime;
+
+    if (WaitCount > Ring->CompletionCount) {
+        WaitCount = Ring->CompletionCount;
+    }
+
+    EndTime = 0;
+    Frequency = 0;
+    if ((TimeoutInMilliseconds != 0) &&
+        (TimeoutInMilliseconds != WAIT_TIME_INDEFINITE)) {
+
+        Frequency = HlQueryTimeCounterFrequency();
+        EndTime = HlQueryTimeCounter() +
+                  KeConvertMicrosecondsToTimeTicks(
+                      TimeoutInMilliseconds * MICROSECONDS_PER_MILLISECOND);
+    }
+
+    WaitTime = TimeoutInMilliseconds;
+    while (TRUE) {
+
+        //
+        // Clear the in event before looking so that a completion posted after
+        // the check sets it again.
+        //
+
+        IoSetIoObjectState(Ring->IoState, POLL_EVENT_IN, FALSE);
+        Ready = Ring->CompletionTail - Ring->Shared->CompletionHead;
+        if ((Ready >= WaitCount) || (WaitTime == 0)) {
+            Status = STATUS_SUCCESS;
+            break;
+        }
+
+        Status = IoWaitForIoObjectState(Ring->IoState,
+                                        POLL_EVENT_IN,
+                                        TRUE,
+                                        WaitTime,
+                                        NULL);
+
+        if (Status == STATUS_TIMEOUT) {
+            Status = STATUS_SUCCESS;
+            break;
+        }
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        if (EndTime != 0) {
+            CurrentTime = HlQueryTimeCounter();
+            if (CurrentTime >= EndTime) {
+                WaitTime = 0;
+
+            } else {
+                WaitTime = ((EndTime - CurrentTime) *
+                            MILLISECONDS_PER_SECOND) / Frequency;
+
+                if (WaitTime == 0) {
+                    WaitTime = 1;
+                }
+            }
+        }
+    }
+
+    //
+    // Leave the in event set if there is anything left to consume, so that
+    // polling the ring handle stays accurate.
+    //
+
+    if (Ring->CompletionTail != Ring->Shared->CompletionHead) {
+        IoSetIoObjectState(Ring->IoState, POLL_EVENT_IN, TRUE);
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopCreateIoRingRequest (
+    PIO_HANDLE RingHandle,
+    PIO_RING_SUBMISSION Submission,
+    PIO_RING_REQUEST *NewRequest
+    )
+
+/*++
+
+Routine Description:
+
+    This routine validates a submission and captures everything a worker
+    thread needs to carry it out: the target handle, the submitting process,
+    and the data buffer locked in memory. This must be called in the context
+    of the submitting process.
+
+Arguments:
+
+    RingHandle - Supplies a pointer to the I/O handle of the ring.
+
+    Submission - Supplies a pointer to the private copy of the submission.
+
+    NewRequest - Supplies a pointer where a pointer to the new request will be
+        returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    BOOL NeedsBuffer;
+    PKPROCESS Process;
+    PIO_RING_REQUEST Request;
+    KSTATUS Status;
+
+    Process = PsGetCurrentProcess();
+    NeedsBuffer = FALSE;
+    switch (Submission->Operation) {
+    case IoRingOperationRead:
+    case IoRingOperationWrite:
+    case IoRingOperationSend:
+    case IoRingOperationReceive:
+        if (Submission->Size > MAX_INTN) {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        NeedsBuffer = TRUE;
+        break;
+
+    case IoRingOperationAccept:
+    case IoRingOperationFlush:
+        break;
+
+    default:
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    Request = MmAllocatePagedPool(sizeof(IO_RING_REQUEST),
+                                  IO_RING_ALLOCATION_TAG);
+
+    if (Request == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(Request, sizeof(IO_RING_REQUEST));
+    RtlCopyMemory(&(Request->Submission),
+                  Submission,
+                  sizeof(IO_RING_SUBMISSION));
+
+    Request->FileObject = RingHandle->FileObject;
+    IopFileObjectAddReference(Request->FileObject);
+    Request->Ring = Request->FileObject->SpecialIo;
+    Request->Process = Process;
+    ObAddReference(Process);
+    Request->IoHandle = ObGetHandleValue(Process->HandleTable,
+                                         Submission->Handle,
+                                         NULL);
+
+    if (Request->IoHandle == NULL) {
+        Status = STATUS_INVALID_HANDLE;
+        goto CreateIoRingRequestEnd;
+    }
+
+    Request->Wait.IoState = Request->IoHandle->FileObject->IoState;
+    Request->Wait.Routine = IopWakeIoRingRequest;
+    Request->Wait.Context = Request;
+    Request->WorkItem = KeCreateWorkItem(IoRingWorkQueue,
+                                         WorkPriorityNormal,
+                                         IopIoRingWorker,
+                                         Request,
+                                         IO_RING_ALLOCATION_TAG);
+
+    if (Request->WorkItem == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateIoRingRequestEnd;
+    }
+
+    if ((NeedsBuffer != FALSE) && (Submission->Size != 0)) {
+        Status = IopPinIoRingBuffer(Submission->Buffer,
+                                    Submission->Size,
+                                    &(Request->UserBuffer),
+                                    &(Request->IoBuffer));
+
+        if (!KSUCCESS(Status)) {
+            goto CreateIoRingRequestEnd;
+        }
+    }
+
+    Status = STATUS_SUCCESS;
+
+CreateIoRingRequestEnd:
+    if (!KSUCCESS(Status)) {
+        IopDestroyIoRingRequest(Request);
+        Request = NULL;
+    }
+
+    *NewRequest = Request;
+    return Status;
+}
+
+VOID
+IopDestroyIoRingRequest (
+    PIO_RING_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases all resources held by an I/O ring request.
+
+Arguments:
+
+    Request - Supplies a pointer to the request to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Request->ListEntry.Next == NULL);
+
+    if (Request->WorkItem != NULL) {
+        KeDestroyWorkItem(Request->WorkItem);
+    }
+
+    if ((Request->IoBuffer != NULL) &&
+        (Request->IoBuffer != Request->UserBuffer)) {
+
+        MmFreeIoBuffer(Request->IoBuffer);
+    }
+
+    if (Request->UserBuffer != NULL) {
+        MmFreeIoBuffer(Request->UserBuffer);
+    }
+
+    if (Request->IoHandle != NULL) {
+        IoIoHandleReleaseReference(Request->IoHandle);
+    }
+
+    ObReleaseReference(Request->Process);
+    IopFileObjectReleaseReference(Request->FileObject);
+    MmFreePagedPool(Request);
+    return;
+}
+
+VOID
+IopIoRingWorker (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine carries out one I/O ring request on a worker thread and posts
+    its completion. A request whose handle is not ready is parked instead, and
+    this routine runs again when the handle's state changes.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the I/O ring request.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BytesCompleted;
+    HANDLE NewHandle;
+    PIO_RING_REQUEST Request;
+    PIO_RING Ring;
+    KSTATUS Status;
+
+    Request = (PIO_RING_REQUEST)Parameter;
+    Ring = Request->Ring;
+
+    //
+    // A request woken from the parked list takes itself off of it.
+    //
+
+    if (Request->ListEntry.Next != NULL) {
+        KeAcquireQueuedLock(Ring->Lock);
+        LIST_REMOVE(&(Request->ListEntry));
+        Request->ListEntry.Next = NULL;
+        KeReleaseQueuedLock(Ring->Lock);
+    }
+
+    while (TRUE) {
+        BytesCompleted = 0;
+        NewHandle = INVALID_HANDLE;
+        Request->Wait.Events = 0;
+        Status = IopPerformIoRingRequest(Request, &NewHandle, &BytesCompleted);
+        if ((Status != STATUS_OPERATION_WOULD_BLOCK) ||
+            (Request->Wait.Events == 0)) {
+
+            break;
+        }
+
+        //
+        // Once parked, the request belongs to whoever wakes or cancels it.
+        // If the handle became ready in the meantime, just try again.
+        //
+
+        Status = IopParkIoRingRequest(Request);
+        if (Status == STATUS_MORE_PROCESSING_REQUIRED) {
+            return;
+        }
+
+        if (Status != STATUS_TOO_LATE) {
+            break;
+        }
+    }
+
+    IopPostIoRingCompletion(Request->Ring,
+                            Request->Submission.UserData,
+                            Status,
+                            NewHandle,
+                            BytesCompleted);
+
+    IopDestroyIoRingRequest(Request);
+    return;
+}
+
+KSTATUS
+IopPerformIoRingRequest (
+    PIO_RING_REQUEST Request,
+    PHANDLE NewHandle,
+    PUINTN BytesCompleted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the I/O described by an I/O ring request. Handles
+    that can be polled are only ever tried without blocking; if the operation
+    would block, the events to park on are set in the request's wait. Other
+    blocking operations wait in bounded intervals so that closing the ring
+    releases the worker.
+
+Arguments:
+
+    Request - Supplies a pointer to the request.
+
+    NewHandle - Supplies a pointer where the new handle for an accept
+        operation will be returned.
+
+    BytesCompleted - Supplies a pointer where the number of bytes transferred
+        will be returned.
+
+Return Value:
+
+    STATUS_OPERATION_WOULD_BLOCK with the wait events set if the request
+    should be parked.
+
+    Other status codes on completion.
+
+--*/
+
+{
+
+    NETWORK_ADDRESS Address;
+    ULONG HandleFlags;
+    PIO_HANDLE IoHandle;
+    PIO_OBJECT_STATE IoState;
+    PIO_HANDLE NewIoHandle;
+    BOOL Pollable;
+    PSTR RemotePath;
+    UINTN RemotePathSize;
+    PIO_RING Ring;
+    SOCKET_IO_PARAMETERS SocketParameters;
+    KSTATUS Status;
+    PIO_RING_SUBMISSION Submission;
+    ULONG Timeout;
+    ULONG WaitEvents;
+
+    IoHandle = Request->IoHandle;
+    IoState = IoHandle->FileObject->IoState;
+    Ring = Request->Ring;
+    Submission = &(Request->Submission);
+    *BytesCompleted = 0;
+
+    //
+    // Operations on pipes, sockets, and terminals can wait indefinitely for
+    // another party, possibly one whose own operation is behind this one in
+    // the ring. Never let those hold a worker thread.
+    //
+
+    Pollable = FALSE;
+    switch (IoHandle->FileObject->Properties.Type) {
+    case IoObjectPipe:
+    case IoObjectSocket:
+    case IoObjectTerminalMaster:
+    case IoObjectTerminalSlave:
+        Pollable = TRUE;
+        break;
+
+    default:
+        break;
+    }
+
+    Timeout = IO_RING_WAIT_INTERVAL;
+    if ((Pollable != FALSE) ||
+        ((IoHandle->OpenFlags & OPEN_FLAG_NON_BLOCKING) != 0)) {
+
+        Timeout = 0;
+    }
+
+    WaitEvents = 0;
+    switch (Submission->Operation) {
+    case IoRingOperationRead:
+    case IoRingOperationWrite:
+        if (Submission->Size == 0) {
+            Status = STATUS_SUCCESS;
+            break;
+        }
+
+        do {
+            if (Submission->Operation == IoRingOperationRead) {
+                WaitEvents = POLL_EVENT_IN;
+                Status = IoReadAtOffset(IoHandle,
+                                        Request->IoBuffer,
+                                        Submission->Offset,
+                                        Submission->Size,
+                                        0,
+                                        Timeout,
+                                        BytesCompleted,
+                                        NULL);
+
+            } else {
+                WaitEvents = POLL_EVENT_OUT;
+                Status = IoWriteAtOffset(IoHandle,
+                                         Request->IoBuffer,
+                                         Submission->Offset,
+                                         Submission->Size,
+                                         0,
+                                         Timeout,
+                                         BytesCompleted,
+                                         NULL);
+            }
+
+        } while ((Status == STATUS_TIMEOUT) && (Timeout != 0) &&
+                 (*BytesCompleted == 0) && (Ring->Closing == FALSE));
+
+        if (Status == STATUS_BROKEN_PIPE) {
+            PsSignalProcess(Request->Process, SIGNAL_BROKEN_PIPE, NULL);
+        }
+
+        if (!KSUCCESS(Status) && (*BytesCompleted != 0)) {
+            Status = STATUS_SUCCESS;
+        }
+
+        break;
+
+    case IoRingOperationSend:
+    case IoRingOperationReceive:
+        do {
+            RtlZeroMemory(&SocketParameters, sizeof(SOCKET_IO_PARAMETERS));
+            SocketParameters.Size = Submission->Size;
+            SocketParameters.SocketIoFlags = Submission->Flags &
+                                             ~SOCKET_IO_REFERENCE_BUFFER;
+
+            SocketParameters.TimeoutInMilliseconds = Timeout;
+            if (Submission->Operation == IoRingOperationSend) {
+                WaitEvents = POLL_EVENT_OUT;
+                Status = IoSocketSendData(TRUE,
+                                          IoHandle,
+                                          &SocketParameters,
+                                          Request->IoBuffer);
+
+            } else {
+                WaitEvents = POLL_EVENT_IN;
+                Status = IoSocketReceiveData(TRUE,
+                                             IoHandle,
+                                             &SocketParameters,
+                                             Request->IoBuffer);
+            }
+
+        } while ((Status == STATUS_TIMEOUT) && (Timeout != 0) &&
+                 (SocketParameters.BytesCompleted == 0) &&
+                 (Ring->Closing == FALSE));
+
+        *BytesCompleted = SocketParameters.BytesCompleted;
+        if (Status == STATUS_BROKEN_PIPE) {
+            PsSignalProcess(Request->Process, SIGNAL_BROKEN_PIPE, NULL);
+        }
+
+        if (!KSUCCESS(Status) && (*BytesCompleted != 0)) {
+            Status = STATUS_SUCCESS;
+        }
+
+        break;
+
+    case IoRingOperationAccept:
+
+        //
+        // The accept itself can only be bounded by the socket's own timeout,
+        // so only go for it once a connection has shown up.
+        //
+
+        WaitEvents = POLL_EVENT_IN;
+        if ((Pollable != FALSE) &&
+            ((IoHandle->OpenFlags & OPEN_FLAG_NON_BLOCKING) == 0) &&
+            ((IoState->Events & (POLL_EVENT_IN | POLL_ERROR_EVENTS)) == 0)) {
+
+            Status = STATUS_OPERATION_WOULD_BLOCK;
+            break;
+        }
+
+        NewIoHandle = NULL;
+        RemotePath = NULL;
+        RemotePathSize = 0;
+        Status = IoSocketAccept(IoHandle,
+                                &NewIoHandle,
+                                &Address,
+                                &RemotePath,
+                                &RemotePathSize);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        if ((Submission->Flags & SYS_OPEN_FLAG_NON_BLOCKING) != 0) {
+            NewIoHandle->OpenFlags |= OPEN_FLAG_NON_BLOCKING;
+        }
+
+        HandleFlags = 0;
+        if ((Submission->Flags & SYS_OPEN_FLAG_CLOSE_ON_EXECUTE) != 0) {
+            HandleFlags |= FILE_DESCRIPTOR_CLOSE_ON_EXECUTE;
+        }
+
+        //
+        // Holding the ring lock keeps the process from getting past closing
+        // its handles while the new one is being added.
+        //
+
+        KeAcquireQueuedLock(Ring->Lock);
+        if ((Ring->Closing != FALSE) ||
+            (Request->Process->HandleTable == NULL)) {
+
+            Status = STATUS_OPERATION_CANCELLED;
+
+        } else {
+            Status = ObCreateHandle(Request->Process->HandleTable,
+                                    NewIoHandle,
+                                    HandleFlags,
+                                    NewHandle);
+        }
+
+        KeReleaseQueuedLock(Ring->Lock);
+        if (!KSUCCESS(Status)) {
+            IoIoHandleReleaseReference(NewIoHandle);
+            *NewHandle = INVALID_HANDLE;
+        }
+
+        break;
+
+    case IoRingOperationFlush:
+        Status = IoFlush(IoHandle, 0, -1, 0);
+        break;
+
+    default:
+
+        ASSERT(FALSE);
+
+        Status = STATUS_NOT_SUPPORTED;
+        break;
+    }
+
+    //
+    // A pollable handle opened for blocking I/O that has nothing ready gets
+    // parked. Non-blocking handles report the condition back as is.
+    //
+
+    if ((Pollable != FALSE) &&
+        ((IoHandle->OpenFlags & OPEN_FLAG_NON_BLOCKING) == 0) &&
+        (*BytesCompleted == 0) &&
+        ((Status == STATUS_TIMEOUT) ||
+         (Status == STATUS_TRY_AGAIN) ||
+         (Status == STATUS_OPERATION_WOULD_BLOCK))) {
+
+        Request->Wait.Events = WaitEvents;
+        Status = STATUS_OPERATION_WOULD_BLOCK;
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopParkIoRingRequest (
+    PIO_RING_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine parks an I/O ring request until its handle's state changes,
+    freeing the worker thread it was running on.
+
+Arguments:
+
+    Request - Supplies a pointer to the request. Its wait events must be set.
+
+Return Value:
+
+    STATUS_MORE_PROCESSING_REQUIRED if the request was parked. The caller must
+    not touch the request again.
+
+    STATUS_TOO_LATE if the handle became ready in the meantime. The request
+    should be tried again.
+
+    STATUS_OPERATION_CANCELLED if the ring is closing.
+
+    Other error codes if the wait could not be armed.
+
+--*/
+
+{
+
+    PIO_RING Ring;
+    KSTATUS Status;
+
+    ASSERT(Request->Wait.Events != 0);
+    ASSERT(Request->ListEntry.Next == NULL);
+
+    //
+    // Arm the wait with the ring lock held so that closing the ring either
+    // finds the request armed and cancels it, or the request sees the ring
+    // closing here.
+    //
+
+    Ring = Request->Ring;
+    KeAcquireQueuedLock(Ring->Lock);
+    if (Ring->Closing != FALSE) {
+        Status = STATUS_OPERATION_CANCELLED;
+        goto ParkIoRingRequestEnd;
+    }
+
+    INSERT_BEFORE(&(Request->ListEntry), &(Ring->ParkedList));
+    Status = IopArmIoStateWait(&(Request->Wait));
+    if (!KSUCCESS(Status)) {
+        LIST_REMOVE(&(Request->ListEntry));
+        Request->ListEntry.Next = NULL;
+        goto ParkIoRingRequestEnd;
+    }
+
+    Status = STATUS_MORE_PROCESSING_REQUIRED;
+
+ParkIoRingRequestEnd:
+    KeReleaseQueuedLock(Ring->Lock);
+    return Status;
+}
+
+VOID
+IopWakeIoRingRequest (
+    PIO_STATE_WAIT Wait,
+    ULONG Events
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when the handle of a parked I/O ring request
+    changes state. It queues the request to run again.
+
+Arguments:
+
+    Wait - Supplies a pointer to the request's wait.
+
+    Events - Supplies the mask of poll events that were just set.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING_REQUEST Request;
+    KSTATUS Status;
+
+    Request = Wait->Context;
+
+    //
+    // The work item may still be finishing the run that parked the request,
+    // in which case the queue defers this until that run is done.
+    //
+
+    Status = KeQueueWorkItem(Request->WorkItem);
+
+    ASSERT(KSUCCESS(Status));
+
+    return;
+}
+
+KSTATUS
+IopPinIoRingBuffer (
+    PVOID Buffer,
+    UINTN Size,
+    PIO_BUFFER *UserBuffer,
+    PIO_BUFFER *LockedBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine locks a user mode buffer of the current process in memory,
+    producing an I/O buffer that can be used from any thread.
+
+Arguments:
+
+    Buffer - Supplies the user mode address of the buffer.
+
+    Size - Supplies the size of the buffer in bytes.
+
+    UserBuffer - Supplies a pointer where the I/O buffer describing the user
+        mode address will be returned. The caller must free this.
+
+    LockedBuffer - Supplies a pointer where the locked I/O buffer will be
+        returned. If this differs from the user buffer, the caller must free
+        it before the user buffer.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    BOOL LockedCopy;
+    PIO_BUFFER NewBuffer;
+    PIO_BUFFER OriginalBuffer;
+    KSTATUS Status;
+
+    *UserBuffer = NULL;
+    *LockedBuffer = NULL;
+    Status = MmCreateIoBuffer(Buffer, Size, 0, &OriginalBuffer);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    NewBuffer = OriginalBuffer;
+    Status = MmValidateIoBuffer(0,
+                                MAX_ULONGLONG,
+                                0,
+                                Size,
+                                FALSE,
+                                &NewBuffer,
+                                &LockedCopy);
+
+    if (!KSUCCESS(Status)) {
+        MmFreeIoBuffer(OriginalBuffer);
+        return Status;
+    }
+
+    //
+    // With no physical constraints, the buffer can only come back as itself
+    // or as a locked copy of the same pages.
+    //
+
+    ASSERT((NewBuffer == OriginalBuffer) || (LockedCopy != FALSE));
+
+    *UserBuffer = OriginalBuffer;
+    *LockedBuffer = NewBuffer;
+    return STATUS_SUCCESS;
+}
+
+VOID
+IopPostIoRingCompletion (
+    PIO_RING Ring,
+    ULONGLONG UserData,
+    KSTATUS Status,
+    HANDLE NewHandle,
+    UINTN BytesCompleted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes a completion into the ring, releasing the completion
+    slot reserved when its submission was consumed.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    UserData - Supplies the caller-defined data from the submission.
+
+    Status - Supplies the status of the operation.
+
+    NewHandle - Supplies the new handle for accept operations.
+
+    BytesCompleted - Supplies the number of bytes transferred.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING_COMPLETION Completion;
+    ULONG Index;
+
+    KeAcquireQueuedLock(Ring->Lock);
+
+    ASSERT(Ring->InFlight != 0);
+
+    Index = Ring->CompletionTail & (Ring->CompletionCount - 1);
+    Completion = &(Ring->Completions[Index]);
+    Completion->UserData = UserData;
+    Completion->Status = Status;
+    Completion->NewHandle = NewHandle;
+    Completion->BytesCompleted = BytesCompleted;
+
+    //
+    // Make sure the entry is visible before the tail that publishes it.
+    //
+
+    RtlMemoryBarrier();
+    Ring->CompletionTail += 1;
+    Ring->Shared->CompletionTail = Ring->CompletionTail;
+    Ring->InFlight -= 1;
+    KeReleaseQueuedLock(Ring->Lock);
+    IoSetIoObjectState(Ring->IoState, POLL_EVENT_IN, TRUE);
+    return;
+}
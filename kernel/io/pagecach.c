@@ -600,6 +600,51 @@ Return Value:
     return STATUS_SUCCESS;
 }
 
+PPAGE_CACHE_ENTRY
+IoLookupPageCacheEntry (
+    PIO_HANDLE Handle,
+    IO_OFFSET Offset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks for a page cache entry that already holds the data at
+    the given offset of the object behind the handle. It never performs I/O.
+
+Arguments:
+
+    Handle - Supplies a pointer to the I/O handle of a cacheable object.
+
+    Offset - Supplies the page-aligned offset into the object.
+
+Return Value:
+
+    Returns a pointer to the page cache entry with a reference taken on
+    behalf of the caller, who must release it with
+    IoPageCacheEntryReleaseReference.
+
+    NULL if the object is not cacheable or the page is not in the cache.
+
+--*/
+
+{
+
+    PPAGE_CACHE_ENTRY Entry;
+    PFILE_OBJECT FileObject;
+
+    FileObject = Handle->FileObject;
+    if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) == FALSE) {
+        return NULL;
+    }
+
+    KeAcquireSharedExclusiveLockShared(FileObject->Lock);
+    Entry = IopLookupPageCacheEntry(FileObject, Offset);
+    KeReleaseSharedExclusiveLockShared(FileObject->Lock);
+    return Entry;
+}
+
 VOID
 IoPageCacheEntryAddReference (
     PPAGE_CACHE_ENTRY Entry
@@ -58,6 +58,34 @@ Module Name:
 
 #define PATH_UNREACHABLE_PATH_PREFIX "(unreachable)/"
 
+//
+// Define the number of children a directory path entry must have before a
+// hash table is created to look them up.
+//
+
+#define PATH_ENTRY_TABLE_THRESHOLD 16
+
+//
+// Define the initial number of buckets in a path entry hash table. This must
+// be a power of two.
+//
+
+#define PATH_ENTRY_TABLE_INITIAL_BUCKETS 32
+
+//
+// Define the average number of entries per bucket that triggers growing a
+// path entry hash table.
+//
+
+#define PATH_ENTRY_TABLE_LOAD_FACTOR 2
+
+//
+// Define the number of old buckets migrated into the new array each time an
+// entry is inserted into a path entry hash table that is being resized.
+//
+
+#define PATH_ENTRY_TABLE_MIGRATE_COUNT 4
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -121,6 +149,40 @@ IopFindPathPoint (
     PPATH_POINT Result
     );
 
+PPATH_ENTRY
+IopFindChildPathEntry (
+    PPATH_ENTRY Directory,
+    PCSTR Name,
+    ULONG NameSize,
+    ULONG Hash
+    );
+
+VOID
+IopCreatePathEntryTable (
+    PPATH_ENTRY Directory
+    );
+
+VOID
+IopDestroyPathEntryTable (
+    PPATH_ENTRY_TABLE Table
+    );
+
+VOID
+IopPathEntryTableInsert (
+    PPATH_ENTRY_TABLE Table,
+    PPATH_ENTRY Entry
+    );
+
+VOID
+IopPathEntryTableMigrate (
+    PPATH_ENTRY_TABLE Table
+    );
+
+VOID
+IopPathEntryTableGrow (
+    PPATH_ENTRY_TABLE Table
+    );
+
 VOID
 IopPathEntryReleaseReference (
     PPATH_ENTRY Entry,
@@ -1040,6 +1102,74 @@ Return Value:
     return FALSE;
 }
 
+VOID
+IopPathLink (
+    PPATH_ENTRY Parent,
+    PPATH_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine links the given path entry into its parent directory's list
+    of children, and into the parent's child hash table if there is one. The
+    caller must hold the parent path entry's file object lock exclusively.
+
+Arguments:
+
+    Parent - Supplies a pointer to the parent path entry.
+
+    Entry - Supplies a pointer to the path entry to link in.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PPATH_ENTRY_TABLE Table;
+
+    ASSERT(Entry->Parent == Parent);
+    ASSERT(Entry->SiblingListEntry.Next == NULL);
+    ASSERT(Entry->HashListEntry.Next == NULL);
+    ASSERT((Parent->FileObject == NULL) ||
+           (KeIsSharedExclusiveLockHeldExclusive(Parent->FileObject->Lock)));
+
+    INSERT_BEFORE(&(Entry->SiblingListEntry), &(Parent->ChildList));
+    Parent->ChildCount += 1;
+    Table = Parent->ChildTable;
+    if (Table == NULL) {
+        if (Parent->ChildCount >= PATH_ENTRY_TABLE_THRESHOLD) {
+            IopCreatePathEntryTable(Parent);
+        }
+
+        return;
+    }
+
+    if (Entry->Name != NULL) {
+        IopPathEntryTableInsert(Table, Entry);
+    }
+
+    //
+    // Move some of the old buckets over if the table is being resized, or
+    // start a resize if the table has become too crowded.
+    //
+
+    if (Table->OldBuckets != NULL) {
+        IopPathEntryTableMigrate(Table);
+
+    } else if (Table->EntryCount >
+               (Table->BucketCount * PATH_ENTRY_TABLE_LOAD_FACTOR)) {
+
+        IopPathEntryTableGrow(Table);
+    }
+
+    return;
+}
+
 VOID
 IopPathUnlink (
     PPATH_ENTRY Entry
@@ -1077,6 +1207,19 @@ Return Value:
     if (Entry->SiblingListEntry.Next != NULL) {
         LIST_REMOVE(&(Entry->SiblingListEntry));
         Entry->SiblingListEntry.Next = NULL;
+
+        ASSERT(Entry->Parent->ChildCount != 0);
+
+        Entry->Parent->ChildCount -= 1;
+    }
+
+    if (Entry->HashListEntry.Next != NULL) {
+        LIST_REMOVE(&(Entry->HashListEntry));
+        Entry->HashListEntry.Next = NULL;
+
+        ASSERT(Entry->Parent->ChildTable->EntryCount != 0);
+
+        Entry->Parent->ChildTable->EntryCount -= 1;
     }
 
     return;
@@ -2955,10 +3098,7 @@ Return Value:
         Result->PathEntry->FileObject = FileObject;
         IopFileObjectAddPathEntryReference(Result->PathEntry->FileObject);
         if ((OpenFlags & OPEN_FLAG_UNLINK_ON_CREATE) != 0) {
-            if (Result->PathEntry->SiblingListEntry.Next != NULL) {
-                LIST_REMOVE(&(Result->PathEntry->SiblingListEntry));
-                Result->PathEntry->SiblingListEntry.Next = NULL;
-            }
+            IopPathUnlink(Result->PathEntry);
         }
 
     //
@@ -2993,8 +3133,7 @@ Return Value:
             ASSERT((FileObject == NULL) ||
                    (FileObject->Properties.HardLinkCount != 0));
 
-            INSERT_BEFORE(&(PathEntry->SiblingListEntry),
-                          &(DirectoryEntry->ChildList));
+            IopPathLink(DirectoryEntry, PathEntry);
         }
 
         Result->PathEntry = PathEntry;
@@ -3240,7 +3379,6 @@ Return Value:
 
 {
 
-    PLIST_ENTRY CurrentEntry;
     PPATH_ENTRY Entry;
     PMOUNT_POINT FoundMountPoint;
     PPATH_ENTRY FoundPathEntry;
@@ -3253,69 +3391,421 @@ Return Value:
     ASSERT(NameSize != 0);
     ASSERT(KeIsSharedExclusiveLockHeld(ParentFileObject->Lock) != FALSE);
 
+    Entry = IopFindChildPathEntry(Parent->PathEntry, Name, NameSize, Hash);
+    if (Entry == NULL) {
+        goto FindPathPointEnd;
+    }
+
     //
-    // Cruise through the cached list looking for this entry.
+    // If the found entry is a mount point, then the parent mount point's
+    // children are searched for a matching mount point. Note that this search
+    // may fail as the path entry is not necessarily a mount point under the
+    // current mount tree. It takes a reference on success. Skip this if the
+    // open flags dictate that the final mount point should not be followed.
     //
 
-    CurrentEntry = Parent->PathEntry->ChildList.Next;
-    while (CurrentEntry != &(Parent->PathEntry->ChildList)) {
-        Entry = LIST_VALUE(CurrentEntry, PATH_ENTRY, SiblingListEntry);
-        CurrentEntry = CurrentEntry->Next;
-
-        //
-        // Quickly skip entries without a name or with the wrong hash.
-        //
+    FoundMountPoint = NULL;
+    if ((Entry->MountCount != 0) &&
+        ((OpenFlags & OPEN_FLAG_NO_MOUNT_POINT) == 0)) {
 
-        if ((Entry->Hash != Hash) || (Entry->Name == NULL)) {
-            continue;
+        FoundMountPoint = IopFindMountPoint(Parent->MountPoint, Entry);
+        if (FoundMountPoint != NULL) {
+            FoundPathEntry = FoundMountPoint->TargetEntry;
         }
+    }
 
-        //
-        // If the names are not equal, this isn't the winner.
-        //
+    //
+    // Use the found entry and the same mount point as the parent if the entry
+    // was found to not be a mount point.
+    //
+
+    if (FoundMountPoint == NULL) {
+        FoundPathEntry = Entry;
+        FoundMountPoint = Parent->MountPoint;
+        IoMountPointAddReference(FoundMountPoint);
+    }
+
+    IoPathEntryAddReference(FoundPathEntry);
+    Result->PathEntry = FoundPathEntry;
+    Result->MountPoint = FoundMountPoint;
+    ResultValid = TRUE;
+
+FindPathPointEnd:
+    return ResultValid;
+}
+
+PPATH_ENTRY
+IopFindChildPathEntry (
+    PPATH_ENTRY Directory,
+    PCSTR Name,
+    ULONG NameSize,
+    ULONG Hash
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the child of the given directory path entry with the
+    given name. Negative entries are returned like any other. This routine
+    assumes the directory's file object lock is held.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory path entry whose children
+        should be searched.
+
+    Name - Supplies a pointer the query string, which may not be null
+        terminated.
+
+    NameSize - Supplies the size of the string including the assumed null
+        terminator that is never checked.
 
-        if (IopArePathsEqual(Entry->Name, Name, NameSize) == FALSE) {
-            continue;
+    Hash - Supplies the hash of the name query string.
+
+Return Value:
+
+    Returns a pointer to the matching child path entry on success. No
+    reference is taken.
+
+    NULL if no child with the given name is cached.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PPATH_ENTRY Entry;
+    PLIST_ENTRY ListHead;
+    ULONG Pass;
+    PPATH_ENTRY_TABLE Table;
+
+    //
+    // Without a hash table, cruise through the cached list looking for this
+    // entry.
+    //
+
+    Table = Directory->ChildTable;
+    if (Table == NULL) {
+        CurrentEntry = Directory->ChildList.Next;
+        while (CurrentEntry != &(Directory->ChildList)) {
+            Entry = LIST_VALUE(CurrentEntry, PATH_ENTRY, SiblingListEntry);
+            CurrentEntry = CurrentEntry->Next;
+
+            //
+            // Quickly skip entries without a name or with the wrong hash.
+            //
+
+            if ((Entry->Hash != Hash) || (Entry->Name == NULL)) {
+                continue;
+            }
+
+            if (IopArePathsEqual(Entry->Name, Name, NameSize) != FALSE) {
+                return Entry;
+            }
         }
 
-        //
-        // If the found entry is a mount point, then the parent mount point's
-        // children are searched for a matching mount point. Note that this
-        // search may fail as the path entry is not necessarily a mount point
-        // under the current mount tree. It takes a reference on success. Skip
-        // this if the open flags dictate that the final mount point should not
-        // be followed.
-        //
+        return NULL;
+    }
+
+    //
+    // Search the bucket in the current array, and then the bucket in the old
+    // array if the table is being resized and that bucket has not yet been
+    // migrated.
+    //
 
-        FoundMountPoint = NULL;
-        if ((Entry->MountCount != 0) &&
-            ((OpenFlags & OPEN_FLAG_NO_MOUNT_POINT) == 0)) {
+    for (Pass = 0; Pass < 2; Pass += 1) {
+        if (Pass == 0) {
+            ListHead = &(Table->Buckets[Hash & (Table->BucketCount - 1)]);
 
-            FoundMountPoint = IopFindMountPoint(Parent->MountPoint, Entry);
-            if (FoundMountPoint != NULL) {
-                FoundPathEntry = FoundMountPoint->TargetEntry;
+        } else {
+            if ((Table->OldBuckets == NULL) ||
+                ((Hash & (Table->OldBucketCount - 1)) < Table->MigrateIndex)) {
+
+                break;
             }
+
+            ListHead = &(Table->OldBuckets[Hash & (Table->OldBucketCount - 1)]);
         }
 
-        //
-        // Use the found entry and the same mount point as the parent if the
-        // entry was found to not be a mount point.
-        //
+        CurrentEntry = ListHead->Next;
+        while (CurrentEntry != ListHead) {
+            Entry = LIST_VALUE(CurrentEntry, PATH_ENTRY, HashListEntry);
+            CurrentEntry = CurrentEntry->Next;
+            if (Entry->Hash != Hash) {
+                continue;
+            }
+
+            if (IopArePathsEqual(Entry->Name, Name, NameSize) != FALSE) {
+                return Entry;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+VOID
+IopCreatePathEntryTable (
+    PPATH_ENTRY Directory
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a child hash table for the given directory path entry
+    and inserts all of its existing named children. Failure to allocate the
+    table is not fatal; lookups simply continue to use the child list. This
+    routine assumes the directory's file object lock is held exclusively.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory path entry.
+
+Return Value:
+
+    None.
+
+--*/
 
-        if (FoundMountPoint == NULL) {
-            FoundPathEntry = Entry;
-            FoundMountPoint = Parent->MountPoint;
-            IoMountPointAddReference(FoundMountPoint);
+{
+
+    ULONG AllocationSize;
+    ULONG BucketIndex;
+    PLIST_ENTRY CurrentEntry;
+    PPATH_ENTRY Entry;
+    PPATH_ENTRY_TABLE Table;
+
+    ASSERT(Directory->ChildTable == NULL);
+
+    AllocationSize = sizeof(PATH_ENTRY_TABLE) +
+                     (PATH_ENTRY_TABLE_INITIAL_BUCKETS * sizeof(LIST_ENTRY));
+
+    Table = MmAllocatePagedPool(AllocationSize, PATH_ALLOCATION_TAG);
+    if (Table == NULL) {
+        return;
+    }
+
+    RtlZeroMemory(Table, sizeof(PATH_ENTRY_TABLE));
+    Table->Buckets = (PLIST_ENTRY)(Table + 1);
+    Table->BucketCount = PATH_ENTRY_TABLE_INITIAL_BUCKETS;
+    for (BucketIndex = 0; BucketIndex < Table->BucketCount; BucketIndex += 1) {
+        INITIALIZE_LIST_HEAD(&(Table->Buckets[BucketIndex]));
+    }
+
+    CurrentEntry = Directory->ChildList.Next;
+    while (CurrentEntry != &(Directory->ChildList)) {
+        Entry = LIST_VALUE(CurrentEntry, PATH_ENTRY, SiblingListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if (Entry->Name != NULL) {
+            IopPathEntryTableInsert(Table, Entry);
         }
+    }
 
-        IoPathEntryAddReference(FoundPathEntry);
-        Result->PathEntry = FoundPathEntry;
-        Result->MountPoint = FoundMountPoint;
-        ResultValid = TRUE;
-        break;
+    Directory->ChildTable = Table;
+    return;
+}
+
+VOID
+IopDestroyPathEntryTable (
+    PPATH_ENTRY_TABLE Table
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys an empty path entry hash table.
+
+Arguments:
+
+    Table - Supplies a pointer to the table to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Table->EntryCount == 0);
+
+    //
+    // The initial bucket array is allocated with the table itself.
+    //
+
+    if ((Table->OldBuckets != NULL) &&
+        (Table->OldBuckets != (PLIST_ENTRY)(Table + 1))) {
+
+        MmFreePagedPool(Table->OldBuckets);
     }
 
-    return ResultValid;
+    if (Table->Buckets != (PLIST_ENTRY)(Table + 1)) {
+        MmFreePagedPool(Table->Buckets);
+    }
+
+    MmFreePagedPool(Table);
+    return;
+}
+
+VOID
+IopPathEntryTableInsert (
+    PPATH_ENTRY_TABLE Table,
+    PPATH_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine inserts a named path entry into the current bucket array of
+    the given hash table.
+
+Arguments:
+
+    Table - Supplies a pointer to the parent's child hash table.
+
+    Entry - Supplies a pointer to the path entry to insert.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY ListHead;
+
+    ASSERT(Entry->Name != NULL);
+    ASSERT(Entry->HashListEntry.Next == NULL);
+
+    ListHead = &(Table->Buckets[Entry->Hash & (Table->BucketCount - 1)]);
+    INSERT_BEFORE(&(Entry->HashListEntry), ListHead);
+    Table->EntryCount += 1;
+    return;
+}
+
+VOID
+IopPathEntryTableMigrate (
+    PPATH_ENTRY_TABLE Table
+    )
+
+/*++
+
+Routine Description:
+
+    This routine moves a handful of buckets from the old bucket array of a
+    resizing hash table into the current array. Once every old bucket has been
+    moved, the old array is freed.
+
+Arguments:
+
+    Table - Supplies a pointer to the table being resized.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PPATH_ENTRY Entry;
+    PLIST_ENTRY ListHead;
+    ULONG Migrated;
+    PLIST_ENTRY OldHead;
+
+    ASSERT(Table->OldBuckets != NULL);
+
+    Migrated = 0;
+    while ((Migrated < PATH_ENTRY_TABLE_MIGRATE_COUNT) &&
+           (Table->MigrateIndex < Table->OldBucketCount)) {
+
+        OldHead = &(Table->OldBuckets[Table->MigrateIndex]);
+        while (LIST_EMPTY(OldHead) == FALSE) {
+            Entry = LIST_VALUE(OldHead->Next, PATH_ENTRY, HashListEntry);
+            LIST_REMOVE(&(Entry->HashListEntry));
+            ListHead = &(Table->Buckets[Entry->Hash &
+                                        (Table->BucketCount - 1)]);
+
+            INSERT_BEFORE(&(Entry->HashListEntry), ListHead);
+        }
+
+        Table->MigrateIndex += 1;
+        Migrated += 1;
+    }
+
+    if (Table->MigrateIndex == Table->OldBucketCount) {
+        if (Table->OldBuckets != (PLIST_ENTRY)(Table + 1)) {
+            MmFreePagedPool(Table->OldBuckets);
+        }
+
+        Table->OldBuckets = NULL;
+        Table->OldBucketCount = 0;
+        Table->MigrateIndex = 0;
+    }
+
+    return;
+}
+
+VOID
+IopPathEntryTableGrow (
+    PPATH_ENTRY_TABLE Table
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts doubling the number of buckets in the given hash
+    table. The existing entries are migrated to the new array incrementally on
+    subsequent insertions. If the new array cannot be allocated, the table
+    simply stays at its current size.
+
+Arguments:
+
+    Table - Supplies a pointer to the table to grow.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG BucketCount;
+    ULONG BucketIndex;
+    PLIST_ENTRY Buckets;
+
+    ASSERT(Table->OldBuckets == NULL);
+
+    BucketCount = Table->BucketCount * 2;
+    if (BucketCount < Table->BucketCount) {
+        return;
+    }
+
+    Buckets = MmAllocatePagedPool(BucketCount * sizeof(LIST_ENTRY),
+                                  PATH_ALLOCATION_TAG);
+
+    if (Buckets == NULL) {
+        return;
+    }
+
+    for (BucketIndex = 0; BucketIndex < BucketCount; BucketIndex += 1) {
+        INITIALIZE_LIST_HEAD(&(Buckets[BucketIndex]));
+    }
+
+    Table->OldBuckets = Table->Buckets;
+    Table->OldBucketCount = Table->BucketCount;
+    Table->MigrateIndex = 0;
+    Table->Buckets = Buckets;
+    Table->BucketCount = BucketCount;
+    IopPathEntryTableMigrate(Table);
+    return;
 }
 
 VOID
@@ -3589,10 +4079,7 @@ Return Value:
         // entries.
         //
 
-        if (Entry->SiblingListEntry.Next != NULL) {
-            LIST_REMOVE(&(Entry->SiblingListEntry));
-            Entry->SiblingListEntry.Next = NULL;
-        }
+        IopPathUnlink(Entry);
 
         ASSERT(ParentFileObject != NULL);
 
@@ -3621,6 +4108,11 @@ Return Value:
         IopFileObjectReleaseReference(Entry->FileObject);
     }
 
+    if (Entry->ChildTable != NULL) {
+        IopDestroyPathEntryTable(Entry->ChildTable);
+        Entry->ChildTable = NULL;
+    }
+
     MmFreePagedPool(Entry);
     return Parent;
 }
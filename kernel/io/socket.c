@@ -1614,6 +1614,7 @@ Return Value:
     ParametersCopied = TRUE;
     IoParameters.BytesCompleted = 0;
     IoParameters.IoFlags &= SYS_IO_FLAG_MASK;
+    IoParameters.SocketIoFlags &= ~SOCKET_IO_REFERENCE_BUFFER;
     Status = MmInitializeIoBuffer(&IoBuffer,
                                   Parameters->Buffer,
                                   INVALID_PHYSICAL_ADDRESS,
@@ -1749,6 +1750,7 @@ Return Value:
     ParametersCopied = TRUE;
     IoParameters.BytesCompleted = 0;
     IoParameters.IoFlags &= SYS_IO_FLAG_MASK;
+    IoParameters.SocketIoFlags &= ~SOCKET_IO_REFERENCE_BUFFER;
     Status = MmCreateIoBufferFromVector(Parameters->VectorArray,
                                         FALSE,
                                         Parameters->VectorCount,
@@ -58,6 +58,12 @@ Module Name:
 
 #define CLOSE_EXECUTE_HANDLE_INITIAL_ARRAY_SIZE 16
 
+//
+// Define the maximum number of bytes sendfile reads from the source at once.
+//
+
+#define SEND_FILE_CHUNK_SIZE (64 * _1KB)
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -798,6 +804,257 @@ Return Value:
     return Result;
 }
 
+INTN
+IoSysSendFile (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine transfers data from a file to another handle without passing
+    it through user mode. When the destination is a socket, the page cache
+    pages holding the file data are handed to the protocol directly.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or the number of bytes completed (a positive integer) on
+    success.
+
+    Error status code (a negative integer) on failure.
+
+--*/
+
+{
+
+    UINTN BytesCompleted;
+    UINTN BytesRead;
+    UINTN BytesThisRound;
+    UINTN BytesWritten;
+    PKPROCESS CurrentProcess;
+    PIO_HANDLE Destination;
+    PIO_BUFFER IoBuffer;
+    IO_OFFSET Offset;
+    UINTN PageOffset;
+    ULONG PageSize;
+    PSYSTEM_CALL_SEND_FILE Parameters;
+    UINTN ReadSize;
+    INTN Result;
+    INTN Size;
+    SOCKET_IO_PARAMETERS SocketParameters;
+    PIO_HANDLE Source;
+    KSTATUS Status;
+    ULONG Timeout;
+    BOOL UseFilePointer;
+
+    CurrentProcess = PsGetCurrentProcess();
+    Parameters = (PSYSTEM_CALL_SEND_FILE)SystemCallParameter;
+    Size = Parameters->Size;
+    BytesCompleted = 0;
+    IoBuffer = NULL;
+    Offset = Parameters->Offset;
+    PageSize = MmPageSize();
+    UseFilePointer = FALSE;
+    Source = NULL;
+    Destination = ObGetHandleValue(CurrentProcess->HandleTable,
+                                   Parameters->Destination,
+                                   NULL);
+
+    if (Destination == NULL) {
+        Status = STATUS_INVALID_HANDLE;
+        goto SysSendFileEnd;
+    }
+
+    Source = ObGetHandleValue(CurrentProcess->HandleTable,
+                              Parameters->Source,
+                              NULL);
+
+    if (Source == NULL) {
+        Status = STATUS_INVALID_HANDLE;
+        goto SysSendFileEnd;
+    }
+
+    //
+    // Only sources that can be backed by the page cache are supported.
+    //
+
+    if (IO_IS_CACHEABLE_TYPE(Source->FileObject->Properties.Type) == FALSE) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto SysSendFileEnd;
+    }
+
+    if (Size <= 0) {
+        Status = STATUS_SUCCESS;
+        goto SysSendFileEnd;
+    }
+
+    Timeout = Parameters->TimeoutInMilliseconds;
+
+    ASSERT(SYS_WAIT_TIME_INDEFINITE == WAIT_TIME_INDEFINITE);
+
+    if ((Destination->OpenFlags & OPEN_FLAG_NON_BLOCKING) != 0) {
+        Timeout = 0;
+    }
+
+    //
+    // Reads are done at explicit offsets so that the file pointer only
+    // advances by what was actually written to the destination.
+    //
+
+    if (Offset == (IO_OFFSET)-1) {
+        UseFilePointer = TRUE;
+        Status = IoSeek(Source, SeekCommandNop, 0, &Offset);
+        if (!KSUCCESS(Status)) {
+            goto SysSendFileEnd;
+        }
+
+    } else if (Offset < 0) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto SysSendFileEnd;
+    }
+
+    while (BytesCompleted < (UINTN)Size) {
+        BytesThisRound = (UINTN)Size - BytesCompleted;
+        if (BytesThisRound > SEND_FILE_CHUNK_SIZE) {
+            BytesThisRound = SEND_FILE_CHUNK_SIZE;
+        }
+
+        //
+        // Read whole pages into an empty I/O buffer. For cached files this
+        // fills the buffer with the page cache entries themselves rather than
+        // copying them.
+        //
+
+        PageOffset = REMAINDER(Offset, PageSize);
+        ReadSize = ALIGN_RANGE_UP(PageOffset + BytesThisRound, PageSize);
+        IoBuffer = MmAllocateUninitializedIoBuffer(ReadSize, 0);
+        if (IoBuffer == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        Status = IoReadAtOffset(Source,
+                                IoBuffer,
+                                Offset - PageOffset,
+                                ReadSize,
+                                0,
+                                WAIT_TIME_INDEFINITE,
+                                &BytesRead,
+                                NULL);
+
+        if (Status == STATUS_END_OF_FILE) {
+            Status = STATUS_SUCCESS;
+            break;
+        }
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        if (BytesRead <= PageOffset) {
+            break;
+        }
+
+        BytesRead -= PageOffset;
+        if (BytesRead > BytesThisRound) {
+            BytesRead = BytesThisRound;
+        }
+
+        MmIoBufferIncrementOffset(IoBuffer, PageOffset);
+
+        //
+        // Sockets are allowed to hang on to the page cache pages until the
+        // data is acknowledged. Everything else gets a plain write.
+        //
+
+        BytesWritten = 0;
+        if (Destination->FileObject->Properties.Type == IoObjectSocket) {
+            RtlZeroMemory(&SocketParameters, sizeof(SOCKET_IO_PARAMETERS));
+            SocketParameters.Size = BytesRead;
+            SocketParameters.TimeoutInMilliseconds = Timeout;
+            SocketParameters.SocketIoFlags = SOCKET_IO_REFERENCE_BUFFER;
+            Status = IoSocketSendData(FALSE,
+                                      Destination,
+                                      &SocketParameters,
+                                      IoBuffer);
+
+            BytesWritten = SocketParameters.BytesCompleted;
+
+        } else {
+            Status = IoWriteAtOffset(Destination,
+                                     IoBuffer,
+                                     (IO_OFFSET)-1,
+                                     BytesRead,
+                                     0,
+                                     Timeout,
+                                     &BytesWritten,
+                                     NULL);
+        }
+
+        MmFreeIoBuffer(IoBuffer);
+        IoBuffer = NULL;
+        BytesCompleted += BytesWritten;
+        Offset += BytesWritten;
+        if ((!KSUCCESS(Status)) || (BytesWritten != BytesThisRound)) {
+            break;
+        }
+    }
+
+    if (Status == STATUS_BROKEN_PIPE) {
+
+        ASSERT(CurrentProcess != PsGetKernelProcess());
+
+        PsSignalProcess(CurrentProcess, SIGNAL_BROKEN_PIPE, NULL);
+    }
+
+    if ((UseFilePointer != FALSE) && (BytesCompleted != 0)) {
+        IoSeek(Source, SeekCommandFromBeginning, Offset, NULL);
+    }
+
+SysSendFileEnd:
+    if (IoBuffer != NULL) {
+        MmFreeIoBuffer(IoBuffer);
+    }
+
+    if (Source != NULL) {
+        IoIoHandleReleaseReference(Source);
+    }
+
+    if (Destination != NULL) {
+        IoIoHandleReleaseReference(Destination);
+    }
+
+    //
+    // If any bytes were transferred, report the partial transfer as a success
+    // and let the next call hit the error. Otherwise, an interrupted transfer
+    // can be restarted if the signal handler allows.
+    //
+
+    if ((!KSUCCESS(Status)) && (BytesCompleted != 0)) {
+        Status = STATUS_SUCCESS;
+
+    } else if (Status == STATUS_INTERRUPTED) {
+        Status = STATUS_RESTART_AFTER_SIGNAL;
+    }
+
+    Result = Status;
+    if (KSUCCESS(Status)) {
+
+        ASSERT(BytesCompleted <= (UINTN)MAX_INTN);
+
+        Result = (INTN)BytesCompleted;
+    }
+
+    return Result;
+}
+
 INTN
 IoSysFlush (
     PVOID SystemCallParameter
@@ -3577,6 +3834,157 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+IoPerformSpawnFileActions (
+    PVOID Actions,
+    ULONG ActionCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the file actions requested for a spawned process.
+    It runs in the context of the new process before its image is loaded.
+
+Arguments:
+
+    Actions - Supplies a pointer to the array of SPAWN_FILE_ACTION structures
+        to perform, in order. Paths in this array must be kernel mode copies.
+
+    ActionCount - Supplies the number of elements in the array.
+
+Return Value:
+
+    Status code. Processing stops at the first action that fails.
+
+--*/
+
+{
+
+    ULONG Access;
+    PSPAWN_FILE_ACTION Action;
+    ULONG ActionIndex;
+    ULONG HandleFlags;
+    PIO_HANDLE IoHandle;
+    PVOID OldValue;
+    ULONG OpenFlags;
+    PKPROCESS Process;
+    KSTATUS Status;
+
+    ASSERT_SYS_OPEN_FLAGS_EQUIVALENT();
+
+    Process = PsGetCurrentProcess();
+
+    ASSERT(Process != PsGetKernelProcess());
+
+    Status = STATUS_SUCCESS;
+    for (ActionIndex = 0; ActionIndex < ActionCount; ActionIndex += 1) {
+        Action = &(((PSPAWN_FILE_ACTION)Actions)[ActionIndex]);
+        IoHandle = NULL;
+        switch (Action->Type) {
+        case SpawnFileActionOpen:
+            Access = (Action->Flags >> SYS_OPEN_ACCESS_SHIFT) & IO_ACCESS_MASK;
+            OpenFlags = Action->Flags & SYS_OPEN_FLAG_MASK;
+            Status = IoOpen(FALSE,
+                            NULL,
+                            Action->Path,
+                            Action->PathSize,
+                            Access,
+                            OpenFlags,
+                            Action->CreatePermissions,
+                            &IoHandle);
+
+            if (!KSUCCESS(Status)) {
+                break;
+            }
+
+            HandleFlags = 0;
+            if ((Action->Flags & SYS_OPEN_FLAG_CLOSE_ON_EXECUTE) != 0) {
+                HandleFlags |= FILE_DESCRIPTOR_CLOSE_ON_EXECUTE;
+            }
+
+            break;
+
+        //
+        // Duplicating a handle onto itself just clears the close on execute
+        // flag so that the handle survives into the new image.
+        //
+
+        case SpawnFileActionDuplicate:
+            HandleFlags = 0;
+            if (Action->SourceHandle == Action->Handle) {
+                Status = ObGetSetHandleFlags(Process->HandleTable,
+                                             Action->Handle,
+                                             TRUE,
+                                             &HandleFlags);
+
+                break;
+            }
+
+            IoHandle = ObGetHandleValue(Process->HandleTable,
+                                        Action->SourceHandle,
+                                        NULL);
+
+            if (IoHandle == NULL) {
+                Status = STATUS_INVALID_HANDLE;
+            }
+
+            break;
+
+        //
+        // As with close, failing to close a handle that isn't open is not
+        // fatal.
+        //
+
+        case SpawnFileActionClose:
+            IopSysClose(Process, Action->Handle);
+            break;
+
+        default:
+            Status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        //
+        // Put the opened or duplicated I/O handle at the requested spot,
+        // closing whatever was there before. The reference on the I/O handle
+        // is transferred to the handle table.
+        //
+
+        if (IoHandle != NULL) {
+            Status = ObReplaceHandleValue(Process->HandleTable,
+                                          Action->Handle,
+                                          IoHandle,
+                                          HandleFlags,
+                                          &OldValue,
+                                          NULL);
+
+            if (!KSUCCESS(Status)) {
+                if (Action->Type == SpawnFileActionOpen) {
+                    IoClose(IoHandle);
+
+                } else {
+                    IoIoHandleReleaseReference(IoHandle);
+                }
+
+                break;
+            }
+
+            if (OldValue != NULL) {
+                IopRemoveFileLocks(OldValue, Process);
+                IoClose(OldValue);
+            }
+        }
+    }
+
+    return Status;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
@@ -93,6 +93,20 @@ KepGetProcessorUsage (
     BOOL Set
     );
 
+KSTATUS
+KepGetSchedulerStatisticsInformation (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
+KSTATUS
+KepGetWorkQueueStatisticsInformation (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
 KSTATUS
 KepGetProcessorCount (
     PVOID Data,
@@ -568,6 +582,14 @@ Return Value:
         Status = KepGetKernelCommandLine(Data, DataSize, Set);
         break;
 
+    case KeInformationSchedulerStatistics:
+        Status = KepGetSchedulerStatisticsInformation(Data, DataSize, Set);
+        break;
+
+    case KeInformationWorkQueueStatistics:
+        Status = KepGetWorkQueueStatisticsInformation(Data, DataSize, Set);
+        break;
+
     default:
         Status = STATUS_INVALID_PARAMETER;
         *DataSize = 0;
@@ -862,6 +884,121 @@ Return Value:
     return STATUS_SUCCESS;
 }
 
+KSTATUS
+KepGetSchedulerStatisticsInformation (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets scheduler load balancing statistics for a processor.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PSCHEDULER_STATISTICS_INFORMATION Information;
+    UINTN ProcessorCount;
+    KSTATUS Status;
+
+    if (Set != FALSE) {
+        return STATUS_ACCESS_DENIED;
+    }
+
+    Status = PsCheckPermission(PERMISSION_RESOURCES);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    if (*DataSize != sizeof(SCHEDULER_STATISTICS_INFORMATION)) {
+        *DataSize = sizeof(SCHEDULER_STATISTICS_INFORMATION);
+        return STATUS_DATA_LENGTH_MISMATCH;
+    }
+
+    Information = Data;
+    ProcessorCount = KeGetActiveProcessorCount();
+    if (Information->ProcessorNumber >= ProcessorCount) {
+        Information->ProcessorNumber = ProcessorCount;
+        return STATUS_OUT_OF_BOUNDS;
+    }
+
+    Status = KepGetSchedulerStatistics(Information->ProcessorNumber,
+                                       &(Information->Statistics));
+
+    return Status;
+}
+
+KSTATUS
+KepGetWorkQueueStatisticsInformation (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets the statistics for the system work queue.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    if (Set != FALSE) {
+        return STATUS_ACCESS_DENIED;
+    }
+
+    Status = PsCheckPermission(PERMISSION_RESOURCES);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    if (*DataSize != sizeof(WORK_QUEUE_STATISTICS)) {
+        *DataSize = sizeof(WORK_QUEUE_STATISTICS);
+        return STATUS_DATA_LENGTH_MISMATCH;
+    }
+
+    KeGetWorkQueueStatistics(NULL, Data);
+    return STATUS_SUCCESS;
+}
+
 KSTATUS
 KepGetProcessorCount (
     PVOID Data,
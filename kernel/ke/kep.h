@@ -513,6 +513,55 @@ Return Value:
 
 --*/
 
+VOID
+KepUpdateSchedulerLoad (
+    PPROCESSOR_BLOCK Processor
+    );
+
+/*++
+
+Routine Description:
+
+    This routine is called from the clock interrupt to update the processor's
+    load average and request periodic load balancing when it is due.
+
+Arguments:
+
+    Processor - Supplies a pointer to the current processor block.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+KepGetSchedulerStatistics (
+    ULONG ProcessorNumber,
+    PSCHEDULER_BALANCE_STATISTICS Statistics
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns a snapshot of the load balancing statistics for a
+    processor.
+
+Arguments:
+
+    ProcessorNumber - Supplies the processor number to query.
+
+    Statistics - Supplies a pointer where the statistics will be returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if the processor number is not valid.
+
+--*/
+
 KSTATUS
 KepWriteCrashDump (
     ULONG CrashCode,
@@ -30,6 +30,7 @@ Module Name:
 //
 
 #include <minoca/kernel/kernel.h>
+#include "kep.h"
 
 //
 // ---------------------------------------------------------------- Definitions
@@ -46,10 +47,27 @@ Module Name:
 #define SHARED_EXCLUSIVE_LOCK_EXCLUSIVE ((ULONG)-1)
 #define SHARED_EXCLUSIVE_LOCK_MAX_WAITERS ((ULONG)-2)
 
+//
+// Define how often a thread spinning on a queued lock checks whether the
+// owner is still running.
+//
+
+#define QUEUED_LOCK_OWNER_CHECK_INTERVAL 16
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+BOOL
+KepSpinOnQueuedLock (
+    PQUEUED_LOCK Lock
+    );
+
+BOOL
+KepIsThreadRunning (
+    PKTHREAD Thread
+    );
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -65,6 +83,14 @@ Module Name:
 
 POBJECT_HEADER KeQueuedLockDirectory = NULL;
 
+//
+// Store the maximum number of iterations a thread will spin waiting for a
+// queued lock whose owner is running on another processor before blocking.
+// Set this to zero to always block immediately.
+//
+
+ULONG KeQueuedLockSpinLimit = 1000;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -217,6 +243,8 @@ Return Value:
 
 {
 
+    BOOL Contended;
+    BOOL Slept;
     KSTATUS Status;
     PKTHREAD Thread;
 
@@ -225,9 +253,50 @@ Return Value:
     ASSERT(KeGetRunLevel() <= RunLevelDispatch);
     ASSERT((Lock->OwningThread != Thread) || (Thread == NULL));
 
-    Status = ObWaitOnObject(&(Lock->Header), 0, TimeoutInMilliseconds);
+    Contended = FALSE;
+    Slept = FALSE;
+    Status = ObWaitOnObject(&(Lock->Header), 0, 0);
     if (KSUCCESS(Status)) {
-        Lock->OwningThread = Thread;
+        goto AcquireQueuedLockTimedEnd;
+    }
+
+    Contended = TRUE;
+    if (TimeoutInMilliseconds == 0) {
+        return Status;
+    }
+
+    //
+    // Short critical sections are often over by the time a block and wake
+    // would complete, so spin for a while if the owner is actively running.
+    //
+
+    if (KepSpinOnQueuedLock(Lock) != FALSE) {
+        Status = STATUS_SUCCESS;
+        goto AcquireQueuedLockTimedEnd;
+    }
+
+    Slept = TRUE;
+    Status = ObWaitOnObject(&(Lock->Header), 0, TimeoutInMilliseconds);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+AcquireQueuedLockTimedEnd:
+
+    //
+    // The statistics are protected by the lock itself.
+    //
+
+    Lock->OwningThread = Thread;
+    Lock->AcquireCount += 1;
+    if (Contended != FALSE) {
+        Lock->ContentionCount += 1;
+        if (Slept != FALSE) {
+            Lock->SleepCount += 1;
+
+        } else {
+            Lock->SpinCount += 1;
+        }
     }
 
     return Status;
@@ -299,6 +368,7 @@ Return Value:
     }
 
     Lock->OwningThread = KeGetCurrentThread();
+    Lock->AcquireCount += 1;
     return TRUE;
 }
 
@@ -527,6 +597,282 @@ Return Value:
     return FALSE;
 }
 
+KERNEL_API
+VOID
+KeInitializeQueuedSpinLock (
+    PKQUEUED_SPIN_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes a queued spin lock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to initialize.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    Lock->Owner = NULL;
+    Lock->OwningThread = NULL;
+    Lock->AcquireCount = 0;
+    Lock->ContentionCount = 0;
+    Lock->SpinCount = 0;
+
+    //
+    // This atomic exchange serves as a memory barrier and serializing
+    // instruction.
+    //
+
+    RtlAtomicExchange((PUINTN)&(Lock->Tail), (UINTN)NULL);
+    return;
+}
+
+KERNEL_API
+VOID
+KeAcquireQueuedSpinLock (
+    PKQUEUED_SPIN_LOCK Lock,
+    PKQUEUED_SPIN_LOCK_HANDLE Handle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine acquires a queued spin lock. Waiters are granted the lock in
+    the order they arrived, and each spins only on its own handle. The lock
+    must be acquired at dispatch level or above, or with interrupts disabled,
+    so that a waiter is never preempted while holding a place in line.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to acquire.
+
+    Handle - Supplies a pointer to the caller's handle for this acquisition.
+        The handle must remain valid until the lock is released, and is
+        usually a local variable of the caller.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PKQUEUED_SPIN_LOCK_HANDLE Previous;
+    UINTN SpinCount;
+
+    ASSERT((KeGetRunLevel() >= RunLevelDispatch) ||
+           (ArAreInterruptsEnabled() == FALSE));
+
+    Handle->Next = NULL;
+    Handle->Waiting = TRUE;
+
+    //
+    // Get in line. The exchange is a full barrier, so the handle is
+    // initialized before anyone else can see it.
+    //
+
+    Previous = (PKQUEUED_SPIN_LOCK_HANDLE)RtlAtomicExchange(
+                                                     (PUINTN)&(Lock->Tail),
+                                                     (UINTN)Handle);
+
+    //
+    // If there was someone ahead, link up behind them and spin locally until
+    // they hand the lock over.
+    //
+
+    SpinCount = 0;
+    if (Previous != NULL) {
+        Previous->Next = Handle;
+        while (Handle->Waiting != FALSE) {
+            ArProcessorYield();
+            SpinCount += 1;
+        }
+
+        RtlMemoryBarrier();
+    }
+
+    //
+    // The counters are protected by the lock itself.
+    //
+
+    Lock->Owner = Handle;
+    Lock->OwningThread = KeGetCurrentThread();
+    Lock->AcquireCount += 1;
+    if (Previous != NULL) {
+        Lock->ContentionCount += 1;
+        Lock->SpinCount += SpinCount;
+    }
+
+    return;
+}
+
+KERNEL_API
+VOID
+KeReleaseQueuedSpinLock (
+    PKQUEUED_SPIN_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a queued spin lock, handing it directly to the next
+    waiter in line if there is one.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PKQUEUED_SPIN_LOCK_HANDLE Handle;
+    PKQUEUED_SPIN_LOCK_HANDLE Next;
+    UINTN OldTail;
+
+    Handle = Lock->Owner;
+
+    ASSERT((Handle != NULL) && (Lock->Tail != NULL));
+
+    Lock->Owner = NULL;
+    Lock->OwningThread = NULL;
+
+    //
+    // If nobody is visibly waiting, try to mark the lock free. If the tail
+    // moved in the meantime, someone is in the middle of getting in line.
+    //
+
+    Next = Handle->Next;
+    if (Next == NULL) {
+        OldTail = RtlAtomicCompareExchange((PUINTN)&(Lock->Tail),
+                                           (UINTN)NULL,
+                                           (UINTN)Handle);
+
+        if (OldTail == (UINTN)Handle) {
+            return;
+        }
+
+        //
+        // Wait for the new waiter to finish linking itself in.
+        //
+
+        while (Handle->Next == NULL) {
+            ArProcessorYield();
+        }
+
+        Next = Handle->Next;
+    }
+
+    //
+    // Make sure everything done under the lock is visible before handing it
+    // to the next waiter.
+    //
+
+    RtlMemoryBarrier();
+    Next->Waiting = FALSE;
+    return;
+}
+
+KERNEL_API
+BOOL
+KeTryToAcquireQueuedSpinLock (
+    PKQUEUED_SPIN_LOCK Lock,
+    PKQUEUED_SPIN_LOCK_HANDLE Handle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine makes one attempt to acquire a queued spin lock. It does not
+    get in line if the lock is held.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to attempt to acquire.
+
+    Handle - Supplies a pointer to the caller's handle for this acquisition,
+        which must remain valid until the lock is released if the acquire
+        succeeds.
+
+Return Value:
+
+    TRUE if the lock was acquired.
+
+    FALSE if the lock was not acquired.
+
+--*/
+
+{
+
+    UINTN OldTail;
+
+    Handle->Next = NULL;
+    Handle->Waiting = FALSE;
+    OldTail = RtlAtomicCompareExchange((PUINTN)&(Lock->Tail),
+                                       (UINTN)Handle,
+                                       (UINTN)NULL);
+
+    if (OldTail != (UINTN)NULL) {
+        return FALSE;
+    }
+
+    Lock->Owner = Handle;
+    Lock->OwningThread = KeGetCurrentThread();
+    Lock->AcquireCount += 1;
+    return TRUE;
+}
+
+KERNEL_API
+BOOL
+KeIsQueuedSpinLockHeld (
+    PKQUEUED_SPIN_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a queued spin lock is held or free.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to check.
+
+Return Value:
+
+    TRUE if the lock has been acquired.
+
+    FALSE if the lock is free.
+
+--*/
+
+{
+
+    RtlMemoryBarrier();
+    if (Lock->Tail != NULL) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
 KERNEL_API
 PSHARED_EXCLUSIVE_LOCK
 KeCreateSharedExclusiveLock (
@@ -1209,3 +1555,109 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+BOOL
+KepSpinOnQueuedLock (
+    PQUEUED_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine spins for a bounded period waiting for a held queued lock to
+    be released, as long as the lock's owner is running on another processor.
+
+Arguments:
+
+    Lock - Supplies a pointer to the queued lock to spin on.
+
+Return Value:
+
+    TRUE if the lock was acquired.
+
+    FALSE if the caller should block waiting for the lock.
+
+--*/
+
+{
+
+    ULONG Iteration;
+    PKTHREAD Owner;
+    KSTATUS Status;
+
+    if (KeActiveProcessorCount == 1) {
+        return FALSE;
+    }
+
+    Owner = NULL;
+    for (Iteration = 0; Iteration < KeQueuedLockSpinLimit; Iteration += 1) {
+
+        //
+        // Give up if the owner changed hands or got scheduled out, since the
+        // lock is not going to come free soon.
+        //
+
+        if ((Iteration % QUEUED_LOCK_OWNER_CHECK_INTERVAL) == 0) {
+            if (Iteration == 0) {
+                Owner = Lock->OwningThread;
+
+            } else if (Lock->OwningThread != Owner) {
+                break;
+            }
+
+            if ((Owner == NULL) || (KepIsThreadRunning(Owner) == FALSE)) {
+                break;
+            }
+        }
+
+        ArProcessorYield();
+        if (Lock->Header.WaitQueue.State == SignaledForOne) {
+            Status = ObWaitOnObject(&(Lock->Header), 0, 0);
+            if (KSUCCESS(Status)) {
+                return TRUE;
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+BOOL
+KepIsThreadRunning (
+    PKTHREAD Thread
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the given thread is currently running on
+    some processor. The thread structure itself is never touched, so the
+    thread may be exiting or even destroyed.
+
+Arguments:
+
+    Thread - Supplies a pointer to the thread to look for.
+
+Return Value:
+
+    TRUE if the thread was running on a processor at the time of the check.
+
+    FALSE if the thread was not found running.
+
+--*/
+
+{
+
+    ULONG Count;
+    ULONG Index;
+
+    Count = KeActiveProcessorCount;
+    for (Index = 0; Index < Count; Index += 1) {
+        if (KeProcessorBlocks[Index]->RunningThread == Thread) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
@@ -32,6 +32,20 @@ Module Name:
 #include <minoca/kernel/kernel.h>
 #include "kep.h"
 
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// This macro evaluates to non-zero if the given scheduler entry is a thread
+// in one of the real-time scheduling classes.
+//
+
+#define IS_REAL_TIME_SCHEDULER_ENTRY(_Entry)                    \
+    (((_Entry)->Type == SchedulerEntryThread) &&                \
+     (((_Entry)->Class == SchedulerClassRealTimeFifo) ||        \
+      ((_Entry)->Class == SchedulerClassRealTimeRoundRobin)))
+
 //
 // ---------------------------------------------------------------- Definitions
 //
@@ -43,6 +57,75 @@ Module Name:
 
 #define SCHEDULER_REBALANCE_MINIMUM_THREADS 2
 
+//
+// Define the number of clock ticks between periodic load balancing passes on
+// a busy processor.
+//
+
+#define SCHEDULER_BALANCE_INTERVAL_TICKS 8
+
+//
+// Define the decay rate of the load average, as a shift. Each tick the
+// average moves 1/8th of the way towards the current number of ready threads.
+//
+
+#define SCHEDULER_LOAD_DECAY_SHIFT 3
+
+//
+// Define how far above the system average a processor's load must be before
+// it pushes work away, as a shift of the average (25%).
+//
+
+#define SCHEDULER_IMBALANCE_SHIFT 2
+
+//
+// Define the minimum difference in ready threads between a busy processor and
+// the least loaded processor before a thread is pushed.
+//
+
+#define SCHEDULER_PUSH_MINIMUM_DIFFERENCE 2
+
+//
+// Define flags that govern which threads are acceptable when searching a
+// scheduler for a thread to migrate.
+//
+
+#define SCHEDULER_SKIP_RUNNING 0x00000001
+#define SCHEDULER_SKIP_CACHE_HOT 0x00000002
+
+//
+// Define the number of clock ticks in the time slice of a fair share entry
+// with the default weight. Round robin real-time threads always get the
+// default time slice.
+//
+
+#define SCHEDULER_DEFAULT_SLICE_TICKS 2
+
+//
+// Define the amount of credit a clock tick of run time costs. Fair share
+// entries earn their weight in credit for each default slice tick, so credit
+// is effectively kept in 1/1024ths of a tick and entries with small weights
+// get fractions of a tick per turn rather than being rounded up to a whole
+// one.
+//
+
+#define SCHEDULER_TICK_CREDIT SCHEDULER_DEFAULT_WEIGHT
+
+//
+// Define the bounds on an entry's credit. Surplus credit is capped to bound
+// the time a heavy entry can hold the processor, and debt is capped at one
+// tick so that an entry in debt is never passed over for long.
+//
+
+#define SCHEDULER_MAXIMUM_CREDIT (64 * SCHEDULER_TICK_CREDIT)
+#define SCHEDULER_MINIMUM_CREDIT (-SCHEDULER_TICK_CREDIT)
+
+//
+// Define the number of distinct nice values.
+//
+
+#define SCHEDULER_NICE_COUNT (SCHEDULER_NICE_MAX - SCHEDULER_NICE_MIN + 1)
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -61,6 +144,31 @@ KepBalanceIdleScheduler (
     VOID
     );
 
+VOID
+KepBalanceBusyScheduler (
+    PPROCESSOR_BLOCK Processor
+    );
+
+UINTN
+KepGetSchedulerLoad (
+    PSCHEDULER_DATA Scheduler
+    );
+
+BOOL
+KepMigrateThread (
+    PSCHEDULER_DATA Source,
+    ULONG DestinationNumber,
+    ULONG Flags
+    );
+
+BOOL
+KepIsThreadMigratable (
+    PSCHEDULER_DATA Scheduler,
+    PKTHREAD Thread,
+    ULONG Flags,
+    ULONGLONG CurrentTime
+    );
+
 BOOL
 KepEnqueueSchedulerEntry (
     PSCHEDULER_ENTRY Entry,
@@ -76,7 +184,30 @@ KepDequeueSchedulerEntry (
 PKTHREAD
 KepGetNextThread (
     PSCHEDULER_DATA Scheduler,
-    BOOL SkipRunning
+    ULONG Flags
+    );
+
+PKTHREAD
+KepGetNextRealTimeThread (
+    PSCHEDULER_DATA Scheduler,
+    ULONG Flags,
+    ULONGLONG CurrentTime
+    );
+
+BOOL
+KepChargeSchedulerEntry (
+    PPROCESSOR_BLOCK Processor,
+    PSCHEDULER_ENTRY Entry
+    );
+
+VOID
+KepDebitSchedulerEntryCredit (
+    PSCHEDULER_ENTRY Entry
+    );
+
+VOID
+KepRefillSchedulerEntryCredit (
+    PSCHEDULER_ENTRY Entry
     );
 
 KSTATUS
@@ -111,6 +242,22 @@ KSPIN_LOCK KeSchedulerGroupLock;
 
 BOOL KeSchedulerStealReadyThreads = FALSE;
 
+//
+// Store the fair share weight for each nice value, starting at
+// SCHEDULER_NICE_MIN. Each step is roughly a 25% change in processor share.
+//
+
+const ULONG KeSchedulerNiceWeights[SCHEDULER_NICE_COUNT] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906,
+    3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423,
+    335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45,
+    36, 29, 23, 18, 15
+};
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -176,6 +323,7 @@ Return Value:
 
     BOOL Enabled;
     BOOL FirstTime;
+    KQUEUED_SPIN_LOCK_HANDLE LockHandle;
     PKTHREAD NextThread;
     PVOID NextThreadStack;
     THREAD_STATE NextThreadState;
@@ -207,14 +355,33 @@ Return Value:
     }
 
     OldThread = Processor->RunningThread;
-    KeAcquireSpinLock(&(Processor->Scheduler.Lock));
+
+    //
+    // If the clock decided it's time to look around at the other processors,
+    // do that before settling on what to run here.
+    //
+
+    if ((Reason == SchedulerReasonDispatchInterrupt) &&
+        (Processor->Scheduler.BalancePending != FALSE)) {
+
+        Processor->Scheduler.BalancePending = FALSE;
+        KepBalanceBusyScheduler(Processor);
+    }
+
+    KeAcquireQueuedSpinLock(&(Processor->Scheduler.Lock), &LockHandle);
 
     //
     // Remove the old thread from the scheduler. Immediately put it back if
-    // it's not blocking.
+    // it's not blocking. A thread that is merely being preempted keeps its
+    // place at the front of its queue until its time slice runs out, so it
+    // will be picked again unless something more important became ready.
     //
 
-    if (OldThread != Processor->IdleThread) {
+    if ((OldThread != Processor->IdleThread) &&
+        ((Reason != SchedulerReasonDispatchInterrupt) ||
+         (KepChargeSchedulerEntry(Processor, &(OldThread->SchedulerEntry)) !=
+          FALSE))) {
+
         KepDequeueSchedulerEntry(&(OldThread->SchedulerEntry), TRUE);
         if ((Reason != SchedulerReasonThreadBlocking) &&
             (Reason != SchedulerReasonThreadSuspending) &&
@@ -229,7 +396,7 @@ Return Value:
     // to run. This might be the old thread again.
     //
 
-    NextThread = KepGetNextThread(&(Processor->Scheduler), FALSE);
+    NextThread = KepGetNextThread(&(Processor->Scheduler), 0);
 
     //
     // If there are no threads to run, run the idle thread.
@@ -255,7 +422,7 @@ Return Value:
 
     NextThreadState = NextThread->State;
     NextThread->State = ThreadStateRunning;
-    KeReleaseSpinLock(&(Processor->Scheduler.Lock));
+    KeReleaseQueuedSpinLock(&(Processor->Scheduler.Lock));
 
     //
     // Just return if there's no change.
@@ -265,6 +432,13 @@ Return Value:
         goto SchedulerEntryEnd;
     }
 
+    //
+    // Remember when the old thread last ran so the load balancer can leave
+    // it alone while its cache footprint is still warm.
+    //
+
+    OldThread->SchedulerEntry.LastRunTime = Processor->Clock.CurrentTime;
+
     //
     // Keep track of the old thread's behavior record.
     //
@@ -499,6 +673,9 @@ Return Value:
 
         Thread->SchedulerEntry.Parent = &(NewGroupEntry->Entry);
         KepEnqueueSchedulerEntry(&(Thread->SchedulerEntry), FALSE);
+        if (IS_REAL_TIME_SCHEDULER_ENTRY(&(Thread->SchedulerEntry))) {
+            ProcessorBlock->PendingDispatchInterrupt = TRUE;
+        }
 
     //
     // Enqueue the thread on the processor it was previously on. This may
@@ -514,13 +691,25 @@ Return Value:
         // make sure the clock is running (or wake it up).
         //
 
-        if (FirstThread != FALSE) {
-            ProcessorBlock = PARENT_STRUCTURE(GroupEntry->Scheduler,
-                                              PROCESSOR_BLOCK,
-                                              Scheduler);
+        ProcessorBlock = PARENT_STRUCTURE(GroupEntry->Scheduler,
+                                          PROCESSOR_BLOCK,
+                                          Scheduler);
 
+        if (FirstThread != FALSE) {
             KepSetClockToPeriodic(ProcessorBlock);
         }
+
+        //
+        // A real-time thread preempts whatever is running on the current
+        // processor right away rather than waiting for the next clock tick.
+        // Other processors will notice it on their next tick.
+        //
+
+        if ((IS_REAL_TIME_SCHEDULER_ENTRY(&(Thread->SchedulerEntry))) &&
+            (ProcessorBlock == KeGetCurrentProcessorBlock())) {
+
+            ProcessorBlock->PendingDispatchInterrupt = TRUE;
+        }
     }
 
     KeLowerRunLevel(OldRunLevel);
@@ -640,6 +829,182 @@ Return Value:
     return;
 }
 
+VOID
+KeInitializeSchedulerEntry (
+    PSCHEDULER_ENTRY Entry,
+    PSCHEDULER_ENTRY Parent,
+    PSCHEDULER_ENTRY Template
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes a thread's scheduler entry.
+
+Arguments:
+
+    Entry - Supplies a pointer to the thread scheduler entry to initialize.
+
+    Parent - Supplies a pointer to the group entry the thread belongs to.
+
+    Template - Supplies an optional pointer to a scheduler entry whose
+        scheduling class and priority should be inherited. If NULL, the entry
+        is placed in the fair share class with the default nice value.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    Entry->Type = SchedulerEntryThread;
+    Entry->Parent = Parent;
+    if (Template != NULL) {
+        Entry->Class = Template->Class;
+        Entry->Priority = Template->Priority;
+        Entry->Weight = Template->Weight;
+
+    } else {
+        Entry->Class = SchedulerClassFairShare;
+        Entry->Priority = SCHEDULER_NICE_DEFAULT;
+        Entry->Weight = SCHEDULER_DEFAULT_WEIGHT;
+    }
+
+    Entry->Credit = 0;
+    Entry->LastRunTime = 0;
+    return;
+}
+
+KSTATUS
+KeSetThreadSchedulingParameters (
+    PKTHREAD Thread,
+    SCHEDULER_CLASS Class,
+    LONG Priority
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the scheduling class and priority of a thread. If the
+    thread is currently ready, it is moved to the appropriate queue. Callers
+    are responsible for checking permissions.
+
+Arguments:
+
+    Thread - Supplies a pointer to the thread to modify.
+
+    Class - Supplies the new scheduling class.
+
+    Priority - Supplies the new priority. For real-time classes this is a
+        fixed priority between SCHEDULER_REAL_TIME_PRIORITY_MIN and
+        SCHEDULER_REAL_TIME_PRIORITY_MAX. For the fair share class this is a
+        nice value between SCHEDULER_NICE_MIN and SCHEDULER_NICE_MAX.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if the class or priority is out of range.
+
+--*/
+
+{
+
+    PSCHEDULER_ENTRY Entry;
+    PSCHEDULER_GROUP_ENTRY GroupEntry;
+    KQUEUED_SPIN_LOCK_HANDLE LockHandle;
+    RUNLEVEL OldRunLevel;
+    BOOL Queued;
+    PSCHEDULER_DATA Scheduler;
+    ULONG Weight;
+
+    switch (Class) {
+    case SchedulerClassFairShare:
+        if ((Priority < SCHEDULER_NICE_MIN) ||
+            (Priority > SCHEDULER_NICE_MAX)) {
+
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        Weight = KeSchedulerNiceWeights[Priority - SCHEDULER_NICE_MIN];
+        break;
+
+    case SchedulerClassRealTimeFifo:
+    case SchedulerClassRealTimeRoundRobin:
+        if ((Priority < SCHEDULER_REAL_TIME_PRIORITY_MIN) ||
+            (Priority > SCHEDULER_REAL_TIME_PRIORITY_MAX)) {
+
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        Weight = SCHEDULER_DEFAULT_WEIGHT;
+        break;
+
+    default:
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Entry = &(Thread->SchedulerEntry);
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+
+    //
+    // Chase the thread around as it bounces from scheduler to scheduler.
+    //
+
+    while (TRUE) {
+        GroupEntry = PARENT_STRUCTURE(Entry->Parent,
+                                      SCHEDULER_GROUP_ENTRY,
+                                      Entry);
+
+        Scheduler = GroupEntry->Scheduler;
+        KeAcquireQueuedSpinLock(&(Scheduler->Lock), &LockHandle);
+        if (Entry->Parent == &(GroupEntry->Entry)) {
+            break;
+        }
+
+        KeReleaseQueuedSpinLock(&(Scheduler->Lock));
+    }
+
+    //
+    // Pull the thread off of its current queue if it's on one, since the
+    // queue it belongs on may change.
+    //
+
+    Queued = FALSE;
+    if ((Entry->ListEntry.Next != NULL) &&
+        (Thread->State != ThreadStateExited)) {
+
+        KepDequeueSchedulerEntry(Entry, TRUE);
+        Queued = TRUE;
+    }
+
+    Entry->Class = Class;
+    Entry->Priority = Priority;
+    Entry->Weight = Weight;
+    Entry->Credit = 0;
+    if (Queued != FALSE) {
+        KepEnqueueSchedulerEntry(Entry, TRUE);
+    }
+
+    KeReleaseQueuedSpinLock(&(Scheduler->Lock));
+
+    //
+    // Reevaluate what should run if the current thread just changed its own
+    // priority.
+    //
+
+    if (Thread == KeGetCurrentThread()) {
+        KeSchedulerEntry(SchedulerReasonThreadYielding);
+    }
+
+    KeLowerRunLevel(OldRunLevel);
+    return STATUS_SUCCESS;
+}
+
 VOID
 KeIdleLoop (
     VOID
@@ -725,9 +1090,35 @@ Return Value:
 
 {
 
+    ULONG Priority;
+    PSCHEDULER_DATA Scheduler;
+
+    Scheduler = &(ProcessorBlock->Scheduler);
     KeInitializeSpinLock(&KeSchedulerGroupLock);
     INITIALIZE_LIST_HEAD(&(KeRootSchedulerGroup.Children));
-    KeInitializeSpinLock(&(ProcessorBlock->Scheduler.Lock));
+    KeRootSchedulerGroup.Weight = SCHEDULER_DEFAULT_WEIGHT;
+    KeInitializeQueuedSpinLock(&(Scheduler->Lock));
+    Scheduler->LastTick = 0;
+    Scheduler->RealTimeReadyMask = 0;
+
+    //
+    // Stagger the balancing passes so that processors don't all go poking at
+    // each other's run queues on the same tick.
+    //
+
+    Scheduler->NextBalanceTick = SCHEDULER_BALANCE_INTERVAL_TICKS +
+                                 (ProcessorBlock->ProcessorNumber %
+                                  SCHEDULER_BALANCE_INTERVAL_TICKS);
+
+    Scheduler->BalancePending = FALSE;
+    RtlZeroMemory(&(Scheduler->Statistics), sizeof(Scheduler->Statistics));
+    for (Priority = 0;
+         Priority < SCHEDULER_REAL_TIME_PRIORITY_COUNT;
+         Priority += 1) {
+
+        INITIALIZE_LIST_HEAD(&(Scheduler->RealTimeQueues[Priority]));
+    }
+
     KepInitializeSchedulerGroupEntry(&(ProcessorBlock->Scheduler.Group),
                                      &(ProcessorBlock->Scheduler),
                                      &KeRootSchedulerGroup,
@@ -736,12 +1127,8 @@ Return Value:
     return;
 }
 
-//
-// --------------------------------------------------------- Internal Functions
-//
-
 VOID
-KepIdle (
+KepUpdateSchedulerLoad (
     PPROCESSOR_BLOCK Processor
     )
 
@@ -749,13 +1136,12 @@ KepIdle (
 
 Routine Description:
 
-    This routine is called when a processor has nothing to run. This routine is
-    called with interrupts disabled, and returns with interrupts enabled.
+    This routine is called from the clock interrupt to update the processor's
+    load average and request periodic load balancing when it is due.
 
 Arguments:
 
-    Processor - Supplies a pointer to the processor block of the current
-        processor.
+    Processor - Supplies a pointer to the current processor block.
 
 Return Value:
 
@@ -765,54 +1151,167 @@ Return Value:
 
 {
 
-    KepClockIdle(Processor);
+    UINTN Average;
+    UINTN Load;
+    PSCHEDULER_DATA Scheduler;
+
+    ASSERT(KeGetRunLevel() >= RunLevelClock);
 
     //
-    // Begin counting this time as idle time. There's no need to put it back
-    // to its previous setting at the end because the next thing this thread
-    // will do is yield, and the scheduler will set the new period.
+    // The ready count is read without the lock. It's only a hint, and the
+    // average smooths out any transient wobble.
     //
 
-    KeBeginCycleAccounting(CycleAccountIdle);
-    PmIdle(Processor);
+    Scheduler = &(Processor->Scheduler);
+    Load = Scheduler->Group.ReadyThreadCount << SCHEDULER_LOAD_SHIFT;
+    Average = Scheduler->Statistics.LoadAverage;
+    Average = ((Average << SCHEDULER_LOAD_DECAY_SHIFT) - Average + Load) >>
+              SCHEDULER_LOAD_DECAY_SHIFT;
+
+    Scheduler->Statistics.LoadAverage = Average;
+
+    //
+    // Only busy processors need to push work around. Idle processors pull
+    // work on their own from the idle loop.
+    //
+
+    if ((INTN)(Processor->Clock.InterruptCount -
+               Scheduler->NextBalanceTick) >= 0) {
+
+        Scheduler->NextBalanceTick = Processor->Clock.InterruptCount +
+                                     SCHEDULER_BALANCE_INTERVAL_TICKS;
+
+        if (Scheduler->Group.ReadyThreadCount >=
+            SCHEDULER_REBALANCE_MINIMUM_THREADS) {
+
+            Scheduler->BalancePending = TRUE;
+        }
+    }
+
     return;
 }
 
-VOID
-KepBalanceIdleScheduler (
-    VOID
+KSTATUS
+KepGetSchedulerStatistics (
+    ULONG ProcessorNumber,
+    PSCHEDULER_BALANCE_STATISTICS Statistics
     )
 
 /*++
 
 Routine Description:
 
-    This routine is called when the processor is idle. It tries to steal
-    threads from a busier processor.
+    This routine returns a snapshot of the load balancing statistics for a
+    processor.
 
 Arguments:
 
-    None.
+    ProcessorNumber - Supplies the processor number to query.
+
+    Statistics - Supplies a pointer where the statistics will be returned.
 
 Return Value:
 
-    None.
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if the processor number is not valid.
 
 --*/
 
 {
 
-    ULONG ActiveCount;
-    ULONG CurrentNumber;
-    PSCHEDULER_GROUP_ENTRY DestinationGroupEntry;
-    BOOL FirstThread;
-    PSCHEDULER_GROUP Group;
-    ULONG Number;
-    RUNLEVEL OldRunLevel;
-    PPROCESSOR_BLOCK ProcessorBlock;
-    PSCHEDULER_GROUP_ENTRY SourceGroupEntry;
-    PSCHEDULER_DATA VictimScheduler;
-    PKTHREAD VictimThread;
+    PSCHEDULER_DATA Scheduler;
+
+    if (ProcessorNumber >= KeGetActiveProcessorCount()) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Scheduler = &(KeProcessorBlocks[ProcessorNumber]->Scheduler);
+    RtlCopyMemory(Statistics,
+                  &(Scheduler->Statistics),
+                  sizeof(SCHEDULER_BALANCE_STATISTICS));
+
+    Statistics->ReadyThreadCount = Scheduler->Group.ReadyThreadCount;
+    Statistics->LoadAverage = KepGetSchedulerLoad(Scheduler);
+    return STATUS_SUCCESS;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+KepIdle (
+    PPROCESSOR_BLOCK Processor
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when a processor has nothing to run. This routine is
+    called with interrupts disabled, and returns with interrupts enabled.
+
+Arguments:
+
+    Processor - Supplies a pointer to the processor block of the current
+        processor.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    KepClockIdle(Processor);
+
+    //
+    // Begin counting this time as idle time. There's no need to put it back
+    // to its previous setting at the end because the next thing this thread
+    // will do is yield, and the scheduler will set the new period.
+    //
+
+    KeBeginCycleAccounting(CycleAccountIdle);
+    PmIdle(Processor);
+    return;
+}
+
+VOID
+KepBalanceIdleScheduler (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when the processor is idle. It tries to steal
+    threads from the busiest processor.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG ActiveCount;
+    UINTN BusiestLoad;
+    ULONG BusiestNumber;
+    PSCHEDULER_DATA BusiestScheduler;
+    ULONG CurrentNumber;
+    UINTN Load;
+    BOOL Migrated;
+    ULONG Number;
+    RUNLEVEL OldRunLevel;
+    PSCHEDULER_DATA Scheduler;
 
     ActiveCount = KeGetActiveProcessorCount();
     if (ActiveCount == 1) {
@@ -824,91 +1323,364 @@ Return Value:
     ASSERT(OldRunLevel == RunLevelLow);
 
     CurrentNumber = KeGetCurrentProcessorNumber();
-    VictimThread = NULL;
 
     //
-    // Try to steal from another processor, starting with the next neighbor.
+    // Find the most heavily loaded processor that has enough threads to spare
+    // one.
     //
 
-    Number = CurrentNumber + 1;
-    while (TRUE) {
-        if (Number == ActiveCount) {
-            Number = 0;
-        }
-
+    BusiestLoad = 0;
+    BusiestNumber = CurrentNumber;
+    for (Number = 0; Number < ActiveCount; Number += 1) {
         if (Number == CurrentNumber) {
-            break;
+            continue;
         }
 
-        ProcessorBlock = KeProcessorBlocks[Number];
-        VictimScheduler = &(ProcessorBlock->Scheduler);
-        if (VictimScheduler->Group.ReadyThreadCount >=
+        Scheduler = &(KeProcessorBlocks[Number]->Scheduler);
+        if (Scheduler->Group.ReadyThreadCount <
             SCHEDULER_REBALANCE_MINIMUM_THREADS) {
 
-            KeAcquireSpinLock(&(VictimScheduler->Lock));
-            VictimThread = KepGetNextThread(VictimScheduler, TRUE);
-            if (VictimThread != NULL) {
+            continue;
+        }
 
-                ASSERT((VictimThread->State == ThreadStateReady) ||
-                       (VictimThread->State == ThreadStateFirstTime));
+        Load = KepGetSchedulerLoad(Scheduler);
+        if ((BusiestNumber == CurrentNumber) || (Load > BusiestLoad)) {
+            BusiestLoad = Load;
+            BusiestNumber = Number;
+        }
+    }
 
-                //
-                // Pull the thread out of the ready queue.
-                //
+    if (BusiestNumber == CurrentNumber) {
+        goto BalanceIdleSchedulerEnd;
+    }
 
-                KepDequeueSchedulerEntry(&(VictimThread->SchedulerEntry), TRUE);
-            }
+    //
+    // Prefer a thread that hasn't run recently, but an idle processor is
+    // worse than a cold cache, so settle for a hot one if that's all there
+    // is.
+    //
 
-            KeReleaseSpinLock(&(VictimScheduler->Lock));
-            if (VictimThread != NULL) {
+    BusiestScheduler = &(KeProcessorBlocks[BusiestNumber]->Scheduler);
+    Migrated = KepMigrateThread(BusiestScheduler,
+                                CurrentNumber,
+                                SCHEDULER_SKIP_RUNNING |
+                                SCHEDULER_SKIP_CACHE_HOT);
 
-                //
-                // Move the entry to this processor's queue.
-                //
+    if (Migrated == FALSE) {
+        Migrated = KepMigrateThread(BusiestScheduler,
+                                    CurrentNumber,
+                                    SCHEDULER_SKIP_RUNNING);
+    }
 
-                SourceGroupEntry = PARENT_STRUCTURE(
-                                           VictimThread->SchedulerEntry.Parent,
-                                           SCHEDULER_GROUP_ENTRY,
-                                           Entry);
+    if (Migrated != FALSE) {
+        KeProcessorBlocks[CurrentNumber]->Scheduler.Statistics.PullCount += 1;
+    }
 
-                Group = SourceGroupEntry->Group;
-                if (Group == &KeRootSchedulerGroup) {
-                    DestinationGroupEntry =
-                          &(KeProcessorBlocks[CurrentNumber]->Scheduler.Group);
+BalanceIdleSchedulerEnd:
+    KeLowerRunLevel(OldRunLevel);
+    return;
+}
 
-                } else {
+VOID
+KepBalanceBusyScheduler (
+    PPROCESSOR_BLOCK Processor
+    )
 
-                    ASSERT(Group->EntryCount > CurrentNumber);
+/*++
 
-                    DestinationGroupEntry = &(Group->Entries[CurrentNumber]);
-                }
+Routine Description:
 
-                VictimThread->SchedulerEntry.Parent =
-                                               &(DestinationGroupEntry->Entry);
+    This routine is called periodically on a busy processor. It compares the
+    processor's load against the rest of the system and pushes a ready thread
+    to the least loaded processor if this one is carrying more than its share.
+    This routine assumes the current runlevel is dispatch.
 
-                //
-                // Enqueue the thread on this processor.
-                //
+Arguments:
 
-                FirstThread =
-                      KepEnqueueSchedulerEntry(&(VictimThread->SchedulerEntry),
-                                               FALSE);
+    Processor - Supplies a pointer to the current processor block.
 
-                if (FirstThread != FALSE) {
-                    KepSetClockToPeriodic(KeProcessorBlocks[CurrentNumber]);
-                }
+Return Value:
 
-                break;
-            }
+    None.
+
+--*/
+
+{
+
+    ULONG ActiveCount;
+    UINTN Average;
+    UINTN Load;
+    BOOL Migrated;
+    ULONG Number;
+    PSCHEDULER_DATA Scheduler;
+    UINTN TargetLoad;
+    ULONG TargetNumber;
+    UINTN TotalLoad;
+
+    ASSERT(KeGetRunLevel() == RunLevelDispatch);
+
+    ActiveCount = KeGetActiveProcessorCount();
+    if (ActiveCount == 1) {
+        return;
+    }
+
+    Scheduler = &(Processor->Scheduler);
+    Scheduler->Statistics.BalanceCount += 1;
+    if (Scheduler->Group.ReadyThreadCount <
+        SCHEDULER_REBALANCE_MINIMUM_THREADS) {
+
+        return;
+    }
+
+    //
+    // Total up the load and find the least loaded processor.
+    //
+
+    TargetLoad = 0;
+    TargetNumber = Processor->ProcessorNumber;
+    TotalLoad = 0;
+    for (Number = 0; Number < ActiveCount; Number += 1) {
+        Load = KepGetSchedulerLoad(&(KeProcessorBlocks[Number]->Scheduler));
+        TotalLoad += Load;
+        if (Number == Processor->ProcessorNumber) {
+            continue;
         }
 
-        Number += 1;
+        if ((TargetNumber == Processor->ProcessorNumber) ||
+            (Load < TargetLoad)) {
+
+            TargetLoad = Load;
+            TargetNumber = Number;
+        }
+    }
+
+    //
+    // Only push if this processor is noticeably above average, and the move
+    // would actually even things out rather than just trade places.
+    //
+
+    Average = TotalLoad / ActiveCount;
+    Load = KepGetSchedulerLoad(Scheduler);
+    if (Load <= Average + (Average >> SCHEDULER_IMBALANCE_SHIFT)) {
+        return;
+    }
+
+    if (Load < TargetLoad +
+               (SCHEDULER_PUSH_MINIMUM_DIFFERENCE << SCHEDULER_LOAD_SHIFT)) {
+
+        return;
+    }
+
+    //
+    // Never push a thread with a warm cache away from a busy processor. If
+    // every candidate is hot, try again next period.
+    //
+
+    Migrated = KepMigrateThread(Scheduler,
+                                TargetNumber,
+                                SCHEDULER_SKIP_RUNNING |
+                                SCHEDULER_SKIP_CACHE_HOT);
+
+    if (Migrated != FALSE) {
+        Scheduler->Statistics.PushCount += 1;
     }
 
-    KeLowerRunLevel(OldRunLevel);
     return;
 }
 
+UINTN
+KepGetSchedulerLoad (
+    PSCHEDULER_DATA Scheduler
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the load of the given scheduler for balancing
+    purposes.
+
+Arguments:
+
+    Scheduler - Supplies a pointer to the scheduler.
+
+Return Value:
+
+    Returns the load average of the scheduler, as a fixed point value with
+    SCHEDULER_LOAD_SHIFT fractional bits.
+
+--*/
+
+{
+
+    //
+    // An idle processor stops its clock, which freezes its load average.
+    // Report it as empty rather than trusting a stale value.
+    //
+
+    if (Scheduler->Group.ReadyThreadCount == 0) {
+        return 0;
+    }
+
+    return Scheduler->Statistics.LoadAverage;
+}
+
+BOOL
+KepMigrateThread (
+    PSCHEDULER_DATA Source,
+    ULONG DestinationNumber,
+    ULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine moves one ready thread from the given scheduler to another
+    processor. This routine assumes the current runlevel is dispatch and that
+    no scheduler locks are held.
+
+Arguments:
+
+    Source - Supplies a pointer to the scheduler to take a thread from.
+
+    DestinationNumber - Supplies the number of the processor to move the
+        thread to.
+
+    Flags - Supplies a bitfield of flags governing which threads may be
+        moved. See SCHEDULER_SKIP_* definitions.
+
+Return Value:
+
+    TRUE if a thread was moved.
+
+    FALSE if no acceptable thread was found.
+
+--*/
+
+{
+
+    PPROCESSOR_BLOCK Destination;
+    PSCHEDULER_GROUP_ENTRY DestinationGroupEntry;
+    BOOL FirstThread;
+    PSCHEDULER_GROUP Group;
+    KQUEUED_SPIN_LOCK_HANDLE LockHandle;
+    PSCHEDULER_GROUP_ENTRY SourceGroupEntry;
+    PKTHREAD Thread;
+
+    KeAcquireQueuedSpinLock(&(Source->Lock), &LockHandle);
+    Thread = KepGetNextThread(Source, Flags);
+    if (Thread != NULL) {
+
+        ASSERT((Thread->State == ThreadStateReady) ||
+               (Thread->State == ThreadStateFirstTime));
+
+        //
+        // Pull the thread out of the ready queue.
+        //
+
+        KepDequeueSchedulerEntry(&(Thread->SchedulerEntry), TRUE);
+    }
+
+    KeReleaseQueuedSpinLock(&(Source->Lock));
+    if (Thread == NULL) {
+        return FALSE;
+    }
+
+    //
+    // Move the entry to the destination processor's queue.
+    //
+
+    SourceGroupEntry = PARENT_STRUCTURE(Thread->SchedulerEntry.Parent,
+                                        SCHEDULER_GROUP_ENTRY,
+                                        Entry);
+
+    Destination = KeProcessorBlocks[DestinationNumber];
+    Group = SourceGroupEntry->Group;
+    if (Group == &KeRootSchedulerGroup) {
+        DestinationGroupEntry = &(Destination->Scheduler.Group);
+
+    } else {
+
+        ASSERT(Group->EntryCount > DestinationNumber);
+
+        DestinationGroupEntry = &(Group->Entries[DestinationNumber]);
+    }
+
+    Thread->SchedulerEntry.Parent = &(DestinationGroupEntry->Entry);
+
+    //
+    // Enqueue the thread on the destination processor, waking it if needed.
+    //
+
+    FirstThread = KepEnqueueSchedulerEntry(&(Thread->SchedulerEntry), FALSE);
+    if (FirstThread != FALSE) {
+        KepSetClockToPeriodic(Destination);
+    }
+
+    return TRUE;
+}
+
+BOOL
+KepIsThreadMigratable (
+    PSCHEDULER_DATA Scheduler,
+    PKTHREAD Thread,
+    ULONG Flags,
+    ULONGLONG CurrentTime
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a ready thread is an acceptable candidate
+    to be returned from a scheduler search. This routine assumes the
+    scheduler lock is already held.
+
+Arguments:
+
+    Scheduler - Supplies a pointer to the scheduler owning the thread.
+
+    Thread - Supplies a pointer to the candidate thread.
+
+    Flags - Supplies a bitfield of flags governing which threads are
+        acceptable. See SCHEDULER_SKIP_* definitions.
+
+    CurrentTime - Supplies the current time counter value, used when skipping
+        cache hot threads.
+
+Return Value:
+
+    TRUE if the thread is acceptable.
+
+    FALSE if the thread should be skipped.
+
+--*/
+
+{
+
+    if (((Flags & SCHEDULER_SKIP_RUNNING) != 0) &&
+        (Thread->State == ThreadStateRunning)) {
+
+        return FALSE;
+    }
+
+    //
+    // A thread that ran within the last clock period probably still has its
+    // working set in this processor's cache.
+    //
+
+    if (((Flags & SCHEDULER_SKIP_CACHE_HOT) != 0) &&
+        (Thread->State != ThreadStateFirstTime) &&
+        (CurrentTime - Thread->SchedulerEntry.LastRunTime < KeClockRate)) {
+
+        Scheduler->Statistics.CacheHotCount += 1;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 BOOL
 KepEnqueueSchedulerEntry (
     PSCHEDULER_ENTRY Entry,
@@ -943,6 +1715,8 @@ Return Value:
 
     BOOL FirstThread;
     PSCHEDULER_GROUP_ENTRY GroupEntry;
+    KQUEUED_SPIN_LOCK_HANDLE LockHandle;
+    LONG Priority;
     PSCHEDULER_DATA Scheduler;
 
     ASSERT((KeGetRunLevel() == RunLevelDispatch) ||
@@ -969,20 +1743,47 @@ Return Value:
                                           Entry);
 
             Scheduler = GroupEntry->Scheduler;
-            KeAcquireSpinLock(&(Scheduler->Lock));
+            KeAcquireQueuedSpinLock(&(Scheduler->Lock), &LockHandle);
             if (Entry->Parent == &(GroupEntry->Entry)) {
                 break;
             }
 
-            KeReleaseSpinLock(&(Scheduler->Lock));
+            KeReleaseQueuedSpinLock(&(Scheduler->Lock));
         }
     }
 
+    ASSERT(Entry->ListEntry.Next == NULL);
+
+    if (Entry->Credit <= 0) {
+        KepRefillSchedulerEntryCredit(Entry);
+    }
+
     //
-    // Add the entry to the list.
+    // Real-time threads go directly on the processor's queue for their
+    // priority level, and are only counted at the top level group.
     //
 
-    ASSERT(Entry->ListEntry.Next == NULL);
+    if (IS_REAL_TIME_SCHEDULER_ENTRY(Entry)) {
+        Priority = Entry->Priority;
+
+        ASSERT((Priority >= SCHEDULER_REAL_TIME_PRIORITY_MIN) &&
+               (Priority <= SCHEDULER_REAL_TIME_PRIORITY_MAX));
+
+        INSERT_BEFORE(&(Entry->ListEntry),
+                      &(Scheduler->RealTimeQueues[Priority]));
+
+        Scheduler->RealTimeReadyMask |= 1U << Priority;
+        Scheduler->Group.ReadyThreadCount += 1;
+        if (Scheduler->Group.ReadyThreadCount == 1) {
+            FirstThread = TRUE;
+        }
+
+        goto EnqueueSchedulerEntryEnd;
+    }
+
+    //
+    // Add the entry to the list.
+    //
 
     INSERT_BEFORE(&(Entry->ListEntry), &(GroupEntry->Children));
 
@@ -1013,8 +1814,9 @@ Return Value:
         }
     }
 
+EnqueueSchedulerEntryEnd:
     if (LockHeld == FALSE) {
-        KeReleaseSpinLock(&(Scheduler->Lock));
+        KeReleaseQueuedSpinLock(&(Scheduler->Lock));
     }
 
     return FirstThread;
@@ -1049,7 +1851,9 @@ Return Value:
 {
 
     PSCHEDULER_GROUP_ENTRY GroupEntry;
+    KQUEUED_SPIN_LOCK_HANDLE LockHandle;
     PSCHEDULER_GROUP_ENTRY ParentGroupEntry;
+    LONG Priority;
     PSCHEDULER_DATA Scheduler;
 
     ASSERT((KeGetRunLevel() == RunLevelDispatch) ||
@@ -1075,12 +1879,12 @@ Return Value:
                                           Entry);
 
             Scheduler = GroupEntry->Scheduler;
-            KeAcquireSpinLock(&(Scheduler->Lock));
+            KeAcquireQueuedSpinLock(&(Scheduler->Lock), &LockHandle);
             if (Entry->Parent == &(GroupEntry->Entry)) {
                 break;
             }
 
-            KeReleaseSpinLock(&(Scheduler->Lock));
+            KeReleaseQueuedSpinLock(&(Scheduler->Lock));
         }
     }
 
@@ -1093,11 +1897,26 @@ Return Value:
     LIST_REMOVE(&(Entry->ListEntry));
     Entry->ListEntry.Next = NULL;
 
+    //
+    // Real-time threads are only counted at the top level. Clear the priority
+    // level's bit if its queue just emptied.
+    //
+
+    if (IS_REAL_TIME_SCHEDULER_ENTRY(Entry)) {
+        Priority = Entry->Priority;
+        if (LIST_EMPTY(&(Scheduler->RealTimeQueues[Priority])) != FALSE) {
+            Scheduler->RealTimeReadyMask &= ~(1U << Priority);
+        }
+
+        ASSERT(Scheduler->Group.ReadyThreadCount != 0);
+
+        Scheduler->Group.ReadyThreadCount -= 1;
+
     //
     // Propagate the no-longer-ready thread up through all levels.
     //
 
-    if (Entry->Type == SchedulerEntryThread) {
+    } else if (Entry->Type == SchedulerEntryThread) {
         while (TRUE) {
             GroupEntry->ReadyThreadCount -= 1;
             if (GroupEntry->Entry.Parent == NULL) {
@@ -1109,12 +1928,17 @@ Return Value:
                                                 Entry);
 
             //
-            // Rotate the groups so others at higher levels get a chance to run.
+            // Rotate the groups so others at higher levels get a chance to
+            // run, but only once the group has used up its time slice.
             //
 
-            LIST_REMOVE(&(GroupEntry->Entry.ListEntry));
-            INSERT_BEFORE(&(GroupEntry->Entry.ListEntry),
-                          &(ParentGroupEntry->Children));
+            if (GroupEntry->Entry.Credit <= 0) {
+                LIST_REMOVE(&(GroupEntry->Entry.ListEntry));
+                INSERT_BEFORE(&(GroupEntry->Entry.ListEntry),
+                              &(ParentGroupEntry->Children));
+
+                KepRefillSchedulerEntryCredit(&(GroupEntry->Entry));
+            }
 
             GroupEntry = ParentGroupEntry;
         }
@@ -1126,7 +1950,7 @@ Return Value:
     }
 
     if (LockHeld == FALSE) {
-        KeReleaseSpinLock(&(Scheduler->Lock));
+        KeReleaseQueuedSpinLock(&(Scheduler->Lock));
     }
 
     return;
@@ -1135,7 +1959,7 @@ Return Value:
 PKTHREAD
 KepGetNextThread (
     PSCHEDULER_DATA Scheduler,
-    BOOL SkipRunning
+    ULONG Flags
     )
 
 /*++
@@ -1149,9 +1973,10 @@ Routine Description:
 
     Scheduler - Supplies a pointer to the scheduler to work on.
 
-    SkipRunning - Supplies a boolean indicating whether to ignore the first
-        thread on the queue if it's marked as running. This is used when trying
-        to steal threads from another scheduler.
+    Flags - Supplies a bitfield of flags governing which threads to pass over.
+        See SCHEDULER_SKIP_* definitions. Zero is used when picking the next
+        thread to run locally; the skip flags are used when trying to steal
+        threads from another scheduler.
 
 Return Value:
 
@@ -1165,8 +1990,10 @@ Return Value:
 
     PSCHEDULER_GROUP_ENTRY ChildGroupEntry;
     PLIST_ENTRY CurrentEntry;
+    ULONGLONG CurrentTime;
     PSCHEDULER_ENTRY Entry;
     PSCHEDULER_GROUP_ENTRY GroupEntry;
+    PLIST_ENTRY NextEntry;
     PKTHREAD Thread;
 
     GroupEntry = &(Scheduler->Group);
@@ -1174,18 +2001,67 @@ Return Value:
         return NULL;
     }
 
+    CurrentTime = 0;
+    if ((Flags & SCHEDULER_SKIP_CACHE_HOT) != 0) {
+        CurrentTime = HlQueryTimeCounter();
+    }
+
+    //
+    // Real-time threads always run ahead of fair share threads.
+    //
+
+    if (Scheduler->RealTimeReadyMask != 0) {
+        Thread = KepGetNextRealTimeThread(Scheduler, Flags, CurrentTime);
+        if (Thread != NULL) {
+            return Thread;
+        }
+    }
+
     CurrentEntry = GroupEntry->Children.Next;
     while (CurrentEntry != &(GroupEntry->Children)) {
+        Entry = LIST_VALUE(CurrentEntry, SCHEDULER_ENTRY, ListEntry);
 
         //
-        // Get the next child of the group. If it's a thread, return it.
+        // An entry still in debt from earlier slices gives up its turn to the
+        // siblings behind it, earning another slice's worth of credit as it
+        // moves to the back. This is how entries with small weights end up
+        // with less than a tick per round. The last entry in the list runs
+        // regardless, and entries are only shuffled when picking locally, not
+        // when another processor is looking for something to steal.
+        //
+
+        ChildGroupEntry = NULL;
+        if (Entry->Type == SchedulerEntryGroup) {
+            ChildGroupEntry = PARENT_STRUCTURE(Entry,
+                                               SCHEDULER_GROUP_ENTRY,
+                                               Entry);
+        }
+
+        if ((Flags == 0) &&
+            (Entry->Credit <= 0) &&
+            (CurrentEntry->Next != &(GroupEntry->Children)) &&
+            ((ChildGroupEntry == NULL) ||
+             (ChildGroupEntry->ReadyThreadCount != 0))) {
+
+            NextEntry = CurrentEntry->Next;
+            LIST_REMOVE(CurrentEntry);
+            INSERT_BEFORE(CurrentEntry, &(GroupEntry->Children));
+            KepRefillSchedulerEntryCredit(Entry);
+            CurrentEntry = NextEntry;
+            continue;
+        }
+
+        //
+        // If the child of the group is a thread, return it.
         //
 
-        Entry = LIST_VALUE(CurrentEntry, SCHEDULER_ENTRY, ListEntry);
         if (Entry->Type == SchedulerEntryThread) {
             Thread = PARENT_STRUCTURE(Entry, KTHREAD, SchedulerEntry);
-            if ((SkipRunning == FALSE) ||
-                (Thread->State != ThreadStateRunning)) {
+            if ((Flags == 0) ||
+                (KepIsThreadMigratable(Scheduler,
+                                       Thread,
+                                       Flags,
+                                       CurrentTime) != FALSE)) {
 
                 return Thread;
             }
@@ -1221,7 +2097,6 @@ Return Value:
 
         ASSERT(Entry->Type == SchedulerEntryGroup);
 
-        ChildGroupEntry = PARENT_STRUCTURE(Entry, SCHEDULER_GROUP_ENTRY, Entry);
         if (ChildGroupEntry->ReadyThreadCount == 0) {
             CurrentEntry = CurrentEntry->Next;
 
@@ -1243,6 +2118,233 @@ Return Value:
     return NULL;
 }
 
+PKTHREAD
+KepGetNextRealTimeThread (
+    PSCHEDULER_DATA Scheduler,
+    ULONG Flags,
+    ULONGLONG CurrentTime
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the highest priority ready real-time thread in the
+    scheduler. This routine assumes the scheduler lock is already held.
+
+Arguments:
+
+    Scheduler - Supplies a pointer to the scheduler to work on.
+
+    Flags - Supplies a bitfield of flags governing which threads to pass over.
+        See SCHEDULER_SKIP_* definitions.
+
+    CurrentTime - Supplies the current time counter value, used when skipping
+        cache hot threads.
+
+Return Value:
+
+    Returns a pointer to the next real-time thread to run.
+
+    NULL if no real-time threads are ready to run.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PLIST_ENTRY ListHead;
+    ULONG Mask;
+    ULONG Priority;
+    PKTHREAD Thread;
+
+    Mask = Scheduler->RealTimeReadyMask;
+    while (Mask != 0) {
+        Priority = (sizeof(ULONG) * BITS_PER_BYTE) - 1 -
+                   RtlCountLeadingZeros32(Mask);
+
+        ListHead = &(Scheduler->RealTimeQueues[Priority]);
+
+        ASSERT(LIST_EMPTY(ListHead) == FALSE);
+
+        CurrentEntry = ListHead->Next;
+        while (CurrentEntry != ListHead) {
+            Thread = LIST_VALUE(CurrentEntry,
+                                KTHREAD,
+                                SchedulerEntry.ListEntry);
+
+            if ((Flags == 0) ||
+                (KepIsThreadMigratable(Scheduler,
+                                       Thread,
+                                       Flags,
+                                       CurrentTime) != FALSE)) {
+
+                return Thread;
+            }
+
+            CurrentEntry = CurrentEntry->Next;
+        }
+
+        Mask &= ~(1U << Priority);
+    }
+
+    return NULL;
+}
+
+BOOL
+KepChargeSchedulerEntry (
+    PPROCESSOR_BLOCK Processor,
+    PSCHEDULER_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine charges the running thread and its parent groups for a clock
+    tick, if one has occurred since the last charge. This routine assumes the
+    scheduler lock is already held.
+
+Arguments:
+
+    Processor - Supplies a pointer to the current processor block.
+
+    Entry - Supplies a pointer to the scheduler entry of the running thread.
+
+Return Value:
+
+    TRUE if the thread's time slice has expired and it should be rotated to
+    the back of its queue.
+
+    FALSE if the thread should keep its place.
+
+--*/
+
+{
+
+    BOOL Expired;
+    PSCHEDULER_GROUP_ENTRY GroupEntry;
+    PSCHEDULER_DATA Scheduler;
+
+    Scheduler = &(Processor->Scheduler);
+
+    //
+    // Dispatch interrupts also come from DPCs and timers. Only charge for
+    // actual clock ticks.
+    //
+
+    if (Processor->Clock.InterruptCount == Scheduler->LastTick) {
+        return FALSE;
+    }
+
+    Scheduler->LastTick = Processor->Clock.InterruptCount;
+    if (Entry->Class == SchedulerClassRealTimeFifo) {
+        return FALSE;
+    }
+
+    KepDebitSchedulerEntryCredit(Entry);
+    Expired = FALSE;
+    if (Entry->Credit <= 0) {
+        Expired = TRUE;
+    }
+
+    //
+    // Charge the enclosing groups as well. Their slices are checked the next
+    // time a thread inside them leaves the ready queue.
+    //
+
+    if (IS_REAL_TIME_SCHEDULER_ENTRY(Entry)) {
+        return Expired;
+    }
+
+    GroupEntry = PARENT_STRUCTURE(Entry->Parent, SCHEDULER_GROUP_ENTRY, Entry);
+    while (GroupEntry->Entry.Parent != NULL) {
+        KepDebitSchedulerEntryCredit(&(GroupEntry->Entry));
+
+        GroupEntry = PARENT_STRUCTURE(GroupEntry->Entry.Parent,
+                                      SCHEDULER_GROUP_ENTRY,
+                                      Entry);
+    }
+
+    return Expired;
+}
+
+VOID
+KepDebitSchedulerEntryCredit (
+    PSCHEDULER_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine charges the given scheduler entry for a clock tick of run
+    time. The entry may go into debt, up to a limit.
+
+Arguments:
+
+    Entry - Supplies a pointer to the entry to charge.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    Entry->Credit -= SCHEDULER_TICK_CREDIT;
+    if (Entry->Credit < SCHEDULER_MINIMUM_CREDIT) {
+        Entry->Credit = SCHEDULER_MINIMUM_CREDIT;
+    }
+
+    return;
+}
+
+VOID
+KepRefillSchedulerEntryCredit (
+    PSCHEDULER_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts a new time slice for the given scheduler entry by
+    adding credit in proportion to its weight. Any debt left over from the
+    previous slice is paid off first, so an entry with a small weight may
+    still be in debt afterwards.
+
+Arguments:
+
+    Entry - Supplies a pointer to the entry to refill.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    LONG Credit;
+
+    if (IS_REAL_TIME_SCHEDULER_ENTRY(Entry)) {
+        Entry->Credit = SCHEDULER_DEFAULT_SLICE_TICKS * SCHEDULER_TICK_CREDIT;
+        return;
+    }
+
+    Credit = Entry->Credit +
+             (LONG)(Entry->Weight * SCHEDULER_DEFAULT_SLICE_TICKS);
+
+    if (Credit > SCHEDULER_MAXIMUM_CREDIT) {
+        Credit = SCHEDULER_MAXIMUM_CREDIT;
+    }
+
+    Entry->Credit = Credit;
+    return;
+}
+
 KSTATUS
 KepCreateSchedulerGroup (
     PSCHEDULER_GROUP *NewGroup
@@ -1315,6 +2417,7 @@ Return Value:
     Group->Entries = (PSCHEDULER_GROUP_ENTRY)(Group + 1);
     Group->EntryCount = EntryCount;
     Group->Parent = ParentGroup;
+    Group->Weight = SCHEDULER_DEFAULT_WEIGHT;
 
     //
     // Add the group to the global tree.
@@ -1436,6 +2539,10 @@ Return Value:
 {
 
     GroupEntry->Entry.Type = SchedulerEntryGroup;
+    GroupEntry->Entry.Class = SchedulerClassFairShare;
+    GroupEntry->Entry.Priority = SCHEDULER_NICE_DEFAULT;
+    GroupEntry->Entry.Weight = Group->Weight;
+    GroupEntry->Entry.Credit = 0;
     if (ParentEntry == NULL) {
         GroupEntry->Entry.Parent = NULL;
 
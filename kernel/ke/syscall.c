@@ -224,6 +224,22 @@ SYSTEM_CALL_TABLE_ENTRY KeSystemCallTable[SystemCallCount] = {
     {MmSysSetBreak,
         sizeof(SYSTEM_CALL_SET_BREAK),
         sizeof(SYSTEM_CALL_SET_BREAK)},
+    {PsSysSetScheduling,
+        sizeof(SYSTEM_CALL_SET_SCHEDULING),
+        sizeof(SYSTEM_CALL_SET_SCHEDULING)},
+    {IoSysCreateEventQueue,
+        sizeof(SYSTEM_CALL_CREATE_EVENT_QUEUE),
+        sizeof(SYSTEM_CALL_CREATE_EVENT_QUEUE)},
+    {IoSysEventQueueControl, sizeof(SYSTEM_CALL_EVENT_QUEUE_CONTROL), 0},
+    {IoSysEventQueueWait, sizeof(SYSTEM_CALL_EVENT_QUEUE_WAIT), 0},
+    {IoSysSendFile, sizeof(SYSTEM_CALL_SEND_FILE), 0},
+    {PsSysSpawnProcess,
+        sizeof(SYSTEM_CALL_SPAWN_PROCESS),
+        sizeof(SYSTEM_CALL_SPAWN_PROCESS)},
+    {IoSysCreateIoRing,
+        sizeof(SYSTEM_CALL_CREATE_IO_RING),
+        sizeof(SYSTEM_CALL_CREATE_IO_RING)},
+    {IoSysIoRingEnter, sizeof(SYSTEM_CALL_IO_RING_ENTER), 0},
 };
 
 //
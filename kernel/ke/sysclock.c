@@ -725,6 +725,7 @@ Return Value:
     }
 
     KepMaintainClock(ProcessorBlock);
+    KepUpdateSchedulerLoad(ProcessorBlock);
 
     //
     // Queue a dispatch interrupt to run the scheduler.
@@ -48,9 +48,9 @@ Module Name:
 //
 
 //
-// This bit is set when the work item is actively in a queue. It cannot be
-// used directly to prevent double-queuing, as it is subject to multiprocessor
-// races if used that way.
+// This bit is set when the work item is actively in a queue. Queuers on
+// different processors take different lane locks, so it is claimed with an
+// atomic compare exchange rather than under a lock.
 //
 
 #define WORK_ITEM_FLAG_QUEUED 0x00000001
@@ -63,6 +63,62 @@ Module Name:
 
 #define WORK_ITEM_FLAG_SUPPORT_DISPATCH_LEVEL 0x00000002
 
+//
+// This bit is set while a worker thread is running the work item. A work item
+// never runs on two workers at once: queuing it while it runs is deferred
+// until the run finishes.
+//
+
+#define WORK_ITEM_FLAG_RUNNING 0x00000004
+
+//
+// This bit is set if the work item was queued while it was running, and needs
+// to go back on its queue once the current run finishes.
+//
+
+#define WORK_ITEM_FLAG_REQUEUE 0x00000008
+
+//
+// This bit is set if the deferred queuing was accounted to flush color 1
+// rather than flush color 0.
+//
+
+#define WORK_ITEM_FLAG_REQUEUE_COLOR 0x00000010
+
+//
+// Define the largest number of per-processor lanes a work queue will have.
+// Processors beyond this share lanes.
+//
+
+#define WORK_QUEUE_MAXIMUM_LANES 64
+
+//
+// Define the number of worker threads a queue keeps even when idle.
+//
+
+#define WORK_QUEUE_MINIMUM_THREAD_COUNT 1
+
+//
+// Define the number of worker threads per processor a queue may grow to when
+// its workers are blocked.
+//
+
+#define WORK_QUEUE_THREADS_PER_PROCESSOR 4
+
+//
+// Define how long an extra worker thread waits for work before exiting, in
+// milliseconds.
+//
+
+#define WORK_QUEUE_IDLE_TIMEOUT 5000
+
+//
+// Define the interval at which the work queue manager looks for stalled
+// queues, in milliseconds.
+//
+
+#define WORK_QUEUE_MANAGER_PERIOD 50
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -71,47 +127,133 @@ Module Name:
 
 Structure Description:
 
-    This structure defines a work queue.
+    This structure defines a per-processor lane of a work queue. Work items
+    are queued to the lane of the processor that queued them, and workers
+    prefer the lane of the processor they are running on before stealing
+    from other lanes.
 
 Members:
 
-    State - Stoers a pointer to the current work queue state.
-
     Lock - Stores either a pointer to a queued lock or a spin lock protecting
-        the work item list, depending on whether the queue needs to accept
+        the lane's lists, depending on whether the queue needs to accept
         work items at dispatch level.
 
-    WorkItemListHead - Stores the head of the list of work items to execute.
+    HighListHead - Stores the head of the list of high priority work items.
+
+    NormalListHead - Stores the head of the list of normal priority work
+        items.
+
+    QueuedCount - Stores the total number of work items queued to the lane.
+
+    HighPriorityCount - Stores the total number of high priority work items
+        queued to the lane.
+
+    StolenCount - Stores the number of work items taken from this lane by a
+        worker running on another processor.
+
+    TotalLatency - Stores the sum of the time counter ticks work items from
+        this lane spent waiting to be picked up.
+
+    MaximumLatency - Stores the longest time in time counter ticks a work
+        item from this lane waited to be picked up.
+
+--*/
+
+typedef struct _WORK_QUEUE_LANE {
+    union {
+        PQUEUED_LOCK QueuedLock;
+        KSPIN_LOCK SpinLock;
+    } Lock;
+
+    LIST_ENTRY HighListHead;
+    LIST_ENTRY NormalListHead;
+    UINTN QueuedCount;
+    UINTN HighPriorityCount;
+    UINTN StolenCount;
+    ULONGLONG TotalLatency;
+    ULONGLONG MaximumLatency;
+} WORK_QUEUE_LANE, *PWORK_QUEUE_LANE;
+
+/*++
+
+Structure Description:
+
+    This structure defines a work queue.
+
+Members:
+
+    State - Stoers a pointer to the current work queue state.
 
-    WorkItemCount - Stores the number of work items currently queued.
+    ListEntry - Stores pointers to the next and previous work queues in the
+        global list watched by the work queue manager.
 
     Event - Stores a pointer to the event used to kick the work item threads
         into action.
 
+    FlushEvent - Stores a pointer to the event signaled whenever the number
+        of outstanding work items of a flush color drops to zero.
+
+    FlushLock - Stores a pointer to the lock serializing flushes.
+
     Flags - Stores a bitfield of flags governing the behavior of the work
         queue. See WORK_QUEUE_FLAG_* definitions.
 
     CurrentThreadCount - Stores the number of threads that are alive and
         processing (or waiting on) the work queue.
 
+    IdleThreadCount - Stores the number of threads waiting for work.
+
+    PeakThreadCount - Stores the largest number of threads the queue has had.
+
+    StallThreadCount - Stores the number of threads the manager created
+        because the existing workers stopped making progress.
+
+    PendingCount - Stores the number of work items sitting on the lanes.
+
+    CompletedCount - Stores the number of work items that have finished
+        running.
+
+    FlushColor - Stores the color new work items are tagged with. A flush
+        flips the color and waits for the old color to drain.
+
+    ColorCount - Stores the number of queued or running work items of each
+        color.
+
+    ManagerCompletedCount - Stores the completed count the manager saw at its
+        last check, used to detect that all workers are blocked.
+
+    ManagerCheckTime - Stores the time counter value of the manager's last
+        progress check.
+
     Name - Stores a pointer to a string containing the name of the worker
         threads.
 
+    LaneCount - Stores the number of elements in the lane array.
+
+    Lanes - Stores a pointer to the array of per-processor lanes.
+
 --*/
 
 struct _WORK_QUEUE {
     volatile WORK_QUEUE_STATE State;
-    union {
-        PQUEUED_LOCK QueuedLock;
-        KSPIN_LOCK SpinLock;
-    } Lock;
-
-    LIST_ENTRY WorkItemListHead;
-    UINTN WorkItemCount;
+    LIST_ENTRY ListEntry;
     PKEVENT Event;
+    PKEVENT FlushEvent;
+    PQUEUED_LOCK FlushLock;
     ULONG Flags;
     volatile ULONG CurrentThreadCount;
+    volatile ULONG IdleThreadCount;
+    ULONG PeakThreadCount;
+    UINTN StallThreadCount;
+    volatile ULONG PendingCount;
+    volatile UINTN CompletedCount;
+    volatile ULONG FlushColor;
+    volatile UINTN ColorCount[2];
+    UINTN ManagerCompletedCount;
+    ULONGLONG ManagerCheckTime;
     PSTR Name;
+    ULONG LaneCount;
+    PWORK_QUEUE_LANE Lanes;
 };
 
 /*++
@@ -124,13 +266,15 @@ Structure Description:
 Members:
 
     ListEntry - Stores pointers to the next and previous work items in the
-        work queue. The work queue is sorted by priority.
+        lane list for the work item's priority.
 
     ReferenceCount - Stores the reference count of the work item.
 
     Queue - Stores a pointer to the queue this work item was or will be
         put on.
 
+    Lane - Stores a pointer to the lane the work item was last queued to.
+
     Event - Stores a pointer to an event that is signaled when the work item
         completes.
 
@@ -140,8 +284,13 @@ Structure Description:
 
     Priority - Stores the priority of the work item.
 
-    Flags - Stores a pointer to internal flags used by the operating system.
-        Do not modify these directly. See WORK_ITEM_FLAG_* definitions.
+    Flags - Stores a bitfield of internal flags used by the operating system.
+        The queued, running, and requeue flags are only changed atomically.
+        See WORK_ITEM_FLAG_* definitions.
+
+    Color - Stores the flush color the work item was queued with.
+
+    QueueTime - Stores the time counter value when the work item was queued.
 
 --*/
 
@@ -149,11 +298,14 @@ struct _WORK_ITEM {
     LIST_ENTRY ListEntry;
     UINTN ReferenceCount;
     PWORK_QUEUE Queue;
+    PWORK_QUEUE_LANE Lane;
     PKEVENT Event;
     PWORK_ITEM_ROUTINE Routine;
     PVOID Parameter;
     WORK_PRIORITY Priority;
-    ULONG Flags;
+    volatile ULONG Flags;
+    ULONG Color;
+    ULONGLONG QueueTime;
 };
 
 //
@@ -164,6 +316,73 @@ VOID
 KepWorkerThread (
     );
 
+VOID
+KepWorkQueueManagerThread (
+    PVOID Parameter
+    );
+
+VOID
+KepBalanceWorkQueue (
+    PWORK_QUEUE Queue,
+    ULONG ProcessorCount,
+    ULONGLONG CurrentTime,
+    ULONGLONG Period
+    );
+
+KSTATUS
+KepCreateWorkerThread (
+    PWORK_QUEUE Queue
+    );
+
+BOOL
+KepTrimWorkerThread (
+    PWORK_QUEUE Queue
+    );
+
+VOID
+KepExitWorkerThread (
+    PWORK_QUEUE Queue
+    );
+
+PWORK_ITEM
+KepDequeueWorkItem (
+    PWORK_QUEUE Queue,
+    PULONG Color
+    );
+
+VOID
+KepInsertWorkItem (
+    PWORK_QUEUE Queue,
+    PWORK_ITEM WorkItem,
+    ULONG Color
+    );
+
+VOID
+KepFinishWorkItem (
+    PWORK_QUEUE Queue,
+    PWORK_ITEM WorkItem,
+    ULONG Color
+    );
+
+VOID
+KepReleaseWorkItemColor (
+    PWORK_QUEUE Queue,
+    ULONG Color
+    );
+
+RUNLEVEL
+KepAcquireWorkQueueLane (
+    PWORK_QUEUE Queue,
+    PWORK_QUEUE_LANE Lane
+    );
+
+VOID
+KepReleaseWorkQueueLane (
+    PWORK_QUEUE Queue,
+    PWORK_QUEUE_LANE Lane,
+    RUNLEVEL OldRunLevel
+    );
+
 VOID
 KepDestroyWorkQueue (
     PWORK_QUEUE Queue
@@ -189,6 +408,15 @@ KepWorkItemReleaseReference (
 
 PWORK_QUEUE KeSystemWorkQueue = NULL;
 
+//
+// Store the list of all work queues, the lock protecting it, and the event
+// used to wake the work queue manager thread.
+//
+
+LIST_ENTRY KeWorkQueueListHead;
+PQUEUED_LOCK KeWorkQueueListLock = NULL;
+PKEVENT KeWorkQueueManagerEvent = NULL;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -226,11 +454,17 @@ Return Value:
 
 {
 
+    UINTN AllocationSize;
+    PWORK_QUEUE_LANE Lane;
+    ULONG LaneCount;
+    ULONG LaneIndex;
     ULONG NameSize;
     BOOL NonPaged;
     PWORK_QUEUE Queue;
     KSTATUS Status;
 
+    ASSERT(KeWorkQueueListLock != NULL);
+
     //
     // Parse the flags.
     //
@@ -241,14 +475,24 @@ Return Value:
     }
 
     //
-    // Create and initialize the work queue structure.
+    // Create and initialize the work queue structure, with one lane per
+    // processor tacked onto the end.
     //
 
+    LaneCount = HlGetMaximumProcessorCount();
+    if (LaneCount == 0) {
+        LaneCount = 1;
+
+    } else if (LaneCount > WORK_QUEUE_MAXIMUM_LANES) {
+        LaneCount = WORK_QUEUE_MAXIMUM_LANES;
+    }
+
+    AllocationSize = sizeof(WORK_QUEUE) + (LaneCount * sizeof(WORK_QUEUE_LANE));
     if (NonPaged != FALSE) {
-        Queue = MmAllocateNonPagedPool(sizeof(WORK_QUEUE), KE_ALLOCATION_TAG);
+        Queue = MmAllocateNonPagedPool(AllocationSize, KE_ALLOCATION_TAG);
 
     } else {
-        Queue = MmAllocatePagedPool(sizeof(WORK_QUEUE), KE_ALLOCATION_TAG);
+        Queue = MmAllocatePagedPool(AllocationSize, KE_ALLOCATION_TAG);
     }
 
     if (Queue == NULL) {
@@ -256,7 +500,10 @@ Return Value:
         goto CreateWorkQueueEnd;
     }
 
-    RtlZeroMemory(Queue, sizeof(WORK_QUEUE));
+    RtlZeroMemory(Queue, AllocationSize);
+    Queue->Flags = Flags;
+    Queue->LaneCount = LaneCount;
+    Queue->Lanes = (PWORK_QUEUE_LANE)(Queue + 1);
 
     //
     // Create a copy of the name, if supplied.
@@ -273,62 +520,66 @@ Return Value:
         RtlStringCopy(Queue->Name, Name, NameSize);
     }
 
-    if (NonPaged != FALSE) {
-        KeInitializeSpinLock(&(Queue->Lock.SpinLock));
+    for (LaneIndex = 0; LaneIndex < LaneCount; LaneIndex += 1) {
+        Lane = &(Queue->Lanes[LaneIndex]);
+        if (NonPaged != FALSE) {
+            KeInitializeSpinLock(&(Lane->Lock.SpinLock));
 
-    } else {
-        Queue->Lock.QueuedLock = KeCreateQueuedLock();
-        if (Queue->Lock.QueuedLock == NULL) {
-            Status = STATUS_INSUFFICIENT_RESOURCES;
-            goto CreateWorkQueueEnd;
+        } else {
+            Lane->Lock.QueuedLock = KeCreateQueuedLock();
+            if (Lane->Lock.QueuedLock == NULL) {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto CreateWorkQueueEnd;
+            }
         }
+
+        INITIALIZE_LIST_HEAD(&(Lane->HighListHead));
+        INITIALIZE_LIST_HEAD(&(Lane->NormalListHead));
     }
 
-    INITIALIZE_LIST_HEAD(&(Queue->WorkItemListHead));
     Queue->Event = KeCreateEvent(NULL);
     if (Queue->Event == NULL) {
         Status = STATUS_INSUFFICIENT_RESOURCES;
         goto CreateWorkQueueEnd;
     }
 
-    Queue->Flags = Flags;
+    Queue->FlushEvent = KeCreateEvent(NULL);
+    if (Queue->FlushEvent == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateWorkQueueEnd;
+    }
+
+    Queue->FlushLock = KeCreateQueuedLock();
+    if (Queue->FlushLock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateWorkQueueEnd;
+    }
+
     Queue->State = WorkQueueStateOpen;
+    Queue->ManagerCheckTime = HlQueryTimeCounter();
 
     //
-    // Create a worker thread.
+    // Create the first worker thread. The manager adds more as work backs up.
+    // The thread count is accounted here rather than in the thread so that
+    // the manager never sees a live queue with no threads.
     //
 
+    Queue->CurrentThreadCount = 1;
+    Queue->PeakThreadCount = 1;
+    KeAcquireQueuedLock(KeWorkQueueListLock);
+    INSERT_BEFORE(&(Queue->ListEntry), &KeWorkQueueListHead);
     Status = PsCreateKernelThread(KepWorkerThread, Queue, Name);
     if (!KSUCCESS(Status)) {
-        goto CreateWorkQueueEnd;
+        LIST_REMOVE(&(Queue->ListEntry));
+        Queue->CurrentThreadCount = 0;
     }
 
-    Status = STATUS_SUCCESS;
+    KeReleaseQueuedLock(KeWorkQueueListLock);
 
 CreateWorkQueueEnd:
     if (!KSUCCESS(Status)) {
         if (Queue != NULL) {
-            if (Queue->Name != NULL) {
-                MmFreePagedPool(Queue->Name);
-            }
-
-            if (NonPaged == FALSE) {
-                if (Queue->Lock.QueuedLock != NULL) {
-                    KeDestroyQueuedLock(Queue->Lock.QueuedLock);
-                }
-            }
-
-            if (Queue->Event != NULL) {
-                KeDestroyEvent(Queue->Event);
-            }
-
-            if (NonPaged != FALSE) {
-                MmFreeNonPagedPool(Queue);
-
-            } else {
-                MmFreePagedPool(Queue);
-            }
-
+            KepDestroyWorkQueue(Queue);
             Queue = NULL;
         }
     }
@@ -431,13 +682,10 @@ Return Value:
 
 {
 
-    BOOL DispatchLevel;
-    RUNLEVEL OldRunLevel;
-    PWORK_ITEM Sentinal;
+    ULONG OldColor;
 
-    ASSERT(KeGetRunLevel() <= RunLevelDispatch);
+    ASSERT(KeGetRunLevel() == RunLevelLow);
 
-    OldRunLevel = RunLevelCount;
     if (WorkQueue == NULL) {
         WorkQueue = KeSystemWorkQueue;
     }
@@ -447,66 +695,27 @@ Return Value:
            (WorkQueue->State != WorkQueueStateDestroying) &&
            (WorkQueue->State != WorkQueueStateDestroyed));
 
-    DispatchLevel = FALSE;
-    if ((WorkQueue->Flags & WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
-        DispatchLevel = TRUE;
-    }
-
-    //
-    // Acquire the queue's lock at the appropriate run level.
-    //
-
-    if (DispatchLevel != FALSE) {
-        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
-        KeAcquireSpinLock(&(WorkQueue->Lock.SpinLock));
-
-    } else {
-        KeAcquireQueuedLock(WorkQueue->Lock.QueuedLock);
-    }
-
     //
-    // If the queue is empty, then there is no sentinal to record and no work
-    // to do.
+    // With several workers pulling from several lanes there is no single last
+    // item to wait on. Instead, flip the color new work items are tagged with
+    // and wait for everything queued or running under the old color to
+    // drain. Flushes are serialized so that each one flips to a color that a
+    // previous flush has already drained.
     //
 
-    if (LIST_EMPTY(&(WorkQueue->WorkItemListHead)) != FALSE) {
-        Sentinal = NULL;
-
-    //
-    // Otherwise, record the last item in the work queue and signal the worker
-    // threads.
-    //
-
-    } else {
-        Sentinal = (PWORK_ITEM)LIST_VALUE(WorkQueue->WorkItemListHead.Previous,
-                                          WORK_ITEM,
-                                          ListEntry);
-
-        ASSERT(Sentinal != NULL);
-
-        KeSignalEvent(WorkQueue->Event, SignalOptionSignalAll);
-    }
-
-    //
-    // Unlock the list to let work proceed.
-    //
-
-    if (DispatchLevel != FALSE) {
-        KeReleaseSpinLock(&(WorkQueue->Lock.SpinLock));
-        KeLowerRunLevel(OldRunLevel);
-
-    } else {
-        KeReleaseQueuedLock(WorkQueue->Lock.QueuedLock);
-    }
-
-    //
-    // If there is a sentinal, wait on it to complete.
-    //
+    KeAcquireQueuedLock(WorkQueue->FlushLock);
+    OldColor = WorkQueue->FlushColor;
+    RtlAtomicExchange32(&(WorkQueue->FlushColor), OldColor ^ 1);
+    while (TRUE) {
+        KeSignalEvent(WorkQueue->FlushEvent, SignalOptionUnsignal);
+        if (WorkQueue->ColorCount[OldColor] == 0) {
+            break;
+        }
 
-    if (Sentinal != NULL) {
-        KeWaitForEvent(Sentinal->Event, FALSE, WAIT_TIME_INDEFINITE);
+        KeWaitForEvent(WorkQueue->FlushEvent, FALSE, WAIT_TIME_INDEFINITE);
     }
 
+    KeReleaseQueuedLock(WorkQueue->FlushLock);
     return;
 }
 
@@ -695,21 +904,52 @@ Return Value:
 
 {
 
-    BOOL DispatchLevel;
+    ULONG Color;
+    PWORK_QUEUE_LANE Lane;
+    ULONG NewFlags;
+    ULONG OldFlags;
     RUNLEVEL OldRunLevel;
     PWORK_QUEUE Queue;
     KSTATUS Status;
 
-    OldRunLevel = RunLevelCount;
-
     ASSERT(KeGetRunLevel() <= RunLevelDispatch);
 
+    Color = 0;
+
+    //
+    // If the work item was queued while running, just call off the deferred
+    // queuing. The running worker sees that it was called off and signals the
+    // work item's event when it is done.
+    //
+
+    while (TRUE) {
+        OldFlags = WorkItem->Flags;
+        if ((OldFlags & WORK_ITEM_FLAG_REQUEUE) == 0) {
+            break;
+        }
+
+        NewFlags = OldFlags &
+                   ~(WORK_ITEM_FLAG_REQUEUE | WORK_ITEM_FLAG_REQUEUE_COLOR);
+
+        if (RtlAtomicCompareExchange32(&(WorkItem->Flags),
+                                       NewFlags,
+                                       OldFlags) == OldFlags) {
+
+            if ((OldFlags & WORK_ITEM_FLAG_REQUEUE_COLOR) != 0) {
+                Color = 1;
+            }
+
+            KepReleaseWorkItemColor(WorkItem->Queue, Color);
+            return STATUS_SUCCESS;
+        }
+    }
+
     //
     // Quickly return "too late" if the work item is not queued. It may be
     // about to run or running, or it might not have been queued.
     //
 
-    if ((WorkItem->Flags & WORK_ITEM_FLAG_QUEUED) == 0) {
+    if ((OldFlags & WORK_ITEM_FLAG_QUEUED) == 0) {
         return STATUS_TOO_LATE;
     }
 
@@ -729,39 +969,42 @@ Return Value:
     }
 
     //
-    // Determine whether or not to raise to dispatch level before acquiring
-    // the lock.
+    // Acquire the lock of the lane the work item was queued to. If the work
+    // item ran and was queued again to a different lane in the meantime, go
+    // chase it there. A work item claimed for queuing but not yet placed on a
+    // lane is as good as running.
     //
 
-    DispatchLevel = FALSE;
-    if ((Queue->Flags & WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
-        DispatchLevel = TRUE;
-    }
+    while (TRUE) {
+        Lane = WorkItem->Lane;
+        if (Lane == NULL) {
+            return STATUS_TOO_LATE;
+        }
 
-    //
-    // Acquire the work queue lock.
-    //
+        OldRunLevel = KepAcquireWorkQueueLane(Queue, Lane);
+        if (((WorkItem->Flags & WORK_ITEM_FLAG_QUEUED) == 0) ||
+            (WorkItem->Lane == Lane)) {
 
-    if (DispatchLevel != FALSE) {
-        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
-        KeAcquireSpinLock(&(Queue->Lock.SpinLock));
+            break;
+        }
 
-    } else {
-        KeAcquireQueuedLock(Queue->Lock.QueuedLock);
+        KepReleaseWorkQueueLane(Queue, Lane, OldRunLevel);
     }
 
     //
     // Now that the lock is held, check again to see if the work item was
-    // selected to run and pulled off the list.
+    // selected to run and pulled off the list, or has not made it onto the
+    // list yet.
     //
 
-    if ((WorkItem->Flags & WORK_ITEM_FLAG_QUEUED) == 0) {
+    if (((WorkItem->Flags & WORK_ITEM_FLAG_QUEUED) == 0) ||
+        (WorkItem->ListEntry.Next == NULL)) {
+
         WorkItem = NULL;
         Status = STATUS_TOO_LATE;
         goto CancelWorkItemEnd;
     }
 
-    ASSERT((WorkItem->Flags & WORK_ITEM_FLAG_QUEUED) != 0);
     ASSERT(WorkItem->ListEntry.Next != NULL);
 
     //
@@ -770,21 +1013,16 @@ Return Value:
 
     LIST_REMOVE(&(WorkItem->ListEntry));
     WorkItem->ListEntry.Next = NULL;
-    Queue->WorkItemCount -= 1;
-    WorkItem->Flags &= ~WORK_ITEM_FLAG_QUEUED;
+    RtlAtomicAdd32(&(Queue->PendingCount), -1);
+    RtlAtomicAnd32(&(WorkItem->Flags), ~WORK_ITEM_FLAG_QUEUED);
+    Color = WorkItem->Color;
     KeSignalEvent(WorkItem->Event, SignalOptionSignalAll);
     Status = STATUS_SUCCESS;
 
 CancelWorkItemEnd:
-    if (DispatchLevel != FALSE) {
-        KeReleaseSpinLock(&(Queue->Lock.SpinLock));
-        KeLowerRunLevel(OldRunLevel);
-
-    } else {
-        KeReleaseQueuedLock(Queue->Lock.QueuedLock);
-    }
-
+    KepReleaseWorkQueueLane(Queue, Lane, OldRunLevel);
     if (WorkItem != NULL) {
+        KepReleaseWorkItemColor(Queue, Color);
         KepWorkItemReleaseReference(WorkItem);
     }
 
@@ -801,7 +1039,8 @@ KeFlushWorkItem (
 
 Routine Description:
 
-    This routine does not return until the given work item has completed.
+    This routine does not return until the given work item has completed,
+    including any run that was queued while it was running.
 
 Arguments:
 
@@ -815,7 +1054,24 @@ Return Value:
 
 {
 
-    KeWaitForEvent(WorkItem->Event, FALSE, WAIT_TIME_INDEFINITE);
+    //
+    // The worker signals the event just after it drops the running state. A
+    // queuing that lands in between can leave the event signaled while the
+    // work item is queued again, so wait that out as well.
+    //
+
+    while (TRUE) {
+        KeWaitForEvent(WorkItem->Event, FALSE, WAIT_TIME_INDEFINITE);
+        if ((WorkItem->Flags &
+             (WORK_ITEM_FLAG_QUEUED | WORK_ITEM_FLAG_RUNNING |
+              WORK_ITEM_FLAG_REQUEUE)) == 0) {
+
+            break;
+        }
+
+        KeYield();
+    }
+
     return;
 }
 
@@ -855,7 +1111,9 @@ Return Value:
 
 {
 
-    if ((WorkItem->Flags & WORK_ITEM_FLAG_QUEUED) != 0) {
+    if ((WorkItem->Flags &
+         (WORK_ITEM_FLAG_QUEUED | WORK_ITEM_FLAG_REQUEUE)) != 0) {
+
         KeCrashSystem(CRASH_WORK_ITEM_CORRUPTION,
                       WORK_ITEM_CRASH_MODIFY_QUEUED_ITEM,
                       (UINTN)WorkItem,
@@ -896,16 +1154,16 @@ Return Value:
 
 {
 
-    BOOL DispatchLevel;
-    RUNLEVEL OldRunLevel;
+    ULONG Color;
+    ULONG NewFlags;
+    ULONG OldFlags;
     PWORK_QUEUE Queue;
-    KSTATUS Status;
-
-    OldRunLevel = RunLevelCount;
 
     ASSERT(KeGetRunLevel() <= RunLevelDispatch);
 
-    if ((WorkItem->Flags & WORK_ITEM_FLAG_QUEUED) != 0) {
+    if ((WorkItem->Flags &
+         (WORK_ITEM_FLAG_QUEUED | WORK_ITEM_FLAG_REQUEUE)) != 0) {
+
         return STATUS_RESOURCE_IN_USE;
     }
 
@@ -921,85 +1179,52 @@ Return Value:
     }
 
     //
-    // Determine whether or not to raise to dispatch level before acquiring
-    // the lock.
+    // Account for the work item under the current flush color before it can
+    // be seen as queued, so that a flush cannot miss it.
     //
 
-    DispatchLevel = FALSE;
-    if ((Queue->Flags & WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
-        DispatchLevel = TRUE;
-    }
-
-    KepWorkItemAddReference(WorkItem);
+    Color = Queue->FlushColor;
+    RtlAtomicAdd(&(Queue->ColorCount[Color]), 1);
 
     //
-    // Acquire the work queue lock.
+    // Claim the work item. If a worker is running it, ask that worker to put
+    // it back on the queue when it finishes rather than letting a second
+    // worker run it at the same time.
     //
 
-    if (DispatchLevel != FALSE) {
-        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
-        KeAcquireSpinLock(&(Queue->Lock.SpinLock));
-
-    } else {
-        KeAcquireQueuedLock(Queue->Lock.QueuedLock);
-    }
-
-    //
-    // Now that the lock is held, check again to see if someone else snuck in
-    // and queued this work item.
-    //
-
-    if ((WorkItem->Flags & WORK_ITEM_FLAG_QUEUED) != 0) {
-        Status = STATUS_RESOURCE_IN_USE;
-        goto QueueWorkItemEnd;
-    }
-
-    //
-    // Mark the work item as having been queued now that the lock is held.
-    //
-
-    WorkItem->Flags |= WORK_ITEM_FLAG_QUEUED;
-    KeSignalEvent(WorkItem->Event, SignalOptionUnsignal);
-
-    //
-    // Insert high priority items on the beginning of the list, and normal items
-    // on the end.
-    //
-
-    if (WorkItem->Priority == WorkPriorityHigh) {
-        INSERT_AFTER(&(WorkItem->ListEntry), &(Queue->WorkItemListHead));
-
-    } else {
-        INSERT_BEFORE(&(WorkItem->ListEntry), &(Queue->WorkItemListHead));
-    }
-
-    Queue->WorkItemCount += 1;
-    WorkItem = NULL;
-    Status = STATUS_SUCCESS;
+    while (TRUE) {
+        OldFlags = WorkItem->Flags;
+        if ((OldFlags &
+             (WORK_ITEM_FLAG_QUEUED | WORK_ITEM_FLAG_REQUEUE)) != 0) {
 
-QueueWorkItemEnd:
-    if (DispatchLevel != FALSE) {
-        KeReleaseSpinLock(&(Queue->Lock.SpinLock));
-        KeLowerRunLevel(OldRunLevel);
+            KepReleaseWorkItemColor(Queue, Color);
+            return STATUS_RESOURCE_IN_USE;
+        }
 
-    } else {
-        KeReleaseQueuedLock(Queue->Lock.QueuedLock);
-    }
+        if ((OldFlags & WORK_ITEM_FLAG_RUNNING) != 0) {
+            NewFlags = OldFlags | WORK_ITEM_FLAG_REQUEUE;
+            if (Color != 0) {
+                NewFlags |= WORK_ITEM_FLAG_REQUEUE_COLOR;
+            }
 
-    if (KSUCCESS(Status)) {
+        } else {
+            NewFlags = OldFlags | WORK_ITEM_FLAG_QUEUED;
+        }
 
-        //
-        // Signal the event to kick off the worker threads.
-        //
+        if (RtlAtomicCompareExchange32(&(WorkItem->Flags),
+                                       NewFlags,
+                                       OldFlags) == OldFlags) {
 
-        KeSignalEvent(Queue->Event, SignalOptionSignalAll);
+            break;
+        }
     }
 
-    if (WorkItem != NULL) {
-        KepWorkItemReleaseReference(WorkItem);
+    if ((NewFlags & WORK_ITEM_FLAG_QUEUED) != 0) {
+        KepWorkItemAddReference(WorkItem);
+        KepInsertWorkItem(Queue, WorkItem, Color);
     }
 
-    return Status;
+    return STATUS_SUCCESS;
 }
 
 KERNEL_API
@@ -1072,6 +1297,85 @@ Return Value:
     return Status;
 }
 
+KERNEL_API
+VOID
+KeGetWorkQueueStatistics (
+    PWORK_QUEUE WorkQueue,
+    PWORK_QUEUE_STATISTICS Statistics
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns a snapshot of the statistics for a work queue. The
+    counters are gathered without synchronization, so they may be slightly
+    inconsistent with each other.
+
+Arguments:
+
+    WorkQueue - Supplies a pointer to the work queue to query. Supply NULL to
+        query the system work queue.
+
+    Statistics - Supplies a pointer where the statistics will be returned.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONGLONG Frequency;
+    PWORK_QUEUE_LANE Lane;
+    ULONG LaneIndex;
+    ULONGLONG MaximumLatency;
+    ULONGLONG TotalLatency;
+
+    if (WorkQueue == NULL) {
+        WorkQueue = KeSystemWorkQueue;
+    }
+
+    RtlZeroMemory(Statistics, sizeof(WORK_QUEUE_STATISTICS));
+    Statistics->ThreadCount = WorkQueue->CurrentThreadCount;
+    Statistics->IdleThreadCount = WorkQueue->IdleThreadCount;
+    Statistics->PeakThreadCount = WorkQueue->PeakThreadCount;
+    Statistics->StallThreadCount = WorkQueue->StallThreadCount;
+    Statistics->PendingCount = WorkQueue->PendingCount;
+    Statistics->CompletedCount = WorkQueue->CompletedCount;
+    MaximumLatency = 0;
+    TotalLatency = 0;
+    for (LaneIndex = 0; LaneIndex < WorkQueue->LaneCount; LaneIndex += 1) {
+        Lane = &(WorkQueue->Lanes[LaneIndex]);
+        Statistics->QueuedCount += Lane->QueuedCount;
+        Statistics->HighPriorityCount += Lane->HighPriorityCount;
+        Statistics->StolenCount += Lane->StolenCount;
+        TotalLatency += Lane->TotalLatency;
+        if (Lane->MaximumLatency > MaximumLatency) {
+            MaximumLatency = Lane->MaximumLatency;
+        }
+    }
+
+    //
+    // Convert the latencies from time counter ticks to microseconds.
+    //
+
+    Frequency = HlQueryTimeCounterFrequency();
+    if (Frequency != 0) {
+        if (Statistics->CompletedCount != 0) {
+            Statistics->AverageLatency =
+                        (TotalLatency * MICROSECONDS_PER_SECOND / Frequency) /
+                        Statistics->CompletedCount;
+        }
+
+        Statistics->MaximumLatency =
+                             MaximumLatency * MICROSECONDS_PER_SECOND / Frequency;
+    }
+
+    return;
+}
+
 KSTATUS
 KepInitializeSystemWorkQueue (
     VOID
@@ -1097,6 +1401,32 @@ Return Value:
 {
 
     ULONG Flags;
+    KSTATUS Status;
+
+    //
+    // Fire up the manager that grows work queues whose workers are all busy
+    // or blocked. Every work queue, starting with the system work queue, is
+    // registered with it.
+    //
+
+    INITIALIZE_LIST_HEAD(&KeWorkQueueListHead);
+    KeWorkQueueListLock = KeCreateQueuedLock();
+    if (KeWorkQueueListLock == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeWorkQueueManagerEvent = KeCreateEvent(NULL);
+    if (KeWorkQueueManagerEvent == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Status = PsCreateKernelThread(KepWorkQueueManagerThread,
+                                  NULL,
+                                  "KeWorkQueueManager");
+
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
 
     Flags = WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL;
     KeSystemWorkQueue = KeCreateWorkQueue(Flags, "KeWorker");
@@ -1120,7 +1450,8 @@ KepWorkerThread (
 
 Routine Description:
 
-    This routine processes work items off of a work queue.
+    This routine processes work items off of a work queue. Extra worker
+    threads exit after sitting idle for a while.
 
 Arguments:
 
@@ -1129,82 +1460,33 @@ Routine Description:
 
 Return Value:
 
-    None. Does not return.
+    None.
 
 --*/
 
 {
 
-    RUNLEVEL OldRunLevel;
+    ULONG Color;
     PWORK_QUEUE Queue;
-    BOOL RaiseToDispatch;
-    ULONG RemainingThreads;
+    KSTATUS Status;
     PWORK_ITEM WorkItem;
 
-    OldRunLevel = RunLevelCount;
     Queue = (PWORK_QUEUE)Parameter;
-    RtlAtomicAdd32(&(Queue->CurrentThreadCount), 1);
-    RaiseToDispatch = FALSE;
-    if ((Queue->Flags & WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
-        RaiseToDispatch = TRUE;
-    }
-
     while (TRUE) {
 
         //
-        // Wait for the event, then process work items until none are left.
+        // Process work items until none are left.
         //
 
-        KeWaitForEvent(Queue->Event, FALSE, WAIT_TIME_INDEFINITE);
         while (TRUE) {
-            WorkItem = NULL;
-            if (RaiseToDispatch != FALSE) {
-                OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
-                KeAcquireSpinLock(&(Queue->Lock.SpinLock));
-
-            } else {
-                KeAcquireQueuedLock(Queue->Lock.QueuedLock);
-            }
-
-            if (LIST_EMPTY(&(Queue->WorkItemListHead)) == FALSE) {
-                WorkItem = LIST_VALUE(Queue->WorkItemListHead.Next,
-                                      WORK_ITEM,
-                                      ListEntry);
-
-                LIST_REMOVE(&(WorkItem->ListEntry));
-                WorkItem->ListEntry.Next = NULL;
-                Queue->WorkItemCount -= 1;
-                WorkItem->Flags &= ~WORK_ITEM_FLAG_QUEUED;
-
-            } else {
-                KeSignalEvent(Queue->Event, SignalOptionUnsignal);
-            }
-
-            if (RaiseToDispatch != FALSE) {
-                KeReleaseSpinLock(&(Queue->Lock.SpinLock));
-                KeLowerRunLevel(OldRunLevel);
-
-            } else {
-                KeReleaseQueuedLock(Queue->Lock.QueuedLock);
-            }
-
-            //
-            // If there is a work item, execute it.
-            //
-
-            if (WorkItem != NULL) {
-                WorkItem->Routine(WorkItem->Parameter);
-                KeSignalEvent(WorkItem->Event, SignalOptionSignalAll);
-                KepWorkItemReleaseReference(WorkItem);
-
-            //
-            // If there was no work item, stop looking.
-            //
-
-            } else {
+            WorkItem = KepDequeueWorkItem(Queue, &Color);
+            if (WorkItem == NULL) {
                 break;
             }
 
+            WorkItem->Routine(WorkItem->Parameter);
+            KepFinishWorkItem(Queue, WorkItem, Color);
+
             //
             // If the work queue became paused, stop processing events.
             //
@@ -1225,18 +1507,31 @@ Return Value:
         }
 
         if (Queue->State == WorkQueueStateDestroying) {
-            RemainingThreads = RtlAtomicAdd32(&(Queue->CurrentThreadCount), -1);
+            KepExitWorkerThread(Queue);
+            break;
+        }
 
-            //
-            // If this is the last thread standing, turn out the lights by
-            // destroying the work queue.
-            //
+        //
+        // Go to sleep. The event is unsignaled before the final check for
+        // pending work so that an item queued in between still wakes this
+        // thread, as queuers bump the pending count before signaling.
+        //
 
-            if (RemainingThreads == 1) {
-                Queue->State = WorkQueueStateDestroyed;
-                KepDestroyWorkQueue(Queue);
-                break;
-            }
+        Status = STATUS_SUCCESS;
+        RtlAtomicAdd32(&(Queue->IdleThreadCount), 1);
+        KeSignalEvent(Queue->Event, SignalOptionUnsignal);
+        if ((Queue->PendingCount == 0) &&
+            ((Queue->State == WorkQueueStateOpen) ||
+             (Queue->State == WorkQueueStatePaused))) {
+
+            Status = KeWaitForEvent(Queue->Event,
+                                    FALSE,
+                                    WORK_QUEUE_IDLE_TIMEOUT);
+        }
+
+        RtlAtomicAdd32(&(Queue->IdleThreadCount), -1);
+        if ((Status == STATUS_TIMEOUT) && (KepTrimWorkerThread(Queue) != FALSE)) {
+            break;
         }
     }
 
@@ -1244,20 +1539,87 @@ Return Value:
 }
 
 VOID
-KepDestroyWorkQueue (
-    PWORK_QUEUE Queue
+KepWorkQueueManagerThread (
+    PVOID Parameter
     )
 
 /*++
 
 Routine Description:
 
-    This routine destroys and frees a work queue. This routine will be
-    called automatically by the last worker thread to exit.
+    This routine implements the work queue manager, which adds worker threads
+    to queues that have work pending and no idle workers. A queue gets up to
+    one worker per processor whenever it backs up, and more than that only if
+    its workers have gone a full period without finishing anything, which
+    indicates they are blocked rather than busy.
 
 Arguments:
 
-    Queue - Supplies a pointer to the queue to destroy.
+    Parameter - Supplies an unused parameter.
+
+Return Value:
+
+    None. Does not return.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    ULONGLONG CurrentTime;
+    ULONGLONG Period;
+    ULONG ProcessorCount;
+    PWORK_QUEUE Queue;
+
+    Period = HlQueryTimeCounterFrequency() * WORK_QUEUE_MANAGER_PERIOD /
+             MILLISECONDS_PER_SECOND;
+
+    while (TRUE) {
+        KeWaitForEvent(KeWorkQueueManagerEvent,
+                       FALSE,
+                       WORK_QUEUE_MANAGER_PERIOD);
+
+        KeSignalEvent(KeWorkQueueManagerEvent, SignalOptionUnsignal);
+        ProcessorCount = KeGetActiveProcessorCount();
+        CurrentTime = HlQueryTimeCounter();
+        KeAcquireQueuedLock(KeWorkQueueListLock);
+        CurrentEntry = KeWorkQueueListHead.Next;
+        while (CurrentEntry != &KeWorkQueueListHead) {
+            Queue = LIST_VALUE(CurrentEntry, WORK_QUEUE, ListEntry);
+            CurrentEntry = CurrentEntry->Next;
+            KepBalanceWorkQueue(Queue, ProcessorCount, CurrentTime, Period);
+        }
+
+        KeReleaseQueuedLock(KeWorkQueueListLock);
+    }
+
+    return;
+}
+
+VOID
+KepBalanceWorkQueue (
+    PWORK_QUEUE Queue,
+    ULONG ProcessorCount,
+    ULONGLONG CurrentTime,
+    ULONGLONG Period
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a worker thread to the given queue if it needs one.
+    This routine assumes the work queue list lock is held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the work queue to balance.
+
+    ProcessorCount - Supplies the number of active processors.
+
+    CurrentTime - Supplies the current time counter value.
+
+    Period - Supplies the number of time counter ticks in a manager period.
 
 Return Value:
 
@@ -1267,25 +1629,676 @@ Return Value:
 
 {
 
-    BOOL NonPaged;
+    UINTN CompletedCount;
+    BOOL Stalled;
+    KSTATUS Status;
+    ULONG ThreadCount;
 
-    ASSERT(Queue->CurrentThreadCount == 0);
+    if (Queue->State != WorkQueueStateOpen) {
+        return;
+    }
 
-    NonPaged = FALSE;
-    if ((Queue->Flags & WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
-        NonPaged = TRUE;
+    //
+    // Once a period, check whether the queue finished anything since the
+    // last check while work was waiting.
+    //
+
+    Stalled = FALSE;
+    CompletedCount = Queue->CompletedCount;
+    if ((CurrentTime - Queue->ManagerCheckTime) >= Period) {
+        if ((CompletedCount == Queue->ManagerCompletedCount) &&
+            (Queue->PendingCount != 0)) {
+
+            Stalled = TRUE;
+        }
+
+        Queue->ManagerCompletedCount = CompletedCount;
+        Queue->ManagerCheckTime = CurrentTime;
     }
 
-    if (Queue->Name != NULL) {
-        MmFreePagedPool(Queue->Name);
+    if ((Queue->PendingCount == 0) || (Queue->IdleThreadCount != 0)) {
+        return;
     }
 
-    if ((NonPaged != FALSE) && (Queue->Lock.QueuedLock != NULL)) {
-        KeDestroyQueuedLock(Queue->Lock.QueuedLock);
+    ThreadCount = Queue->CurrentThreadCount;
+    if (ThreadCount < ProcessorCount) {
+        KepCreateWorkerThread(Queue);
+
+    } else if ((Stalled != FALSE) &&
+               (ThreadCount <
+                (ProcessorCount * WORK_QUEUE_THREADS_PER_PROCESSOR))) {
+
+        Status = KepCreateWorkerThread(Queue);
+        if (KSUCCESS(Status)) {
+            Queue->StallThreadCount += 1;
+        }
     }
 
-    if (Queue->Event != NULL) {
-        KeDestroyEvent(Queue->Event);
+    return;
+}
+
+KSTATUS
+KepCreateWorkerThread (
+    PWORK_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a worker thread to a work queue. This routine assumes
+    the work queue list lock is held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the work queue.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG OldCount;
+    ULONG ThreadCount;
+    KSTATUS Status;
+
+    //
+    // Account for the new thread up front so the queue cannot be torn down
+    // while the thread is being created. A count of zero means the last
+    // worker is already on its way to destroying the queue.
+    //
+
+    while (TRUE) {
+        ThreadCount = Queue->CurrentThreadCount;
+        if (ThreadCount == 0) {
+            return STATUS_TOO_LATE;
+        }
+
+        OldCount = RtlAtomicCompareExchange32(&(Queue->CurrentThreadCount),
+                                              ThreadCount + 1,
+                                              ThreadCount);
+
+        if (OldCount == ThreadCount) {
+            break;
+        }
+    }
+
+    if (ThreadCount + 1 > Queue->PeakThreadCount) {
+        Queue->PeakThreadCount = ThreadCount + 1;
+    }
+
+    Status = PsCreateKernelThread(KepWorkerThread, Queue, Queue->Name);
+    if (!KSUCCESS(Status)) {
+        OldCount = RtlAtomicAdd32(&(Queue->CurrentThreadCount), -1);
+
+        //
+        // If every other worker exited for a destroy while the thread was
+        // being created, finish the destruction on their behalf.
+        //
+
+        if (OldCount == 1) {
+            LIST_REMOVE(&(Queue->ListEntry));
+            Queue->State = WorkQueueStateDestroyed;
+            KepDestroyWorkQueue(Queue);
+        }
+    }
+
+    return Status;
+}
+
+BOOL
+KepTrimWorkerThread (
+    PWORK_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether an idle worker thread should exit, and
+    removes it from the thread count if so.
+
+Arguments:
+
+    Queue - Supplies a pointer to the work queue.
+
+Return Value:
+
+    TRUE if the calling worker thread should exit.
+
+    FALSE if the calling worker thread should keep servicing the queue.
+
+--*/
+
+{
+
+    ULONG OldCount;
+    ULONG ThreadCount;
+
+    while (TRUE) {
+        ThreadCount = Queue->CurrentThreadCount;
+        if ((ThreadCount <= WORK_QUEUE_MINIMUM_THREAD_COUNT) ||
+            (Queue->PendingCount != 0) ||
+            (Queue->State != WorkQueueStateOpen)) {
+
+            return FALSE;
+        }
+
+        OldCount = RtlAtomicCompareExchange32(&(Queue->CurrentThreadCount),
+                                              ThreadCount - 1,
+                                              ThreadCount);
+
+        if (OldCount == ThreadCount) {
+            break;
+        }
+    }
+
+    return TRUE;
+}
+
+VOID
+KepExitWorkerThread (
+    PWORK_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a worker thread from a queue being destroyed. The
+    last worker out destroys the queue.
+
+Arguments:
+
+    Queue - Supplies a pointer to the work queue.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG RemainingThreads;
+
+    ASSERT(Queue->State == WorkQueueStateDestroying);
+
+    RemainingThreads = RtlAtomicAdd32(&(Queue->CurrentThreadCount), -1);
+
+    //
+    // If this is the last thread standing, turn out the lights by destroying
+    // the work queue.
+    //
+
+    if (RemainingThreads == 1) {
+        KeAcquireQueuedLock(KeWorkQueueListLock);
+        LIST_REMOVE(&(Queue->ListEntry));
+        KeReleaseQueuedLock(KeWorkQueueListLock);
+        Queue->State = WorkQueueStateDestroyed;
+        KepDestroyWorkQueue(Queue);
+    }
+
+    return;
+}
+
+PWORK_ITEM
+KepDequeueWorkItem (
+    PWORK_QUEUE Queue,
+    PULONG Color
+    )
+
+/*++
+
+Routine Description:
+
+    This routine pulls the next work item to run off of a work queue. High
+    priority items from any lane come before normal priority items. Within a
+    priority, the lane of the current processor is tried first, then the
+    other lanes are stolen from in order.
+
+Arguments:
+
+    Queue - Supplies a pointer to the work queue.
+
+    Color - Supplies a pointer where the flush color of the work item will be
+        returned. Queuing the work item again while it runs is deferred, and
+        may use a different color.
+
+Return Value:
+
+    Returns a pointer to the work item, with the queue's reference
+    transferred to the caller.
+
+    NULL if the queue is empty.
+
+--*/
+
+{
+
+    ULONG Home;
+    ULONGLONG Latency;
+    PWORK_QUEUE_LANE Lane;
+    ULONG LaneIndex;
+    PLIST_ENTRY ListHead;
+    ULONG Offset;
+    RUNLEVEL OldRunLevel;
+    ULONG Pass;
+    PWORK_ITEM WorkItem;
+
+    if (Queue->PendingCount == 0) {
+        return NULL;
+    }
+
+    Home = KeGetCurrentProcessorNumber() % Queue->LaneCount;
+    for (Pass = 0; Pass < 2; Pass += 1) {
+        for (Offset = 0; Offset < Queue->LaneCount; Offset += 1) {
+            LaneIndex = Home + Offset;
+            if (LaneIndex >= Queue->LaneCount) {
+                LaneIndex -= Queue->LaneCount;
+            }
+
+            Lane = &(Queue->Lanes[LaneIndex]);
+            if (Pass == 0) {
+                ListHead = &(Lane->HighListHead);
+
+            } else {
+                ListHead = &(Lane->NormalListHead);
+            }
+
+            //
+            // Peek without the lock to avoid bouncing every lane's lock
+            // around, then check again with the lock held.
+            //
+
+            if (LIST_EMPTY(ListHead) != FALSE) {
+                continue;
+            }
+
+            WorkItem = NULL;
+            OldRunLevel = KepAcquireWorkQueueLane(Queue, Lane);
+            if (LIST_EMPTY(ListHead) == FALSE) {
+                WorkItem = LIST_VALUE(ListHead->Next, WORK_ITEM, ListEntry);
+                LIST_REMOVE(&(WorkItem->ListEntry));
+                WorkItem->ListEntry.Next = NULL;
+                RtlAtomicAdd32(&(Queue->PendingCount), -1);
+
+                //
+                // Mark the work item running before it stops being queued, so
+                // that a queuer never sees it as neither.
+                //
+
+                RtlAtomicOr32(&(WorkItem->Flags), WORK_ITEM_FLAG_RUNNING);
+                RtlAtomicAnd32(&(WorkItem->Flags), ~WORK_ITEM_FLAG_QUEUED);
+                *Color = WorkItem->Color;
+                Latency = HlQueryTimeCounter() - WorkItem->QueueTime;
+                Lane->TotalLatency += Latency;
+                if (Latency > Lane->MaximumLatency) {
+                    Lane->MaximumLatency = Latency;
+                }
+
+                if (Offset != 0) {
+                    Lane->StolenCount += 1;
+                }
+            }
+
+            KepReleaseWorkQueueLane(Queue, Lane, OldRunLevel);
+            if (WorkItem != NULL) {
+                return WorkItem;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+VOID
+KepInsertWorkItem (
+    PWORK_QUEUE Queue,
+    PWORK_ITEM WorkItem,
+    ULONG Color
+    )
+
+/*++
+
+Routine Description:
+
+    This routine places a work item that has been claimed for queuing onto the
+    current processor's lane and kicks the worker threads.
+
+Arguments:
+
+    Queue - Supplies a pointer to the work queue.
+
+    WorkItem - Supplies a pointer to the work item. The caller must have set
+        the queued flag and must hand over a reference.
+
+    Color - Supplies the flush color the work item was accounted under.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PWORK_QUEUE_LANE Lane;
+    ULONG LaneIndex;
+    RUNLEVEL OldRunLevel;
+
+    ASSERT((WorkItem->Flags & WORK_ITEM_FLAG_QUEUED) != 0);
+
+    //
+    // Queue the work item to the current processor's lane. At low level the
+    // thread may migrate after the processor number is read, which only costs
+    // a little locality.
+    //
+
+    LaneIndex = KeGetCurrentProcessorNumber() % Queue->LaneCount;
+    Lane = &(Queue->Lanes[LaneIndex]);
+    OldRunLevel = KepAcquireWorkQueueLane(Queue, Lane);
+    KeSignalEvent(WorkItem->Event, SignalOptionUnsignal);
+    WorkItem->Lane = Lane;
+    WorkItem->QueueTime = HlQueryTimeCounter();
+    WorkItem->Color = Color;
+
+    //
+    // High priority items go on their own list, which workers drain from
+    // every lane before looking at any normal priority items.
+    //
+
+    if (WorkItem->Priority == WorkPriorityHigh) {
+        INSERT_BEFORE(&(WorkItem->ListEntry), &(Lane->HighListHead));
+        Lane->HighPriorityCount += 1;
+
+    } else {
+        INSERT_BEFORE(&(WorkItem->ListEntry), &(Lane->NormalListHead));
+    }
+
+    Lane->QueuedCount += 1;
+    RtlAtomicAdd32(&(Queue->PendingCount), 1);
+    KepReleaseWorkQueueLane(Queue, Lane, OldRunLevel);
+
+    //
+    // Signal the event to kick off the worker threads. If none of them are
+    // idle and there are processors to spare, ask the manager for another
+    // worker.
+    //
+
+    KeSignalEvent(Queue->Event, SignalOptionSignalAll);
+    if ((Queue->IdleThreadCount == 0) &&
+        (Queue->CurrentThreadCount < KeGetActiveProcessorCount())) {
+
+        KeSignalEvent(KeWorkQueueManagerEvent, SignalOptionSignalAll);
+    }
+
+    return;
+}
+
+VOID
+KepFinishWorkItem (
+    PWORK_QUEUE Queue,
+    PWORK_ITEM WorkItem,
+    ULONG Color
+    )
+
+/*++
+
+Routine Description:
+
+    This routine cleans up after a worker thread runs a work item. If the work
+    item was queued while it ran, it goes back on the queue now. Otherwise
+    anyone flushing it is woken.
+
+Arguments:
+
+    Queue - Supplies a pointer to the work queue.
+
+    WorkItem - Supplies a pointer to the work item that ran. The worker's
+        reference is either released or handed to the queue.
+
+    Color - Supplies the flush color the work item ran under.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG NewFlags;
+    ULONG OldFlags;
+    ULONG RequeueColor;
+
+    while (TRUE) {
+        OldFlags = WorkItem->Flags;
+
+        ASSERT((OldFlags & WORK_ITEM_FLAG_RUNNING) != 0);
+
+        NewFlags = OldFlags & ~(WORK_ITEM_FLAG_RUNNING |
+                                WORK_ITEM_FLAG_REQUEUE |
+                                WORK_ITEM_FLAG_REQUEUE_COLOR);
+
+        if ((OldFlags & WORK_ITEM_FLAG_REQUEUE) != 0) {
+            NewFlags |= WORK_ITEM_FLAG_QUEUED;
+        }
+
+        if (RtlAtomicCompareExchange32(&(WorkItem->Flags),
+                                       NewFlags,
+                                       OldFlags) == OldFlags) {
+
+            break;
+        }
+    }
+
+    RtlAtomicAdd(&(Queue->CompletedCount), 1);
+    KepReleaseWorkItemColor(Queue, Color);
+    if ((NewFlags & WORK_ITEM_FLAG_QUEUED) != 0) {
+        RequeueColor = 0;
+        if ((OldFlags & WORK_ITEM_FLAG_REQUEUE_COLOR) != 0) {
+            RequeueColor = 1;
+        }
+
+        KepInsertWorkItem(Queue, WorkItem, RequeueColor);
+
+    //
+    // Decide on the signal from what the exchange actually did. A deferred
+    // queuing may have been called off by a cancel after the run ended, and
+    // the flushers still need waking in that case.
+    //
+
+    } else {
+        KeSignalEvent(WorkItem->Event, SignalOptionSignalAll);
+        KepWorkItemReleaseReference(WorkItem);
+    }
+
+    return;
+}
+
+VOID
+KepReleaseWorkItemColor (
+    PWORK_QUEUE Queue,
+    ULONG Color
+    )
+
+/*++
+
+Routine Description:
+
+    This routine accounts for a work item of the given flush color finishing
+    or being cancelled, waking any flush waiting on that color.
+
+Arguments:
+
+    Queue - Supplies a pointer to the work queue.
+
+    Color - Supplies the flush color the work item was queued with.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN OldCount;
+
+    OldCount = RtlAtomicAdd(&(Queue->ColorCount[Color]), -1);
+
+    ASSERT(OldCount != 0);
+
+    if (OldCount == 1) {
+        KeSignalEvent(Queue->FlushEvent, SignalOptionSignalAll);
+    }
+
+    return;
+}
+
+RUNLEVEL
+KepAcquireWorkQueueLane (
+    PWORK_QUEUE Queue,
+    PWORK_QUEUE_LANE Lane
+    )
+
+/*++
+
+Routine Description:
+
+    This routine acquires the lock of a work queue lane, raising to dispatch
+    level first if the queue accepts work items at dispatch.
+
+Arguments:
+
+    Queue - Supplies a pointer to the work queue.
+
+    Lane - Supplies a pointer to the lane to lock.
+
+Return Value:
+
+    Returns the previous run level, to be handed back when releasing the lane.
+
+--*/
+
+{
+
+    RUNLEVEL OldRunLevel;
+
+    if ((Queue->Flags & WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(Lane->Lock.SpinLock));
+
+    } else {
+        OldRunLevel = RunLevelCount;
+        KeAcquireQueuedLock(Lane->Lock.QueuedLock);
+    }
+
+    return OldRunLevel;
+}
+
+VOID
+KepReleaseWorkQueueLane (
+    PWORK_QUEUE Queue,
+    PWORK_QUEUE_LANE Lane,
+    RUNLEVEL OldRunLevel
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases the lock of a work queue lane.
+
+Arguments:
+
+    Queue - Supplies a pointer to the work queue.
+
+    Lane - Supplies a pointer to the lane to unlock.
+
+    OldRunLevel - Supplies the run level returned when the lane was acquired.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if ((Queue->Flags & WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
+        KeReleaseSpinLock(&(Lane->Lock.SpinLock));
+        KeLowerRunLevel(OldRunLevel);
+
+    } else {
+        KeReleaseQueuedLock(Lane->Lock.QueuedLock);
+    }
+
+    return;
+}
+
+VOID
+KepDestroyWorkQueue (
+    PWORK_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys and frees a work queue. This routine will be
+    called automatically by the last worker thread to exit.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PWORK_QUEUE_LANE Lane;
+    ULONG LaneIndex;
+    BOOL NonPaged;
+
+    ASSERT(Queue->CurrentThreadCount == 0);
+
+    NonPaged = FALSE;
+    if ((Queue->Flags & WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
+        NonPaged = TRUE;
+    }
+
+    if (Queue->Name != NULL) {
+        MmFreePagedPool(Queue->Name);
+    }
+
+    if (NonPaged == FALSE) {
+        for (LaneIndex = 0; LaneIndex < Queue->LaneCount; LaneIndex += 1) {
+            Lane = &(Queue->Lanes[LaneIndex]);
+            if (Lane->Lock.QueuedLock != NULL) {
+                KeDestroyQueuedLock(Lane->Lock.QueuedLock);
+            }
+        }
+    }
+
+    if (Queue->Event != NULL) {
+        KeDestroyEvent(Queue->Event);
+    }
+
+    if (Queue->FlushEvent != NULL) {
+        KeDestroyEvent(Queue->FlushEvent);
+    }
+
+    if (Queue->FlushLock != NULL) {
+        KeDestroyQueuedLock(Queue->FlushLock);
     }
 
     if (NonPaged != FALSE) {
@@ -1363,7 +2376,8 @@ Return Value:
 
     if (OldReferenceCount == 1) {
 
-        ASSERT((WorkItem->Flags & WORK_ITEM_FLAG_QUEUED) == 0);
+        ASSERT((WorkItem->Flags &
+                (WORK_ITEM_FLAG_QUEUED | WORK_ITEM_FLAG_RUNNING)) == 0);
 
         if (WorkItem->Event != NULL) {
             KeDestroyEvent(WorkItem->Event);
@@ -144,6 +144,7 @@ Return Value:
     return Block;
 }
 
+KERNEL_API
 ULONG
 KeGetCurrentProcessorNumber (
     VOID
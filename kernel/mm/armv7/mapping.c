@@ -819,8 +819,11 @@ Return Value:
 
     ULONG FirstIndex;
     PFIRST_LEVEL_TABLE FirstTable;
+    PADDRESS_SPACE OldAddressSpace;
+    PPROCESSOR_BLOCK ProcessorBlock;
     PADDRESS_SPACE_ARM Space;
 
+    ProcessorBlock = Processor;
     Space = (PADDRESS_SPACE_ARM)AddressSpace;
 
     //
@@ -835,7 +838,30 @@ Return Value:
         MmUpdatePageDirectory(AddressSpace, CurrentStack, PAGE_SIZE);
     }
 
+    //
+    // The outgoing thread still owns the processor, so its process tells
+    // which address space is currently loaded.
+    //
+
+    OldAddressSpace = NULL;
+    if (ProcessorBlock->RunningThread != NULL) {
+        OldAddressSpace =
+                    ProcessorBlock->RunningThread->OwningProcess->AddressSpace;
+    }
+
+    MmpSetAddressSpaceActive(AddressSpace, ProcessorBlock->ProcessorNumber);
     ArSwitchTtbr0(Space->PageDirectoryPhysical);
+
+    //
+    // Switching TTBR0 invalidated the entire TLB, so this processor no longer
+    // needs the old address space's invalidations.
+    //
+
+    if ((OldAddressSpace != NULL) && (OldAddressSpace != AddressSpace)) {
+        MmpSetAddressSpaceInactive(OldAddressSpace,
+                                   ProcessorBlock->ProcessorNumber);
+    }
+
     return;
 }
 
@@ -2991,6 +3017,103 @@ Return Value:
     return;
 }
 
+ULONG
+MmpGetLargePageShift (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the shift of the large page size that the current
+    architecture can map with a single translation entry.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the large page shift, or 0 if large pages are not supported.
+
+--*/
+
+{
+
+    //
+    // First level section mappings are not used outside the boot loader.
+    //
+
+    return 0;
+}
+
+KSTATUS
+MmpPrepareLargePage (
+    PADDRESS_SPACE AddressSpace,
+    PVOID VirtualAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets aside the resources needed to later split a large page
+    mapped at the given user mode address back into small pages.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space the large page will
+        be mapped in.
+
+    VirtualAddress - Supplies the large page aligned virtual address.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+KSTATUS
+MmpMapLargePage (
+    PHYSICAL_ADDRESS PhysicalAddress,
+    PVOID VirtualAddress,
+    ULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine maps a large page of physically contiguous memory into the
+    current address space with a single translation entry.
+
+Arguments:
+
+    PhysicalAddress - Supplies the large page aligned physical address to back
+        the mapping with.
+
+    VirtualAddress - Supplies the large page aligned virtual address to map.
+
+    Flags - Supplies a bitfield of flags governing the options of the mapping.
+        See MAP_FLAG_* definitions.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
@@ -254,6 +254,15 @@ Return Value:
                               Status);
             }
 
+            //
+            // Map any neighboring pages that are already sitting in the page
+            // cache to save taking a fault on each of them.
+            //
+
+            if (KSUCCESS(Status)) {
+                MmpFaultAround(ImageSection, PageOffset);
+            }
+
         //
         // The page was there and the access was not in violation, so this must
         // be a write on a read only page.
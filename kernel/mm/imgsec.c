@@ -1752,6 +1752,127 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+MmpAdviseImageSectionRegion (
+    PADDRESS_SPACE AddressSpace,
+    PVOID Address,
+    UINTN Size,
+    ULONG Advice
+    )
+
+/*++
+
+Routine Description:
+
+    This routine applies access pattern advice to the image sections covering
+    the given region. Advice applies to whole image sections.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space containing the
+        region.
+
+    Address - Supplies the page-aligned starting address of the region.
+
+    Size - Supplies the size of the region in bytes.
+
+    Advice - Supplies a bitmask of SYS_MAP_FLAG_SEQUENTIAL,
+        SYS_MAP_FLAG_RANDOM and SYS_MAP_FLAG_WILL_NEED. Zero resets the
+        section to normal access. "Will need" on its own leaves the access
+        pattern alone.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG AdviceFlags;
+    PLIST_ENTRY CurrentEntry;
+    PVOID End;
+    IO_OFFSET FileOffset;
+    BOOL Prefetch;
+    PVOID PrefetchEnd;
+    PVOID PrefetchStart;
+    PIMAGE_SECTION Section;
+    PVOID SectionEnd;
+
+    AdviceFlags = 0;
+    if ((Advice & SYS_MAP_FLAG_RANDOM) != 0) {
+        AdviceFlags = IMAGE_SECTION_RANDOM;
+
+    } else if ((Advice & SYS_MAP_FLAG_SEQUENTIAL) != 0) {
+        AdviceFlags = IMAGE_SECTION_SEQUENTIAL;
+    }
+
+    End = Address + Size;
+    FileOffset = 0;
+    PrefetchEnd = NULL;
+    PrefetchStart = NULL;
+    MmAcquireAddressSpaceLock(AddressSpace);
+    CurrentEntry = AddressSpace->SectionListHead.Next;
+    while (CurrentEntry != &(AddressSpace->SectionListHead)) {
+        Section = LIST_VALUE(CurrentEntry, IMAGE_SECTION, AddressListEntry);
+        if (Section->VirtualAddress >= End) {
+            break;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+        SectionEnd = Section->VirtualAddress + Section->Size;
+        if (SectionEnd <= Address) {
+            continue;
+        }
+
+        Prefetch = FALSE;
+        KeAcquireQueuedLock(Section->Lock);
+        if (Advice != SYS_MAP_FLAG_WILL_NEED) {
+            Section->Flags = (Section->Flags & ~IMAGE_SECTION_ADVICE_MASK) |
+                             AdviceFlags;
+        }
+
+        //
+        // For "will need" advice, start pulling the covered part of the
+        // backing file into the page cache. Later faults then only need to
+        // map it.
+        //
+
+        if (((Advice & SYS_MAP_FLAG_WILL_NEED) != 0) &&
+            ((Section->Flags & IMAGE_SECTION_DESTROYED) == 0) &&
+            (Section->ImageBacking.DeviceHandle != INVALID_HANDLE)) {
+
+            PrefetchStart = Section->VirtualAddress;
+            if (PrefetchStart < Address) {
+                PrefetchStart = Address;
+            }
+
+            PrefetchEnd = SectionEnd;
+            if (PrefetchEnd > End) {
+                PrefetchEnd = End;
+            }
+
+            FileOffset = Section->ImageBacking.Offset +
+                         (PrefetchStart - Section->VirtualAddress);
+
+            MmpImageSectionAddImageBackingReference(Section);
+            Prefetch = TRUE;
+        }
+
+        KeReleaseQueuedLock(Section->Lock);
+        if (Prefetch != FALSE) {
+            IoPrefetchCachedData(Section->ImageBacking.DeviceHandle,
+                                 FileOffset,
+                                 PrefetchEnd - PrefetchStart);
+
+            MmpImageSectionReleaseImageBackingReference(Section);
+        }
+    }
+
+    MmReleaseAddressSpaceLock(AddressSpace);
+    return STATUS_SUCCESS;
+}
+
 VOID
 MmpImageSectionAddReference (
     PIMAGE_SECTION ImageSection
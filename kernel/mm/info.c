@@ -31,6 +31,7 @@ Module Name:
 //
 
 #include <minoca/kernel/kernel.h>
+#include "mmp.h"
 
 //
 // ---------------------------------------------------------------- Definitions
@@ -51,6 +52,13 @@ MmpGetSetSystemMemoryInformation (
     BOOL Set
     );
 
+KSTATUS
+MmpGetSetFaultAroundInformation (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -106,6 +114,10 @@ Return Value:
         Status = MmpGetSetSystemMemoryInformation(Data, DataSize, Set);
         break;
 
+    case MmInformationFaultAround:
+        Status = MmpGetSetFaultAroundInformation(Data, DataSize, Set);
+        break;
+
     default:
         Status = STATUS_INVALID_PARAMETER;
         *DataSize = 0;
@@ -167,3 +179,63 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+MmpGetSetFaultAroundInformation (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets the number of pages mapped from the page cache
+    around a fault on a cache-backed image section.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG PageCount;
+    KSTATUS Status;
+
+    if (*DataSize != sizeof(ULONG)) {
+        *DataSize = sizeof(ULONG);
+        return STATUS_DATA_LENGTH_MISMATCH;
+    }
+
+    if (Set == FALSE) {
+        *((PULONG)Data) = MmFaultAroundPageCount;
+        return STATUS_SUCCESS;
+    }
+
+    Status = PsCheckPermission(PERMISSION_SYSTEM_ADMINISTRATOR);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    PageCount = *((PULONG)Data);
+    if (PageCount > MM_FAULT_AROUND_MAX_PAGES) {
+        PageCount = MM_FAULT_AROUND_MAX_PAGES;
+    }
+
+    MmFaultAroundPageCount = PageCount;
+    return STATUS_SUCCESS;
+}
+
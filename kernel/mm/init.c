@@ -206,8 +206,7 @@ Return Value:
         //
 
         if (KeGetCurrentProcessorNumber() == 0) {
-            KeInitializeSpinLock(&MmInvalidateIpiLock);
-            KeInitializeSpinLock(&MmNonPagedPoolLock);
+            KeInitializeQueuedSpinLock(&MmNonPagedPoolLock);
 
             //
             // Initialize the physical memory allocator.
@@ -259,6 +258,20 @@ Return Value:
             MmpInitializePagedPool();
         }
 
+        //
+        // Set up this processor's pool cache now that the pools exist.
+        //
+
+        Status = MmpInitializePoolCache(0);
+        if (!KSUCCESS(Status)) {
+            goto InitializeEnd;
+        }
+
+        Status = MmpInitializePhysicalPageCache();
+        if (!KSUCCESS(Status)) {
+            goto InitializeEnd;
+        }
+
     //
     // In phase 2, lock down memory structures in preparation for
     // multi-threaded access. This is only executed on processor 0.
@@ -332,6 +345,16 @@ Return Value:
             goto InitializeEnd;
         }
 
+        //
+        // Set up the TLB invalidation requests now that the processor count
+        // is known, but before the other processors are started.
+        //
+
+        Status = MmpInitializeTlbInvalidation();
+        if (!KSUCCESS(Status)) {
+            goto InitializeEnd;
+        }
+
         Status = STATUS_SUCCESS;
 
     //
@@ -357,6 +380,21 @@ Return Value:
         if (MmPhysicalPageZeroAvailable != FALSE) {
             MmpAddPageZeroDescriptorsToMdl(&MmKernelVirtualSpace);
         }
+
+        //
+        // The system work queue is up, so the pool caches can now schedule
+        // reclaim passes.
+        //
+
+        Status = MmpInitializePoolCache(1);
+        if (!KSUCCESS(Status)) {
+            goto InitializeEnd;
+        }
+
+        Status = MmpInitializeZeroPageThread();
+        if (!KSUCCESS(Status)) {
+            goto InitializeEnd;
+        }
     }
 
 InitializeEnd:
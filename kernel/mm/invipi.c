@@ -36,28 +36,82 @@ Module Name:
 // ---------------------------------------------------------------- Definitions
 //
 
+//
+// Define the number of processors described by each word of a processor mask.
+//
+
+#define MM_PROCESSOR_MASK_BITS (sizeof(ULONG) * BITS_PER_BYTE)
+
+//
+// Define the number of pages in a user mode range above which it is cheaper
+// to flush the whole TLB than to invalidate each page.
+//
+
+#define MM_TLB_FLUSH_ALL_THRESHOLD 32
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure defines a processor's outstanding TLB invalidation request.
+    Each processor owns exactly one, so processors can invalidate concurrently
+    without serializing on a global lock.
+
+Members:
+
+    AddressSpace - Stores a pointer to the address space being invalidated.
+
+    Address - Stores the first virtual address to invalidate.
+
+    PageCount - Stores the number of pages to invalidate.
+
+    PendingProcessors - Stores a pointer to the mask of processors that have
+        yet to service the request. Each target clears its own bit once its
+        TLB is clean.
+
+--*/
+
+typedef struct _MM_TLB_INVALIDATE_REQUEST {
+    PADDRESS_SPACE AddressSpace;
+    PVOID Address;
+    ULONG PageCount;
+    volatile ULONG *PendingProcessors;
+} MM_TLB_INVALIDATE_REQUEST, *PMM_TLB_INVALIDATE_REQUEST;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+VOID
+MmpInvalidateTlbRange (
+    PVOID VirtualAddress,
+    ULONG PageCount
+    );
+
+ULONG
+MmpGetTlbInvalidateTargets (
+    PADDRESS_SPACE AddressSpace,
+    PVOID VirtualAddress,
+    ULONG Word,
+    ULONG ActiveCount
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
 //
-// Store the global containing the address to invalidate and the number of
-// processors that have yet to respond to the IPI.
+// Store the array of invalidation requests, one per processor, and the number
+// of words in each request's processor mask.
 //
 
-KSPIN_LOCK MmInvalidateIpiLock;
-volatile PADDRESS_SPACE MmInvalidateIpiAddressSpace = NULL;
-volatile PVOID MmInvalidateIpiAddress = NULL;
-volatile ULONG MmInvalidateIpiPageCount = 0;
-volatile ULONG MmInvalidateIpiProcessorsRemaining = 0;
+PMM_TLB_INVALIDATE_REQUEST MmTlbInvalidateRequests;
+ULONG MmTlbInvalidateRequestCount;
+ULONG MmTlbInvalidateMaskWords;
 
 //
 // ------------------------------------------------------------------ Functions
@@ -72,7 +126,9 @@ MmTlbInvalidateIpiServiceRoutine (
 
 Routine Description:
 
-    This routine handles TLB invalidation IPIs.
+    This routine handles TLB invalidation IPIs. Every outstanding request
+    targeting this processor is serviced, so IPIs from several processors
+    that arrive together are handled in one pass.
 
 Arguments:
 
@@ -86,30 +142,197 @@ Return Value:
 
 {
 
-    PVOID Address;
     ULONG Index;
+    ULONG Mask;
     RUNLEVEL OldRunLevel;
-    ULONG PageSize;
     PKPROCESS Process;
+    ULONG ProcessorNumber;
+    PMM_TLB_INVALIDATE_REQUEST Request;
+    ULONG Word;
 
     OldRunLevel = KeRaiseRunLevel(RunLevelIpi);
-    PageSize = MmPageSize();
+    ProcessorNumber = KeGetCurrentProcessorNumber();
+    Word = ProcessorNumber / MM_PROCESSOR_MASK_BITS;
+    Mask = 1U << (ProcessorNumber % MM_PROCESSOR_MASK_BITS);
     Process = PsGetCurrentProcess();
-    if ((MmInvalidateIpiAddress >= KERNEL_VA_START) ||
-        (Process->AddressSpace == MmInvalidateIpiAddressSpace)) {
+    for (Index = 0; Index < MmTlbInvalidateRequestCount; Index += 1) {
+        Request = &(MmTlbInvalidateRequests[Index]);
+        if ((Request->PendingProcessors[Word] & Mask) == 0) {
+            continue;
+        }
+
+        //
+        // Don't read the request until its pending bit has been seen, as the
+        // bit is what publishes it.
+        //
 
-        Address = MmInvalidateIpiAddress;
-        for (Index = 0; Index < MmInvalidateIpiPageCount; Index += 1) {
-            ArInvalidateTlbEntry(Address);
-            Address = (PVOID)((UINTN)Address + PageSize);
+        RtlMemoryBarrier();
+        if ((Request->Address >= KERNEL_VA_START) ||
+            (Process->AddressSpace == Request->AddressSpace)) {
+
+            MmpInvalidateTlbRange(Request->Address, Request->PageCount);
         }
+
+        RtlAtomicAnd32(&(Request->PendingProcessors[Word]), ~Mask);
     }
 
-    RtlAtomicAdd32(&MmInvalidateIpiProcessorsRemaining, -1);
     KeLowerRunLevel(OldRunLevel);
     return InterruptStatusClaimed;
 }
 
+KSTATUS
+MmpInitializeTlbInvalidation (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates the per-processor TLB invalidation requests. It
+    must be called before any application processors are started.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN AllocationSize;
+    ULONG Count;
+    ULONG Index;
+    volatile ULONG *Masks;
+    PMM_TLB_INVALIDATE_REQUEST Requests;
+    ULONG Words;
+
+    ASSERT(KeGetActiveProcessorCount() == 1);
+
+    Count = HlGetMaximumProcessorCount();
+    if (Count == 0) {
+        Count = 1;
+    }
+
+    Words = (Count + MM_PROCESSOR_MASK_BITS - 1) / MM_PROCESSOR_MASK_BITS;
+    AllocationSize = (sizeof(MM_TLB_INVALIDATE_REQUEST) * Count) +
+                     (sizeof(ULONG) * Words * Count);
+
+    Requests = MmAllocateNonPagedPool(AllocationSize, MM_ALLOCATION_TAG);
+    if (Requests == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(Requests, AllocationSize);
+    Masks = (volatile ULONG *)(Requests + Count);
+    for (Index = 0; Index < Count; Index += 1) {
+        Requests[Index].PendingProcessors = Masks + (Index * Words);
+    }
+
+    MmTlbInvalidateMaskWords = Words;
+    MmTlbInvalidateRequests = Requests;
+    MmTlbInvalidateRequestCount = Count;
+    return STATUS_SUCCESS;
+}
+
+VOID
+MmpSetAddressSpaceActive (
+    PADDRESS_SPACE AddressSpace,
+    ULONG ProcessorNumber
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records that the given processor is about to load the given
+    address space. This must be called before the switch so that a concurrent
+    TLB invalidation either targets this processor or has already changed the
+    page tables it is about to use.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space being loaded.
+
+    ProcessorNumber - Supplies the number of the current processor.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Mask;
+    ULONG Word;
+
+    if (ProcessorNumber >= ADDRESS_SPACE_TRACKED_PROCESSORS) {
+        return;
+    }
+
+    Word = ProcessorNumber / MM_PROCESSOR_MASK_BITS;
+    Mask = 1U << (ProcessorNumber % MM_PROCESSOR_MASK_BITS);
+
+    //
+    // The atomic OR doubles as the full barrier ordering this against the
+    // page table walks that follow the switch. Skip it if the bit is already
+    // set, which is the common case of switching between threads of the same
+    // process.
+    //
+
+    if ((AddressSpace->ActiveProcessors[Word] & Mask) == 0) {
+        RtlAtomicOr32(&(AddressSpace->ActiveProcessors[Word]), Mask);
+    }
+
+    return;
+}
+
+VOID
+MmpSetAddressSpaceInactive (
+    PADDRESS_SPACE AddressSpace,
+    ULONG ProcessorNumber
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records that the given processor has switched away from the
+    given address space. This must only be called after the switch has removed
+    the address space's entries from the processor's TLB.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space that was unloaded.
+
+    ProcessorNumber - Supplies the number of the current processor.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Mask;
+    ULONG Word;
+
+    if (ProcessorNumber >= ADDRESS_SPACE_TRACKED_PROCESSORS) {
+        return;
+    }
+
+    Word = ProcessorNumber / MM_PROCESSOR_MASK_BITS;
+    Mask = 1U << (ProcessorNumber % MM_PROCESSOR_MASK_BITS);
+    RtlAtomicAnd32(&(AddressSpace->ActiveProcessors[Word]), ~Mask);
+    return;
+}
+
 VOID
 MmpSendTlbInvalidateIpi (
     PADDRESS_SPACE AddressSpace,
@@ -121,7 +344,10 @@ MmpSendTlbInvalidateIpi (
 
 Routine Description:
 
-    This routine invalidates the given TLB entry on all active processors.
+    This routine invalidates the given TLB entries on every processor that
+    could have them cached: all active processors for kernel addresses, and
+    only the processors with the address space loaded for user addresses.
+    Large user mode ranges are invalidated by flushing the whole TLB.
 
 Arguments:
 
@@ -139,11 +365,17 @@ Return Value:
 
 {
 
+    ULONG ActiveCount;
+    ULONG Bit;
     RUNLEVEL OldRunLevel;
-    ULONG PageIndex;
-    ULONG PageSize;
+    PKPROCESS Process;
+    ULONG ProcessorNumber;
     PROCESSOR_SET ProcessorSet;
+    PMM_TLB_INVALIDATE_REQUEST Request;
     KSTATUS Status;
+    ULONG TargetCount;
+    ULONG Targets;
+    ULONG Word;
 
     //
     // If there is only one processor in the system, do the invalidate
@@ -151,42 +383,103 @@ Return Value:
     //
 
     if (KeGetActiveProcessorCount() == 1) {
-        PageSize = MmPageSize();
-        for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
-            ArInvalidateTlbEntry(VirtualAddress);
-            VirtualAddress = (PVOID)((UINTN)VirtualAddress + PageSize);
-        }
-
+        MmpInvalidateTlbRange(VirtualAddress, PageCount);
         return;
     }
 
     OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
-    KeAcquireSpinLock(&MmInvalidateIpiLock);
-    MmInvalidateIpiAddressSpace = AddressSpace;
-    MmInvalidateIpiAddress = VirtualAddress;
-    MmInvalidateIpiPageCount = PageCount;
-    MmInvalidateIpiProcessorsRemaining = KeGetActiveProcessorCount();
+    ProcessorNumber = KeGetCurrentProcessorNumber();
+    ActiveCount = KeGetActiveProcessorCount();
+
+    ASSERT(ProcessorNumber < MmTlbInvalidateRequestCount);
+
+    Request = &(MmTlbInvalidateRequests[ProcessorNumber]);
+    Request->AddressSpace = AddressSpace;
+    Request->Address = VirtualAddress;
+    Request->PageCount = PageCount;
+
+    //
+    // Clean up this processor's TLB directly rather than interrupting itself.
+    //
+
+    Process = PsGetCurrentProcess();
+    if ((VirtualAddress >= KERNEL_VA_START) ||
+        (Process->AddressSpace == AddressSpace)) {
+
+        MmpInvalidateTlbRange(VirtualAddress, PageCount);
+    }
+
+    //
+    // The caller has already changed the page tables. Make sure that is
+    // visible before looking at which processors are using the address space:
+    // a processor that loads the address space after this point will walk the
+    // new page tables.
+    //
+
     RtlMemoryBarrier();
+    TargetCount = 0;
+    for (Word = 0; Word < MmTlbInvalidateMaskWords; Word += 1) {
+        Targets = MmpGetTlbInvalidateTargets(AddressSpace,
+                                             VirtualAddress,
+                                             Word,
+                                             ActiveCount);
+
+        if (Word == (ProcessorNumber / MM_PROCESSOR_MASK_BITS)) {
+            Targets &= ~(1U << (ProcessorNumber % MM_PROCESSOR_MASK_BITS));
+        }
+
+        ASSERT(Request->PendingProcessors[Word] == 0);
+
+        Request->PendingProcessors[Word] = Targets;
+        TargetCount += RtlCountSetBits32(Targets);
+    }
+
+    if (TargetCount == 0) {
+        goto SendTlbInvalidateIpiEnd;
+    }
 
     //
-    // Send out the IPI.
+    // Send out the IPI. If every other processor needs it, a single broadcast
+    // is cheaper than addressing each one.
     //
 
-    ProcessorSet.Target = ProcessorTargetAll;
-    Status = HlSendIpi(IpiTypeTlbFlush, &ProcessorSet);
-    if (!KSUCCESS(Status)) {
-        KeCrashSystem(CRASH_IPI_FAILURE, Status, 0, 0, 0);
+    RtlMemoryBarrier();
+    if (TargetCount == (ActiveCount - 1)) {
+        ProcessorSet.Target = ProcessorTargetAllExcludingSelf;
+        Status = HlSendIpi(IpiTypeTlbFlush, &ProcessorSet);
+        if (!KSUCCESS(Status)) {
+            KeCrashSystem(CRASH_IPI_FAILURE, Status, 0, 0, 0);
+        }
+
+    } else {
+        ProcessorSet.Target = ProcessorTargetSingleProcessor;
+        for (Word = 0; Word < MmTlbInvalidateMaskWords; Word += 1) {
+            Targets = Request->PendingProcessors[Word];
+            while (Targets != 0) {
+                Bit = RtlCountTrailingZeros32(Targets);
+                Targets &= ~(1U << Bit);
+                ProcessorSet.U.Number = (Word * MM_PROCESSOR_MASK_BITS) + Bit;
+                Status = HlSendIpi(IpiTypeTlbFlush, &ProcessorSet);
+                if (!KSUCCESS(Status)) {
+                    KeCrashSystem(CRASH_IPI_FAILURE, Status, 0, 0, 0);
+                }
+            }
+        }
     }
 
     //
-    // Spin waiting for the IPI to complete on all processors before returning.
+    // Spin waiting for the IPI to complete on all targeted processors before
+    // returning. Interrupts remain enabled, so requests from other
+    // processors continue to be serviced here in the meantime.
     //
 
-    while (MmInvalidateIpiProcessorsRemaining != 0) {
-        ArProcessorYield();
+    for (Word = 0; Word < MmTlbInvalidateMaskWords; Word += 1) {
+        while (Request->PendingProcessors[Word] != 0) {
+            ArProcessorYield();
+        }
     }
 
-    KeReleaseSpinLock(&MmInvalidateIpiLock);
+SendTlbInvalidateIpiEnd:
     KeLowerRunLevel(OldRunLevel);
     return;
 }
@@ -195,3 +488,117 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+VOID
+MmpInvalidateTlbRange (
+    PVOID VirtualAddress,
+    ULONG PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine invalidates a range of TLB entries on the current processor.
+    User mode ranges above a threshold are handled by flushing the whole TLB,
+    which leaves global kernel entries alone.
+
+Arguments:
+
+    VirtualAddress - Supplies the first virtual address to invalidate.
+
+    PageCount - Supplies the number of pages to invalidate.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG PageIndex;
+    ULONG PageSize;
+
+    if ((VirtualAddress < KERNEL_VA_START) &&
+        (PageCount > MM_TLB_FLUSH_ALL_THRESHOLD)) {
+
+        ArInvalidateEntireTlb();
+        return;
+    }
+
+    PageSize = MmPageSize();
+    for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+        ArInvalidateTlbEntry(VirtualAddress);
+        VirtualAddress = (PVOID)((UINTN)VirtualAddress + PageSize);
+    }
+
+    return;
+}
+
+ULONG
+MmpGetTlbInvalidateTargets (
+    PADDRESS_SPACE AddressSpace,
+    PVOID VirtualAddress,
+    ULONG Word,
+    ULONG ActiveCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines which processors described by one word of a
+    processor mask need to invalidate the given address.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space being invalidated.
+
+    VirtualAddress - Supplies the virtual address being invalidated.
+
+    Word - Supplies the index of the processor mask word to compute.
+
+    ActiveCount - Supplies the number of active processors.
+
+Return Value:
+
+    Returns the mask of processors in the given word that need the IPI.
+
+--*/
+
+{
+
+    ULONG FirstProcessor;
+    ULONG Targets;
+
+    //
+    // Only processors that have been started can respond.
+    //
+
+    FirstProcessor = Word * MM_PROCESSOR_MASK_BITS;
+    if (FirstProcessor >= ActiveCount) {
+        return 0;
+    }
+
+    if ((ActiveCount - FirstProcessor) >= MM_PROCESSOR_MASK_BITS) {
+        Targets = MAX_ULONG;
+
+    } else {
+        Targets = (1U << (ActiveCount - FirstProcessor)) - 1;
+    }
+
+    //
+    // Kernel addresses are visible in every address space. User addresses
+    // only need to go to the processors using the address space, where those
+    // are tracked.
+    //
+
+    if ((VirtualAddress < KERNEL_VA_START) &&
+        (Word < ADDRESS_SPACE_PROCESSOR_WORDS)) {
+
+        Targets &= AddressSpace->ActiveProcessors[Word];
+    }
+
+    return Targets;
+}
+
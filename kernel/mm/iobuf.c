@@ -531,6 +531,98 @@ Return Value:
     return IoBuffer;
 }
 
+KERNEL_API
+PIO_BUFFER
+MmReferenceIoBufferRange (
+    PIO_BUFFER IoBuffer,
+    UINTN Offset,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new I/O buffer that describes a range of a page
+    cache backed I/O buffer without copying it. The new buffer takes its own
+    references on the page cache entries, so the data stays valid after the
+    original buffer is freed.
+
+Arguments:
+
+    IoBuffer - Supplies a pointer to the page cache backed I/O buffer.
+
+    Offset - Supplies the offset into the I/O buffer where the range begins.
+
+    Size - Supplies the size of the range, in bytes.
+
+Return Value:
+
+    Returns a pointer to the new I/O buffer on success. Offset zero of the new
+    buffer corresponds to the start of the range. The caller must free it with
+    MmFreeIoBuffer.
+
+    NULL if any page in the range is not backed by the page cache or on
+    allocation failure.
+
+--*/
+
+{
+
+    UINTN EndOffset;
+    ULONG InternalFlags;
+    PVOID PageCacheEntry;
+    UINTN PageIndex;
+    UINTN PageOffset;
+    ULONG PageSize;
+    PIO_BUFFER Reference;
+    UINTN StartOffset;
+
+    InternalFlags = IoBuffer->Internal.Flags;
+    if ((Size == 0) ||
+        ((InternalFlags & IO_BUFFER_INTERNAL_FLAG_CACHE_BACKED) == 0) ||
+        ((InternalFlags & IO_BUFFER_INTERNAL_FLAG_USER_MODE) != 0)) {
+
+        return NULL;
+    }
+
+    PageSize = MmPageSize();
+    Offset += IoBuffer->Internal.CurrentOffset;
+    StartOffset = ALIGN_RANGE_DOWN(Offset, PageSize);
+    EndOffset = ALIGN_RANGE_UP(Offset + Size, PageSize);
+
+    ASSERT((Offset + Size) <= IoBuffer->Internal.TotalSize);
+
+    if ((EndOffset >> MmPageShift()) > IoBuffer->Internal.PageCacheEntryCount) {
+        return NULL;
+    }
+
+    Reference = MmAllocateUninitializedIoBuffer(EndOffset - StartOffset, 0);
+    if (Reference == NULL) {
+        return NULL;
+    }
+
+    for (PageOffset = StartOffset;
+         PageOffset < EndOffset;
+         PageOffset += PageSize) {
+
+        PageIndex = PageOffset >> MmPageShift();
+        PageCacheEntry = IoBuffer->Internal.PageCacheEntries[PageIndex];
+        if (PageCacheEntry == NULL) {
+            MmFreeIoBuffer(Reference);
+            return NULL;
+        }
+
+        MmIoBufferAppendPage(Reference,
+                             PageCacheEntry,
+                             NULL,
+                             INVALID_PHYSICAL_ADDRESS);
+    }
+
+    Reference->Internal.CurrentOffset = Offset - StartOffset;
+    return Reference;
+}
+
 KERNEL_API
 KSTATUS
 MmCreateIoBuffer (
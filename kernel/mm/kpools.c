@@ -52,6 +52,37 @@ Module Name:
 
 #define KERNEL_STACK_CACHE_SIZE 10
 
+//
+// Define the number of pool types that have per-processor caches, and a
+// macro to convert a pool type into an index into the cache arrays.
+//
+
+#define POOL_CACHE_TYPE_COUNT 2
+#define POOL_CACHE_TYPE_INDEX(_PoolType) ((_PoolType) - PoolTypeNonPaged)
+
+//
+// Define the number of object size classes the pool caches hold, and the
+// largest allocation that goes through the caches.
+//
+
+#define POOL_CACHE_CLASS_COUNT 10
+#define POOL_CACHE_MAX_SIZE 1024
+#define POOL_CACHE_NO_CLASS ((ULONG)-1)
+
+//
+// Define the number of objects a single magazine holds.
+//
+
+#define POOL_MAGAZINE_ROUNDS 15
+
+//
+// Define the number of full and empty magazines per size class the depot
+// keeps before a reclaim pass starts handing them back to the pool.
+//
+
+#define POOL_DEPOT_FULL_LIMIT 8
+#define POOL_DEPOT_EMPTY_LIMIT 4
+
 //
 // Do not collect pool tag statistics on non-debug builds.
 //
@@ -94,6 +125,17 @@ MmpContractNonPagedPool (
     UINTN Size
     );
 
+PVOID
+MmpExpandNonPagedPoolWithLargePages (
+    UINTN Size
+    );
+
+BOOL
+MmpIsPoolRangeLargePageBacked (
+    PVOID Memory,
+    UINTN Size
+    );
+
 PVOID
 MmpExpandPagedPool (
     PMEMORY_HEAP Heap,
@@ -115,10 +157,155 @@ MmpHandlePoolCorruption (
     PVOID Parameter
     );
 
+PVOID
+MmpAllocatePoolDirect (
+    POOL_TYPE PoolType,
+    UINTN Size,
+    ULONG Tag
+    );
+
+VOID
+MmpFreePoolDirect (
+    POOL_TYPE PoolType,
+    PVOID Allocation
+    );
+
+ULONG
+MmpGetPoolCacheClass (
+    UINTN Size
+    );
+
+PVOID
+MmpPoolCacheAllocate (
+    POOL_TYPE PoolType,
+    ULONG Class
+    );
+
+BOOL
+MmpPoolCacheFree (
+    POOL_TYPE PoolType,
+    PVOID Allocation
+    );
+
+VOID
+MmpReclaimPoolCaches (
+    PVOID Parameter
+    );
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure defines a magazine, a small stack of free pool objects of
+    a single size class.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous magazines in the
+        depot list this magazine is on, if any.
+
+    Rounds - Stores the number of objects currently in the magazine.
+
+    Objects - Stores the array of free objects.
+
+--*/
+
+typedef struct _POOL_MAGAZINE {
+    LIST_ENTRY ListEntry;
+    ULONG Rounds;
+    PVOID Objects[POOL_MAGAZINE_ROUNDS];
+} POOL_MAGAZINE, *PPOOL_MAGAZINE;
+
+/*++
+
+Structure Description:
+
+    This structure defines the magazines a processor has loaded for a single
+    pool type and size class.
+
+Members:
+
+    Loaded - Stores a pointer to the magazine allocations and frees are
+        currently served from.
+
+    Previous - Stores a pointer to the previously loaded magazine, which is
+        always either full or empty.
+
+--*/
+
+typedef struct _POOL_CACHE_SLOT {
+    PPOOL_MAGAZINE Loaded;
+    PPOOL_MAGAZINE Previous;
+} POOL_CACHE_SLOT, *PPOOL_CACHE_SLOT;
+
+/*++
+
+Structure Description:
+
+    This structure defines the per-processor pool cache.
+
+Members:
+
+    Slots - Stores the loaded magazines for each pool type and size class.
+
+    AllocateHits - Stores the number of allocations satisfied by the cache.
+
+    AllocateMisses - Stores the number of cacheable allocations that had to
+        go to the pool.
+
+    FreeHits - Stores the number of frees absorbed by the cache.
+
+    FreeMisses - Stores the number of cacheable frees that had to go to the
+        pool.
+
+--*/
+
+typedef struct _POOL_CACHE {
+    POOL_CACHE_SLOT Slots[POOL_CACHE_TYPE_COUNT][POOL_CACHE_CLASS_COUNT];
+    UINTN AllocateHits;
+    UINTN AllocateMisses;
+    UINTN FreeHits;
+    UINTN FreeMisses;
+} POOL_CACHE, *PPOOL_CACHE;
+
+/*++
+
+Structure Description:
+
+    This structure defines the global depot of magazines for a single pool
+    type and size class, shared by all processors.
+
+Members:
+
+    Lock - Stores the spin lock protecting the depot.
+
+    FullList - Stores the head of the list of full magazines.
+
+    EmptyList - Stores the head of the list of empty magazines.
+
+    FullCount - Stores the number of magazines on the full list.
+
+    EmptyCount - Stores the number of magazines on the empty list.
+
+    MinimumFullCount - Stores the lowest the full count has been since the
+        last reclaim pass. This many magazines went unused during that time
+        and can be handed back to the pool.
+
+--*/
+
+typedef struct _POOL_DEPOT {
+    KSPIN_LOCK Lock;
+    LIST_ENTRY FullList;
+    LIST_ENTRY EmptyList;
+    UINTN FullCount;
+    UINTN EmptyCount;
+    UINTN MinimumFullCount;
+} POOL_DEPOT, *PPOOL_DEPOT;
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -129,8 +316,16 @@ MmpHandlePoolCorruption (
 //
 
 MEMORY_HEAP MmNonPagedPool;
-KSPIN_LOCK MmNonPagedPoolLock;
+KQUEUED_SPIN_LOCK MmNonPagedPoolLock;
 RUNLEVEL MmNonPagedPoolOldRunLevel;
+
+//
+// Store a pointer to the queued spin lock handle of the current non-paged
+// pool lock holder. The pool expansion and contraction routines drop and
+// reacquire the lock on behalf of that holder.
+//
+
+PKQUEUED_SPIN_LOCK_HANDLE MmNonPagedPoolLockHandle;
 MEMORY_HEAP MmPagedPool;
 PQUEUED_LOCK MmPagedPoolLock = NULL;
 
@@ -144,6 +339,22 @@ KSPIN_LOCK MmFreeKernelStackLock;
 LIST_ENTRY MmFreeKernelStackList;
 ULONG MmFreeKernelStackCount;
 
+//
+// Small pool allocations are served from per-processor magazine caches
+// backed by a global depot. Objects sitting in the caches are still
+// allocated as far as the underlying heap is concerned, and stay accounted
+// to the tag of whoever first carved them out of the heap. Set this to FALSE
+// to send every allocation straight to the heap.
+//
+
+BOOL MmPoolCacheEnabled = FALSE;
+POOL_DEPOT MmPoolCacheDepots[POOL_CACHE_TYPE_COUNT][POOL_CACHE_CLASS_COUNT];
+PWORK_ITEM MmPoolCacheReclaimWorkItem;
+
+const ULONG MmPoolCacheSizes[POOL_CACHE_CLASS_COUNT] = {
+    32, 64, 96, 128, 192, 256, 384, 512, 768, 1024
+};
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -190,16 +401,73 @@ Return Value:
 {
 
     PVOID Allocation;
-    RUNLEVEL OldRunLevel;
+    ULONG Class;
 
     ASSERT((Size != 0) && (Tag != 0) && (Tag != 0xFFFFFFFF));
 
+    //
+    // Try to satisfy small allocations from this processor's cache. On a
+    // miss, round the request up to its size class so the object can be
+    // recycled through the cache once it's freed.
+    //
+
+    if ((MmPoolCacheEnabled != FALSE) &&
+        (Size <= POOL_CACHE_MAX_SIZE) &&
+        ((PoolType == PoolTypeNonPaged) || (PoolType == PoolTypePaged))) {
+
+        Class = MmpGetPoolCacheClass(Size);
+        Allocation = MmpPoolCacheAllocate(PoolType, Class);
+        if (Allocation != NULL) {
+            return Allocation;
+        }
+
+        Size = MmPoolCacheSizes[Class];
+    }
+
+    return MmpAllocatePoolDirect(PoolType, Size, Tag);
+}
+
+PVOID
+MmpAllocatePoolDirect (
+    POOL_TYPE PoolType,
+    UINTN Size,
+    ULONG Tag
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates memory directly from a kernel pool's heap,
+    bypassing the per-processor caches.
+
+Arguments:
+
+    PoolType - Supplies the type of pool to allocate from.
+
+    Size - Supplies the size of the allocation, in bytes.
+
+    Tag - Supplies an identifier to associate with the allocation.
+
+Return Value:
+
+    Returns the allocated memory if successful, or NULL on failure.
+
+--*/
+
+{
+
+    PVOID Allocation;
+    KQUEUED_SPIN_LOCK_HANDLE LockHandle;
+    RUNLEVEL OldRunLevel;
+
     if (PoolType == PoolTypeNonPaged) {
         OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
-        KeAcquireSpinLock(&MmNonPagedPoolLock);
+        KeAcquireQueuedSpinLock(&MmNonPagedPoolLock, &LockHandle);
+        MmNonPagedPoolLockHandle = &LockHandle;
         MmNonPagedPoolOldRunLevel = OldRunLevel;
         Allocation = RtlHeapAllocate(&MmNonPagedPool, Size, Tag);
-        KeReleaseSpinLock(&MmNonPagedPoolLock);
+        KeReleaseQueuedSpinLock(&MmNonPagedPoolLock);
         KeLowerRunLevel(OldRunLevel);
 
     } else if (PoolType == PoolTypePaged) {
@@ -264,17 +532,19 @@ Return Value:
 
 {
 
+    KQUEUED_SPIN_LOCK_HANDLE LockHandle;
     RUNLEVEL OldRunLevel;
 
     if (PoolType == PoolTypeNonPaged) {
         OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
-        KeAcquireSpinLock(&MmNonPagedPoolLock);
+        KeAcquireQueuedSpinLock(&MmNonPagedPoolLock, &LockHandle);
+        MmNonPagedPoolLockHandle = &LockHandle;
         Memory = RtlHeapReallocate(&MmNonPagedPool,
                                    Memory,
                                    NewSize,
                                    AllocationTag);
 
-        KeReleaseSpinLock(&MmNonPagedPoolLock);
+        KeReleaseQueuedSpinLock(&MmNonPagedPoolLock);
         KeLowerRunLevel(OldRunLevel);
 
     } else if (PoolType == PoolTypePaged) {
@@ -334,13 +604,55 @@ Return Value:
 
 {
 
+    if ((MmPoolCacheEnabled != FALSE) &&
+        (Allocation != NULL) &&
+        ((PoolType == PoolTypeNonPaged) || (PoolType == PoolTypePaged))) {
+
+        if (MmpPoolCacheFree(PoolType, Allocation) != FALSE) {
+            return;
+        }
+    }
+
+    MmpFreePoolDirect(PoolType, Allocation);
+    return;
+}
+
+VOID
+MmpFreePoolDirect (
+    POOL_TYPE PoolType,
+    PVOID Allocation
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees memory directly back to a kernel pool's heap,
+    bypassing the per-processor caches.
+
+Arguments:
+
+    PoolType - Supplies the type of pool the memory was allocated from.
+
+    Allocation - Supplies a pointer to the allocation to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    KQUEUED_SPIN_LOCK_HANDLE LockHandle;
     RUNLEVEL OldRunLevel;
 
     if (PoolType == PoolTypeNonPaged) {
         OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
-        KeAcquireSpinLock(&MmNonPagedPoolLock);
+        KeAcquireQueuedSpinLock(&MmNonPagedPoolLock, &LockHandle);
+        MmNonPagedPoolLockHandle = &LockHandle;
         RtlHeapFree(&MmNonPagedPool, Allocation);
-        KeReleaseSpinLock(&MmNonPagedPoolLock);
+        KeReleaseQueuedSpinLock(&MmNonPagedPoolLock);
         KeLowerRunLevel(OldRunLevel);
 
     } else if (PoolType == PoolTypePaged) {
@@ -400,6 +712,7 @@ Return Value:
 
 {
 
+    KQUEUED_SPIN_LOCK_HANDLE LockHandle;
     PVOID NonPagedPoolBuffer;
     BOOL NonPagedPoolLockHeld;
     ULONG NonPagedPoolSize;
@@ -425,7 +738,8 @@ Return Value:
     //
 
     OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
-    KeAcquireSpinLock(&MmNonPagedPoolLock);
+    KeAcquireQueuedSpinLock(&MmNonPagedPoolLock, &LockHandle);
+    MmNonPagedPoolLockHandle = &LockHandle;
     NonPagedPoolLockHeld = TRUE;
 
     //
@@ -463,7 +777,7 @@ Return Value:
                                  NonPagedPoolBuffer,
                                  NonPagedPoolSize);
 
-    KeReleaseSpinLock(&MmNonPagedPoolLock);
+    KeReleaseQueuedSpinLock(&MmNonPagedPoolLock);
     KeLowerRunLevel(OldRunLevel);
     NonPagedPoolLockHeld = FALSE;
     ProfilerMemoryPool = NonPagedPoolBuffer;
@@ -544,7 +858,7 @@ Return Value:
 GetPoolStatisticsEnd:
     if (!KSUCCESS(Status)) {
         if (NonPagedPoolLockHeld != FALSE) {
-            KeReleaseSpinLock(&MmNonPagedPoolLock);
+            KeReleaseQueuedSpinLock(&MmNonPagedPoolLock);
             KeLowerRunLevel(OldRunLevel);
         }
 
@@ -595,15 +909,17 @@ Return Value:
 
 {
 
+    KQUEUED_SPIN_LOCK_HANDLE LockHandle;
     RUNLEVEL OldRunLevel;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
     OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
-    KeAcquireSpinLock(&MmNonPagedPoolLock);
+    KeAcquireQueuedSpinLock(&MmNonPagedPoolLock, &LockHandle);
+    MmNonPagedPoolLockHandle = &LockHandle;
     RtlDebugPrint("Non-Paged Pool:\n");
     RtlHeapDebugPrintStatistics(&MmNonPagedPool);
-    KeReleaseSpinLock(&MmNonPagedPoolLock);
+    KeReleaseQueuedSpinLock(&MmNonPagedPoolLock);
     KeLowerRunLevel(OldRunLevel);
     if (MmPagedPoolLock != NULL) {
         KeAcquireQueuedLock(MmPagedPoolLock);
@@ -646,6 +962,7 @@ Return Value:
 
 {
 
+    KQUEUED_SPIN_LOCK_HANDLE LockHandle;
     RUNLEVEL OldRunLevel;
 
     if (Statistics->Version < MM_STATISTICS_VERSION) {
@@ -657,12 +974,13 @@ Return Value:
 
     ASSERT(OldRunLevel == RunLevelLow);
 
-    KeAcquireSpinLock(&MmNonPagedPoolLock);
+    KeAcquireQueuedSpinLock(&MmNonPagedPoolLock, &LockHandle);
+    MmNonPagedPoolLockHandle = &LockHandle;
     RtlCopyMemory(&(Statistics->NonPagedPool),
                   &(MmNonPagedPool.Statistics),
                   sizeof(MEMORY_HEAP_STATISTICS));
 
-    KeReleaseSpinLock(&MmNonPagedPoolLock);
+    KeReleaseQueuedSpinLock(&MmNonPagedPoolLock);
     KeLowerRunLevel(OldRunLevel);
     KeAcquireQueuedLock(MmPagedPoolLock);
     RtlCopyMemory(&(Statistics->PagedPool),
@@ -1007,6 +1325,135 @@ Return Value:
     return;
 }
 
+KSTATUS
+MmpInitializePoolCache (
+    ULONG Phase
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes the per-processor pool caches. Phase 0 runs on
+    every processor and sets up that processor's cache. Phase 1 runs once the
+    system work queue exists and creates the reclaim work item.
+
+Arguments:
+
+    Phase - Supplies the initialization phase.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PPOOL_CACHE Cache;
+    ULONG Class;
+    PPOOL_DEPOT Depot;
+    PPROCESSOR_BLOCK Processor;
+    KSTATUS Status;
+    ULONG TypeIndex;
+
+    if (Phase == 0) {
+        Processor = KeGetCurrentProcessorBlock();
+        if (Processor == NULL) {
+            Status = STATUS_SUCCESS;
+            goto InitializePoolCacheEnd;
+        }
+
+        if (Processor->ProcessorNumber == 0) {
+            for (TypeIndex = 0;
+                 TypeIndex < POOL_CACHE_TYPE_COUNT;
+                 TypeIndex += 1) {
+
+                for (Class = 0; Class < POOL_CACHE_CLASS_COUNT; Class += 1) {
+                    Depot = &(MmPoolCacheDepots[TypeIndex][Class]);
+                    KeInitializeSpinLock(&(Depot->Lock));
+                    INITIALIZE_LIST_HEAD(&(Depot->FullList));
+                    INITIALIZE_LIST_HEAD(&(Depot->EmptyList));
+                    Depot->FullCount = 0;
+                    Depot->EmptyCount = 0;
+                    Depot->MinimumFullCount = 0;
+                }
+            }
+        }
+
+        Cache = MmpAllocatePoolDirect(PoolTypeNonPaged,
+                                      sizeof(POOL_CACHE),
+                                      MM_POOL_CACHE_ALLOCATION_TAG);
+
+        if (Cache == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto InitializePoolCacheEnd;
+        }
+
+        RtlZeroMemory(Cache, sizeof(POOL_CACHE));
+        Processor->PoolCache = Cache;
+        if (Processor->ProcessorNumber == 0) {
+            MmPoolCacheEnabled = TRUE;
+        }
+
+    } else {
+
+        ASSERT(Phase == 1);
+
+        MmPoolCacheReclaimWorkItem = KeCreateWorkItem(
+                                                  NULL,
+                                                  WorkPriorityNormal,
+                                                  MmpReclaimPoolCaches,
+                                                  NULL,
+                                                  MM_POOL_CACHE_ALLOCATION_TAG);
+
+        if (MmPoolCacheReclaimWorkItem == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto InitializePoolCacheEnd;
+        }
+    }
+
+    Status = STATUS_SUCCESS;
+
+InitializePoolCacheEnd:
+    return Status;
+}
+
+VOID
+MmpQueuePoolCacheReclaim (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine schedules a pass that hands idle objects sitting in the
+    pool cache depot back to the pools. It can be called at dispatch level.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    //
+    // A failure here just means the reclaim pass is already queued.
+    //
+
+    if (MmPoolCacheReclaimWorkItem != NULL) {
+        KeQueueWorkItem(MmPoolCacheReclaimWorkItem);
+    }
+
+    return;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
@@ -1045,6 +1492,7 @@ Return Value:
 {
 
     BOOL LockHeld;
+    PKQUEUED_SPIN_LOCK_HANDLE LockHandle;
     RUNLEVEL OldRunLevel;
     ULONG PageSize;
     KSTATUS Status;
@@ -1057,6 +1505,13 @@ Return Value:
 
     ASSERT(ALIGN_RANGE_DOWN(Size, PageSize) == Size);
 
+    //
+    // The pool is growing, so hand back any idle objects the pool caches
+    // are sitting on to keep them from inflating the pool further.
+    //
+
+    MmpQueuePoolCacheReclaim();
+
     //
     // Free ranges must be allocated at low level. If the previous runlevel was
     // low then release the lock and lower back down to try the allocation.
@@ -1071,11 +1526,24 @@ Return Value:
     }
 
     OldRunLevel = MmNonPagedPoolOldRunLevel;
-    KeReleaseSpinLock(&MmNonPagedPoolLock);
+    LockHandle = MmNonPagedPoolLockHandle;
+    KeReleaseQueuedSpinLock(&MmNonPagedPoolLock);
     KeLowerRunLevel(OldRunLevel);
     LockHeld = FALSE;
-    VaRequest.Size = Size;
-    VaRequest.Alignment = PageSize;
+
+    //
+    // Back big expansions with large pages if possible to go easier on the
+    // TLB.
+    //
+
+    VaRequest.Address = MmpExpandNonPagedPoolWithLargePages(Size);
+    if (VaRequest.Address != NULL) {
+        Status = STATUS_SUCCESS;
+        goto ExpandNonPagedPoolEnd;
+    }
+
+    VaRequest.Size = Size;
+    VaRequest.Alignment = PageSize;
     VaRequest.Min = 0;
     VaRequest.Max = MAX_ADDRESS;
     VaRequest.MemoryType = MemoryTypeNonPagedPool;
@@ -1114,7 +1582,8 @@ Return Value:
 
     if (LockHeld == FALSE) {
         OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
-        KeAcquireSpinLock(&MmNonPagedPoolLock);
+        KeAcquireQueuedSpinLock(&MmNonPagedPoolLock, LockHandle);
+        MmNonPagedPoolLockHandle = LockHandle;
         MmNonPagedPoolOldRunLevel = OldRunLevel;
     }
 
@@ -1153,6 +1622,7 @@ Return Value:
 
 {
 
+    PKQUEUED_SPIN_LOCK_HANDLE LockHandle;
     RUNLEVEL OldRunLevel;
     UINTN PageSize;
     KSTATUS Status;
@@ -1174,8 +1644,19 @@ Return Value:
         goto ContractNonPagedPoolEnd;
     }
 
+    //
+    // Kernel large pages are never split or unmapped, so the pool has to hang
+    // on to any range that touches one.
+    //
+
+    if (MmpIsPoolRangeLargePageBacked(Memory, Size) != FALSE) {
+        Status = STATUS_RESOURCE_IN_USE;
+        goto ContractNonPagedPoolEnd;
+    }
+
     OldRunLevel = MmNonPagedPoolOldRunLevel;
-    KeReleaseSpinLock(&MmNonPagedPoolLock);
+    LockHandle = MmNonPagedPoolLockHandle;
+    KeReleaseQueuedSpinLock(&MmNonPagedPoolLock);
     KeLowerRunLevel(OldRunLevel);
     UnmapFlags = UNMAP_FLAG_FREE_PHYSICAL_PAGES |
                  UNMAP_FLAG_SEND_INVALIDATE_IPI;
@@ -1187,7 +1668,8 @@ Return Value:
                                     UnmapFlags);
 
     OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
-    KeAcquireSpinLock(&MmNonPagedPoolLock);
+    KeAcquireQueuedSpinLock(&MmNonPagedPoolLock, LockHandle);
+    MmNonPagedPoolLockHandle = LockHandle;
     MmNonPagedPoolOldRunLevel = OldRunLevel;
     if (!KSUCCESS(Status)) {
         goto ContractNonPagedPoolEnd;
@@ -1201,6 +1683,184 @@ Return Value:
     return TRUE;
 }
 
+PVOID
+MmpExpandNonPagedPoolWithLargePages (
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to expand non-paged pool with a region mapped by
+    large pages. It only succeeds if the size is a multiple of the large page
+    size, memory is not tight, and a physically contiguous run is free right
+    now. The resulting region can never be given back. This routine must be
+    called at low level.
+
+Arguments:
+
+    Size - Supplies the size of the expansion, in bytes.
+
+Return Value:
+
+    Returns a pointer to the mapped region on success.
+
+    NULL if the expansion should be done with small pages instead.
+
+--*/
+
+{
+
+    PVOID Address;
+    UINTN LargePageCount;
+    UINTN LargePageIndex;
+    ULONG LargePageShift;
+    UINTN LargePageSize;
+    ULONG MapFlags;
+    UINTN PageIndex;
+    ULONG PageShift;
+    ULONG PageSize;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    KSTATUS Status;
+    VM_ALLOCATION_PARAMETERS VaRequest;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    LargePageShift = MmpGetLargePageShift();
+    if (LargePageShift == 0) {
+        return NULL;
+    }
+
+    LargePageSize = (UINTN)1 << LargePageShift;
+    if ((Size < LargePageSize) || (IS_ALIGNED(Size, LargePageSize) == FALSE)) {
+        return NULL;
+    }
+
+    if (MmGetPhysicalMemoryWarningLevel() != MemoryWarningLevelNone) {
+        return NULL;
+    }
+
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    PhysicalAddress = MmpTryAllocatePhysicalPages(Size >> PageShift,
+                                                  LargePageSize >> PageShift);
+
+    if (PhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
+        return NULL;
+    }
+
+    VaRequest.Address = NULL;
+    VaRequest.Size = Size;
+    VaRequest.Alignment = LargePageSize;
+    VaRequest.Min = 0;
+    VaRequest.Max = MAX_ADDRESS;
+    VaRequest.MemoryType = MemoryTypeNonPagedPool;
+    VaRequest.Strategy = AllocationStrategyAnyAddress;
+    Status = MmpAllocateAddressRange(&MmKernelVirtualSpace, &VaRequest, FALSE);
+    if (!KSUCCESS(Status)) {
+        MmFreePhysicalPages(PhysicalAddress, Size >> PageShift);
+        return NULL;
+    }
+
+    //
+    // Map each large page. If a page table already covers one of the regions
+    // from some previous use, map that piece with small pages instead; the
+    // physical memory is already in hand, so nothing can fail from here on.
+    //
+
+    Address = VaRequest.Address;
+    MapFlags = MAP_FLAG_PRESENT | MAP_FLAG_GLOBAL;
+    LargePageCount = Size >> LargePageShift;
+    for (LargePageIndex = 0;
+         LargePageIndex < LargePageCount;
+         LargePageIndex += 1) {
+
+        Status = MmpMapLargePage(PhysicalAddress, Address, MapFlags);
+        if (KSUCCESS(Status)) {
+            Address += LargePageSize;
+            PhysicalAddress += LargePageSize;
+            continue;
+        }
+
+        for (PageIndex = 0;
+             PageIndex < (LargePageSize >> PageShift);
+             PageIndex += 1) {
+
+            MmpMapPage(PhysicalAddress, Address, MapFlags);
+            Address += PageSize;
+            PhysicalAddress += PageSize;
+        }
+    }
+
+    return VaRequest.Address;
+}
+
+BOOL
+MmpIsPoolRangeLargePageBacked (
+    PVOID Memory,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether any part of the given pool region is
+    mapped by a large page.
+
+Arguments:
+
+    Memory - Supplies the base of the region.
+
+    Size - Supplies the size of the region, in bytes.
+
+Return Value:
+
+    TRUE if some part of the region is mapped with a large page.
+
+    FALSE if the region is entirely mapped with small pages.
+
+--*/
+
+{
+
+    PVOID Address;
+    ULONG Attributes;
+    PVOID End;
+    ULONG LargePageShift;
+    UINTN LargePageSize;
+    PVOID Next;
+
+    LargePageShift = MmpGetLargePageShift();
+    if (LargePageShift == 0) {
+        return FALSE;
+    }
+
+    //
+    // Check the start of the region and each large page boundary within it.
+    //
+
+    LargePageSize = (UINTN)1 << LargePageShift;
+    Address = Memory;
+    End = Memory + Size;
+    while (Address < End) {
+        MmpVirtualToPhysical(Address, &Attributes);
+        if ((Attributes & MAP_FLAG_LARGE_PAGE) != 0) {
+            return TRUE;
+        }
+
+        Next = ALIGN_POINTER_DOWN(Address, LargePageSize) + LargePageSize;
+        if (Next <= Address) {
+            break;
+        }
+
+        Address = Next;
+    }
+
+    return FALSE;
+}
+
 PVOID
 MmpExpandPagedPool (
     PMEMORY_HEAP Heap,
@@ -1246,6 +1906,13 @@ Return Value:
 
     ASSERT(ALIGN_RANGE_DOWN(Size, PageSize) == Size);
 
+    //
+    // The pool is growing, so hand back any idle objects the pool caches
+    // are sitting on to keep them from inflating the pool further.
+    //
+
+    MmpQueuePoolCacheReclaim();
+
     VaRequest.Address = NULL;
     VaRequest.Size = Size;
     VaRequest.Alignment = PageSize;
@@ -1384,3 +2051,449 @@ Return Value:
     return;
 }
 
+ULONG
+MmpGetPoolCacheClass (
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the smallest pool cache size class that can hold an
+    allocation of the given size.
+
+Arguments:
+
+    Size - Supplies the size of the allocation, in bytes.
+
+Return Value:
+
+    Returns the size class index.
+
+    POOL_CACHE_NO_CLASS if the allocation is too big to be cached.
+
+--*/
+
+{
+
+    ULONG Class;
+
+    for (Class = 0; Class < POOL_CACHE_CLASS_COUNT; Class += 1) {
+        if (Size <= MmPoolCacheSizes[Class]) {
+            return Class;
+        }
+    }
+
+    return POOL_CACHE_NO_CLASS;
+}
+
+PVOID
+MmpPoolCacheAllocate (
+    POOL_TYPE PoolType,
+    ULONG Class
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to allocate an object from the current processor's
+    pool cache, refilling the loaded magazine from the depot if needed.
+
+Arguments:
+
+    PoolType - Supplies the type of pool to allocate from.
+
+    Class - Supplies the size class of the allocation.
+
+Return Value:
+
+    Returns a pointer to the allocation on success.
+
+    NULL if the cache had nothing to give.
+
+--*/
+
+{
+
+    PVOID Allocation;
+    PPOOL_CACHE Cache;
+    PPOOL_DEPOT Depot;
+    PPOOL_MAGAZINE Full;
+    PPOOL_MAGAZINE Magazine;
+    RUNLEVEL OldRunLevel;
+    PPOOL_CACHE_SLOT Slot;
+    ULONG TypeIndex;
+
+    ASSERT(Class < POOL_CACHE_CLASS_COUNT);
+
+    Allocation = NULL;
+    TypeIndex = POOL_CACHE_TYPE_INDEX(PoolType);
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    Cache = KeGetCurrentProcessorBlock()->PoolCache;
+    if (Cache == NULL) {
+        goto PoolCacheAllocateEnd;
+    }
+
+    Slot = &(Cache->Slots[TypeIndex][Class]);
+    Magazine = Slot->Loaded;
+
+    //
+    // If the loaded magazine is empty, swap in the previous one if it's full.
+    // Otherwise, trade the empty previous magazine in for a full one from the
+    // depot.
+    //
+
+    if ((Magazine == NULL) || (Magazine->Rounds == 0)) {
+        if ((Slot->Previous != NULL) && (Slot->Previous->Rounds != 0)) {
+            Slot->Loaded = Slot->Previous;
+            Slot->Previous = Magazine;
+
+        } else {
+            Depot = &(MmPoolCacheDepots[TypeIndex][Class]);
+            KeAcquireSpinLock(&(Depot->Lock));
+            if (LIST_EMPTY(&(Depot->FullList)) == FALSE) {
+                Full = LIST_VALUE(Depot->FullList.Next,
+                                  POOL_MAGAZINE,
+                                  ListEntry);
+
+                LIST_REMOVE(&(Full->ListEntry));
+                Depot->FullCount -= 1;
+                if (Depot->FullCount < Depot->MinimumFullCount) {
+                    Depot->MinimumFullCount = Depot->FullCount;
+                }
+
+                if (Slot->Previous != NULL) {
+                    INSERT_BEFORE(&(Slot->Previous->ListEntry),
+                                  &(Depot->EmptyList));
+
+                    Depot->EmptyCount += 1;
+                }
+
+                Slot->Previous = Magazine;
+                Slot->Loaded = Full;
+            }
+
+            KeReleaseSpinLock(&(Depot->Lock));
+        }
+
+        Magazine = Slot->Loaded;
+    }
+
+    if ((Magazine != NULL) && (Magazine->Rounds != 0)) {
+        Magazine->Rounds -= 1;
+        Allocation = Magazine->Objects[Magazine->Rounds];
+        Cache->AllocateHits += 1;
+
+    } else {
+        Cache->AllocateMisses += 1;
+    }
+
+PoolCacheAllocateEnd:
+    KeLowerRunLevel(OldRunLevel);
+    return Allocation;
+}
+
+BOOL
+MmpPoolCacheFree (
+    POOL_TYPE PoolType,
+    PVOID Allocation
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to stash a freed pool allocation in the current
+    processor's pool cache.
+
+Arguments:
+
+    PoolType - Supplies the type of pool the allocation came from.
+
+    Allocation - Supplies a pointer to the allocation being freed.
+
+Return Value:
+
+    TRUE if the cache took the allocation.
+
+    FALSE if the allocation should be freed back to the pool.
+
+--*/
+
+{
+
+    BOOL AllocatedMagazine;
+    PPOOL_CACHE Cache;
+    ULONG Class;
+    PPOOL_DEPOT Depot;
+    PPOOL_MAGAZINE Empty;
+    BOOL Freed;
+    PMEMORY_HEAP Heap;
+    PPOOL_MAGAZINE Magazine;
+    PPOOL_MAGAZINE NewMagazine;
+    RUNLEVEL OldRunLevel;
+    BOOL QueueReclaim;
+    PPOOL_CACHE_SLOT Slot;
+    ULONG TypeIndex;
+    UINTN UsableSize;
+
+    //
+    // Figure out which size class the allocation can serve. The heap may
+    // have handed back a bit more than the class size, but don't waste too
+    // much by caching a big chunk under a small class.
+    //
+
+    Heap = &MmNonPagedPool;
+    if (PoolType == PoolTypePaged) {
+        Heap = &MmPagedPool;
+    }
+
+    UsableSize = RtlHeapGetAllocationSize(Heap, Allocation);
+    Class = POOL_CACHE_CLASS_COUNT;
+    while (Class != 0) {
+        if (MmPoolCacheSizes[Class - 1] <= UsableSize) {
+            break;
+        }
+
+        Class -= 1;
+    }
+
+    if (Class == 0) {
+        return FALSE;
+    }
+
+    Class -= 1;
+    if (UsableSize >
+        (MmPoolCacheSizes[Class] + (MmPoolCacheSizes[Class] / 2))) {
+
+        return FALSE;
+    }
+
+    AllocatedMagazine = FALSE;
+    Freed = FALSE;
+    NewMagazine = NULL;
+    QueueReclaim = FALSE;
+    TypeIndex = POOL_CACHE_TYPE_INDEX(PoolType);
+    Depot = &(MmPoolCacheDepots[TypeIndex][Class]);
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    while (TRUE) {
+        Cache = KeGetCurrentProcessorBlock()->PoolCache;
+        if (Cache == NULL) {
+            break;
+        }
+
+        Slot = &(Cache->Slots[TypeIndex][Class]);
+        Magazine = Slot->Loaded;
+
+        //
+        // If the loaded magazine is full, swap in the previous one if it's
+        // empty. Otherwise, trade the full previous magazine in for an empty
+        // one from the depot.
+        //
+
+        if ((Magazine == NULL) || (Magazine->Rounds == POOL_MAGAZINE_ROUNDS)) {
+            if ((Slot->Previous != NULL) && (Slot->Previous->Rounds == 0)) {
+                Slot->Loaded = Slot->Previous;
+                Slot->Previous = Magazine;
+
+            } else {
+                Empty = NULL;
+                KeAcquireSpinLock(&(Depot->Lock));
+                if (LIST_EMPTY(&(Depot->EmptyList)) == FALSE) {
+                    Empty = LIST_VALUE(Depot->EmptyList.Next,
+                                       POOL_MAGAZINE,
+                                       ListEntry);
+
+                    LIST_REMOVE(&(Empty->ListEntry));
+                    Depot->EmptyCount -= 1;
+
+                } else if (NewMagazine != NULL) {
+                    Empty = NewMagazine;
+                    NewMagazine = NULL;
+                }
+
+                if (Empty != NULL) {
+                    if (Slot->Previous != NULL) {
+                        INSERT_BEFORE(&(Slot->Previous->ListEntry),
+                                      &(Depot->FullList));
+
+                        Depot->FullCount += 1;
+                        if (Depot->FullCount > POOL_DEPOT_FULL_LIMIT) {
+                            QueueReclaim = TRUE;
+                        }
+                    }
+
+                    Slot->Previous = Magazine;
+                    Slot->Loaded = Empty;
+                }
+
+                KeReleaseSpinLock(&(Depot->Lock));
+            }
+
+            Magazine = Slot->Loaded;
+        }
+
+        if ((Magazine != NULL) && (Magazine->Rounds < POOL_MAGAZINE_ROUNDS)) {
+            Magazine->Objects[Magazine->Rounds] = Allocation;
+            Magazine->Rounds += 1;
+            Cache->FreeHits += 1;
+            Freed = TRUE;
+            break;
+        }
+
+        //
+        // There are no empty magazines around. Go allocate one and try again,
+        // but only once.
+        //
+
+        if (AllocatedMagazine != FALSE) {
+            Cache->FreeMisses += 1;
+            break;
+        }
+
+        KeLowerRunLevel(OldRunLevel);
+        AllocatedMagazine = TRUE;
+        NewMagazine = MmpAllocatePoolDirect(PoolTypeNonPaged,
+                                            sizeof(POOL_MAGAZINE),
+                                            MM_POOL_CACHE_ALLOCATION_TAG);
+
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        if (NewMagazine == NULL) {
+            Cache = KeGetCurrentProcessorBlock()->PoolCache;
+            Cache->FreeMisses += 1;
+            break;
+        }
+
+        NewMagazine->Rounds = 0;
+    }
+
+    KeLowerRunLevel(OldRunLevel);
+    if (NewMagazine != NULL) {
+        MmpFreePoolDirect(PoolTypeNonPaged, NewMagazine);
+    }
+
+    if (QueueReclaim != FALSE) {
+        MmpQueuePoolCacheReclaim();
+    }
+
+    return Freed;
+}
+
+VOID
+MmpReclaimPoolCaches (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands idle magazines in the pool cache depots back to the
+    pools. Full magazines that went untouched since the last pass are freed,
+    as are any beyond the depot limits. Under memory pressure the depots are
+    emptied entirely. Freeing the objects back to the heaps lets the normal
+    pool contraction path return whole pages to the system.
+
+Arguments:
+
+    Parameter - Supplies an unused parameter.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL Aggressive;
+    ULONG Class;
+    PPOOL_DEPOT Depot;
+    UINTN EmptyRelease;
+    LIST_ENTRY FreeList;
+    UINTN FullRelease;
+    PPOOL_MAGAZINE Magazine;
+    RUNLEVEL OldRunLevel;
+    POOL_TYPE PoolType;
+    ULONG Round;
+    ULONG TypeIndex;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    Aggressive = FALSE;
+    if (MmGetPhysicalMemoryWarningLevel() != MemoryWarningLevelNone) {
+        Aggressive = TRUE;
+    }
+
+    for (TypeIndex = 0; TypeIndex < POOL_CACHE_TYPE_COUNT; TypeIndex += 1) {
+        PoolType = PoolTypeNonPaged + TypeIndex;
+        for (Class = 0; Class < POOL_CACHE_CLASS_COUNT; Class += 1) {
+            Depot = &(MmPoolCacheDepots[TypeIndex][Class]);
+            INITIALIZE_LIST_HEAD(&FreeList);
+            OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+            KeAcquireSpinLock(&(Depot->Lock));
+            if (Aggressive != FALSE) {
+                FullRelease = Depot->FullCount;
+                EmptyRelease = Depot->EmptyCount;
+
+            } else {
+                FullRelease = Depot->MinimumFullCount;
+                if (Depot->FullCount - FullRelease > POOL_DEPOT_FULL_LIMIT) {
+                    FullRelease = Depot->FullCount - POOL_DEPOT_FULL_LIMIT;
+                }
+
+                EmptyRelease = 0;
+                if (Depot->EmptyCount > POOL_DEPOT_EMPTY_LIMIT) {
+                    EmptyRelease = Depot->EmptyCount - POOL_DEPOT_EMPTY_LIMIT;
+                }
+            }
+
+            ASSERT(FullRelease <= Depot->FullCount);
+
+            Depot->FullCount -= FullRelease;
+            while (FullRelease != 0) {
+                Magazine = LIST_VALUE(Depot->FullList.Previous,
+                                      POOL_MAGAZINE,
+                                      ListEntry);
+
+                LIST_REMOVE(&(Magazine->ListEntry));
+                INSERT_BEFORE(&(Magazine->ListEntry), &FreeList);
+                FullRelease -= 1;
+            }
+
+            Depot->EmptyCount -= EmptyRelease;
+            while (EmptyRelease != 0) {
+                Magazine = LIST_VALUE(Depot->EmptyList.Previous,
+                                      POOL_MAGAZINE,
+                                      ListEntry);
+
+                LIST_REMOVE(&(Magazine->ListEntry));
+                INSERT_BEFORE(&(Magazine->ListEntry), &FreeList);
+                EmptyRelease -= 1;
+            }
+
+            Depot->MinimumFullCount = Depot->FullCount;
+            KeReleaseSpinLock(&(Depot->Lock));
+            KeLowerRunLevel(OldRunLevel);
+
+            //
+            // Free the released objects and magazines outside the depot lock.
+            //
+
+            while (LIST_EMPTY(&FreeList) == FALSE) {
+                Magazine = LIST_VALUE(FreeList.Next, POOL_MAGAZINE, ListEntry);
+                LIST_REMOVE(&(Magazine->ListEntry));
+                for (Round = 0; Round < Magazine->Rounds; Round += 1) {
+                    MmpFreePoolDirect(PoolType, Magazine->Objects[Round]);
+                }
+
+                MmpFreePoolDirect(PoolTypeNonPaged, Magazine);
+            }
+        }
+    }
+
+    return;
+}
+
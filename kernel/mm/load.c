@@ -670,6 +670,18 @@ Return Value:
             SectionFlags |= IMAGE_SECTION_SHARED;
         }
 
+        //
+        // Record any access pattern advice given up front. Random wins if
+        // the caller supplied both.
+        //
+
+        if ((MapFlags & SYS_MAP_FLAG_RANDOM) != 0) {
+            SectionFlags |= IMAGE_SECTION_RANDOM;
+
+        } else if ((MapFlags & SYS_MAP_FLAG_SEQUENTIAL) != 0) {
+            SectionFlags |= IMAGE_SECTION_SEQUENTIAL;
+        }
+
         //
         // If the fixed flag was supplied, then the requested address must be
         // page-aligned and in user mode, but not NULL.
@@ -719,6 +731,21 @@ Return Value:
             goto SysMapOrUnmapMemoryEnd;
         }
 
+        //
+        // An unmap request carrying the advise flag only updates the access
+        // pattern advice for the region.
+        //
+
+        if ((Parameters->Flags & SYS_MAP_FLAG_ADVISE) != 0) {
+            Status = MmpAdviseImageSectionRegion(
+                                    CurrentProcess->AddressSpace,
+                                    Parameters->Address,
+                                    Parameters->Size,
+                                    Parameters->Flags & SYS_MAP_ADVICE_MASK);
+
+            goto SysMapOrUnmapMemoryEnd;
+        }
+
         Status = MmUnmapFileSection(CurrentProcess,
                                     Parameters->Address,
                                     Parameters->Size,
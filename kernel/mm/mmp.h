@@ -30,6 +30,7 @@ Module Name:
 //
 
 #define MM_PAGE_DIRECTORY_BLOCK_ALLOCATION_TAG 0x6C426450 // 'lBdP'
+#define MM_POOL_CACHE_ALLOCATION_TAG 0x43506D4D // 'CPmM'
 
 //
 // Define the block expansion count for the page directory block allocator.
@@ -38,6 +39,14 @@ Module Name:
 
 #define MM_PAGE_DIRECTORY_BLOCK_ALLOCATOR_EXPANSION_COUNT 4
 
+//
+// Define the default and maximum number of neighboring pages a fault on a
+// page cache backed section may map from the page cache.
+//
+
+#define MM_FAULT_AROUND_DEFAULT_PAGES 16
+#define MM_FAULT_AROUND_MAX_PAGES 64
+
 //
 // Define paging entry flags.
 //
@@ -362,7 +371,7 @@ extern PADDRESS_SPACE MmKernelAddressSpace;
 // Stores the locks that serialize access to the pools.
 //
 
-extern KSPIN_LOCK MmNonPagedPoolLock;
+extern KQUEUED_SPIN_LOCK MmNonPagedPoolLock;
 extern PQUEUED_LOCK MmPagedPoolLock;
 
 //
@@ -381,10 +390,10 @@ extern PKEVENT MmPagingEvent;
 extern PKEVENT MmPagingFreePagesEvent;
 
 //
-// This lock serializes TLB invaldation IPIs.
+// Store the number of neighboring cached pages mapped on a fault.
 //
 
-extern KSPIN_LOCK MmInvalidateIpiLock;
+extern ULONG MmFaultAroundPageCount;
 
 //
 // Define cache line sizes for the CPU L1 caches.
@@ -458,6 +467,76 @@ Return Value:
 
 --*/
 
+KSTATUS
+MmpInitializePhysicalPageCache (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets up the current processor's list of cached free physical
+    pages. It must run after non-paged pool is available.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+MmpInitializeZeroPageThread (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates the background thread that keeps a pool of pre-zeroed
+    physical pages ready for anonymous page faults.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+PHYSICAL_ADDRESS
+MmpAllocateZeroedPhysicalPage (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine takes a page from the pool of pre-zeroed pages. The page is
+    returned allocated and non-paged, just like a page from
+    MmpAllocatePhysicalPages. This routine must be called at low level.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the physical address of a zeroed page on success.
+
+    INVALID_PHYSICAL_ADDRESS if the pool is empty, in which case the caller
+    should allocate a page normally and zero it itself.
+
+--*/
+
 PHYSICAL_ADDRESS
 MmpAllocatePhysicalPages (
     UINTN PageCount,
@@ -488,6 +567,37 @@ Return Value:
 
 --*/
 
+PHYSICAL_ADDRESS
+MmpTryAllocatePhysicalPages (
+    UINTN PageCount,
+    UINTN Alignment
+    );
+
+/*++
+
+Routine Description:
+
+    This routine attempts to allocate a run of physical pages from the free
+    pages that are available right now. Unlike MmpAllocatePhysicalPages, it
+    never pages anything out or waits for memory, making it suitable for
+    opportunistic allocations that have a fallback. This routine must be
+    called at low level.
+
+Arguments:
+
+    PageCount - Supplies the number of consecutive physical pages required.
+
+    Alignment - Supplies the alignment requirement of the allocation, in pages.
+        Valid values are powers of 2. Values of 1 or 0 indicate no alignment
+        requirement.
+
+Return Value:
+
+    Returns the physical address of the first page of allocated memory on
+    success, or INVALID_PHYSICAL_ADDRESS if no suitable run is free.
+
+--*/
+
 PHYSICAL_ADDRESS
 MmpAllocateIdentityMappablePhysicalPages (
     UINTN PageCount,
@@ -1023,6 +1133,102 @@ Return Value:
 
 --*/
 
+ULONG
+MmpGetLargePageShift (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the shift of the large page size that the current
+    architecture can map with a single translation entry.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the large page shift, or 0 if large pages are not supported.
+
+--*/
+
+KSTATUS
+MmpPrepareLargePage (
+    PADDRESS_SPACE AddressSpace,
+    PVOID VirtualAddress
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets aside the resources needed to later split a large page
+    mapped at the given user mode address back into small pages, so that the
+    split never has to allocate memory. It also checks that nothing has been
+    mapped in the large page region yet. This routine must be called at low
+    level without any image section locks held.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space the large page will
+        be mapped in.
+
+    VirtualAddress - Supplies the large page aligned virtual address.
+
+Return Value:
+
+    STATUS_SUCCESS if the region is ready to take a large page.
+
+    STATUS_NOT_SUPPORTED if large pages are not supported.
+
+    STATUS_RESOURCE_IN_USE if the region is already mapped with small pages.
+
+    STATUS_INSUFFICIENT_RESOURCES on allocation failure.
+
+--*/
+
+KSTATUS
+MmpMapLargePage (
+    PHYSICAL_ADDRESS PhysicalAddress,
+    PVOID VirtualAddress,
+    ULONG Flags
+    );
+
+/*++
+
+Routine Description:
+
+    This routine maps a large page of physically contiguous memory into the
+    current address space with a single translation entry. User mode large
+    pages are split back into small pages automatically whenever part of them
+    is unmapped or has its access changed; MmpPrepareLargePage must have
+    succeeded for the region first. Kernel mode large pages are permanent. This
+    routine must be called at low level.
+
+Arguments:
+
+    PhysicalAddress - Supplies the large page aligned physical address to back
+        the mapping with.
+
+    VirtualAddress - Supplies the large page aligned virtual address to map.
+
+    Flags - Supplies a bitfield of flags governing the options of the mapping.
+        See MAP_FLAG_* definitions.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_SUPPORTED if large pages are not supported.
+
+    STATUS_RESOURCE_IN_USE if part of the region is already mapped with small
+    pages, or the split resources for a user mode region are missing.
+
+--*/
+
 KSTATUS
 MmpPreallocatePageTables (
     PADDRESS_SPACE SourceAddressSpace,
@@ -1656,6 +1862,41 @@ Return Value:
 
 --*/
 
+KSTATUS
+MmpAdviseImageSectionRegion (
+    PADDRESS_SPACE AddressSpace,
+    PVOID Address,
+    UINTN Size,
+    ULONG Advice
+    );
+
+/*++
+
+Routine Description:
+
+    This routine applies access pattern advice to the image sections covering
+    the given region. Advice applies to whole image sections.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space containing the
+        region.
+
+    Address - Supplies the page-aligned starting address of the region.
+
+    Size - Supplies the size of the region in bytes.
+
+    Advice - Supplies a bitmask of SYS_MAP_FLAG_SEQUENTIAL,
+        SYS_MAP_FLAG_RANDOM and SYS_MAP_FLAG_WILL_NEED. Zero resets the
+        section to normal access. "Will need" on its own leaves the access
+        pattern alone.
+
+Return Value:
+
+    Status code.
+
+--*/
+
 VOID
 MmpImageSectionAddReference (
     PIMAGE_SECTION ImageSection
@@ -2050,6 +2291,51 @@ Return Value:
 
 --*/
 
+KSTATUS
+MmpInitializePoolCache (
+    ULONG Phase
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes the per-processor pool caches. Phase 0 runs on
+    every processor and sets up that processor's cache. Phase 1 runs once the
+    system work queue exists and creates the reclaim work item.
+
+Arguments:
+
+    Phase - Supplies the initialization phase.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VOID
+MmpQueuePoolCacheReclaim (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine schedules a pass that hands idle objects sitting in the
+    pool cache depot back to the pools. It can be called at dispatch level.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
 VOID
 MmpSendTlbInvalidateIpi (
     PADDRESS_SPACE AddressSpace,
@@ -2061,7 +2347,10 @@ MmpSendTlbInvalidateIpi (
 
 Routine Description:
 
-    This routine invalidates the given TLB entry on all active processors.
+    This routine invalidates the given TLB entries on every processor that
+    could have them cached: all active processors for kernel addresses, and
+    only the processors with the address space loaded for user addresses.
+    Large user mode ranges are invalidated by flushing the whole TLB.
 
 Arguments:
 
@@ -2077,6 +2366,81 @@ Return Value:
 
 --*/
 
+KSTATUS
+MmpInitializeTlbInvalidation (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine allocates the per-processor TLB invalidation requests. It
+    must be called before any application processors are started.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VOID
+MmpSetAddressSpaceActive (
+    PADDRESS_SPACE AddressSpace,
+    ULONG ProcessorNumber
+    );
+
+/*++
+
+Routine Description:
+
+    This routine records that the given processor is about to load the given
+    address space. This must be called before the switch so that a concurrent
+    TLB invalidation either targets this processor or has already changed the
+    page tables it is about to use.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space being loaded.
+
+    ProcessorNumber - Supplies the number of the current processor.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+MmpSetAddressSpaceInactive (
+    PADDRESS_SPACE AddressSpace,
+    ULONG ProcessorNumber
+    );
+
+/*++
+
+Routine Description:
+
+    This routine records that the given processor has switched away from the
+    given address space. This must only be called after the switch has removed
+    the address space's entries from the processor's TLB.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space that was unloaded.
+
+    ProcessorNumber - Supplies the number of the current processor.
+
+Return Value:
+
+    None.
+
+--*/
+
 KSTATUS
 MmpInitializePaging (
     VOID
@@ -2166,6 +2530,32 @@ Return Value:
 
 --*/
 
+VOID
+MmpFaultAround (
+    PIMAGE_SECTION Section,
+    UINTN PageOffset
+    );
+
+/*++
+
+Routine Description:
+
+    This routine maps pages neighboring a just-resolved fault in a page cache
+    backed section, provided they are already present in the page cache. No
+    I/O is performed. This routine must be called at low level.
+
+Arguments:
+
+    Section - Supplies a pointer to the image section that faulted.
+
+    PageOffset - Supplies the offset, in pages, of the page that faulted.
+
+Return Value:
+
+    None.
+
+--*/
+
 KSTATUS
 MmpPageOut (
     PPAGING_ENTRY PagingEntry,
@@ -75,6 +75,8 @@ Module Name:
 #define PAGE_IN_CONTEXT_FLAG_ALLOCATE_IRP        0x00000002
 #define PAGE_IN_CONTEXT_FLAG_ALLOCATE_SWAP_SPACE 0x00000004
 #define PAGE_IN_CONTEXT_FLAG_ALLOCATE_MASK       0x00000007
+#define PAGE_IN_CONTEXT_FLAG_ZERO_PAGE           0x00000008
+#define PAGE_IN_CONTEXT_FLAG_PAGE_ZEROED         0x00000010
 
 //
 // ------------------------------------------------------ Data Type Definitions
@@ -204,6 +206,12 @@ MmpPageInAnonymousSection (
     PIO_BUFFER LockedIoBuffer
     );
 
+KSTATUS
+MmpPageInLargePage (
+    PIMAGE_SECTION ImageSection,
+    UINTN PageOffset
+    );
+
 KSTATUS
 MmpPageInSharedSection (
     PIMAGE_SECTION ImageSection,
@@ -330,6 +338,14 @@ volatile UINTN MmPagingFreeTarget;
 
 PBLOCK_ALLOCATOR MmPagingEntryBlockAllocator;
 
+//
+// Store the number of pages, including the faulting page, in the window that
+// a fault on a page cache backed section maps from the page cache. A value of
+// one or less disables fault-around.
+//
+
+ULONG MmFaultAroundPageCount = MM_FAULT_AROUND_DEFAULT_PAGES;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -1126,6 +1142,192 @@ Return Value:
     return Status;
 }
 
+VOID
+MmpFaultAround (
+    PIMAGE_SECTION Section,
+    UINTN PageOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine maps pages neighboring a just-resolved fault in a page cache
+    backed private section, provided they are already present in the page
+    cache. Shared sections are skipped, as they are mapped under different
+    rules. No I/O is performed. This routine must be called at low level.
+
+Arguments:
+
+    Section - Supplies a pointer to the image section that faulted.
+
+    PageOffset - Supplies the offset, in pages, of the page that faulted.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BitmapIndex;
+    ULONG BitmapMask;
+    PPAGE_CACHE_ENTRY Entries[MM_FAULT_AROUND_MAX_PAGES];
+    UINTN EndOffset;
+    UINTN EntryCount;
+    IO_OFFSET FileOffset;
+    PIO_HANDLE Handle;
+    UINTN Index;
+    PIMAGE_SECTION OwningSection;
+    UINTN PageCount;
+    ULONG PageShift;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    UINTN StartOffset;
+    ULONG TruncateCount;
+    PVOID VirtualAddress;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    PageCount = MmFaultAroundPageCount;
+    if ((PageCount <= 1) ||
+        ((Section->Flags & IMAGE_SECTION_PAGE_CACHE_BACKED) == 0) ||
+        ((Section->Flags &
+          (IMAGE_SECTION_SHARED | IMAGE_SECTION_RANDOM)) != 0) ||
+        (Section->DirtyPageBitmap == NULL)) {
+
+        return;
+    }
+
+    //
+    // Sequential access only looks forward, and twice as far. Otherwise the
+    // window is centered on the faulting page.
+    //
+
+    if ((Section->Flags & IMAGE_SECTION_SEQUENTIAL) != 0) {
+        PageCount *= 2;
+        if (PageCount > MM_FAULT_AROUND_MAX_PAGES) {
+            PageCount = MM_FAULT_AROUND_MAX_PAGES;
+        }
+
+        StartOffset = PageOffset;
+
+    } else {
+        if (PageCount > MM_FAULT_AROUND_MAX_PAGES) {
+            PageCount = MM_FAULT_AROUND_MAX_PAGES;
+        }
+
+        StartOffset = 0;
+        if (PageOffset > PageCount / 2) {
+            StartOffset = PageOffset - (PageCount / 2);
+        }
+    }
+
+    PageShift = MmPageShift();
+    EndOffset = StartOffset + PageCount;
+
+    //
+    // Snapshot the section state and take a reference on the backing handle
+    // so the page cache can be searched without the section lock held.
+    //
+
+    KeAcquireQueuedLock(Section->Lock);
+    if (((Section->Flags &
+          (IMAGE_SECTION_DESTROYING | IMAGE_SECTION_DESTROYED)) != 0) ||
+        (Section->ImageBacking.DeviceHandle == INVALID_HANDLE)) {
+
+        KeReleaseQueuedLock(Section->Lock);
+        return;
+    }
+
+    if (EndOffset > (Section->Size >> PageShift)) {
+        EndOffset = Section->Size >> PageShift;
+    }
+
+    Handle = Section->ImageBacking.DeviceHandle;
+    FileOffset = Section->ImageBacking.Offset;
+    TruncateCount = Section->TruncateCount;
+    MmpImageSectionAddImageBackingReference(Section);
+    KeReleaseQueuedLock(Section->Lock);
+
+    ASSERT(IS_ALIGNED(FileOffset, MmPageSize()) != FALSE);
+
+    EntryCount = 0;
+    for (Index = StartOffset; Index < EndOffset; Index += 1) {
+        Entries[Index - StartOffset] = NULL;
+        if (Index == PageOffset) {
+            continue;
+        }
+
+        Entries[Index - StartOffset] =
+                  IoLookupPageCacheEntry(Handle,
+                                         FileOffset + (Index << PageShift));
+
+        if (Entries[Index - StartOffset] != NULL) {
+            EntryCount += 1;
+        }
+    }
+
+    MmpImageSectionReleaseImageBackingReference(Section);
+    if (EntryCount == 0) {
+        return;
+    }
+
+    //
+    // Map everything found under a single acquisition of the section lock.
+    // A truncate while the lock was dropped may have evicted the entries, and
+    // pages that went dirty or were already resolved must be left alone.
+    //
+
+    KeAcquireQueuedLock(Section->Lock);
+    if (((Section->Flags &
+          (IMAGE_SECTION_DESTROYING | IMAGE_SECTION_DESTROYED)) == 0) &&
+        (Section->TruncateCount == TruncateCount)) {
+
+        for (Index = StartOffset; Index < EndOffset; Index += 1) {
+            if ((Entries[Index - StartOffset] == NULL) ||
+                (Index >= (Section->Size >> PageShift))) {
+
+                continue;
+            }
+
+            VirtualAddress = Section->VirtualAddress + (Index << PageShift);
+            if (MmpVirtualToPhysical(VirtualAddress, NULL) !=
+                INVALID_PHYSICAL_ADDRESS) {
+
+                continue;
+            }
+
+            OwningSection = MmpGetOwningSection(Section, Index);
+            BitmapIndex = IMAGE_SECTION_BITMAP_INDEX(Index);
+            BitmapMask = IMAGE_SECTION_BITMAP_MASK(Index);
+            if ((OwningSection == Section) &&
+                ((Section->DirtyPageBitmap[BitmapIndex] & BitmapMask) == 0)) {
+
+                PhysicalAddress = IoGetPageCacheEntryPhysicalAddress(
+                                                 Entries[Index - StartOffset]);
+
+                MmpMapPageInSection(Section,
+                                    Index,
+                                    PhysicalAddress,
+                                    NULL,
+                                    FALSE);
+            }
+
+            MmpImageSectionReleaseReference(OwningSection);
+        }
+    }
+
+    KeReleaseQueuedLock(Section->Lock);
+    for (Index = StartOffset; Index < EndOffset; Index += 1) {
+        if (Entries[Index - StartOffset] != NULL) {
+            IoPageCacheEntryReleaseReference(Entries[Index - StartOffset]);
+        }
+    }
+
+    return;
+}
+
 KSTATUS
 MmpPageOut (
     PPAGING_ENTRY PagingEntry,
@@ -2513,11 +2715,16 @@ Return Value:
         ASSERT(KSUCCESS(Status));
 
         //
-        // If the memory warning event signaled for something other than
+        // Any memory warning is a reason to drain the pool caches. Beyond
+        // that, if the memory warning event signaled for something other than
         // warning level 1, ignore it.
         //
 
         if (SignalingObject == PhysicalMemoryWarningEvent) {
+            if (MmGetPhysicalMemoryWarningLevel() != MemoryWarningLevelNone) {
+                MmpQueuePoolCacheReclaim();
+            }
+
             if (MmGetPhysicalMemoryWarningLevel() != MemoryWarningLevel1) {
                 continue;
             }
@@ -2608,6 +2815,18 @@ Return Value:
     ASSERT((ImageSection->Flags & IMAGE_SECTION_SHARED) == 0);
     ASSERT(ImageSection->ImageBacking.DeviceHandle == INVALID_HANDLE);
 
+    //
+    // Try to back the whole surrounding large page region at once if this is
+    // the first touch there. Fall back to a single page on any failure.
+    //
+
+    if (LockedIoBuffer == NULL) {
+        Status = MmpPageInLargePage(ImageSection, PageOffset);
+        if (KSUCCESS(Status)) {
+            return Status;
+        }
+    }
+
     RtlZeroMemory(&Context, sizeof(PAGE_IN_CONTEXT));
 
     ASSERT(Context.PhysicalAddress == INVALID_PHYSICAL_ADDRESS);
@@ -2719,15 +2938,22 @@ Return Value:
 
                 OwningSection = NULL;
                 Context.Flags |= PAGE_IN_CONTEXT_FLAG_ALLOCATE_PAGE;
+                if (VirtualAddress < KERNEL_VA_START) {
+                    Context.Flags |= PAGE_IN_CONTEXT_FLAG_ZERO_PAGE;
+                }
+
                 LockHeld = FALSE;
                 continue;
             }
 
             //
-            // Zero the contents if the page is getting mapped to user mode.
+            // Zero the contents if the page is getting mapped to user mode,
+            // unless it came out of the pre-zeroed pool.
             //
 
-            if (VirtualAddress < KERNEL_VA_START) {
+            if ((VirtualAddress < KERNEL_VA_START) &&
+                ((Context.Flags & PAGE_IN_CONTEXT_FLAG_PAGE_ZEROED) == 0)) {
+
                 MmpZeroPage(Context.PhysicalAddress);
             }
 
@@ -2928,6 +3154,252 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+MmpPageInLargePage (
+    PIMAGE_SECTION ImageSection,
+    UINTN PageOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to satisfy a first touch fault in an anonymous
+    section by mapping the entire surrounding large page region with a single
+    large page of freshly zeroed memory. This is only done for sections that
+    own all their pages outright and only when physical memory is plentiful.
+    This routine must be called at low level.
+
+Arguments:
+
+    ImageSection - Supplies a pointer to the image section that took the fault.
+
+    PageOffset - Supplies the offset, in pages, from the beginning of the
+        section of the faulting page.
+
+Return Value:
+
+    STATUS_SUCCESS if the region was mapped with a large page.
+
+    Other error codes if the fault should be handled with a small page.
+
+--*/
+
+{
+
+    PADDRESS_SPACE AddressSpace;
+    UINTN BitmapIndex;
+    ULONG BitmapMask;
+    ULONG Flags;
+    PVOID LargeAddress;
+    ULONG LargePageShift;
+    UINTN LargeSize;
+    BOOL LockHeld;
+    ULONG MapFlags;
+    BOOL Mapped;
+    UINTN PageCount;
+    PPAGING_ENTRY *PagingEntries;
+    UINTN PageIndex;
+    ULONG PageShift;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    PKPROCESS Process;
+    UINTN SectionOffset;
+    KSTATUS Status;
+    PVOID VirtualAddress;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    LockHeld = FALSE;
+    Mapped = FALSE;
+    PageCount = 0;
+    PagingEntries = NULL;
+    PhysicalAddress = INVALID_PHYSICAL_ADDRESS;
+    LargePageShift = MmpGetLargePageShift();
+    if (LargePageShift == 0) {
+        Status = STATUS_NOT_SUPPORTED;
+        goto PageInLargePageEnd;
+    }
+
+    //
+    // Only consider user mode sections that are mapped accessible, are not
+    // sharing pages with any parent or child, and live in the current
+    // process.
+    //
+
+    Flags = ImageSection->Flags;
+    Process = PsGetCurrentProcess();
+    PageShift = MmPageShift();
+    VirtualAddress = ImageSection->VirtualAddress + (PageOffset << PageShift);
+    if ((VirtualAddress >= KERNEL_VA_START) ||
+        ((Flags & (IMAGE_SECTION_READABLE | IMAGE_SECTION_WRITABLE)) == 0) ||
+        (ImageSection->Parent != NULL) ||
+        (LIST_EMPTY(&(ImageSection->ChildList)) == FALSE) ||
+        (ImageSection->AddressSpace != Process->AddressSpace)) {
+
+        Status = STATUS_NOT_SUPPORTED;
+        goto PageInLargePageEnd;
+    }
+
+    //
+    // The whole large page region must fall inside the section.
+    //
+
+    LargeSize = 1 << LargePageShift;
+    LargeAddress = ALIGN_POINTER_DOWN(VirtualAddress, LargeSize);
+    if ((LargeAddress < ImageSection->VirtualAddress) ||
+        ((UINTN)(ImageSection->VirtualAddress + ImageSection->Size -
+                 LargeAddress) < LargeSize)) {
+
+        Status = STATUS_NOT_SUPPORTED;
+        goto PageInLargePageEnd;
+    }
+
+    if (MmGetPhysicalMemoryWarningLevel() != MemoryWarningLevelNone) {
+        Status = STATUS_NO_MEMORY;
+        goto PageInLargePageEnd;
+    }
+
+    //
+    // Set aside what is needed to split the large page later. This fails if
+    // anything is already mapped in the region.
+    //
+
+    AddressSpace = ImageSection->AddressSpace;
+    Status = MmpPrepareLargePage(AddressSpace, LargeAddress);
+    if (!KSUCCESS(Status)) {
+        goto PageInLargePageEnd;
+    }
+
+    PageCount = LargeSize >> PageShift;
+    PhysicalAddress = MmpTryAllocatePhysicalPages(PageCount, PageCount);
+    if (PhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
+        Status = STATUS_NO_MEMORY;
+        goto PageInLargePageEnd;
+    }
+
+    //
+    // Create paging entries up front so the pages can be made pageable once
+    // mapped. Like single pages, they get their section when mapped.
+    //
+
+    if ((Flags & IMAGE_SECTION_NON_PAGED) == 0) {
+        PagingEntries = MmAllocateNonPagedPool(
+                                            PageCount * sizeof(PPAGING_ENTRY),
+                                            MM_ALLOCATION_TAG);
+
+        if (PagingEntries == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto PageInLargePageEnd;
+        }
+
+        RtlZeroMemory(PagingEntries, PageCount * sizeof(PPAGING_ENTRY));
+        for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+            PagingEntries[PageIndex] = MmpCreatePagingEntry(NULL, 0);
+            if (PagingEntries[PageIndex] == NULL) {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto PageInLargePageEnd;
+            }
+        }
+    }
+
+    for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+        MmpZeroPage(PhysicalAddress + (PageIndex << PageShift));
+    }
+
+    //
+    // Recheck everything under the section lock. Any page in the region that
+    // was ever written out to the page file has to come back the normal way.
+    //
+
+    KeAcquireQueuedLock(ImageSection->Lock);
+    LockHeld = TRUE;
+    SectionOffset = (LargeAddress - ImageSection->VirtualAddress) >> PageShift;
+    if (((ImageSection->Flags & IMAGE_SECTION_DESTROYED) != 0) ||
+        (ImageSection->Parent != NULL) ||
+        (LIST_EMPTY(&(ImageSection->ChildList)) == FALSE) ||
+        ((ImageSection->Size >> PageShift) < SectionOffset + PageCount)) {
+
+        Status = STATUS_TRY_AGAIN;
+        goto PageInLargePageEnd;
+    }
+
+    if (ImageSection->DirtyPageBitmap != NULL) {
+        for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+            BitmapIndex = IMAGE_SECTION_BITMAP_INDEX(SectionOffset + PageIndex);
+            BitmapMask = IMAGE_SECTION_BITMAP_MASK(SectionOffset + PageIndex);
+            if ((ImageSection->DirtyPageBitmap[BitmapIndex] &
+                 BitmapMask) != 0) {
+
+                Status = STATUS_TRY_AGAIN;
+                goto PageInLargePageEnd;
+            }
+        }
+    }
+
+    MapFlags = MAP_FLAG_PRESENT | MAP_FLAG_USER_MODE;
+    if ((ImageSection->Flags & IMAGE_SECTION_EXECUTABLE) != 0) {
+        MapFlags |= MAP_FLAG_EXECUTE;
+    }
+
+    if (MmpCanWriteToSection(ImageSection,
+                             ImageSection,
+                             SectionOffset) == FALSE) {
+
+        MapFlags |= MAP_FLAG_READ_ONLY;
+    }
+
+    Status = MmpMapLargePage(PhysicalAddress, LargeAddress, MapFlags);
+    if (!KSUCCESS(Status)) {
+        goto PageInLargePageEnd;
+    }
+
+    Mapped = TRUE;
+    if (ImageSection->MinTouched > LargeAddress) {
+        ImageSection->MinTouched = LargeAddress;
+    }
+
+    if (ImageSection->MaxTouched < LargeAddress + LargeSize) {
+        ImageSection->MaxTouched = LargeAddress + LargeSize;
+    }
+
+    if (PagingEntries != NULL) {
+        for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+            MmpInitializePagingEntry(PagingEntries[PageIndex],
+                                     ImageSection,
+                                     SectionOffset + PageIndex);
+        }
+
+        MmpEnablePagingOnPhysicalAddress(PhysicalAddress,
+                                         PageCount,
+                                         PagingEntries,
+                                         FALSE);
+
+        MmFreeNonPagedPool(PagingEntries);
+        PagingEntries = NULL;
+    }
+
+PageInLargePageEnd:
+    if (LockHeld != FALSE) {
+        KeReleaseQueuedLock(ImageSection->Lock);
+    }
+
+    if (PagingEntries != NULL) {
+        for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+            if (PagingEntries[PageIndex] != NULL) {
+                MmpDestroyPagingEntry(PagingEntries[PageIndex]);
+            }
+        }
+
+        MmFreeNonPagedPool(PagingEntries);
+    }
+
+    if ((Mapped == FALSE) && (PhysicalAddress != INVALID_PHYSICAL_ADDRESS)) {
+        MmFreePhysicalPages(PhysicalAddress, PageCount);
+    }
+
+    return Status;
+}
+
 KSTATUS
 MmpPageInSharedSection (
     PIMAGE_SECTION ImageSection,
@@ -5036,10 +5508,24 @@ Return Value:
         ASSERT(Context->PhysicalAddress == INVALID_PHYSICAL_ADDRESS);
         ASSERT(Context->PagingEntry == NULL);
 
-        Context->PhysicalAddress = MmpAllocatePhysicalPages(1, 1);
+        //
+        // Pages that are going to be zeroed anyway come from the pool of
+        // pre-zeroed pages first.
+        //
+
+        if ((Context->Flags & PAGE_IN_CONTEXT_FLAG_ZERO_PAGE) != 0) {
+            Context->PhysicalAddress = MmpAllocateZeroedPhysicalPage();
+            if (Context->PhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
+                Context->Flags |= PAGE_IN_CONTEXT_FLAG_PAGE_ZEROED;
+            }
+        }
+
         if (Context->PhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
-            Status = STATUS_NO_MEMORY;
-            goto AllocatePageInStructuresEnd;
+            Context->PhysicalAddress = MmpAllocatePhysicalPages(1, 1);
+            if (Context->PhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
+                Status = STATUS_NO_MEMORY;
+                goto AllocatePageInStructuresEnd;
+            }
         }
 
         //
@@ -50,11 +50,40 @@ Module Name:
 #define PHYSICAL_PAGE_FLAG_NON_PAGED 0x1
 
 //
-// Define the free page value. A physical page is free if its 'free' member is
-// set to zero.
+// Define the free page value. A physical page is free if the low two bits of
+// its 'free' member hold this value, which neither a paging entry pointer nor
+// a non-paged page ever does. The first page of each free block in the buddy
+// allocator also has the head bit set and stores the block's order.
 //
 
-#define PHYSICAL_PAGE_FREE 0
+#define PHYSICAL_PAGE_FREE 0x2
+#define PHYSICAL_PAGE_STATE_MASK 0x3
+#define PHYSICAL_PAGE_FREE_HEAD 0x4
+#define PHYSICAL_PAGE_ORDER_SHIFT 3
+
+//
+// Define the number of block sizes in the buddy allocator. Blocks of order N
+// are 2^N pages long and aligned to 2^N pages in physical memory.
+//
+
+#define PHYSICAL_BUDDY_ORDER_COUNT 11
+
+//
+// Define the maximum number of free pages each processor holds, and the
+// number moved between a processor and the buddy allocator at once.
+//
+
+#define PHYSICAL_PAGE_CACHE_HIGH 64
+#define PHYSICAL_PAGE_CACHE_BATCH 16
+
+//
+// Define the size of the pool of pre-zeroed pages as a fraction of physical
+// memory, and the absolute cap on it. The zero page thread wakes up to refill
+// the pool once it falls below half of its target.
+//
+
+#define ZERO_PAGE_POOL_DIVISOR 256
+#define ZERO_PAGE_POOL_MAX 1024
 
 //
 // Define the percentage of physical pages that should remain free.
@@ -120,6 +149,22 @@ Module Name:
      ((_Type) == MemoryTypeFirmwareTemporary) ||                \
      ((_Type) == MemoryTypeBootPageTables))
 
+//
+// This macro evaluates to non-zero if the given physical page is free.
+//
+
+#define IS_PHYSICAL_PAGE_FREE(_Page) \
+    (((_Page)->U.Free & PHYSICAL_PAGE_STATE_MASK) == PHYSICAL_PAGE_FREE)
+
+//
+// This macro returns the 'free' value for the head of a free buddy block of
+// the given order.
+//
+
+#define PHYSICAL_PAGE_FREE_BLOCK(_Order)              \
+    (PHYSICAL_PAGE_FREE | PHYSICAL_PAGE_FREE_HEAD |    \
+     ((UINTN)(_Order) << PHYSICAL_PAGE_ORDER_SHIFT))
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -139,7 +184,8 @@ Structure Description:
 
 Members:
 
-    Free - Stores PHYSICAL_PAGE_FREE if the page is free.
+    Free - Stores PHYSICAL_PAGE_FREE if the page is free, possibly combined
+        with the free block head flag and order.
 
     Flags - Stores a bitmask of flags for the physical page. See
         PHYSICAL_PAGE_FLAG_* for definitions.
@@ -148,6 +194,10 @@ Structure Description:
 
     PageCacheEntry - Stores a pointer to page cache entry.
 
+    ListEntry - Stores pointers to the next and previous pages in either the
+        segment's free list for the block this page heads, or a processor's
+        list of cached free pages. This is unused otherwise.
+
 --*/
 
 typedef struct _PHYSICAL_PAGE {
@@ -158,6 +208,7 @@ typedef struct _PHYSICAL_PAGE {
         PPAGE_CACHE_ENTRY PageCacheEntry;
     } U;
 
+    LIST_ENTRY ListEntry;
 } PHYSICAL_PAGE, *PPHYSICAL_PAGE;
 
 /*++
@@ -177,6 +228,10 @@ Structure Description:
 
     FreePages - Stores the number of unallocated pages in the segment.
 
+    FreeLists - Stores the buddy allocator's lists of free blocks in this
+        segment, indexed by block order. Each list links the first physical
+        page of each free block.
+
 --*/
 
 typedef struct _PHYSICAL_MEMORY_SEGMENT {
@@ -184,10 +239,33 @@ typedef struct _PHYSICAL_MEMORY_SEGMENT {
     PHYSICAL_ADDRESS StartAddress;
     PHYSICAL_ADDRESS EndAddress;
     UINTN FreePages;
+    LIST_ENTRY FreeLists[PHYSICAL_BUDDY_ORDER_COUNT];
 } PHYSICAL_MEMORY_SEGMENT, *PPHYSICAL_MEMORY_SEGMENT;
 
 /*++
 
+Structure Description:
+
+    This structure stores a processor's cache of free physical pages. Pages
+    are freed to and allocated from the hot end (the head) of the list, and
+    handed back to the buddy allocator from the cold end (the tail). Cached
+    pages are accounted as allocated, non-paged pages.
+
+Members:
+
+    ListHead - Stores the head of the list of free physical pages.
+
+    Count - Stores the number of pages on the list.
+
+--*/
+
+typedef struct _PHYSICAL_PAGE_CACHE {
+    LIST_ENTRY ListHead;
+    UINTN Count;
+} PHYSICAL_PAGE_CACHE, *PPHYSICAL_PAGE_CACHE;
+
+/*++
+
 Structure Description:
 
     This structure defines the iteration context when initializing the physical
@@ -249,6 +327,88 @@ MmpUpdatePhysicalMemoryStatistics (
     BOOL Allocation
     );
 
+PPHYSICAL_MEMORY_SEGMENT
+MmpFindPhysicalMemorySegment (
+    PHYSICAL_ADDRESS PhysicalAddress
+    );
+
+PPHYSICAL_MEMORY_SEGMENT
+MmpFindPhysicalPageSegment (
+    PPHYSICAL_PAGE PhysicalPage,
+    PUINTN PageOffset
+    );
+
+PPHYSICAL_MEMORY_SEGMENT
+MmpClaimFreePhysicalPages (
+    UINTN PageCount,
+    UINTN PageAlignment,
+    PUINTN SelectedPageOffset
+    );
+
+PPHYSICAL_MEMORY_SEGMENT
+MmpBuddyAllocate (
+    ULONG Order,
+    PUINTN SelectedPageOffset
+    );
+
+VOID
+MmpBuddyFree (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    UINTN PageOffset,
+    UINTN PageCount
+    );
+
+VOID
+MmpBuddyRemoveRange (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    UINTN PageOffset,
+    UINTN PageCount
+    );
+
+VOID
+MmpBuddyInsertBlock (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    UINTN PageOffset,
+    ULONG Order
+    );
+
+VOID
+MmpBuddyRemoveBlock (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    UINTN PageOffset,
+    ULONG Order
+    );
+
+PHYSICAL_ADDRESS
+MmpPhysicalPageCacheAllocate (
+    VOID
+    );
+
+BOOL
+MmpPhysicalPageCacheFree (
+    PHYSICAL_ADDRESS PhysicalAddress
+    );
+
+PHYSICAL_ADDRESS
+MmpPhysicalPageCacheRefill (
+    VOID
+    );
+
+UINTN
+MmpPhysicalPageCacheTrim (
+    UINTN PageCount
+    );
+
+VOID
+MmpZeroPageThread (
+    PVOID Parameter
+    );
+
+UINTN
+MmpReleaseZeroedPages (
+    UINTN PageCount
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -368,6 +528,37 @@ UINTN MmPhysicalMemoryFreeCount;
 
 BOOL MmPhysicalPageZeroAvailable = FALSE;
 
+//
+// Store the number of free blocks of each order in the buddy allocator,
+// across all segments.
+//
+
+UINTN MmPhysicalFreeBlockCounts[PHYSICAL_BUDDY_ORDER_COUNT];
+
+//
+// Store the pool of pages that have already been zeroed by the zero page
+// thread. These pages are accounted as allocated and non-paged, and are
+// protected by the physical page lock.
+//
+
+LIST_ENTRY MmZeroedPageListHead;
+UINTN MmZeroedPageCount;
+UINTN MmZeroedPageTarget;
+
+//
+// Store the event used to wake the zero page thread.
+//
+
+PKEVENT MmZeroPageEvent;
+
+//
+// Store the number of anonymous page faults that did and did not find a
+// pre-zeroed page waiting.
+//
+
+UINTN MmZeroPageHits;
+UINTN MmZeroPageMisses;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -522,6 +713,17 @@ Return Value:
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
+    //
+    // Single non-paged pages go straight back to this processor's cache
+    // without touching the physical page lock.
+    //
+
+    if (PageCount == 1) {
+        if (MmpPhysicalPageCacheFree(PhysicalAddress) != FALSE) {
+            return;
+        }
+    }
+
     PageShift = MmPageShift();
     PagingEntry = NULL;
     INITIALIZE_LIST_HEAD(&PagingEntryList);
@@ -562,14 +764,14 @@ Return Value:
 
         for (Index = 0; Index < PageCount; Index += 1) {
 
-            ASSERT(PhysicalPage->U.Free != PHYSICAL_PAGE_FREE);
+            ASSERT(!IS_PHYSICAL_PAGE_FREE(PhysicalPage));
 
             //
-            // Directly mark non-paged physical pages as free.
+            // Directly release non-paged physical pages.
             //
 
             if ((PhysicalPage->U.Flags & PHYSICAL_PAGE_FLAG_NON_PAGED) != 0) {
-                PhysicalPage->U.Free = PHYSICAL_PAGE_FREE;
+                MmpBuddyFree(Segment, Offset + Index, 1);
                 MmNonPagedPhysicalPages -= 1;
                 ReleasedCount += 1;
 
@@ -588,7 +790,7 @@ Return Value:
                      PAGING_ENTRY_FLAG_PAGING_OUT) == 0) {
 
                     if (PagingEntry->U.LockCount == 0) {
-                        PhysicalPage->U.Free = PHYSICAL_PAGE_FREE;
+                        MmpBuddyFree(Segment, Offset + Index, 1);
                         ReleasedCount += 1;
                         INSERT_BEFORE(&(PagingEntry->U.ListEntry),
                                       &PagingEntryList);
@@ -607,7 +809,6 @@ Return Value:
         //
 
         if (ReleasedCount != 0) {
-            Segment->FreePages += ReleasedCount;
             SignalEvent = MmpUpdatePhysicalMemoryStatistics(ReleasedCount,
                                                             FALSE);
         }
@@ -779,15 +980,22 @@ Return Value:
     ULONG AllocationSize;
     INIT_PHYSICAL_MEMORY_ITERATOR Context;
     UINTN Count;
+    PLIST_ENTRY CurrentEntry;
     ULONG LastBitIndex;
     ULONG LeadingZeros;
+    UINTN Offset;
     ULONG PageShift;
+    PPHYSICAL_PAGE PhysicalPage;
     PUCHAR RawBuffer;
+    UINTN RunStart;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    UINTN SegmentPageCount;
     KSTATUS Status;
 
     PageShift = MmPageShift();
     Status = STATUS_SUCCESS;
     INITIALIZE_LIST_HEAD(&MmPhysicalSegmentListHead);
+    INITIALIZE_LIST_HEAD(&MmZeroedPageListHead);
 
     //
     // Loop through the descriptors once to determine the number of segments
@@ -847,6 +1055,38 @@ Return Value:
         MmMaximumPhysicalAddress = Context.LastEnd;
     }
 
+    //
+    // Hand each run of free pages to the buddy allocator, which carves them
+    // into naturally aligned blocks.
+    //
+
+    CurrentEntry = MmPhysicalSegmentListHead.Next;
+    while (CurrentEntry != &MmPhysicalSegmentListHead) {
+        Segment = LIST_VALUE(CurrentEntry, PHYSICAL_MEMORY_SEGMENT, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        Segment->FreePages = 0;
+        PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+        SegmentPageCount = (Segment->EndAddress - Segment->StartAddress) >>
+                           PageShift;
+
+        Offset = 0;
+        while (Offset < SegmentPageCount) {
+            if (!IS_PHYSICAL_PAGE_FREE(&(PhysicalPage[Offset]))) {
+                Offset += 1;
+                continue;
+            }
+
+            RunStart = Offset;
+            while ((Offset < SegmentPageCount) &&
+                   (IS_PHYSICAL_PAGE_FREE(&(PhysicalPage[Offset])))) {
+
+                Offset += 1;
+            }
+
+            MmpBuddyFree(Segment, RunStart, Offset - RunStart);
+        }
+    }
+
     MmLastAllocatedSegment = LIST_VALUE(MmPhysicalSegmentListHead.Next,
                                         PHYSICAL_MEMORY_SEGMENT,
                                         ListEntry);
@@ -860,6 +1100,11 @@ Return Value:
 
     ASSERT(MmMinimumFreePhysicalPages > 0);
 
+    MmZeroedPageTarget = MmTotalPhysicalPages / ZERO_PAGE_POOL_DIVISOR;
+    if (MmZeroedPageTarget > ZERO_PAGE_POOL_MAX) {
+        MmZeroedPageTarget = ZERO_PAGE_POOL_MAX;
+    }
+
     //
     // Initialize the physical memory warning levels.
     //
@@ -920,140 +1165,352 @@ Return Value:
 
 {
 
+    UINTN BlockPages;
+    UINTN FreePages;
+    ULONG Order;
+
     Statistics->PhysicalPages = MmTotalPhysicalPages;
     Statistics->AllocatedPhysicalPages = MmTotalAllocatedPhysicalPages;
     Statistics->NonPagedPhysicalPages = MmNonPagedPhysicalPages;
+    Statistics->LargestFreePhysicalRun = 0;
+    Statistics->PhysicalFragmentation = 0;
+    Statistics->ZeroedPhysicalPages = MmZeroedPageCount;
+    Statistics->ZeroPageHits = MmZeroPageHits;
+    Statistics->ZeroPageMisses = MmZeroPageMisses;
+    FreePages = 0;
+    if (MmPhysicalPageLock != NULL) {
+        KeAcquireQueuedLock(MmPhysicalPageLock);
+    }
+
+    for (Order = 0; Order < PHYSICAL_BUDDY_ORDER_COUNT; Order += 1) {
+        if (MmPhysicalFreeBlockCounts[Order] != 0) {
+            BlockPages = MmPhysicalFreeBlockCounts[Order] << Order;
+            FreePages += BlockPages;
+            Statistics->LargestFreePhysicalRun = (UINTN)1 << Order;
+        }
+    }
+
+    //
+    // Measure fragmentation as the share of free memory that cannot be used
+    // to satisfy a request for the largest block size.
+    //
+
+    if (FreePages != 0) {
+        Order = PHYSICAL_BUDDY_ORDER_COUNT - 1;
+        BlockPages = MmPhysicalFreeBlockCounts[Order] << Order;
+        Statistics->PhysicalFragmentation =
+                                 ((FreePages - BlockPages) * 100) / FreePages;
+    }
+
+    if (MmPhysicalPageLock != NULL) {
+        KeReleaseQueuedLock(MmPhysicalPageLock);
+    }
+
     return;
 }
 
-PHYSICAL_ADDRESS
-MmpAllocatePhysicalPages (
-    UINTN PageCount,
-    UINTN Alignment
+KSTATUS
+MmpInitializePhysicalPageCache (
+    VOID
     )
 
 /*++
 
 Routine Description:
 
-    This routine allocates a physical page of memory. If necessary, it will
-    notify the system that free physical memory is low and wake up the page out
-    worker thread. All allocate pages start out as non-paged and must be
-    made pagable.
+    This routine sets up the current processor's list of cached free physical
+    pages. It must run after non-paged pool is available.
 
 Arguments:
 
-    PageCount - Supplies the number of consecutive physical pages required.
-
-    Alignment - Supplies the alignment requirement of the allocation, in pages.
-        Valid values are powers of 2. Values of 1 or 0 indicate no alignment
-        requirement.
+    None.
 
 Return Value:
 
-    Returns the physical address of the first page of allocated memory on
-    success, or INVALID_PHYSICAL_ADDRESS on failure.
+    Status code.
 
 --*/
 
 {
 
-    UINTN FreePageTarget;
-    BOOL LockHeld;
-    UINTN PageIndex;
-    ULONG PageShift;
-    volatile PPHYSICAL_PAGE PhysicalPage;
-    PPHYSICAL_MEMORY_SEGMENT Segment;
-    UINTN SegmentOffset;
-    BOOL SignalEvent;
-    ULONGLONG Timeout;
-    PHYSICAL_ADDRESS WorkingAllocation;
-
-    ASSERT(KeGetRunLevel() == RunLevelLow);
-    ASSERT((MmPagingThread == NULL) ||
-           (KeGetCurrentThread() != MmPagingThread));
+    PPHYSICAL_PAGE_CACHE Cache;
+    PPROCESSOR_BLOCK Processor;
 
-    LockHeld = FALSE;
-    PageShift = MmPageShift();
-    SignalEvent = FALSE;
-    WorkingAllocation = INVALID_PHYSICAL_ADDRESS;
-    if (Alignment == 0) {
-        Alignment = 1;
+    Processor = KeGetCurrentProcessorBlock();
+    if (Processor == NULL) {
+        return STATUS_SUCCESS;
     }
 
-    //
-    // Loop continuously looking for free pages.
-    //
+    Cache = MmAllocateNonPagedPool(sizeof(PHYSICAL_PAGE_CACHE),
+                                   MM_ALLOCATION_TAG);
 
-    Timeout = 0;
-    while (TRUE) {
-        if (MmPhysicalPageLock != NULL) {
-            KeAcquireQueuedLock(MmPhysicalPageLock);
-            LockHeld = TRUE;
-        }
+    if (Cache == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
 
-        //
-        // Attempt to find some free pages.
-        //
+    INITIALIZE_LIST_HEAD(&(Cache->ListHead));
+    Cache->Count = 0;
+    Processor->PhysicalPageCache = Cache;
+    return STATUS_SUCCESS;
+}
 
-        Segment = MmpFindPhysicalPages(PageCount,
-                                       Alignment,
-                                       PhysicalMemoryFindFree,
-                                       &SegmentOffset,
-                                       NULL);
+KSTATUS
+MmpInitializeZeroPageThread (
+    VOID
+    )
 
-        //
-        // If a section of free memory was available, grab it up!
-        //
+/*++
 
-        if (Segment != NULL) {
-            WorkingAllocation = Segment->StartAddress +
-                                (SegmentOffset << PageShift);
+Routine Description:
 
-            PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
-            PhysicalPage += SegmentOffset;
-            for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+    This routine creates the background thread that keeps a pool of pre-zeroed
+    physical pages ready for anonymous page faults.
 
-                ASSERT(PhysicalPage->U.Free == PHYSICAL_PAGE_FREE);
+Arguments:
 
-                PhysicalPage->U.Flags = PHYSICAL_PAGE_FLAG_NON_PAGED;
-                PhysicalPage += 1;
-            }
+    None.
 
-            Segment->FreePages -= PageCount;
-            SignalEvent = MmpUpdatePhysicalMemoryStatistics(PageCount, TRUE);
-            goto AllocatePhysicalPagesEnd;
-        }
+Return Value:
 
-        //
-        // Page out to try to get back to the minimum free count, or at least
-        // enough to hopefully satisfy the request.
-        //
+    Status code.
 
-        FreePageTarget = MmMinimumFreePhysicalPages;
-        if (FreePageTarget < (PageCount + Alignment)) {
-            FreePageTarget = PageCount + Alignment;
-        }
+--*/
 
-        if (LockHeld != FALSE) {
-            KeReleaseQueuedLock(MmPhysicalPageLock);
-            LockHeld = FALSE;
-        }
+{
 
-        //
-        // Not enough free memory could be found laying around. Schedule the
-        // paging worker to notify it that memory is a little tight. If it gets
-        // scheduled, wait for it to free some pages.
-        //
+    KSTATUS Status;
 
-        if (MmRequestPagingOut(FreePageTarget) != FALSE) {
-            KeWaitForEvent(MmPagingFreePagesEvent, FALSE, WAIT_TIME_INDEFINITE);
-        }
+    if (MmZeroedPageTarget == 0) {
+        return STATUS_SUCCESS;
+    }
 
-        //
-        // If this is the first time around, set the timeout timer to decide
-        // when to give up.
-        //
+    MmZeroPageEvent = KeCreateEvent(NULL);
+    if (MmZeroPageEvent == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeSignalEvent(MmZeroPageEvent, SignalOptionSignalAll);
+    Status = PsCreateKernelThread(MmpZeroPageThread, NULL, "MmpZeroPageThread");
+    if (!KSUCCESS(Status)) {
+        KeDestroyEvent(MmZeroPageEvent);
+        MmZeroPageEvent = NULL;
+    }
+
+    return Status;
+}
+
+PHYSICAL_ADDRESS
+MmpAllocateZeroedPhysicalPage (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes a page from the pool of pre-zeroed pages. The page is
+    returned allocated and non-paged, just like a page from
+    MmpAllocatePhysicalPages. This routine must be called at low level.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the physical address of a zeroed page on success.
+
+    INVALID_PHYSICAL_ADDRESS if the pool is empty, in which case the caller
+    should allocate a page normally and zero it itself.
+
+--*/
+
+{
+
+    PHYSICAL_ADDRESS Address;
+    UINTN Offset;
+    PPHYSICAL_PAGE PhysicalPage;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    BOOL Wake;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    Address = INVALID_PHYSICAL_ADDRESS;
+    Wake = FALSE;
+    if (MmZeroedPageCount != 0) {
+        KeAcquireQueuedLock(MmPhysicalPageLock);
+        if (LIST_EMPTY(&MmZeroedPageListHead) == FALSE) {
+            PhysicalPage = LIST_VALUE(MmZeroedPageListHead.Next,
+                                      PHYSICAL_PAGE,
+                                      ListEntry);
+
+            LIST_REMOVE(&(PhysicalPage->ListEntry));
+            MmZeroedPageCount -= 1;
+            Segment = MmpFindPhysicalPageSegment(PhysicalPage, &Offset);
+            Address = Segment->StartAddress + (Offset << MmPageShift());
+        }
+
+        if (MmZeroedPageCount < (MmZeroedPageTarget / 2)) {
+            Wake = TRUE;
+        }
+
+        KeReleaseQueuedLock(MmPhysicalPageLock);
+
+    } else {
+        Wake = TRUE;
+    }
+
+    if (Address != INVALID_PHYSICAL_ADDRESS) {
+        RtlAtomicAdd(&MmZeroPageHits, 1);
+
+    } else {
+        RtlAtomicAdd(&MmZeroPageMisses, 1);
+    }
+
+    if ((Wake != FALSE) && (MmZeroPageEvent != NULL)) {
+        KeSignalEvent(MmZeroPageEvent, SignalOptionSignalAll);
+    }
+
+    return Address;
+}
+
+PHYSICAL_ADDRESS
+MmpAllocatePhysicalPages (
+    UINTN PageCount,
+    UINTN Alignment
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates a physical page of memory. If necessary, it will
+    notify the system that free physical memory is low and wake up the page out
+    worker thread. All allocate pages start out as non-paged and must be
+    made pagable.
+
+Arguments:
+
+    PageCount - Supplies the number of consecutive physical pages required.
+
+    Alignment - Supplies the alignment requirement of the allocation, in pages.
+        Valid values are powers of 2. Values of 1 or 0 indicate no alignment
+        requirement.
+
+Return Value:
+
+    Returns the physical address of the first page of allocated memory on
+    success, or INVALID_PHYSICAL_ADDRESS on failure.
+
+--*/
+
+{
+
+    UINTN FreePageTarget;
+    BOOL LockHeld;
+    ULONG PageShift;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    UINTN SegmentOffset;
+    BOOL SignalEvent;
+    ULONGLONG Timeout;
+    PHYSICAL_ADDRESS WorkingAllocation;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+    ASSERT((MmPagingThread == NULL) ||
+           (KeGetCurrentThread() != MmPagingThread));
+
+    LockHeld = FALSE;
+    PageShift = MmPageShift();
+    SignalEvent = FALSE;
+    WorkingAllocation = INVALID_PHYSICAL_ADDRESS;
+    if (Alignment == 0) {
+        Alignment = 1;
+    }
+
+    //
+    // Single pages come from this processor's cache when possible, which
+    // avoids the physical page lock entirely.
+    //
+
+    if ((PageCount == 1) && (Alignment == 1)) {
+        WorkingAllocation = MmpPhysicalPageCacheAllocate();
+        if (WorkingAllocation != INVALID_PHYSICAL_ADDRESS) {
+            return WorkingAllocation;
+        }
+    }
+
+    //
+    // Loop continuously looking for free pages.
+    //
+
+    Timeout = 0;
+    while (TRUE) {
+        if (MmPhysicalPageLock != NULL) {
+            KeAcquireQueuedLock(MmPhysicalPageLock);
+            LockHeld = TRUE;
+        }
+
+        //
+        // Attempt to claim some free pages.
+        //
+
+        Segment = MmpClaimFreePhysicalPages(PageCount,
+                                            Alignment,
+                                            &SegmentOffset);
+
+        //
+        // If a section of free memory was available, it's now allocated.
+        //
+
+        if (Segment != NULL) {
+            WorkingAllocation = Segment->StartAddress +
+                                (SegmentOffset << PageShift);
+
+            SignalEvent = MmpUpdatePhysicalMemoryStatistics(PageCount, TRUE);
+            goto AllocatePhysicalPagesEnd;
+        }
+
+        //
+        // Page out to try to get back to the minimum free count, or at least
+        // enough to hopefully satisfy the request.
+        //
+
+        FreePageTarget = MmMinimumFreePhysicalPages;
+        if (FreePageTarget < (PageCount + Alignment)) {
+            FreePageTarget = PageCount + Alignment;
+        }
+
+        if (LockHeld != FALSE) {
+            KeReleaseQueuedLock(MmPhysicalPageLock);
+            LockHeld = FALSE;
+        }
+
+        //
+        // Before resorting to paging, hand back the pre-zeroed pages and this
+        // processor's cached pages, as they may be just what is needed to
+        // complete a contiguous run.
+        //
+
+        if ((MmpReleaseZeroedPages(MAX_UINTN) != 0) ||
+            (MmpPhysicalPageCacheTrim(MAX_UINTN) != 0)) {
+
+            continue;
+        }
+
+        //
+        // Not enough free memory could be found laying around. Schedule the
+        // paging worker to notify it that memory is a little tight. If it gets
+        // scheduled, wait for it to free some pages.
+        //
+
+        if (MmRequestPagingOut(FreePageTarget) != FALSE) {
+            KeWaitForEvent(MmPagingFreePagesEvent, FALSE, WAIT_TIME_INDEFINITE);
+        }
+
+        //
+        // If this is the first time around, set the timeout timer to decide
+        // when to give up.
+        //
 
         if (Timeout == 0) {
             Timeout = KeGetRecentTimeCounter() +
@@ -1099,6 +1556,78 @@ Return Value:
     return WorkingAllocation;
 }
 
+PHYSICAL_ADDRESS
+MmpTryAllocatePhysicalPages (
+    UINTN PageCount,
+    UINTN Alignment
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to allocate a run of physical pages from the free
+    pages that are available right now. Unlike MmpAllocatePhysicalPages, it
+    never pages anything out or waits for memory, making it suitable for
+    opportunistic allocations that have a fallback. This routine must be
+    called at low level.
+
+Arguments:
+
+    PageCount - Supplies the number of consecutive physical pages required.
+
+    Alignment - Supplies the alignment requirement of the allocation, in pages.
+        Valid values are powers of 2. Values of 1 or 0 indicate no alignment
+        requirement.
+
+Return Value:
+
+    Returns the physical address of the first page of allocated memory on
+    success, or INVALID_PHYSICAL_ADDRESS if no suitable run is free.
+
+--*/
+
+{
+
+    ULONG PageShift;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    UINTN SegmentOffset;
+    BOOL SignalEvent;
+    PHYSICAL_ADDRESS WorkingAllocation;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    if (MmPhysicalPageLock == NULL) {
+        return INVALID_PHYSICAL_ADDRESS;
+    }
+
+    PageShift = MmPageShift();
+    SignalEvent = FALSE;
+    WorkingAllocation = INVALID_PHYSICAL_ADDRESS;
+    if (Alignment == 0) {
+        Alignment = 1;
+    }
+
+    KeAcquireQueuedLock(MmPhysicalPageLock);
+    Segment = MmpClaimFreePhysicalPages(PageCount, Alignment, &SegmentOffset);
+    if (Segment != NULL) {
+        WorkingAllocation = Segment->StartAddress +
+                            (SegmentOffset << PageShift);
+
+        SignalEvent = MmpUpdatePhysicalMemoryStatistics(PageCount, TRUE);
+    }
+
+    KeReleaseQueuedLock(MmPhysicalPageLock);
+    if (SignalEvent != FALSE) {
+
+        ASSERT(MmPhysicalMemoryWarningEvent != NULL);
+
+        KeSignalEvent(MmPhysicalMemoryWarningEvent, SignalOptionPulse);
+    }
+
+    return WorkingAllocation;
+}
+
 PHYSICAL_ADDRESS
 MmpAllocateIdentityMappablePhysicalPages (
     UINTN PageCount,
@@ -1130,9 +1659,7 @@ Return Value:
 
 {
 
-    UINTN PageIndex;
     ULONG PageShift;
-    PPHYSICAL_PAGE PhysicalPage;
     PPHYSICAL_MEMORY_SEGMENT Segment;
     UINTN SegmentOffset;
     PHYSICAL_ADDRESS WorkingAllocation;
@@ -1163,21 +1690,11 @@ Return Value:
     }
 
     if (WorkingAllocation != INVALID_PHYSICAL_ADDRESS) {
-        PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
-        PhysicalPage += SegmentOffset;
-        for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
-
-            ASSERT(PhysicalPage->U.Free == PHYSICAL_PAGE_FREE);
-
-            Segment->FreePages -= 1;
-            MmTotalAllocatedPhysicalPages += 1;
-            MmNonPagedPhysicalPages += 1;
-
-            ASSERT(MmTotalAllocatedPhysicalPages <= MmTotalPhysicalPages);
+        MmpBuddyRemoveRange(Segment, SegmentOffset, PageCount);
+        MmTotalAllocatedPhysicalPages += PageCount;
+        MmNonPagedPhysicalPages += PageCount;
 
-            PhysicalPage->U.Flags = PHYSICAL_PAGE_FLAG_NON_PAGED;
-            PhysicalPage += 1;
-        }
+        ASSERT(MmTotalAllocatedPhysicalPages <= MmTotalPhysicalPages);
     }
 
     if (MmPhysicalPageLock != NULL) {
@@ -1353,7 +1870,7 @@ Return Value:
 
             ASSERT(PhysicalPage->U.Flags == PHYSICAL_PAGE_FLAG_NON_PAGED);
             ASSERT(((UINTN)PagingEntries[PageIndex] &
-                    PHYSICAL_PAGE_FLAG_NON_PAGED) == 0);
+                    PHYSICAL_PAGE_STATE_MASK) == 0);
 
             PhysicalPage->U.PagingEntry = PagingEntries[PageIndex];
 
@@ -1458,7 +1975,7 @@ Return Value:
         for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
 
             ASSERT((Offset + PageIndex) < MaxOffset);
-            ASSERT(PhysicalPage[PageIndex].U.Free != PHYSICAL_PAGE_FREE);
+            ASSERT(!IS_PHYSICAL_PAGE_FREE(&(PhysicalPage[PageIndex])));
 
             //
             // If there is no paging entry and this is just a non-paged
@@ -1603,7 +2120,7 @@ Return Value:
         for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
 
             ASSERT((Offset + PageIndex) < MaxOffset);
-            ASSERT(PhysicalPage[PageIndex].U.Free != PHYSICAL_PAGE_FREE);
+            ASSERT(!IS_PHYSICAL_PAGE_FREE(&(PhysicalPage[PageIndex])));
 
             //
             // If this is a non-paged physical page, then skip it.
@@ -1623,7 +2140,7 @@ Return Value:
             if (PagingEntry->U.LockCount == 0) {
                 MmNonPagedPhysicalPages -= 1;
                 if ((PagingEntry->U.Flags & PAGING_ENTRY_FLAG_FREED) != 0) {
-                    PhysicalPage[PageIndex].U.Free = PHYSICAL_PAGE_FREE;
+                    MmpBuddyFree(Segment, Offset + PageIndex, 1);
                     ReleasedCount += 1;
                     INSERT_BEFORE(&(PagingEntry->U.ListEntry),
                                   &PagingEntryList);
@@ -1632,7 +2149,6 @@ Return Value:
         }
 
         if (ReleasedCount != 0) {
-            Segment->FreePages += ReleasedCount;
             SignalEvent = MmpUpdatePhysicalMemoryStatistics(ReleasedCount,
                                                             FALSE);
         }
@@ -1857,7 +2373,7 @@ Return Value:
 
             PhysicalPage += SegmentOffset;
 
-            ASSERT(PhysicalPage->U.Flags != PHYSICAL_PAGE_FREE);
+            ASSERT(!IS_PHYSICAL_PAGE_FREE(PhysicalPage));
 
             //
             // If it's a page cache entry, just leave it alone. Otherwise, it
@@ -2279,7 +2795,7 @@ Return Value:
                 // The page isn't suitable if it's allocated.
                 //
 
-                if (PhysicalPage->U.Free != PHYSICAL_PAGE_FREE) {
+                if (!IS_PHYSICAL_PAGE_FREE(PhysicalPage)) {
                     ExitCheck = TRUE;
                 }
 
@@ -2292,7 +2808,7 @@ Return Value:
                 // Free or non-pagable pages cannot be paged out.
                 //
 
-                if ((PhysicalPage->U.Free == PHYSICAL_PAGE_FREE) ||
+                if ((IS_PHYSICAL_PAGE_FREE(PhysicalPage)) ||
                     ((Flags & PHYSICAL_PAGE_FLAG_NON_PAGED) != 0)) {
 
                     ExitCheck = TRUE;
@@ -2331,7 +2847,7 @@ Return Value:
             //
 
             case PhysicalMemoryFindIdentityMappable:
-                if (PhysicalPage->U.Free != PHYSICAL_PAGE_FREE) {
+                if (!IS_PHYSICAL_PAGE_FREE(PhysicalPage)) {
                     ExitCheck = TRUE;
 
                 } else {
@@ -2461,6 +2977,7 @@ Return Value:
     BOOL FreePage;
     PHYSICAL_ADDRESS LowestPhysicalAddress;
     PINIT_PHYSICAL_MEMORY_ITERATOR MemoryContext;
+    ULONG Order;
     UINTN OutOfBoundsAllocatedPageCount;
     UINTN PageCount;
     UINTN PageShift;
@@ -2643,6 +3160,10 @@ Return Value:
             CurrentSegment->StartAddress = BaseAddress;
             CurrentSegment->EndAddress = CurrentSegment->StartAddress;
             CurrentSegment->FreePages = 0;
+            for (Order = 0; Order < PHYSICAL_BUDDY_ORDER_COUNT; Order += 1) {
+                INITIALIZE_LIST_HEAD(&(CurrentSegment->FreeLists[Order]));
+            }
+
             MemoryContext->CurrentSegment = CurrentSegment;
             MemoryContext->CurrentPage = (PPHYSICAL_PAGE)(CurrentSegment + 1);
         }
@@ -2878,3 +3399,1059 @@ Return Value:
     return SignalEvent;
 }
 
+
+PPHYSICAL_MEMORY_SEGMENT
+MmpFindPhysicalMemorySegment (
+    PHYSICAL_ADDRESS PhysicalAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the physical memory segment containing the given
+    address. Segments never change after initialization, so this can be called
+    without the physical page lock.
+
+Arguments:
+
+    PhysicalAddress - Supplies the physical address to look up.
+
+Return Value:
+
+    Returns a pointer to the segment containing the address.
+
+    NULL if the address is not managed by the physical page allocator.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+
+    CurrentEntry = MmPhysicalSegmentListHead.Next;
+    while (CurrentEntry != &MmPhysicalSegmentListHead) {
+        Segment = LIST_VALUE(CurrentEntry, PHYSICAL_MEMORY_SEGMENT, ListEntry);
+        if ((PhysicalAddress >= Segment->StartAddress) &&
+            (PhysicalAddress < Segment->EndAddress)) {
+
+            return Segment;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    return NULL;
+}
+
+PPHYSICAL_MEMORY_SEGMENT
+MmpFindPhysicalPageSegment (
+    PPHYSICAL_PAGE PhysicalPage,
+    PUINTN PageOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the physical memory segment whose page array contains
+    the given physical page structure.
+
+Arguments:
+
+    PhysicalPage - Supplies a pointer to the physical page structure.
+
+    PageOffset - Supplies a pointer where the index of the page within the
+        segment will be returned.
+
+Return Value:
+
+    Returns a pointer to the segment owning the page.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PPHYSICAL_PAGE FirstPage;
+    ULONG PageShift;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    UINTN SegmentPageCount;
+
+    PageShift = MmPageShift();
+    CurrentEntry = MmPhysicalSegmentListHead.Next;
+    while (CurrentEntry != &MmPhysicalSegmentListHead) {
+        Segment = LIST_VALUE(CurrentEntry, PHYSICAL_MEMORY_SEGMENT, ListEntry);
+        FirstPage = (PPHYSICAL_PAGE)(Segment + 1);
+        SegmentPageCount = (Segment->EndAddress - Segment->StartAddress) >>
+                           PageShift;
+
+        if ((PhysicalPage >= FirstPage) &&
+            (PhysicalPage < FirstPage + SegmentPageCount)) {
+
+            *PageOffset = PhysicalPage - FirstPage;
+            return Segment;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    ASSERT(FALSE);
+
+    return NULL;
+}
+
+PPHYSICAL_MEMORY_SEGMENT
+MmpClaimFreePhysicalPages (
+    UINTN PageCount,
+    UINTN PageAlignment,
+    PUINTN SelectedPageOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds a run of free physical pages and marks them as
+    allocated, non-paged pages. The caller must hold the physical page lock if
+    it exists, and is responsible for updating the allocation statistics.
+
+Arguments:
+
+    PageCount - Supplies the number of consecutive pages needed.
+
+    PageAlignment - Supplies the alignment of the allocation, in pages.
+
+    SelectedPageOffset - Supplies a pointer where the index of the first page
+        within the returned segment will be returned on success.
+
+Return Value:
+
+    Returns a pointer to the memory segment containing the allocated pages.
+
+    NULL if there is not enough contiguous memory to satisfy the request.
+
+--*/
+
+{
+
+    UINTN BlockSize;
+    UINTN Offset;
+    ULONG Order;
+    UINTN PageIndex;
+    PPHYSICAL_PAGE PhysicalPage;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+
+    ASSERT(PageAlignment != 0);
+
+    //
+    // Buddy blocks are naturally aligned, so the smallest block that covers
+    // both the size and the alignment satisfies the request. Give back the
+    // tail of the block beyond what was asked for.
+    //
+
+    Order = 0;
+    while ((Order < PHYSICAL_BUDDY_ORDER_COUNT) &&
+           ((((UINTN)1 << Order) < PageCount) ||
+            (((UINTN)1 << Order) < PageAlignment))) {
+
+        Order += 1;
+    }
+
+    if (Order < PHYSICAL_BUDDY_ORDER_COUNT) {
+        Segment = MmpBuddyAllocate(Order, &Offset);
+        if (Segment == NULL) {
+            return NULL;
+        }
+
+        PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+        PhysicalPage += Offset;
+        for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+
+            ASSERT(IS_PHYSICAL_PAGE_FREE(PhysicalPage));
+
+            PhysicalPage->U.Flags = PHYSICAL_PAGE_FLAG_NON_PAGED;
+            PhysicalPage += 1;
+        }
+
+        BlockSize = (UINTN)1 << Order;
+        if (BlockSize > PageCount) {
+            MmpBuddyFree(Segment, Offset + PageCount, BlockSize - PageCount);
+        }
+
+    //
+    // Requests larger than the biggest block fall back to searching the page
+    // array, then carve the run they found out of the free blocks.
+    //
+
+    } else {
+        Segment = MmpFindPhysicalPages(PageCount,
+                                       PageAlignment,
+                                       PhysicalMemoryFindFree,
+                                       &Offset,
+                                       NULL);
+
+        if (Segment == NULL) {
+            return NULL;
+        }
+
+        MmpBuddyRemoveRange(Segment, Offset, PageCount);
+    }
+
+    *SelectedPageOffset = Offset;
+    return Segment;
+}
+
+PPHYSICAL_MEMORY_SEGMENT
+MmpBuddyAllocate (
+    ULONG Order,
+    PUINTN SelectedPageOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a free block of the given order from the buddy
+    allocator, splitting a larger block if needed. The smallest suitable block
+    in any segment is used. The pages are left marked free; the caller must
+    mark them allocated. The caller must hold the physical page lock if it
+    exists.
+
+Arguments:
+
+    Order - Supplies the order of the block to allocate.
+
+    SelectedPageOffset - Supplies a pointer where the index of the first page
+        of the block within the returned segment will be returned.
+
+Return Value:
+
+    Returns a pointer to the segment containing the block on success.
+
+    NULL if no block of the requested order or larger is free.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    ULONG CurrentOrder;
+    PLIST_ENTRY FreeList;
+    UINTN Offset;
+    PPHYSICAL_PAGE PhysicalPage;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+
+    ASSERT((MmPhysicalPageLock == NULL) ||
+           (KeIsQueuedLockHeld(MmPhysicalPageLock) != FALSE));
+
+    for (CurrentOrder = Order;
+         CurrentOrder < PHYSICAL_BUDDY_ORDER_COUNT;
+         CurrentOrder += 1) {
+
+        if (MmPhysicalFreeBlockCounts[CurrentOrder] == 0) {
+            continue;
+        }
+
+        CurrentEntry = MmPhysicalSegmentListHead.Next;
+        while (CurrentEntry != &MmPhysicalSegmentListHead) {
+            Segment = LIST_VALUE(CurrentEntry,
+                                 PHYSICAL_MEMORY_SEGMENT,
+                                 ListEntry);
+
+            CurrentEntry = CurrentEntry->Next;
+            FreeList = &(Segment->FreeLists[CurrentOrder]);
+            if (LIST_EMPTY(FreeList) != FALSE) {
+                continue;
+            }
+
+            PhysicalPage = LIST_VALUE(FreeList->Next,
+                                      PHYSICAL_PAGE,
+                                      ListEntry);
+
+            Offset = PhysicalPage - (PPHYSICAL_PAGE)(Segment + 1);
+            MmpBuddyRemoveBlock(Segment, Offset, CurrentOrder);
+
+            //
+            // Split the block down to size, freeing the upper half each time.
+            //
+
+            while (CurrentOrder > Order) {
+                CurrentOrder -= 1;
+                MmpBuddyInsertBlock(Segment,
+                                    Offset + ((UINTN)1 << CurrentOrder),
+                                    CurrentOrder);
+            }
+
+            Segment->FreePages -= (UINTN)1 << Order;
+            *SelectedPageOffset = Offset;
+            return Segment;
+        }
+    }
+
+    return NULL;
+}
+
+VOID
+MmpBuddyFree (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    UINTN PageOffset,
+    UINTN PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a run of pages to the buddy allocator, merging each
+    piece with its free buddies. The caller must hold the physical page lock if
+    it exists.
+
+Arguments:
+
+    Segment - Supplies a pointer to the segment containing the pages.
+
+    PageOffset - Supplies the index of the first page within the segment.
+
+    PageCount - Supplies the number of pages to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BlockOffset;
+    ULONG BlockOrder;
+    UINTN BuddyFrame;
+    UINTN BuddyOffset;
+    UINTN Frame;
+    UINTN Index;
+    ULONG Order;
+    ULONG PageShift;
+    PPHYSICAL_PAGE PhysicalPage;
+    UINTN SegmentPageCount;
+    UINTN StartFrame;
+
+    PageShift = MmPageShift();
+    StartFrame = Segment->StartAddress >> PageShift;
+    SegmentPageCount = (Segment->EndAddress - Segment->StartAddress) >>
+                       PageShift;
+
+    ASSERT(PageOffset + PageCount <= SegmentPageCount);
+
+    PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+    for (Index = 0; Index < PageCount; Index += 1) {
+        PhysicalPage[PageOffset + Index].U.Free = PHYSICAL_PAGE_FREE;
+    }
+
+    Segment->FreePages += PageCount;
+    while (PageCount != 0) {
+
+        //
+        // Take the largest naturally aligned block that starts here and fits
+        // in what is left of the run.
+        //
+
+        Frame = StartFrame + PageOffset;
+        Order = 0;
+        while ((Order + 1 < PHYSICAL_BUDDY_ORDER_COUNT) &&
+               (((UINTN)1 << (Order + 1)) <= PageCount) &&
+               ((Frame & (((UINTN)1 << (Order + 1)) - 1)) == 0)) {
+
+            Order += 1;
+        }
+
+        //
+        // Merge with the buddy as long as it is a free block of the same size
+        // that lies within the segment.
+        //
+
+        BlockOffset = PageOffset;
+        BlockOrder = Order;
+        while (BlockOrder + 1 < PHYSICAL_BUDDY_ORDER_COUNT) {
+            BuddyFrame = (StartFrame + BlockOffset) ^ ((UINTN)1 << BlockOrder);
+            if (BuddyFrame < StartFrame) {
+                break;
+            }
+
+            BuddyOffset = BuddyFrame - StartFrame;
+            if ((BuddyOffset + ((UINTN)1 << BlockOrder) > SegmentPageCount) ||
+                (PhysicalPage[BuddyOffset].U.Free !=
+                 PHYSICAL_PAGE_FREE_BLOCK(BlockOrder))) {
+
+                break;
+            }
+
+            MmpBuddyRemoveBlock(Segment, BuddyOffset, BlockOrder);
+            if (BuddyOffset < BlockOffset) {
+                BlockOffset = BuddyOffset;
+            }
+
+            BlockOrder += 1;
+        }
+
+        MmpBuddyInsertBlock(Segment, BlockOffset, BlockOrder);
+        PageOffset += (UINTN)1 << Order;
+        PageCount -= (UINTN)1 << Order;
+    }
+
+    return;
+}
+
+VOID
+MmpBuddyRemoveRange (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    UINTN PageOffset,
+    UINTN PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes a specific run of free pages out of the buddy allocator
+    and marks them as allocated, non-paged pages. Any parts of the containing
+    free blocks outside the run are released again. The caller must hold the
+    physical page lock if it exists.
+
+Arguments:
+
+    Segment - Supplies a pointer to the segment containing the pages.
+
+    PageOffset - Supplies the index of the first page within the segment.
+
+    PageCount - Supplies the number of pages to remove. Every page in the run
+        must be free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BlockEnd;
+    UINTN Current;
+    UINTN End;
+    UINTN Frame;
+    UINTN HeadOffset;
+    UINTN Index;
+    ULONG Order;
+    ULONG PageShift;
+    PPHYSICAL_PAGE PhysicalPage;
+    UINTN RunEnd;
+    UINTN StartFrame;
+
+    PageShift = MmPageShift();
+    StartFrame = Segment->StartAddress >> PageShift;
+    PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+    Current = PageOffset;
+    End = PageOffset + PageCount;
+    while (Current < End) {
+
+        //
+        // Find the free block containing the current page by checking each
+        // possible head, smallest block first.
+        //
+
+        Frame = StartFrame + Current;
+        HeadOffset = 0;
+        for (Order = 0; Order < PHYSICAL_BUDDY_ORDER_COUNT; Order += 1) {
+            if ((Frame & ~(((UINTN)1 << Order) - 1)) < StartFrame) {
+                Order = PHYSICAL_BUDDY_ORDER_COUNT;
+                break;
+            }
+
+            HeadOffset = (Frame & ~(((UINTN)1 << Order) - 1)) - StartFrame;
+            if (PhysicalPage[HeadOffset].U.Free ==
+                PHYSICAL_PAGE_FREE_BLOCK(Order)) {
+
+                break;
+            }
+        }
+
+        ASSERT(Order < PHYSICAL_BUDDY_ORDER_COUNT);
+
+        if (Order == PHYSICAL_BUDDY_ORDER_COUNT) {
+            Current += 1;
+            continue;
+        }
+
+        BlockEnd = HeadOffset + ((UINTN)1 << Order);
+        MmpBuddyRemoveBlock(Segment, HeadOffset, Order);
+        Segment->FreePages -= (UINTN)1 << Order;
+        RunEnd = End;
+        if (BlockEnd < RunEnd) {
+            RunEnd = BlockEnd;
+        }
+
+        for (Index = Current; Index < RunEnd; Index += 1) {
+            PhysicalPage[Index].U.Flags = PHYSICAL_PAGE_FLAG_NON_PAGED;
+        }
+
+        if (HeadOffset < Current) {
+            MmpBuddyFree(Segment, HeadOffset, Current - HeadOffset);
+        }
+
+        if (BlockEnd > RunEnd) {
+            MmpBuddyFree(Segment, RunEnd, BlockEnd - RunEnd);
+        }
+
+        Current = RunEnd;
+    }
+
+    return;
+}
+
+VOID
+MmpBuddyInsertBlock (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    UINTN PageOffset,
+    ULONG Order
+    )
+
+/*++
+
+Routine Description:
+
+    This routine puts a block of free pages on its segment's free list.
+
+Arguments:
+
+    Segment - Supplies a pointer to the segment containing the block.
+
+    PageOffset - Supplies the index of the block's first page within the
+        segment.
+
+    Order - Supplies the order of the block.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PPHYSICAL_PAGE PhysicalPage;
+
+    PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+    PhysicalPage += PageOffset;
+
+    ASSERT(PhysicalPage->U.Free == PHYSICAL_PAGE_FREE);
+
+    PhysicalPage->U.Free = PHYSICAL_PAGE_FREE_BLOCK(Order);
+    INSERT_AFTER(&(PhysicalPage->ListEntry), &(Segment->FreeLists[Order]));
+    MmPhysicalFreeBlockCounts[Order] += 1;
+    return;
+}
+
+VOID
+MmpBuddyRemoveBlock (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    UINTN PageOffset,
+    ULONG Order
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes a block of free pages off of its segment's free list.
+    The pages remain marked free.
+
+Arguments:
+
+    Segment - Supplies a pointer to the segment containing the block.
+
+    PageOffset - Supplies the index of the block's first page within the
+        segment.
+
+    Order - Supplies the order of the block.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PPHYSICAL_PAGE PhysicalPage;
+
+    PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+    PhysicalPage += PageOffset;
+
+    ASSERT(PhysicalPage->U.Free == PHYSICAL_PAGE_FREE_BLOCK(Order));
+    ASSERT(MmPhysicalFreeBlockCounts[Order] != 0);
+
+    LIST_REMOVE(&(PhysicalPage->ListEntry));
+    PhysicalPage->U.Free = PHYSICAL_PAGE_FREE;
+    MmPhysicalFreeBlockCounts[Order] -= 1;
+    return;
+}
+
+PHYSICAL_ADDRESS
+MmpPhysicalPageCacheAllocate (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates a single physical page from the current processor's
+    cache, refilling the cache from the buddy allocator if it is empty.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the physical address of the allocated page on success.
+
+    INVALID_PHYSICAL_ADDRESS if the cache is not set up or no free pages could
+    be found.
+
+--*/
+
+{
+
+    PPHYSICAL_PAGE_CACHE Cache;
+    UINTN Offset;
+    RUNLEVEL OldRunLevel;
+    PPHYSICAL_PAGE PhysicalPage;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+
+    PhysicalPage = NULL;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    Cache = KeGetCurrentProcessorBlock()->PhysicalPageCache;
+    if (Cache == NULL) {
+        KeLowerRunLevel(OldRunLevel);
+        return INVALID_PHYSICAL_ADDRESS;
+    }
+
+    if (Cache->Count != 0) {
+        PhysicalPage = LIST_VALUE(Cache->ListHead.Next,
+                                  PHYSICAL_PAGE,
+                                  ListEntry);
+
+        LIST_REMOVE(&(PhysicalPage->ListEntry));
+        Cache->Count -= 1;
+    }
+
+    KeLowerRunLevel(OldRunLevel);
+    if (PhysicalPage == NULL) {
+        return MmpPhysicalPageCacheRefill();
+    }
+
+    ASSERT(PhysicalPage->U.Flags == PHYSICAL_PAGE_FLAG_NON_PAGED);
+
+    Segment = MmpFindPhysicalPageSegment(PhysicalPage, &Offset);
+    return Segment->StartAddress + (Offset << MmPageShift());
+}
+
+BOOL
+MmpPhysicalPageCacheFree (
+    PHYSICAL_ADDRESS PhysicalAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to free a single non-paged physical page to the hot
+    end of the current processor's cache. The physical page lock is not needed,
+    as the caller owns the page.
+
+Arguments:
+
+    PhysicalAddress - Supplies the physical address of the page to free.
+
+Return Value:
+
+    TRUE if the page was placed in the cache.
+
+    FALSE if the page must be freed the normal way.
+
+--*/
+
+{
+
+    PPHYSICAL_PAGE_CACHE Cache;
+    UINTN Offset;
+    RUNLEVEL OldRunLevel;
+    PPHYSICAL_PAGE PhysicalPage;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    BOOL Trim;
+
+    Segment = MmpFindPhysicalMemorySegment(PhysicalAddress);
+    if (Segment == NULL) {
+        return FALSE;
+    }
+
+    Offset = (PhysicalAddress - Segment->StartAddress) >> MmPageShift();
+    PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+    PhysicalPage += Offset;
+
+    ASSERT(!IS_PHYSICAL_PAGE_FREE(PhysicalPage));
+
+    if ((PhysicalPage->U.Flags & PHYSICAL_PAGE_FLAG_NON_PAGED) == 0) {
+        return FALSE;
+    }
+
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    Cache = KeGetCurrentProcessorBlock()->PhysicalPageCache;
+    if (Cache == NULL) {
+        KeLowerRunLevel(OldRunLevel);
+        return FALSE;
+    }
+
+    PhysicalPage->U.Flags = PHYSICAL_PAGE_FLAG_NON_PAGED;
+    INSERT_AFTER(&(PhysicalPage->ListEntry), &(Cache->ListHead));
+    Cache->Count += 1;
+    Trim = FALSE;
+    if (Cache->Count > PHYSICAL_PAGE_CACHE_HIGH) {
+        Trim = TRUE;
+    }
+
+    KeLowerRunLevel(OldRunLevel);
+    if (Trim != FALSE) {
+        MmpPhysicalPageCacheTrim(PHYSICAL_PAGE_CACHE_BATCH);
+    }
+
+    return TRUE;
+}
+
+PHYSICAL_ADDRESS
+MmpPhysicalPageCacheRefill (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine pulls a batch of single pages out of the buddy allocator,
+    returning one to the caller and adding the rest to the cold end of the
+    current processor's cache. This routine must be called at low level.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the physical address of the allocated page on success.
+
+    INVALID_PHYSICAL_ADDRESS if no free pages could be found.
+
+--*/
+
+{
+
+    PHYSICAL_ADDRESS Address;
+    PPHYSICAL_PAGE_CACHE Cache;
+    UINTN Count;
+    LIST_ENTRY List;
+    UINTN Offset;
+    RUNLEVEL OldRunLevel;
+    ULONG PageShift;
+    PPHYSICAL_PAGE PhysicalPage;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    BOOL SignalEvent;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    Address = INVALID_PHYSICAL_ADDRESS;
+    Count = 0;
+    INITIALIZE_LIST_HEAD(&List);
+    PageShift = MmPageShift();
+    SignalEvent = FALSE;
+    if (MmPhysicalPageLock != NULL) {
+        KeAcquireQueuedLock(MmPhysicalPageLock);
+    }
+
+    while (Count < PHYSICAL_PAGE_CACHE_BATCH) {
+        Segment = MmpBuddyAllocate(0, &Offset);
+        if (Segment == NULL) {
+            break;
+        }
+
+        PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+        PhysicalPage += Offset;
+        PhysicalPage->U.Flags = PHYSICAL_PAGE_FLAG_NON_PAGED;
+        if (Address == INVALID_PHYSICAL_ADDRESS) {
+            Address = Segment->StartAddress + (Offset << PageShift);
+
+        } else {
+            INSERT_BEFORE(&(PhysicalPage->ListEntry), &List);
+        }
+
+        Count += 1;
+    }
+
+    if (Count != 0) {
+        SignalEvent = MmpUpdatePhysicalMemoryStatistics(Count, TRUE);
+    }
+
+    if (MmPhysicalPageLock != NULL) {
+        KeReleaseQueuedLock(MmPhysicalPageLock);
+    }
+
+    if (Count > 1) {
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        Cache = KeGetCurrentProcessorBlock()->PhysicalPageCache;
+
+        ASSERT(Cache != NULL);
+
+        APPEND_LIST(&List, &(Cache->ListHead));
+        Cache->Count += Count - 1;
+        KeLowerRunLevel(OldRunLevel);
+    }
+
+    if (SignalEvent != FALSE) {
+
+        ASSERT(MmPhysicalMemoryWarningEvent != NULL);
+
+        KeSignalEvent(MmPhysicalMemoryWarningEvent, SignalOptionPulse);
+    }
+
+    return Address;
+}
+
+UINTN
+MmpPhysicalPageCacheTrim (
+    UINTN PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands pages from the cold end of the current processor's
+    cache back to the buddy allocator. This routine must be called at low
+    level.
+
+Arguments:
+
+    PageCount - Supplies the maximum number of pages to hand back.
+
+Return Value:
+
+    Returns the number of pages handed back.
+
+--*/
+
+{
+
+    PPHYSICAL_PAGE_CACHE Cache;
+    UINTN Count;
+    PLIST_ENTRY Entry;
+    LIST_ENTRY List;
+    UINTN Offset;
+    RUNLEVEL OldRunLevel;
+    PPHYSICAL_PAGE PhysicalPage;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    BOOL SignalEvent;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    Count = 0;
+    INITIALIZE_LIST_HEAD(&List);
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    Cache = KeGetCurrentProcessorBlock()->PhysicalPageCache;
+    if (Cache != NULL) {
+        while ((Count < PageCount) && (Cache->Count != 0)) {
+            Entry = Cache->ListHead.Previous;
+            LIST_REMOVE(Entry);
+            INSERT_BEFORE(Entry, &List);
+            Cache->Count -= 1;
+            Count += 1;
+        }
+    }
+
+    KeLowerRunLevel(OldRunLevel);
+    if (Count == 0) {
+        return 0;
+    }
+
+    if (MmPhysicalPageLock != NULL) {
+        KeAcquireQueuedLock(MmPhysicalPageLock);
+    }
+
+    while (LIST_EMPTY(&List) == FALSE) {
+        PhysicalPage = LIST_VALUE(List.Next, PHYSICAL_PAGE, ListEntry);
+        LIST_REMOVE(&(PhysicalPage->ListEntry));
+        Segment = MmpFindPhysicalPageSegment(PhysicalPage, &Offset);
+        MmpBuddyFree(Segment, Offset, 1);
+    }
+
+    MmNonPagedPhysicalPages -= Count;
+    SignalEvent = MmpUpdatePhysicalMemoryStatistics(Count, FALSE);
+    if (MmPhysicalPageLock != NULL) {
+        KeReleaseQueuedLock(MmPhysicalPageLock);
+    }
+
+    if (SignalEvent != FALSE) {
+
+        ASSERT(MmPhysicalMemoryWarningEvent != NULL);
+
+        KeSignalEvent(MmPhysicalMemoryWarningEvent, SignalOptionPulse);
+    }
+
+    return Count;
+}
+
+VOID
+MmpZeroPageThread (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine keeps the pool of pre-zeroed pages topped up. It runs at the
+    lowest fair share priority so that zeroing mostly happens when the
+    processors would otherwise be idle, and it backs off whenever physical
+    memory is getting tight.
+
+Arguments:
+
+    Parameter - Supplies a pointer supplied by the creator of the thread. This
+        parameter is not used.
+
+Return Value:
+
+    None. This thread never exits.
+
+--*/
+
+{
+
+    UINTN FreePages;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    PPHYSICAL_PAGE PhysicalPage;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+
+    KeSetThreadSchedulingParameters(KeGetCurrentThread(),
+                                    SchedulerClassFairShare,
+                                    SCHEDULER_NICE_MAX);
+
+    while (TRUE) {
+        KeWaitForEvent(MmZeroPageEvent, FALSE, WAIT_TIME_INDEFINITE);
+        KeSignalEvent(MmZeroPageEvent, SignalOptionUnsignal);
+        while (MmZeroedPageCount < MmZeroedPageTarget) {
+
+            //
+            // Leave the remaining free memory alone if the system is anywhere
+            // near having to page out.
+            //
+
+            FreePages = MmTotalPhysicalPages - MmTotalAllocatedPhysicalPages;
+            if ((MmPhysicalMemoryWarningLevel != MemoryWarningLevelNone) ||
+                (FreePages <
+                 (MmMinimumFreePhysicalPages * 2) + MmZeroedPageTarget)) {
+
+                break;
+            }
+
+            PhysicalAddress = MmpAllocatePhysicalPages(1, 1);
+            if (PhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
+                break;
+            }
+
+            MmpZeroPage(PhysicalAddress);
+            Segment = MmpFindPhysicalMemorySegment(PhysicalAddress);
+            PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+            PhysicalPage += (PhysicalAddress - Segment->StartAddress) >>
+                            MmPageShift();
+
+            ASSERT(PhysicalPage->U.Flags == PHYSICAL_PAGE_FLAG_NON_PAGED);
+
+            KeAcquireQueuedLock(MmPhysicalPageLock);
+            INSERT_BEFORE(&(PhysicalPage->ListEntry), &MmZeroedPageListHead);
+            MmZeroedPageCount += 1;
+            KeReleaseQueuedLock(MmPhysicalPageLock);
+            KeYield();
+        }
+    }
+
+    return;
+}
+
+UINTN
+MmpReleaseZeroedPages (
+    UINTN PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands pre-zeroed pages back to the buddy allocator when memory
+    is needed elsewhere. This routine must be called at low level.
+
+Arguments:
+
+    PageCount - Supplies the maximum number of pages to hand back.
+
+Return Value:
+
+    Returns the number of pages handed back.
+
+--*/
+
+{
+
+    UINTN Count;
+    UINTN Offset;
+    PPHYSICAL_PAGE PhysicalPage;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    BOOL SignalEvent;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    if (MmZeroedPageCount == 0) {
+        return 0;
+    }
+
+    Count = 0;
+    SignalEvent = FALSE;
+    KeAcquireQueuedLock(MmPhysicalPageLock);
+    while ((Count < PageCount) &&
+           (LIST_EMPTY(&MmZeroedPageListHead) == FALSE)) {
+
+        PhysicalPage = LIST_VALUE(MmZeroedPageListHead.Previous,
+                                  PHYSICAL_PAGE,
+                                  ListEntry);
+
+        LIST_REMOVE(&(PhysicalPage->ListEntry));
+        MmZeroedPageCount -= 1;
+        Segment = MmpFindPhysicalPageSegment(PhysicalPage, &Offset);
+        MmpBuddyFree(Segment, Offset, 1);
+        Count += 1;
+    }
+
+    if (Count != 0) {
+        MmNonPagedPhysicalPages -= Count;
+        SignalEvent = MmpUpdatePhysicalMemoryStatistics(Count, FALSE);
+    }
+
+    KeReleaseQueuedLock(MmPhysicalPageLock);
+    if (SignalEvent != FALSE) {
+
+        ASSERT(MmPhysicalMemoryWarningEvent != NULL);
+
+        KeSignalEvent(MmPhysicalMemoryWarningEvent, SignalOptionPulse);
+    }
+
+    return Count;
+}
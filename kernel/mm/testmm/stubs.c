@@ -959,6 +959,34 @@ Return Value:
     return STATUS_SUCCESS;
 }
 
+ULONG
+HlGetMaximumProcessorCount (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the maximum number of logical processors that this
+    machine supports.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the maximum number of logical processors that may exist in the
+    system.
+
+--*/
+
+{
+
+    return 1;
+}
+
 PKPROCESS
 PsGetCurrentProcess (
     VOID
@@ -1904,6 +1932,99 @@ Return Value:
     return;
 }
 
+VOID
+KeInitializeQueuedSpinLock (
+    PKQUEUED_SPIN_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes a queued spin lock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to initialize.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    RtlZeroMemory(Lock, sizeof(KQUEUED_SPIN_LOCK));
+    return;
+}
+
+VOID
+KeAcquireQueuedSpinLock (
+    PKQUEUED_SPIN_LOCK Lock,
+    PKQUEUED_SPIN_LOCK_HANDLE Handle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine acquires a queued spin lock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to acquire.
+
+    Handle - Supplies a pointer to the caller's handle for this acquisition.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Lock->Tail == NULL);
+
+    Handle->Next = NULL;
+    Handle->Waiting = FALSE;
+    Lock->Tail = Handle;
+    Lock->Owner = Handle;
+    Lock->AcquireCount += 1;
+    return;
+}
+
+VOID
+KeReleaseQueuedSpinLock (
+    PKQUEUED_SPIN_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a queued spin lock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Lock->Tail != NULL);
+
+    Lock->Tail = NULL;
+    Lock->Owner = NULL;
+    return;
+}
+
 ULONG
 KeGetActiveProcessorCount (
     VOID
@@ -2063,6 +2184,141 @@ Return Value:
     return STATUS_NOT_IMPLEMENTED;
 }
 
+KERNEL_API
+VOID
+KeYield (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine yields the current thread's execution time to other threads
+    in the system.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    return;
+}
+
+KSTATUS
+KeSetThreadSchedulingParameters (
+    PKTHREAD Thread,
+    SCHEDULER_CLASS Class,
+    LONG Priority
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the scheduling class and priority of a thread.
+
+Arguments:
+
+    Thread - Supplies a pointer to the thread to modify.
+
+    Class - Supplies the new scheduling class.
+
+    Priority - Supplies the new priority.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    return STATUS_SUCCESS;
+}
+
+KERNEL_API
+PWORK_ITEM
+KeCreateWorkItem (
+    PWORK_QUEUE WorkQueue,
+    WORK_PRIORITY Priority,
+    PWORK_ITEM_ROUTINE WorkRoutine,
+    PVOID Parameter,
+    ULONG AllocationTag
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new reusable work item.
+
+Arguments:
+
+    WorkQueue - Supplies a pointer to the queue this work item will
+        eventually be queued to.
+
+    Priority - Supplies the work priority.
+
+    WorkRoutine - Supplies the routine to execute to do the work.
+
+    Parameter - Supplies an optional parameter to pass to the worker routine.
+
+    AllocationTag - Supplies an allocation tag to associate with the work
+        item.
+
+Return Value:
+
+    Returns a pointer to the new work item on success.
+
+    NULL on failure.
+
+--*/
+
+{
+
+    ASSERT(FALSE);
+
+    return NULL;
+}
+
+KERNEL_API
+KSTATUS
+KeQueueWorkItem (
+    PWORK_ITEM WorkItem
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues a work item onto the work queue for execution as soon
+    as possible.
+
+Arguments:
+
+    WorkItem - Supplies a pointer to the work item to queue.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ASSERT(FALSE);
+
+    return STATUS_NOT_IMPLEMENTED;
+}
+
 KERNEL_API
 KSTATUS
 IoGetDevice (
@@ -2873,6 +3129,71 @@ Return Value:
     return;
 }
 
+PPAGE_CACHE_ENTRY
+IoLookupPageCacheEntry (
+    PIO_HANDLE Handle,
+    IO_OFFSET Offset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks for a page cache entry that already holds the data at
+    the given offset of the object behind the handle. It never performs I/O.
+
+Arguments:
+
+    Handle - Supplies a pointer to the I/O handle of a cacheable object.
+
+    Offset - Supplies the page-aligned offset into the object.
+
+Return Value:
+
+    Returns a pointer to the page cache entry with a reference taken on
+    behalf of the caller, or NULL if the page is not in the cache.
+
+--*/
+
+{
+
+    return NULL;
+}
+
+KERNEL_API
+KSTATUS
+IoPrefetchCachedData (
+    PIO_HANDLE Handle,
+    IO_OFFSET Offset,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts reading the given range of a cached file into the page
+    cache in the background.
+
+Arguments:
+
+    Handle - Supplies a pointer to the I/O handle of the object to prefetch.
+
+    Offset - Supplies the file offset to start prefetching at.
+
+    Size - Supplies the number of bytes to prefetch.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    return STATUS_SUCCESS;
+}
+
 VOID
 IoPageCacheEntryAddReference (
     PPAGE_CACHE_ENTRY Entry
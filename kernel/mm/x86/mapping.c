@@ -67,6 +67,12 @@ MmpCreatePageTable (
     PVOID VirtualAddress
     );
 
+VOID
+MmpSplitLargePage (
+    PADDRESS_SPACE_X86 AddressSpace,
+    ULONG DirectoryIndex
+    );
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -99,6 +105,13 @@ PQUEUED_LOCK MmPageTableLock;
 
 PBLOCK_ALLOCATOR MmPageDirectoryBlockAllocator;
 
+//
+// Stores the shift of the large page size, or 0 if the processor does not
+// have large pages enabled.
+//
+
+ULONG MmLargePageShift;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -405,14 +418,23 @@ Return Value:
             break;
         }
 
-        PageTable = GET_PAGE_TABLE(DirectoryIndex);
-        TableIndex = ((UINTN)Address & PTE_INDEX_MASK) >> PAGE_SHIFT;
-        if (PageTable[TableIndex].Present == 0) {
-            break;
-        }
+        if (PageDirectory[DirectoryIndex].LargePage != 0) {
+            if ((Writable != NULL) &&
+                (PageDirectory[DirectoryIndex].Writable == 0)) {
 
-        if ((Writable != NULL) && (PageTable[TableIndex].Writable == 0)) {
-            *Writable = FALSE;
+                *Writable = FALSE;
+            }
+
+        } else {
+            PageTable = GET_PAGE_TABLE(DirectoryIndex);
+            TableIndex = ((UINTN)Address & PTE_INDEX_MASK) >> PAGE_SHIFT;
+            if (PageTable[TableIndex].Present == 0) {
+                break;
+            }
+
+            if ((Writable != NULL) && (PageTable[TableIndex].Writable == 0)) {
+                *Writable = FALSE;
+            }
         }
 
         ByteOffset = (UINTN)Address & PAGE_MASK;
@@ -495,8 +517,18 @@ Return Value:
 
     ASSERT(PageDirectory[DirectoryIndex].Present != 0);
 
-    PageTable = GET_PAGE_TABLE(DirectoryIndex);
-    TableIndex = ((UINTN)Address & PTE_INDEX_MASK) >> PAGE_SHIFT;
+    //
+    // A large page has no page table, so modify the directory entry itself.
+    //
+
+    if (PageDirectory[DirectoryIndex].LargePage != 0) {
+        PageTable = PageDirectory;
+        TableIndex = DirectoryIndex;
+
+    } else {
+        PageTable = GET_PAGE_TABLE(DirectoryIndex);
+        TableIndex = ((UINTN)Address & PTE_INDEX_MASK) >> PAGE_SHIFT;
+    }
 
     ASSERT(PageTable[TableIndex].Present != 0);
 
@@ -553,6 +585,7 @@ Return Value:
 {
 
     ULONG DirectoryIndex;
+    PADDRESS_SPACE OldAddressSpace;
     PPROCESSOR_BLOCK ProcessorBlock;
     PADDRESS_SPACE_X86 Space;
     PTSS Tss;
@@ -572,6 +605,19 @@ Return Value:
     ProcessorBlock = Processor;
     Tss = ProcessorBlock->Tss;
 
+    //
+    // The outgoing thread still owns the processor, so its process tells
+    // which address space is currently loaded.
+    //
+
+    OldAddressSpace = NULL;
+    if (ProcessorBlock->RunningThread != NULL) {
+        OldAddressSpace =
+                    ProcessorBlock->RunningThread->OwningProcess->AddressSpace;
+    }
+
+    MmpSetAddressSpaceActive(AddressSpace, ProcessorBlock->ProcessorNumber);
+
     //
     // Set the CR3 first because an NMI can come in any time and change CR3 to
     // whatever is in the TSS.
@@ -579,6 +625,17 @@ Return Value:
 
     Tss->Cr3 = Space->PageDirectoryPhysical;
     ArSetCurrentPageDirectory(Space->PageDirectoryPhysical);
+
+    //
+    // Loading CR3 flushed the old address space's entries from the TLB, so
+    // this processor no longer needs its invalidations.
+    //
+
+    if ((OldAddressSpace != NULL) && (OldAddressSpace != AddressSpace)) {
+        MmpSetAddressSpaceInactive(OldAddressSpace,
+                                   ProcessorBlock->ProcessorNumber);
+    }
+
     return;
 }
 
@@ -673,6 +730,15 @@ Return Value:
                                MemoryTypeReserved);
 
             MmMdAddDescriptorToList(Parameters->MemoryMap, &NewDescriptor);
+
+            //
+            // Large pages can be used if the processor feature setup turned
+            // on page size extensions.
+            //
+
+            if ((ArGetControlRegister4() & CR4_PAGE_SIZE_EXTENSIONS) != 0) {
+                MmLargePageShift = PAGE_DIRECTORY_SHIFT;
+            }
         }
 
         Status = STATUS_SUCCESS;
@@ -963,6 +1029,14 @@ Return Value:
         CurrentPageDirectory[DirectoryIndex] =
                                         MmKernelPageDirectory[DirectoryIndex];
 
+        //
+        // A large page maps the whole region, so the fault is resolved.
+        //
+
+        if (CurrentPageDirectory[DirectoryIndex].LargePage != 0) {
+            return TRUE;
+        }
+
         //
         // See if the page fault is resolved by this entry.
         //
@@ -1039,6 +1113,7 @@ Return Value:
 
     ASSERT((PhysicalAddress & PAGE_MASK) == 0);
     ASSERT(((UINTN)VirtualAddress & PAGE_MASK) == 0);
+    ASSERT((Flags & MAP_FLAG_LARGE_PAGE) == 0);
 
     DirectoryIndex = (UINTN)VirtualAddress >> PAGE_DIRECTORY_SHIFT;
     PageTable = GET_PAGE_TABLE(DirectoryIndex);
@@ -1053,6 +1128,7 @@ Return Value:
     }
 
     ASSERT(Directory[DirectoryIndex].Present != 0);
+    ASSERT(Directory[DirectoryIndex].LargePage == 0);
     ASSERT((PageTable[TableIndex].Present == 0) &&
            (PageTable[TableIndex].Entry == 0));
 
@@ -1072,10 +1148,6 @@ Return Value:
         PageTable[TableIndex].WriteThrough = 1;
     }
 
-    if ((Flags & MAP_FLAG_LARGE_PAGE) != 0) {
-        PageTable[TableIndex].LargePage = 1;
-    }
-
     if ((Flags & MAP_FLAG_USER_MODE) != 0) {
 
         ASSERT(VirtualAddress < KERNEL_VA_START);
@@ -1226,6 +1298,15 @@ Return Value:
             continue;
         }
 
+        //
+        // Split a large page back into small pages before unmapping any of
+        // it.
+        //
+
+        if (Directory[DirectoryIndex].LargePage != 0) {
+            MmpSplitLargePage(AddressSpace, DirectoryIndex);
+        }
+
         PageTable = GET_PAGE_TABLE(DirectoryIndex);
         TableIndex = ((UINTN)CurrentVirtual & PTE_INDEX_MASK) >> PAGE_SHIFT;
 
@@ -1436,6 +1517,32 @@ Return Value:
         return INVALID_PHYSICAL_ADDRESS;
     }
 
+    //
+    // A large page translates directly from the directory entry.
+    //
+
+    if (Directory[DirectoryIndex].LargePage != 0) {
+        PhysicalAddress = (UINTN)(Directory[DirectoryIndex].Entry <<
+                                  PAGE_SHIFT) +
+                          ((UINTN)VirtualAddress &
+                           ((1 << PAGE_DIRECTORY_SHIFT) - 1));
+
+        if (Attributes != NULL) {
+            *Attributes |= MAP_FLAG_PRESENT | MAP_FLAG_EXECUTE |
+                           MAP_FLAG_LARGE_PAGE;
+
+            if (Directory[DirectoryIndex].Writable == 0) {
+                *Attributes |= MAP_FLAG_READ_ONLY;
+            }
+
+            if (Directory[DirectoryIndex].Dirty != 0) {
+                *Attributes |= MAP_FLAG_DIRTY;
+            }
+        }
+
+        return PhysicalAddress;
+    }
+
     PageTable = GET_PAGE_TABLE(DirectoryIndex);
     TableIndex = ((UINTN)VirtualAddress & PTE_INDEX_MASK) >> PAGE_SHIFT;
     if (PageTable[TableIndex].Entry == 0) {
@@ -1528,6 +1635,14 @@ Return Value:
     }
 
     PageTablePhysical = (ULONG)(Directory[DirectoryIndex].Entry << PAGE_SHIFT);
+    if (Directory[DirectoryIndex].LargePage != 0) {
+        PhysicalAddress = PageTablePhysical +
+                          ((UINTN)VirtualAddress &
+                           ((1 << PAGE_DIRECTORY_SHIFT) - 1));
+
+        return PhysicalAddress;
+    }
+
     PageTableIndex = ((UINTN)VirtualAddress & PTE_INDEX_MASK) >> PAGE_SHIFT;
 
     //
@@ -1623,6 +1738,10 @@ Return Value:
         goto UnmapPageInOtherProcessEnd;
     }
 
+    if (Directory[DirectoryIndex].LargePage != 0) {
+        MmpSplitLargePage(Space, DirectoryIndex);
+    }
+
     PageTablePhysical = (UINTN)(Directory[DirectoryIndex].Entry << PAGE_SHIFT);
     PageTableIndex = ((UINTN)VirtualAddress & PTE_INDEX_MASK) >> PAGE_SHIFT;
 
@@ -1745,17 +1864,22 @@ Return Value:
     //
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
+    ASSERT((MapFlags & MAP_FLAG_LARGE_PAGE) == 0);
 
     Space = (PADDRESS_SPACE_X86)AddressSpace;
     Directory = Space->PageDirectory;
     DirectoryIndex = (UINTN)VirtualAddress >> PAGE_DIRECTORY_SHIFT;
 
     //
-    // Create a page table if nothing is there.
+    // Create a page table if nothing is there. A remap within a large page
+    // needs the large page split first.
     //
 
     if (Directory[DirectoryIndex].Present == 0) {
         MmpCreatePageTable(Space, Directory, VirtualAddress);
+
+    } else if (Directory[DirectoryIndex].LargePage != 0) {
+        MmpSplitLargePage(Space, DirectoryIndex);
     }
 
     PageTablePhysical = (UINTN)(Directory[DirectoryIndex].Entry << PAGE_SHIFT);
@@ -1810,10 +1934,6 @@ Return Value:
         PageTable[PageTableIndex].CacheDisabled = 1;
     }
 
-    if ((MapFlags & MAP_FLAG_LARGE_PAGE) != 0) {
-        PageTable[PageTableIndex].LargePage = 1;
-    }
-
     ASSERT(((MapFlags & MAP_FLAG_USER_MODE) == 0) ||
            (VirtualAddress < KERNEL_VA_START));
 
@@ -1949,6 +2069,14 @@ Return Value:
             continue;
         }
 
+        //
+        // Split a large page before changing the access of part of it.
+        //
+
+        if (Directory[DirectoryIndex].LargePage != 0) {
+            MmpSplitLargePage(AddressSpace, DirectoryIndex);
+        }
+
         PageTable = GET_PAGE_TABLE(DirectoryIndex);
         if (PageTable[PageTableIndex].Entry == 0) {
 
@@ -2209,6 +2337,15 @@ Return Value:
             continue;
         }
 
+        //
+        // The source mappings are about to become read-only page by page, so
+        // split any large page first.
+        //
+
+        if (SourceDirectory[DirectoryIndex].LargePage != 0) {
+            MmpSplitLargePage(SourceSpace, DirectoryIndex);
+        }
+
         TableIndexEnd = ((UINTN)CurrentVirtual & PTE_INDEX_MASK) >>
                         PAGE_SHIFT;
 
@@ -2404,6 +2541,298 @@ Return Value:
     return;
 }
 
+ULONG
+MmpGetLargePageShift (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the shift of the large page size that the current
+    architecture can map with a single translation entry.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the large page shift, or 0 if large pages are not supported.
+
+--*/
+
+{
+
+    return MmLargePageShift;
+}
+
+KSTATUS
+MmpPrepareLargePage (
+    PADDRESS_SPACE AddressSpace,
+    PVOID VirtualAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets aside the resources needed to later split a large page
+    mapped at the given user mode address back into small pages, so that the
+    split never has to allocate memory. It also checks that nothing has been
+    mapped in the large page region yet. This routine must be called at low
+    level without any image section locks held.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space the large page will
+        be mapped in.
+
+    VirtualAddress - Supplies the large page aligned virtual address.
+
+Return Value:
+
+    STATUS_SUCCESS if the region is ready to take a large page.
+
+    STATUS_NOT_SUPPORTED if large pages are not supported.
+
+    STATUS_RESOURCE_IN_USE if the region is already mapped with small pages.
+
+    STATUS_INSUFFICIENT_RESOURCES on allocation failure.
+
+--*/
+
+{
+
+    ULONG DirectoryIndex;
+    PULONG LargePageTables;
+    PHYSICAL_ADDRESS PageTable;
+    PADDRESS_SPACE_X86 Space;
+    UINTN TableCount;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+    ASSERT(VirtualAddress < KERNEL_VA_START);
+    ASSERT(IS_POINTER_ALIGNED(VirtualAddress, 1 << PAGE_DIRECTORY_SHIFT));
+
+    if ((MmLargePageShift == 0) || (MmPageTableLock == NULL)) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    Space = (PADDRESS_SPACE_X86)AddressSpace;
+    DirectoryIndex = (UINTN)VirtualAddress >> PAGE_DIRECTORY_SHIFT;
+
+    //
+    // Once a page table exists for the region, it stays. Don't bother setting
+    // anything aside if small pages got there first.
+    //
+
+    if (Space->PageDirectory[DirectoryIndex].Entry != 0) {
+        return STATUS_RESOURCE_IN_USE;
+    }
+
+    //
+    // Create the array of set aside page tables the first time this address
+    // space maps a large page.
+    //
+
+    if (Space->LargePageTables == NULL) {
+        TableCount = (UINTN)KERNEL_VA_START >> PAGE_DIRECTORY_SHIFT;
+        LargePageTables = MmAllocateNonPagedPool(
+                                           TableCount * sizeof(ULONG),
+                                           MM_ADDRESS_SPACE_ALLOCATION_TAG);
+
+        if (LargePageTables == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlZeroMemory(LargePageTables, TableCount * sizeof(ULONG));
+        KeAcquireQueuedLock(MmPageTableLock);
+        if (Space->LargePageTables == NULL) {
+            Space->LargePageTables = LargePageTables;
+            LargePageTables = NULL;
+        }
+
+        KeReleaseQueuedLock(MmPageTableLock);
+        if (LargePageTables != NULL) {
+            MmFreeNonPagedPool(LargePageTables);
+        }
+    }
+
+    if (Space->LargePageTables[DirectoryIndex] != 0) {
+        return STATUS_SUCCESS;
+    }
+
+    PageTable = MmpAllocatePhysicalPages(1, 0);
+    if (PageTable == INVALID_PHYSICAL_ADDRESS) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeAcquireQueuedLock(MmPageTableLock);
+    if (Space->LargePageTables[DirectoryIndex] == 0) {
+        Space->LargePageTables[DirectoryIndex] = (ULONG)PageTable;
+        PageTable = INVALID_PHYSICAL_ADDRESS;
+    }
+
+    KeReleaseQueuedLock(MmPageTableLock);
+    if (PageTable != INVALID_PHYSICAL_ADDRESS) {
+        MmFreePhysicalPage(PageTable);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+MmpMapLargePage (
+    PHYSICAL_ADDRESS PhysicalAddress,
+    PVOID VirtualAddress,
+    ULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine maps a large page of physically contiguous memory into the
+    current address space with a single translation entry. User mode large
+    pages are split back into small pages automatically whenever part of them
+    is unmapped or has its access changed; MmpPrepareLargePage must have
+    succeeded for the region first. Kernel mode large pages are permanent. This
+    routine must be called at low level.
+
+Arguments:
+
+    PhysicalAddress - Supplies the large page aligned physical address to back
+        the mapping with.
+
+    VirtualAddress - Supplies the large page aligned virtual address to map.
+
+    Flags - Supplies a bitfield of flags governing the options of the mapping.
+        See MAP_FLAG_* definitions.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_SUPPORTED if large pages are not supported.
+
+    STATUS_RESOURCE_IN_USE if part of the region is already mapped with small
+    pages, or the split resources for a user mode region are missing.
+
+--*/
+
+{
+
+    PADDRESS_SPACE_X86 AddressSpace;
+    volatile PTE *Directory;
+    ULONG DirectoryIndex;
+    PTE LargeEntry;
+    PKPROCESS Process;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+    ASSERT(IS_ALIGNED(PhysicalAddress, 1 << PAGE_DIRECTORY_SHIFT));
+    ASSERT(IS_POINTER_ALIGNED(VirtualAddress, 1 << PAGE_DIRECTORY_SHIFT));
+    ASSERT((Flags & MAP_FLAG_PRESENT) != 0);
+
+    if ((MmLargePageShift == 0) || (MmPageTableLock == NULL)) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    AddressSpace = NULL;
+    Process = PsGetCurrentProcess();
+    if (Process != NULL) {
+        AddressSpace = (PADDRESS_SPACE_X86)(Process->AddressSpace);
+    }
+
+    DirectoryIndex = (UINTN)VirtualAddress >> PAGE_DIRECTORY_SHIFT;
+    RtlZeroMemory(&LargeEntry, sizeof(PTE));
+    LargeEntry.Entry = (ULONG)PhysicalAddress >> PAGE_SHIFT;
+    LargeEntry.LargePage = 1;
+    if ((Flags & MAP_FLAG_READ_ONLY) == 0) {
+        LargeEntry.Writable = 1;
+    }
+
+    if ((Flags & MAP_FLAG_CACHE_DISABLE) != 0) {
+
+        ASSERT((Flags & MAP_FLAG_WRITE_THROUGH) == 0);
+
+        LargeEntry.CacheDisabled = 1;
+
+    } else if ((Flags & MAP_FLAG_WRITE_THROUGH) != 0) {
+        LargeEntry.WriteThrough = 1;
+    }
+
+    if ((Flags & MAP_FLAG_USER_MODE) != 0) {
+
+        ASSERT(VirtualAddress < KERNEL_VA_START);
+
+        LargeEntry.User = 1;
+
+    } else if ((Flags & MAP_FLAG_GLOBAL) != 0) {
+        LargeEntry.Global = 1;
+    }
+
+    if ((Flags & MAP_FLAG_DIRTY) != 0) {
+        LargeEntry.Dirty = 1;
+    }
+
+    LargeEntry.Present = 1;
+    KeAcquireQueuedLock(MmPageTableLock);
+
+    //
+    // User mode large pages need a page table set aside to split into later.
+    //
+
+    if (VirtualAddress >= KERNEL_VA_START) {
+        Directory = MmKernelPageDirectory;
+
+    } else {
+
+        ASSERT(AddressSpace != NULL);
+
+        Directory = AddressSpace->PageDirectory;
+        if ((AddressSpace->LargePageTables == NULL) ||
+            (AddressSpace->LargePageTables[DirectoryIndex] == 0)) {
+
+            Status = STATUS_RESOURCE_IN_USE;
+            goto MapLargePageEnd;
+        }
+    }
+
+    if (Directory[DirectoryIndex].Entry != 0) {
+        Status = STATUS_RESOURCE_IN_USE;
+        goto MapLargePageEnd;
+    }
+
+    //
+    // As with small pages, going from not present to present needs no TLB
+    // invalidation. Kernel entries also go into the current directory so
+    // this processor does not have to fault them in.
+    //
+
+    Directory[DirectoryIndex] = LargeEntry;
+    if (VirtualAddress >= KERNEL_VA_START) {
+        if ((AddressSpace != NULL) &&
+            (AddressSpace->PageDirectory != MmKernelPageDirectory)) {
+
+            AddressSpace->PageDirectory[DirectoryIndex] = LargeEntry;
+        }
+
+    } else {
+        MmpUpdateResidentSetCounter(
+                              &(AddressSpace->Common),
+                              1 << (PAGE_DIRECTORY_SHIFT - PAGE_SHIFT));
+    }
+
+    RtlMemoryBarrier();
+    Status = STATUS_SUCCESS;
+
+MapLargePageEnd:
+    KeReleaseQueuedLock(MmPageTableLock);
+    return Status;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
@@ -2550,6 +2979,19 @@ Return Value:
          DirectoryIndex < ((UINTN)KERNEL_VA_START >> PAGE_DIRECTORY_SHIFT);
          DirectoryIndex += 1) {
 
+        //
+        // Large pages get split whenever they are unmapped, so none should
+        // be left. Skip any that are rather than freeing data as a page
+        // table.
+        //
+
+        if (Directory[DirectoryIndex].LargePage != 0) {
+
+            ASSERT(FALSE);
+
+            continue;
+        }
+
         if (Directory[DirectoryIndex].Entry != 0) {
             Total += 1;
             PhysicalAddress = (ULONG)(Directory[DirectoryIndex].Entry <<
@@ -2578,6 +3020,26 @@ Return Value:
         MmFreePhysicalPages(RunPhysicalAddress, RunSize >> PAGE_SHIFT);
     }
 
+    //
+    // Release the page tables set aside for large pages that never needed to
+    // be split.
+    //
+
+    if (AddressSpace->LargePageTables != NULL) {
+        for (DirectoryIndex = 0;
+             DirectoryIndex < ((UINTN)KERNEL_VA_START >> PAGE_DIRECTORY_SHIFT);
+             DirectoryIndex += 1) {
+
+            PhysicalAddress = AddressSpace->LargePageTables[DirectoryIndex];
+            if (PhysicalAddress != 0) {
+                MmFreePhysicalPage(PhysicalAddress);
+            }
+        }
+
+        MmFreeNonPagedPool(AddressSpace->LargePageTables);
+        AddressSpace->LargePageTables = NULL;
+    }
+
     //
     // Assert if page tables were leaked somewhere.
     //
@@ -2770,3 +3232,128 @@ Return Value:
     return;
 }
 
+VOID
+MmpSplitLargePage (
+    PADDRESS_SPACE_X86 AddressSpace,
+    ULONG DirectoryIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine breaks a user mode large page back into a page table full of
+    small pages that map the same physical memory with the same attributes. It
+    uses the page table that was set aside when the large page was mapped, so
+    it never allocates. The image section lock covering the region must be
+    held, which keeps faults on the region from resolving while the directory
+    entry is briefly not present. This routine must be called at low level.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space, which need not be
+        the current one.
+
+    DirectoryIndex - Supplies the index of the large page's directory entry.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    volatile PTE *Directory;
+    PTE LargeEntry;
+    PTE NewEntry;
+    RUNLEVEL OldRunLevel;
+    PHYSICAL_ADDRESS PageTable;
+    PPROCESSOR_BLOCK ProcessorBlock;
+    volatile PTE *Table;
+    ULONG TableIndex;
+    PVOID VirtualAddress;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+    ASSERT(AddressSpace != NULL);
+    ASSERT(DirectoryIndex < ((UINTN)KERNEL_VA_START >> PAGE_DIRECTORY_SHIFT));
+
+    Directory = AddressSpace->PageDirectory;
+    VirtualAddress = (PVOID)(DirectoryIndex << PAGE_DIRECTORY_SHIFT);
+    KeAcquireQueuedLock(MmPageTableLock);
+
+    //
+    // Someone else may have gotten here first.
+    //
+
+    if ((Directory[DirectoryIndex].Present == 0) ||
+        (Directory[DirectoryIndex].LargePage == 0)) {
+
+        goto SplitLargePageEnd;
+    }
+
+    ASSERT(AddressSpace->LargePageTables != NULL);
+
+    PageTable = AddressSpace->LargePageTables[DirectoryIndex];
+    AddressSpace->LargePageTables[DirectoryIndex] = 0;
+
+    ASSERT(PageTable != 0);
+
+    //
+    // Take the large page away and flush it out of every TLB before the small
+    // pages go in. Letting a large and small translation for the same address
+    // coexist in a TLB is undefined on some processors. This also freezes the
+    // dirty bit. Clear the present bit atomically so a dirty bit being set by
+    // another processor is not lost.
+    //
+
+    RtlAtomicAnd32((volatile ULONG *)&(Directory[DirectoryIndex]),
+                   ~PTE_FLAG_PRESENT);
+
+    MmpSendTlbInvalidateIpi(&(AddressSpace->Common), VirtualAddress, 1);
+    LargeEntry = Directory[DirectoryIndex];
+
+    //
+    // Fill in the set aside page table with a small page for each piece of the
+    // large page.
+    //
+
+    NewEntry = LargeEntry;
+    NewEntry.LargePage = 0;
+    NewEntry.Present = 1;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    ProcessorBlock = KeGetCurrentProcessorBlock();
+    MmpMapPage(PageTable,
+               ProcessorBlock->SwapPage,
+               MAP_FLAG_PRESENT | MAP_FLAG_GLOBAL);
+
+    Table = (volatile PTE *)(ProcessorBlock->SwapPage);
+    for (TableIndex = 0;
+         TableIndex < PAGE_SIZE / sizeof(PTE);
+         TableIndex += 1) {
+
+        Table[TableIndex] = NewEntry;
+        NewEntry.Entry += 1;
+    }
+
+    MmpUnmapPages(ProcessorBlock->SwapPage, 1, 0, NULL);
+    KeLowerRunLevel(OldRunLevel);
+
+    //
+    // Point the directory entry at the new page table. This is a transition
+    // from not present to present, so no further invalidation is needed.
+    //
+
+    RtlZeroMemory(&NewEntry, sizeof(PTE));
+    NewEntry.Entry = (ULONG)PageTable >> PAGE_SHIFT;
+    NewEntry.Writable = 1;
+    NewEntry.User = 1;
+    NewEntry.Present = 1;
+    Directory[DirectoryIndex] = NewEntry;
+    AddressSpace->PageTableCount += 1;
+    RtlMemoryBarrier();
+
+SplitLargePageEnd:
+    KeReleaseQueuedLock(MmPageTableLock);
+    return;
+}
@@ -628,8 +628,10 @@ Return Value:
     CurrentThread->KernelStack = IdleThreadStackBase;
     CurrentThread->KernelStackSize = IdleThreadStackSize;
     CurrentThread->State = ThreadStateRunning;
-    CurrentThread->SchedulerEntry.Type = SchedulerEntryThread;
-    CurrentThread->SchedulerEntry.Parent = &(Processor->Scheduler.Group.Entry);
+    KeInitializeSchedulerEntry(&(CurrentThread->SchedulerEntry),
+                               &(Processor->Scheduler.Group.Entry),
+                               NULL);
+
     CurrentThread->ThreadPointer = PsInitialThreadPointer;
     CurrentThread->BuiltinWaitBlock = ObCreateWaitBlock(0);
     if (CurrentThread->BuiltinWaitBlock == NULL) {
@@ -58,6 +58,60 @@ Module Name:
 
 #define MAX_PROCESS_NAME_LENGTH 11
 
+//
+// Define the exit status of a spawned child that could not start its image.
+//
+
+#define SPAWN_FAILURE_EXIT_STATUS 127
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines the context handed from a spawning thread to the
+    loader thread of the new child.
+
+Members:
+
+    FileActions - Stores a pointer to the kernel copy of the file actions to
+        perform in the child.
+
+    FileActionCount - Stores the number of file actions.
+
+    Flags - Stores the spawn attribute flags. See SPAWN_FLAG_*.
+
+    ProcessGroup - Stores the process group the child should join.
+
+    SignalMask - Stores the signal mask of the child's main thread.
+
+    DefaultSignals - Stores the signals to return to their default disposition.
+
+    File - Stores the open executable image, whose ownership passes to the
+        loader thread.
+
+    Event - Stores a pointer to the event signaled when the child has either
+        started its image or failed.
+
+    Status - Stores the result of starting the child.
+
+--*/
+
+typedef struct _SPAWN_CONTEXT {
+    PSPAWN_FILE_ACTION FileActions;
+    ULONG FileActionCount;
+    ULONG Flags;
+    PROCESS_GROUP_ID ProcessGroup;
+    SIGNAL_SET SignalMask;
+    SIGNAL_SET DefaultSignals;
+    IMAGE_FILE_INFORMATION File;
+    PKEVENT Event;
+    KSTATUS Status;
+} SPAWN_CONTEXT, *PSPAWN_CONTEXT;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -85,6 +139,25 @@ PspLoadExecutable (
     PPROCESS_START_DATA StartData
     );
 
+VOID
+PspSpawnLoaderThread (
+    PVOID Parameter
+    );
+
+KSTATUS
+PspCreateChildProcess (
+    PKPROCESS Process,
+    PPROCESS_ENVIRONMENT Environment,
+    BOOL InheritSignalHandlers,
+    PKPROCESS *CreatedProcess
+    );
+
+VOID
+PspDestroySpawnFileActions (
+    PSPAWN_FILE_ACTION Actions,
+    ULONG ActionCount
+    );
+
 VOID
 PspHandleTableLookupCallback (
     PHANDLE_TABLE HandleTable,
@@ -679,6 +752,227 @@ Return Value:
     return ReturnValue;
 }
 
+INTN
+PsSysSpawnProcess (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new child process running the given image. Unlike
+    fork followed by exec, the caller's address space is never duplicated:
+    the child starts with a fresh address space, a copy of the caller's
+    handles, and the requested file actions and attributes applied.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Error status code on failure.
+
+--*/
+
+{
+
+    PSPAWN_FILE_ACTION Action;
+    ULONG ActionIndex;
+    UINTN ActionsSize;
+    SPAWN_CONTEXT Context;
+    IMAGE_FORMAT Format;
+    PPROCESS_ENVIRONMENT NewEnvironment;
+    PKPROCESS NewProcess;
+    PSYSTEM_CALL_SPAWN_PROCESS Parameters;
+    PKPROCESS Process;
+    KSTATUS Status;
+    PKTHREAD Thread;
+    THREAD_CREATION_PARAMETERS ThreadParameters;
+    PSTR UserPath;
+
+    RtlZeroMemory(&Context, sizeof(SPAWN_CONTEXT));
+    Context.File.Handle = INVALID_HANDLE;
+    NewEnvironment = NULL;
+    NewProcess = NULL;
+    Parameters = (PSYSTEM_CALL_SPAWN_PROCESS)SystemCallParameter;
+    Parameters->ProcessId = 0;
+    Thread = KeGetCurrentThread();
+    Process = Thread->OwningProcess;
+
+    ASSERT(Process != PsGetKernelProcess());
+
+    if (((Parameters->Flags & ~SPAWN_FLAG_MASK) != 0) ||
+        (Parameters->FileActionCount > SPAWN_MAX_FILE_ACTIONS)) {
+
+        Status = STATUS_INVALID_PARAMETER;
+        goto SysSpawnProcessEnd;
+    }
+
+    Context.Flags = Parameters->Flags;
+    Context.ProcessGroup = Parameters->ProcessGroup;
+    Context.DefaultSignals = Parameters->DefaultSignals;
+    Context.SignalMask = Thread->BlockedSignals;
+    if ((Parameters->Flags & SPAWN_FLAG_SIGNAL_MASK) != 0) {
+        Context.SignalMask = Parameters->SignalMask;
+        REMOVE_SIGNAL(Context.SignalMask, SIGNAL_KILL);
+        REMOVE_SIGNAL(Context.SignalMask, SIGNAL_STOP);
+    }
+
+    //
+    // Copy the file actions and their paths out of the caller's address
+    // space, as the loader thread runs in the child's.
+    //
+
+    if (Parameters->FileActionCount != 0) {
+        ActionsSize = Parameters->FileActionCount * sizeof(SPAWN_FILE_ACTION);
+        Context.FileActions = MmAllocatePagedPool(ActionsSize,
+                                                  PS_ALLOCATION_TAG);
+
+        if (Context.FileActions == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto SysSpawnProcessEnd;
+        }
+
+        Status = MmCopyFromUserMode(Context.FileActions,
+                                    Parameters->FileActions,
+                                    ActionsSize);
+
+        if (!KSUCCESS(Status)) {
+            MmFreePagedPool(Context.FileActions);
+            Context.FileActions = NULL;
+            goto SysSpawnProcessEnd;
+        }
+
+        for (ActionIndex = 0;
+             ActionIndex < Parameters->FileActionCount;
+             ActionIndex += 1) {
+
+            Action = &(Context.FileActions[ActionIndex]);
+            UserPath = Action->Path;
+            Action->Path = NULL;
+            if (Action->Type == SpawnFileActionOpen) {
+                Status = MmCreateCopyOfUserModeString(UserPath,
+                                                      Action->PathSize,
+                                                      PS_ALLOCATION_TAG,
+                                                      &(Action->Path));
+
+                if (!KSUCCESS(Status)) {
+                    goto SysSpawnProcessEnd;
+                }
+            }
+
+            Context.FileActionCount += 1;
+        }
+    }
+
+    Status = PsCopyEnvironment(&(Parameters->Environment),
+                               &NewEnvironment,
+                               TRUE,
+                               NULL);
+
+    if (!KSUCCESS(Status)) {
+        goto SysSpawnProcessEnd;
+    }
+
+    //
+    // Open the image and check its format before creating anything, so that
+    // a missing file or a script (which user mode must hand to an
+    // interpreter) fails without leaving a child behind.
+    //
+
+    Status = ImGetExecutableFormat(NewEnvironment->ImageName,
+                                   Process,
+                                   &(Context.File),
+                                   NULL,
+                                   &Format);
+
+    if (!KSUCCESS(Status)) {
+        goto SysSpawnProcessEnd;
+    }
+
+    Status = PspCreateChildProcess(Process,
+                                   NewEnvironment,
+                                   FALSE,
+                                   &NewProcess);
+
+    if (!KSUCCESS(Status)) {
+        goto SysSpawnProcessEnd;
+    }
+
+    Status = IoCopyProcessHandles(Process, NewProcess);
+    if (!KSUCCESS(Status)) {
+        goto SysSpawnProcessEnd;
+    }
+
+    Context.Event = KeCreateEvent(NULL);
+    if (Context.Event == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto SysSpawnProcessEnd;
+    }
+
+    KeSignalEvent(Context.Event, SignalOptionUnsignal);
+
+    //
+    // Kick off the loader thread in the child. It takes ownership of the
+    // image file handle, and once it exists the child is responsible for its
+    // own cleanup.
+    //
+
+    RtlZeroMemory(&ThreadParameters, sizeof(THREAD_CREATION_PARAMETERS));
+    ThreadParameters.Process = NewProcess;
+    ThreadParameters.Name = "PspSpawnLoaderThread";
+    ThreadParameters.NameSize = sizeof("PspSpawnLoaderThread");
+    ThreadParameters.ThreadRoutine = PspSpawnLoaderThread;
+    ThreadParameters.Parameter = &Context;
+    Status = PsCreateThread(&ThreadParameters);
+    if (!KSUCCESS(Status)) {
+        goto SysSpawnProcessEnd;
+    }
+
+    Parameters->ProcessId = NewProcess->Identifiers.ProcessId;
+    KeWaitForEvent(Context.Event, FALSE, WAIT_TIME_INDEFINITE);
+    Status = Context.Status;
+    ObReleaseReference(NewProcess);
+    NewProcess = NULL;
+
+SysSpawnProcessEnd:
+    if (NewProcess != NULL) {
+
+        //
+        // No thread was ever launched in the child, so nothing else will
+        // clean it up.
+        //
+
+        PspProcessTermination(NewProcess);
+        ObReleaseReference(NewProcess);
+    }
+
+    if (Context.File.Handle != INVALID_HANDLE) {
+        IoClose(Context.File.Handle);
+    }
+
+    if (Context.Event != NULL) {
+        KeDestroyEvent(Context.Event);
+    }
+
+    if (Context.FileActions != NULL) {
+        PspDestroySpawnFileActions(Context.FileActions,
+                                   Context.FileActionCount);
+    }
+
+    if (NewEnvironment != NULL) {
+        PsDestroyEnvironment(NewEnvironment);
+    }
+
+    return Status;
+}
+
 INTN
 PsSysGetSetProcessId (
     PVOID SystemCallParameter
@@ -857,7 +1151,7 @@ Return Value:
 }
 
 INTN
-PsSysDebug (
+PsSysSetScheduling (
     PVOID SystemCallParameter
     )
 
@@ -865,7 +1159,8 @@ PsSysDebug (
 
 Routine Description:
 
-    This routine implements the user mode debug interface.
+    This routine implements the system call that gets or sets the scheduling
+    class and priority of a process.
 
 Arguments:
 
@@ -883,81 +1178,226 @@ Return Value:
 
 {
 
+    SCHEDULER_CLASS Class;
+    PLIST_ENTRY CurrentEntry;
     PKPROCESS CurrentProcess;
-    PKPROCESS Parent;
-    PSYSTEM_CALL_DEBUG Request;
+    PKTHREAD CurrentThread;
+    THREAD_IDENTITY Identity;
+    BOOL LockHeld;
+    PSYSTEM_CALL_SET_SCHEDULING Parameters;
+    LONG Priority;
+    PKPROCESS Process;
     KSTATUS Status;
-    PKPROCESS TargetProcess;
-
-    CurrentProcess = PsGetCurrentProcess();
-    Request = (PSYSTEM_CALL_DEBUG)SystemCallParameter;
-    TargetProcess = NULL;
-    switch (Request->Command.Command) {
-    case DebugCommandEnableDebugging:
-        KeAcquireQueuedLock(CurrentProcess->QueuedLock);
-        Parent = CurrentProcess->Parent;
-        if (Parent != NULL) {
-            ObAddReference(Parent);
-        }
-
-        KeReleaseQueuedLock(CurrentProcess->QueuedLock);
-        if (Parent == NULL) {
-            Request->Command.Status = STATUS_TOO_LATE;
+    PKTHREAD Thread;
 
-        } else {
-            Request->Command.Status = PspDebugEnable(CurrentProcess,
-                                                     CurrentProcess->Parent);
+    CurrentThread = KeGetCurrentThread();
+    CurrentProcess = CurrentThread->OwningProcess;
+    LockHeld = FALSE;
+    Parameters = SystemCallParameter;
+    Process = CurrentProcess;
+    if ((Parameters->ProcessId != 0) &&
+        (Parameters->ProcessId != CurrentProcess->Identifiers.ProcessId)) {
 
-            ObReleaseReference(Parent);
+        Process = PspGetProcessById(Parameters->ProcessId);
+        if (Process == NULL) {
+            Status = STATUS_NO_SUCH_PROCESS;
+            goto SysSetSchedulingEnd;
         }
 
-        break;
+        if (Process == PsKernelProcess) {
+            Status = STATUS_ACCESS_DENIED;
+            goto SysSetSchedulingEnd;
+        }
+    }
 
-    case DebugCommandPrint:
-        Request->Command.Status = PspDebugPrint(CurrentProcess,
-                                                &(Request->Command));
+    //
+    // Changing another user's process requires the scheduling permission.
+    //
 
-        break;
+    if ((Parameters->Set != FALSE) && (Process != CurrentProcess)) {
+        Status = PspGetProcessIdentity(Process, &Identity);
+        if (!KSUCCESS(Status)) {
+            goto SysSetSchedulingEnd;
+        }
 
-    case DebugCommandReportModuleChange:
-        if (Request->Command.Size < sizeof(PROCESS_DEBUG_MODULE_CHANGE)) {
-            Request->Command.Size = sizeof(PROCESS_DEBUG_MODULE_CHANGE);
-            Request->Command.Status = STATUS_DATA_LENGTH_MISMATCH;
+        if ((CurrentThread->Identity.EffectiveUserId != Identity.RealUserId) &&
+            (CurrentThread->Identity.EffectiveUserId !=
+             Identity.EffectiveUserId)) {
 
-        } else {
-            Request->Command.Status =
-                         PspProcessUserModeModuleChange(Request->Command.Data);
+            Status = PsCheckPermission(PERMISSION_SCHEDULING);
+            if (!KSUCCESS(Status)) {
+                goto SysSetSchedulingEnd;
+            }
         }
+    }
 
-        break;
-
-    case DebugCommandContinue:
-    case DebugCommandReadMemory:
-    case DebugCommandWriteMemory:
-    case DebugCommandSwitchThread:
-    case DebugCommandGetBreakInformation:
-    case DebugCommandSetBreakInformation:
-    case DebugCommandGetSignalInformation:
-    case DebugCommandSetSignalInformation:
-    case DebugCommandSingleStep:
-    case DebugCommandRangeStep:
+    Class = Parameters->Class;
+    Priority = Parameters->Priority;
+    KeAcquireQueuedLock(Process->QueuedLock);
+    LockHeld = TRUE;
+    if (Process->ThreadCount == 0) {
+        Status = STATUS_NO_SUCH_PROCESS;
+        goto SysSetSchedulingEnd;
+    }
 
-        //
-        // First, look up the process.
-        //
+    //
+    // Return the current values, using the first thread as representative of
+    // the process.
+    //
 
-        TargetProcess = PspGetProcessById(Request->Process);
-        if ((TargetProcess == NULL) ||
-            (TargetProcess->DebugData == NULL) ||
-            (TargetProcess->DebugData->TracingProcess != CurrentProcess)) {
+    Thread = LIST_VALUE(Process->ThreadListHead.Next, KTHREAD, ProcessEntry);
+    Parameters->Class = Thread->SchedulerEntry.Class;
+    Parameters->Priority = Thread->SchedulerEntry.Priority;
+    if (Parameters->Set == FALSE) {
+        Status = STATUS_SUCCESS;
+        goto SysSetSchedulingEnd;
+    }
 
-            Request->Command.Status = STATUS_INVALID_PARAMETER;
-            goto SysDebugEnd;
-        }
+    //
+    // Entering a real-time class or lowering the nice value of a process
+    // requires the scheduling permission.
+    //
 
-        Status = PspDebugIssueCommand(CurrentProcess,
-                                      TargetProcess,
-                                      &(Request->Command));
+    if ((Class != SchedulerClassFairShare) ||
+        ((Parameters->Class == SchedulerClassFairShare) &&
+         (Priority < Parameters->Priority))) {
+
+        Status = PsCheckPermission(PERMISSION_SCHEDULING);
+        if (!KSUCCESS(Status)) {
+            goto SysSetSchedulingEnd;
+        }
+    }
+
+    CurrentEntry = Process->ThreadListHead.Next;
+    while (CurrentEntry != &(Process->ThreadListHead)) {
+        Thread = LIST_VALUE(CurrentEntry, KTHREAD, ProcessEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if (Thread->State == ThreadStateExited) {
+            continue;
+        }
+
+        Status = KeSetThreadSchedulingParameters(Thread, Class, Priority);
+        if (!KSUCCESS(Status)) {
+            goto SysSetSchedulingEnd;
+        }
+    }
+
+    Status = STATUS_SUCCESS;
+
+SysSetSchedulingEnd:
+    if (LockHeld != FALSE) {
+        KeReleaseQueuedLock(Process->QueuedLock);
+    }
+
+    if ((Process != NULL) && (Process != CurrentProcess)) {
+        ObReleaseReference(Process);
+    }
+
+    return Status;
+}
+
+INTN
+PsSysDebug (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the user mode debug interface.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+{
+
+    PKPROCESS CurrentProcess;
+    PKPROCESS Parent;
+    PSYSTEM_CALL_DEBUG Request;
+    KSTATUS Status;
+    PKPROCESS TargetProcess;
+
+    CurrentProcess = PsGetCurrentProcess();
+    Request = (PSYSTEM_CALL_DEBUG)SystemCallParameter;
+    TargetProcess = NULL;
+    switch (Request->Command.Command) {
+    case DebugCommandEnableDebugging:
+        KeAcquireQueuedLock(CurrentProcess->QueuedLock);
+        Parent = CurrentProcess->Parent;
+        if (Parent != NULL) {
+            ObAddReference(Parent);
+        }
+
+        KeReleaseQueuedLock(CurrentProcess->QueuedLock);
+        if (Parent == NULL) {
+            Request->Command.Status = STATUS_TOO_LATE;
+
+        } else {
+            Request->Command.Status = PspDebugEnable(CurrentProcess,
+                                                     CurrentProcess->Parent);
+
+            ObReleaseReference(Parent);
+        }
+
+        break;
+
+    case DebugCommandPrint:
+        Request->Command.Status = PspDebugPrint(CurrentProcess,
+                                                &(Request->Command));
+
+        break;
+
+    case DebugCommandReportModuleChange:
+        if (Request->Command.Size < sizeof(PROCESS_DEBUG_MODULE_CHANGE)) {
+            Request->Command.Size = sizeof(PROCESS_DEBUG_MODULE_CHANGE);
+            Request->Command.Status = STATUS_DATA_LENGTH_MISMATCH;
+
+        } else {
+            Request->Command.Status =
+                         PspProcessUserModeModuleChange(Request->Command.Data);
+        }
+
+        break;
+
+    case DebugCommandContinue:
+    case DebugCommandReadMemory:
+    case DebugCommandWriteMemory:
+    case DebugCommandSwitchThread:
+    case DebugCommandGetBreakInformation:
+    case DebugCommandSetBreakInformation:
+    case DebugCommandGetSignalInformation:
+    case DebugCommandSetSignalInformation:
+    case DebugCommandSingleStep:
+    case DebugCommandRangeStep:
+
+        //
+        // First, look up the process.
+        //
+
+        TargetProcess = PspGetProcessById(Request->Process);
+        if ((TargetProcess == NULL) ||
+            (TargetProcess->DebugData == NULL) ||
+            (TargetProcess->DebugData->TracingProcess != CurrentProcess)) {
+
+            Request->Command.Status = STATUS_INVALID_PARAMETER;
+            goto SysDebugEnd;
+        }
+
+        Status = PspDebugIssueCommand(CurrentProcess,
+                                      TargetProcess,
+                                      &(Request->Command));
 
         if (!KSUCCESS(Status)) {
             Request->Command.Status = Status;
@@ -1703,120 +2143,21 @@ Return Value:
 
 {
 
-    PPATH_POINT CurrentDirectory;
-    PATH_POINT CurrentDirectoryCopy;
     PKTHREAD NewMainThread;
     PKPROCESS NewProcess;
-    PPATH_POINT RootDirectory;
-    PATH_POINT RootDirectoryCopy;
-    PPATH_POINT SharedMemoryDirectory;
-    PATH_POINT SharedMemoryDirectoryCopy;
     KSTATUS Status;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
-    CurrentDirectory = NULL;
-    RootDirectory = NULL;
-    SharedMemoryDirectory = NULL;
-
-    //
-    // Get the processes root and current directories. Add references in case a
-    // pending change directory is coming in, which would release the
-    // references held inherently by this process.
-    //
-
-    KeAcquireQueuedLock(Process->Paths.Lock);
-    if (Process->Paths.CurrentDirectory.PathEntry != NULL) {
-        IO_COPY_PATH_POINT(&CurrentDirectoryCopy,
-                           &(Process->Paths.CurrentDirectory));
-
-        IO_PATH_POINT_ADD_REFERENCE(&CurrentDirectoryCopy);
-        CurrentDirectory = &CurrentDirectoryCopy;
-    }
-
-    if (Process->Paths.Root.PathEntry != NULL) {
-        IO_COPY_PATH_POINT(&RootDirectoryCopy, &(Process->Paths.Root));
-        IO_PATH_POINT_ADD_REFERENCE(&RootDirectoryCopy);
-        RootDirectory = &RootDirectoryCopy;
-    }
-
-    if (Process->Paths.SharedMemoryDirectory.PathEntry != NULL) {
-        IO_COPY_PATH_POINT(&SharedMemoryDirectoryCopy,
-                           &(Process->Paths.SharedMemoryDirectory));
-
-        IO_PATH_POINT_ADD_REFERENCE(&SharedMemoryDirectoryCopy);
-        SharedMemoryDirectory = &SharedMemoryDirectoryCopy;
-    }
-
-    KeReleaseQueuedLock(Process->Paths.Lock);
-    NewProcess = PspCreateProcess(Process->BinaryName,
-                                  Process->BinaryNameSize,
-                                  Process->Environment,
-                                  &(Process->Identifiers),
-                                  Process->ControllingTerminal,
-                                  RootDirectory,
-                                  CurrentDirectory,
-                                  SharedMemoryDirectory);
-
-    if (CurrentDirectory != NULL) {
-        IO_PATH_POINT_RELEASE_REFERENCE(CurrentDirectory);
-    }
-
-    if (RootDirectory != NULL) {
-        IO_PATH_POINT_RELEASE_REFERENCE(RootDirectory);
-    }
-
-    if (SharedMemoryDirectory != NULL) {
-        IO_PATH_POINT_RELEASE_REFERENCE(SharedMemoryDirectory);
-    }
+    Status = PspCreateChildProcess(Process,
+                                   Process->Environment,
+                                   TRUE,
+                                   &NewProcess);
 
-    if (NewProcess == NULL) {
-        Status = STATUS_UNSUCCESSFUL;
+    if (!KSUCCESS(Status)) {
         goto CopyProcessEnd;
     }
 
-    //
-    // Set the parent, join the parent's children and then the parent's process
-    // group. The new process must be on the parent's list of children before
-    // joining the process group in case there is a race to change the parent's
-    // process group (perhaps a request from the grandparent). Changing a
-    // process group requires notifying all the children with non-null process
-    // groups.
-    //
-
-    NewProcess->Parent = Process;
-    KeAcquireQueuedLock(Process->QueuedLock);
-    NewProcess->SignalHandlerRoutine = Process->SignalHandlerRoutine;
-    NewProcess->HandledSignals = Process->HandledSignals;
-    NewProcess->IgnoredSignals = Process->IgnoredSignals;
-    NewProcess->Umask = Process->Umask;
-    INSERT_BEFORE(&(NewProcess->SiblingListEntry), &(Process->ChildListHead));
-    KeReleaseQueuedLock(Process->QueuedLock);
-    PspAddProcessToParentProcessGroup(NewProcess);
-
-    //
-    // If this process' controlling terminal was cleared during the process
-    // creation, clear out the new child as well, as the clearing may have
-    // happened before the new child was added to the global list.
-    //
-
-    if (Process->ControllingTerminal == NULL) {
-        NewProcess->ControllingTerminal = NULL;
-    }
-
-    //
-    // Add the tracing process if needed.
-    //
-
-    if ((Process->DebugData != NULL) &&
-        (Process->DebugData->TracingProcess != NULL)) {
-
-        Status = PspDebugEnable(NewProcess, Process->DebugData->TracingProcess);
-        if (!KSUCCESS(Status)) {
-            goto CopyProcessEnd;
-        }
-    }
-
     //
     // Copy the process handle table.
     //
@@ -3258,82 +3599,476 @@ Return Value:
     PROCESS_DEBUG_COMMAND TerminateCommand;
 
     //
-    // Disassociate the children from their dying parent.
+    // Disassociate the children from their dying parent.
+    //
+
+    KeAcquireQueuedLock(Process->QueuedLock);
+    CurrentEntry = Process->ChildListHead.Next;
+    while (CurrentEntry != &(Process->ChildListHead)) {
+        Child = LIST_VALUE(CurrentEntry, KPROCESS, SiblingListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        KeAcquireQueuedLock(Child->QueuedLock);
+        LIST_REMOVE(&(Child->SiblingListEntry));
+        Child->SiblingListEntry.Next = NULL;
+        Child->Parent = NULL;
+
+        //
+        // Simulate the reparenting even though that's not done.
+        //
+
+        Child->Identifiers.ParentProcessId = 1;
+        KeReleaseQueuedLock(Child->QueuedLock);
+    }
+
+    //
+    // Also release and continue any processes this process is tracing.
+    //
+
+    if (Process->DebugData != NULL) {
+        CurrentEntry = Process->DebugData->TraceeListHead.Next;
+        while (CurrentEntry != &(Process->DebugData->TraceeListHead)) {
+            ChildDebugData = LIST_VALUE(CurrentEntry,
+                                        PROCESS_DEBUG_DATA,
+                                        TracerListEntry);
+
+            Child = ChildDebugData->Process;
+            CurrentEntry = CurrentEntry->Next;
+
+            //
+            // Only the child process can detach itself from the tracer (though
+            // it can't go through with that until acquiring the process lock
+            // already held here). Coerce the process into doing this by sending
+            // a kill signal. Additionally, if the child is already waiting on
+            // this process for tracing, then continue it with the kill signal.
+            //
+
+            PspSetProcessExitStatus(Child,
+                                    CHILD_SIGNAL_REASON_KILLED,
+                                    SIGNAL_ABORT);
+
+            PsSignalProcess(Child, SIGNAL_KILL, NULL);
+            if (KeIsSpinLockHeld(&(ChildDebugData->TracerLock)) != FALSE) {
+                RtlZeroMemory(&TerminateCommand, sizeof(PROCESS_DEBUG_COMMAND));
+                TerminateCommand.Command = DebugCommandContinue;
+                TerminateCommand.SignalToDeliver = SIGNAL_KILL;
+                PspDebugIssueCommand(Process, Child, &TerminateCommand);
+            }
+        }
+    }
+
+    KeReleaseQueuedLock(Process->QueuedLock);
+    return;
+}
+
+VOID
+PspLoaderThread (
+    PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine begins a new process by loading the executable.
+
+Arguments:
+
+    Context - Supplies the context pointer, which is the name of the binary to
+        load.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PKPROCESS Process;
+    PROCESS_START_DATA StartData;
+    KSTATUS Status;
+    PKTHREAD Thread;
+    THREAD_CREATION_PARAMETERS ThreadParameters;
+
+    Thread = KeGetCurrentThread();
+    Process = Thread->OwningProcess;
+
+    //
+    // Map the user shared data page into the process' usermode address space.
+    //
+
+    Status = MmMapUserSharedData(Process->AddressSpace);
+    if (!KSUCCESS(Status)) {
+        goto LoaderThreadEnd;
+    }
+
+    //
+    // Initialize the memory map limit, otherwise the image loads can't map
+    // anything anywhere.
+    //
+
+    Process->AddressSpace->MaxMemoryMap = MAX_USER_ADDRESS -
+                                  (Thread->Limits[ResourceLimitStack].Current +
+                                   USER_STACK_HEADROOM) + 1;
+
+    //
+    // Load the executable image for the process.
+    //
+
+    Status = PspLoadExecutable(Process->Environment->ImageName,
+                               NULL,
+                               NULL,
+                               &StartData);
+
+    if (!KSUCCESS(Status)) {
+        goto LoaderThreadEnd;
+    }
+
+    Process->Environment->StartData = &StartData;
+
+    //
+    // Kick off the primary usermode thread.
+    //
+
+    RtlZeroMemory(&ThreadParameters, sizeof(THREAD_CREATION_PARAMETERS));
+    ThreadParameters.Name = "MainThread";
+    ThreadParameters.NameSize = sizeof("MainThread");
+    ThreadParameters.ThreadRoutine = StartData.EntryPoint;
+    ThreadParameters.Environment = Process->Environment;
+    ThreadParameters.Flags = THREAD_FLAG_USER_MODE;
+    Status = PsCreateThread(&ThreadParameters);
+    Process->Environment->StartData = NULL;
+    if (!KSUCCESS(Status)) {
+        goto LoaderThreadEnd;
+    }
+
+    Status = STATUS_SUCCESS;
+
+LoaderThreadEnd:
+    if (!KSUCCESS(Status)) {
+        PspSetProcessExitStatus(Process,
+                                CHILD_SIGNAL_REASON_KILLED,
+                                SIGNAL_ABORT);
+    }
+
+    //
+    // There's really no point in cleaning up as the process cleanup will
+    // catch everything.
+    //
+
+    return;
+}
+
+KSTATUS
+PspLoadExecutable (
+    PSTR BinaryName,
+    PIMAGE_FILE_INFORMATION File,
+    PIMAGE_BUFFER Buffer,
+    PPROCESS_START_DATA StartData
+    )
+
+/*++
+
+Routine Description:
+
+    This routine loads a new executable image into memory.
+
+Arguments:
+
+    BinaryName - Supplies a pointer to the name of the image on disk. This
+        memory is not used after this function call, and can be released by the
+        caller.
+
+    File - Supplies an optional pointer to the already retrieved file
+        information, including a handle pointing at the beginning of the file.
+
+    Buffer - Supplies an optional pointer to the loaded image buffer, or at
+        least part of it.
+
+    StartData - Supplies a pointer to the process start data, which will be
+        initialized by this routine.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PLOADED_IMAGE Executable;
+    ULONG Flags;
+    PLOADED_IMAGE Interpreter;
+    PLOADED_IMAGE OsBaseLibrary;
+    ULONG PageSize;
+    PKPROCESS Process;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    Executable = NULL;
+    Process = PsGetCurrentProcess();
+
+    ASSERT(Process != PsKernelProcess);
+
+    PsAcquireImageListLock(Process);
+
+    //
+    // Always load the OS base library.
+    //
+
+    Flags = IMAGE_LOAD_FLAG_LOAD_ONLY;
+    Status = ImLoad(&(Process->ImageListHead),
+                    OS_BASE_LIBRARY,
+                    NULL,
+                    NULL,
+                    Process,
+                    Flags,
+                    &OsBaseLibrary,
+                    NULL);
+
+    if (!KSUCCESS(Status)) {
+        RtlDebugPrint("Failed to load %s: %d\n", OS_BASE_LIBRARY, Status);
+        goto LoadExecutableEnd;
+    }
+
+    OsBaseLibrary->LibraryName = OsBaseLibrary->FileName;
+
+    //
+    // Load the image and maybe the interpreter, but do not load any imports
+    // or perform any relocations.
+    //
+
+    Flags = IMAGE_LOAD_FLAG_LOAD_ONLY | IMAGE_LOAD_FLAG_PRIMARY_EXECUTABLE;
+    Status = ImLoad(&(Process->ImageListHead),
+                    BinaryName,
+                    File,
+                    Buffer,
+                    Process,
+                    Flags,
+                    &Executable,
+                    &Interpreter);
+
+    if (!KSUCCESS(Status)) {
+        RtlDebugPrint("Failed to load %s: %d\n", BinaryName, Status);
+        goto LoadExecutableEnd;
+    }
+
+    //
+    // Drop the extra reference on the OS base library if it was also loaded
+    // as the executable directly or the interpreter.
+    //
+
+    if ((OsBaseLibrary == Interpreter) || (OsBaseLibrary == Executable)) {
+        ImImageReleaseReference(OsBaseLibrary);
+    }
+
+    //
+    // Save the address of the program break.
+    //
+
+    PageSize = MmPageSize();
+    Process->AddressSpace->BreakStart =
+           ALIGN_POINTER_UP(Executable->LoadedImageBuffer + Executable->Size,
+                            PageSize);
+
+    Process->AddressSpace->BreakEnd = Process->AddressSpace->BreakStart;
+    PspInitializeProcessStartData(StartData,
+                                  OsBaseLibrary,
+                                  Executable,
+                                  Interpreter);
+
+LoadExecutableEnd:
+    PsReleaseImageListLock(Process);
+    return Status;
+}
+
+KSTATUS
+PspCreateChildProcess (
+    PKPROCESS Process,
+    PPROCESS_ENVIRONMENT Environment,
+    BOOL InheritSignalHandlers,
+    PKPROCESS *CreatedProcess
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new, empty child of the given process. The child
+    inherits the parent's paths, identifiers, umask, ignored signals, process
+    group, and tracer, but has no handles, memory, or threads.
+
+Arguments:
+
+    Process - Supplies a pointer to the parent process.
+
+    Environment - Supplies a pointer to the environment to copy into the
+        child.
+
+    InheritSignalHandlers - Supplies a boolean indicating whether the child
+        inherits the parent's signal handlers (TRUE, for fork) or starts with
+        all handled signals at their default dispositions (FALSE).
+
+    CreatedProcess - Supplies a pointer where a pointer to the new process
+        will be returned on success. The caller owns a reference on it.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PPATH_POINT CurrentDirectory;
+    PATH_POINT CurrentDirectoryCopy;
+    PKPROCESS NewProcess;
+    PPATH_POINT RootDirectory;
+    PATH_POINT RootDirectoryCopy;
+    PPATH_POINT SharedMemoryDirectory;
+    PATH_POINT SharedMemoryDirectoryCopy;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    CurrentDirectory = NULL;
+    RootDirectory = NULL;
+    SharedMemoryDirectory = NULL;
+
+    //
+    // Get the processes root and current directories. Add references in case a
+    // pending change directory is coming in, which would release the
+    // references held inherently by this process.
+    //
+
+    KeAcquireQueuedLock(Process->Paths.Lock);
+    if (Process->Paths.CurrentDirectory.PathEntry != NULL) {
+        IO_COPY_PATH_POINT(&CurrentDirectoryCopy,
+                           &(Process->Paths.CurrentDirectory));
+
+        IO_PATH_POINT_ADD_REFERENCE(&CurrentDirectoryCopy);
+        CurrentDirectory = &CurrentDirectoryCopy;
+    }
+
+    if (Process->Paths.Root.PathEntry != NULL) {
+        IO_COPY_PATH_POINT(&RootDirectoryCopy, &(Process->Paths.Root));
+        IO_PATH_POINT_ADD_REFERENCE(&RootDirectoryCopy);
+        RootDirectory = &RootDirectoryCopy;
+    }
+
+    if (Process->Paths.SharedMemoryDirectory.PathEntry != NULL) {
+        IO_COPY_PATH_POINT(&SharedMemoryDirectoryCopy,
+                           &(Process->Paths.SharedMemoryDirectory));
+
+        IO_PATH_POINT_ADD_REFERENCE(&SharedMemoryDirectoryCopy);
+        SharedMemoryDirectory = &SharedMemoryDirectoryCopy;
+    }
+
+    KeReleaseQueuedLock(Process->Paths.Lock);
+    NewProcess = PspCreateProcess(Process->BinaryName,
+                                  Process->BinaryNameSize,
+                                  Environment,
+                                  &(Process->Identifiers),
+                                  Process->ControllingTerminal,
+                                  RootDirectory,
+                                  CurrentDirectory,
+                                  SharedMemoryDirectory);
+
+    if (CurrentDirectory != NULL) {
+        IO_PATH_POINT_RELEASE_REFERENCE(CurrentDirectory);
+    }
+
+    if (RootDirectory != NULL) {
+        IO_PATH_POINT_RELEASE_REFERENCE(RootDirectory);
+    }
+
+    if (SharedMemoryDirectory != NULL) {
+        IO_PATH_POINT_RELEASE_REFERENCE(SharedMemoryDirectory);
+    }
+
+    if (NewProcess == NULL) {
+        Status = STATUS_UNSUCCESSFUL;
+        goto CreateChildProcessEnd;
+    }
+
+    //
+    // Set the parent, join the parent's children and then the parent's process
+    // group. The new process must be on the parent's list of children before
+    // joining the process group in case there is a race to change the parent's
+    // process group (perhaps a request from the grandparent). Changing a
+    // process group requires notifying all the children with non-null process
+    // groups.
     //
 
+    NewProcess->Parent = Process;
     KeAcquireQueuedLock(Process->QueuedLock);
-    CurrentEntry = Process->ChildListHead.Next;
-    while (CurrentEntry != &(Process->ChildListHead)) {
-        Child = LIST_VALUE(CurrentEntry, KPROCESS, SiblingListEntry);
-        CurrentEntry = CurrentEntry->Next;
-        KeAcquireQueuedLock(Child->QueuedLock);
-        LIST_REMOVE(&(Child->SiblingListEntry));
-        Child->SiblingListEntry.Next = NULL;
-        Child->Parent = NULL;
+    if (InheritSignalHandlers != FALSE) {
+        NewProcess->SignalHandlerRoutine = Process->SignalHandlerRoutine;
+        NewProcess->HandledSignals = Process->HandledSignals;
+    }
 
-        //
-        // Simulate the reparenting even though that's not done.
-        //
+    NewProcess->IgnoredSignals = Process->IgnoredSignals;
+    NewProcess->Umask = Process->Umask;
+    INSERT_BEFORE(&(NewProcess->SiblingListEntry), &(Process->ChildListHead));
+    KeReleaseQueuedLock(Process->QueuedLock);
+    PspAddProcessToParentProcessGroup(NewProcess);
 
-        Child->Identifiers.ParentProcessId = 1;
-        KeReleaseQueuedLock(Child->QueuedLock);
+    //
+    // If this process' controlling terminal was cleared during the process
+    // creation, clear out the new child as well, as the clearing may have
+    // happened before the new child was added to the global list.
+    //
+
+    if (Process->ControllingTerminal == NULL) {
+        NewProcess->ControllingTerminal = NULL;
     }
 
     //
-    // Also release and continue any processes this process is tracing.
+    // Add the tracing process if needed.
     //
 
-    if (Process->DebugData != NULL) {
-        CurrentEntry = Process->DebugData->TraceeListHead.Next;
-        while (CurrentEntry != &(Process->DebugData->TraceeListHead)) {
-            ChildDebugData = LIST_VALUE(CurrentEntry,
-                                        PROCESS_DEBUG_DATA,
-                                        TracerListEntry);
-
-            Child = ChildDebugData->Process;
-            CurrentEntry = CurrentEntry->Next;
+    if ((Process->DebugData != NULL) &&
+        (Process->DebugData->TracingProcess != NULL)) {
 
-            //
-            // Only the child process can detach itself from the tracer (though
-            // it can't go through with that until acquiring the process lock
-            // already held here). Coerce the process into doing this by sending
-            // a kill signal. Additionally, if the child is already waiting on
-            // this process for tracing, then continue it with the kill signal.
-            //
+        Status = PspDebugEnable(NewProcess, Process->DebugData->TracingProcess);
+        if (!KSUCCESS(Status)) {
+            goto CreateChildProcessEnd;
+        }
+    }
 
-            PspSetProcessExitStatus(Child,
-                                    CHILD_SIGNAL_REASON_KILLED,
-                                    SIGNAL_ABORT);
+    Status = STATUS_SUCCESS;
 
-            PsSignalProcess(Child, SIGNAL_KILL, NULL);
-            if (KeIsSpinLockHeld(&(ChildDebugData->TracerLock)) != FALSE) {
-                RtlZeroMemory(&TerminateCommand, sizeof(PROCESS_DEBUG_COMMAND));
-                TerminateCommand.Command = DebugCommandContinue;
-                TerminateCommand.SignalToDeliver = SIGNAL_KILL;
-                PspDebugIssueCommand(Process, Child, &TerminateCommand);
-            }
+CreateChildProcessEnd:
+    if (!KSUCCESS(Status)) {
+        if (NewProcess != NULL) {
+            PspProcessTermination(NewProcess);
+            ObReleaseReference(NewProcess);
+            NewProcess = NULL;
         }
     }
 
-    KeReleaseQueuedLock(Process->QueuedLock);
-    return;
+    *CreatedProcess = NewProcess;
+    return Status;
 }
 
 VOID
-PspLoaderThread (
-    PVOID Context
+PspSpawnLoaderThread (
+    PVOID Parameter
     )
 
 /*++
 
 Routine Description:
 
-    This routine begins a new process by loading the executable.
+    This routine starts a spawned process. It runs as the first thread of the
+    child, applies the requested attributes and file actions, loads the
+    image, and kicks off the main thread before reporting back to the parent.
 
 Arguments:
 
-    Context - Supplies the context pointer, which is the name of the binary to
-        load.
+    Parameter - Supplies a pointer to the spawn context, which lives on the
+        parent's stack until the event in it is signaled.
 
 Return Value:
 
@@ -3343,52 +4078,96 @@ Return Value:
 
 {
 
+    PSPAWN_CONTEXT Context;
+    IMAGE_FILE_INFORMATION File;
+    PROCESS_GROUP_ID ProcessGroup;
     PKPROCESS Process;
     PROCESS_START_DATA StartData;
     KSTATUS Status;
     PKTHREAD Thread;
     THREAD_CREATION_PARAMETERS ThreadParameters;
 
+    Context = Parameter;
     Thread = KeGetCurrentThread();
     Process = Thread->OwningProcess;
+    RtlCopyMemory(&File, &(Context->File), sizeof(IMAGE_FILE_INFORMATION));
+    Context->File.Handle = INVALID_HANDLE;
 
     //
-    // Map the user shared data page into the process' usermode address space.
+    // Apply the attributes in the same order a child of fork would.
     //
 
-    Status = MmMapUserSharedData(Process->AddressSpace);
+    if ((Context->Flags & SPAWN_FLAG_PROCESS_GROUP) != 0) {
+        ProcessGroup = Context->ProcessGroup;
+        if (ProcessGroup == 0) {
+            ProcessGroup = Process->Identifiers.ProcessId;
+        }
+
+        Status = PspJoinProcessGroup(Process, ProcessGroup, FALSE);
+        if (!KSUCCESS(Status)) {
+            goto SpawnLoaderThreadEnd;
+        }
+    }
+
+    if ((Context->Flags & SPAWN_FLAG_RESET_IDS) != 0) {
+        Thread->Identity.EffectiveUserId = Thread->Identity.RealUserId;
+        Thread->Identity.EffectiveGroupId = Thread->Identity.RealGroupId;
+    }
+
+    if ((Context->Flags & SPAWN_FLAG_SIGNAL_DEFAULTS) != 0) {
+        KeAcquireQueuedLock(Process->QueuedLock);
+        REMOVE_SIGNALS_FROM_SET(Process->IgnoredSignals,
+                                Context->DefaultSignals);
+
+        KeReleaseQueuedLock(Process->QueuedLock);
+    }
+
+    Status = IoPerformSpawnFileActions(Context->FileActions,
+                                       Context->FileActionCount);
+
     if (!KSUCCESS(Status)) {
-        goto LoaderThreadEnd;
+        goto SpawnLoaderThreadEnd;
+    }
+
+    Status = IoCloseHandlesOnExecute(Process);
+    if (!KSUCCESS(Status)) {
+        goto SpawnLoaderThreadEnd;
     }
 
     //
-    // Initialize the memory map limit, otherwise the image loads can't map
-    // anything anywhere.
+    // From here on this is the same as starting a process from scratch.
     //
 
+    Status = MmMapUserSharedData(Process->AddressSpace);
+    if (!KSUCCESS(Status)) {
+        goto SpawnLoaderThreadEnd;
+    }
+
     Process->AddressSpace->MaxMemoryMap = MAX_USER_ADDRESS -
                                   (Thread->Limits[ResourceLimitStack].Current +
                                    USER_STACK_HEADROOM) + 1;
 
-    //
-    // Load the executable image for the process.
-    //
-
+    PspPerformExecutePermissionChanges(File.Handle);
     Status = PspLoadExecutable(Process->Environment->ImageName,
-                               NULL,
+                               &File,
                                NULL,
                                &StartData);
 
     if (!KSUCCESS(Status)) {
-        goto LoaderThreadEnd;
+        goto SpawnLoaderThreadEnd;
     }
 
-    Process->Environment->StartData = &StartData;
+    File.Handle = INVALID_HANDLE;
+    KeAcquireQueuedLock(Process->QueuedLock);
+    Process->Flags |= PROCESS_FLAG_EXECUTED_IMAGE;
+    KeReleaseQueuedLock(Process->QueuedLock);
 
     //
-    // Kick off the primary usermode thread.
+    // The main thread picks up its signal mask from this thread.
     //
 
+    Thread->BlockedSignals = Context->SignalMask;
+    Process->Environment->StartData = &StartData;
     RtlZeroMemory(&ThreadParameters, sizeof(THREAD_CREATION_PARAMETERS));
     ThreadParameters.Name = "MainThread";
     ThreadParameters.NameSize = sizeof("MainThread");
@@ -3398,148 +4177,68 @@ Return Value:
     Status = PsCreateThread(&ThreadParameters);
     Process->Environment->StartData = NULL;
     if (!KSUCCESS(Status)) {
-        goto LoaderThreadEnd;
+        goto SpawnLoaderThreadEnd;
     }
 
     Status = STATUS_SUCCESS;
 
-LoaderThreadEnd:
+SpawnLoaderThreadEnd:
+    if (File.Handle != INVALID_HANDLE) {
+        IoClose(File.Handle);
+    }
+
     if (!KSUCCESS(Status)) {
         PspSetProcessExitStatus(Process,
-                                CHILD_SIGNAL_REASON_KILLED,
-                                SIGNAL_ABORT);
+                                CHILD_SIGNAL_REASON_EXITED,
+                                SPAWN_FAILURE_EXIT_STATUS);
     }
 
     //
-    // There's really no point in cleaning up as the process cleanup will
-    // catch everything.
+    // The context is gone once the parent is released.
     //
 
+    Context->Status = Status;
+    KeSignalEvent(Context->Event, SignalOptionSignalAll);
     return;
 }
 
-KSTATUS
-PspLoadExecutable (
-    PSTR BinaryName,
-    PIMAGE_FILE_INFORMATION File,
-    PIMAGE_BUFFER Buffer,
-    PPROCESS_START_DATA StartData
+VOID
+PspDestroySpawnFileActions (
+    PSPAWN_FILE_ACTION Actions,
+    ULONG ActionCount
     )
 
 /*++
 
 Routine Description:
 
-    This routine loads a new executable image into memory.
+    This routine frees a kernel copy of a spawn file action array.
 
 Arguments:
 
-    BinaryName - Supplies a pointer to the name of the image on disk. This
-        memory is not used after this function call, and can be released by the
-        caller.
-
-    File - Supplies an optional pointer to the already retrieved file
-        information, including a handle pointing at the beginning of the file.
-
-    Buffer - Supplies an optional pointer to the loaded image buffer, or at
-        least part of it.
+    Actions - Supplies a pointer to the array to free.
 
-    StartData - Supplies a pointer to the process start data, which will be
-        initialized by this routine.
+    ActionCount - Supplies the number of elements whose paths have been
+        initialized.
 
 Return Value:
 
-    Status code.
+    None.
 
 --*/
 
 {
 
-    PLOADED_IMAGE Executable;
-    ULONG Flags;
-    PLOADED_IMAGE Interpreter;
-    PLOADED_IMAGE OsBaseLibrary;
-    ULONG PageSize;
-    PKPROCESS Process;
-    KSTATUS Status;
-
-    ASSERT(KeGetRunLevel() == RunLevelLow);
-
-    Executable = NULL;
-    Process = PsGetCurrentProcess();
-
-    ASSERT(Process != PsKernelProcess);
-
-    PsAcquireImageListLock(Process);
-
-    //
-    // Always load the OS base library.
-    //
-
-    Flags = IMAGE_LOAD_FLAG_LOAD_ONLY;
-    Status = ImLoad(&(Process->ImageListHead),
-                    OS_BASE_LIBRARY,
-                    NULL,
-                    NULL,
-                    Process,
-                    Flags,
-                    &OsBaseLibrary,
-                    NULL);
-
-    if (!KSUCCESS(Status)) {
-        RtlDebugPrint("Failed to load %s: %d\n", OS_BASE_LIBRARY, Status);
-        goto LoadExecutableEnd;
-    }
-
-    OsBaseLibrary->LibraryName = OsBaseLibrary->FileName;
-
-    //
-    // Load the image and maybe the interpreter, but do not load any imports
-    // or perform any relocations.
-    //
-
-    Flags = IMAGE_LOAD_FLAG_LOAD_ONLY | IMAGE_LOAD_FLAG_PRIMARY_EXECUTABLE;
-    Status = ImLoad(&(Process->ImageListHead),
-                    BinaryName,
-                    File,
-                    Buffer,
-                    Process,
-                    Flags,
-                    &Executable,
-                    &Interpreter);
-
-    if (!KSUCCESS(Status)) {
-        RtlDebugPrint("Failed to load %s: %d\n", BinaryName, Status);
-        goto LoadExecutableEnd;
-    }
-
-    //
-    // Drop the extra reference on the OS base library if it was also loaded
-    // as the executable directly or the interpreter.
-    //
+    ULONG ActionIndex;
 
-    if ((OsBaseLibrary == Interpreter) || (OsBaseLibrary == Executable)) {
-        ImImageReleaseReference(OsBaseLibrary);
+    for (ActionIndex = 0; ActionIndex < ActionCount; ActionIndex += 1) {
+        if (Actions[ActionIndex].Path != NULL) {
+            MmFreePagedPool(Actions[ActionIndex].Path);
+        }
     }
 
-    //
-    // Save the address of the program break.
-    //
-
-    PageSize = MmPageSize();
-    Process->AddressSpace->BreakStart =
-           ALIGN_POINTER_UP(Executable->LoadedImageBuffer + Executable->Size,
-                            PageSize);
-
-    Process->AddressSpace->BreakEnd = Process->AddressSpace->BreakStart;
-    PspInitializeProcessStartData(StartData,
-                                  OsBaseLibrary,
-                                  Executable,
-                                  Interpreter);
-
-LoadExecutableEnd:
-    PsReleaseImageListLock(Process);
-    return Status;
+    MmFreePagedPool(Actions);
+    return;
 }
 
 VOID
@@ -4676,11 +5375,30 @@ Return Value:
         }
 
         //
-        // TODO: Fill out the remaining process data (user ID, priority, etc).
+        // Report the scheduling parameters of the first thread. Real-time
+        // threads report their fixed priority, fair share threads report
+        // their nice value.
         //
 
         Buffer->Priority = 0;
         Buffer->NiceValue = 0;
+        if (Process->ThreadCount != 0) {
+            Thread = LIST_VALUE(Process->ThreadListHead.Next,
+                                KTHREAD,
+                                ProcessEntry);
+
+            if (Thread->SchedulerEntry.Class == SchedulerClassFairShare) {
+                Buffer->NiceValue = Thread->SchedulerEntry.Priority;
+
+            } else {
+                Buffer->Priority = Thread->SchedulerEntry.Priority;
+            }
+        }
+
+        //
+        // TODO: Fill out the remaining process data (flags, etc).
+        //
+
         Buffer->Flags = 0;
 
     } else {
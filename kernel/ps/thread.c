@@ -1487,6 +1487,7 @@ Return Value:
     PKTHREAD NewThread;
     ULONG ObjectFlags;
     KSTATUS Status;
+    PSCHEDULER_ENTRY Template;
     BOOL UserMode;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
@@ -1555,8 +1556,21 @@ Return Value:
     NewThread->ThreadParameter = ThreadParameter;
     NewThread->Flags = Flags;
     NewThread->SignalPending = ThreadNoSignalPending;
-    NewThread->SchedulerEntry.Type = SchedulerEntryThread;
-    NewThread->SchedulerEntry.Parent = CurrentThread->SchedulerEntry.Parent;
+
+    //
+    // User mode threads inherit the scheduling class and priority of their
+    // creator. Kernel threads always start out in the default class.
+    //
+
+    Template = NULL;
+    if (OwningProcess != PsKernelProcess) {
+        Template = &(CurrentThread->SchedulerEntry);
+    }
+
+    KeInitializeSchedulerEntry(&(NewThread->SchedulerEntry),
+                               CurrentThread->SchedulerEntry.Parent,
+                               Template);
+
     NewThread->ThreadPointer = PsInitialThreadPointer;
 
     //
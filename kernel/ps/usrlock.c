@@ -36,6 +36,20 @@ Module Name:
 // ---------------------------------------------------------------- Definitions
 //
 
+//
+// Define the number of hash buckets user locks are spread across. This must be
+// a power of two.
+//
+
+#define USER_LOCK_BUCKET_SHIFT 8
+#define USER_LOCK_BUCKET_COUNT (1 << USER_LOCK_BUCKET_SHIFT)
+
+//
+// Define the multiplier used to scatter lock keys across the buckets.
+//
+
+#define USER_LOCK_HASH_MULTIPLIER 0x9E3779B1
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -56,8 +70,9 @@ Structure Description:
 
 Members:
 
-    TreeNode - Stores the accounting structure for keeping the entry in a
-        Red-Black tree.
+    ListEntry - Stores pointers to the next and previous waiters in the hash
+        bucket. The next pointer is set to NULL once the waiter has been
+        removed by a wake.
 
     Object - Stores a pointer to the object this lock is tied to. This is a
         process for a process local lock, an image section for a lock in a
@@ -67,7 +82,11 @@ Structure Description:
         into the image section, or 3) the user mode address in the process
         address space, depending on the type of lock.
 
-    ReferenceCount - Stores the reference count of the object.
+    ReferencedObject - Stores a pointer to the object the lock holds a
+        reference on. This starts out the same as the object, but a requeue
+        operation may move the waiter to another object without transferring
+        the reference. At worst that allows a spurious wake, which user mode
+        must tolerate anyway.
 
     Type - Stores the object type, used when trying to release the lock.
 
@@ -76,13 +95,35 @@ Structure Description:
 --*/
 
 typedef struct _USER_LOCK {
-    RED_BLACK_TREE_NODE TreeNode;
+    LIST_ENTRY ListEntry;
     PVOID Object;
     UINTN Offset;
+    PVOID ReferencedObject;
     USER_LOCK_TYPE Type;
     WAIT_QUEUE WaitQueue;
 } USER_LOCK, *PUSER_LOCK;
 
+/*++
+
+Structure Description:
+
+    This structure defines a hash bucket of user mode lock waiters.
+
+Members:
+
+    Lock - Stores a pointer to the lock serializing waits and wakes on the
+        bucket.
+
+    WaiterList - Stores the head of the list of waiting threads' user locks,
+        in the order they went down.
+
+--*/
+
+typedef struct _USER_LOCK_BUCKET {
+    PQUEUED_LOCK Lock;
+    LIST_ENTRY WaiterList;
+} USER_LOCK_BUCKET, *PUSER_LOCK_BUCKET;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -93,7 +134,12 @@ PspUserLockWait (
     );
 
 KSTATUS
-PspUserLockWake (
+PspUserLockRequeue (
+    PSYSTEM_CALL_USER_LOCK Parameters
+    );
+
+KSTATUS
+PspUserLockWakeOperation (
     PSYSTEM_CALL_USER_LOCK Parameters
     );
 
@@ -109,19 +155,47 @@ PspReleaseUserLockObject (
     PUSER_LOCK Lock
     );
 
-COMPARISON_RESULT
-PspCompareUserLocks (
-    PRED_BLACK_TREE Tree,
-    PRED_BLACK_TREE_NODE FirstNode,
-    PRED_BLACK_TREE_NODE SecondNode
+PUSER_LOCK_BUCKET
+PspGetUserLockBucket (
+    PUSER_LOCK Lock
+    );
+
+VOID
+PspAcquireUserLockBuckets (
+    PUSER_LOCK_BUCKET FirstBucket,
+    PUSER_LOCK_BUCKET SecondBucket
+    );
+
+VOID
+PspReleaseUserLockBuckets (
+    PUSER_LOCK_BUCKET FirstBucket,
+    PUSER_LOCK_BUCKET SecondBucket
+    );
+
+ULONG
+PspWakeUserLockWaiters (
+    PUSER_LOCK_BUCKET Bucket,
+    PUSER_LOCK Lock,
+    ULONG Count
+    );
+
+VOID
+PspRemoveUserLockWaiter (
+    PUSER_LOCK Lock
+    );
+
+KSTATUS
+PspApplyUserLockWakeOperation (
+    PULONG Address,
+    ULONG Argument,
+    PBOOL Wake
     );
 
 //
 // -------------------------------------------------------------------- Globals
 //
 
-PQUEUED_LOCK PsUserLockLock;
-RED_BLACK_TREE PsUserLockTree;
+USER_LOCK_BUCKET PsUserLockBuckets[USER_LOCK_BUCKET_COUNT];
 
 //
 // ------------------------------------------------------------------ Functions
@@ -169,6 +243,14 @@ Return Value:
         Status = PspUserLockWake(Parameters);
         break;
 
+    case UserLockRequeue:
+        Status = PspUserLockRequeue(Parameters);
+        break;
+
+    case UserLockWakeOperation:
+        Status = PspUserLockWakeOperation(Parameters);
+        break;
+
     default:
         Status = STATUS_INVALID_PARAMETER;
         break;
@@ -200,11 +282,18 @@ Return Value:
 
 {
 
-    PsUserLockLock = KeCreateQueuedLock();
+    PUSER_LOCK_BUCKET Bucket;
+    ULONG Index;
 
-    ASSERT(PsUserLockLock != NULL);
+    for (Index = 0; Index < USER_LOCK_BUCKET_COUNT; Index += 1) {
+        Bucket = &(PsUserLockBuckets[Index]);
+        Bucket->Lock = KeCreateQueuedLock();
+
+        ASSERT(Bucket->Lock != NULL);
+
+        INITIALIZE_LIST_HEAD(&(Bucket->WaiterList));
+    }
 
-    RtlRedBlackTreeInitialize(&PsUserLockTree, 0, PspCompareUserLocks);
     return;
 }
 
@@ -231,8 +320,7 @@ Return Value:
 
 {
 
-    PUSER_LOCK FoundLock;
-    PRED_BLACK_TREE_NODE FoundNode;
+    PUSER_LOCK_BUCKET Bucket;
     USER_LOCK Lock;
     BOOL Private;
     ULONG ProcessesReleased;
@@ -252,37 +340,13 @@ Return Value:
     // Release the specified number of processes.
     //
 
-    ProcessesReleased = 0;
-    KeAcquireQueuedLock(PsUserLockLock);
-    while (Parameters->Value != 0) {
-        FoundNode = RtlRedBlackTreeSearch(&PsUserLockTree, &(Lock.TreeNode));
-        if (FoundNode == NULL) {
-            break;
-        }
-
-        //
-        // Remove it from the tree first. The locks are stack allocated, so as
-        // soon as the thread is made ready the memory could go invalid.
-        //
-
-        FoundLock = RED_BLACK_TREE_VALUE(FoundNode, USER_LOCK, TreeNode);
-        RtlRedBlackTreeRemove(&PsUserLockTree, FoundNode);
-        ObSignalQueue(&(FoundLock->WaitQueue), SignalOptionSignalAll);
+    Bucket = PspGetUserLockBucket(&Lock);
+    KeAcquireQueuedLock(Bucket->Lock);
+    ProcessesReleased = PspWakeUserLockWaiters(Bucket,
+                                               &Lock,
+                                               Parameters->Value);
 
-        //
-        // The object can go away as soon as it's known to be removed from the
-        // tree. Make sure this thread is done touching the object before
-        // indicating to the woken thread that it can destroy this memory.
-        //
-
-        FoundNode->Parent = NULL;
-        ProcessesReleased += 1;
-        if (Parameters->Value != MAX_ULONG) {
-            Parameters->Value -= 1;
-        }
-    }
-
-    KeReleaseQueuedLock(PsUserLockLock);
+    KeReleaseQueuedLock(Bucket->Lock);
     PspReleaseUserLockObject(&Lock);
     Parameters->Value = ProcessesReleased;
     return STATUS_SUCCESS;
@@ -315,6 +379,7 @@ Return Value:
 
 {
 
+    PUSER_LOCK_BUCKET Bucket;
     ULONGLONG ElapsedTimeInMilliseconds;
     ULONGLONG EndTime;
     ULONGLONG Frequency;
@@ -335,7 +400,8 @@ Return Value:
     }
 
     ObInitializeWaitQueue(&(Lock.WaitQueue), NotSignaled);
-    KeAcquireQueuedLock(PsUserLockLock);
+    Bucket = PspGetUserLockBucket(&Lock);
+    KeAcquireQueuedLock(Bucket->Lock);
 
     //
     // If the read failed, then bail out.
@@ -360,11 +426,11 @@ Return Value:
 
         } else {
             Status = STATUS_SUCCESS;
-            RtlRedBlackTreeInsert(&PsUserLockTree, &(Lock.TreeNode));
+            INSERT_BEFORE(&(Lock.ListEntry), &(Bucket->WaiterList));
         }
     }
 
-    KeReleaseQueuedLock(PsUserLockLock);
+    KeReleaseQueuedLock(Bucket->Lock);
     if (!KSUCCESS(Status)) {
         goto UserLockWaitEnd;
     }
@@ -410,22 +476,236 @@ Return Value:
     }
 
     //
-    // Remove the object from the tree, racing with the parent who may
-    // have already done it to save the extra lock acquire.
+    // Remove the object from its bucket, racing with the waker who may have
+    // already done it to save the extra lock acquire.
     //
 
-    if (Lock.TreeNode.Parent != NULL) {
-        KeAcquireQueuedLock(PsUserLockLock);
-        if (Lock.TreeNode.Parent != NULL) {
-            RtlRedBlackTreeRemove(&PsUserLockTree, &(Lock.TreeNode));
-            Lock.TreeNode.Parent = NULL;
+    if (Lock.ListEntry.Next != NULL) {
+        PspRemoveUserLockWaiter(&Lock);
+    }
+
+UserLockWaitEnd:
+    PspReleaseUserLockObject(&Lock);
+    return Status;
+}
+
+KSTATUS
+PspUserLockRequeue (
+    PSYSTEM_CALL_USER_LOCK Parameters
+    )
+
+/*++
+
+Routine Description:
+
+    This routine wakes up a number of threads blocked on the given user mode
+    address and moves a number of the remaining waiters over to wait on the
+    second address, without waking them. This allows a condition variable
+    broadcast to hand its waiters to the mutex one at a time rather than
+    having them all race for it.
+
+Arguments:
+
+    Parameters - Supplies a pointer to the requeue parameters. The value
+        contains the number of threads to wake, and returns the number woken.
+        The second value contains the maximum number of threads to requeue,
+        and returns the number requeued. The argument contains the value the
+        first address must still hold.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_OPERATION_WOULD_BLOCK if the value at the first address no longer
+    matches the argument.
+
+    Other error codes on failure.
+
+--*/
+
+{
+
+    PUSER_LOCK_BUCKET Bucket;
+    PLIST_ENTRY CurrentEntry;
+    USER_LOCK Lock;
+    BOOL Private;
+    ULONG ProcessesReleased;
+    ULONG ProcessesRequeued;
+    KSTATUS Status;
+    USER_LOCK Target;
+    PUSER_LOCK_BUCKET TargetBucket;
+    ULONG UserValue;
+    PUSER_LOCK Waiter;
+
+    Private = FALSE;
+    if ((Parameters->Operation & USER_LOCK_PRIVATE) != 0) {
+        Private = TRUE;
+    }
+
+    ProcessesReleased = 0;
+    ProcessesRequeued = 0;
+    Status = PspInitializeUserLock(Parameters->Address, Private, &Lock);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Status = PspInitializeUserLock(Parameters->SecondAddress,
+                                   Private,
+                                   &Target);
+
+    if (!KSUCCESS(Status)) {
+        PspReleaseUserLockObject(&Lock);
+        return Status;
+    }
+
+    Bucket = PspGetUserLockBucket(&Lock);
+    TargetBucket = PspGetUserLockBucket(&Target);
+    PspAcquireUserLockBuckets(Bucket, TargetBucket);
+
+    //
+    // Make sure nothing changed since user mode decided to requeue. Waiters
+    // check the value under the same lock, so none can slip in after this.
+    //
+
+    if (MmUserRead32(Parameters->Address, &UserValue) == FALSE) {
+        Status = STATUS_ACCESS_VIOLATION;
+        goto UserLockRequeueEnd;
+    }
+
+    if (UserValue != Parameters->Argument) {
+        Status = STATUS_OPERATION_WOULD_BLOCK;
+        goto UserLockRequeueEnd;
+    }
+
+    ProcessesReleased = PspWakeUserLockWaiters(Bucket,
+                                               &Lock,
+                                               Parameters->Value);
+
+    //
+    // Move the next batch of waiters over to the target, preserving their
+    // order.
+    //
+
+    CurrentEntry = Bucket->WaiterList.Next;
+    while ((CurrentEntry != &(Bucket->WaiterList)) &&
+           (ProcessesRequeued < Parameters->SecondValue)) {
+
+        Waiter = LIST_VALUE(CurrentEntry, USER_LOCK, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if ((Waiter->Object != Lock.Object) ||
+            (Waiter->Offset != Lock.Offset)) {
+
+            continue;
         }
 
-        KeReleaseQueuedLock(PsUserLockLock);
+        LIST_REMOVE(&(Waiter->ListEntry));
+        Waiter->Object = Target.Object;
+        Waiter->Offset = Target.Offset;
+        INSERT_BEFORE(&(Waiter->ListEntry), &(TargetBucket->WaiterList));
+        ProcessesRequeued += 1;
     }
 
-UserLockWaitEnd:
+    Status = STATUS_SUCCESS;
+
+UserLockRequeueEnd:
+    PspReleaseUserLockBuckets(Bucket, TargetBucket);
+    PspReleaseUserLockObject(&Target);
+    PspReleaseUserLockObject(&Lock);
+    Parameters->Value = ProcessesReleased;
+    Parameters->SecondValue = ProcessesRequeued;
+    return Status;
+}
+
+KSTATUS
+PspUserLockWakeOperation (
+    PSYSTEM_CALL_USER_LOCK Parameters
+    )
+
+/*++
+
+Routine Description:
+
+    This routine atomically modifies the value at the second address, wakes
+    threads blocked on the first address, and then conditionally wakes
+    threads blocked on the second address based on the value the second
+    address held before the modification.
+
+Arguments:
+
+    Parameters - Supplies a pointer to the wake parameters. The value contains
+        the number of threads to wake on the first address, and the second
+        value the number to wake on the second address. On output they return
+        the number of threads actually woken on each. The argument contains
+        the packed USER_LOCK_WAKE_OP describing the modification and
+        comparison.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PUSER_LOCK_BUCKET Bucket;
+    USER_LOCK Lock;
+    BOOL Private;
+    ULONG ProcessesReleased;
+    ULONG SecondProcessesReleased;
+    KSTATUS Status;
+    USER_LOCK Target;
+    PUSER_LOCK_BUCKET TargetBucket;
+    BOOL WakeTarget;
+
+    Private = FALSE;
+    if ((Parameters->Operation & USER_LOCK_PRIVATE) != 0) {
+        Private = TRUE;
+    }
+
+    ProcessesReleased = 0;
+    SecondProcessesReleased = 0;
+    Status = PspInitializeUserLock(Parameters->Address, Private, &Lock);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Status = PspInitializeUserLock(Parameters->SecondAddress,
+                                   Private,
+                                   &Target);
+
+    if (!KSUCCESS(Status)) {
+        PspReleaseUserLockObject(&Lock);
+        return Status;
+    }
+
+    Bucket = PspGetUserLockBucket(&Lock);
+    TargetBucket = PspGetUserLockBucket(&Target);
+    PspAcquireUserLockBuckets(Bucket, TargetBucket);
+    Status = PspApplyUserLockWakeOperation(Parameters->SecondAddress,
+                                           Parameters->Argument,
+                                           &WakeTarget);
+
+    if (!KSUCCESS(Status)) {
+        goto UserLockWakeOperationEnd;
+    }
+
+    ProcessesReleased = PspWakeUserLockWaiters(Bucket,
+                                               &Lock,
+                                               Parameters->Value);
+
+    if (WakeTarget != FALSE) {
+        SecondProcessesReleased = PspWakeUserLockWaiters(
+                                                    TargetBucket,
+                                                    &Target,
+                                                    Parameters->SecondValue);
+    }
+
+UserLockWakeOperationEnd:
+    PspReleaseUserLockBuckets(Bucket, TargetBucket);
+    PspReleaseUserLockObject(&Target);
     PspReleaseUserLockObject(&Lock);
+    Parameters->Value = ProcessesReleased;
+    Parameters->SecondValue = SecondProcessesReleased;
     return Status;
 }
 
@@ -463,6 +743,7 @@ Return Value:
 
     BOOL Shared;
 
+    Lock->ListEntry.Next = NULL;
     if (Private != FALSE) {
         Lock->Object = PsGetCurrentProcess();
         Lock->Offset = (UINTN)Address;
@@ -482,6 +763,7 @@ Return Value:
         }
     }
 
+    Lock->ReferencedObject = Lock->Object;
     return STATUS_SUCCESS;
 }
 
@@ -524,7 +806,7 @@ Return Value:
         //
 
     case UserLockTypeImageSection:
-        MmReleaseObjectReference(Lock->Object, Shared);
+        MmReleaseObjectReference(Lock->ReferencedObject, Shared);
         break;
 
     default:
@@ -537,62 +819,359 @@ Return Value:
     return;
 }
 
-COMPARISON_RESULT
-PspCompareUserLocks (
-    PRED_BLACK_TREE Tree,
-    PRED_BLACK_TREE_NODE FirstNode,
-    PRED_BLACK_TREE_NODE SecondNode
+PUSER_LOCK_BUCKET
+PspGetUserLockBucket (
+    PUSER_LOCK Lock
     )
 
 /*++
 
 Routine Description:
 
-    This routine compares two Red-Black tree nodes that in this case are user
-    mode lock objects.
+    This routine returns the hash bucket a user lock belongs in.
 
 Arguments:
 
-    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+    Lock - Supplies a pointer to the user lock.
+
+Return Value:
+
+    Returns a pointer to the bucket.
+
+--*/
+
+{
+
+    ULONG Hash;
+
+    Hash = (ULONG)((UINTN)(Lock->Object) >> 4) + (ULONG)(Lock->Offset >> 2);
+    Hash *= USER_LOCK_HASH_MULTIPLIER;
+    return &(PsUserLockBuckets[Hash >> (32 - USER_LOCK_BUCKET_SHIFT)]);
+}
+
+VOID
+PspAcquireUserLockBuckets (
+    PUSER_LOCK_BUCKET FirstBucket,
+    PUSER_LOCK_BUCKET SecondBucket
+    )
+
+/*++
 
-    FirstNode - Supplies a pointer to the left side of the comparison.
+Routine Description:
+
+    This routine acquires the locks for two user lock buckets, always in the
+    same order to avoid deadlocks.
+
+Arguments:
+
+    FirstBucket - Supplies a pointer to one of the buckets.
 
-    SecondNode - Supplies a pointer to the second side of the comparison.
+    SecondBucket - Supplies a pointer to the other bucket, which may be the
+        same as the first.
 
 Return Value:
 
-    Same if the two nodes have the same value.
+    None.
 
-    Ascending if the first node is less than the second node.
+--*/
+
+{
+
+    if (FirstBucket == SecondBucket) {
+        KeAcquireQueuedLock(FirstBucket->Lock);
+
+    } else if (FirstBucket < SecondBucket) {
+        KeAcquireQueuedLock(FirstBucket->Lock);
+        KeAcquireQueuedLock(SecondBucket->Lock);
+
+    } else {
+        KeAcquireQueuedLock(SecondBucket->Lock);
+        KeAcquireQueuedLock(FirstBucket->Lock);
+    }
 
-    Descending if the second node is less than the first node.
+    return;
+}
+
+VOID
+PspReleaseUserLockBuckets (
+    PUSER_LOCK_BUCKET FirstBucket,
+    PUSER_LOCK_BUCKET SecondBucket
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases the locks for two user lock buckets acquired
+    together.
+
+Arguments:
+
+    FirstBucket - Supplies a pointer to one of the buckets.
+
+    SecondBucket - Supplies a pointer to the other bucket, which may be the
+        same as the first.
+
+Return Value:
+
+    None.
 
 --*/
 
 {
 
-    PUSER_LOCK FirstLock;
-    PUSER_LOCK SecondLock;
+    KeReleaseQueuedLock(FirstBucket->Lock);
+    if (SecondBucket != FirstBucket) {
+        KeReleaseQueuedLock(SecondBucket->Lock);
+    }
 
-    //
-    // Compare raw pointers to the objects first.
-    //
+    return;
+}
+
+ULONG
+PspWakeUserLockWaiters (
+    PUSER_LOCK_BUCKET Bucket,
+    PUSER_LOCK Lock,
+    ULONG Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine wakes threads waiting on the given user lock, oldest first.
+    The bucket lock must be held.
+
+Arguments:
+
+    Bucket - Supplies a pointer to the bucket the lock hashes to.
+
+    Lock - Supplies a pointer to the lock to wake waiters of.
+
+    Count - Supplies the maximum number of threads to wake. Supply MAX_ULONG
+        to wake everyone.
+
+Return Value:
+
+    Returns the number of threads woken.
 
-    FirstLock = RED_BLACK_TREE_VALUE(FirstNode, USER_LOCK, TreeNode);
-    SecondLock = RED_BLACK_TREE_VALUE(SecondNode, USER_LOCK, TreeNode);
-    if (FirstLock->Object < SecondLock->Object) {
-        return ComparisonResultAscending;
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    ULONG ProcessesReleased;
+    PUSER_LOCK Waiter;
+
+    ASSERT(KeIsQueuedLockHeld(Bucket->Lock) != FALSE);
 
-    } else if (FirstLock->Object > SecondLock->Object) {
-        return ComparisonResultDescending;
+    ProcessesReleased = 0;
+    CurrentEntry = Bucket->WaiterList.Next;
+    while ((CurrentEntry != &(Bucket->WaiterList)) &&
+           (ProcessesReleased < Count)) {
+
+        Waiter = LIST_VALUE(CurrentEntry, USER_LOCK, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if ((Waiter->Object != Lock->Object) ||
+            (Waiter->Offset != Lock->Offset)) {
 
-    } else if (FirstLock->Offset > SecondLock->Offset) {
-        return ComparisonResultDescending;
+            continue;
+        }
 
-    } else if (FirstLock->Offset < SecondLock->Offset) {
-        return ComparisonResultAscending;
+        //
+        // Remove it from the list first. The locks are stack allocated, so as
+        // soon as the thread is made ready the memory could go invalid.
+        //
+
+        LIST_REMOVE(&(Waiter->ListEntry));
+        ObSignalQueue(&(Waiter->WaitQueue), SignalOptionSignalAll);
+
+        //
+        // The object can go away as soon as it's known to be removed from the
+        // list. Make sure this thread is done touching the object before
+        // indicating to the woken thread that it can destroy this memory.
+        //
+
+        RtlMemoryBarrier();
+        Waiter->ListEntry.Next = NULL;
+        ProcessesReleased += 1;
     }
 
-    return ComparisonResultSame;
+    return ProcessesReleased;
 }
 
+VOID
+PspRemoveUserLockWaiter (
+    PUSER_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a user lock from whichever bucket it is waiting in,
+    if a waker has not already removed it. A requeue may move the lock to a
+    different bucket at any time, so the bucket is rechecked once its lock is
+    held.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to remove.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PUSER_LOCK_BUCKET Bucket;
+
+    while (Lock->ListEntry.Next != NULL) {
+        Bucket = PspGetUserLockBucket(Lock);
+        KeAcquireQueuedLock(Bucket->Lock);
+        if ((Lock->ListEntry.Next != NULL) &&
+            (PspGetUserLockBucket(Lock) == Bucket)) {
+
+            LIST_REMOVE(&(Lock->ListEntry));
+            Lock->ListEntry.Next = NULL;
+        }
+
+        KeReleaseQueuedLock(Bucket->Lock);
+    }
+
+    return;
+}
+
+KSTATUS
+PspApplyUserLockWakeOperation (
+    PULONG Address,
+    ULONG Argument,
+    PBOOL Wake
+    )
+
+/*++
+
+Routine Description:
+
+    This routine atomically applies the modification described by a packed
+    wake operation argument to a user mode value, and evaluates the
+    comparison against the original value.
+
+Arguments:
+
+    Address - Supplies the user mode address to modify.
+
+    Argument - Supplies the packed USER_LOCK_WAKE_OP argument.
+
+    Wake - Supplies a pointer where a boolean will be returned indicating
+        whether the comparison held and the waiters on the address should be
+        woken.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if the operation or comparison is not valid.
+
+    STATUS_ACCESS_VIOLATION if the address could not be accessed.
+
+--*/
+
+{
+
+    USER_LOCK_WAKE_OP_COMPARISON Comparison;
+    ULONG CompareValue;
+    ULONG NewValue;
+    ULONG OldValue;
+    ULONG Operand;
+    USER_LOCK_WAKE_OP_OPERATION Operation;
+    ULONG Value;
+
+    *Wake = FALSE;
+    Operation = (Argument >> USER_LOCK_WAKE_OP_OPERATION_SHIFT) &
+                USER_LOCK_WAKE_OP_FIELD_MASK;
+
+    Comparison = (Argument >> USER_LOCK_WAKE_OP_COMPARISON_SHIFT) &
+                 USER_LOCK_WAKE_OP_FIELD_MASK;
+
+    Operand = (Argument >> USER_LOCK_WAKE_OP_OPERAND_SHIFT) &
+              USER_LOCK_WAKE_OP_VALUE_MASK;
+
+    CompareValue = Argument & USER_LOCK_WAKE_OP_VALUE_MASK;
+    if ((Operation > UserLockWakeOpXor) ||
+        (Comparison > UserLockWakeOpGreaterOrEqual)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (MmUserRead32(Address, &OldValue) == FALSE) {
+        return STATUS_ACCESS_VIOLATION;
+    }
+
+    while (TRUE) {
+        switch (Operation) {
+        case UserLockWakeOpSet:
+            NewValue = Operand;
+            break;
+
+        case UserLockWakeOpAdd:
+            NewValue = OldValue + Operand;
+            break;
+
+        case UserLockWakeOpOr:
+            NewValue = OldValue | Operand;
+            break;
+
+        case UserLockWakeOpAndNot:
+            NewValue = OldValue & ~Operand;
+            break;
+
+        case UserLockWakeOpXor:
+        default:
+            NewValue = OldValue ^ Operand;
+            break;
+        }
+
+        Value = OldValue;
+        if (MmUserCompareExchange32(Address, &Value, NewValue) == FALSE) {
+            return STATUS_ACCESS_VIOLATION;
+        }
+
+        if (Value == OldValue) {
+            break;
+        }
+
+        OldValue = Value;
+    }
+
+    switch (Comparison) {
+    case UserLockWakeOpEqual:
+        *Wake = (OldValue == CompareValue);
+        break;
+
+    case UserLockWakeOpNotEqual:
+        *Wake = (OldValue != CompareValue);
+        break;
+
+    case UserLockWakeOpLessThan:
+        *Wake = (OldValue < CompareValue);
+        break;
+
+    case UserLockWakeOpLessOrEqual:
+        *Wake = (OldValue <= CompareValue);
+        break;
+
+    case UserLockWakeOpGreaterThan:
+        *Wake = (OldValue > CompareValue);
+        break;
+
+    case UserLockWakeOpGreaterOrEqual:
+    default:
+        *Wake = (OldValue >= CompareValue);
+        break;
+    }
+
+    return STATUS_SUCCESS;
+}
@@ -1632,6 +1632,17 @@ Return Value:
         ArRestoreFpuState = ArRestoreX87State;
     }
 
+    //
+    // Enable 4MB pages if the processor supports them. The memory manager
+    // checks this bit before creating any large page mappings.
+    //
+
+    if ((Edx & X86_CPUID_BASIC_EDX_PAGE_SIZE_EXTENSIONS) != 0) {
+        Cr4 = ArGetControlRegister4();
+        Cr4 |= CR4_PAGE_SIZE_EXTENSIONS;
+        ArSetControlRegister4(Cr4);
+    }
+
     return;
 }
 